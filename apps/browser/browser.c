@@ -15,11 +15,15 @@
 #include "browser.h"
 #include "kernel/ui/compositor.h"
 #include "kernel/gfx/framebuffer.h"
+#include "kernel/gfx/text.h"
+#include "kernel/gfx/raster.h"
 #include "kernel/drivers/net.h"
 #include "kernel/net/net_stack.h"
 #include "kernel/drivers/timer.h"
 #include "kernel/mem/heap.h"
+#include "kernel/sched/kthread.h"
 #include "kernel/drivers/keyboard.h"
+#include "kernel/fs/vfs.h"
 
 /* ── String Helpers (freestanding) ───────────────────────────────────── */
 static int str_len(const char *s) { int n = 0; while (s[n]) n++; return n; }
@@ -30,6 +34,14 @@ static void str_cpy(char *d, const char *s)
     *d = 0;
 }
 
+/* Copy at most n - 1 characters; d is always terminated */
+static void str_ncpy(char *d, const char *s, int n)
+{
+    int i = 0;
+    for (; s[i] && i < n - 1; i++) d[i] = s[i];
+    d[i] = 0;
+}
+
 static int str_cmp(const char *a, const char *b)
 {
     while (*a && *a == *b) { a++; b++; }
@@ -92,49 +104,25 @@ static void draw_hline(uint32_t *canvas, int cw, int ch,
     }
 }
 
-/* 8x16 font glyph accessor (from framebuffer.c) */
-extern const uint8_t font_8x16[95][16];
-
+/* Browser text is unsmoothed: solid glyphs from the shared atlas */
 static void canvas_draw_char(uint32_t *canvas, int cw, int ch,
                              int x, int y, char c, uint32_t fg)
 {
     if (c < 32 || c > 126) return;
-    const uint8_t *glyph = font_8x16[c - 32];
-    for (int row = 0; row < 16; row++) {
-        int py = y + row;
-        if (py < 0 || py >= ch) continue;
-        uint8_t bits = glyph[row];
-        for (int col = 0; col < 8; col++) {
-            if (bits & (0x80 >> col)) {
-                int px = x + col;
-                if (px >= 0 && px < cw)
-                    canvas[py * cw + px] = fg;
-            }
-        }
-    }
+    text_draw_canvas(canvas, cw, ch, x, y, &c, 1, fg, TEXT_SOLID);
 }
 
 static void canvas_draw_string(uint32_t *canvas, int cw, int ch,
                                int x, int y, const char *s, uint32_t fg)
 {
-    for (int i = 0; s[i]; i++) {
-        canvas_draw_char(canvas, cw, ch, x + i * 8, y, s[i], fg);
-    }
-}
-
-/* Bold: draw character twice with 1px offset */
-static void canvas_draw_char_bold(uint32_t *canvas, int cw, int ch,
-                                  int x, int y, char c, uint32_t fg)
-{
-    canvas_draw_char(canvas, cw, ch, x, y, c, fg);
-    canvas_draw_char(canvas, cw, ch, x + 1, y, c, fg);
+    text_draw_canvas(canvas, cw, ch, x, y, s, -1, fg, TEXT_SOLID);
 }
 
 /* ── Browser State ───────────────────────────────────────────────────── */
 static window_t *browser_win = 0;
 
 #define URL_MAX      512
-#define PAGE_BUF_SIZE 65536
+#define PAGE_MAX     (4u << 20)   /* Larger pages are cut off */
 #define TITLE_MAX    128
 #define TOOLBAR_H    32
 #define STATUS_H     20
@@ -149,8 +137,12 @@ static int  url_focused = 1;
 static int  url_select_all = 0;       /* URL bar select-all flag */
 static int  input_select_all = 0;     /* Form input select-all flag */
 
-static char page_buf[PAGE_BUF_SIZE];
-static int  page_len = 0;
+/* The page source lives on the heap and grows to fit (see page_reserve) */
+static char  page_empty[1];
+static char *page_buf = page_empty;
+static int   page_cap = 0;
+static int   page_len = 0;
+static int   page_streaming = 0;   /* page_buf is still being downloaded into */
 
 static char page_title[TITLE_MAX];
 static int  scroll_y = 0;
@@ -174,6 +166,7 @@ typedef struct {
     char value[FORM_INPUT_MAX];      /* Current value */
     int is_submit;                   /* 1 if submit button */
     int user_modified;               /* 1 if user has typed into this input */
+    char placeholder[64];
 } form_input_t;
 static form_input_t form_inputs[MAX_FORM_INPUTS];
 static int form_input_count = 0;
@@ -195,7 +188,7 @@ static char saved_focused_name[64]; /* Name of focused input to restore */
 static char hover_url[URL_MAX];
 
 /* CSS style rules parsed from <style> blocks */
-#define MAX_CSS_RULES 64
+#define CSS_HASH_BUCKETS 256
 #define CSS_SELECTOR_MAX 32
 #define CSS_VALUE_MAX 64
 typedef struct {
@@ -214,9 +207,15 @@ typedef struct {
     int margin_right; /* pixels, -1=no change */
     int padding_left;
     int padding_right;
+    int hash_next;   /* Next rule in the same css_hash bucket, -1 ends */
 } css_rule_t;
-static css_rule_t css_rules[MAX_CSS_RULES];
-static int css_rule_count = 0;
+
+/* One rule per distinct selector on the heap, hashed by selector text
+ * ("p", ".note", "#main"); later declarations are merged into it.    */
+static css_rule_t *css_rules;
+static int css_rule_count = 0, css_rule_cap = 0;
+static int css_hash[CSS_HASH_BUCKETS];
+static uint32_t css_gen;         /* Bumped whenever any rule changes */
 
 /* Navigation states */
 #define NAV_IDLE     0
@@ -226,6 +225,18 @@ static int css_rule_count = 0;
 static int nav_state = NAV_IDLE;
 static char status_msg[128];
 
+/* Background fetch: navigate_internal queues a request for the fetch
+ * thread, which downloads into fetch_rope and streams the body into
+ * page_buf as it arrives (see fetch_body).
+ * nav_gen tells a finished fetch whether it is still the latest one. */
+static rope_t          fetch_rope;
+static char            fetch_url[URL_MAX];
+static int             fetch_push_history = 0;
+static uint32_t        fetch_gen = 0;
+static uint32_t        nav_gen = 0;
+static int             fetch_thread_id = -1;
+static kthread_event_t fetch_event;
+
 /* History stack for back/forward */
 #define HISTORY_MAX 32
 static char history_urls[HISTORY_MAX][URL_MAX];
@@ -423,6 +434,7 @@ static void restore_focused_input(void)
         if (str_cmp(form_inputs[i].name, saved_focused_name) == 0 &&
             !form_inputs[i].is_submit) {
             focused_input = i;
+            saved_focused_name[0] = 0;
             return;
         }
     }
@@ -439,10 +451,90 @@ static void css_skip_whitespace(const char *s, int *pos, int len)
            s[*pos] == '\n' || s[*pos] == '\r')) (*pos)++;
 }
 
+static void css_reset(void)
+{
+    css_rule_count = 0;
+    for (int i = 0; i < CSS_HASH_BUCKETS; i++) css_hash[i] = -1;
+    css_gen++;
+}
+
+/* Selectors are stored lower case; names from the page are folded too */
+static uint32_t css_hash_name(char prefix, const char *name)
+{
+    uint32_t h = 2166136261u;
+    if (prefix) { h ^= (uint8_t)prefix; h *= 16777619u; }
+    for (; *name; name++) {
+        char c = *name;
+        if (c >= 'A' && c <= 'Z') c += 32;
+        h ^= (uint8_t)c;
+        h *= 16777619u;
+    }
+    return h % CSS_HASH_BUCKETS;
+}
+
+/* The rule whose selector is `prefix` (0, '.' or '#') followed by `name` */
+static css_rule_t *css_find(char prefix, const char *name)
+{
+    if (!css_rule_count) return 0;
+    int len = str_len(name);
+    for (int i = css_hash[css_hash_name(prefix, name)]; i >= 0; i = css_rules[i].hash_next) {
+        const char *sel = css_rules[i].selector;
+        if (prefix) {
+            if (sel[0] != prefix) continue;
+            sel++;
+        }
+        if (str_len(sel) == len && str_ncasecmp(sel, name, len) == 0)
+            return &css_rules[i];
+    }
+    return 0;
+}
+
+/* Add a rule, or merge it into the one already held for `selector`:
+ * properties the new block sets win, as later rules do in the cascade. */
+static void css_add_rule(const char *selector, const css_rule_t *parsed)
+{
+    char prefix = (selector[0] == '.' || selector[0] == '#') ? selector[0] : 0;
+    const char *name = prefix ? selector + 1 : selector;
+    if (!name[0]) return;
+
+    css_rule_t *rule = css_find(prefix, name);
+    if (rule) {
+        if (parsed->has_color) { rule->has_color = 1; rule->color = parsed->color; }
+        if (parsed->has_bg_color) { rule->has_bg_color = 1; rule->bg_color = parsed->bg_color; }
+        if (parsed->bold >= 0) rule->bold = parsed->bold;
+        if (parsed->italic >= 0) rule->italic = parsed->italic;
+        if (parsed->underline >= 0) rule->underline = parsed->underline;
+        if (parsed->text_align) rule->text_align = parsed->text_align;
+        if (parsed->display_none) rule->display_none = 1;
+        if (parsed->font_size) rule->font_size = parsed->font_size;
+        if (parsed->margin_left >= 0) rule->margin_left = parsed->margin_left;
+        if (parsed->margin_right >= 0) rule->margin_right = parsed->margin_right;
+        if (parsed->padding_left > 0) rule->padding_left = parsed->padding_left;
+        if (parsed->padding_right > 0) rule->padding_right = parsed->padding_right;
+        css_gen++;
+        return;
+    }
+
+    if (css_rule_count == css_rule_cap) {
+        int cap = css_rule_cap ? css_rule_cap * 2 : 64;
+        css_rule_t *n = (css_rule_t *)krealloc(css_rules, (size_t)cap * sizeof(css_rule_t));
+        if (!n) return;
+        css_rules = n;
+        css_rule_cap = cap;
+    }
+    uint32_t b = css_hash_name(prefix, name);
+    rule = &css_rules[css_rule_count];
+    *rule = *parsed;
+    str_cpy(rule->selector, selector);
+    rule->hash_next = css_hash[b];
+    css_hash[b] = css_rule_count++;
+    css_gen++;
+}
+
 static void parse_css_block(const char *css, int css_len)
 {
     int pos = 0;
-    while (pos < css_len && css_rule_count < MAX_CSS_RULES) {
+    while (pos < css_len) {
         css_skip_whitespace(css, &pos, css_len);
         if (pos >= css_len) break;
 
@@ -686,53 +778,30 @@ static void parse_css_block(const char *css, int css_len)
             }
         }
 
-        /* Create a rule for each selector */
-        for (int s = 0; s < sel_count && css_rule_count < MAX_CSS_RULES; s++) {
-            css_rule_t *rule = &css_rules[css_rule_count];
-            *rule = parsed;
-            str_cpy(rule->selector, selectors[s]);
-            css_rule_count++;
-        }
+        /* Create (or extend) a rule for each selector */
+        for (int s = 0; s < sel_count; s++)
+            css_add_rule(selectors[s], &parsed);
     }
 }
 
-/* Look up a CSS rule for a given tag name and apply it.
-   Also checks class-based rules: .classname matches if tag has class="classname". */
+/* Look up the rule for a tag name (already lower case) */
 static css_rule_t *css_lookup(const char *tag_name)
 {
-    for (int i = 0; i < css_rule_count; i++) {
-        if (str_cmp(css_rules[i].selector, tag_name) == 0)
-            return &css_rules[i];
-    }
-    return 0;
+    return css_find(0, tag_name);
 }
 
 /* Look up CSS rule by class name (selector starts with '.') */
 static css_rule_t *css_lookup_class(const char *class_name)
 {
     if (!class_name || !class_name[0]) return 0;
-    for (int i = 0; i < css_rule_count; i++) {
-        if (css_rules[i].selector[0] == '.') {
-            if (str_ncasecmp(css_rules[i].selector + 1, class_name,
-                str_len(css_rules[i].selector + 1)) == 0)
-                return &css_rules[i];
-        }
-    }
-    return 0;
+    return css_find('.', class_name);
 }
 
 /* Look up CSS rule by ID (selector starts with '#') */
 static css_rule_t *css_lookup_id(const char *id_name)
 {
     if (!id_name || !id_name[0]) return 0;
-    for (int i = 0; i < css_rule_count; i++) {
-        if (css_rules[i].selector[0] == '#') {
-            if (str_ncasecmp(css_rules[i].selector + 1, id_name,
-                str_len(css_rules[i].selector + 1)) == 0)
-                return &css_rules[i];
-        }
-    }
-    return 0;
+    return css_find('#', id_name);
 }
 
 /* Apply a CSS rule to the current render state */
@@ -743,20 +812,18 @@ static void apply_inline_style(const char *tag, int tag_len);
 
 /* ── HTML Renderer ───────────────────────────────────────────────────── */
 /*
- * Streaming HTML renderer. Parses tags and renders text
- * directly into the window canvas.
+ * Streaming HTML renderer. Parses tags and lays text out into the
+ * display list, in content coordinates.
  * Supports basic centering via two-pass line measurement.
  */
 
 /* Render state */
 typedef struct {
-    uint32_t *canvas;
-    int cw, ch;
+    int cw, ch;            /* Canvas width, layout extent */
     int x, y;              /* Current cursor position */
     int start_x;           /* Left margin */
     int max_x;             /* Right margin */
     int line_height;        /* Current line height in pixels */
-    int scroll;            /* Scroll offset */
 
     /* Text style */
     int bold;
@@ -824,6 +891,391 @@ typedef struct {
 
 static render_state_t rs;
 
+/* ── Display List ────────────────────────────────────────────────────── */
+/*
+ * Layout runs once per navigation or width change and records what it
+ * draws here, in content coordinates.  A paint replays only the ops
+ * that intersect the visible band [scroll_y, scroll_y + height).
+ */
+#define DL_LAYOUT_H  (1 << 28)     /* Layout extent: nothing is culled */
+#define DL_MAX_RECT_H 256          /* Taller rects are split, so each op is short */
+#define DL_MAX_OPS   65536
+#define DL_BOLD      1
+#define DL_UNDERLINE 2
+#define DL_STRIKE    4
+
+enum { DL_RECT, DL_TEXT, DL_INPUT };
+
+typedef struct {
+    uint8_t  type;
+    uint8_t  style;            /* DL_TEXT: DL_BOLD | DL_UNDERLINE | DL_STRIKE */
+    uint16_t len;              /* DL_TEXT: characters at dl_text + off */
+    int      x, y, w, h;
+    uint32_t color;
+    uint32_t off;              /* DL_TEXT: text offset; DL_INPUT: form input */
+    int      bottom_max;       /* Largest y + h of the ops up to here */
+    int      top_min;          /* Smallest y of the ops from here on  */
+} dl_op_t;
+
+static dl_op_t *dl_ops;
+static int      dl_count, dl_cap;
+static char    *dl_text;
+static uint32_t dl_text_len, dl_text_cap;
+static int      dl_valid;      /* Cleared whenever page_buf changes */
+static int      dl_width;      /* Canvas width the list was laid out for */
+static uint32_t dl_bg;         /* Page background, filled before any op */
+
+static int      dl_finished;   /* Ops already covered by dl_finish() */
+
+/* ── Raster Tile Cache ───────────────────────────────────────────────── */
+/*
+ * The laid-out page is rasterised in TILE_H-pixel strips that are kept,
+ * least recently used first out, within tile_budget bytes.  A paint
+ * copies the strips covering the visible band and rasterises only the
+ * ones not cached, so scrolling over a cached page is a copy.  Form
+ * inputs change without a re-layout and are drawn over the tiles.
+ */
+#define TILE_H      256
+#define TILE_SLOTS  64
+
+typedef struct {
+    uint32_t *pix;             /* width x TILE_H, or 0 */
+    int       width;
+    int       strip;           /* Content rows [strip * TILE_H, +TILE_H) */
+    int       valid;
+    uint64_t  last_use;
+} tile_t;
+
+static tile_t   tiles[TILE_SLOTS];
+static uint32_t tile_budget = BROWSER_TILE_BUDGET;
+static uint32_t tile_bytes;    /* Held by allocated tiles */
+static uint64_t tile_clock;
+
+static void tile_free(tile_t *t)
+{
+    if (!t->pix) return;
+    kfree(t->pix);
+    tile_bytes -= (uint32_t)t->width * TILE_H * 4;
+    t->pix = 0;
+    t->valid = 0;
+}
+
+static void tile_release_all(void)
+{
+    for (int i = 0; i < TILE_SLOTS; i++) tile_free(&tiles[i]);
+}
+
+/* Drop the strips that reach down to content row y or below */
+static void tile_invalidate_from(int y)
+{
+    for (int i = 0; i < TILE_SLOTS; i++)
+        if (tiles[i].valid && (tiles[i].strip + 1) * TILE_H > y) tiles[i].valid = 0;
+}
+
+void browser_set_tile_budget(uint32_t bytes)
+{
+    tile_budget = bytes;
+    tile_release_all();
+}
+
+static void dl_reset(uint32_t bg)
+{
+    dl_count = 0;
+    dl_text_len = 0;
+    dl_finished = 0;
+    dl_bg = bg;
+    tile_invalidate_from(-DL_LAYOUT_H);
+}
+
+static dl_op_t *dl_push(void)
+{
+    if (dl_count == dl_cap) {
+        if (dl_cap >= DL_MAX_OPS) return (void *)0;
+        int cap = dl_cap ? dl_cap * 2 : 1024;
+        dl_op_t *n = (dl_op_t *)krealloc(dl_ops, (size_t)cap * sizeof(dl_op_t));
+        if (!n) return (void *)0;
+        dl_ops = n;
+        dl_cap = cap;
+    }
+    return &dl_ops[dl_count++];
+}
+
+static void dl_rect(int x, int y, int w, int h, uint32_t color)
+{
+    if (w <= 0 || h <= 0) return;
+    while (h > DL_MAX_RECT_H) {
+        dl_rect(x, y, w, DL_MAX_RECT_H, color);
+        y += DL_MAX_RECT_H;
+        h -= DL_MAX_RECT_H;
+    }
+
+    /* Rows of pixels and adjoining segments collapse into one rect */
+    if (dl_count) {
+        dl_op_t *p = &dl_ops[dl_count - 1];
+        if (p->type == DL_RECT && p->y == y && p->h == h && p->color == color &&
+            p->x + p->w == x) {
+            p->w += w;
+            return;
+        }
+    }
+    dl_op_t *op = dl_push();
+    if (!op) return;
+    op->type = DL_RECT;
+    op->x = x; op->y = y; op->w = w; op->h = h;
+    op->color = color;
+}
+
+static void dl_hline(int x, int y, int w, uint32_t color)
+{
+    dl_rect(x, y, w, 1, color);
+}
+
+static void dl_chars(int x, int y, const char *s, int len, uint32_t fg, int style)
+{
+    if (len <= 0) return;
+    if (dl_text_len + (uint32_t)len > dl_text_cap) {
+        uint32_t cap = dl_text_cap ? dl_text_cap : 16384;
+        while (cap < dl_text_len + (uint32_t)len) cap *= 2;
+        char *n = (char *)krealloc(dl_text, cap);
+        if (!n) return;
+        dl_text = n;
+        dl_text_cap = cap;
+    }
+
+    /* Characters continuing the previous run extend it */
+    int adv = (style & DL_BOLD) ? 9 : 8;
+    dl_op_t *op = (void *)0;
+    if (dl_count) {
+        dl_op_t *p = &dl_ops[dl_count - 1];
+        if (p->type == DL_TEXT && p->y == y && p->color == fg && p->style == style &&
+            p->x + p->len * adv == x && p->off + p->len == dl_text_len &&
+            p->len + len <= 0xFFFF)
+            op = p;
+    }
+    if (!op) {
+        op = dl_push();
+        if (!op) return;
+        op->type = DL_TEXT;
+        op->style = (uint8_t)style;
+        op->len = 0;
+        op->x = x; op->y = y; op->h = TEXT_GLYPH_H;
+        op->color = fg;
+        op->off = dl_text_len;
+    }
+    for (int i = 0; i < len; i++) dl_text[dl_text_len++] = s[i];
+    op->len = (uint16_t)(op->len + len);
+    op->w = op->len * adv;
+}
+
+static void dl_char(int x, int y, char c, uint32_t fg, int style)
+{
+    if (c < 32 || c > 126) return;
+    dl_chars(x, y, &c, 1, fg, style);
+}
+
+static void dl_string(int x, int y, const char *s, uint32_t fg)
+{
+    dl_chars(x, y, s, str_len(s), fg, 0);
+}
+
+/* Text input whose value, focus and cursor are drawn at paint time */
+static void dl_input(int x, int y, int w, int h, int index)
+{
+    dl_op_t *op = dl_push();
+    if (!op) return;
+    op->type = DL_INPUT;
+    op->x = x; op->y = y; op->w = w; op->h = h;
+    op->off = (uint32_t)index;
+}
+
+/* Build the slice index once layout is complete */
+static void dl_finish(void)
+{
+    /* Strips showing the ops added (or merged into) since the last call */
+    int dirty = DL_LAYOUT_H;
+    for (int i = dl_finished > 0 ? dl_finished - 1 : 0; i < dl_count; i++)
+        if (dl_ops[i].y < dirty) dirty = dl_ops[i].y;
+    dl_finished = dl_count;
+    tile_invalidate_from(dirty);
+
+    int bottom = -DL_LAYOUT_H;
+    for (int i = 0; i < dl_count; i++) {
+        dl_op_t *op = &dl_ops[i];
+        if (op->y + op->h > bottom) bottom = op->y + op->h;
+        op->bottom_max = bottom;
+    }
+    int top = DL_LAYOUT_H;
+    for (int i = dl_count - 1; i >= 0; i--) {
+        dl_op_t *op = &dl_ops[i];
+        if (op->y < top) top = op->y;
+        op->top_min = top;
+    }
+}
+
+static void paint_form_input(uint32_t *canvas, int cw, int ch, const dl_op_t *op, int y)
+{
+    int idx = (int)op->off;
+    form_input_t *fi = &form_inputs[idx];
+    int x = op->x, fw = op->w;
+
+    /* Draw text field - highlight if focused */
+    int is_focused = (idx == focused_input);
+    uint32_t border_color = is_focused ? 0x4488CC : 0x808080;
+    fill_rect(canvas, cw, ch, x, y, fw, 22, 0xFFFFFF);
+    draw_hline(canvas, cw, ch, x, y, fw, border_color);
+    draw_hline(canvas, cw, ch, x, y + 21, fw, border_color);
+    fill_rect(canvas, cw, ch, x, y, 1, 22, border_color);
+    fill_rect(canvas, cw, ch, x + fw - 1, y, 1, 22, border_color);
+
+    /* Display value or placeholder */
+    const char *txt;
+    uint32_t txt_color;
+    int show_input_sel = (is_focused && input_select_all && fi->value[0]);
+    if (fi->value[0]) {
+        txt = fi->value;
+        txt_color = show_input_sel ? COL_SELECT_TXT : 0x1A1A1A;
+    } else {
+        txt = fi->placeholder;
+        txt_color = 0xA0A0A0;
+    }
+    if (txt[0]) {
+        int max_txt = (fw - 8) / 8;
+        if (max_txt < 1) max_txt = 1;
+        int n = 0;
+        while (txt[n] && n < max_txt && n < 79) n++;
+        /* Selection highlight */
+        if (show_input_sel)
+            fill_rect(canvas, cw, ch, x + 2, y + 2, n * 8 + 4, 18, COL_SELECT_BG);
+        text_draw_canvas(canvas, cw, ch, x + 4, y + 3, txt, n, txt_color, TEXT_SOLID);
+    }
+    /* Cursor in focused input */
+    if (is_focused) {
+        int cx = x + 4 + str_len(fi->value) * 8;
+        if (cx < x + fw - 4)
+            fill_rect(canvas, cw, ch, cx, y + 3, 2, 16, 0x1A1A1A);
+    }
+}
+
+/* Ops in [*lo_out, *hi_out) cover every op that intersects [top, bottom) */
+static void dl_slice(int top, int bottom, int *lo_out, int *hi_out)
+{
+    /* Ops before lo all end above the band; ops from hi on all start
+     * below it.  Layout runs top to bottom, so [lo, hi) is tight.    */
+    int lo = 0, hi = dl_count;
+    while (lo < hi) {
+        int m = (lo + hi) / 2;
+        if (dl_ops[m].bottom_max > top) hi = m;
+        else                            lo = m + 1;
+    }
+    hi = dl_count;
+    for (int a = lo; a < hi; ) {
+        int m = (a + hi) / 2;
+        if (dl_ops[m].top_min >= bottom) hi = m;
+        else                             a = m + 1;
+    }
+    *lo_out = lo;
+    *hi_out = hi;
+}
+
+/* Replay the ops visible with the content scrolled to `scroll`;
+ * form inputs only if `inputs` is set                          */
+static void dl_raster(uint32_t *canvas, int cw, int ch, int scroll, int inputs)
+{
+    int top = scroll, bottom = scroll + ch, lo, hi;
+    fill_rect(canvas, cw, ch, 0, 0, cw, ch, dl_bg);
+    dl_slice(top, bottom, &lo, &hi);
+
+    for (int i = lo; i < hi; i++) {
+        const dl_op_t *op = &dl_ops[i];
+        if (op->y + op->h <= top || op->y >= bottom) continue;
+        int y = op->y - scroll;
+
+        if (op->type == DL_RECT) {
+            fill_rect(canvas, cw, ch, op->x, y, op->w, op->h, op->color);
+        } else if (op->type == DL_TEXT) {
+            const char *s = dl_text + op->off;
+            if (op->style & DL_BOLD) {
+                for (int c = 0; c < op->len; c++)
+                    text_draw_canvas(canvas, cw, ch, op->x + c * 9, y, s + c, 1,
+                                     op->color, TEXT_SOLID | TEXT_BOLD);
+            } else {
+                text_draw_canvas(canvas, cw, ch, op->x, y, s, op->len,
+                                 op->color, TEXT_SOLID);
+            }
+            if (op->style & DL_UNDERLINE)
+                draw_hline(canvas, cw, ch, op->x, y + 15, op->w, op->color);
+            if (op->style & DL_STRIKE)
+                draw_hline(canvas, cw, ch, op->x, y + 7, op->w, op->color);
+        } else if (inputs) {
+            paint_form_input(canvas, cw, ch, op, y);
+        }
+    }
+}
+
+/* The cached raster of `strip` at width cw, rasterising it if needed.
+ * Returns 0 if the budget cannot hold another tile.                  */
+static tile_t *tile_get(int strip, int cw)
+{
+    tile_t *reuse = 0, *empty = 0, *lru = 0;
+    uint32_t need = (uint32_t)cw * TILE_H * 4;
+
+    for (int i = 0; i < TILE_SLOTS; i++) {
+        tile_t *t = &tiles[i];
+        if (t->pix && t->width != cw) tile_free(t);
+        if (!t->pix) { if (!empty) empty = t; continue; }
+        if (t->valid && t->strip == strip) {
+            t->last_use = ++tile_clock;
+            return t;
+        }
+        if (!t->valid) { if (!reuse) reuse = t; continue; }
+        if (!lru || t->last_use < lru->last_use) lru = t;
+    }
+
+    tile_t *t = reuse;
+    if (!t && empty && tile_bytes + need <= tile_budget) {
+        empty->pix = (uint32_t *)kmalloc_tagged(need);
+        if (empty->pix) {
+            empty->width = cw;
+            tile_bytes += need;
+            t = empty;
+        }
+    }
+    if (!t) t = lru;
+    if (!t) return 0;
+
+    dl_raster(t->pix, cw, TILE_H, strip * TILE_H, 0);
+    t->strip = strip;
+    t->valid = 1;
+    t->last_use = ++tile_clock;
+    return t;
+}
+
+/* Show the content scrolled to `scroll`: cached strips are copied and
+ * form inputs drawn on top                                           */
+static void dl_paint(uint32_t *canvas, int cw, int ch, int scroll)
+{
+    int bottom = scroll + ch, lo, hi;
+    for (int strip = scroll / TILE_H; strip * TILE_H < bottom; strip++) {
+        tile_t *t = tile_get(strip, cw);
+        if (!t) {
+            dl_raster(canvas, cw, ch, scroll, 1);
+            return;
+        }
+        int top = strip * TILE_H;
+        int r0 = top > scroll ? top : scroll;
+        int r1 = top + TILE_H < bottom ? top + TILE_H : bottom;
+        for (int r = r0; r < r1; r++)
+            raster_ops.copy(canvas + (r - scroll) * cw, t->pix + (r - top) * cw, cw);
+    }
+
+    dl_slice(scroll, bottom, &lo, &hi);
+    for (int i = lo; i < hi; i++) {
+        const dl_op_t *op = &dl_ops[i];
+        if (op->type != DL_INPUT || op->y + op->h <= scroll || op->y >= bottom) continue;
+        paint_form_input(canvas, cw, ch, op, op->y - scroll);
+    }
+}
+
 static uint32_t parse_html_color(const char *s)
 {
     if (!s || !s[0]) return 0xFFFFFF;
@@ -1059,29 +1511,16 @@ static void flush_center_buf(void)
         offset = (avail - text_w) / 2;
     if (offset < 0) offset = 0;
     int draw_x = rs.start_x + offset;
-    int draw_y = rs.y - rs.scroll;
+    int draw_y = rs.y;
 
     if (draw_y >= -16 && draw_y < rs.ch) {
         for (int i = 0; i < rs.center_buf_len; i++) {
-            uint32_t fg = rs.center_buf_colors[i];
             int char_w = rs.center_line_bold ? 9 : 8;
-            if (rs.center_line_bold)
-                canvas_draw_char_bold(rs.canvas, rs.cw, rs.ch,
-                    draw_x + i * char_w, draw_y, rs.center_buf[i], fg);
-            else
-                canvas_draw_char(rs.canvas, rs.cw, rs.ch,
-                    draw_x + i * char_w, draw_y, rs.center_buf[i], fg);
-            if (rs.center_buf_underline[i] && draw_y + 15 >= 0 && draw_y + 15 < rs.ch)
-                for (int col = 0; col < char_w; col++)
-                    if (draw_x + i * char_w + col >= 0 && draw_x + i * char_w + col < rs.cw)
-                        rs.canvas[(draw_y + 15) * rs.cw + draw_x + i * char_w + col] = fg;
-            if (rs.center_buf_strikethrough[i]) {
-                int sy = draw_y + 7;
-                if (sy >= 0 && sy < rs.ch)
-                    for (int col = 0; col < char_w; col++)
-                        if (draw_x + i * char_w + col >= 0 && draw_x + i * char_w + col < rs.cw)
-                            rs.canvas[sy * rs.cw + draw_x + i * char_w + col] = fg;
-            }
+            int style = (rs.center_line_bold ? DL_BOLD : 0) |
+                        (rs.center_buf_underline[i] ? DL_UNDERLINE : 0) |
+                        (rs.center_buf_strikethrough[i] ? DL_STRIKE : 0);
+            dl_char(draw_x + i * char_w, draw_y, rs.center_buf[i],
+                    rs.center_buf_colors[i], style);
         }
     }
     /* Update rs.x to end of centered text for link tracking */
@@ -1130,34 +1569,18 @@ static void render_char(char c)
         return;
     }
 
-    int draw_y = rs.y - rs.scroll;
+    int draw_y = rs.y;
 
     /* Word wrap */
     if (rs.x + 8 > rs.max_x && !rs.preformatted) {
         render_newline();
-        draw_y = rs.y - rs.scroll;
+        draw_y = rs.y;
     }
 
     if (draw_y >= -16 && draw_y < rs.ch) {
         uint32_t fg = rs.in_link ? rs.link_color : rs.text_color;
-        if (rs.bold) {
-            canvas_draw_char_bold(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, c, fg);
-        } else {
-            canvas_draw_char(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, c, fg);
-        }
-        if (rs.underline) {
-            if (draw_y + 15 >= 0 && draw_y + 15 < rs.ch)
-                for (int col = 0; col < (rs.bold ? 9 : 8); col++)
-                    if (rs.x + col >= 0 && rs.x + col < rs.cw)
-                        rs.canvas[(draw_y + 15) * rs.cw + rs.x + col] = fg;
-        }
-        if (rs.strikethrough) {
-            int sy = draw_y + 7;
-            if (sy >= 0 && sy < rs.ch)
-                for (int col = 0; col < (rs.bold ? 9 : 8); col++)
-                    if (rs.x + col >= 0 && rs.x + col < rs.cw)
-                        rs.canvas[sy * rs.cw + rs.x + col] = fg;
-        }
+        dl_char(rs.x, draw_y, c, fg, (rs.bold ? DL_BOLD : 0) |
+                (rs.underline ? DL_UNDERLINE : 0) | (rs.strikethrough ? DL_STRIKE : 0));
     }
     rs.x += rs.bold ? 9 : 8;
     rs.last_char_space = (c == ' ');
@@ -1301,9 +1724,9 @@ static void apply_inline_style(const char *tag, int tag_len)
                 if (c != 0xFFFFFF || str_ncasecmp(val, "white", 5) == 0 ||
                     val[0] == '#' || str_ncasecmp(val, "rgb", 3) == 0) {
                     /* For block-level inline: fill background of current line area */
-                    int draw_y = rs.y - rs.scroll;
+                    int draw_y = rs.y;
                     if (draw_y >= -rs.line_height && draw_y < rs.ch)
-                        fill_rect(rs.canvas, rs.cw, rs.ch, rs.start_x, draw_y,
+                        dl_rect(rs.start_x, draw_y,
                                   rs.max_x - rs.start_x, rs.line_height, c);
                 }
             }
@@ -1448,9 +1871,9 @@ static void handle_tag(const char *tag, int tag_len)
         render_newline();
     } else if (str_cmp(name, "hr") == 0) {
         render_newline();
-        int draw_y = rs.y - rs.scroll + 8;
+        int draw_y = rs.y + 8;
         if (draw_y >= 0 && draw_y < rs.ch)
-            draw_hline(rs.canvas, rs.cw, rs.ch, rs.start_x, draw_y,
+            dl_hline(rs.start_x, draw_y,
                        rs.max_x - rs.start_x, 0x808080);
         rs.y += 20;
         rs.x = rs.start_x;
@@ -1460,17 +1883,17 @@ static void handle_tag(const char *tag, int tag_len)
             char alt[64];
             if (!get_attr(tag, tag_len, "alt", alt, sizeof(alt)))
                 str_cpy(alt, "[image]");
-            int draw_y = rs.y - rs.scroll;
+            int draw_y = rs.y;
             if (draw_y >= -20 && draw_y < rs.ch) {
                 /* Draw a placeholder box */
                 int pw = str_len(alt) * 8 + 12;
                 int ph = 22;
                 int dx = rs.x;
-                if (dx + pw > rs.max_x) { render_newline(); draw_y = rs.y - rs.scroll; dx = rs.x; }
-                fill_rect(rs.canvas, rs.cw, rs.ch, dx, draw_y, pw, ph, 0xE8E8E8);
-                draw_hline(rs.canvas, rs.cw, rs.ch, dx, draw_y, pw, 0xC0C0C0);
-                draw_hline(rs.canvas, rs.cw, rs.ch, dx, draw_y + ph - 1, pw, 0xC0C0C0);
-                canvas_draw_string(rs.canvas, rs.cw, rs.ch, dx + 6, draw_y + 3, alt, 0x808080);
+                if (dx + pw > rs.max_x) { render_newline(); draw_y = rs.y; dx = rs.x; }
+                dl_rect(dx, draw_y, pw, ph, 0xE8E8E8);
+                dl_hline(dx, draw_y, pw, 0xC0C0C0);
+                dl_hline(dx, draw_y + ph - 1, pw, 0xC0C0C0);
+                dl_string(dx + 6, draw_y + 3, alt, 0x808080);
                 rs.x += pw + 4;
             }
         }
@@ -1502,23 +1925,19 @@ static void handle_tag(const char *tag, int tag_len)
                 return;
             }
 
-            int draw_y = rs.y - rs.scroll;
+            int draw_y = rs.y;
             if (draw_y >= -20 && draw_y < rs.ch) {
                 if (str_ncasecmp(type, "submit", 6) == 0 || str_ncasecmp(type, "button", 6) == 0) {
                     /* Button-style input */
                     const char *label = value[0] ? value : "Submit";
                     int bw = str_len(label) * 8 + 16;
                     /* Button with 3D look */
-                    fill_rect(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, bw, 22, 0xE0E0E0);
-                    draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, bw, 0xF0F0F0);
-                    draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y + 21, bw, 0x808080);
-                    for (int by = draw_y; by < draw_y + 22 && by < rs.ch; by++) {
-                        if (by >= 0) {
-                            if (rs.x >= 0 && rs.x < rs.cw) rs.canvas[by * rs.cw + rs.x] = 0xF0F0F0;
-                            if (rs.x+bw-1 >= 0 && rs.x+bw-1 < rs.cw) rs.canvas[by * rs.cw + rs.x+bw-1] = 0x808080;
-                        }
-                    }
-                    canvas_draw_string(rs.canvas, rs.cw, rs.ch, rs.x + 8, draw_y + 3, label, 0x1A1A1A);
+                    dl_rect(rs.x, draw_y, bw, 22, 0xE0E0E0);
+                    dl_hline(rs.x, draw_y, bw, 0xF0F0F0);
+                    dl_hline(rs.x, draw_y + 21, bw, 0x808080);
+                    dl_rect(rs.x, draw_y, 1, 22, 0xF0F0F0);
+                    dl_rect(rs.x + bw - 1, draw_y, 1, 22, 0x808080);
+                    dl_string(rs.x + 8, draw_y + 3, label, 0x1A1A1A);
                     /* Register as submit button */
                     if (form_input_count < MAX_FORM_INPUTS) {
                         form_input_t *fi = &form_inputs[form_input_count];
@@ -1530,32 +1949,26 @@ static void handle_tag(const char *tag, int tag_len)
                     }
                     rs.x += bw + 4;
                 } else if (str_ncasecmp(type, "checkbox", 8) == 0) {
-                    fill_rect(rs.canvas, rs.cw, rs.ch, rs.x, draw_y + 2, 14, 14, 0xFFFFFF);
-                    draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y + 2, 14, 0x808080);
-                    draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y + 15, 14, 0x808080);
-                    for (int by = draw_y + 2; by <= draw_y + 15 && by < rs.ch; by++) {
-                        if (by >= 0) {
-                            if (rs.x >= 0 && rs.x < rs.cw) rs.canvas[by * rs.cw + rs.x] = 0x808080;
-                            if (rs.x+13 >= 0 && rs.x+13 < rs.cw) rs.canvas[by * rs.cw + rs.x+13] = 0x808080;
-                        }
-                    }
+                    dl_rect(rs.x, draw_y + 2, 14, 14, 0xFFFFFF);
+                    dl_hline(rs.x, draw_y + 2, 14, 0x808080);
+                    dl_hline(rs.x, draw_y + 15, 14, 0x808080);
+                    dl_rect(rs.x, draw_y + 2, 1, 14, 0x808080);
+                    dl_rect(rs.x + 13, draw_y + 2, 1, 14, 0x808080);
                     rs.x += 18;
                 } else if (str_ncasecmp(type, "radio", 5) == 0) {
                     int rcx = rs.x + 7, rcy = draw_y + 9;
                     for (int dy2 = -6; dy2 <= 6; dy2++)
                         for (int dx2 = -6; dx2 <= 6; dx2++)
                             if (dx2*dx2 + dy2*dy2 <= 36 && dx2*dx2 + dy2*dy2 >= 25)
-                                if (rcy+dy2 >= 0 && rcy+dy2 < rs.ch && rcx+dx2 >= 0 && rcx+dx2 < rs.cw)
-                                    rs.canvas[(rcy+dy2)*rs.cw + rcx+dx2] = 0x808080;
+                                dl_rect(rcx + dx2, rcy + dy2, 1, 1, 0x808080);
                     for (int dy2 = -5; dy2 <= 5; dy2++)
                         for (int dx2 = -5; dx2 <= 5; dx2++)
                             if (dx2*dx2 + dy2*dy2 <= 25)
-                                if (rcy+dy2 >= 0 && rcy+dy2 < rs.ch && rcx+dx2 >= 0 && rcx+dx2 < rs.cw)
-                                    rs.canvas[(rcy+dy2)*rs.cw + rcx+dx2] = 0xFFFFFF;
+                                dl_rect(rcx + dx2, rcy + dy2, 1, 1, 0xFFFFFF);
                     rs.x += 18;
                 } else if (str_ncasecmp(type, "image", 5) == 0) {
-                    fill_rect(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, 40, 22, 0xE0E0E0);
-                    canvas_draw_string(rs.canvas, rs.cw, rs.ch, rs.x + 4, draw_y + 3, "[Go]", 0x1A1A1A);
+                    dl_rect(rs.x, draw_y, 40, 22, 0xE0E0E0);
+                    dl_string(rs.x + 4, draw_y + 3, "[Go]", 0x1A1A1A);
                     rs.x += 44;
                 } else {
                     /* Text-like input field */
@@ -1584,55 +1997,17 @@ static void handle_tag(const char *tag, int tag_len)
                         form_input_count++;
                     }
 
-                    /* Draw text field - highlight if focused */
-                    int is_focused = (fi_idx >= 0 && fi_idx == focused_input);
-                    uint32_t border_color = is_focused ? 0x4488CC : 0x808080;
-                    fill_rect(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, fw, 22, 0xFFFFFF);
-                    draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, fw, border_color);
-                    draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y + 21, fw, border_color);
-                    for (int by = draw_y; by < draw_y + 22 && by < rs.ch; by++) {
-                        if (by >= 0) {
-                            if (rs.x >= 0 && rs.x < rs.cw) rs.canvas[by * rs.cw + rs.x] = border_color;
-                            if (rs.x+fw-1 >= 0 && rs.x+fw-1 < rs.cw) rs.canvas[by * rs.cw + rs.x+fw-1] = border_color;
-                        }
-                    }
-                    /* Display value or placeholder */
-                    const char *txt;
-                    uint32_t txt_color;
-                    int show_input_sel = (is_focused && input_select_all &&
-                                         fi_idx >= 0 && form_inputs[fi_idx].value[0]);
-                    /* Always show the current stored value (which includes user-typed text) */
-                    if (fi_idx >= 0 && form_inputs[fi_idx].value[0]) {
-                        txt = form_inputs[fi_idx].value;
-                        txt_color = show_input_sel ? COL_SELECT_TXT : 0x1A1A1A;
-                    } else if (placeholder[0]) {
-                        txt = placeholder;
-                        txt_color = 0xA0A0A0;
+                    /* Value, focus and cursor are drawn at paint time */
+                    if (fi_idx >= 0) {
+                        str_ncpy(form_inputs[fi_idx].placeholder, placeholder,
+                                 sizeof(form_inputs[fi_idx].placeholder));
+                        dl_input(rs.x, draw_y, fw, 22, fi_idx);
                     } else {
-                        txt = "";
-                        txt_color = 0x1A1A1A;
-                    }
-                    if (txt[0]) {
-                        int max_txt = (fw - 8) / 8;
-                        if (max_txt < 1) max_txt = 1;
-                        char clipped[80];
-                        int ci2 = 0;
-                        while (txt[ci2] && ci2 < max_txt && ci2 < 79)
-                            { clipped[ci2] = txt[ci2]; ci2++; }
-                        clipped[ci2] = 0;
-                        /* Selection highlight */
-                        if (show_input_sel)
-                            fill_rect(rs.canvas, rs.cw, rs.ch, rs.x + 2, draw_y + 2,
-                                      ci2 * 8 + 4, 18, COL_SELECT_BG);
-                        canvas_draw_string(rs.canvas, rs.cw, rs.ch, rs.x + 4, draw_y + 3,
-                                           clipped, txt_color);
-                    }
-                    /* Cursor in focused input */
-                    if (is_focused) {
-                        int clen = str_len(form_inputs[fi_idx].value);
-                        int cx = rs.x + 4 + clen * 8;
-                        if (cx < rs.x + fw - 4)
-                            fill_rect(rs.canvas, rs.cw, rs.ch, cx, draw_y + 3, 2, 16, 0x1A1A1A);
+                        dl_rect(rs.x, draw_y, fw, 22, 0xFFFFFF);
+                        dl_hline(rs.x, draw_y, fw, 0x808080);
+                        dl_hline(rs.x, draw_y + 21, fw, 0x808080);
+                        dl_rect(rs.x, draw_y, 1, 22, 0x808080);
+                        dl_rect(rs.x + fw - 1, draw_y, 1, 22, 0x808080);
                     }
                     rs.x += fw + 4;
                 }
@@ -1641,19 +2016,15 @@ static void handle_tag(const char *tag, int tag_len)
     } else if (str_cmp(name, "button") == 0) {
         if (!is_close) {
             /* Draw button background; content will render on top */
-            int draw_y = rs.y - rs.scroll;
+            int draw_y = rs.y;
             if (draw_y >= -20 && draw_y < rs.ch) {
                 /* 3D raised button look */
                 int bw = 80;
-                fill_rect(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, bw, 22, 0xE0E0E0);
-                draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, bw, 0xF0F0F0);
-                draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y + 21, bw, 0x808080);
-                for (int by = draw_y; by < draw_y + 22 && by < rs.ch; by++) {
-                    if (by >= 0) {
-                        if (rs.x >= 0 && rs.x < rs.cw) rs.canvas[by * rs.cw + rs.x] = 0xF0F0F0;
-                        if (rs.x+bw-1 >= 0 && rs.x+bw-1 < rs.cw) rs.canvas[by * rs.cw + rs.x+bw-1] = 0x808080;
-                    }
-                }
+                dl_rect(rs.x, draw_y, bw, 22, 0xE0E0E0);
+                dl_hline(rs.x, draw_y, bw, 0xF0F0F0);
+                dl_hline(rs.x, draw_y + 21, bw, 0x808080);
+                dl_rect(rs.x, draw_y, 1, 22, 0xF0F0F0);
+                dl_rect(rs.x + bw - 1, draw_y, 1, 22, 0x808080);
             }
             rs.x += 4;
         } else {
@@ -1931,7 +2302,7 @@ static void handle_tag(const char *tag, int tag_len)
             if (get_attr(tag, tag_len, "bgcolor", color_val, sizeof(color_val))) {
                 rs.bg_color = named_color(color_val);
                 /* Fill background */
-                fill_rect(rs.canvas, rs.cw, rs.ch, 0, 0, rs.cw, rs.ch, rs.bg_color);
+                dl_bg = rs.bg_color;
             }
             char text_val[32];
             if (get_attr(tag, tag_len, "text", text_val, sizeof(text_val))) {
@@ -1944,7 +2315,7 @@ static void handle_tag(const char *tag, int tag_len)
             /* Apply CSS for body, class, id, and inline style */
             apply_css_for_tag("body", tag, tag_len);
             if (rs.bg_color != 0xFFFFFF)
-                fill_rect(rs.canvas, rs.cw, rs.ch, 0, 0, rs.cw, rs.ch, rs.bg_color);
+                dl_bg = rs.bg_color;
             apply_inline_style(tag, tag_len);
         }
     /* Heading tags */
@@ -2053,9 +2424,9 @@ static void handle_tag(const char *tag, int tag_len)
             char bg_val[32];
             if (get_attr(tag, tag_len, "bgcolor", bg_val, sizeof(bg_val))) {
                 /* Fill a background region for the table */
-                int draw_y = rs.y - rs.scroll;
+                int draw_y = rs.y;
                 if (draw_y >= 0 && draw_y < rs.ch)
-                    fill_rect(rs.canvas, rs.cw, rs.ch, rs.start_x, draw_y,
+                    dl_rect(rs.start_x, draw_y,
                               rs.max_x - rs.start_x, 2, named_color(bg_val));
             }
             /* Check for width */
@@ -2097,9 +2468,9 @@ static void handle_tag(const char *tag, int tag_len)
             /* Cell background */
             char bg_val[32];
             if (get_attr(tag, tag_len, "bgcolor", bg_val, sizeof(bg_val))) {
-                int draw_y = rs.y - rs.scroll;
+                int draw_y = rs.y;
                 if (draw_y >= 0 && draw_y < rs.ch)
-                    fill_rect(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, col_w, rs.line_height, named_color(bg_val));
+                    dl_rect(rs.x, draw_y, col_w, rs.line_height, named_color(bg_val));
             }
             /* Cell alignment */
             char align_val[16];
@@ -2108,9 +2479,9 @@ static void handle_tag(const char *tag, int tag_len)
                 else if (str_ncasecmp(align_val, "right", 5) == 0) rs.right_align = 1;
             }
             /* Draw a subtle cell border */
-            int draw_y = rs.y - rs.scroll;
+            int draw_y = rs.y;
             if (draw_y >= 0 && draw_y < rs.ch)
-                draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y - 1,
+                dl_hline(rs.x, draw_y - 1,
                            col_w, 0xD0D0D0);
         } else {
             if (name[1] == 'h') rs.bold = 0;
@@ -2151,32 +2522,28 @@ static void handle_tag(const char *tag, int tag_len)
         else { rs.bold = 0; render_newline(); }
     } else if (str_cmp(name, "textarea") == 0) {
         if (!is_close) {
-            int draw_y = rs.y - rs.scroll;
+            int draw_y = rs.y;
             if (draw_y >= -60 && draw_y < rs.ch) {
                 int tw = 200, th = 60;
-                fill_rect(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, tw, th, 0xFFFFFF);
-                draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, tw, 0x808080);
-                draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y + th - 1, tw, 0x808080);
-                for (int by = draw_y; by < draw_y + th && by < rs.ch; by++) {
-                    if (by >= 0) {
-                        if (rs.x >= 0 && rs.x < rs.cw) rs.canvas[by * rs.cw + rs.x] = 0x808080;
-                        if (rs.x+tw-1 >= 0 && rs.x+tw-1 < rs.cw) rs.canvas[by * rs.cw + rs.x+tw-1] = 0x808080;
-                    }
-                }
+                dl_rect(rs.x, draw_y, tw, th, 0xFFFFFF);
+                dl_hline(rs.x, draw_y, tw, 0x808080);
+                dl_hline(rs.x, draw_y + th - 1, tw, 0x808080);
+                dl_rect(rs.x, draw_y, 1, th, 0x808080);
+                dl_rect(rs.x + tw - 1, draw_y, 1, th, 0x808080);
             }
             rs.y += 64;
             rs.x = rs.start_x;
         }
     } else if (str_cmp(name, "select") == 0) {
         if (!is_close) {
-            int draw_y = rs.y - rs.scroll;
+            int draw_y = rs.y;
             if (draw_y >= -20 && draw_y < rs.ch) {
                 int sw = 120;
-                fill_rect(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, sw, 22, 0xFFFFFF);
-                draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y, sw, 0x808080);
-                draw_hline(rs.canvas, rs.cw, rs.ch, rs.x, draw_y + 21, sw, 0x808080);
+                dl_rect(rs.x, draw_y, sw, 22, 0xFFFFFF);
+                dl_hline(rs.x, draw_y, sw, 0x808080);
+                dl_hline(rs.x, draw_y + 21, sw, 0x808080);
                 /* Dropdown arrow */
-                canvas_draw_char(rs.canvas, rs.cw, rs.ch, rs.x + sw - 14, draw_y + 3, 'v', 0x606060);
+                dl_char(rs.x + sw - 14, draw_y + 3, 'v', 0x606060, 0);
                 rs.x += sw + 4;
             }
         }
@@ -2205,9 +2572,9 @@ static void handle_tag(const char *tag, int tag_len)
                str_cmp(name, "canvas") == 0 || str_cmp(name, "svg") == 0) {
         if (!is_close) {
             /* Show placeholder */
-            int draw_y = rs.y - rs.scroll;
+            int draw_y = rs.y;
             if (draw_y >= -20 && draw_y < rs.ch) {
-                canvas_draw_string(rs.canvas, rs.cw, rs.ch, rs.x, draw_y + 3,
+                dl_string(rs.x, draw_y + 3,
                                    "[embedded content]", 0xA0A0A0);
             }
             rs.x += 150;
@@ -2465,8 +2832,50 @@ static char decode_entity(const char *s, int *advance)
     return '&';
 }
 
-static void render_html(const char *html, int html_len,
-                        uint32_t *canvas, int cw, int ch, int scroll)
+/*
+ * Layout is resumable so a page can be shown while it downloads.
+ * render_begin() starts over from the top of page_buf; render_feed()
+ * lays out whatever has arrived since, stopping in front of a tag,
+ * comment or entity that is not complete yet.  Once the page is complete
+ * the result is the same as laying it out in one go.
+ */
+static int lay_pos;            /* Next byte of page_buf to lay out        */
+static int lay_final;          /* Laid out to the end of a complete page  */
+static int lay_css_pos;        /* Next byte for the <style> pre-scan      */
+static int lay_capture_title;
+
+/* Pre-scan <style> blocks for CSS rules.  Returns 1 if any changed. */
+static int css_scan(const char *html, int html_len, int final)
+{
+    uint32_t before = css_gen;
+    int si = lay_css_pos;
+    while (si < html_len - 7) {
+        if (html[si] == '<' && str_ncasecmp(html + si + 1, "style", 5) == 0 &&
+            (html[si + 6] == '>' || html[si + 6] == ' ')) {
+            /* Find end of style opening tag */
+            int css_start = si + 6;
+            while (css_start < html_len && html[css_start] != '>') css_start++;
+            css_start++;
+            /* Find </style> */
+            int css_end = css_start;
+            while (css_end + 7 < html_len) {
+                if (html[css_end] == '<' && html[css_end+1] == '/' &&
+                    str_ncasecmp(html + css_end + 2, "style", 5) == 0) break;
+                css_end++;
+            }
+            if (!final && css_end + 7 >= html_len) break;  /* Still arriving */
+            if (css_end > css_start)
+                parse_css_block(html + css_start, css_end - css_start);
+            si = css_end;
+        }
+        si++;
+    }
+    lay_css_pos = si;
+    return css_gen != before;
+}
+
+/* Start laying the page out for a canvas `cw` pixels wide */
+static void render_begin(const char *html, int html_len, int cw, int final)
 {
     /* Save user-typed form values before resetting */
     save_form_inputs();
@@ -2476,43 +2885,19 @@ static void render_html(const char *html, int html_len,
     form_input_count = 0;
     form_action[0] = 0;
     str_cpy(form_method, "get");
-    css_rule_count = 0;
+    css_reset();
 
-    /* Pre-scan for <style> blocks to extract CSS rules */
-    {
-        int si = 0;
-        while (si < html_len - 7) {
-            if (html[si] == '<' && str_ncasecmp(html + si + 1, "style", 5) == 0 &&
-                (html[si + 6] == '>' || html[si + 6] == ' ')) {
-                /* Find end of style opening tag */
-                int css_start = si + 6;
-                while (css_start < html_len && html[css_start] != '>') css_start++;
-                css_start++;
-                /* Find </style> */
-                int css_end = css_start;
-                while (css_end + 7 < html_len) {
-                    if (html[css_end] == '<' && html[css_end+1] == '/' &&
-                        str_ncasecmp(html + css_end + 2, "style", 5) == 0) break;
-                    css_end++;
-                }
-                if (css_end > css_start)
-                    parse_css_block(html + css_start, css_end - css_start);
-                si = css_end;
-            }
-            si++;
-        }
-    }
+    lay_css_pos = 0;
+    css_scan(html, html_len, final);
 
     /* Initialize render state */
-    rs.canvas = canvas;
     rs.cw = cw;
-    rs.ch = ch;
+    rs.ch = DL_LAYOUT_H;
     rs.x = 8;
     rs.y = 4;
     rs.start_x = 8;
     rs.max_x = cw - SCROLLBAR_W - 8;  /* Leave space for scrollbar */
     rs.line_height = 18;
-    rs.scroll = scroll;
     rs.bold = 0;
     rs.italic = 0;
     rs.underline = 0;
@@ -2565,23 +2950,43 @@ static void render_html(const char *html, int html_len,
         if (html_css->has_color) rs.text_color = html_css->color;
     }
 
-    /* Clear canvas */
-    fill_rect(canvas, cw, ch, 0, 0, cw, ch, rs.bg_color);
+    dl_reset(rs.bg_color);
 
-    int i = 0;
+    /* The title is taken from the first layout of a page only; a page
+     * still downloading may have been cut off inside <title>.       */
+    if (!final) page_title[0] = 0;
+    lay_capture_title = page_title[0] == 0;
+
+    lay_pos = 0;
+    lay_final = 0;
+    dl_width = cw;
+    dl_valid = 1;
+}
+
+/* Lay out page_buf up to html_len; `final` once nothing more will arrive */
+static void render_feed(const char *html, int html_len, int final)
+{
+    /* A new style sheet changes how everything before it looks */
+    if (css_scan(html, html_len, final))
+        render_begin(html, html_len, rs.cw, final);
+
+    int i = lay_pos;
     while (i < html_len) {
         if (html[i] == '<') {
+            if (!final && i + 3 >= html_len) break;
             /* Check for comments <!-- --> */
             if (i + 3 < html_len && html[i+1] == '!' && html[i+2] == '-' && html[i+3] == '-') {
                 /* Skip to end of comment */
-                int ci = i + 4;
+                int ci = i + 4, closed = 0;
                 while (ci + 2 < html_len) {
                     if (html[ci] == '-' && html[ci+1] == '-' && html[ci+2] == '>') {
                         ci += 3;
+                        closed = 1;
                         break;
                     }
                     ci++;
                 }
+                if (!closed && !final) break;
                 i = ci;
                 continue;
             }
@@ -2599,11 +3004,15 @@ static void render_html(const char *html, int html_len,
                 }
                 handle_tag(html + tag_start, tag_end - tag_start);
                 i = tag_end + 1;
+            } else if (!final) {
+                break;
             } else {
                 render_char('<');
                 i++;
             }
         } else if (html[i] == '&') {
+            /* decode_entity() looks at most 11 bytes ahead */
+            if (!final && html_len - i < 12) break;
             int advance;
             char c = decode_entity(html + i, &advance);
             if (!rs.in_title && !rs.in_style && !rs.in_script) {
@@ -2616,7 +3025,7 @@ static void render_html(const char *html, int html_len,
         } else {
             if (rs.in_title) {
                 /* Store title */
-                int ti = str_len(page_title);
+                int ti = lay_capture_title ? str_len(page_title) : TITLE_MAX;
                 if (ti < TITLE_MAX - 1) {
                     page_title[ti] = html[i];
                     page_title[ti + 1] = 0;
@@ -2663,12 +3072,18 @@ static void render_html(const char *html, int html_len,
         }
     }
 
+    lay_pos = i;
+
     /* Flush any pending centered/right-aligned text */
-    if ((rs.centered || rs.right_align) && rs.center_buf_len > 0)
-        flush_center_buf();
+    if (final) {
+        if ((rs.centered || rs.right_align) && rs.center_buf_len > 0)
+            flush_center_buf();
+        lay_final = 1;
+    }
 
     /* Record total content height for scrollbar */
     content_total_h = rs.y + rs.line_height;
+    dl_finish();
 
     /* Restore focused input by name */
     restore_focused_input();
@@ -2710,10 +3125,40 @@ static const char homepage[] =
     "<p><i>nextOS 3.0.0 - A next-generation operating system</i></p>"
     "</body></html>";
 
+/* Room for a page of len bytes plus its terminator; -1 if it cannot grow */
+static int page_reserve(int len)
+{
+    if (len < page_cap) return 0;
+    if (len >= (int)PAGE_MAX) return -1;
+    int cap = page_cap ? page_cap : 65536;
+    while (cap <= len) cap *= 2;
+    if (cap > (int)PAGE_MAX) cap = (int)PAGE_MAX;
+    char *n = (char *)krealloc(page_cap ? page_buf : (void *)0, (size_t)cap);
+    if (!n) return -1;
+    page_buf = n;
+    page_cap = cap;
+    return 0;
+}
+
+/* Replace the page source, truncating it if memory runs short */
+static void page_set(const char *src, int len)
+{
+    if (page_reserve(len) != 0) len = page_cap ? page_cap - 1 : 0;
+    for (int i = 0; i < len; i++) page_buf[i] = src[i];
+    page_buf[len] = 0;
+    page_len = len;
+}
+
+static void page_set_str(const char *html)
+{
+    page_set(html, str_len(html));
+}
+
 static void load_homepage(void)
 {
-    str_cpy(page_buf, homepage);
-    page_len = str_len(homepage);
+    page_set(homepage, str_len(homepage));
+    dl_valid = 0;
+    page_streaming = 0;
     str_cpy(page_title, "nextOS Browser");
     str_cpy(url_bar, "about:home");
     url_cursor = str_len(url_bar);
@@ -2723,11 +3168,137 @@ static void load_homepage(void)
     saved_input_count = 0;
     saved_focused_name[0] = 0;
     nav_state = NAV_DONE;
+    nav_gen++;   /* Drop any fetch still in flight */
     str_cpy(status_msg, "Ready");
 }
 
+/* ── HTTP Cache ──────────────────────────────────────────────────────── */
+/*
+ * Responses are kept by URL in memory, least recently used first out
+ * within HCACHE_BUDGET bytes.  A fresh entry (Cache-Control max-age,
+ * or Expires) is shown without asking the server; a stale one is
+ * revalidated with If-None-Match / If-Modified-Since, and a 304 is
+ * served from the cache.  Back and forward show any stored copy as is.
+ */
+#define HCACHE_ENTRIES 32
+#define HCACHE_BUDGET  (4u << 20)
+#define HCACHE_OLD_DIR "/Documents/.webcache"  /* Left by earlier builds */
+
+#define CACHE_NORMAL   0   /* Use fresh entries, revalidate stale ones */
+#define CACHE_HISTORY  1   /* Back/forward: any stored copy will do    */
+#define CACHE_RELOAD   2   /* Always ask the server (conditionally)    */
+
+typedef struct {
+    char     url[URL_MAX];
+    char    *body;                 /* 0: slot unused */
+    int      len;
+    char     etag[64];
+    char     last_modified[48];
+    uint64_t fresh_until;          /* timer ms; 0 = revalidate before use */
+    uint64_t last_use;
+} hcache_entry_t;
+
+static hcache_entry_t hcache[HCACHE_ENTRIES];
+static uint32_t       hcache_bytes;
+static uint64_t       hcache_clock;
+
+static void hcache_drop(hcache_entry_t *e)
+{
+    if (!e->body) return;
+    kfree(e->body);
+    hcache_bytes -= (uint32_t)e->len;
+    e->body = 0;
+}
+
+/* A free slot with room for `len` more bytes, dropping LRU entries */
+static hcache_entry_t *hcache_slot(int len)
+{
+    for (;;) {
+        hcache_entry_t *free_e = 0, *lru = 0;
+        for (int i = 0; i < HCACHE_ENTRIES; i++) {
+            hcache_entry_t *e = &hcache[i];
+            if (!e->body) { if (!free_e) free_e = e; continue; }
+            if (!lru || e->last_use < lru->last_use) lru = e;
+        }
+        if (free_e && hcache_bytes + (uint32_t)len <= HCACHE_BUDGET) return free_e;
+        if (!lru) return 0;
+        hcache_drop(lru);
+    }
+}
+
+/* An entry for `url` with room for a len-byte body (not yet filled) */
+static hcache_entry_t *hcache_alloc(const char *url, int len)
+{
+    if (len <= 0 || (uint32_t)len > HCACHE_BUDGET) return 0;
+    hcache_entry_t *e = hcache_slot(len);
+    if (!e) return 0;
+    e->body = (char *)kmalloc_tagged((size_t)len);
+    if (!e->body) return 0;
+    e->len = len;
+    hcache_bytes += (uint32_t)len;
+    str_ncpy(e->url, url, URL_MAX);
+    e->etag[0] = 0;
+    e->last_modified[0] = 0;
+    e->fresh_until = 0;
+    e->last_use = ++hcache_clock;
+    return e;
+}
+
+static hcache_entry_t *hcache_find(const char *url)
+{
+    for (int i = 0; i < HCACHE_ENTRIES; i++) {
+        hcache_entry_t *e = &hcache[i];
+        if (e->body && str_cmp(e->url, url) == 0) {
+            e->last_use = ++hcache_clock;
+            return e;
+        }
+    }
+    return 0;
+}
+
+/* Validators and lifetime from a 200 or 304 */
+static void hcache_update(hcache_entry_t *e, const http_response_info_t *r)
+{
+    if (r->etag[0]) str_ncpy(e->etag, r->etag, sizeof(e->etag));
+    if (r->last_modified[0]) str_ncpy(e->last_modified, r->last_modified, sizeof(e->last_modified));
+    e->fresh_until = r->fresh_secs > 0
+        ? timer_get_ticks() + (uint64_t)r->fresh_secs * 1000 : 0;
+}
+
+/* Keep a 200 response that the server allows to be stored */
+static void hcache_store(const char *url, const char *body, int len,
+                         const http_response_info_t *r)
+{
+    if (r->status != 200 || r->corrupt) return;
+    for (int i = 0; i < HCACHE_ENTRIES; i++)
+        if (hcache[i].body && str_cmp(hcache[i].url, url) == 0) hcache_drop(&hcache[i]);
+    if (r->no_store) return;
+
+    hcache_entry_t *e = hcache_alloc(url, len);
+    if (!e) return;
+    for (int i = 0; i < len; i++) e->body[i] = body[i];
+    hcache_update(e, r);
+}
+
+static int hcache_fresh(const hcache_entry_t *e)
+{
+    return e->fresh_until && timer_get_ticks() < e->fresh_until;
+}
+
+/* Put a cached body up as the current page */
+static void hcache_show(const hcache_entry_t *e)
+{
+    page_set(e->body, e->len);
+    dl_valid = 0;
+    page_streaming = 0;
+    page_title[0] = 0;
+    focused_input = -1;
+    scroll_y = 0;
+}
+
 /* ── Navigation ──────────────────────────────────────────────────────── */
-static void navigate_internal(const char *url, int push_history);
+static void navigate_internal(const char *url, int push_history, int cache_mode);
+static void fetch_thread(void *arg);
 
 /* Submit form by building a GET URL with query parameters */
 static void submit_form(void)
@@ -2770,15 +3341,15 @@ static void submit_form(void)
     str_cpy(url_bar, submit_url);
     url_cursor = str_len(url_bar);
     focused_input = -1;
-    navigate_internal(submit_url, 1);
+    navigate_internal(submit_url, 1, CACHE_NORMAL);
 }
 
 static void navigate(const char *url)
 {
-    navigate_internal(url, 1);
+    navigate_internal(url, 1, CACHE_NORMAL);
 }
 
-static void navigate_internal(const char *url, int push_history)
+static void navigate_internal(const char *url, int push_history, int cache_mode)
 {
     if (!url || !url[0]) return;
 
@@ -2794,96 +3365,247 @@ static void navigate_internal(const char *url, int push_history)
     }
 
     if (!net_is_available()) {
-        str_cpy(page_buf,
+        page_set_str(
             "<html><body bgcolor=\"#FFF0F0\">"
             "<h1>Network Unavailable</h1>"
             "<p>No network adapter was detected.</p>"
             "<p>To use networking in QEMU, start with:</p>"
             "<pre>qemu-system-x86_64 -cdrom nextOS.iso -m 256M -nic model=e1000</pre>"
             "</body></html>");
-        page_len = str_len(page_buf);
+        dl_valid = 0;
+        page_streaming = 0;
         str_cpy(page_title, "Network Error");
         scroll_y = 0;
+        nav_gen++;   /* Drop any fetch still in flight */
         nav_state = NAV_ERROR;
         str_cpy(status_msg, "No network adapter");
         return;
     }
 
-    nav_state = NAV_LOADING;
-    str_cpy(status_msg, "Loading...");
-
     parsed_url_t purl;
     if (!parse_url(url, &purl)) {
-        str_cpy(page_buf,
+        page_set_str(
             "<html><body><h1>Invalid URL</h1>"
             "<p>The URL could not be parsed.</p></body></html>");
-        page_len = str_len(page_buf);
+        dl_valid = 0;
+        page_streaming = 0;
         str_cpy(page_title, "Error");
         scroll_y = 0;
+        nav_gen++;   /* Drop any fetch still in flight */
         nav_state = NAV_ERROR;
         str_cpy(status_msg, "Invalid URL");
         return;
     }
 
-    /* Build status message with bounded host to prevent overflow */
-    str_cpy(status_msg, "Resolving ");
-    {
-        int slen = str_len(status_msg);
-        int hlen = str_len(purl.host);
-        int avail = (int)sizeof(status_msg) - slen - 4; /* room for "..." (3) + NUL (1) */
-        if (hlen > avail) hlen = avail;
-        for (int i = 0; i < hlen; i++) status_msg[slen + i] = purl.host[i];
-        status_msg[slen + hlen] = 0;
+    /* A usable cached copy is shown straight away */
+    if (cache_mode != CACHE_RELOAD) {
+        hcache_entry_t *ce = hcache_find(url);
+        if (ce && (cache_mode == CACHE_HISTORY || hcache_fresh(ce))) {
+            hcache_show(ce);
+            nav_gen++;   /* Drop any fetch still in flight */
+            nav_state = NAV_DONE;
+            str_cpy(status_msg, "Done (cached)");
+            if (push_history) history_push(url);
+            return;
+        }
+    }
+
+    /* Hand the request to the fetch thread; the current page stays up
+     * and the status bar follows its progress.                        */
+    if (fetch_thread_id < 0)
+        fetch_thread_id = kthread_create("browser-fetch", fetch_thread, (void *)0);
+    if (fetch_thread_id < 0) {
+        str_cpy(status_msg, "Cannot start fetch");
+        nav_state = NAV_ERROR;
+        return;
     }
+    page_streaming = 0;   /* A page cut off by this navigation stays as it is */
+    nav_state = NAV_LOADING;
+    str_cpy(status_msg, "Loading...");
+    str_ncpy(fetch_url, url, URL_MAX);
+    fetch_push_history = push_history;
+    fetch_gen = ++nav_gen;
+    kthread_signal(&fetch_event);
+}
+
+static void fetch_status(const char *prefix, const char *host)
+{
+    /* Bounded host to prevent overflow */
+    str_cpy(status_msg, prefix);
+    int slen = str_len(status_msg);
+    int hlen = str_len(host);
+    int avail = (int)sizeof(status_msg) - slen - 4; /* room for "..." (3) + NUL (1) */
+    if (hlen > avail) hlen = avail;
+    for (int i = 0; i < hlen; i++) status_msg[slen + i] = host[i];
+    status_msg[slen + hlen] = 0;
     str_cat(status_msg, "...");
+}
+
+static const char *fetch_host = "";
+
+/* Runs on the fetch thread, between its network waits */
+static void fetch_progress(int stage, int bytes)
+{
+    if (nav_state != NAV_LOADING) return;
+    switch (stage) {
+    case NET_PROGRESS_RESOLVING:  fetch_status("Resolving ", fetch_host);   break;
+    case NET_PROGRESS_CONNECTING: fetch_status("Connecting to ", fetch_host); break;
+    case NET_PROGRESS_HANDSHAKE:  fetch_status("Securing ", fetch_host);    break;
+    case NET_PROGRESS_RECEIVING: {
+        char num[16];
+        int kb = bytes / 1024, n = 0;
+        do { num[n++] = (char)('0' + kb % 10); kb /= 10; } while (kb && n < 15);
+        str_cpy(status_msg, "Receiving ");
+        int slen = str_len(status_msg);
+        while (n > 0) status_msg[slen++] = num[--n];
+        status_msg[slen] = 0;
+        str_cat(status_msg, " KB...");
+        break;
+    }
+    default: return;
+    }
+    if (browser_win) compositor_invalidate_window(browser_win, (void *)0);
+}
 
-    if (purl.is_https) {
-        str_cpy(status_msg, "Connecting (HTTPS)...");
-        /* Use HTTPS GET via TLS */
-        int result = https_get(purl.host, purl.port, purl.path, page_buf, PAGE_BUF_SIZE);
-        if (result < 0) {
-            str_cpy(page_buf,
+/* Runs on the fetch thread as body bytes arrive: the first chunk
+ * replaces the current page, and each one is laid out at the next paint. */
+static uint32_t stream_gen;
+static int      stream_started;
+
+static void fetch_body(const char *data, int len)
+{
+    if (stream_gen != nav_gen) return;
+    if (!stream_started) {
+        stream_started = 1;
+        page_streaming = 1;
+        page_len = 0;
+        dl_valid = 0;
+        page_title[0] = 0;
+        focused_input = -1;
+        scroll_y = 0;
+    }
+    if (page_reserve(page_len + len) != 0) len = page_cap ? page_cap - 1 - page_len : 0;
+    if (len <= 0) return;
+    for (int i = 0; i < len; i++) page_buf[page_len + i] = data[i];
+    page_len += len;
+    page_buf[page_len] = 0;
+    if (browser_win) compositor_invalidate_window(browser_win, (void *)0);
+}
+
+static void fetch_thread(void *arg)
+{
+    (void)arg;
+    char url[URL_MAX];
+    for (;;) {
+        kthread_wait_event(&fetch_event, 0);
+        uint32_t gen = fetch_gen;
+        int push_history = fetch_push_history;
+        str_ncpy(url, fetch_url, URL_MAX);
+
+        parsed_url_t purl;
+        if (!parse_url(url, &purl)) continue;
+
+        /* Ask for the body only if it changed since the cached copy */
+        char conditional[160];
+        conditional[0] = 0;
+        hcache_entry_t *ce = hcache_find(url);
+        if (ce && ce->etag[0]) {
+            str_cpy(conditional, "If-None-Match: ");
+            str_cat(conditional, ce->etag);
+            str_cat(conditional, "\r\n");
+        } else if (ce && ce->last_modified[0]) {
+            str_cpy(conditional, "If-Modified-Since: ");
+            str_cat(conditional, ce->last_modified);
+            str_cat(conditional, "\r\n");
+        }
+
+        fetch_host = purl.host;
+        stream_gen = gen;
+        stream_started = 0;
+        net_set_progress_hook(fetch_progress);
+        net_set_body_hook(fetch_body);
+        net_set_request_headers(conditional[0] ? conditional : (void *)0);
+        rope_init(&fetch_rope, PAGE_MAX - 1);
+        int result = purl.is_https
+            ? https_get(purl.host, purl.port, purl.path, &fetch_rope)
+            : http_get(purl.host, purl.port, purl.path, &fetch_rope);
+        net_set_request_headers((void *)0);
+        net_set_progress_hook((void *)0);
+        net_set_body_hook((void *)0);
+        fetch_host = "";
+        const http_response_info_t *resp = net_last_response();
+
+        /* Superseded by a newer navigation, or the browser was reset */
+        if (gen != nav_gen) {
+            rope_free(&fetch_rope);
+            continue;
+        }
+
+        /* Not modified: the cached copy is current (look it up again,
+         * the UI thread may have moved it while we waited)            */
+        if (result >= 0 && resp->status == 304) {
+            rope_free(&fetch_rope);
+            ce = hcache_find(url);
+            if (ce) {
+                hcache_update(ce, resp);
+                hcache_show(ce);
+                nav_state = NAV_DONE;
+                str_cpy(status_msg, "Done (not modified)");
+                if (push_history) history_push(url);
+                if (browser_win) compositor_invalidate_window(browser_win, (void *)0);
+                continue;
+            }
+            kthread_signal(&fetch_event);   /* Gone: fetch it in full */
+            continue;
+        }
+
+        if (result < 0 && purl.is_https) {
+            page_set_str(
                 "<html><body bgcolor=\"#FFF0F0\">"
                 "<h1>HTTPS Connection Failed</h1>"
                 "<p>Could not establish a secure connection to the server.</p>"
                 "<p>The server may not support the TLS version used by nextOS.</p>"
                 "<p>Try using <b>http://</b> instead if available.</p>"
                 "</body></html>");
-            page_len = str_len(page_buf);
-            str_cpy(page_title, "HTTPS Error");
+            dl_valid = 0;
+            page_streaming = 0;
             scroll_y = 0;
+            str_cpy(page_title, "HTTPS Error");
             nav_state = NAV_ERROR;
             str_cpy(status_msg, "HTTPS connection failed");
-            return;
-        }
-        page_len = result;
-    } else {
-        /* Perform HTTP GET */
-        int result = http_get(purl.host, purl.port, purl.path, page_buf, PAGE_BUF_SIZE);
-        if (result < 0) {
-            str_cpy(page_buf,
+        } else if (result < 0) {
+            page_set_str(
                 "<html><body bgcolor=\"#FFF0F0\">"
                 "<h1>Connection Failed</h1>"
                 "<p>Could not connect to the server.</p>"
                 "<p>Please check the URL and try again.</p>"
                 "</body></html>");
-            page_len = str_len(page_buf);
-            str_cpy(page_title, "Connection Error");
+            dl_valid = 0;
+            page_streaming = 0;
             scroll_y = 0;
+            str_cpy(page_title, "Connection Error");
             nav_state = NAV_ERROR;
             str_cpy(status_msg, "Connection failed");
-            return;
+        } else {
+            /* Bodies that were not streamed (error pages) are installed whole */
+            if (!stream_started || page_len != result) {
+                if (page_reserve(result) != 0) result = page_cap ? page_cap - 1 : 0;
+                page_len = (int)rope_copy(&fetch_rope, 0, page_buf, (uint32_t)result);
+                page_buf[page_len] = 0;
+                dl_valid = 0;
+                page_title[0] = 0;  /* Will be set by renderer */
+                focused_input = -1;
+                scroll_y = 0;
+            }
+            page_streaming = 0;
+            hcache_store(url, page_buf, page_len, resp);
+            nav_state = NAV_DONE;
+            str_cpy(status_msg, "Done");
+            if (push_history) history_push(url);
         }
-        page_len = result;
+        rope_free(&fetch_rope);
+        if (browser_win) compositor_invalidate_window(browser_win, (void *)0);
     }
-
-    page_title[0] = 0;  /* Will be set by renderer */
-    scroll_y = 0;
-    focused_input = -1;
-    nav_state = NAV_DONE;
-    str_cpy(status_msg, "Done");
-
-    if (push_history) history_push(url);
 }
 
 static void go_back(void)
@@ -2892,7 +3614,7 @@ static void go_back(void)
         history_pos--;
         str_cpy(url_bar, history_urls[history_pos]);
         url_cursor = str_len(url_bar);
-        navigate_internal(url_bar, 0);
+        navigate_internal(url_bar, 0, CACHE_HISTORY);
     }
 }
 
@@ -2902,13 +3624,13 @@ static void go_forward(void)
         history_pos++;
         str_cpy(url_bar, history_urls[history_pos]);
         url_cursor = str_len(url_bar);
-        navigate_internal(url_bar, 0);
+        navigate_internal(url_bar, 0, CACHE_HISTORY);
     }
 }
 
 static void refresh_page(void)
 {
-    navigate_internal(url_bar, 0);
+    navigate_internal(url_bar, 0, CACHE_RELOAD);
 }
 
 /* ── Paint ───────────────────────────────────────────────────────────── */
@@ -3010,9 +3732,10 @@ static void browser_paint(window_t *win)
         }
     }
 
-    /* Cursor blink */
+    /* Cursor blink (repaint again at the next blink edge) */
     if (url_focused) {
         uint64_t t = timer_get_ticks();
+        compositor_schedule_repaint(win, (uint32_t)(500 - t % 500));
         if ((t / 500) & 1) {
             int cx = url_x + 4 + (url_cursor - start) * 8;
             if (cx >= url_x && cx < url_x + url_w)
@@ -3026,11 +3749,12 @@ static void browser_paint(window_t *win)
     int content_w = cw - SCROLLBAR_W;
 
     if (page_len > 0) {
-        /* Render HTML into a sub-canvas area */
-        uint32_t *content_canvas = win->canvas + content_y * cw;
-        /* Clear content area */
-        fill_rect(win->canvas, cw, ch, 0, content_y, content_w, content_h, 0xFFFFFF);
-        render_html(page_buf, page_len, content_canvas, cw, content_h, scroll_y);
+        /* Lay out once per page and width; each frame replays the list */
+        if (!dl_valid || dl_width != cw)
+            render_begin(page_buf, page_len, cw, !page_streaming);
+        if (lay_pos < page_len || (!lay_final && !page_streaming))
+            render_feed(page_buf, page_len, !page_streaming);
+        dl_paint(win->canvas + content_y * cw, cw, content_h, scroll_y);
     } else {
         fill_rect(win->canvas, cw, ch, 0, content_y, content_w, content_h, 0xFFFFFF);
         if (nav_state == NAV_LOADING) {
@@ -3450,6 +4174,20 @@ static void browser_close(window_t *win)
 {
     (void)win;
     browser_win = 0;
+    tile_release_all();
+}
+
+/* ── Offscreen rendering (benchmark suite) ───────────────────────────── */
+int browser_render_html(const char *html, int len, uint32_t *canvas, int cw, int ch)
+{
+    /* Layout state is the open page's: not while a window shows one */
+    if (browser_win && browser_win->active) return -1;
+
+    render_begin(html, len, cw, 1);
+    render_feed(html, len, 1);
+    dl_paint(canvas, cw, ch, 0);
+    dl_valid = 0;
+    return content_total_h;
 }
 
 /* ── Launch ──────────────────────────────────────────────────────────── */
@@ -3479,4 +4217,7 @@ void browser_launch(void)
     load_homepage();
     history_push("about:home");
     prev_buttons = 0;
+
+    /* Cached bodies used to be spilled here, into the user's files */
+    vfs_delete(HCACHE_OLD_DIR);
 }
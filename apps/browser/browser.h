@@ -5,6 +5,17 @@
 #ifndef NEXTOS_BROWSER_H
 #define NEXTOS_BROWSER_H
 
+#include <stdint.h>
+
+/* Memory the browser may spend on rasterised page tiles */
+#define BROWSER_TILE_BUDGET (8u << 20)
+
 void browser_launch(void);
+void browser_set_tile_budget(uint32_t bytes);
+
+/* Lay out a complete page `cw` pixels wide and paint its top `ch` rows
+ * into canvas, as the page area would.  Returns the content height, or
+ * -1 while the browser window is open.                               */
+int  browser_render_html(const char *html, int len, uint32_t *canvas, int cw, int ch);
 
 #endif /* NEXTOS_BROWSER_H */
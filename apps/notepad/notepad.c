@@ -4,26 +4,33 @@
  *
  * Features:
  *   - Full text editing (cursor, backspace, enter, arrow keys)
- *   - Open / Save file dialogs using kernel VFS + disk I/O
+ *   - Piece-table buffer with a line index (textbuf.c), so editing and
+ *     painting cost O(log n) in the size of the document
+ *   - Open / Save file dialogs using kernel VFS + disk I/O; files are
+ *     read in chunks by a background thread, so large ones open without
+ *     holding up the compositor
  *   - Visual design: ruled yellow paper with red margin line
  */
 #include "notepad.h"
+#include "textbuf.h"
 #include "kernel/ui/compositor.h"
 #include "kernel/gfx/framebuffer.h"
+#include "kernel/gfx/text.h"
 #include "kernel/fs/vfs.h"
 #include "kernel/mem/heap.h"
 #include "kernel/drivers/keyboard.h"
+#include "kernel/sched/kthread.h"
 
 /* ── Text buffer ──────────────────────────────────────────────────────── */
-#define TEXT_MAX    8192
 #define LINE_HEIGHT 18
 #define CHAR_WIDTH  8
 #define MAX_PATH    256
+#define ROW_MAX     256           /* Widest row drawn, in characters */
+#define IO_CHUNK    (64 * 1024)   /* Bytes per vfs_read / vfs_write */
 
 static window_t *notepad_win = (void *)0;
-static char      text_buf[TEXT_MAX];
-static int       text_len = 0;
-static int       cursor_pos = 0;
+static textbuf_t doc;
+static uint32_t  cursor_pos = 0;
 static int       scroll_y = 0;
 static char      file_path[MAX_PATH] = "";
 static int       dialog_mode = 0;  /* 0=none, 1=open, 2=save, 3=unsaved prompt */
@@ -32,9 +39,22 @@ static int       dialog_input_len = 0;
 static int       np_scrollbar_dragging = 0;
 static int       np_scrollbar_drag_offset = 0;
 static int       modified = 0;  /* Track unsaved changes */
+static int       save_failed = 0; /* Last save did not reach disk */
 static int       select_all_active = 0;       /* Text select-all flag */
 static int       dialog_select_all = 0;       /* Dialog input select-all flag */
 
+/* Background loading: load_file queues the path for the load thread,
+ * which reads the file into load_doc a chunk at a time and swaps it in
+ * when done.  doc_gen tells it whether its load is still wanted.      */
+static textbuf_t        load_doc;
+static char             load_path[MAX_PATH];
+static uint32_t         load_gen = 0;
+static uint32_t         doc_gen = 0;
+static int              loading = 0;
+static uint64_t         load_done = 0, load_size = 0;
+static int              load_thread_id = -1;
+static kthread_event_t  load_event;
+
 /* ── Skeuomorphic colours ─────────────────────────────────────────────── */
 #define COL_PAPER      0xFFF8C8   /* Legal pad yellow */
 #define COL_PAPER_DARK 0xF0E8A0
@@ -53,56 +73,10 @@ static int       dialog_select_all = 0;       /* Dialog input select-all flag */
 #define COL_SELECT_TXT 0xFFFFFF   /* White text on selection */
 
 /* ── Canvas font renderer ─────────────────────────────────────────────── */
-extern const uint8_t font_8x16[95][16];
-
-static void canvas_draw_char(uint32_t *canvas, int cw, int ch,
-                             int x, int y, char c, uint32_t fg)
-{
-    if (c < 32 || c > 126) c = '?';
-    const uint8_t *glyph = font_8x16[c - 32];
-    for (int row = 0; row < 16; row++) {
-        int py = y + row;
-        if (py < 0 || py >= ch) continue;
-        uint8_t bits = glyph[row];
-        uint8_t bits_above = (row > 0)  ? glyph[row - 1] : 0;
-        uint8_t bits_below = (row < 15) ? glyph[row + 1] : 0;
-        for (int col = 0; col < 8; col++) {
-            int px = x + col;
-            if (px < 0 || px >= cw) continue;
-            uint8_t mask = 0x80 >> col;
-            if (bits & mask) {
-                canvas[py * cw + px] = fg;
-            } else {
-                int neighbors = 0;
-                if (bits_above & mask) neighbors++;
-                if (bits_below & mask) neighbors++;
-                if (col > 0 && (bits & (mask << 1))) neighbors++;
-                if (col < 7 && (bits & (mask >> 1))) neighbors++;
-                if (neighbors > 0) {
-                    uint32_t base = canvas[py * cw + px];
-                    uint8_t sr = (fg >> 16) & 0xFF, sg = (fg >> 8) & 0xFF, sb = fg & 0xFF;
-                    uint8_t dr = (base >> 16) & 0xFF, dg = (base >> 8) & 0xFF, db = base & 0xFF;
-                    uint8_t alpha = (uint8_t)(neighbors * 40);
-                    uint8_t rr = (sr * alpha + dr * (255 - alpha)) / 255;
-                    uint8_t rg = (sg * alpha + dg * (255 - alpha)) / 255;
-                    uint8_t rb = (sb * alpha + db * (255 - alpha)) / 255;
-                    canvas[py * cw + px] = ((uint32_t)rr << 16) | ((uint32_t)rg << 8) | (uint32_t)rb;
-                }
-            }
-        }
-    }
-}
-
 static void canvas_draw_string(uint32_t *canvas, int cw, int ch,
                                int x, int y, const char *s, uint32_t fg)
 {
-    int cx = x;
-    while (*s) {
-        if (*s >= 32 && *s <= 126)
-            canvas_draw_char(canvas, cw, ch, cx, y, *s, fg);
-        cx += 8;
-        s++;
-    }
+    text_draw_canvas(canvas, cw, ch, x, y, s, -1, fg, TEXT_AA);
 }
 
 /* ── Helpers ──────────────────────────────────────────────────────────── */
@@ -145,59 +119,56 @@ static void draw_gradient(uint32_t *c, int cw, int ch,
     }
 }
 
-/* Get column of cursor on its current line */
-static int cursor_column(void)
-{
-    int col = 0;
-    for (int i = cursor_pos - 1; i >= 0 && text_buf[i] != '\n'; i--)
-        col++;
-    return col;
-}
-
 /* ── Draw text content ────────────────────────────────────────────────── */
+/* Only the rows on screen are read out of the buffer, each up to the
+ * right edge.  A row is drawn as one run of glyphs, split at the cursor
+ * so it stays under the glyph it precedes.                            */
 static void draw_text_area(uint32_t *canvas, int cw, int ch)
 {
     int text_x = 50;  /* After margin line */
     int text_y_start = 36;
-    int line = 0;
-    int col = 0;
     uint32_t text_color = select_all_active ? COL_SELECT_TXT : COL_TEXT_COL;
+    char row[ROW_MAX];
 
-    for (int i = 0; i <= text_len; i++) {
-        int screen_y = text_y_start + line * LINE_HEIGHT - scroll_y;
+    int max_cols = (cw - 4 - text_x + CHAR_WIDTH - 1) / CHAR_WIDTH;
+    if (max_cols < 0) max_cols = 0;
+    if (max_cols > ROW_MAX) max_cols = ROW_MAX;
 
-        /* Draw cursor */
-        if (i == cursor_pos && screen_y >= text_y_start && screen_y < ch - 4) {
-            fill_rect(canvas, cw, ch, text_x + col * CHAR_WIDTH,
-                      screen_y, 2, LINE_HEIGHT, COL_CURSOR);
-        }
+    uint32_t lines = textbuf_lines(&doc);
+    uint32_t cur_line = textbuf_line_of(&doc, cursor_pos);
+    uint32_t cur_col = cursor_pos - textbuf_line_start(&doc, cur_line);
 
-        if (i >= text_len) break;
+    for (uint32_t line = (uint32_t)(scroll_y + LINE_HEIGHT - 1) / LINE_HEIGHT;
+         line < lines; line++) {
+        int screen_y = text_y_start + (int)line * LINE_HEIGHT - scroll_y;
+        if (screen_y >= ch - 4) break;
 
-        if (text_buf[i] == '\n') {
-            /* Selection highlight for trailing newline area */
-            if (select_all_active && screen_y >= text_y_start && screen_y < ch - 4) {
-                fill_rect(canvas, cw, ch, text_x + col * CHAR_WIDTH,
+        uint32_t len = textbuf_line_length(&doc, line);
+        int n = len < (uint32_t)max_cols ? (int)len : max_cols;
+        textbuf_read(&doc, textbuf_line_start(&doc, line), (uint32_t)n, row);
+        for (int i = 0; i < n; i++)
+            if (row[i] < 32 || row[i] > 126) row[i] = '?';
+
+        if (select_all_active) {
+            fill_rect(canvas, cw, ch, text_x, screen_y,
+                      n * CHAR_WIDTH, LINE_HEIGHT, COL_SELECT_BG);
+            /* Trailing newline area */
+            if (line + 1 < lines)
+                fill_rect(canvas, cw, ch, text_x + (int)len * CHAR_WIDTH,
                           screen_y, CHAR_WIDTH, LINE_HEIGHT, COL_SELECT_BG);
-            }
-            line++;
-            col = 0;
-        } else {
-            /* Render character glyph into canvas */
-            if (screen_y >= text_y_start && screen_y < ch - 4 &&
-                text_x + col * CHAR_WIDTH < cw - 4) {
-                /* Draw selection background behind character */
-                if (select_all_active) {
-                    fill_rect(canvas, cw, ch,
-                              text_x + col * CHAR_WIDTH, screen_y,
-                              CHAR_WIDTH, LINE_HEIGHT, COL_SELECT_BG);
-                }
-                canvas_draw_char(canvas, cw, ch,
-                                 text_x + col * CHAR_WIDTH, screen_y,
-                                 text_buf[i], text_color);
-            }
-            col++;
         }
+
+        int split = n;
+        if (line == cur_line && cur_col < (uint32_t)n) split = (int)cur_col;
+        if (split > 0)
+            text_draw_canvas(canvas, cw, ch, text_x, screen_y, row, split,
+                             text_color, TEXT_AA);
+        if (line == cur_line)
+            fill_rect(canvas, cw, ch, text_x + (int)cur_col * CHAR_WIDTH,
+                      screen_y, 2, LINE_HEIGHT, COL_CURSOR);
+        if (split < n)
+            text_draw_canvas(canvas, cw, ch, text_x + split * CHAR_WIDTH, screen_y,
+                             row + split, n - split, text_color, TEXT_AA);
     }
 }
 
@@ -299,6 +270,21 @@ static void notepad_paint(window_t *win)
     draw_gradient(win->canvas, cw, ch, 116, 4, 50, 24, COL_BTN_T, COL_BTN_B);
     canvas_draw_string(win->canvas, cw, ch, 120, 8, "Save", 0x1A1A1A);
 
+    /* Load progress */
+    if (loading) {
+        char msg[24] = "Loading... ";
+        int pct = load_size ? (int)(load_done * 100 / load_size) : 0;
+        int i = 11;
+        if (pct >= 100) msg[i++] = '1';
+        if (pct >= 10) msg[i++] = (char)('0' + pct / 10 % 10);
+        msg[i++] = (char)('0' + pct % 10);
+        msg[i++] = '%';
+        msg[i] = 0;
+        canvas_draw_string(win->canvas, cw, ch, 180, 8, msg, 0x1A1A1A);
+    } else if (save_failed) {
+        canvas_draw_string(win->canvas, cw, ch, 180, 8, "Save failed", 0xA01010);
+    }
+
     /* Paper area */
     int paper_y = 32;
     int paper_h = ch - paper_y;
@@ -324,11 +310,7 @@ static void notepad_paint(window_t *win)
     {
         int sb_x = cw - 14;
         fill_rect(win->canvas, cw, ch, sb_x, paper_y, 14, paper_h, 0xD0C8B8);
-        /* Count total lines */
-        int total_lines = 1;
-        for (int i = 0; i < text_len; i++) {
-            if (text_buf[i] == '\n') total_lines++;
-        }
+        int total_lines = (int)textbuf_lines(&doc);
         int visible_lines = paper_h / LINE_HEIGHT;
         if (visible_lines < 1) visible_lines = 1;
         if (total_lines > visible_lines) {
@@ -336,7 +318,7 @@ static void notepad_paint(window_t *win)
             if (max_scroll < 1) max_scroll = 1;
             int thumb_h = paper_h * visible_lines / total_lines;
             if (thumb_h < 20) thumb_h = 20;
-            int thumb_y = paper_y + (paper_h - thumb_h) * scroll_y / max_scroll;
+            int thumb_y = paper_y + (int)((int64_t)(paper_h - thumb_h) * scroll_y / max_scroll);
             if (thumb_y + thumb_h > paper_y + paper_h)
                 thumb_y = paper_y + paper_h - thumb_h;
             fill_rect(win->canvas, cw, ch, sb_x + 2, thumb_y, 10, thumb_h, 0x807060);
@@ -370,67 +352,154 @@ static void build_full_path(const char *input, char *out, int max_len)
 }
 
 /* ── File I/O ─────────────────────────────────────────────────────────── */
-static void load_file(const char *path)
+static void copy_path(char *dst, const char *src)
 {
-    char full_path[MAX_PATH];
-    build_full_path(path, full_path, MAX_PATH);
+    int i = 0;
+    while (src[i] && i < MAX_PATH - 1) { dst[i] = src[i]; i++; }
+    dst[i] = 0;
+}
 
+/* Read path into load_doc and make it the document, unless doc_gen moves
+ * past gen first.  Yields between chunks when run on the load thread.  */
+static void load_document(const char *path, uint32_t gen)
+{
     vfs_node_t node;
-    if (vfs_open(full_path, &node) != 0) return;
-    if (node.type != VFS_FILE) return;
+    int ok = vfs_open(path, &node) == 0 && node.type == VFS_FILE &&
+             node.size <= TEXTBUF_MAX_SIZE;
+    char *dst = ok ? textbuf_load_begin(&load_doc, (uint32_t)node.size) : (void *)0;
+    ok = dst != (void *)0;
+
+    load_size = ok ? node.size : 0;
+    load_done = 0;
+    while (ok && load_done < load_size) {
+        uint64_t n = load_size - load_done;
+        if (n > IO_CHUNK) n = IO_CHUNK;
+        int got = vfs_read(&node, load_done, n, dst + load_done);
+        if (got <= 0) break;
+        if (textbuf_load_data(&load_doc, (uint32_t)got) < 0) ok = 0;
+        load_done += (uint64_t)got;
+
+        if (notepad_win) compositor_invalidate_window(notepad_win, (void *)0);
+        kthread_yield();
+        if (gen != doc_gen) {
+            textbuf_free(&load_doc);
+            return;
+        }
+    }
+    if (ok && (load_done < load_size || textbuf_load_end(&load_doc) < 0)) ok = 0;
 
-    int bytes = vfs_read(&node, 0, TEXT_MAX - 1, text_buf);
-    if (bytes > 0) {
-        text_len = bytes;
-        text_buf[text_len] = 0;
+    /* A file that cannot be read in full leaves the document as it was */
+    loading = 0;
+    if (ok) {
+        textbuf_free(&doc);
+        doc = load_doc;
+        textbuf_init(&load_doc);
+        copy_path(file_path, path);
+        cursor_pos = 0;
+        scroll_y = 0;
+        modified = 0;
+        select_all_active = 0;
     } else {
-        text_len = 0;
-        text_buf[0] = 0;
+        textbuf_free(&load_doc);
     }
-    cursor_pos = 0;
-    scroll_y = 0;
-    modified = 0;
+    if (notepad_win) compositor_invalidate_window(notepad_win, (void *)0);
+}
 
-    /* Store file path only on successful read */
-    if (bytes > 0) {
-        int i = 0;
-        while (full_path[i] && i < MAX_PATH - 1) { file_path[i] = full_path[i]; i++; }
-        file_path[i] = 0;
-    } else {
-        file_path[0] = 0;
+static void load_thread(void *arg)
+{
+    (void)arg;
+    char path[MAX_PATH];
+    for (;;) {
+        kthread_wait_event(&load_event, 0);
+        uint32_t gen = load_gen;
+        if (gen != doc_gen) continue;
+        copy_path(path, load_path);
+        load_document(path, gen);
     }
 }
 
-static void save_file(const char *path)
+static void load_file(const char *path)
 {
     char full_path[MAX_PATH];
     build_full_path(path, full_path, MAX_PATH);
 
+    copy_path(load_path, full_path);
+    load_gen = ++doc_gen;
+    loading = 1;
+    load_done = load_size = 0;
+
+    if (load_thread_id < 0)
+        load_thread_id = kthread_create("notepad-load", load_thread, (void *)0);
+    if (load_thread_id < 0) {
+        load_document(full_path, load_gen);   /* No thread: read it here */
+        return;
+    }
+    kthread_signal(&load_event);
+}
+
+/* Write the document to a "~" sibling first and only replace the
+ * original once every byte is down, so a failed save never costs the
+ * user their file.  Returns 0 on success.                          */
+static int save_file(const char *path)
+{
+    char full_path[MAX_PATH], tmp_path[MAX_PATH];
+    build_full_path(path, full_path, MAX_PATH);
+
+    int plen = 0;
+    while (full_path[plen]) plen++;
+    save_failed = 1;
+    if (plen + 2 > MAX_PATH) return -1;
+    copy_path(tmp_path, full_path);
+    tmp_path[plen] = '~';
+    tmp_path[plen + 1] = 0;
+
+    char *chunk = kmalloc(IO_CHUNK);
+    if (!chunk) return -1;
+
     vfs_node_t node;
-    /* Try to open existing file first */
-    if (vfs_open(full_path, &node) != 0) {
-        /* File doesn't exist, try to create it */
-        if (vfs_create(full_path, VFS_FILE) != 0) return;
-        if (vfs_open(full_path, &node) != 0) return;
+    int ok = 0;
+    vfs_delete(tmp_path);
+    if (vfs_create(tmp_path, VFS_FILE) == 0 && vfs_open(tmp_path, &node) == 0) {
+        uint32_t len = textbuf_length(&doc);
+        uint32_t off = 0;
+        while (off < len) {
+            uint32_t n = textbuf_read(&doc, off, IO_CHUNK, chunk);
+            if (n == 0 || vfs_write(&node, off, n, chunk) != (int)n) break;
+            off += n;
+        }
+        ok = off == len;
+    }
+    kfree(chunk);
+
+    if (ok) {
+        vfs_delete(full_path);
+        ok = vfs_rename(tmp_path, full_path) == 0;
     }
-    vfs_write(&node, 0, text_len, text_buf);
+    if (!ok) {
+        vfs_delete(tmp_path);
+        return -1;
+    }
+
+    save_failed = 0;
     modified = 0;
 
     /* Update stored path */
-    int i = 0;
-    while (full_path[i] && i < MAX_PATH - 1) { file_path[i] = full_path[i]; i++; }
-    file_path[i] = 0;
+    copy_path(file_path, full_path);
+    return 0;
 }
 
 /* ── New document helper ──────────────────────────────────────────────── */
 static void new_document(void)
 {
-    text_len = 0;
-    text_buf[0] = 0;
+    doc_gen++;      /* Drop any load still in flight */
+    loading = 0;
+    textbuf_free(&doc);
     cursor_pos = 0;
     scroll_y = 0;
     file_path[0] = 0;
     modified = 0;
+    save_failed = 0;
+    select_all_active = 0;
 }
 
 /* ── Mouse callback ───────────────────────────────────────────────────── */
@@ -448,10 +517,7 @@ static void notepad_mouse(window_t *win, int mx, int my, int buttons)
             np_scrollbar_dragging = 0;
             return;
         }
-        int total_lines = 1;
-        for (int i = 0; i < text_len; i++) {
-            if (text_buf[i] == '\n') total_lines++;
-        }
+        int total_lines = (int)textbuf_lines(&doc);
         int visible_lines = paper_h / LINE_HEIGHT;
         if (visible_lines < 1) visible_lines = 1;
         int max_scroll = (total_lines - visible_lines) * LINE_HEIGHT;
@@ -462,7 +528,7 @@ static void notepad_mouse(window_t *win, int mx, int my, int buttons)
             int track_range = paper_h - thumb_h;
             if (track_range > 0) {
                 int thumb_top = my - np_scrollbar_drag_offset;
-                int new_scroll = (thumb_top - paper_y) * max_scroll / track_range;
+                int new_scroll = (int)((int64_t)(thumb_top - paper_y) * max_scroll / track_range);
                 if (new_scroll < 0) new_scroll = 0;
                 if (new_scroll > max_scroll) new_scroll = max_scroll;
                 scroll_y = new_scroll;
@@ -474,10 +540,7 @@ static void notepad_mouse(window_t *win, int mx, int my, int buttons)
     /* Handle scroll wheel */
     int scroll = compositor_get_smooth_scroll();
     if (scroll != 0) {
-        int total_lines = 1;
-        for (int i = 0; i < text_len; i++) {
-            if (text_buf[i] == '\n') total_lines++;
-        }
+        int total_lines = (int)textbuf_lines(&doc);
         int visible_lines = paper_h / LINE_HEIGHT;
         if (visible_lines < 1) visible_lines = 1;
         int max_scroll = (total_lines - visible_lines) * LINE_HEIGHT;
@@ -500,8 +563,9 @@ static void notepad_mouse(window_t *win, int mx, int my, int buttons)
             if (mx >= dx + 20 && mx < dx + 90 &&
                 my >= dy + dh - 36 && my < dy + dh - 12) {
                 if (file_path[0]) {
-                    save_file(file_path);
-                    new_document();
+                    /* Keep the text if it could not be written */
+                    if (save_file(file_path) == 0) new_document();
+                    dialog_mode = 0;
                 } else {
                     /* Need to ask for filename first */
                     dialog_mode = 2;
@@ -545,7 +609,7 @@ static void notepad_mouse(window_t *win, int mx, int my, int buttons)
 
     /* Toolbar: New button */
     if (mx >= 4 && mx < 54 && my >= 4 && my < 28) {
-        if (modified && text_len > 0) {
+        if (modified && textbuf_length(&doc) > 0) {
             /* Ask about unsaved changes */
             dialog_mode = 3;
         } else {
@@ -560,8 +624,9 @@ static void notepad_mouse(window_t *win, int mx, int my, int buttons)
         dialog_input[0] = 0;
         return;
     }
-    /* Toolbar: Save button */
+    /* Toolbar: Save button (the document is about to be replaced) */
     if (mx >= 116 && mx < 166 && my >= 4 && my < 28) {
+        if (loading) return;
         if (file_path[0]) {
             save_file(file_path);
         } else {
@@ -574,10 +639,7 @@ static void notepad_mouse(window_t *win, int mx, int my, int buttons)
 
     /* Scrollbar click/drag on right side */
     if (mx >= cw - 14 && my >= paper_y && my < paper_y + paper_h) {
-        int total_lines = 1;
-        for (int i = 0; i < text_len; i++) {
-            if (text_buf[i] == '\n') total_lines++;
-        }
+        int total_lines = (int)textbuf_lines(&doc);
         int visible_lines = paper_h / LINE_HEIGHT;
         if (visible_lines < 1) visible_lines = 1;
         if (total_lines > visible_lines) {
@@ -588,7 +650,7 @@ static void notepad_mouse(window_t *win, int mx, int my, int buttons)
             int track_range = paper_h - thumb_h;
             int thumb_y = paper_y;
             if (track_range > 0)
-                thumb_y = paper_y + track_range * scroll_y / max_scroll;
+                thumb_y = paper_y + (int)((int64_t)track_range * scroll_y / max_scroll);
             if (my >= thumb_y && my < thumb_y + thumb_h) {
                 np_scrollbar_dragging = 1;
                 np_scrollbar_drag_offset = my - thumb_y;
@@ -610,16 +672,14 @@ static void notepad_mouse(window_t *win, int mx, int my, int buttons)
         int col_click  = (mx - 50) / CHAR_WIDTH;
         if (col_click < 0) col_click = 0;
 
-        /* Find position in text buffer */
-        int line = 0, col = 0, pos = 0;
-        for (int i = 0; i < text_len; i++) {
-            if (line == line_click && col == col_click) { pos = i; break; }
-            if (text_buf[i] == '\n') { line++; col = 0; }
-            else col++;
-            pos = i + 1;
+        /* Past the last line: end of text; past a line's end: its end */
+        if ((uint32_t)line_click >= textbuf_lines(&doc)) {
+            cursor_pos = textbuf_length(&doc);
+        } else {
+            uint32_t len = textbuf_line_length(&doc, (uint32_t)line_click);
+            cursor_pos = textbuf_line_start(&doc, (uint32_t)line_click) +
+                         ((uint32_t)col_click < len ? (uint32_t)col_click : len);
         }
-        if (pos > text_len) pos = text_len;
-        cursor_pos = pos;
     }
 }
 
@@ -663,6 +723,9 @@ static void notepad_key(window_t *win, char ascii, int scancode, int pressed)
         return;
     }
 
+    /* The document is about to be replaced */
+    if (loading) return;
+
     /* CTRL+A: select all text */
     if (ctrl && scancode == 0x1E) {
         select_all_active = 1;
@@ -672,15 +735,11 @@ static void notepad_key(window_t *win, char ascii, int scancode, int pressed)
     /* Backspace */
     if (ascii == '\b') {
         if (select_all_active) {
-            text_len = 0;
+            textbuf_free(&doc);
             cursor_pos = 0;
-            text_buf[0] = 0;
             select_all_active = 0;
             modified = 1;
-        } else if (cursor_pos > 0) {
-            for (int i = cursor_pos - 1; i < text_len - 1; i++)
-                text_buf[i] = text_buf[i + 1];
-            text_len--;
+        } else if (cursor_pos > 0 && textbuf_delete(&doc, cursor_pos - 1, 1) == 0) {
             cursor_pos--;
             modified = 1;
         }
@@ -693,48 +752,33 @@ static void notepad_key(window_t *win, char ascii, int scancode, int pressed)
 
     /* Arrow keys (scan codes) */
     if (scancode == 0x4B && cursor_pos > 0) { cursor_pos--; return; }         /* Left  */
-    if (scancode == 0x4D && cursor_pos < text_len) { cursor_pos++; return; }   /* Right */
-    if (scancode == 0x48) { /* Up */
-        int col = cursor_column();
-        /* Move to previous line */
-        int pos = cursor_pos - col - 1;  /* end of previous line */
-        if (pos >= 0) {
-            int prev_start = pos;
-            while (prev_start > 0 && text_buf[prev_start - 1] != '\n')
-                prev_start--;
-            int prev_len = pos - prev_start;
-            cursor_pos = prev_start + (col < prev_len ? col : prev_len);
-        }
+    if (scancode == 0x4D && cursor_pos < textbuf_length(&doc)) {               /* Right */
+        cursor_pos++;
         return;
     }
-    if (scancode == 0x50) { /* Down */
-        int col = cursor_column();
-        /* Find start of next line */
-        int pos = cursor_pos;
-        while (pos < text_len && text_buf[pos] != '\n') pos++;
-        if (pos < text_len) {
-            pos++; /* skip newline */
-            int next_end = pos;
-            while (next_end < text_len && text_buf[next_end] != '\n')
-                next_end++;
-            int next_len = next_end - pos;
-            cursor_pos = pos + (col < next_len ? col : next_len);
+    if (scancode == 0x48 || scancode == 0x50) {                               /* Up, Down */
+        uint32_t line = textbuf_line_of(&doc, cursor_pos);
+        uint32_t col = cursor_pos - textbuf_line_start(&doc, line);
+        if (scancode == 0x48) {
+            if (line == 0) return;
+            line--;
+        } else {
+            if (line + 1 >= textbuf_lines(&doc)) return;
+            line++;
         }
+        uint32_t len = textbuf_line_length(&doc, line);
+        cursor_pos = textbuf_line_start(&doc, line) + (col < len ? col : len);
         return;
     }
 
     /* Normal character insertion */
     if (ascii >= 32 || ascii == '\n' || ascii == '\t') {
         if (select_all_active) {
-            text_len = 0;
+            textbuf_free(&doc);
             cursor_pos = 0;
             select_all_active = 0;
         }
-        if (text_len < TEXT_MAX - 1) {
-            for (int i = text_len; i > cursor_pos; i--)
-                text_buf[i] = text_buf[i - 1];
-            text_buf[cursor_pos] = ascii;
-            text_len++;
+        if (textbuf_insert(&doc, cursor_pos, &ascii, 1) == 0) {
             cursor_pos++;
             modified = 1;
         }
@@ -746,6 +790,7 @@ static void notepad_close(window_t *win)
 {
     (void)win;
     notepad_win = (void *)0;
+    new_document();
 }
 
 /* ── Public: launch notepad ───────────────────────────────────────────── */
@@ -754,9 +799,7 @@ void notepad_launch(void)
     if (notepad_win && notepad_win->active) return;
     notepad_win = (void *)0;
 
-    text_len = 0;
-    cursor_pos = 0;
-    text_buf[0] = 0;
+    new_document();
 
     notepad_win = compositor_create_window("Notepad", 200, 100, 500, 400);
     if (!notepad_win) return;
@@ -773,11 +816,7 @@ void notepad_open_file(const char *path)
     /* Launch notepad window if not already open */
     if (!notepad_win || !notepad_win->active) {
         notepad_win = (void *)0;
-        text_len = 0;
-        cursor_pos = 0;
-        text_buf[0] = 0;
-        file_path[0] = 0;
-        modified = 0;
+        new_document();
         dialog_mode = 0;
 
         notepad_win = compositor_create_window("Notepad", 200, 100, 500, 400);
@@ -788,6 +827,7 @@ void notepad_open_file(const char *path)
         notepad_win->on_close = notepad_close;
     }
 
-    /* Load the file using the absolute path */
+    /* Load the file using the absolute path; it appears when read in */
     load_file(path);
+    compositor_invalidate_window(notepad_win, (void *)0);
 }
@@ -0,0 +1,410 @@
+/*
+ * nextOS - textbuf.c
+ * Piece-table text buffer with a line index, for the notepad
+ *
+ * The piece tree is a treap ordered by document position: each node is
+ * one piece, and its subtree sums (characters and newlines) let a walk
+ * from the root find an offset or line in O(log n).  A piece's own
+ * newline count comes from binary searches in its buffer's newline
+ * list, so splitting a piece never rescans text.  Typing at the end of
+ * the piece just typed into grows that piece instead of adding one.
+ */
+#include "textbuf.h"
+#include "kernel/mem/heap.h"
+
+struct textbuf_piece {
+    uint32_t left, right;
+    uint32_t prio;
+    uint32_t start, len;        /* Span of the buffer                 */
+    uint32_t nl;                /* Newlines in the span               */
+    uint32_t sum_len, sum_nl;   /* Over the whole subtree             */
+    uint8_t  buf;               /* PIECE_ORIG or PIECE_ADD            */
+};
+
+#define PIECE_ORIG 0
+#define PIECE_ADD  1
+
+typedef struct textbuf_piece piece_t;
+
+/* ── Buffers ──────────────────────────────────────────────────────────── */
+static int grow(void **ptr, uint32_t *cap, uint32_t need, uint32_t elem)
+{
+    if (need <= *cap) return 0;
+    uint32_t n = *cap ? *cap : 64;
+    while (n < need) n *= 2;
+    void *p = krealloc(*ptr, (uint64_t)n * elem);
+    if (!p) return -1;
+    *ptr = p;
+    *cap = n;
+    return 0;
+}
+
+static void store_free(textbuf_store_t *s)
+{
+    if (s->data) kfree(s->data);
+    if (s->nl) kfree(s->nl);
+    s->data = (void *)0;
+    s->nl = (void *)0;
+    s->len = s->cap = s->nl_count = s->nl_cap = 0;
+}
+
+/* Record the newlines of data[from, len) */
+static int store_index(textbuf_store_t *s, uint32_t from)
+{
+    for (uint32_t i = from; i < s->len; i++) {
+        if (s->data[i] != '\n') continue;
+        if (grow((void **)&s->nl, &s->nl_cap, s->nl_count + 1, sizeof(uint32_t)) < 0)
+            return -1;
+        s->nl[s->nl_count++] = i;
+    }
+    return 0;
+}
+
+/* Index of the first newline at or after offset */
+static uint32_t nl_lower(const textbuf_store_t *s, uint32_t offset)
+{
+    uint32_t lo = 0, hi = s->nl_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (s->nl[mid] < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static inline const textbuf_store_t *store_of(const textbuf_t *tb, const piece_t *p)
+{
+    return p->buf == PIECE_ADD ? &tb->add : &tb->orig;
+}
+
+static uint32_t span_newlines(const textbuf_t *tb, const piece_t *p)
+{
+    const textbuf_store_t *s = store_of(tb, p);
+    return nl_lower(s, p->start + p->len) - nl_lower(s, p->start);
+}
+
+/* ── Piece tree ───────────────────────────────────────────────────────── */
+static uint32_t node_new(textbuf_t *tb, uint8_t buf, uint32_t start, uint32_t len)
+{
+    uint32_t n = tb->free_node;
+    if (n) {
+        tb->free_node = tb->nodes[n].left;
+    } else {
+        if (grow((void **)&tb->nodes, &tb->node_cap, tb->node_count + 1, sizeof(piece_t)) < 0)
+            return 0;
+        n = tb->node_count++;
+    }
+    tb->seed ^= tb->seed << 13;
+    tb->seed ^= tb->seed >> 17;
+    tb->seed ^= tb->seed << 5;
+
+    piece_t *p = &tb->nodes[n];
+    p->left = p->right = 0;
+    p->prio = tb->seed;
+    p->buf = buf;
+    p->start = start;
+    p->len = len;
+    p->nl = span_newlines(tb, p);
+    p->sum_len = len;
+    p->sum_nl = p->nl;
+    return n;
+}
+
+static void node_release(textbuf_t *tb, uint32_t t)
+{
+    if (!t) return;
+    node_release(tb, tb->nodes[t].left);
+    node_release(tb, tb->nodes[t].right);
+    tb->nodes[t].left = tb->free_node;
+    tb->free_node = t;
+}
+
+static inline void node_update(textbuf_t *tb, uint32_t t)
+{
+    piece_t *p = &tb->nodes[t];
+    p->sum_len = p->len + tb->nodes[p->left].sum_len + tb->nodes[p->right].sum_len;
+    p->sum_nl = p->nl + tb->nodes[p->left].sum_nl + tb->nodes[p->right].sum_nl;
+}
+
+static uint32_t merge(textbuf_t *tb, uint32_t a, uint32_t b)
+{
+    if (!a) return b;
+    if (!b) return a;
+    if (tb->nodes[a].prio > tb->nodes[b].prio) {
+        tb->nodes[a].right = merge(tb, tb->nodes[a].right, b);
+        node_update(tb, a);
+        return a;
+    }
+    tb->nodes[b].left = merge(tb, a, tb->nodes[b].left);
+    node_update(tb, b);
+    return b;
+}
+
+/* Split t into the first pos characters and the rest, cutting the piece
+ * that straddles pos in two.  The cut needs one node, reserved by the
+ * caller so the split itself cannot fail.                            */
+static void split(textbuf_t *tb, uint32_t t, uint32_t pos, uint32_t spare,
+                  uint32_t *l, uint32_t *r)
+{
+    if (!t) { *l = *r = 0; return; }
+    piece_t *p = &tb->nodes[t];
+    uint32_t lsz = tb->nodes[p->left].sum_len;
+
+    if (pos <= lsz) {
+        split(tb, p->left, pos, spare, l, &tb->nodes[t].left);
+        node_update(tb, t);
+        *r = t;
+    } else if (pos >= lsz + p->len) {
+        split(tb, p->right, pos - lsz - p->len, spare, &tb->nodes[t].right, r);
+        node_update(tb, t);
+        *l = t;
+    } else {
+        uint32_t k = pos - lsz;
+        piece_t *q = &tb->nodes[spare];
+        q->buf = p->buf;
+        q->start = p->start + k;
+        q->len = p->len - k;
+        q->nl = span_newlines(tb, q);
+        q->sum_len = q->len;
+        q->sum_nl = q->nl;
+        p->len = k;
+        p->nl -= q->nl;
+        *r = merge(tb, spare, p->right);
+        tb->nodes[t].right = 0;
+        node_update(tb, t);
+        *l = t;
+    }
+}
+
+/* Grow the last piece of t by n characters (with nl newlines) if it ends
+ * where the add buffer did before they were appended.                */
+static int grow_last(textbuf_t *tb, uint32_t t, uint32_t add_end, uint32_t n, uint32_t nl)
+{
+    if (!t) return 0;
+    piece_t *p = &tb->nodes[t];
+    if (p->right) {
+        if (!grow_last(tb, p->right, add_end, n, nl)) return 0;
+    } else {
+        if (p->buf != PIECE_ADD || p->start + p->len != add_end) return 0;
+        p->len += n;
+        p->nl += nl;
+    }
+    p->sum_len += n;
+    p->sum_nl += nl;
+    return 1;
+}
+
+static uint32_t read_range(const textbuf_t *tb, uint32_t t, uint32_t offset,
+                           uint32_t len, char *out)
+{
+    uint32_t done = 0;
+    while (t && len) {
+        const piece_t *p = &tb->nodes[t];
+        uint32_t lsz = tb->nodes[p->left].sum_len;
+        if (offset < lsz) {
+            uint32_t n = read_range(tb, p->left, offset, len, out);
+            done += n; out += n; len -= n;
+            offset = lsz;
+            continue;
+        }
+        offset -= lsz;
+        if (offset < p->len) {
+            const char *src = store_of(tb, p)->data + p->start + offset;
+            uint32_t n = p->len - offset;
+            if (n > len) n = len;
+            for (uint32_t i = 0; i < n; i++) out[i] = src[i];
+            done += n; out += n; len -= n;
+            offset = p->len;
+        }
+        offset -= p->len;
+        t = p->right;
+    }
+    return done;
+}
+
+/* ── Public interface ─────────────────────────────────────────────────── */
+void textbuf_init(textbuf_t *tb)
+{
+    tb->orig.data = tb->add.data = (void *)0;
+    tb->orig.nl = tb->add.nl = (void *)0;
+    tb->orig.len = tb->orig.cap = tb->orig.nl_count = tb->orig.nl_cap = 0;
+    tb->add.len = tb->add.cap = tb->add.nl_count = tb->add.nl_cap = 0;
+    tb->nodes = (void *)0;
+    tb->node_count = tb->node_cap = 0;
+    tb->free_node = 0;
+    tb->root = 0;
+    tb->seed = 0x9E3779B9u;
+}
+
+void textbuf_free(textbuf_t *tb)
+{
+    store_free(&tb->orig);
+    store_free(&tb->add);
+    if (tb->nodes) kfree(tb->nodes);
+    textbuf_init(tb);
+}
+
+static int nodes_ready(textbuf_t *tb, uint32_t extra)
+{
+    /* Node 0 stands for "none": all zero, so its sums read as empty */
+    if (!tb->node_count) {
+        if (grow((void **)&tb->nodes, &tb->node_cap, 1, sizeof(piece_t)) < 0) return -1;
+        piece_t *z = &tb->nodes[0];
+        z->left = z->right = z->prio = z->start = z->len = z->nl = 0;
+        z->sum_len = z->sum_nl = 0;
+        z->buf = 0;
+        tb->node_count = 1;
+    }
+    return grow((void **)&tb->nodes, &tb->node_cap, tb->node_count + extra, sizeof(piece_t));
+}
+
+uint32_t textbuf_length(const textbuf_t *tb)
+{
+    return tb->root ? tb->nodes[tb->root].sum_len : 0;
+}
+
+uint32_t textbuf_lines(const textbuf_t *tb)
+{
+    return (tb->root ? tb->nodes[tb->root].sum_nl : 0) + 1;
+}
+
+uint32_t textbuf_line_start(const textbuf_t *tb, uint32_t line)
+{
+    if (!line) return 0;
+    if (!tb->root || line > tb->nodes[tb->root].sum_nl) return textbuf_length(tb);
+
+    /* Find the line'th newline; the line starts just after it */
+    uint32_t t = tb->root, base = 0;
+    for (;;) {
+        const piece_t *p = &tb->nodes[t];
+        const piece_t *l = &tb->nodes[p->left];
+        if (line <= l->sum_nl) { t = p->left; continue; }
+        line -= l->sum_nl;
+        base += l->sum_len;
+        if (line <= p->nl) {
+            const textbuf_store_t *s = store_of(tb, p);
+            uint32_t at = s->nl[nl_lower(s, p->start) + line - 1];
+            return base + (at - p->start) + 1;
+        }
+        line -= p->nl;
+        base += p->len;
+        t = p->right;
+    }
+}
+
+uint32_t textbuf_line_length(const textbuf_t *tb, uint32_t line)
+{
+    uint32_t start = textbuf_line_start(tb, line);
+    uint32_t end = textbuf_line_start(tb, line + 1);
+    if (line + 1 < textbuf_lines(tb)) end--;   /* Drop the newline */
+    return end > start ? end - start : 0;
+}
+
+uint32_t textbuf_line_of(const textbuf_t *tb, uint32_t offset)
+{
+    uint32_t t = tb->root, line = 0;
+    while (t) {
+        const piece_t *p = &tb->nodes[t];
+        const piece_t *l = &tb->nodes[p->left];
+        if (offset <= l->sum_len) { t = p->left; continue; }
+        offset -= l->sum_len;
+        line += l->sum_nl;
+        if (offset < p->len) {
+            const textbuf_store_t *s = store_of(tb, p);
+            return line + nl_lower(s, p->start + offset) - nl_lower(s, p->start);
+        }
+        offset -= p->len;
+        line += p->nl;
+        t = p->right;
+    }
+    return line;
+}
+
+uint32_t textbuf_read(const textbuf_t *tb, uint32_t offset, uint32_t len, char *out)
+{
+    return read_range(tb, tb->root, offset, len, out);
+}
+
+int textbuf_insert(textbuf_t *tb, uint32_t offset, const char *text, uint32_t len)
+{
+    if (!len) return 0;
+    uint32_t total = textbuf_length(tb);
+    if (offset > total) offset = total;
+    if (len > TEXTBUF_MAX_SIZE - total) return -1;
+
+    /* Append to the add buffer, keeping its newline list current */
+    textbuf_store_t *s = &tb->add;
+    uint32_t add_end = s->len, nl_before = s->nl_count;
+    if (nodes_ready(tb, 2) < 0) return -1;
+    if (grow((void **)&s->data, &s->cap, s->len + len, 1) < 0) return -1;
+    for (uint32_t i = 0; i < len; i++) s->data[s->len + i] = text[i];
+    s->len += len;
+    if (store_index(s, add_end) < 0) {
+        s->len = add_end;
+        s->nl_count = nl_before;
+        return -1;
+    }
+
+    /* Both nodes come from the reservation above */
+    uint32_t spare = node_new(tb, PIECE_ADD, 0, 0);
+    uint32_t l, r;
+    split(tb, tb->root, offset, spare, &l, &r);
+    if (!tb->nodes[spare].len) {
+        tb->nodes[spare].left = tb->free_node;
+        tb->free_node = spare;
+    }
+
+    uint32_t nl = s->nl_count - nl_before;
+    if (!grow_last(tb, l, add_end, len, nl)) {
+        uint32_t n = node_new(tb, PIECE_ADD, add_end, len);
+        l = merge(tb, l, n);
+    }
+    tb->root = merge(tb, l, r);
+    return 0;
+}
+
+int textbuf_delete(textbuf_t *tb, uint32_t offset, uint32_t len)
+{
+    uint32_t total = textbuf_length(tb);
+    if (offset >= total || !len) return 0;
+    if (len > total - offset) len = total - offset;
+    if (nodes_ready(tb, 2) < 0) return -1;
+
+    uint32_t a = node_new(tb, PIECE_ORIG, 0, 0);
+    uint32_t b = node_new(tb, PIECE_ORIG, 0, 0);
+    uint32_t left, mid, right;
+    split(tb, tb->root, offset, a, &left, &mid);
+    split(tb, mid, len, b, &mid, &right);
+    node_release(tb, mid);
+    if (!tb->nodes[a].len) { tb->nodes[a].left = tb->free_node; tb->free_node = a; }
+    if (!tb->nodes[b].len) { tb->nodes[b].left = tb->free_node; tb->free_node = b; }
+    tb->root = merge(tb, left, right);
+    return 0;
+}
+
+char *textbuf_load_begin(textbuf_t *tb, uint32_t size)
+{
+    textbuf_free(tb);
+    if (size > TEXTBUF_MAX_SIZE) return (void *)0;
+    tb->orig.data = kmalloc(size ? size : 1);
+    if (!tb->orig.data) return (void *)0;
+    tb->orig.cap = size;
+    return tb->orig.data;
+}
+
+int textbuf_load_data(textbuf_t *tb, uint32_t len)
+{
+    textbuf_store_t *s = &tb->orig;
+    if (len > s->cap - s->len) len = s->cap - s->len;
+    uint32_t from = s->len;
+    s->len += len;
+    return store_index(s, from);
+}
+
+int textbuf_load_end(textbuf_t *tb)
+{
+    if (!tb->orig.len) return 0;
+    if (nodes_ready(tb, 1) < 0) return -1;
+    tb->root = node_new(tb, PIECE_ORIG, 0, tb->orig.len);
+    return 0;
+}
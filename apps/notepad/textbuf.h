@@ -0,0 +1,65 @@
+/*
+ * nextOS - textbuf.h
+ * Piece-table text buffer with a line index, for the notepad
+ *
+ * The document is a sequence of pieces, each a span of either the file
+ * as loaded (read-only) or the append-only buffer that receives every
+ * inserted character.  Pieces live in a balanced tree that keeps the
+ * length and newline count of each subtree, and both buffers keep the
+ * sorted offsets of their newlines, so offset <-> line conversion,
+ * insertion and deletion are O(log n) in the size of the document.
+ */
+#ifndef NEXTOS_TEXTBUF_H
+#define NEXTOS_TEXTBUF_H
+
+#include <stdint.h>
+
+#define TEXTBUF_MAX_SIZE  (16u * 1024 * 1024)   /* Largest file that loads */
+
+typedef struct {
+    char     *data;
+    uint32_t  len, cap;
+    uint32_t *nl;               /* Offsets of '\n' in data, ascending */
+    uint32_t  nl_count, nl_cap;
+} textbuf_store_t;
+
+typedef struct {
+    textbuf_store_t orig;       /* The file as loaded */
+    textbuf_store_t add;        /* Everything typed since */
+    struct textbuf_piece *nodes;   /* Node 0 is the null node */
+    uint32_t  node_count, node_cap;
+    uint32_t  free_node;
+    uint32_t  root;
+    uint32_t  seed;
+} textbuf_t;
+
+void     textbuf_init(textbuf_t *tb);
+void     textbuf_free(textbuf_t *tb);       /* Back to empty, memory released */
+
+uint32_t textbuf_length(const textbuf_t *tb);
+uint32_t textbuf_lines(const textbuf_t *tb);   /* Newlines + 1 */
+
+/* Offset of the first character of `line` (0-based), or the length of
+ * the document past the last line.                                   */
+uint32_t textbuf_line_start(const textbuf_t *tb, uint32_t line);
+/* Length of `line` without its newline */
+uint32_t textbuf_line_length(const textbuf_t *tb, uint32_t line);
+/* Line holding `offset` (the number of newlines before it) */
+uint32_t textbuf_line_of(const textbuf_t *tb, uint32_t offset);
+
+/* Copy up to len characters from offset; returns the number copied */
+uint32_t textbuf_read(const textbuf_t *tb, uint32_t offset, uint32_t len, char *out);
+
+/* Edits return 0, or -1 when out of memory (the document is unchanged) */
+int      textbuf_insert(textbuf_t *tb, uint32_t offset, const char *text, uint32_t len);
+int      textbuf_delete(textbuf_t *tb, uint32_t offset, uint32_t len);
+
+/* Loading: textbuf_load_begin empties tb and returns room for `size`
+ * characters (0 if it cannot be had); fill it from the start and report
+ * each chunk with textbuf_load_data, then textbuf_load_end makes what
+ * was reported the document.                                          */
+char    *textbuf_load_begin(textbuf_t *tb, uint32_t size);
+int      textbuf_load_data(textbuf_t *tb, uint32_t len);
+int      textbuf_load_end(textbuf_t *tb);
+
+#endif /* NEXTOS_TEXTBUF_H */
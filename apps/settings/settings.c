@@ -12,9 +12,11 @@
 #include "settings.h"
 #include "kernel/ui/compositor.h"
 #include "kernel/gfx/framebuffer.h"
+#include "kernel/gfx/text.h"
 #include "kernel/drivers/keyboard.h"
 #include "kernel/drivers/mouse.h"
 #include "kernel/drivers/disk.h"
+#include "kernel/drivers/bcache.h"
 #include "kernel/mem/heap.h"
 
 /* ── Settings persistence ────────────────────────────────────────────── */
@@ -45,7 +47,7 @@ void settings_save_to_disk(void)
     cfg.resolution_w = f->width;
     cfg.resolution_h = f->height;
     cfg.utc_offset = (int32_t)compositor_get_utc_offset();
-    disk_write(disk, SETTINGS_LBA, 1, &cfg);
+    bcache_write(disk, SETTINGS_LBA, 1, &cfg);
 }
 
 void settings_load_from_disk(void)
@@ -53,7 +55,7 @@ void settings_load_from_disk(void)
     disk_device_t *disk = disk_get_primary();
     if (!disk) return;
     settings_disk_t cfg;
-    if (disk_read(disk, SETTINGS_LBA, 1, &cfg) < 0) return;
+    if (bcache_read(disk, SETTINGS_LBA, 1, &cfg) < 0) return;
     if (cfg.magic != SETTINGS_MAGIC) return;
     if (cfg.theme < THEME_COUNT)
         compositor_set_theme((theme_t)cfg.theme);
@@ -164,59 +166,13 @@ static void draw_canvas_gradient(uint32_t *canvas, int cw, int ch,
     }
 }
 
-/* Minimal built-in font render directly into canvas */
-extern const uint8_t font_8x16[95][16]; /* defined in framebuffer.c */
-
-static void canvas_draw_char(uint32_t *canvas, int cw, int ch,
-                             int x, int y, char c, uint32_t fg)
-{
-    if (c < 32 || c > 126) c = '?';
-    const uint8_t *glyph = font_8x16[c - 32];
-    for (int row = 0; row < 16; row++) {
-        int py = y + row;
-        if (py < 0 || py >= ch) continue;
-        uint8_t bits = glyph[row];
-        uint8_t bits_above = (row > 0)  ? glyph[row - 1] : 0;
-        uint8_t bits_below = (row < 15) ? glyph[row + 1] : 0;
-        for (int col = 0; col < 8; col++) {
-            int px = x + col;
-            if (px < 0 || px >= cw) continue;
-            uint8_t mask = 0x80 >> col;
-            if (bits & mask) {
-                canvas[py * cw + px] = fg;
-            } else {
-                int neighbors = 0;
-                if (bits_above & mask) neighbors++;
-                if (bits_below & mask) neighbors++;
-                if (col > 0 && (bits & (mask << 1))) neighbors++;
-                if (col < 7 && (bits & (mask >> 1))) neighbors++;
-                if (neighbors > 0) {
-                    uint32_t base = canvas[py * cw + px];
-                    uint8_t sr = (fg >> 16) & 0xFF, sg = (fg >> 8) & 0xFF, sb = fg & 0xFF;
-                    uint8_t dr = (base >> 16) & 0xFF, dg = (base >> 8) & 0xFF, db = base & 0xFF;
-                    uint8_t alpha = (uint8_t)(neighbors * 40);
-                    uint8_t rr = (sr * alpha + dr * (255 - alpha)) / 255;
-                    uint8_t rg = (sg * alpha + dg * (255 - alpha)) / 255;
-                    uint8_t rb = (sb * alpha + db * (255 - alpha)) / 255;
-                    canvas[py * cw + px] = ((uint32_t)rr << 16) | ((uint32_t)rg << 8) | (uint32_t)rb;
-                }
-            }
-        }
-    }
-}
-
+/* Text goes through the shared glyph atlas */
 static void draw_canvas_string(uint32_t *canvas, int cw, int ch,
                                int x, int y, const char *s,
                                uint32_t fg, uint32_t bg)
 {
     (void)bg;
-    int cx = x;
-    while (*s) {
-        if (*s >= 32 && *s <= 126)
-            canvas_draw_char(canvas, cw, ch, cx, y, *s, fg);
-        cx += 8;
-        s++;
-    }
+    text_draw_canvas(canvas, cw, ch, x, y, s, -1, fg, TEXT_AA);
 }
 
 /* ── Tab drawing ──────────────────────────────────────────────────────── */
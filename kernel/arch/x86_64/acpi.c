@@ -0,0 +1,154 @@
+/*
+ * nextOS - acpi.c
+ * Minimal ACPI table discovery (RSDP -> RSDT/XSDT -> MADT)
+ *
+ * Only the Multiple APIC Description Table is consumed, to enumerate
+ * processors for SMP bring-up.  All tables are read through the boot
+ * identity map, so anything above 4 GiB is ignored.
+ */
+#include "acpi.h"
+
+typedef struct {
+    char     signature[8];
+    uint8_t  checksum;
+    char     oem_id[6];
+    uint8_t  revision;
+    uint32_t rsdt_addr;
+    /* ACPI 2.0+ */
+    uint32_t length;
+    uint64_t xsdt_addr;
+    uint8_t  ext_checksum;
+    uint8_t  reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char     signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    acpi_sdt_header_t hdr;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+#define MADT_TYPE_LAPIC          0
+#define MADT_TYPE_LAPIC_OVERRIDE 5
+#define MADT_LAPIC_ENABLED       0x1
+
+#define ACPI_PHYS_LIMIT 0x100000000ULL
+
+static acpi_rsdp_t rsdp_copy;
+static int         rsdp_valid = 0;
+
+static int mem_eq(const void *a, const char *b, int n)
+{
+    const char *p = (const char *)a;
+    for (int i = 0; i < n; i++)
+        if (p[i] != b[i]) return 0;
+    return 1;
+}
+
+static int checksum_ok(const void *p, uint32_t len)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) sum += b[i];
+    return sum == 0;
+}
+
+void acpi_set_rsdp(const void *rsdp, uint32_t len)
+{
+    if (len > sizeof(rsdp_copy)) len = sizeof(rsdp_copy);
+    if (len < 20) return;
+    uint8_t *dst = (uint8_t *)&rsdp_copy;
+    const uint8_t *src = (const uint8_t *)rsdp;
+    for (uint32_t i = 0; i < sizeof(rsdp_copy); i++)
+        dst[i] = i < len ? src[i] : 0;
+    if (rsdp_copy.revision < 2) rsdp_copy.xsdt_addr = 0;
+    rsdp_valid = mem_eq(rsdp_copy.signature, "RSD PTR ", 8);
+}
+
+/* Legacy discovery: the RSDP sits on a 16-byte boundary in the BIOS area */
+static void rsdp_scan_bios(void)
+{
+    for (uint64_t a = 0xE0000; a < 0x100000; a += 16) {
+        if (mem_eq((const void *)a, "RSD PTR ", 8) && checksum_ok((const void *)a, 20)) {
+            const acpi_rsdp_t *r = (const acpi_rsdp_t *)a;
+            acpi_set_rsdp(r, r->revision >= 2 ? sizeof(acpi_rsdp_t) : 20);
+            return;
+        }
+    }
+}
+
+static const acpi_sdt_header_t *sdt_at(uint64_t phys)
+{
+    if (!phys || phys >= ACPI_PHYS_LIMIT) return (void *)0;
+    const acpi_sdt_header_t *h = (const acpi_sdt_header_t *)phys;
+    if (h->length < sizeof(*h) || !checksum_ok(h, h->length)) return (void *)0;
+    return h;
+}
+
+static const acpi_sdt_header_t *find_table(const char *sig)
+{
+    const acpi_sdt_header_t *root;
+    int wide = 0;
+
+    if (rsdp_copy.xsdt_addr && (root = sdt_at(rsdp_copy.xsdt_addr)))
+        wide = 1;
+    else if (!(root = sdt_at(rsdp_copy.rsdt_addr)))
+        return (void *)0;
+
+    const uint8_t *ents = (const uint8_t *)(root + 1);
+    uint32_t esz = wide ? 8 : 4;
+    uint32_t n = (root->length - sizeof(*root)) / esz;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t phys = 0;
+        for (uint32_t b = 0; b < esz; b++)
+            phys |= (uint64_t)ents[i * esz + b] << (8 * b);
+        const acpi_sdt_header_t *t = sdt_at(phys);
+        if (t && mem_eq(t->signature, sig, 4)) return t;
+    }
+    return (void *)0;
+}
+
+int acpi_read_madt(acpi_madt_info_t *out)
+{
+    out->lapic_base = 0;
+    out->cpu_count  = 0;
+
+    if (!rsdp_valid) rsdp_scan_bios();
+    if (!rsdp_valid) return -1;
+
+    const acpi_madt_t *madt = (const acpi_madt_t *)find_table("APIC");
+    if (!madt) return -1;
+
+    out->lapic_base = madt->lapic_addr;
+
+    const uint8_t *p   = (const uint8_t *)(madt + 1);
+    const uint8_t *end = (const uint8_t *)madt + madt->hdr.length;
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        if (p[0] == MADT_TYPE_LAPIC && p[1] >= 8) {
+            uint8_t  apic_id = p[3];
+            uint32_t flags   = (uint32_t)p[4] | ((uint32_t)p[5] << 8) |
+                               ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+            if ((flags & MADT_LAPIC_ENABLED) && out->cpu_count < ACPI_MAX_CPUS)
+                out->apic_ids[out->cpu_count++] = apic_id;
+        } else if (p[0] == MADT_TYPE_LAPIC_OVERRIDE && p[1] >= 12) {
+            uint64_t addr = 0;
+            for (int b = 0; b < 8; b++)
+                addr |= (uint64_t)p[4 + b] << (8 * b);
+            out->lapic_base = addr;
+        }
+        p += p[1];
+    }
+
+    return out->cpu_count ? 0 : -1;
+}
@@ -0,0 +1,24 @@
+/*
+ * nextOS - acpi.h
+ * Minimal ACPI table discovery (RSDP -> RSDT/XSDT -> MADT)
+ */
+#ifndef NEXTOS_ACPI_H
+#define NEXTOS_ACPI_H
+
+#include <stdint.h>
+
+#define ACPI_MAX_CPUS 16
+
+typedef struct {
+    uint64_t lapic_base;
+    int      cpu_count;
+    uint8_t  apic_ids[ACPI_MAX_CPUS];   /* Enabled processors, firmware order */
+} acpi_madt_info_t;
+
+/* Record the RSDP copy handed over in a Multiboot2 ACPI tag */
+void acpi_set_rsdp(const void *rsdp, uint32_t len);
+
+/* Parse the MADT; returns 0 on success, -1 if no usable table is found */
+int  acpi_read_madt(acpi_madt_info_t *out);
+
+#endif /* NEXTOS_ACPI_H */
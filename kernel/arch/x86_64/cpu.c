@@ -0,0 +1,119 @@
+/*
+ * nextOS - cpu.c
+ * CPUID feature detection and extended (vector) register state setup
+ */
+#include "cpu.h"
+
+#define CR4_OSXSAVE     (1ULL << 18)
+#define XCR0_X87        (1ULL << 0)
+#define XCR0_SSE        (1ULL << 1)
+#define XCR0_AVX        (1ULL << 2)
+
+/* PAT entries 0-3 keep their reset values (WB, WT, UC-, UC) so PCD/PWT
+ * alone still mean what they always did; entry 4 (PAT bit alone) is
+ * write-combining for paging.h's PAGE_CACHE_WC.                      */
+#define MSR_IA32_PAT    0x277
+#define PAT_LAYOUT      0x0007040100070406ULL
+
+/* Bytes isr_common reserves for the XSAVE image (after 64-byte alignment) */
+#define ISR_XSAVE_AREA  960
+
+uint8_t cpu_xsave_enabled = 0;
+static uint32_t features = 0;
+
+static inline void cpuid(uint32_t leaf, uint32_t sub, uint32_t *a,
+                         uint32_t *b, uint32_t *c, uint32_t *d)
+{
+    __asm__ volatile("cpuid"
+                     : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                     : "a"(leaf), "c"(sub));
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                     "d"((uint32_t)(value >> 32)));
+}
+
+/* Caches are flushed around the switch so no line survives with a
+ * memory type that no longer matches its mapping.                  */
+static void pat_init(void)
+{
+    if (!(features & CPU_FEAT_PAT)) return;
+    __asm__ volatile("wbinvd" : : : "memory");
+    wrmsr(MSR_IA32_PAT, PAT_LAYOUT);
+    __asm__ volatile("wbinvd" : : : "memory");
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+static inline void xsetbv(uint32_t index, uint64_t value)
+{
+    __asm__ volatile("xsetbv" : : "c"(index), "a"((uint32_t)value),
+                     "d"((uint32_t)(value >> 32)));
+}
+
+void cpu_init(void)
+{
+    uint32_t a, b, c, d;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    uint32_t max_leaf = a;
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    if (d & (1u << 4))  features |= CPU_FEAT_TSC;
+    if (d & (1u << 26)) features |= CPU_FEAT_SSE2;
+    if (d & (1u << 16)) features |= CPU_FEAT_PAT;
+    if (c & (1u << 19)) features |= CPU_FEAT_SSE41;
+    if (c & (1u << 25)) features |= CPU_FEAT_AESNI;
+    if (c & (1u << 1))  features |= CPU_FEAT_PCLMUL;
+
+    /* AVX state is only usable once CR4.OSXSAVE is set and XCR0 enables
+     * the YMM component; boot.S has already set OSFXSR for SSE.        */
+    int has_xsave = (c >> 26) & 1;
+    int has_avx   = (c >> 28) & 1;
+    if (has_xsave && has_avx && max_leaf >= 0xD) {
+        uint64_t cr4;
+        __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+        __asm__ volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_OSXSAVE));
+        xsetbv(0, XCR0_X87 | XCR0_SSE | XCR0_AVX);
+
+        /* EBX of leaf 0xD = save area size for the components in XCR0 */
+        cpuid(0xD, 0, &a, &b, &c, &d);
+        if (b <= ISR_XSAVE_AREA) {
+            cpu_xsave_enabled = 1;
+            features |= CPU_FEAT_XSAVE | CPU_FEAT_AVX;
+        }
+    }
+
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        if ((features & CPU_FEAT_AVX) && (b & (1u << 5))) features |= CPU_FEAT_AVX2;
+        if (b & (1u << 29)) features |= CPU_FEAT_SHA;
+    }
+
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a >= 0x80000001) {
+        cpuid(0x80000001, 0, &a, &b, &c, &d);
+        if (d & (1u << 26)) features |= CPU_FEAT_PAGE1G;
+    }
+    pat_init();
+}
+
+/* Application processors inherit the feature set probed on the BSP but
+ * must program the same PAT and enable the same extended state
+ * themselves before any AVX code.                                    */
+void cpu_init_ap(void)
+{
+    pat_init();
+    if (!cpu_xsave_enabled) return;
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_OSXSAVE));
+    xsetbv(0, XCR0_X87 | XCR0_SSE | XCR0_AVX);
+}
+
+uint32_t cpu_features(void)
+{
+    return features;
+}
@@ -0,0 +1,36 @@
+/*
+ * nextOS - cpu.h
+ * CPUID feature detection and extended (vector) register state setup
+ */
+#ifndef NEXTOS_CPU_H
+#define NEXTOS_CPU_H
+
+#include <stdint.h>
+
+/* Feature bits reported by cpu_features().  A bit is only set when the
+ * kernel can actually use the feature (e.g. AVX needs XSAVE enabled). */
+#define CPU_FEAT_SSE2   (1u << 0)
+#define CPU_FEAT_SSE41  (1u << 1)
+#define CPU_FEAT_XSAVE  (1u << 2)
+#define CPU_FEAT_AVX    (1u << 3)
+#define CPU_FEAT_AVX2   (1u << 4)
+#define CPU_FEAT_TSC    (1u << 5)
+#define CPU_FEAT_PAT    (1u << 6)
+#define CPU_FEAT_PAGE1G (1u << 7)
+#define CPU_FEAT_AESNI  (1u << 8)
+#define CPU_FEAT_PCLMUL (1u << 9)
+#define CPU_FEAT_SHA    (1u << 10)
+
+/* Set by cpu_init(); isr_common saves vector state with XSAVE when
+ * nonzero, FXSAVE otherwise.                                        */
+extern uint8_t cpu_xsave_enabled;
+
+void     cpu_init(void);
+void     cpu_init_ap(void);
+uint32_t cpu_features(void);
+
+static inline int cpu_has(uint32_t feat) {
+    return (cpu_features() & feat) == feat;
+}
+
+#endif /* NEXTOS_CPU_H */
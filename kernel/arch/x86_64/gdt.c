@@ -51,3 +51,10 @@ void gdt_init(void)
 
     gdt_flush((uint64_t)&gdt_pointer);
 }
+
+/* Application processors share the BSP's table (no TSS is loaded, so
+ * there is no per-CPU busy bit to worry about).                      */
+void gdt_load(void)
+{
+    gdt_flush((uint64_t)&gdt_pointer);
+}
@@ -42,5 +42,6 @@ struct gdt_ptr {
 } __attribute__((packed));
 
 void gdt_init(void);
+void gdt_load(void);
 
 #endif /* NEXTOS_GDT_H */
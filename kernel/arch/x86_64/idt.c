@@ -28,6 +28,8 @@ extern void irq9(void);  extern void irq10(void); extern void irq11(void);
 extern void irq12(void); extern void irq13(void); extern void irq14(void);
 extern void irq15(void);
 
+extern void isr240(void); extern void isr255(void);
+
 void idt_set_gate(int idx, uint64_t handler, uint16_t sel, uint8_t flags)
 {
     idt_entries[idx].offset_low  = handler & 0xFFFF;
@@ -143,8 +145,18 @@ void idt_init(void)
     idt_set_gate(46, (uint64_t)irq14, 0x08, 0x8E);
     idt_set_gate(47, (uint64_t)irq15, 0x08, 0x8E);
 
+    /* LAPIC vectors: SMP wake-up IPI and spurious interrupt */
+    idt_set_gate(240, (uint64_t)isr240, 0x08, 0x8E);
+    idt_set_gate(255, (uint64_t)isr255, 0x08, 0x8E);
+
     /* Load IDT */
     __asm__ volatile("lidt %0" : : "m"(idt_pointer));
     /* Enable interrupts */
     __asm__ volatile("sti");
 }
+
+/* Load the shared IDT on an application processor */
+void idt_load(void)
+{
+    __asm__ volatile("lidt %0" : : "m"(idt_pointer));
+}
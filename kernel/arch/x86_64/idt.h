@@ -29,6 +29,7 @@ struct idt_ptr {
 typedef void (*isr_handler_t)(uint64_t irq, uint64_t error_code);
 
 void idt_init(void);
+void idt_load(void);
 void idt_set_gate(int idx, uint64_t handler, uint16_t sel, uint8_t flags);
 void irq_register_handler(int irq, isr_handler_t handler);
 
@@ -0,0 +1,102 @@
+/*
+ * nextOS - lapic.c
+ * Local APIC access: IDs, EOI and inter-processor interrupts
+ *
+ * The LAPIC page (normally 0xFEE00000) lies inside the 4 GiB identity map
+ * from boot.S.  The BSP's LAPIC is left as the firmware configured it, so
+ * legacy PIC interrupts keep arriving through LINT0; only the ICR is used
+ * there.  APs software-enable theirs to receive wake-up IPIs.
+ */
+#include "lapic.h"
+
+#define LAPIC_REG_ID        0x020
+#define LAPIC_REG_TPR       0x080
+#define LAPIC_REG_EOI       0x0B0
+#define LAPIC_REG_SVR       0x0F0
+#define LAPIC_REG_ICR_LOW   0x300
+#define LAPIC_REG_ICR_HIGH  0x310
+#define LAPIC_REG_LVT_LINT0 0x350
+#define LAPIC_REG_LVT_LINT1 0x360
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LVT_MASKED          0x10000
+
+#define ICR_INIT            0x00000500
+#define ICR_STARTUP         0x00000600
+#define ICR_LEVEL_ASSERT    0x00004000
+#define ICR_DELIVERY_PEND   0x00001000
+#define ICR_ALL_BUT_SELF    0x000C0000
+
+#define ICR_SPIN_LIMIT      1000000
+
+static volatile uint32_t *lapic = (void *)0;
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val)
+{
+    lapic[reg / 4] = val;
+}
+
+static void icr_wait(void)
+{
+    for (int i = 0; i < ICR_SPIN_LIMIT && (lapic_read(LAPIC_REG_ICR_LOW) & ICR_DELIVERY_PEND); i++)
+        __asm__ volatile("pause");
+}
+
+static void icr_send(uint32_t dest, uint32_t low)
+{
+    icr_wait();
+    lapic_write(LAPIC_REG_ICR_HIGH, dest << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, low);
+    icr_wait();
+}
+
+void lapic_set_base(uint64_t phys)
+{
+    lapic = (volatile uint32_t *)phys;
+}
+
+int lapic_present(void)
+{
+    return lapic != (void *)0;
+}
+
+void lapic_enable(void)
+{
+    if (!lapic) return;
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_LVT_LINT0, LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_LINT1, LVT_MASKED);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+uint32_t lapic_id(void)
+{
+    return lapic ? lapic_read(LAPIC_REG_ID) >> 24 : 0;
+}
+
+void lapic_eoi(void)
+{
+    if (lapic) lapic_write(LAPIC_REG_EOI, 0);
+}
+
+void lapic_send_init(uint32_t apic_id)
+{
+    icr_send(apic_id, ICR_INIT | ICR_LEVEL_ASSERT);
+}
+
+void lapic_send_startup(uint32_t apic_id, uint32_t vector_page)
+{
+    icr_send(apic_id, ICR_STARTUP | (vector_page & 0xFF));
+}
+
+void lapic_send_ipi_others(uint8_t vector)
+{
+    if (!lapic) return;
+    icr_wait();
+    lapic_write(LAPIC_REG_ICR_LOW, ICR_ALL_BUT_SELF | vector);
+}
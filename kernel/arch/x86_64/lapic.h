@@ -0,0 +1,22 @@
+/*
+ * nextOS - lapic.h
+ * Local APIC access: IDs, EOI and inter-processor interrupts
+ */
+#ifndef NEXTOS_LAPIC_H
+#define NEXTOS_LAPIC_H
+
+#include <stdint.h>
+
+#define LAPIC_SPURIOUS_VECTOR  0xFF
+#define IPI_WAKE_VECTOR        0xF0   /* Wakes idle APs to pick up work */
+
+void     lapic_set_base(uint64_t phys);
+int      lapic_present(void);
+void     lapic_enable(void);          /* Software-enable this CPU's LAPIC */
+uint32_t lapic_id(void);
+void     lapic_eoi(void);
+void     lapic_send_init(uint32_t apic_id);
+void     lapic_send_startup(uint32_t apic_id, uint32_t vector_page);
+void     lapic_send_ipi_others(uint8_t vector);
+
+#endif /* NEXTOS_LAPIC_H */
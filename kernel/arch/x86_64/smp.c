@@ -0,0 +1,145 @@
+/*
+ * nextOS - smp.c
+ * Symmetric multiprocessing: AP bring-up, per-CPU data, wake-up IPIs
+ *
+ * Processors are enumerated from the ACPI MADT and started with the
+ * INIT/SIPI/SIPI sequence through the trampoline in ap_boot.S.  APs do
+ * not take device interrupts; they run the job scheduler's worker loop
+ * and sleep in hlt until smp_wake_others() signals queued work.
+ */
+#include "smp.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "cpu.h"
+#include "../../sched/job.h"
+#include "../../drivers/timer.h"
+
+#define AP_TRAMPOLINE_BASE  0x8000      /* Must match ap_boot.S */
+#define AP_STACK_SIZE       (32 * 1024)
+#define AP_START_TIMEOUT_MS 100
+
+#define MSR_GS_BASE         0xC0000101
+
+extern uint8_t  ap_trampoline_start[], ap_trampoline_end[];
+extern uint64_t ap_param_cr3, ap_param_stack, ap_param_entry, ap_param_arg;
+
+static percpu_t percpu[SMP_MAX_CPUS];
+static int      cpus_online = 1;
+
+static uint8_t  ap_stacks[SMP_MAX_CPUS - 1][AP_STACK_SIZE] __attribute__((aligned(16)));
+
+/* ── Wake-up IPI ───────────────────────────────────────────────────────── */
+static void ipi_wake_handler(uint64_t irq, uint64_t error_code)
+{
+    (void)irq; (void)error_code;
+    lapic_eoi();
+}
+
+void smp_wake_others(void)
+{
+    if (cpus_online > 1)
+        lapic_send_ipi_others(IPI_WAKE_VECTOR);
+}
+
+/* ── Per-CPU block ────────────────────────────────────────────────────── */
+static void set_gs_base(percpu_t *pc)
+{
+    uint64_t v = (uint64_t)pc;
+    __asm__ volatile("wrmsr" : : "c"(MSR_GS_BASE), "a"((uint32_t)v),
+                     "d"((uint32_t)(v >> 32)));
+}
+
+void smp_early_init(void)
+{
+    percpu[0].index  = 0;
+    percpu[0].online = 1;
+    set_gs_base(&percpu[0]);
+}
+
+int smp_cpu_count(void)
+{
+    return cpus_online;
+}
+
+/* ── AP bring-up ──────────────────────────────────────────────────────── */
+static void ap_main(uint64_t index)
+{
+    percpu_t *pc = &percpu[index];
+
+    /* gdt_flush reloads GS, so the base is set afterwards */
+    gdt_load();
+    idt_load();
+    set_gs_base(pc);
+    cpu_init_ap();
+    lapic_enable();
+
+    __atomic_store_n(&pc->online, 1, __ATOMIC_RELEASE);
+    job_worker_loop();
+}
+
+static volatile uint64_t *tramp_param(uint64_t *sym)
+{
+    uint64_t off = (uint64_t)((uint8_t *)sym - ap_trampoline_start);
+    return (volatile uint64_t *)(AP_TRAMPOLINE_BASE + off);
+}
+
+static int wait_online(percpu_t *pc, uint32_t ms)
+{
+    for (uint32_t t = 0; t < ms; t++) {
+        if (__atomic_load_n(&pc->online, __ATOMIC_ACQUIRE)) return 1;
+        timer_sleep_ms(1);
+    }
+    return __atomic_load_n(&pc->online, __ATOMIC_ACQUIRE) != 0;
+}
+
+static int start_ap(int index, uint8_t apic_id)
+{
+    percpu_t *pc = &percpu[index];
+    pc->index     = (uint32_t)index;
+    pc->apic_id   = apic_id;
+    pc->online    = 0;
+    pc->stack_top = ap_stacks[index - 1] + AP_STACK_SIZE;
+
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    *tramp_param(&ap_param_cr3)   = cr3;
+    *tramp_param(&ap_param_stack) = (uint64_t)pc->stack_top;
+    *tramp_param(&ap_param_entry) = (uint64_t)ap_main;
+    *tramp_param(&ap_param_arg)   = (uint64_t)index;
+
+    lapic_send_init(apic_id);
+    timer_sleep_ms(10);
+    lapic_send_startup(apic_id, AP_TRAMPOLINE_BASE >> 12);
+    if (wait_online(pc, 1)) return 1;
+    lapic_send_startup(apic_id, AP_TRAMPOLINE_BASE >> 12);
+    if (wait_online(pc, AP_START_TIMEOUT_MS)) return 1;
+
+    /* Park it again so a late start cannot collide with the next slot */
+    lapic_send_init(apic_id);
+    return 0;
+}
+
+void smp_init(void)
+{
+    acpi_madt_info_t madt;
+    if (acpi_read_madt(&madt) != 0 || madt.cpu_count < 2) return;
+
+    lapic_set_base(madt.lapic_base);
+    uint32_t bsp_id = lapic_id();
+    percpu[0].apic_id = bsp_id;
+
+    irq_register_handler(IPI_WAKE_VECTOR, ipi_wake_handler);
+
+    /* Copy the trampoline below 1 MiB; the PMM never hands out this page */
+    uint8_t *dst = (uint8_t *)AP_TRAMPOLINE_BASE;
+    for (uint8_t *src = ap_trampoline_start; src < ap_trampoline_end; src++)
+        *dst++ = *src;
+
+    for (int i = 0; i < madt.cpu_count && cpus_online < SMP_MAX_CPUS; i++) {
+        if (madt.apic_ids[i] == bsp_id) continue;
+        /* Indices stay dense: a CPU that fails to start reuses its slot */
+        if (start_ap(cpus_online, madt.apic_ids[i])) cpus_online++;
+    }
+}
@@ -0,0 +1,32 @@
+/*
+ * nextOS - smp.h
+ * Symmetric multiprocessing: AP bring-up, per-CPU data, wake-up IPIs
+ */
+#ifndef NEXTOS_SMP_H
+#define NEXTOS_SMP_H
+
+#include <stdint.h>
+
+#define SMP_MAX_CPUS 16
+
+/* Reached through GS; index must remain the first field (smp_cpu_id) */
+typedef struct {
+    uint32_t          index;       /* 0 = BSP, 1.. = APs in start order */
+    uint32_t          apic_id;
+    volatile uint32_t online;
+    uint8_t          *stack_top;
+} percpu_t;
+
+/* Logical index of the calling CPU; valid once smp_early_init has run */
+static inline int smp_cpu_id(void) {
+    uint32_t id;
+    __asm__ volatile("movl %%gs:0, %0" : "=r"(id));
+    return (int)id;
+}
+
+void smp_early_init(void);   /* BSP per-CPU block; call right after gdt_init */
+void smp_init(void);         /* Start APs; needs the timer running           */
+int  smp_cpu_count(void);
+void smp_wake_others(void);  /* IPI idle APs so they re-check for work      */
+
+#endif /* NEXTOS_SMP_H */
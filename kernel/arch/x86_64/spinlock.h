@@ -0,0 +1,46 @@
+/*
+ * nextOS - spinlock.h
+ * Test-and-test-and-set spinlocks for SMP
+ */
+#ifndef NEXTOS_SPINLOCK_H
+#define NEXTOS_SPINLOCK_H
+
+#include <stdint.h>
+
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void cpu_relax(void) {
+    __asm__ volatile("pause" ::: "memory");
+}
+
+static inline void spin_lock(spinlock_t *l) {
+    while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED))
+            cpu_relax();
+    }
+}
+
+static inline void spin_unlock(spinlock_t *l) {
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+/* Variants for locks also taken from interrupt handlers: interrupts stay
+ * off on this CPU while the lock is held.                              */
+static inline uint64_t spin_lock_irqsave(spinlock_t *l) {
+    uint64_t flags;
+    __asm__ volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    spin_lock(l);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *l, uint64_t flags) {
+    spin_unlock(l);
+    if (flags & 0x200)
+        __asm__ volatile("sti" ::: "memory");
+}
+
+#endif /* NEXTOS_SPINLOCK_H */
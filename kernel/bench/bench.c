@@ -0,0 +1,402 @@
+/*
+ * nextOS - bench.c
+ * In-kernel benchmark suite: memory, graphics, compositor, HTML layout,
+ * disk, crypto and TCP over loopback, reported on COM1
+ *
+ * Every benchmark times a fixed amount of work with timer_now_ns() and
+ * reports the mean per operation (or the throughput), so numbers from
+ * two builds on the same host compare directly.  Nothing here is
+ * cached between benchmarks beyond what the subsystem itself keeps.
+ */
+#include "bench.h"
+#include "../drivers/serial.h"
+#include "../drivers/timer.h"
+#include "../drivers/disk.h"
+#include "../drivers/net.h"
+#include "../arch/x86_64/idt.h"
+#include "../mem/heap.h"
+#include "../mem/pmm.h"
+#include "../gfx/framebuffer.h"
+#include "../ui/compositor.h"
+#include "../net/net_stack.h"
+#include "../net/tls_crypto.h"
+#include "../../apps/browser/browser.h"
+
+#define HEAP_ITERS        200000
+#define HEAP_SLOTS        512
+#define HEAP_CHURN_ITERS  200000
+#define PMM_ITERS         100000
+#define PMM_BATCH         256
+#define FB_ITERS          200
+#define SPRITE            256       /* fb_blit source, pixels square */
+#define FRAME_ITERS       60
+#define HTML_ITERS        20
+#define HTML_CANVAS_W     700
+#define HTML_CANVAS_H     500
+#define DISK_SEQ_BYTES    (64u << 20)
+#define DISK_SEQ_SECTORS  2048      /* Per disk_read: 1 MiB */
+#define DISK_RAND_ITERS   1000
+#define DISK_RAND_SECTORS 8         /* 4 KiB, aligned */
+#define TCP_PORT          5001
+#define TCP_BYTES         (16u << 20)
+#define TCP_CHUNK         (32 * 1024)
+#define LOOPBACK_IP       0x0100007Fu   /* 127.0.0.1, network byte order */
+
+#define DEBUG_EXIT_PORT   0xF4      /* QEMU -device isa-debug-exit,iobase=0xf4 */
+
+/* ── Output ──────────────────────────────────────────────────────────── */
+static void report(const char *name, uint64_t value, const char *unit)
+{
+    serial_write("BENCH ");
+    serial_write(name);
+    serial_putc(' ');
+    serial_write_uint(value);
+    serial_putc(' ');
+    serial_write(unit);
+    serial_write("\n");
+}
+
+static void skip(const char *name, const char *reason)
+{
+    serial_write("BENCH-SKIP ");
+    serial_write(name);
+    serial_putc(' ');
+    serial_write(reason);
+    serial_write("\n");
+}
+
+static uint64_t per_op(uint64_t ns, uint64_t ops)
+{
+    return ops ? ns / ops : 0;
+}
+
+/* MB/s (10^6 bytes) for `bytes` in `ns` */
+static uint64_t mb_per_s(uint64_t bytes, uint64_t ns)
+{
+    return ns ? bytes * 1000 / ns : 0;
+}
+
+static uint32_t bench_seed = 1;
+
+static uint32_t bench_rand(void)
+{
+    bench_seed = bench_seed * 1103515245u + 12345u;
+    return bench_seed >> 8;
+}
+
+/* ── Kernel heap ─────────────────────────────────────────────────────── */
+static void *heap_slots[HEAP_SLOTS];
+
+static void bench_heap(void)
+{
+    uint64_t t0 = timer_now_ns();
+    for (int i = 0; i < HEAP_ITERS; i++) kfree(kmalloc(64));
+    report("kmalloc_free_64", per_op(timer_now_ns() - t0, HEAP_ITERS), "ns/op");
+
+    /* Churn: a window of live blocks of mixed sizes, replaced in turn */
+    bench_seed = 1;
+    t0 = timer_now_ns();
+    for (int i = 0; i < HEAP_CHURN_ITERS; i++) {
+        int s = i % HEAP_SLOTS;
+        kfree(heap_slots[s]);
+        heap_slots[s] = kmalloc(16 + bench_rand() % 4096);
+    }
+    report("kmalloc_churn", per_op(timer_now_ns() - t0, HEAP_CHURN_ITERS), "ns/op");
+    for (int s = 0; s < HEAP_SLOTS; s++) {
+        kfree(heap_slots[s]);
+        heap_slots[s] = (void *)0;
+    }
+}
+
+/* ── Physical pages ──────────────────────────────────────────────────── */
+static void *pmm_slots[PMM_BATCH];
+
+static void bench_pmm(void)
+{
+    uint64_t t0 = timer_now_ns();
+    for (int i = 0; i < PMM_ITERS; i++) {
+        void *p = pmm_alloc_page();
+        if (!p) { skip("pmm_alloc_free", "out of memory"); return; }
+        pmm_free_page(p);
+    }
+    report("pmm_alloc_free", per_op(timer_now_ns() - t0, PMM_ITERS), "ns/op");
+
+    /* A batch held at once, so the allocator walks past what it gave out */
+    int got = 0;
+    t0 = timer_now_ns();
+    for (int r = 0; r < PMM_ITERS / PMM_BATCH; r++) {
+        for (got = 0; got < PMM_BATCH; got++)
+            if (!(pmm_slots[got] = pmm_alloc_page())) break;
+        for (int i = 0; i < got; i++) pmm_free_page(pmm_slots[i]);
+        if (got < PMM_BATCH) { skip("pmm_batch", "out of memory"); return; }
+    }
+    report("pmm_batch", per_op(timer_now_ns() - t0, (PMM_ITERS / PMM_BATCH) * PMM_BATCH), "ns/page");
+
+    t0 = timer_now_ns();
+    for (int i = 0; i < PMM_ITERS / 16; i++) {
+        void *p = pmm_alloc_pages(4);
+        if (!p) { skip("pmm_alloc_order4", "out of memory"); return; }
+        pmm_free_pages(p, 4);
+    }
+    report("pmm_alloc_order4", per_op(timer_now_ns() - t0, PMM_ITERS / 16), "ns/op");
+}
+
+/* ── Framebuffer ─────────────────────────────────────────────────────── */
+static void bench_fb(void)
+{
+    framebuffer_t *fb = fb_get();
+    int w = (int)fb->width, h = (int)fb->height;
+    fb_reset_target();
+    fb_reset_clip();
+
+    uint64_t t0 = timer_now_ns();
+    for (int i = 0; i < FB_ITERS; i++)
+        fb_fill_rect(0, 0, w, h, (uint32_t)i * 0x010101u);
+    report("fb_fill_rect_full", per_op(timer_now_ns() - t0, FB_ITERS), "ns/op");
+
+    uint32_t *sprite = (uint32_t *)kmalloc(SPRITE * SPRITE * 4);
+    if (sprite) {
+        for (int i = 0; i < SPRITE * SPRITE; i++) sprite[i] = (uint32_t)i * 2654435761u;
+        t0 = timer_now_ns();
+        for (int i = 0; i < FB_ITERS; i++)
+            fb_blit((i * 37) % (w > SPRITE ? w - SPRITE : 1),
+                    (i * 53) % (h > SPRITE ? h - SPRITE : 1), SPRITE, SPRITE, sprite);
+        report("fb_blit_256", per_op(timer_now_ns() - t0, FB_ITERS), "ns/op");
+        kfree(sprite);
+    } else {
+        skip("fb_blit_256", "out of memory");
+    }
+
+    t0 = timer_now_ns();
+    for (int i = 0; i < FB_ITERS; i++) fb_swap();
+    report("fb_swap_full", per_op(timer_now_ns() - t0, FB_ITERS), "ns/op");
+}
+
+/* ── Compositor ──────────────────────────────────────────────────────── */
+static const int frame_windows[] = { 1, 4, 8 };
+
+static void bench_compositor(void)
+{
+    static const char *names[] = {
+        "compositor_frame_w1", "compositor_frame_w4", "compositor_frame_w8",
+    };
+    window_t *wins[8];
+
+    for (int c = 0; c < 3; c++) {
+        int n = 0;
+        for (; n < frame_windows[c]; n++) {
+            wins[n] = compositor_create_window("Benchmark", 40 + n * 48, 40 + n * 32, 480, 360);
+            if (!wins[n]) break;
+            wins[n]->anim_type = ANIM_NONE;     /* Measure settled frames */
+        }
+
+        if (n == frame_windows[c]) {
+            /* One frame first: decorations and caches are built once */
+            compositor_damage_all();
+            compositor_render_frame();
+            uint64_t t0 = timer_now_ns();
+            for (int i = 0; i < FRAME_ITERS; i++) {
+                compositor_damage_all();
+                compositor_render_frame();
+            }
+            report(names[c], per_op(timer_now_ns() - t0, FRAME_ITERS), "ns/frame");
+        } else {
+            skip(names[c], "no window slot");
+        }
+
+        /* Closing animates; back-date it so the next frame frees them */
+        for (int i = 0; i < n; i++) {
+            compositor_destroy_window(wins[i]);
+            wins[i]->anim_start = 0;
+        }
+        compositor_render_frame();
+    }
+}
+
+/* ── HTML layout ─────────────────────────────────────────────────────── */
+typedef struct {
+    char *buf;
+    int   len, cap;
+} page_t;
+
+static void page_add(page_t *p, const char *s)
+{
+    while (*s && p->len < p->cap - 1) p->buf[p->len++] = *s++;
+    p->buf[p->len] = 0;
+}
+
+/* A long article: headings, paragraphs of inline formatting, links, lists */
+static void fixture_article(page_t *p)
+{
+    page_add(p, "<html><head><title>Article</title></head><body>");
+    for (int i = 0; i < 150; i++) {
+        page_add(p, "<h2>Section heading</h2><p>The <b>quick</b> brown fox <i>jumps</i> "
+                    "over the <a href=\"/next\">lazy dog</a>, and then keeps running "
+                    "across the field until the <u>light fades</u> and the long "
+                    "paragraph has wrapped over several lines of the page.</p>"
+                    "<ul><li>First point</li><li>Second <code>point</code></li>"
+                    "<li>Third point with <s>struck</s> words</li></ul>");
+    }
+    page_add(p, "</body></html>");
+}
+
+/* A style sheet and a large table of styled cells */
+static void fixture_table(page_t *p)
+{
+    page_add(p, "<html><head><style>body { color: #222222; } td { color: #333333; } "
+                ".hi { background-color: #EEEEFF; } #total { font-weight: bold; }"
+                "</style></head><body><h1>Report</h1><table>");
+    for (int i = 0; i < 400; i++) {
+        page_add(p, "<tr><td class=\"hi\">Row name</td><td>12345</td>"
+                    "<td><span style=\"color: #CC0000\">-4.2%</span></td>"
+                    "<td><a href=\"/detail\">details</a></td></tr>");
+    }
+    page_add(p, "</table><p id=\"total\">Total</p></body></html>");
+}
+
+static void bench_html(void)
+{
+    static const char *names[] = { "render_html_article", "render_html_table" };
+    void (*fixtures[])(page_t *) = { fixture_article, fixture_table };
+
+    page_t page = { (char *)kmalloc(256 * 1024), 0, 256 * 1024 };
+    uint32_t *canvas = (uint32_t *)kmalloc(HTML_CANVAS_W * HTML_CANVAS_H * 4);
+    if (!page.buf || !canvas) {
+        skip("render_html", "out of memory");
+        kfree(page.buf);
+        kfree(canvas);
+        return;
+    }
+
+    for (int f = 0; f < 2; f++) {
+        page.len = 0;
+        fixtures[f](&page);
+        if (browser_render_html(page.buf, page.len, canvas, HTML_CANVAS_W, HTML_CANVAS_H) < 0) {
+            skip(names[f], "browser open");
+            continue;
+        }
+        uint64_t t0 = timer_now_ns();
+        for (int i = 0; i < HTML_ITERS; i++)
+            browser_render_html(page.buf, page.len, canvas, HTML_CANVAS_W, HTML_CANVAS_H);
+        report(names[f], per_op(timer_now_ns() - t0, HTML_ITERS), "ns/page");
+    }
+    kfree(page.buf);
+    kfree(canvas);
+}
+
+/* ── Disk ────────────────────────────────────────────────────────────── */
+static void bench_disk(void)
+{
+    disk_device_t *dev = disk_get_primary();
+    if (!dev || !dev->present || dev->total_sectors < DISK_SEQ_SECTORS) {
+        skip("disk_read", "no disk");
+        return;
+    }
+    uint8_t *buf = (uint8_t *)kmalloc(DISK_SEQ_SECTORS * 512);
+    if (!buf) {
+        skip("disk_read", "out of memory");
+        return;
+    }
+
+    uint64_t sectors = DISK_SEQ_BYTES / 512;
+    if (sectors > dev->total_sectors) sectors = dev->total_sectors - dev->total_sectors % DISK_SEQ_SECTORS;
+    uint64_t t0 = timer_now_ns();
+    int ok = 1;
+    for (uint64_t lba = 0; lba < sectors && ok; lba += DISK_SEQ_SECTORS)
+        ok = disk_read(dev, lba, DISK_SEQ_SECTORS, buf) >= 0;
+    if (ok) report("disk_seq_read", mb_per_s(sectors * 512, timer_now_ns() - t0), "MB/s");
+    else    skip("disk_seq_read", "read error");
+
+    uint64_t blocks = dev->total_sectors / DISK_RAND_SECTORS;
+    bench_seed = 1;
+    t0 = timer_now_ns();
+    ok = 1;
+    for (int i = 0; i < DISK_RAND_ITERS && ok; i++) {
+        uint64_t lba = (uint64_t)(bench_rand() % blocks) * DISK_RAND_SECTORS;
+        ok = disk_read(dev, lba, DISK_RAND_SECTORS, buf) >= 0;
+    }
+    if (ok) report("disk_rand_read_4k", per_op(timer_now_ns() - t0, DISK_RAND_ITERS), "ns/op");
+    else    skip("disk_rand_read_4k", "read error");
+    kfree(buf);
+}
+
+/* ── Crypto ──────────────────────────────────────────────────────────── */
+static void bench_crypto(void)
+{
+    tls_bench_t b;
+    tls_crypto_bench(&b);
+    report("rsa2048_encrypt", b.rsa2048_ns, "ns/op");
+    report("rsa4096_encrypt", b.rsa4096_ns, "ns/op");
+    report("tls_prf_x4", b.prf_ns, "ns/op");
+    report("tls_handshake_crypto", b.handshake_ns, "ns/op");
+    report("sha256", mb_per_s(16384, b.sha256_16k_ns), "MB/s");
+    report("aes128_cbc_hmac", mb_per_s(16384, b.cbc_16k_ns), "MB/s");
+    report("aes128_gcm", mb_per_s(16384, b.gcm_16k_ns), "MB/s");
+    report("cpu_aesni", (uint64_t)b.aesni, "bool");
+    report("cpu_pclmul", (uint64_t)b.pclmul, "bool");
+    report("cpu_shani", (uint64_t)b.shani, "bool");
+}
+
+/* ── TCP over loopback ───────────────────────────────────────────────── */
+/* Both ends run here: each round queues a chunk on the client and reads
+ * it back from the accepted socket, the stack moving the segments and
+ * ACKs through the loopback queue while tcp_recv polls.            */
+static void bench_tcp(void)
+{
+    if (!net_is_available()) {
+        skip("tcp_loopback", "no network stack");
+        return;
+    }
+    uint8_t *tx = (uint8_t *)kmalloc(TCP_CHUNK);
+    uint8_t *rx = (uint8_t *)kmalloc(TCP_CHUNK);
+    int l = tcp_listen(TCP_PORT);
+    int c = l >= 0 ? tcp_connect(LOOPBACK_IP, TCP_PORT) : -1;
+    int s = c >= 0 ? tcp_accept(l, 1000) : -1;
+
+    if (!tx || !rx || s < 0) {
+        skip("tcp_loopback", !tx || !rx ? "out of memory" : "no connection");
+    } else {
+        bench_seed = 1;
+        for (int i = 0; i < TCP_CHUNK; i++) tx[i] = (uint8_t)bench_rand();
+
+        uint32_t moved = 0;
+        int ok = 1;
+        uint64_t t0 = timer_now_ns();
+        while (moved < TCP_BYTES && ok) {
+            ok = tcp_send(c, tx, TCP_CHUNK) == TCP_CHUNK &&
+                 tcp_recv(s, rx, TCP_CHUNK, 2000) == TCP_CHUNK;
+            for (int i = 0; i < TCP_CHUNK && ok; i++) ok = rx[i] == tx[i];
+            moved += TCP_CHUNK;
+        }
+        uint64_t ns = timer_now_ns() - t0;
+        if (ok) report("tcp_loopback", mb_per_s(moved, ns), "MB/s");
+        else    skip("tcp_loopback", "transfer failed");
+    }
+
+    tcp_close(c);
+    tcp_close(s);
+    tcp_close(l);
+    kfree(tx);
+    kfree(rx);
+}
+
+/* ── Entry point ─────────────────────────────────────────────────────── */
+void bench_run(void)
+{
+    serial_write("BENCH begin\n");
+    report("cpu_tsc_hz", timer_tsc_hz(), "Hz");
+
+    bench_heap();
+    bench_pmm();
+    bench_fb();
+    bench_compositor();
+    bench_html();
+    bench_disk();
+    bench_crypto();
+    bench_tcp();
+
+    serial_write("BENCH end\n");
+
+    /* QEMU exits with status (value << 1) | 1; elsewhere this is nothing */
+    outb(DEBUG_EXIT_PORT, 0);
+}
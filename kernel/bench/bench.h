@@ -0,0 +1,23 @@
+/*
+ * nextOS - bench.h
+ * In-kernel benchmark suite, run instead of the desktop when the
+ * Multiboot2 command line holds "bench"
+ *
+ * Results go to COM1, one per line:
+ *
+ *   BENCH begin
+ *   BENCH <name> <value> <unit>     e.g. BENCH kmalloc_free_64 48 ns/op
+ *   BENCH-SKIP <name> <reason>      a benchmark that could not run
+ *   BENCH end
+ *
+ * Names and units stay fixed so results can be compared run to run
+ * (`make bench` collects them into bench_output.txt).
+ */
+#ifndef NEXTOS_BENCH_H
+#define NEXTOS_BENCH_H
+
+/* Runs every benchmark, then asks QEMU's isa-debug-exit to quit; returns
+ * if there is none, and the caller powers off.                        */
+void bench_run(void);
+
+#endif /* NEXTOS_BENCH_H */
@@ -0,0 +1,515 @@
+/*
+ * nextOS - bcache.c
+ * Block buffer cache in front of disk_read / disk_write
+ *
+ * The disk is cached in aligned blocks of BCACHE_BLOCK_SECTORS sectors,
+ * found through a hash on (device, block) and recycled in LRU order.
+ * Each block keeps a valid and a dirty bit per sector, so a write never
+ * has to read the rest of its block first and write-back only touches
+ * the sectors that changed.  A miss reads the whole block, which doubles
+ * as readahead for the small sequential reads filesystems issue; longer
+ * readahead is queued asynchronously with bcache_readahead.  Blocks it
+ * is filling are "pending": they are never evicted, and anything that
+ * touches one first waits for its request.
+ *
+ * Like the disk driver underneath, the cache is single-threaded: it is
+ * only used from the BSP's main loop and cooperative kernel threads.
+ */
+#include "bcache.h"
+#include "../mem/heap.h"
+#include "../sched/kthread.h"
+
+#define SECTOR_SIZE     512
+#define BLOCK_BYTES     (BCACHE_BLOCK_SECTORS * SECTOR_SIZE)
+#define BCACHE_BUCKETS  1024            /* Power of two */
+#define SYNC_BATCH      8               /* Write requests kept queued by bcache_sync */
+#define RA_SLOTS        4               /* Readahead requests in flight */
+
+typedef struct bc_block {
+    disk_device_t   *dev;               /* NULL while unused         */
+    uint64_t         block;             /* First LBA / BLOCK_SECTORS */
+    uint8_t          valid;             /* Per-sector bitmasks       */
+    uint8_t          dirty;
+    uint8_t          pending;           /* Readahead slot + 1, or 0  */
+    struct bc_block *hash_next;
+    struct bc_block *lru_prev, *lru_next;
+    uint8_t         *data;
+} bc_block_t;
+
+/* A bcache_sync write: dirty runs of consecutive LBAs from several
+ * blocks gathered into one scatter-gather request.                 */
+typedef struct {
+    disk_request_t   req;
+    disk_seg_t       segs[DISK_REQ_MAX_SEGS];
+    struct bc_block *owner[DISK_REQ_MAX_SEGS];
+    uint8_t          mask[DISK_REQ_MAX_SEGS];
+    uint32_t         sectors;
+} sync_req_t;
+
+static bc_block_t      blocks[BCACHE_BLOCKS];
+static bc_block_t     *buckets[BCACHE_BUCKETS];
+static bc_block_t     *lru_head, *lru_tail;     /* Head is most recent */
+static bc_block_t     *sync_list[BCACHE_BLOCKS];
+static sync_req_t      sync_reqs[SYNC_BATCH];
+
+/* A readahead: consecutive missing blocks read straight into their
+ * cache buffers by one scatter-gather request.                     */
+typedef struct {
+    disk_request_t   req;
+    disk_seg_t       segs[DISK_REQ_MAX_SEGS];
+    struct bc_block *owner[DISK_REQ_MAX_SEGS];
+    int              busy;
+} ra_req_t;
+
+static ra_req_t        ra_reqs[RA_SLOTS];
+static uint8_t        *pool;
+static uint8_t         fill_buf[BLOCK_BYTES];
+static bcache_stats_t  stats;
+
+static void copy_bytes(void *dst, const void *src, uint32_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    for (uint32_t i = 0; i < n; i++) d[i] = s[i];
+}
+
+/* ── Hash and LRU ─────────────────────────────────────────────────────── */
+static inline uint32_t bucket_of(const disk_device_t *dev, uint64_t block)
+{
+    uint64_t h = (block ^ (uint64_t)dev) * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 32) & (BCACHE_BUCKETS - 1);
+}
+
+static bc_block_t *lookup(const disk_device_t *dev, uint64_t block)
+{
+    for (bc_block_t *b = buckets[bucket_of(dev, block)]; b; b = b->hash_next)
+        if (b->dev == dev && b->block == block) return b;
+    return (void *)0;
+}
+
+static void unhash(bc_block_t *b)
+{
+    bc_block_t **pp = &buckets[bucket_of(b->dev, b->block)];
+    while (*pp && *pp != b) pp = &(*pp)->hash_next;
+    if (*pp) *pp = b->hash_next;
+    b->hash_next = (void *)0;
+    b->dev = (void *)0;
+    stats.cached_blocks--;
+}
+
+static void lru_unlink(bc_block_t *b)
+{
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+    else             lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+    else             lru_tail = b->lru_prev;
+}
+
+static void lru_push_head(bc_block_t *b)
+{
+    b->lru_prev = (void *)0;
+    b->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = b;
+    else          lru_tail = b;
+    lru_head = b;
+}
+
+static void lru_touch(bc_block_t *b)
+{
+    if (b == lru_head) return;
+    lru_unlink(b);
+    lru_push_head(b);
+}
+
+/* Drop a block to the cold end so it is the next one reused */
+static void lru_retire(bc_block_t *b)
+{
+    unhash(b);
+    b->valid = b->dirty = 0;
+    lru_unlink(b);
+    b->lru_next = (void *)0;
+    b->lru_prev = lru_tail;
+    if (lru_tail) lru_tail->lru_next = b;
+    else          lru_head = b;
+    lru_tail = b;
+}
+
+/* ── Disk transfers ───────────────────────────────────────────────────── */
+/* Sectors of a block that exist on the device */
+static uint32_t block_span(const disk_device_t *dev, uint64_t block)
+{
+    uint64_t first = block * BCACHE_BLOCK_SECTORS;
+    if (!dev->total_sectors || first + BCACHE_BLOCK_SECTORS <= dev->total_sectors)
+        return BCACHE_BLOCK_SECTORS;
+    return first < dev->total_sectors ? (uint32_t)(dev->total_sectors - first) : 0;
+}
+
+/* Write each contiguous run of dirty sectors */
+static int writeback(bc_block_t *b)
+{
+    int rc = 0;
+    uint64_t first = b->block * BCACHE_BLOCK_SECTORS;
+    for (uint32_t s = 0; s < BCACHE_BLOCK_SECTORS; ) {
+        if (!(b->dirty & (1u << s))) { s++; continue; }
+        uint32_t n = 1;
+        while (s + n < BCACHE_BLOCK_SECTORS && (b->dirty & (1u << (s + n)))) n++;
+        if (disk_write(b->dev, first + s, n, b->data + s * SECTOR_SIZE) < 0) {
+            stats.write_errors++;
+            rc = -1;
+        } else {
+            b->dirty &= (uint8_t)~(((1u << n) - 1) << s);
+            stats.writebacks++;
+        }
+        s += n;
+    }
+    if (!b->dirty) stats.dirty_blocks--;
+    return rc;
+}
+
+/* Bring every sector of the block in, keeping those already cached */
+static int fill(bc_block_t *b)
+{
+    uint32_t span = block_span(b->dev, b->block);
+    uint8_t  want = (uint8_t)((1u << span) - 1);
+    if (!span) return -1;
+    if ((b->valid & want) == want) return 0;
+
+    uint64_t first = b->block * BCACHE_BLOCK_SECTORS;
+    stats.misses++;
+    if (!b->valid) {
+        if (disk_read(b->dev, first, span, b->data) < 0) return -1;
+    } else {
+        if (disk_read(b->dev, first, span, fill_buf) < 0) return -1;
+        for (uint32_t s = 0; s < span; s++)
+            if (!(b->valid & (1u << s)))
+                copy_bytes(b->data + s * SECTOR_SIZE, fill_buf + s * SECTOR_SIZE, SECTOR_SIZE);
+    }
+    b->valid = want;
+    return 0;
+}
+
+/* ── Readahead completion ─────────────────────────────────────────────── */
+/* Completion callbacks may run in the disk interrupt, so the blocks of a
+ * finished readahead are only marked valid here, from cache context.  */
+static void ra_finish(ra_req_t *ra)
+{
+    for (uint32_t k = 0; k < ra->req.nsegs; k++) {
+        bc_block_t *b = ra->owner[k];
+        b->pending = 0;
+        if (ra->req.status == DISK_REQ_DONE)
+            b->valid = (uint8_t)((1u << ra->segs[k].sectors) - 1);
+        else
+            lru_retire(b);
+    }
+    ra->busy = 0;
+}
+
+static void ra_reap(void)
+{
+    for (int i = 0; i < RA_SLOTS; i++)
+        if (ra_reqs[i].busy && ra_reqs[i].req.status != DISK_REQ_PENDING)
+            ra_finish(&ra_reqs[i]);
+}
+
+/* Wait for the readahead filling b */
+static void ra_wait(bc_block_t *b)
+{
+    ra_req_t *ra = &ra_reqs[b->pending - 1];
+    disk_wait(b->dev, &ra->req);
+    ra_finish(ra);
+}
+
+/* Find or claim the cache block for (dev, block), making it most recent.
+ * A dirty victim that cannot be written back stays cached and an older
+ * block is taken instead; returns 0 if no block can be freed.        */
+static bc_block_t *get_block(disk_device_t *dev, uint64_t block)
+{
+    bc_block_t *b = lookup(dev, block);
+    if (b) {
+        if (b->pending) ra_wait(b);
+        lru_touch(b);
+        return b;
+    }
+
+    /* At most RA_SLOTS * DISK_REQ_MAX_SEGS blocks are pending, far fewer
+     * than the cache holds.  After one failed writeback only clean blocks
+     * are considered, so a failing disk costs one write per call.     */
+    int write_failed = 0;
+    for (b = lru_tail; b; b = b->lru_prev) {
+        if (b->pending) continue;
+        if (!b->dirty) break;
+        if (write_failed) continue;
+        if (writeback(b) == 0) break;
+        stats.evict_failures++;
+        write_failed = 1;
+    }
+    if (!b) return (void *)0;
+    if (b->dev) {
+        unhash(b);
+        stats.evictions++;
+    }
+    b->dev   = dev;
+    b->block = block;
+    b->valid = b->dirty = 0;
+    uint32_t h = bucket_of(dev, block);
+    b->hash_next = buckets[h];
+    buckets[h] = b;
+    stats.cached_blocks++;
+    lru_touch(b);
+    return b;
+}
+
+/* Large transfers go straight to the disk; cached copies of the range
+ * are newer than the disk on reads and must follow it on writes.      */
+static void bypass_sync_range(disk_device_t *dev, uint64_t lba, uint32_t count,
+                              uint8_t *buf, int is_write)
+{
+    uint64_t end = lba + count;
+    for (uint64_t blk = lba / BCACHE_BLOCK_SECTORS;
+         blk * BCACHE_BLOCK_SECTORS < end; blk++) {
+        bc_block_t *b = lookup(dev, blk);
+        if (!b) continue;
+        if (b->pending) ra_wait(b);
+        uint64_t first = blk * BCACHE_BLOCK_SECTORS;
+        for (uint32_t s = 0; s < BCACHE_BLOCK_SECTORS; s++) {
+            uint64_t sec = first + s;
+            if (sec < lba || sec >= end) continue;
+            uint8_t *cached = b->data + s * SECTOR_SIZE;
+            uint8_t *user   = buf + (sec - lba) * SECTOR_SIZE;
+            if (is_write) {
+                copy_bytes(cached, user, SECTOR_SIZE);
+                b->valid |= (uint8_t)(1u << s);
+                if (b->dirty & (1u << s)) {
+                    b->dirty &= (uint8_t)~(1u << s);
+                    if (!b->dirty) stats.dirty_blocks--;
+                }
+            } else if (b->valid & (1u << s)) {
+                copy_bytes(user, cached, SECTOR_SIZE);
+            }
+        }
+    }
+}
+
+/* ── Public API ───────────────────────────────────────────────────────── */
+static void flush_thread(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        kthread_sleep_ms(BCACHE_WRITEBACK_MS);
+        if (stats.dirty_blocks) bcache_sync();
+    }
+}
+
+void bcache_init(void)
+{
+    pool = (uint8_t *)kmalloc_tagged((uint64_t)BCACHE_BLOCKS * BLOCK_BYTES);
+    if (!pool) return;
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        blocks[i].data = pool + (uint64_t)i * BLOCK_BYTES;
+        lru_push_head(&blocks[i]);
+    }
+    kthread_create("bcache-flush", flush_thread, (void *)0);
+}
+
+int bcache_read(disk_device_t *dev, uint64_t lba, uint32_t count, void *buf)
+{
+    if (!dev || !dev->present) return -1;
+    if (!pool) return disk_read(dev, lba, count, buf);
+
+    uint8_t *out = (uint8_t *)buf;
+    ra_reap();
+    if (count >= BCACHE_BYPASS_SECTORS) {
+        int rc = disk_read(dev, lba, count, buf);
+        if (rc >= 0) bypass_sync_range(dev, lba, count, out, 0);
+        stats.bypassed++;
+        return rc;
+    }
+
+    for (uint32_t done = 0; done < count; ) {
+        uint64_t blk = (lba + done) / BCACHE_BLOCK_SECTORS;
+        uint32_t off = (uint32_t)((lba + done) % BCACHE_BLOCK_SECTORS);
+        uint32_t n   = BCACHE_BLOCK_SECTORS - off;
+        if (n > count - done) n = count - done;
+
+        if (off + n > block_span(dev, blk)) return -1;
+
+        bc_block_t *b = get_block(dev, blk);
+        if (!b) return -1;
+        uint8_t mask = (uint8_t)(((1u << n) - 1) << off);
+        if ((b->valid & mask) == mask) {
+            stats.hits++;
+        } else if (fill(b) < 0) {
+            if (!b->dirty) lru_retire(b);
+            return -1;
+        }
+        copy_bytes(out + (uint64_t)done * SECTOR_SIZE, b->data + off * SECTOR_SIZE,
+                   n * SECTOR_SIZE);
+        done += n;
+    }
+    return (int)count;
+}
+
+int bcache_write(disk_device_t *dev, uint64_t lba, uint32_t count, const void *buf)
+{
+    if (!dev || !dev->present) return -1;
+    if (!pool) return disk_write(dev, lba, count, buf);
+
+    const uint8_t *in = (const uint8_t *)buf;
+    ra_reap();
+    if (count >= BCACHE_BYPASS_SECTORS) {
+        int rc = disk_write(dev, lba, count, buf);
+        if (rc >= 0) bypass_sync_range(dev, lba, count, (uint8_t *)in, 1);
+        stats.bypassed++;
+        return rc;
+    }
+
+    for (uint32_t done = 0; done < count; ) {
+        uint64_t blk = (lba + done) / BCACHE_BLOCK_SECTORS;
+        uint32_t off = (uint32_t)((lba + done) % BCACHE_BLOCK_SECTORS);
+        uint32_t n   = BCACHE_BLOCK_SECTORS - off;
+        if (n > count - done) n = count - done;
+        if (off + n > block_span(dev, blk)) return -1;
+
+        bc_block_t *b = get_block(dev, blk);
+        if (!b) return -1;
+        uint8_t mask = (uint8_t)(((1u << n) - 1) << off);
+        copy_bytes(b->data + off * SECTOR_SIZE, in + (uint64_t)done * SECTOR_SIZE,
+                   n * SECTOR_SIZE);
+        if (!b->dirty) stats.dirty_blocks++;
+        b->valid |= mask;
+        b->dirty |= mask;
+        done += n;
+    }
+    return (int)count;
+}
+
+void bcache_readahead(disk_device_t *dev, uint64_t lba, uint32_t count)
+{
+    if (!pool || !dev || !dev->present || !count) return;
+    ra_reap();
+
+    uint64_t blk = lba / BCACHE_BLOCK_SECTORS;
+    uint64_t last = (lba + count - 1) / BCACHE_BLOCK_SECTORS;
+    while (blk <= last) {
+        /* Skip what is cached (or already on its way) */
+        if (lookup(dev, blk) || !block_span(dev, blk)) { blk++; continue; }
+
+        ra_req_t *ra = (void *)0;
+        for (int i = 0; i < RA_SLOTS && !ra; i++)
+            if (!ra_reqs[i].busy) ra = &ra_reqs[i];
+        if (!ra) return;
+
+        /* One request for the run of missing blocks starting here */
+        ra->req.lba      = blk * BCACHE_BLOCK_SECTORS;
+        ra->req.write    = 0;
+        ra->req.segs     = ra->segs;
+        ra->req.nsegs    = 0;
+        ra->req.complete = (void *)0;
+        while (blk <= last && ra->req.nsegs < DISK_REQ_MAX_SEGS && !lookup(dev, blk)) {
+            uint32_t span = block_span(dev, blk);
+            if (!span) break;
+            bc_block_t *b = get_block(dev, blk);
+            if (!b) break;
+            b->pending = (uint8_t)(ra - ra_reqs + 1);
+            uint32_t k = ra->req.nsegs++;
+            ra->segs[k].buf     = b->data;
+            ra->segs[k].sectors = span;
+            ra->owner[k]        = b;
+            stats.readahead++;
+            blk++;
+            if (span < BCACHE_BLOCK_SECTORS) break;    /* End of the device */
+        }
+        if (!ra->req.nsegs) return;                    /* No block to spare */
+        ra->busy = 1;
+        disk_submit(dev, &ra->req);
+    }
+}
+
+/* Wait for queued sync writes and mark what they covered clean */
+static int sync_drain(int n)
+{
+    int rc = 0;
+    for (int i = 0; i < n; i++) {
+        sync_req_t *sr = &sync_reqs[i];
+        if (disk_wait(sr->owner[0]->dev, &sr->req) < 0) {
+            stats.write_errors++;
+            rc = -1;
+            continue;
+        }
+        stats.writebacks++;
+        for (uint32_t k = 0; k < sr->req.nsegs; k++) {
+            bc_block_t *b = sr->owner[k];
+            if (b->dirty && !(b->dirty &= (uint8_t)~sr->mask[k]))
+                stats.dirty_blocks--;
+        }
+    }
+    return rc;
+}
+
+int bcache_sync(void)
+{
+    if (!pool || !stats.dirty_blocks) return 0;
+
+    /* Ascending LBA keeps the drive's head (or the host's file) moving
+     * one way through the disk.                                      */
+    int n = 0;
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        bc_block_t *b = &blocks[i];
+        if (!b->dev || !b->dirty) continue;
+        int j = n++;
+        while (j > 0 && sync_list[j - 1]->block > b->block) {
+            sync_list[j] = sync_list[j - 1];
+            j--;
+        }
+        sync_list[j] = b;
+    }
+
+    /* Gather runs that continue where the previous one ended into the
+     * same request; up to SYNC_BATCH requests are queued at once.     */
+    int rc = 0, nreq = 0;
+    sync_req_t *cur = (void *)0;
+    uint64_t cur_end = 0;
+    for (int i = 0; i < n; i++) {
+        bc_block_t *b = sync_list[i];
+        uint64_t first = b->block * BCACHE_BLOCK_SECTORS;
+        for (uint32_t s = 0; s < BCACHE_BLOCK_SECTORS; ) {
+            if (!(b->dirty & (1u << s))) { s++; continue; }
+            uint32_t len = 1;
+            while (s + len < BCACHE_BLOCK_SECTORS && (b->dirty & (1u << (s + len)))) len++;
+
+            uint64_t lba = first + s;
+            if (!cur || lba != cur_end || b->dev != cur->owner[0]->dev ||
+                cur->req.nsegs == DISK_REQ_MAX_SEGS ||
+                cur->sectors + len > DISK_REQ_MAX_SECTORS) {
+                if (cur) disk_submit(cur->owner[0]->dev, &cur->req);
+                if (nreq == SYNC_BATCH) {
+                    if (sync_drain(nreq) < 0) rc = -1;
+                    nreq = 0;
+                }
+                cur = &sync_reqs[nreq++];
+                cur->req.lba      = lba;
+                cur->req.write    = 1;
+                cur->req.segs     = cur->segs;
+                cur->req.nsegs    = 0;
+                cur->req.complete = (void *)0;
+                cur->sectors      = 0;
+            }
+            uint32_t k = cur->req.nsegs++;
+            cur->segs[k].buf     = b->data + s * SECTOR_SIZE;
+            cur->segs[k].sectors = len;
+            cur->owner[k]        = b;
+            cur->mask[k]         = (uint8_t)(((1u << len) - 1) << s);
+            cur->sectors        += len;
+            cur_end = lba + len;
+            s += len;
+        }
+    }
+    if (cur) disk_submit(cur->owner[0]->dev, &cur->req);
+    if (sync_drain(nreq) < 0) rc = -1;
+    return rc;
+}
+
+void bcache_get_stats(bcache_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,49 @@
+/*
+ * nextOS - bcache.h
+ * Block buffer cache in front of disk_read / disk_write
+ */
+#ifndef NEXTOS_BCACHE_H
+#define NEXTOS_BCACHE_H
+
+#include <stdint.h>
+#include "disk.h"
+
+#define BCACHE_BLOCK_SECTORS  8         /* 4 KiB cache blocks             */
+#define BCACHE_BLOCKS         512       /* 2 MiB of cached data           */
+#define BCACHE_BYPASS_SECTORS 32        /* Larger transfers skip the cache */
+#define BCACHE_WRITEBACK_MS   1000      /* Flusher thread period          */
+
+typedef struct {
+    uint64_t hits;              /* Block lookups served from cache     */
+    uint64_t misses;            /* Blocks read from disk               */
+    uint64_t bypassed;          /* Large transfers sent straight through */
+    uint64_t readahead;         /* Blocks queued by bcache_readahead   */
+    uint64_t evictions;
+    uint64_t writebacks;        /* Dirty runs written to disk          */
+    uint64_t write_errors;
+    uint64_t evict_failures;    /* Dirty victims kept: writeback failed */
+    uint32_t cached_blocks;
+    uint32_t dirty_blocks;
+} bcache_stats_t;
+
+/* Allocate the cache and start the write-back thread; before this runs
+ * the entry points below go straight to the disk.                    */
+void bcache_init(void);
+
+/* Same contract as disk_read / disk_write.  Writes are write-back: they
+ * reach the disk on eviction, on the flusher's next pass, or bcache_sync. */
+int  bcache_read(disk_device_t *dev, uint64_t lba, uint32_t count, void *buf);
+int  bcache_write(disk_device_t *dev, uint64_t lba, uint32_t count, const void *buf);
+
+/* Start reading [lba, lba + count) into the cache without waiting;
+ * blocks already cached are skipped.  Later reads of the range wait for
+ * the transfer if it has not finished.                              */
+void bcache_readahead(disk_device_t *dev, uint64_t lba, uint32_t count);
+
+/* Write every dirty block back in LBA order.  Returns 0, or -1 if any
+ * write failed (those blocks stay dirty).                        */
+int  bcache_sync(void);
+
+void bcache_get_stats(bcache_stats_t *out);
+
+#endif /* NEXTOS_BCACHE_H */
@@ -1,9 +1,19 @@
 /*
  * nextOS - disk.c
  * ATA PIO mode disk driver with AHCI (SATA) support
+ *
+ * AHCI transfers DMA straight into the caller's buffers through a PRDT
+ * entry per scatter-gather segment.  Drives that support NCQ get READ /
+ * WRITE FPDMA QUEUED commands spread over all command slots, completed
+ * from the port interrupt or by polling; others run one DMA command at
+ * a time.  ATA PIO requests always complete synchronously.  NVMe
+ * controllers are handled by nvme.c behind the same request API.
  */
 #include "disk.h"
+#include "nvme.h"
+#include "timer.h"
 #include "../arch/x86_64/idt.h"
+#include "../arch/x86_64/spinlock.h"
 
 /* Primary ATA I/O ports */
 #define ATA_PRIMARY_IO   0x1F0
@@ -34,6 +44,12 @@
 /* Timeout for ATA polling loops */
 #define ATA_TIMEOUT_LOOPS 100000
 
+/* Longest wait for an AHCI command before the port is reset */
+#define DISK_TIMEOUT_MS   5000
+
+/* Chunks disk_read / disk_write keep in flight */
+#define DISK_RW_INFLIGHT  8
+
 /* ── PCI Configuration Space ─────────────────────────────────────────── */
 #define PCI_CONFIG_ADDR 0xCF8
 #define PCI_CONFIG_DATA 0xCFC
@@ -61,10 +77,16 @@ static void pci_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off,
 /* AHCI Generic Host Control registers (offsets from ABAR) */
 #define AHCI_HBA_CAP    0x00  /* Host Capabilities */
 #define AHCI_HBA_GHC    0x04  /* Global Host Control */
+#define AHCI_HBA_IS     0x08  /* Interrupt Status (one bit per port) */
 #define AHCI_HBA_PI     0x0C  /* Ports Implemented */
 
+/* CAP bits */
+#define AHCI_CAP_SNCQ   (1u << 30)  /* Native Command Queuing */
+#define AHCI_CAP_NCS(c) ((((c) >> 8) & 0x1F) + 1)  /* Command slots */
+
 /* GHC bits */
 #define AHCI_GHC_AE     (1u << 31)  /* AHCI Enable */
+#define AHCI_GHC_IE     (1u << 1)   /* Interrupt Enable */
 
 /* Port register base: 0x100 + port * 0x80 */
 #define AHCI_PORT_BASE(p) (0x100 + (p) * 0x80)
@@ -78,6 +100,7 @@ static void pci_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off,
 #define AHCI_PxTFD   0x20  /* Task File Data */
 #define AHCI_PxSIG   0x24  /* Signature */
 #define AHCI_PxSSTS  0x28  /* SATA Status */
+#define AHCI_PxSACT  0x34  /* SATA Active (NCQ tags outstanding) */
 #define AHCI_PxCI    0x38  /* Command Issue */
 
 /* PxCMD bits */
@@ -95,6 +118,8 @@ static void pci_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off,
 
 /* PxIS error bits */
 #define AHCI_IS_TFES (1u << 30)  /* Task File Error Status */
+#define AHCI_IS_DHRS (1u << 0)   /* D2H Register FIS received */
+#define AHCI_IS_SDBS (1u << 3)   /* Set Device Bits FIS (NCQ completion) */
 
 /* PxTFD bits */
 #define AHCI_TFD_BSY (1 << 7)
@@ -110,6 +135,12 @@ static void pci_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off,
 #define ATA_CMD_IDENTIFY_AHCI  0xEC
 #define ATA_CMD_READ_DMA_EXT   0x25
 #define ATA_CMD_WRITE_DMA_EXT  0x35
+#define ATA_CMD_READ_FPDMA     0x60
+#define ATA_CMD_WRITE_FPDMA    0x61
+
+/* IDENTIFY words describing NCQ */
+#define ATA_IDENT_QUEUE_DEPTH  75   /* Bits 0-4: depth - 1 */
+#define ATA_IDENT_SATA_CAP     76   /* Bit 8: NCQ supported */
 
 /* ── AHCI Command structures ─────────────────────────────────────────── */
 /* Command Header (32 bytes, in Command List) */
@@ -135,7 +166,7 @@ typedef struct {
     uint8_t  cfis[64];     /* Command FIS */
     uint8_t  acmd[16];     /* ATAPI Command */
     uint8_t  reserved[48]; /* Reserved */
-    ahci_prdt_entry_t prdt[1]; /* At least 1 PRDT entry */
+    ahci_prdt_entry_t prdt[DISK_REQ_MAX_SEGS];
 } __attribute__((packed)) ahci_cmd_table_t;
 
 /* Received FIS area (256 bytes minimum) */
@@ -144,13 +175,23 @@ typedef struct {
 } __attribute__((aligned(256))) ahci_received_fis_t;
 
 /* ── AHCI static memory areas ────────────────────────────────────────── */
-/* We use one command slot (slot 0) with one PRDT entry.
- * All structures must be aligned and below 4 GiB for our identity-mapped setup. */
+/* One command table per slot.  All structures must be aligned and below
+ * 4 GiB for our identity-mapped setup.  The data buffer is only a bounce
+ * buffer for IDENTIFY and for caller buffers DMA cannot address.     */
 static ahci_cmd_header_t   ahci_cmd_list[32] __attribute__((aligned(1024)));
 static ahci_received_fis_t ahci_fis          __attribute__((aligned(256)));
-static ahci_cmd_table_t    ahci_cmd_table    __attribute__((aligned(128)));
+static ahci_cmd_table_t    ahci_cmd_tables[32] __attribute__((aligned(128)));
 static uint8_t             ahci_data_buf[512] __attribute__((aligned(512)));
 
+/* Command slot state.  ahci_lock is taken with interrupts off so the
+ * port interrupt can reap completions while a submitter waits.      */
+static uint32_t        ahci_slots   = 1;      /* Usable slots (queue depth) */
+static int             ahci_ncq     = 0;
+static uint32_t        ahci_busy    = 0;      /* Slots with a request issued */
+static disk_request_t *ahci_slot_req[32];
+static uint8_t         ahci_irq_line = 0xFF;
+static spinlock_t      ahci_lock    = SPINLOCK_INIT;
+
 /* ── Helper: MMIO read/write ─────────────────────────────────────────── */
 static inline volatile uint32_t *ahci_reg(uint64_t base, uint32_t off)
 {
@@ -240,6 +281,7 @@ static int ata_identify(disk_device_t *dev)
         dev->total_sectors = (uint32_t)ident[60] | ((uint32_t)ident[61] << 16);
     }
 
+    dev->queue_depth = 1;
     dev->present = 1;
     return 1;
 }
@@ -347,6 +389,8 @@ static uint64_t ahci_find_controller(void)
                     cmd |= (1 << 1) | (1 << 2);  /* Memory Space + Bus Master */
                     pci_write(bus, slot, func, 0x04, cmd);
 
+                    ahci_irq_line = (uint8_t)pci_read(bus, slot, func, 0x3C);
+
                     /* BAR5 is at offset 0x24 */
                     uint32_t bar5 = pci_read(bus, slot, func, 0x24);
                     /* Mask lower bits (memory BAR) */
@@ -434,47 +478,57 @@ static void ahci_port_init(uint64_t abar, int port)
     ahci_start_cmd(abar, port);
 }
 
-/* Issue an AHCI command using slot 0 and wait for completion.
- * fis:  pointer to the 20-byte H2D FIS
- * buf:  data buffer (physical address, must be < 4 GiB)
- * len:  data length in bytes
- * write: 1 = host-to-device (write), 0 = device-to-host (read)
- * Returns 0 on success, -1 on error. */
-static int ahci_issue_cmd(uint64_t abar, int port,
-                          const uint8_t *fis, int fis_len,
-                          void *buf, uint32_t len, int write)
+/* Fill in the command header and table of a slot.
+ * fis:   pointer to the 20-byte H2D FIS
+ * segs:  data buffers (physical addresses, must be < 4 GiB), one PRD each
+ * write: 1 = host-to-device (write), 0 = device-to-host (read)        */
+static void ahci_prepare_slot(int slot, const uint8_t *fis, int fis_len,
+                              const disk_seg_t *segs, uint32_t nsegs, int write)
 {
-    uint32_t pb = AHCI_PORT_BASE(port);
-
-    /* Set up command header (slot 0) */
-    ahci_cmd_header_t *hdr = &ahci_cmd_list[0];
+    ahci_cmd_header_t *hdr = &ahci_cmd_list[slot];
+    ahci_cmd_table_t  *tbl = &ahci_cmd_tables[slot];
     for (int i = 0; i < 8; i++) ((uint32_t *)hdr)[i] = 0;
 
     uint16_t flags = (uint16_t)(fis_len / 4);  /* CFL = FIS length in DWORDs */
     if (write) flags |= (1 << 6);  /* W bit */
     hdr->flags = flags;
-    hdr->prdtl = (len > 0) ? 1 : 0;
+    hdr->prdtl = (uint16_t)nsegs;
     hdr->prdbc = 0;
 
-    uint64_t ctba = (uint64_t)(uintptr_t)&ahci_cmd_table;
+    uint64_t ctba = (uint64_t)(uintptr_t)tbl;
     hdr->ctba  = (uint32_t)(ctba & 0xFFFFFFFF);
     hdr->ctbau = (uint32_t)(ctba >> 32);
 
-    /* Clear command table */
-    uint8_t *ct = (uint8_t *)&ahci_cmd_table;
-    for (int i = 0; i < (int)sizeof(ahci_cmd_table); i++) ct[i] = 0;
-
-    /* Copy FIS */
+    /* Clear the FIS area, then copy the FIS */
+    for (int i = 0; i < 128; i++) ((uint8_t *)tbl)[i] = 0;
     for (int i = 0; i < fis_len && i < 64; i++)
-        ahci_cmd_table.cfis[i] = fis[i];
-
-    /* Set up PRDT entry */
-    if (len > 0) {
-        uint64_t dba = (uint64_t)(uintptr_t)buf;
-        ahci_cmd_table.prdt[0].dba  = (uint32_t)(dba & 0xFFFFFFFF);
-        ahci_cmd_table.prdt[0].dbau = (uint32_t)(dba >> 32);
-        ahci_cmd_table.prdt[0].dbc  = (len - 1);  /* 0-based byte count */
+        tbl->cfis[i] = fis[i];
+
+    for (uint32_t i = 0; i < nsegs; i++) {
+        uint64_t dba = (uint64_t)(uintptr_t)segs[i].buf;
+        tbl->prdt[i].dba      = (uint32_t)(dba & 0xFFFFFFFF);
+        tbl->prdt[i].dbau     = (uint32_t)(dba >> 32);
+        tbl->prdt[i].reserved = 0;
+        tbl->prdt[i].dbc      = segs[i].sectors * 512 - 1;  /* 0-based */
     }
+}
+
+/* Restart a port after a task file error or a timeout.  Clearing ST
+ * also clears PxCI and PxSACT, dropping every outstanding command.  */
+static void ahci_port_recover(uint64_t abar, int port)
+{
+    uint32_t pb = AHCI_PORT_BASE(port);
+    ahci_stop_cmd(abar, port);
+    ahci_write(abar, pb + AHCI_PxSERR, 0xFFFFFFFF);
+    ahci_write(abar, pb + AHCI_PxIS, 0xFFFFFFFF);
+    ahci_start_cmd(abar, port);
+}
+
+/* Run the non-queued command prepared in slot 0 and poll for completion.
+ * Only used while no other slot is busy.  Returns 0 on success, -1 on error. */
+static int ahci_run_slot0(uint64_t abar, int port)
+{
+    uint32_t pb = AHCI_PORT_BASE(port);
 
     /* Clear interrupt status */
     ahci_write(abar, pb + AHCI_PxIS, 0xFFFFFFFF);
@@ -487,8 +541,12 @@ static int ahci_issue_cmd(uint64_t abar, int port,
         uint32_t ci = ahci_read(abar, pb + AHCI_PxCI);
         if (!(ci & 1)) break;  /* Slot 0 completed */
         uint32_t is = ahci_read(abar, pb + AHCI_PxIS);
-        if (is & AHCI_IS_TFES) return -1;  /* Task file error */
+        if (is & AHCI_IS_TFES) {  /* Task file error */
+            ahci_port_recover(abar, port);
+            return -1;
+        }
     }
+    ahci_write(abar, pb + AHCI_PxIS, 0xFFFFFFFF);
 
     /* Check for errors */
     uint32_t tfd = ahci_read(abar, pb + AHCI_PxTFD);
@@ -497,6 +555,15 @@ static int ahci_issue_cmd(uint64_t abar, int port,
     return 0;
 }
 
+static int ahci_issue_cmd(uint64_t abar, int port,
+                          const uint8_t *fis, int fis_len,
+                          void *buf, uint32_t sectors, int write)
+{
+    disk_seg_t seg = { buf, sectors };
+    ahci_prepare_slot(0, fis, fis_len, &seg, sectors ? 1 : 0, write);
+    return ahci_run_slot0(abar, port);
+}
+
 /* Build an H2D Register FIS for an ATA command */
 static void ahci_build_fis_h2d(uint8_t *fis, uint8_t command,
                                 uint64_t lba, uint16_t count)
@@ -518,6 +585,17 @@ static void ahci_build_fis_h2d(uint8_t *fis, uint8_t command,
     fis[13] = (uint8_t)((count >> 8) & 0xFF);
 }
 
+/* FPDMA QUEUED commands carry the sector count in the feature fields
+ * and the NCQ tag (= command slot) in bits 3-7 of the count field.  */
+static void ahci_build_fis_fpdma(uint8_t *fis, uint8_t command,
+                                 uint64_t lba, uint16_t count, int tag)
+{
+    ahci_build_fis_h2d(fis, command, lba, 0);
+    fis[3]  = (uint8_t)(count & 0xFF);
+    fis[11] = (uint8_t)((count >> 8) & 0xFF);
+    fis[12] = (uint8_t)(tag << 3);
+}
+
 /* Identify an AHCI device and fill in total_sectors */
 static int ahci_identify(disk_device_t *dev)
 {
@@ -527,7 +605,7 @@ static int ahci_identify(disk_device_t *dev)
     uint8_t fis[20];
     ahci_build_fis_h2d(fis, ATA_CMD_IDENTIFY_AHCI, 0, 0);
 
-    if (ahci_issue_cmd(abar, port, fis, 20, ahci_data_buf, 512, 0) < 0)
+    if (ahci_issue_cmd(abar, port, fis, 20, ahci_data_buf, 1, 0) < 0)
         return 0;
 
     /* Parse identify data */
@@ -540,51 +618,185 @@ static int ahci_identify(disk_device_t *dev)
         dev->total_sectors = (uint32_t)ident[60] | ((uint32_t)ident[61] << 16);
     }
 
+    /* Queue depth: the smaller of the HBA's slots and the drive's NCQ depth */
+    uint32_t cap = ahci_read(abar, AHCI_HBA_CAP);
+    if ((cap & AHCI_CAP_SNCQ) && (ident[ATA_IDENT_SATA_CAP] & (1u << 8))) {
+        uint32_t depth = (ident[ATA_IDENT_QUEUE_DEPTH] & 0x1F) + 1u;
+        ahci_slots = AHCI_CAP_NCS(cap);
+        if (ahci_slots > depth) ahci_slots = depth;
+        ahci_ncq = ahci_slots > 1;
+    }
+    if (!ahci_ncq) ahci_slots = 1;
+    dev->queue_depth = ahci_slots;
+
     dev->present = 1;
     return 1;
 }
 
-/* Read sectors via AHCI DMA */
-static int ahci_read_sectors(disk_device_t *dev, uint64_t lba,
-                             uint32_t count, void *buf)
+/* ── AHCI request queue ───────────────────────────────────────────────── */
+static void finish_request(disk_request_t *req, int status)
+{
+    req->status = status;
+    if (req->complete) req->complete(req);
+}
+
+/* Fail everything in flight and restart the port.  Caller holds the lock
+ * and finishes the returned requests once it has dropped it.          */
+static int ahci_fail_all(disk_device_t *dev, disk_request_t **out)
 {
+    int n = 0;
+    for (int slot = 0; slot < 32; slot++) {
+        if (!(ahci_busy & (1u << slot))) continue;
+        out[n++] = ahci_slot_req[slot];
+        ahci_slot_req[slot] = (void *)0;
+    }
+    ahci_busy = 0;
+    ahci_port_recover(dev->mmio_base, dev->port_index);
+    return n;
+}
+
+static int ahci_poll(disk_device_t *dev)
+{
+    disk_request_t *done[32];
+    int ndone = 0, ok = 1;
     uint64_t abar = dev->mmio_base;
-    int port = dev->port_index;
-    uint8_t *dst = (uint8_t *)buf;
+    uint32_t pb = AHCI_PORT_BASE(dev->port_index);
+
+    uint64_t flags = spin_lock_irqsave(&ahci_lock);
+    uint32_t is = ahci_read(abar, pb + AHCI_PxIS);
+    ahci_write(abar, pb + AHCI_PxIS, is);
+    if (ahci_busy) {
+        if (is & AHCI_IS_TFES) {
+            /* NCQ errors abort the whole queue; nothing says which tag */
+            ndone = ahci_fail_all(dev, done);
+            ok = 0;
+        } else {
+            uint32_t active = ahci_read(abar, pb + AHCI_PxSACT) |
+                              ahci_read(abar, pb + AHCI_PxCI);
+            uint32_t finished = ahci_busy & ~active;
+            for (int slot = 0; finished; slot++, finished >>= 1) {
+                if (!(finished & 1)) continue;
+                done[ndone++] = ahci_slot_req[slot];
+                ahci_slot_req[slot] = (void *)0;
+                ahci_busy &= ~(1u << slot);
+            }
+        }
+    }
+    int in_flight = 0;
+    for (uint32_t b = ahci_busy; b; b &= b - 1) in_flight++;
+    spin_unlock_irqrestore(&ahci_lock, flags);
+
+    /* Callbacks may submit more, so they run without the lock */
+    for (int i = 0; i < ndone; i++)
+        finish_request(done[i], ok ? DISK_REQ_DONE : DISK_REQ_ERROR);
+    return in_flight;
+}
 
-    for (uint32_t s = 0; s < count; s++) {
-        uint8_t fis[20];
-        ahci_build_fis_h2d(fis, ATA_CMD_READ_DMA_EXT, lba + s, 1);
+static void ahci_irq(uint64_t irq, uint64_t error_code)
+{
+    (void)irq; (void)error_code;
+    disk_device_t *dev = disk_get_primary();
+    if (!dev || dev->type != DISK_TYPE_AHCI) return;
+    uint32_t is = ahci_read(dev->mmio_base, AHCI_HBA_IS);
+    if (is & (1u << dev->port_index))
+        ahci_poll(dev);
+    ahci_write(dev->mmio_base, AHCI_HBA_IS, is);
+}
 
-        if (ahci_issue_cmd(abar, port, fis, 20, ahci_data_buf, 512, 0) < 0)
-            return -1;
+/* Used when a buffer is not word aligned, which PRDs require: move the
+ * data one sector at a time through the aligned bounce buffer.       */
+static int ahci_bounce_rw(disk_device_t *dev, uint64_t lba,
+                          const disk_seg_t *segs, uint32_t nsegs, int write)
+{
+    while (ahci_poll(dev)) cpu_relax();     /* Slot 0 must be free */
 
-        for (int i = 0; i < 512; i++)
-            dst[s * 512 + i] = ahci_data_buf[i];
+    uint8_t fis[20];
+    for (uint32_t i = 0; i < nsegs; i++) {
+        uint8_t *p = (uint8_t *)segs[i].buf;
+        for (uint32_t s = 0; s < segs[i].sectors; s++, lba++, p += 512) {
+            if (write)
+                for (int b = 0; b < 512; b++) ahci_data_buf[b] = p[b];
+            ahci_build_fis_h2d(fis, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT,
+                               lba, 1);
+            if (ahci_issue_cmd(dev->mmio_base, dev->port_index, fis, 20,
+                               ahci_data_buf, 1, write) < 0)
+                return -1;
+            if (!write)
+                for (int b = 0; b < 512; b++) p[b] = ahci_data_buf[b];
+        }
     }
-    return (int)count;
+    return 0;
 }
 
-/* Write sectors via AHCI DMA */
-static int ahci_write_sectors(disk_device_t *dev, uint64_t lba,
-                              uint32_t count, const void *buf)
+static int ahci_submit(disk_device_t *dev, disk_request_t *req,
+                       const disk_seg_t *segs, uint32_t nsegs, uint32_t sectors)
 {
-    uint64_t abar = dev->mmio_base;
-    int port = dev->port_index;
-    const uint8_t *src = (const uint8_t *)buf;
-
-    for (uint32_t s = 0; s < count; s++) {
-        /* Copy data to aligned DMA buffer */
-        for (int i = 0; i < 512; i++)
-            ahci_data_buf[i] = src[s * 512 + i];
+    for (uint32_t i = 0; i < nsegs; i++) {
+        if ((uintptr_t)segs[i].buf & 1) {
+            finish_request(req, ahci_bounce_rw(dev, req->lba, segs, nsegs, req->write) < 0
+                                ? DISK_REQ_ERROR : DISK_REQ_DONE);
+            return 0;
+        }
+    }
 
-        uint8_t fis[20];
-        ahci_build_fis_h2d(fis, ATA_CMD_WRITE_DMA_EXT, lba + s, 1);
+    uint8_t fis[20];
+    if (!ahci_ncq) {
+        ahci_build_fis_h2d(fis, req->write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT,
+                           req->lba, (uint16_t)sectors);
+        ahci_prepare_slot(0, fis, 20, segs, nsegs, req->write);
+        int rc = ahci_run_slot0(dev->mmio_base, dev->port_index);
+        finish_request(req, rc < 0 ? DISK_REQ_ERROR : DISK_REQ_DONE);
+        return 0;
+    }
 
-        if (ahci_issue_cmd(abar, port, fis, 20, ahci_data_buf, 512, 1) < 0)
-            return -1;
+    /* Wait for a free slot, reaping completions meanwhile */
+    uint64_t deadline = timer_now_ns() + DISK_TIMEOUT_MS * NS_PER_MS;
+    uint64_t flags;
+    int slot;
+    for (;;) {
+        flags = spin_lock_irqsave(&ahci_lock);
+        uint32_t free_slots = ~ahci_busy & (ahci_slots == 32 ? 0xFFFFFFFFu : (1u << ahci_slots) - 1);
+        if (free_slots) {
+            slot = __builtin_ctz(free_slots);
+            break;
+        }
+        spin_unlock_irqrestore(&ahci_lock, flags);
+        if (!ahci_poll(dev)) continue;
+        if (timer_now_ns() > deadline) {
+            disk_request_t *failed[32];
+            flags = spin_lock_irqsave(&ahci_lock);
+            int n = ahci_fail_all(dev, failed);
+            spin_unlock_irqrestore(&ahci_lock, flags);
+            for (int i = 0; i < n; i++) finish_request(failed[i], DISK_REQ_ERROR);
+        }
+        cpu_relax();
     }
-    return (int)count;
+
+    ahci_build_fis_fpdma(fis, req->write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA,
+                         req->lba, (uint16_t)sectors, slot);
+    ahci_prepare_slot(slot, fis, 20, segs, nsegs, req->write);
+    ahci_slot_req[slot] = req;
+    ahci_busy |= 1u << slot;
+
+    uint32_t pb = AHCI_PORT_BASE(dev->port_index);
+    ahci_write(dev->mmio_base, pb + AHCI_PxSACT, 1u << slot);
+    ahci_write(dev->mmio_base, pb + AHCI_PxCI, 1u << slot);
+    spin_unlock_irqrestore(&ahci_lock, flags);
+    return 0;
+}
+
+/* Completions raise the controller's legacy PCI interrupt; without a
+ * usable line everything still completes through polling.           */
+static void ahci_enable_irq(disk_device_t *dev)
+{
+    if (ahci_irq_line >= 16) return;
+    uint32_t pb = AHCI_PORT_BASE(dev->port_index);
+    irq_register_handler(32 + ahci_irq_line, ahci_irq);
+    ahci_write(dev->mmio_base, pb + AHCI_PxIS, 0xFFFFFFFF);
+    ahci_write(dev->mmio_base, AHCI_HBA_IS, 0xFFFFFFFF);
+    ahci_write(dev->mmio_base, pb + AHCI_PxIE, AHCI_IS_DHRS | AHCI_IS_SDBS | AHCI_IS_TFES);
+    ahci_write(dev->mmio_base, AHCI_HBA_GHC,
+               ahci_read(dev->mmio_base, AHCI_HBA_GHC) | AHCI_GHC_IE);
 }
 
 /* Probe AHCI ports for a SATA disk device */
@@ -622,8 +834,10 @@ static int ahci_probe(disk_device_t *dev)
 
         ahci_port_init(abar, port);
 
-        if (ahci_identify(dev))
+        if (ahci_identify(dev)) {
+            ahci_enable_irq(dev);
             return 1;
+        }
     }
 
     return 0;
@@ -644,36 +858,121 @@ void disk_init(void)
     if (ata_identify(&primary_disk))
         return;
 
-    /* Fall back to AHCI (SATA) */
-    ahci_probe(&primary_disk);
+    /* Fall back to AHCI (SATA), then NVMe */
+    if (ahci_probe(&primary_disk))
+        return;
+    nvme_probe(&primary_disk);
 }
 
-int disk_read(disk_device_t *dev, uint64_t lba, uint32_t count, void *buf)
+int disk_submit(disk_device_t *dev, disk_request_t *req)
 {
-    if (!dev || !dev->present) return -1;
-    switch (dev->type) {
-    case DISK_TYPE_ATA:
-        return ata_read_sectors(dev, lba, count, buf);
-    case DISK_TYPE_AHCI:
-        return ahci_read_sectors(dev, lba, count, buf);
-    case DISK_TYPE_NVME:
+    disk_seg_t single = { req->buf, req->count };
+    const disk_seg_t *segs = req->segs ? req->segs : &single;
+    uint32_t nsegs = req->segs ? req->nsegs : 1;
+
+    uint32_t sectors = 0;
+    for (uint32_t i = 0; i < nsegs; i++) sectors += segs[i].sectors;
+
+    req->status = DISK_REQ_PENDING;
+    if (!dev || !dev->present || !nsegs || nsegs > DISK_REQ_MAX_SEGS ||
+        !sectors || sectors > DISK_REQ_MAX_SECTORS) {
+        finish_request(req, DISK_REQ_ERROR);
         return -1;
     }
-    return -1;
+
+    if (dev->type == DISK_TYPE_AHCI)
+        return ahci_submit(dev, req, segs, nsegs, sectors);
+    if (dev->type == DISK_TYPE_NVME)
+        return nvme_submit(dev, req, segs, nsegs);
+
+    int rc = 0;
+    uint64_t lba = req->lba;
+    for (uint32_t i = 0; i < nsegs && rc >= 0; i++) {
+        if (dev->type != DISK_TYPE_ATA)
+            rc = -1;
+        else if (req->write)
+            rc = ata_write_sectors(dev, lba, segs[i].sectors, segs[i].buf);
+        else
+            rc = ata_read_sectors(dev, lba, segs[i].sectors, segs[i].buf);
+        lba += segs[i].sectors;
+    }
+    finish_request(req, rc < 0 ? DISK_REQ_ERROR : DISK_REQ_DONE);
+    return 0;
 }
 
-int disk_write(disk_device_t *dev, uint64_t lba, uint32_t count, const void *buf)
+int disk_poll(disk_device_t *dev)
+{
+    if (!dev) return 0;
+    if (dev->type == DISK_TYPE_NVME) return nvme_poll(dev);
+    if (dev->type != DISK_TYPE_AHCI) return 0;
+    return ahci_poll(dev);
+}
+
+int disk_wait(disk_device_t *dev, disk_request_t *req)
+{
+    uint64_t deadline = timer_now_ns() + DISK_TIMEOUT_MS * NS_PER_MS;
+    while (req->status == DISK_REQ_PENDING) {
+        if (!disk_poll(dev) || req->status != DISK_REQ_PENDING) break;
+        if (timer_now_ns() > deadline) {
+            /* Hung command: drop the queue so buffers are released */
+            if (dev->type == DISK_TYPE_NVME) {
+                nvme_reset(dev);
+                break;
+            }
+            disk_request_t *failed[32];
+            uint64_t flags = spin_lock_irqsave(&ahci_lock);
+            int n = ahci_fail_all(dev, failed);
+            spin_unlock_irqrestore(&ahci_lock, flags);
+            for (int i = 0; i < n; i++) finish_request(failed[i], DISK_REQ_ERROR);
+            break;
+        }
+        cpu_relax();
+    }
+    return req->status == DISK_REQ_DONE ? 0 : -1;
+}
+
+/* Split a transfer into requests of at most DISK_REQ_MAX_SECTORS and keep
+ * up to DISK_RW_INFLIGHT of them queued, so NCQ drives see several.   */
+static int disk_rw(disk_device_t *dev, uint64_t lba, uint32_t count, void *buf, int write)
 {
     if (!dev || !dev->present) return -1;
-    switch (dev->type) {
-    case DISK_TYPE_ATA:
-        return ata_write_sectors(dev, lba, count, buf);
-    case DISK_TYPE_AHCI:
-        return ahci_write_sectors(dev, lba, count, buf);
-    case DISK_TYPE_NVME:
-        return -1;
+
+    disk_request_t reqs[DISK_RW_INFLIGHT];
+    uint8_t *p = (uint8_t *)buf;
+    int rc = 0;
+    uint32_t done = 0;
+    while (done < count) {
+        int n = 0;
+        for (; n < DISK_RW_INFLIGHT && done < count; n++) {
+            uint32_t chunk = count - done;
+            if (chunk > DISK_REQ_MAX_SECTORS) chunk = DISK_REQ_MAX_SECTORS;
+            disk_request_t *r = &reqs[n];
+            r->lba      = lba + done;
+            r->write    = write;
+            r->segs     = (void *)0;
+            r->nsegs    = 0;
+            r->buf      = p + (uint64_t)done * 512;
+            r->count    = chunk;
+            r->complete = (void *)0;
+            r->ctx      = (void *)0;
+            disk_submit(dev, r);
+            done += chunk;
+        }
+        for (int i = 0; i < n; i++)
+            if (disk_wait(dev, &reqs[i]) < 0) rc = -1;
+        if (rc < 0) return -1;
     }
-    return -1;
+    return (int)count;
+}
+
+int disk_read(disk_device_t *dev, uint64_t lba, uint32_t count, void *buf)
+{
+    return disk_rw(dev, lba, count, buf, 0);
+}
+
+int disk_write(disk_device_t *dev, uint64_t lba, uint32_t count, const void *buf)
+{
+    return disk_rw(dev, lba, count, (void *)buf, 1);
 }
 
 disk_device_t *disk_get_primary(void)
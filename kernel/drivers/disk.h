@@ -20,12 +20,56 @@ typedef struct {
     uint64_t    mmio_base;   /* For AHCI/NVMe: MMIO BAR */
     int         port_index;  /* For AHCI: port number (0-31) */
     uint64_t    total_sectors;
+    uint32_t    queue_depth; /* Requests kept in flight (1 = one at a time) */
     int         present;
 } disk_device_t;
 
+/* ── Asynchronous requests ── */
+#define DISK_REQ_MAX_SECTORS  8192      /* 4 MiB per request          */
+#define DISK_REQ_MAX_SEGS     16        /* Scatter-gather segments    */
+
+#define DISK_REQ_PENDING      0
+#define DISK_REQ_DONE         1
+#define DISK_REQ_ERROR        2
+
+/* One piece of a scatter-gather transfer.  Buffers are identity-mapped
+ * memory below 4 GiB; AHCI DMAs into them directly when word aligned. */
+typedef struct {
+    void     *buf;
+    uint32_t  sectors;
+} disk_seg_t;
+
+typedef struct disk_request {
+    uint64_t          lba;
+    int               write;
+    const disk_seg_t *segs;         /* NULL: the single buffer below */
+    uint32_t          nsegs;
+    void             *buf;
+    uint32_t          count;        /* Sectors, when segs is NULL    */
+    volatile int      status;       /* DISK_REQ_*                    */
+    uint16_t          parts;        /* Driver use: commands in flight */
+    uint16_t          part_errors;
+    /* Optional; runs from disk_poll, possibly in the disk interrupt */
+    void            (*complete)(struct disk_request *req);
+    void             *ctx;
+} disk_request_t;
+
 void disk_init(void);
 int  disk_read(disk_device_t *dev, uint64_t lba, uint32_t count, void *buf);
 int  disk_write(disk_device_t *dev, uint64_t lba, uint32_t count, const void *buf);
 disk_device_t *disk_get_primary(void);
 
+/* Queue a request.  With AHCI NCQ or NVMe up to 32 are in flight at once;
+ * ATA finishes it before returning.  Returns 0 once queued, -1 if it
+ * was rejected (status is then DISK_REQ_ERROR).                      */
+int  disk_submit(disk_device_t *dev, disk_request_t *req);
+
+/* Reap finished commands.  Called by the disk interrupt when the
+ * controller has one, and safe to call from polling loops anyway.
+ * Returns the number of requests still in flight.                 */
+int  disk_poll(disk_device_t *dev);
+
+/* Poll until the request finishes; returns 0 or -1 */
+int  disk_wait(disk_device_t *dev, disk_request_t *req);
+
 #endif /* NEXTOS_DISK_H */
@@ -51,6 +51,9 @@ typedef enum {
 /* Extended scancode constants (after E0 prefix) */
 #define KEY_SCANCODE_LWIN  0x5B
 
+#define KEY_SCANCODE_F11   0x57
+#define KEY_SCANCODE_F12   0x58
+
 void         keyboard_init(void);
 void         keyboard_set_layout(kb_layout_t layout);
 kb_layout_t  keyboard_get_layout(void);
@@ -2,12 +2,17 @@
  * nextOS - net.c
  * Intel E1000 NIC driver (for QEMU e1000 emulation)
  *
- * Supports basic packet send/receive using polling mode.
+ * TX/RX descriptor rings over a shared pool of packet buffers, with the
+ * tail registers written once per batch.  RX is NAPI-style: the
+ * (throttled) interrupt masks itself and wakes the waiter, which polls
+ * the ring empty and only then re-arms it.  IPv4 and TCP checksums are
+ * inserted on TX and verified on RX by the NIC.
  * PCI device: vendor 0x8086, device 0x100E (82540EM)
  */
 #include "net.h"
 #include "../arch/x86_64/idt.h"
 #include "../mem/paging.h"
+#include "../sched/kthread.h"
 
 /* PCI Configuration Space */
 #define PCI_CONFIG_ADDR 0xCF8
@@ -37,6 +42,7 @@ static void pci_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off,
 #define E1000_STATUS    0x0008
 #define E1000_EERD      0x0014
 #define E1000_ICR       0x00C0
+#define E1000_ITR       0x00C4
 #define E1000_IMS       0x00D0
 #define E1000_IMC       0x00D8
 #define E1000_RCTL      0x0100
@@ -54,11 +60,23 @@ static void pci_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off,
 #define E1000_RAL0      0x5400
 #define E1000_RAH0      0x5404
 #define E1000_MTA       0x5200
+#define E1000_RXCSUM    0x5000
+#define E1000_MPC       0x4010      /* Missed packets, clear on read */
 
 /* CTRL bits */
 #define E1000_CTRL_SLU  (1u << 6)   /* Set Link Up */
 #define E1000_CTRL_RST  (1u << 26)  /* Device Reset */
 
+/* Interrupt causes (ICR/IMS/IMC) */
+#define E1000_ICR_LSC    (1u << 2)  /* Link status change */
+#define E1000_ICR_RXDMT0 (1u << 4)  /* RX descriptors below threshold */
+#define E1000_ICR_RXO    (1u << 6)  /* RX overrun */
+#define E1000_ICR_RXT0   (1u << 7)  /* RX timer: frames written back */
+#define E1000_RX_CAUSES  (E1000_ICR_RXT0 | E1000_ICR_RXO | E1000_ICR_RXDMT0 | E1000_ICR_LSC)
+
+/* ITR counts 256 ns units between interrupts: ~8000 per second */
+#define E1000_ITR_VALUE  488
+
 /* RCTL bits */
 #define E1000_RCTL_EN   (1u << 1)
 #define E1000_RCTL_BAM  (1u << 15)  /* Broadcast Accept */
@@ -77,13 +95,31 @@ static void pci_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off,
 #define E1000_TXD_CMD_RS   (1u << 3)
 #define E1000_TXD_STAT_DD  (1u << 0)
 
+/* Extended TX descriptors (checksum offload) */
+#define E1000_TXD_CMD_DEXT (1u << 5)
+#define E1000_TXD_DTYP_DATA 0x10    /* In the cso byte: DTYP = 1 */
+#define E1000_TXD_POPTS_IXSM (1u << 0)
+#define E1000_TXD_POPTS_TXSM (1u << 1)
+#define E1000_TUCMD_TCP    (1u << 0)
+#define E1000_TUCMD_IP     (1u << 1)
+
+/* RXCSUM bits */
+#define E1000_RXCSUM_IPOFLD (1u << 8)
+#define E1000_RXCSUM_TUOFLD (1u << 9)
+
 /* RX descriptor status bits */
 #define E1000_RXD_STAT_DD  (1u << 0)
 #define E1000_RXD_STAT_EOP (1u << 1)
+#define E1000_RXD_STAT_IXSM  (1u << 2)  /* Checksums not checked */
+#define E1000_RXD_STAT_TCPCS (1u << 5)  /* TCP/UDP checksum checked */
+#define E1000_RXD_STAT_IPCS  (1u << 6)  /* IP checksum checked */
+#define E1000_RXD_ERR_TCPE   (1u << 5)
+#define E1000_RXD_ERR_IPE    (1u << 6)
 
 /* Descriptor counts (must be multiple of 8) */
 #define NUM_RX_DESC  32
-#define NUM_TX_DESC  8
+#define NUM_TX_DESC  64
+#define RX_BATCH     8         /* Reclaimed RX descriptors per RDT write */
 
 /* ── Descriptor Structures ───────────────────────────────────────────── */
 typedef struct {
@@ -105,18 +141,84 @@ typedef struct {
     uint16_t special;
 } __attribute__((packed)) e1000_tx_desc_t;
 
+/* Checksum context descriptor, occupying a TX ring slot: checksum
+ * start, offset and (inclusive) end for the IP header and TCP/UDP.  */
+typedef struct {
+    uint8_t  ipcss;
+    uint8_t  ipcso;
+    uint16_t ipcse;
+    uint8_t  tucss;
+    uint8_t  tucso;
+    uint16_t tucse;            /* 0: to the end of the frame */
+    uint32_t paylen_cmd;       /* PAYLEN, DTYP = 0, TUCMD in the top byte */
+    uint8_t  status;
+    uint8_t  hdrlen;
+    uint16_t mss;
+} __attribute__((packed)) e1000_tx_ctx_desc_t;
+
+/* Offsets of the only context used: IPv4 without options, then TCP */
+#define CSUM_IP_START   14
+#define CSUM_TCP_START  (CSUM_IP_START + 20)
+
 /* ── Static Buffers (BSS, identity-mapped for DMA) ───────────────────── */
 static e1000_rx_desc_t rx_descs[NUM_RX_DESC] __attribute__((aligned(16)));
 static e1000_tx_desc_t tx_descs[NUM_TX_DESC] __attribute__((aligned(16)));
-static uint8_t rx_buffers[NUM_RX_DESC][2048] __attribute__((aligned(16)));
-static uint8_t tx_buffer[2048] __attribute__((aligned(16)));
+static uint8_t  netbuf_mem[NETBUF_COUNT][NETBUF_SIZE] __attribute__((aligned(16)));
+static netbuf_t netbufs[NETBUF_COUNT];
+static netbuf_t *netbuf_free[NETBUF_COUNT];
+static int      netbuf_free_count = 0;
+
+/* The buffer each descriptor points at */
+static netbuf_t *rx_bufs[NUM_RX_DESC];
+static netbuf_t *tx_bufs[NUM_TX_DESC];
 
 /* ── Device State ────────────────────────────────────────────────────── */
 static uint64_t mmio_base = 0;
 static int      net_present = 0;
 static uint8_t  mac_addr[6];
 static uint32_t rx_cur = 0;
-static uint32_t tx_cur = 0;
+static uint32_t rx_tail = 0;      /* Last descriptor handed back, unflushed */
+static int      rx_unflushed = 0;
+static uint32_t tx_cur = 0;       /* Next descriptor to fill        */
+static uint32_t tx_clean = 0;     /* Oldest descriptor not reaped   */
+static int      tx_unflushed = 0;
+static int      tx_ctx_loaded = 0;  /* TCP context in effect on the NIC */
+static uint8_t  net_irq_line = 0xFF;
+static net_stats_t stats;
+static kthread_event_t rx_event;
+
+/* ── Packet buffers ──────────────────────────────────────────────────── */
+static void netbuf_pool_init(void)
+{
+    netbuf_free_count = 0;
+    for (int i = NETBUF_COUNT - 1; i >= 0; i--) {
+        netbufs[i].data = netbuf_mem[i];
+        netbufs[i].len = 0;
+        netbufs[i].refs = 0;
+        netbuf_free[netbuf_free_count++] = &netbufs[i];
+    }
+}
+
+netbuf_t *netbuf_alloc(void)
+{
+    if (netbuf_free_count == 0) return (void *)0;
+    netbuf_t *nb = netbuf_free[--netbuf_free_count];
+    nb->len = 0;
+    nb->refs = 1;
+    nb->flags = 0;
+    return nb;
+}
+
+void netbuf_ref(netbuf_t *nb)
+{
+    nb->refs++;
+}
+
+void netbuf_put(netbuf_t *nb)
+{
+    if (nb && nb->refs && --nb->refs == 0)
+        netbuf_free[netbuf_free_count++] = nb;
+}
 
 /* ── MMIO Access ─────────────────────────────────────────────────────── */
 static uint32_t e1000_read(uint32_t reg)
@@ -172,7 +274,8 @@ static void e1000_read_mac(void)
 static void e1000_init_rx(void)
 {
     for (int i = 0; i < NUM_RX_DESC; i++) {
-        rx_descs[i].addr = (uint64_t)(uintptr_t)&rx_buffers[i][0];
+        rx_bufs[i] = netbuf_alloc();
+        rx_descs[i].addr = (uint64_t)(uintptr_t)rx_bufs[i]->data;
         rx_descs[i].status = 0;
     }
 
@@ -183,7 +286,9 @@ static void e1000_init_rx(void)
     e1000_write(E1000_RDH, 0);
     e1000_write(E1000_RDT, NUM_RX_DESC - 1);
     rx_cur = 0;
+    rx_unflushed = 0;
 
+    e1000_write(E1000_RXCSUM, E1000_RXCSUM_IPOFLD | E1000_RXCSUM_TUOFLD);
     e1000_write(E1000_RCTL, E1000_RCTL_EN | E1000_RCTL_BAM |
                              E1000_RCTL_BSIZE_2048 | E1000_RCTL_SECRC);
 }
@@ -195,6 +300,7 @@ static void e1000_init_tx(void)
         tx_descs[i].addr = 0;
         tx_descs[i].cmd = 0;
         tx_descs[i].status = E1000_TXD_STAT_DD;
+        tx_bufs[i] = (void *)0;
     }
 
     uint64_t tx_addr = (uint64_t)(uintptr_t)tx_descs;
@@ -204,6 +310,9 @@ static void e1000_init_tx(void)
     e1000_write(E1000_TDH, 0);
     e1000_write(E1000_TDT, 0);
     tx_cur = 0;
+    tx_clean = 0;
+    tx_unflushed = 0;
+    tx_ctx_loaded = 0;
 
     e1000_write(E1000_TCTL, E1000_TCTL_EN | E1000_TCTL_PSP |
                              (15u << E1000_TCTL_CT_SHIFT) |
@@ -234,6 +343,23 @@ static int find_e1000(uint8_t *out_bus, uint8_t *out_slot, uint8_t *out_func)
     return 0;
 }
 
+/* ── Interrupts ──────────────────────────────────────────────────────── */
+/* Top half: mask RX and wake the waiter.  Reading ICR acknowledges it;
+ * a zero read means the (shared, level-triggered) line was not ours. */
+static void e1000_irq(uint64_t irq, uint64_t error_code)
+{
+    (void)irq; (void)error_code;
+    if (!e1000_read(E1000_ICR)) return;
+    stats.interrupts++;
+    e1000_write(E1000_IMC, E1000_RX_CAUSES);
+    kthread_signal(&rx_event);
+}
+
+static int rx_pending(void)
+{
+    return (rx_descs[rx_cur].status & E1000_RXD_STAT_DD) != 0;
+}
+
 /* ── Public API ──────────────────────────────────────────────────────── */
 void net_init(void)
 {
@@ -253,8 +379,7 @@ void net_init(void)
     mmio_base = bar0 & ~0xFu;
 
     /* Map MMIO region (128KB should be enough for E1000 registers) */
-    for (uint64_t off = 0; off < 0x20000; off += 4096)
-        paging_map(mmio_base + off, mmio_base + off, 0x03);
+    paging_map_range(mmio_base, mmio_base, 0x20000, PAGE_WRITE | PAGE_CACHE_UC);
 
     /* Reset the device */
     e1000_write(E1000_CTRL, e1000_read(E1000_CTRL) | E1000_CTRL_RST);
@@ -263,8 +388,13 @@ void net_init(void)
     /* Set link up */
     e1000_write(E1000_CTRL, e1000_read(E1000_CTRL) | E1000_CTRL_SLU);
 
-    /* Disable interrupts (we use polling) */
+    /* Everything masked until a waiter arms RX; ITR throttles the rest */
     e1000_write(E1000_IMC, 0xFFFFFFFF);
+    e1000_read(E1000_ICR);
+    e1000_write(E1000_ITR, E1000_ITR_VALUE);
+    net_irq_line = (uint8_t)pci_read(bus, slot, func, 0x3C);
+
+    e1000_read(E1000_MPC);
 
     /* Clear multicast table */
     for (int i = 0; i < 128; i++)
@@ -274,10 +404,13 @@ void net_init(void)
     e1000_read_mac();
 
     /* Initialize RX and TX */
+    netbuf_pool_init();
     e1000_init_rx();
     e1000_init_tx();
 
     net_present = 1;
+    if (net_irq_line < 16)
+        irq_register_handler(32 + net_irq_line, e1000_irq);
 }
 
 int net_is_available(void)
@@ -291,58 +424,203 @@ void net_get_mac(uint8_t mac[6])
         mac[i] = mac_addr[i];
 }
 
-int net_send(const void *data, uint32_t len)
+/* Return the buffers of descriptors the NIC has finished sending */
+static void tx_reap(void)
 {
-    if (!net_present || len > 1518) return -1;
+    while (tx_clean != tx_cur && (tx_descs[tx_clean].status & E1000_TXD_STAT_DD)) {
+        netbuf_put(tx_bufs[tx_clean]);
+        tx_bufs[tx_clean] = (void *)0;
+        tx_clean = (tx_clean + 1) % NUM_TX_DESC;
+    }
+}
 
-    /* Wait for previous TX to complete */
-    while (!(tx_descs[tx_cur].status & E1000_TXD_STAT_DD)) {
-        for (volatile int i = 0; i < 1000; i++);
+void net_flush(void)
+{
+    if (!net_present) return;
+    if (tx_unflushed) {
+        e1000_write(E1000_TDT, tx_cur);
+        tx_unflushed = 0;
+    }
+    if (rx_unflushed) {
+        e1000_write(E1000_RDT, rx_tail);
+        rx_unflushed = 0;
     }
+}
 
-    /* Copy data to TX buffer */
-    const uint8_t *src = (const uint8_t *)data;
-    for (uint32_t i = 0; i < len; i++)
-        tx_buffer[i] = src[i];
+int net_offloads(void)
+{
+    return net_present ? NET_OFFLOAD_TX_CSUM | NET_OFFLOAD_RX_CSUM : 0;
+}
 
-    tx_descs[tx_cur].addr = (uint64_t)(uintptr_t)tx_buffer;
-    tx_descs[tx_cur].length = (uint16_t)len;
-    tx_descs[tx_cur].cmd = E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS;
-    tx_descs[tx_cur].status = 0;
+/* Wait until a TX slot is free; 0 on success */
+static int tx_slot(void)
+{
+    tx_reap();
+    uint32_t next = (tx_cur + 1) % NUM_TX_DESC;
+    if (next == tx_clean) {
+        /* Ring full: start what is queued and wait for a slot */
+        net_flush();
+        for (int timeout = 0; timeout < 100000 && next == tx_clean; timeout++)
+            tx_reap();
+        if (next == tx_clean) return -1;
+    }
+    return 0;
+}
 
-    uint32_t old = tx_cur;
+/* Load the IPv4 + TCP checksum context.  It stays in effect for every
+ * later offloaded frame, so this happens once per ring reset.       */
+static int tx_load_ctx(void)
+{
+    if (tx_slot() < 0) return -1;
+    e1000_tx_ctx_desc_t *c = (e1000_tx_ctx_desc_t *)&tx_descs[tx_cur];
+    c->ipcss = CSUM_IP_START;
+    c->ipcso = CSUM_IP_START + 10;
+    c->ipcse = CSUM_TCP_START - 1;
+    c->tucss = CSUM_TCP_START;
+    c->tucso = CSUM_TCP_START + 16;
+    c->tucse = 0;
+    c->paylen_cmd = (E1000_TXD_CMD_DEXT | E1000_TXD_CMD_RS |
+                     E1000_TUCMD_IP | E1000_TUCMD_TCP) << 24;
+    c->status = 0;
+    c->hdrlen = 0;
+    c->mss = 0;
+    tx_bufs[tx_cur] = (void *)0;
     tx_cur = (tx_cur + 1) % NUM_TX_DESC;
-    e1000_write(E1000_TDT, tx_cur);
+    tx_unflushed++;
+    tx_ctx_loaded = 1;
+    return 0;
+}
 
-    /* Wait for completion */
-    for (int timeout = 0; timeout < 100000; timeout++) {
-        if (tx_descs[old].status & E1000_TXD_STAT_DD)
-            return 0;
+int net_send_buf(netbuf_t *nb)
+{
+    if (!net_present || nb->len > 1518) return -1;
+
+    int offload = (nb->flags & NETBUF_TX_CSUM_TCP) != 0;
+    if ((offload && !tx_ctx_loaded && tx_load_ctx() < 0) || tx_slot() < 0) {
+        stats.tx_ring_full++;
+        return -1;
+    }
+
+    netbuf_ref(nb);
+    tx_bufs[tx_cur] = nb;
+    tx_descs[tx_cur].addr = (uint64_t)(uintptr_t)nb->data;
+    tx_descs[tx_cur].length = nb->len;
+    tx_descs[tx_cur].status = 0;
+    tx_descs[tx_cur].special = 0;
+    if (offload) {
+        tx_descs[tx_cur].cso = E1000_TXD_DTYP_DATA;
+        tx_descs[tx_cur].cmd = E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS |
+                               E1000_TXD_CMD_RS | E1000_TXD_CMD_DEXT;
+        tx_descs[tx_cur].css = E1000_TXD_POPTS_IXSM | E1000_TXD_POPTS_TXSM;
+    } else {
+        tx_descs[tx_cur].cso = 0;
+        tx_descs[tx_cur].cmd = E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS;
+        tx_descs[tx_cur].css = 0;
     }
-    return -1;
+    tx_cur = (tx_cur + 1) % NUM_TX_DESC;
+    tx_unflushed++;
+    stats.tx_frames++;
+    stats.tx_bytes += nb->len;
+    if (offload) stats.tx_csum_hw++;
+    return 0;
 }
 
-int net_receive(void *buf, uint32_t buf_size)
+/* What the NIC found checking a received frame's checksums */
+static uint16_t rx_csum_flags(const volatile e1000_rx_desc_t *d)
 {
-    if (!net_present) return -1;
+    if (d->status & E1000_RXD_STAT_IXSM) return 0;
+    if (d->errors & (E1000_RXD_ERR_IPE | E1000_RXD_ERR_TCPE)) return NETBUF_RX_CSUM_BAD;
+    if ((d->status & (E1000_RXD_STAT_IPCS | E1000_RXD_STAT_TCPCS)) ==
+        (E1000_RXD_STAT_IPCS | E1000_RXD_STAT_TCPCS))
+        return NETBUF_RX_CSUM_OK;
+    return 0;
+}
 
-    if (!(rx_descs[rx_cur].status & E1000_RXD_STAT_DD))
-        return 0;  /* No packet available */
+netbuf_t *net_receive_buf(void)
+{
+    if (!net_present) return (void *)0;
+
+    while (rx_descs[rx_cur].status & E1000_RXD_STAT_DD) {
+        /* Lend the filled buffer out and put a fresh one in its place;
+         * with none to spare the frame is dropped and its buffer reused. */
+        netbuf_t *nb = rx_bufs[rx_cur];
+        netbuf_t *fresh = netbuf_alloc();
+        if (fresh) {
+            nb->len = rx_descs[rx_cur].length;
+            nb->flags = rx_csum_flags(&rx_descs[rx_cur]);
+            rx_bufs[rx_cur] = fresh;
+            rx_descs[rx_cur].addr = (uint64_t)(uintptr_t)fresh->data;
+            stats.rx_frames++;
+            stats.rx_bytes += nb->len;
+            if (nb->flags & NETBUF_RX_CSUM_OK) stats.rx_csum_hw++;
+        } else {
+            stats.rx_no_buf++;
+        }
+        rx_descs[rx_cur].status = 0;
+        rx_tail = rx_cur;
+        rx_cur = (rx_cur + 1) % NUM_RX_DESC;
+        if (++rx_unflushed >= RX_BATCH) {
+            e1000_write(E1000_RDT, rx_tail);
+            rx_unflushed = 0;
+        }
+        if (fresh) return nb;
+    }
+    return (void *)0;
+}
 
-    uint16_t len = rx_descs[rx_cur].length;
-    if (len > buf_size) len = (uint16_t)buf_size;
+int net_send(const void *data, uint32_t len)
+{
+    if (!net_present || len > 1518) return -1;
+    netbuf_t *nb = netbuf_alloc();
+    if (!nb) return -1;
 
+    const uint8_t *src = (const uint8_t *)data;
+    for (uint32_t i = 0; i < len; i++)
+        nb->data[i] = src[i];
+    nb->len = (uint16_t)len;
+
+    int rc = net_send_buf(nb);
+    netbuf_put(nb);
+    net_flush();
+    return rc;
+}
+
+int net_receive(void *buf, uint32_t buf_size)
+{
+    netbuf_t *nb = net_receive_buf();
+    if (!nb) return net_present ? 0 : -1;
+
+    uint16_t len = nb->len;
+    if (len > buf_size) len = (uint16_t)buf_size;
     uint8_t *dst = (uint8_t *)buf;
-    uint8_t *src = rx_buffers[rx_cur];
     for (uint16_t i = 0; i < len; i++)
-        dst[i] = src[i];
+        dst[i] = nb->data[i];
+    netbuf_put(nb);
+    return len;
+}
+
+void net_get_stats(net_stats_t *out)
+{
+    if (net_present) stats.rx_missed += e1000_read(E1000_MPC);
+    stats.netbufs_free = (uint32_t)netbuf_free_count;
+    *out = stats;
+}
 
-    rx_descs[rx_cur].status = 0;
-    uint32_t old = rx_cur;
-    rx_cur = (rx_cur + 1) % NUM_RX_DESC;
-    e1000_write(E1000_RDT, old);
+int net_wait(uint32_t timeout_ms)
+{
+    if (!net_present) return 0;
+    if (rx_pending() || net_irq_line >= 16) {
+        kthread_yield();
+        return rx_pending();
+    }
 
-    return len;
+    /* The ring is empty: re-arm.  Causes latched since the mask went on
+     * raise the interrupt again at once, so no frame slips past.     */
+    rx_event.signaled = 0;
+    e1000_write(E1000_IMS, E1000_RX_CAUSES);
+    if (!rx_pending())
+        kthread_wait_event(&rx_event, timeout_ms);
+    return rx_pending();
 }
 
 void net_poll(void)
@@ -10,9 +10,78 @@
 #define ETH_FRAME_MAX  1518
 #define ETH_ALEN       6
 
+/* ── Packet buffers ──────────────────────────────────────────────────── */
+/*
+ * DMA-able frame buffers shared by the driver and the stack.  Frames are
+ * built in place and handed to the TX ring, and received frames are
+ * lent to the stack as they came off the wire.  Whoever holds a
+ * reference may read the frame; the last netbuf_put() returns it.
+ */
+#define NETBUF_SIZE   2048
+#define NETBUF_COUNT  128
+
+typedef struct {
+    uint8_t  *data;            /* Start of the Ethernet frame */
+    uint16_t  len;
+    uint16_t  refs;
+    uint16_t  flags;           /* NETBUF_*, cleared by netbuf_alloc() */
+} netbuf_t;
+
+/* TX: an IPv4 frame carrying TCP whose IP checksum is 0 and whose TCP
+ * checksum field holds the folded pseudo-header sum; the NIC finishes
+ * both.  Only valid when net_offloads() reports NET_OFFLOAD_TX_CSUM. */
+#define NETBUF_TX_CSUM_TCP  0x0001
+/* RX: the NIC verified the IP and TCP/UDP checksums, or found one bad */
+#define NETBUF_RX_CSUM_OK   0x0002
+#define NETBUF_RX_CSUM_BAD  0x0004
+/* RX: looped back by the stack itself, never on the wire */
+#define NETBUF_RX_LOOPBACK  0x0008
+
+netbuf_t *netbuf_alloc(void);               /* One reference, or 0 if none are free */
+void      netbuf_ref(netbuf_t *nb);
+void      netbuf_put(netbuf_t *nb);
+
 void net_init(void);
 int  net_is_available(void);
 void net_get_mac(uint8_t mac[6]);
+
+#define NET_OFFLOAD_TX_CSUM 0x01
+#define NET_OFFLOAD_RX_CSUM 0x02
+int  net_offloads(void);
+
+/* Driver counters since net_init */
+typedef struct {
+    uint64_t rx_frames, rx_bytes;
+    uint64_t tx_frames, tx_bytes;
+    uint64_t rx_missed;        /* NIC dropped: RX ring full (MPC) */
+    uint64_t rx_no_buf;        /* Driver dropped: no free netbuf  */
+    uint64_t tx_ring_full;     /* Sends refused: TX ring full     */
+    uint64_t rx_csum_hw;       /* Checksums verified by the NIC   */
+    uint64_t tx_csum_hw;       /* Checksums inserted by the NIC   */
+    uint64_t interrupts;
+    uint32_t netbufs_free;
+} net_stats_t;
+
+void net_get_stats(net_stats_t *out);
+
+/* Queue nb->len bytes of nb for sending.  The driver keeps its own
+ * reference until the NIC is done with it.  Queued frames go out at
+ * the next net_flush().                                            */
+int       net_send_buf(netbuf_t *nb);
+
+/* Next received frame, or 0.  The caller owns the reference.       */
+netbuf_t *net_receive_buf(void);
+
+/* Hand queued TX frames and reclaimed RX buffers to the NIC: one tail
+ * register write each, however many frames were batched.           */
+void      net_flush(void);
+
+/* Block until a frame is ready to receive or timeout_ms passes (0
+ * waits forever), halting the CPU if nothing else runs.  With frames
+ * already waiting it only yields.  Returns 1 if a frame is ready.  */
+int       net_wait(uint32_t timeout_ms);
+
+/* Copying forms of the above: net_send flushes at once */
 int  net_send(const void *data, uint32_t len);
 int  net_receive(void *buf, uint32_t buf_size);
 void net_poll(void);
@@ -0,0 +1,582 @@
+/*
+ * nextOS - nvme.c
+ * NVMe backend for the disk driver
+ *
+ * One admin queue pair and one I/O queue pair live in BSS.  A disk
+ * request becomes one or more NVM READ / WRITE commands: each command
+ * describes its buffer with PRPs (a list page per command identifier
+ * when it spans more than two pages) and is cut wherever the next
+ * scatter-gather segment cannot continue a PRP list or the controller's
+ * transfer limit is reached.  All commands of a request are written to
+ * the submission queue before the tail doorbell is rung once, and the
+ * completion queue head doorbell is likewise written once per poll.
+ */
+#include "nvme.h"
+#include "timer.h"
+#include "../arch/x86_64/idt.h"
+#include "../arch/x86_64/spinlock.h"
+#include "../mem/paging.h"
+
+/* ── PCI Configuration Space ─────────────────────────────────────────── */
+#define PCI_CONFIG_ADDR 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+static uint32_t pci_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off)
+{
+    uint32_t addr = (1u << 31) | ((uint32_t)bus << 16) |
+                    ((uint32_t)slot << 11) | ((uint32_t)func << 8) |
+                    (off & 0xFC);
+    outl(PCI_CONFIG_ADDR, addr);
+    return inl(PCI_CONFIG_DATA);
+}
+
+static void pci_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off,
+                      uint32_t val)
+{
+    uint32_t addr = (1u << 31) | ((uint32_t)bus << 16) |
+                    ((uint32_t)slot << 11) | ((uint32_t)func << 8) |
+                    (off & 0xFC);
+    outl(PCI_CONFIG_ADDR, addr);
+    outl(PCI_CONFIG_DATA, val);
+}
+
+/* ── Controller registers ────────────────────────────────────────────── */
+#define NVME_REG_CAP    0x00    /* Capabilities (64-bit) */
+#define NVME_REG_CC     0x14    /* Controller Configuration */
+#define NVME_REG_CSTS   0x1C    /* Controller Status */
+#define NVME_REG_AQA    0x24    /* Admin Queue Attributes */
+#define NVME_REG_ASQ    0x28    /* Admin SQ Base (64-bit) */
+#define NVME_REG_ACQ    0x30    /* Admin CQ Base (64-bit) */
+#define NVME_DOORBELLS  0x1000
+
+#define NVME_CAP_MQES(c)   ((uint32_t)((c) & 0xFFFF) + 1)
+#define NVME_CAP_TO(c)     ((uint32_t)(((c) >> 24) & 0xFF))     /* 500 ms units */
+#define NVME_CAP_DSTRD(c)  ((uint32_t)(((c) >> 32) & 0xF))
+
+#define NVME_CC_EN         (1u << 0)
+#define NVME_CC_IOSQES     (6u << 16)   /* 64-byte SQ entries */
+#define NVME_CC_IOCQES     (4u << 20)   /* 16-byte CQ entries */
+#define NVME_CSTS_RDY      (1u << 0)
+#define NVME_CSTS_CFS      (1u << 1)
+
+#define NVME_MMIO_SIZE     0x4000
+
+/* Admin and NVM command opcodes */
+#define NVME_ADMIN_CREATE_SQ  0x01
+#define NVME_ADMIN_CREATE_CQ  0x05
+#define NVME_ADMIN_IDENTIFY   0x06
+#define NVME_CMD_WRITE        0x01
+#define NVME_CMD_READ         0x02
+
+#define NVME_CNS_NAMESPACE    0x00
+#define NVME_CNS_CONTROLLER   0x01
+#define NVME_CNS_NS_LIST      0x02
+
+/* ── Queue sizing ────────────────────────────────────────────────────── */
+#define NVME_PAGE          PAGE_SIZE_4K
+#define NVME_ADMIN_DEPTH   16
+#define NVME_IO_DEPTH      64           /* SQ/CQ entries of the I/O pair */
+#define NVME_IO_CIDS       32           /* Commands in flight at once    */
+#define NVME_CIDS_ALL      0xFFFFFFFFu  /* cid_busy with every id taken  */
+#define NVME_MAX_XFER      (512 * 1024) /* Per command, before MDTS      */
+#define NVME_PRP_ENTRIES   (NVME_MAX_XFER / NVME_PAGE)
+#define NVME_TIMEOUT_MS    2000
+
+typedef struct {
+    uint32_t cdw0;          /* Opcode (7:0), command identifier (31:16) */
+    uint32_t nsid;
+    uint64_t rsvd;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10, cdw11, cdw12, cdw13, cdw14, cdw15;
+} nvme_sqe_t;
+
+typedef struct {
+    uint32_t result;
+    uint32_t rsvd;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;        /* Bit 0: phase tag, 15:1: status field */
+} nvme_cqe_t;
+
+typedef struct {
+    volatile nvme_sqe_t *sq;
+    volatile nvme_cqe_t *cq;
+    uint16_t             depth;
+    uint16_t             qid;
+    uint16_t             sq_tail;
+    uint16_t             cq_head;
+    uint8_t              phase;
+} nvme_queue_t;
+
+static nvme_sqe_t admin_sq[NVME_ADMIN_DEPTH] __attribute__((aligned(4096)));
+static nvme_cqe_t admin_cq[NVME_ADMIN_DEPTH] __attribute__((aligned(4096)));
+static nvme_sqe_t io_sq[NVME_IO_DEPTH]       __attribute__((aligned(4096)));
+static nvme_cqe_t io_cq[NVME_IO_DEPTH]       __attribute__((aligned(4096)));
+static uint64_t   prp_lists[NVME_IO_CIDS][NVME_PRP_ENTRIES] __attribute__((aligned(4096)));
+static uint8_t    identify_buf[4096]         __attribute__((aligned(4096)));
+static uint8_t    bounce_buf[512]            __attribute__((aligned(512)));
+
+static nvme_queue_t    admin_q, io_q;
+static uint64_t        nvme_base;
+static uint32_t        doorbell_stride;
+static uint32_t        nsid;
+static uint32_t        max_xfer = NVME_MAX_XFER;
+static uint32_t        cid_busy;            /* One bit per I/O command id */
+static disk_request_t *cid_req[NVME_IO_CIDS];
+static uint8_t         nvme_irq_line = 0xFF;
+static spinlock_t      nvme_lock = SPINLOCK_INIT;
+
+/* ── Register access ─────────────────────────────────────────────────── */
+static inline uint32_t nvme_read32(uint32_t off)
+{
+    return *(volatile uint32_t *)(nvme_base + off);
+}
+
+static inline void nvme_write32(uint32_t off, uint32_t val)
+{
+    *(volatile uint32_t *)(nvme_base + off) = val;
+}
+
+static inline uint64_t nvme_read64(uint32_t off)
+{
+    return (uint64_t)nvme_read32(off) | ((uint64_t)nvme_read32(off + 4) << 32);
+}
+
+static inline void nvme_write64(uint32_t off, uint64_t val)
+{
+    nvme_write32(off, (uint32_t)val);
+    nvme_write32(off + 4, (uint32_t)(val >> 32));
+}
+
+static inline void ring_sq(nvme_queue_t *q)
+{
+    nvme_write32(NVME_DOORBELLS + (2 * q->qid) * doorbell_stride, q->sq_tail);
+}
+
+static inline void ring_cq(nvme_queue_t *q)
+{
+    nvme_write32(NVME_DOORBELLS + (2 * q->qid + 1) * doorbell_stride, q->cq_head);
+}
+
+static void zero(void *p, uint64_t n)
+{
+    uint8_t *d = (uint8_t *)p;
+    for (uint64_t i = 0; i < n; i++) d[i] = 0;
+}
+
+static void queue_init(nvme_queue_t *q, nvme_sqe_t *sq, nvme_cqe_t *cq,
+                       uint16_t depth, uint16_t qid)
+{
+    zero(sq, (uint64_t)depth * sizeof(nvme_sqe_t));
+    zero(cq, (uint64_t)depth * sizeof(nvme_cqe_t));
+    q->sq = sq;
+    q->cq = cq;
+    q->depth = depth;
+    q->qid = qid;
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->phase = 1;
+}
+
+/* Copy a command into the next SQ slot; the doorbell is rung separately */
+static void sq_push(nvme_queue_t *q, const nvme_sqe_t *cmd)
+{
+    volatile uint32_t *dst = (volatile uint32_t *)&q->sq[q->sq_tail];
+    const uint32_t *src = (const uint32_t *)cmd;
+    for (int i = 0; i < 16; i++) dst[i] = src[i];
+    q->sq_tail = (uint16_t)((q->sq_tail + 1) % q->depth);
+}
+
+/* Next completion, or NULL if the controller has not posted one */
+static volatile nvme_cqe_t *cq_peek(nvme_queue_t *q)
+{
+    volatile nvme_cqe_t *e = &q->cq[q->cq_head];
+    return (e->status & 1) == q->phase ? e : (void *)0;
+}
+
+static void cq_advance(nvme_queue_t *q)
+{
+    if (++q->cq_head == q->depth) {
+        q->cq_head = 0;
+        q->phase ^= 1;
+    }
+}
+
+/* ── Admin commands ──────────────────────────────────────────────────── */
+/* Issue one admin command and poll for its completion */
+static int admin_cmd(nvme_sqe_t *cmd)
+{
+    sq_push(&admin_q, cmd);
+    ring_sq(&admin_q);
+
+    uint64_t deadline = timer_now_ns() + NVME_TIMEOUT_MS * NS_PER_MS;
+    volatile nvme_cqe_t *e;
+    while (!(e = cq_peek(&admin_q))) {
+        if (timer_now_ns() > deadline) return -1;
+        cpu_relax();
+    }
+    int status = e->status >> 1;
+    cq_advance(&admin_q);
+    ring_cq(&admin_q);
+    return status ? -1 : 0;
+}
+
+static int identify(uint32_t ns, uint32_t cns)
+{
+    nvme_sqe_t cmd;
+    zero(&cmd, sizeof(cmd));
+    cmd.cdw0  = NVME_ADMIN_IDENTIFY;
+    cmd.nsid  = ns;
+    cmd.prp1  = (uint64_t)(uintptr_t)identify_buf;
+    cmd.cdw10 = cns;
+    return admin_cmd(&cmd);
+}
+
+static int create_io_queues(void)
+{
+    nvme_sqe_t cmd;
+    zero(&cmd, sizeof(cmd));
+    cmd.cdw0  = NVME_ADMIN_CREATE_CQ;
+    cmd.prp1  = (uint64_t)(uintptr_t)io_cq;
+    cmd.cdw10 = ((uint32_t)(io_q.depth - 1) << 16) | io_q.qid;
+    cmd.cdw11 = (nvme_irq_line < 16 ? 2u : 0u) | 1u;   /* IEN, physically contiguous */
+    if (admin_cmd(&cmd) < 0) return -1;
+
+    zero(&cmd, sizeof(cmd));
+    cmd.cdw0  = NVME_ADMIN_CREATE_SQ;
+    cmd.prp1  = (uint64_t)(uintptr_t)io_sq;
+    cmd.cdw10 = ((uint32_t)(io_q.depth - 1) << 16) | io_q.qid;
+    cmd.cdw11 = ((uint32_t)io_q.qid << 16) | 1u;        /* CQ id, contiguous */
+    return admin_cmd(&cmd);
+}
+
+static int wait_ready(int ready, uint32_t timeout_ms)
+{
+    uint64_t deadline = timer_now_ns() + (uint64_t)timeout_ms * NS_PER_MS;
+    while (((nvme_read32(NVME_REG_CSTS) & NVME_CSTS_RDY) != 0) != ready) {
+        if (nvme_read32(NVME_REG_CSTS) & NVME_CSTS_CFS) return -1;
+        if (timer_now_ns() > deadline) return -1;
+        cpu_relax();
+    }
+    return 0;
+}
+
+/* Disable the controller, then bring it back with fresh queues */
+static int controller_start(void)
+{
+    uint64_t cap = nvme_read64(NVME_REG_CAP);
+    uint32_t timeout_ms = NVME_CAP_TO(cap) * 500 + 500;
+    doorbell_stride = 4u << NVME_CAP_DSTRD(cap);
+
+    nvme_write32(NVME_REG_CC, nvme_read32(NVME_REG_CC) & ~NVME_CC_EN);
+    if (wait_ready(0, timeout_ms) < 0) return -1;
+
+    uint16_t io_depth = NVME_IO_DEPTH;
+    if (NVME_CAP_MQES(cap) < io_depth) io_depth = (uint16_t)NVME_CAP_MQES(cap);
+    queue_init(&admin_q, admin_sq, admin_cq, NVME_ADMIN_DEPTH, 0);
+    queue_init(&io_q, io_sq, io_cq, io_depth, 1);
+
+    nvme_write32(NVME_REG_AQA, ((NVME_ADMIN_DEPTH - 1) << 16) | (NVME_ADMIN_DEPTH - 1));
+    nvme_write64(NVME_REG_ASQ, (uint64_t)(uintptr_t)admin_sq);
+    nvme_write64(NVME_REG_ACQ, (uint64_t)(uintptr_t)admin_cq);
+    nvme_write32(NVME_REG_CC, NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES);
+    if (wait_ready(1, timeout_ms) < 0) return -1;
+
+    return create_io_queues();
+}
+
+/* ── I/O path ────────────────────────────────────────────────────────── */
+static void finish_request(disk_request_t *req, int status)
+{
+    req->status = status;
+    if (req->complete) req->complete(req);
+}
+
+static void nvme_irq(uint64_t irq, uint64_t error_code)
+{
+    (void)irq; (void)error_code;
+    disk_device_t *dev = disk_get_primary();
+    if (dev && dev->type == DISK_TYPE_NVME) nvme_poll(dev);
+}
+
+int nvme_poll(disk_device_t *dev)
+{
+    (void)dev;
+    disk_request_t *done[NVME_IO_CIDS];
+    int ndone = 0;
+
+    uint64_t flags = spin_lock_irqsave(&nvme_lock);
+    volatile nvme_cqe_t *e;
+    int reaped = 0;
+    while ((e = cq_peek(&io_q))) {
+        uint16_t cid = e->cid;
+        int failed = (e->status >> 1) != 0;
+        cq_advance(&io_q);
+        reaped = 1;
+        if (cid >= NVME_IO_CIDS || !(cid_busy & (1u << cid))) continue;
+
+        disk_request_t *req = cid_req[cid];
+        cid_req[cid] = (void *)0;
+        cid_busy &= ~(1u << cid);
+        if (failed) req->part_errors++;
+        if (--req->parts == 0) done[ndone++] = req;
+    }
+    if (reaped) ring_cq(&io_q);
+    int in_flight = 0;
+    for (uint32_t b = cid_busy; b; b &= b - 1) in_flight++;
+    spin_unlock_irqrestore(&nvme_lock, flags);
+
+    for (int i = 0; i < ndone; i++)
+        finish_request(done[i], done[i]->part_errors ? DISK_REQ_ERROR : DISK_REQ_DONE);
+    return in_flight;
+}
+
+/* Claim a command id, ringing the doorbell for what is already queued and
+ * reaping completions while every id is busy.  Called with the lock held;
+ * returns with it held, or -1 after a timeout.                          */
+static int claim_cid(disk_device_t *dev, uint64_t *flags, int *queued)
+{
+    uint64_t deadline = timer_now_ns() + NVME_TIMEOUT_MS * NS_PER_MS;
+    while (cid_busy == NVME_CIDS_ALL) {
+        if (*queued) {
+            ring_sq(&io_q);
+            *queued = 0;
+        }
+        spin_unlock_irqrestore(&nvme_lock, *flags);
+        nvme_poll(dev);
+        if (timer_now_ns() > deadline) {
+            *flags = spin_lock_irqsave(&nvme_lock);
+            return -1;
+        }
+        cpu_relax();
+        *flags = spin_lock_irqsave(&nvme_lock);
+    }
+    return __builtin_ctz(~cid_busy);
+}
+
+/* Misaligned buffers cannot be described by PRPs (they need dword
+ * alignment); move those through a bounce sector once the queue drains. */
+static int bounce_rw(disk_device_t *dev, uint64_t lba, const disk_seg_t *segs,
+                     uint32_t nsegs, int write)
+{
+    uint64_t idle = timer_now_ns() + NVME_TIMEOUT_MS * NS_PER_MS;
+    while (nvme_poll(dev)) {
+        if (timer_now_ns() > idle) return -1;
+        cpu_relax();
+    }
+
+    for (uint32_t i = 0; i < nsegs; i++) {
+        uint8_t *p = (uint8_t *)segs[i].buf;
+        for (uint32_t s = 0; s < segs[i].sectors; s++, lba++, p += 512) {
+            if (write)
+                for (int b = 0; b < 512; b++) bounce_buf[b] = p[b];
+
+            disk_request_t one;
+            zero(&one, sizeof(one));
+            one.lba = lba;
+            one.write = write;
+            one.buf = bounce_buf;
+            one.count = 1;
+            one.status = DISK_REQ_PENDING;
+            nvme_submit(dev, &one, (void *)0, 0);
+            uint64_t deadline = timer_now_ns() + NVME_TIMEOUT_MS * NS_PER_MS;
+            while (one.status == DISK_REQ_PENDING) {
+                nvme_poll(dev);
+                if (timer_now_ns() > deadline) {
+                    nvme_reset(dev);    /* Drops the command before `one` goes */
+                    return -1;
+                }
+                cpu_relax();
+            }
+            if (one.status != DISK_REQ_DONE) return -1;
+
+            if (!write)
+                for (int b = 0; b < 512; b++) p[b] = bounce_buf[b];
+        }
+    }
+    return 0;
+}
+
+int nvme_submit(disk_device_t *dev, disk_request_t *req,
+                const disk_seg_t *segs, uint32_t nsegs)
+{
+    disk_seg_t single = { req->buf, req->count };
+    if (!segs) { segs = &single; nsegs = 1; }
+
+    for (uint32_t i = 0; i < nsegs; i++) {
+        if ((uintptr_t)segs[i].buf & 3) {
+            finish_request(req, bounce_rw(dev, req->lba, segs, nsegs, req->write) < 0
+                                ? DISK_REQ_ERROR : DISK_REQ_DONE);
+            return 0;
+        }
+    }
+
+    req->parts = 1;         /* Held until every command is queued */
+    req->part_errors = 0;
+
+    uint64_t flags = spin_lock_irqsave(&nvme_lock);
+    uint64_t lba = req->lba;
+    uint32_t si = 0, off = 0;
+    int queued = 0;
+    while (si < nsegs) {
+        int cid = claim_cid(dev, &flags, &queued);
+        if (cid < 0) {
+            req->part_errors++;
+            break;
+        }
+
+        /* PRP1 may start anywhere; every later entry must be a whole
+         * page, so a segment that starts mid-page ends the command.  */
+        uint64_t *list = prp_lists[cid];
+        uint64_t prp1 = 0;
+        uint32_t bytes = 0, np = 0;
+        while (si < nsegs && bytes < max_xfer) {
+            uint64_t addr = (uint64_t)(uintptr_t)segs[si].buf + off;
+            uint32_t left = segs[si].sectors * 512 - off;
+            uint32_t chunk;
+            if (bytes == 0) {
+                prp1 = addr;
+                chunk = (uint32_t)(NVME_PAGE - (addr & (NVME_PAGE - 1)));
+            } else {
+                if (addr & (NVME_PAGE - 1)) break;
+                list[np++] = addr;
+                chunk = NVME_PAGE;
+            }
+            if (chunk > left) chunk = left;
+            if (chunk > max_xfer - bytes) chunk = max_xfer - bytes;
+            bytes += chunk;
+            off += chunk;
+            if (off == segs[si].sectors * 512) { si++; off = 0; }
+            if ((addr + chunk) & (NVME_PAGE - 1)) break;
+        }
+
+        nvme_sqe_t cmd;
+        zero(&cmd, sizeof(cmd));
+        cmd.cdw0  = (req->write ? NVME_CMD_WRITE : NVME_CMD_READ) | ((uint32_t)cid << 16);
+        cmd.nsid  = nsid;
+        cmd.prp1  = prp1;
+        cmd.prp2  = np == 0 ? 0 : np == 1 ? list[0] : (uint64_t)(uintptr_t)list;
+        cmd.cdw10 = (uint32_t)lba;
+        cmd.cdw11 = (uint32_t)(lba >> 32);
+        cmd.cdw12 = bytes / 512 - 1;        /* 0-based block count */
+
+        cid_req[cid] = req;
+        cid_busy |= 1u << cid;
+        req->parts++;
+        sq_push(&io_q, &cmd);
+        queued = 1;
+        lba += bytes / 512;
+    }
+    if (queued) ring_sq(&io_q);
+
+    int last = --req->parts == 0;
+    spin_unlock_irqrestore(&nvme_lock, flags);
+    if (last)
+        finish_request(req, req->part_errors ? DISK_REQ_ERROR : DISK_REQ_DONE);
+    return 0;
+}
+
+/* Fail everything in flight and restart the controller with empty queues */
+void nvme_reset(disk_device_t *dev)
+{
+    disk_request_t *done[NVME_IO_CIDS];
+    int ndone = 0;
+
+    uint64_t flags = spin_lock_irqsave(&nvme_lock);
+    for (int cid = 0; cid < NVME_IO_CIDS; cid++) {
+        if (!(cid_busy & (1u << cid))) continue;
+        disk_request_t *req = cid_req[cid];
+        cid_req[cid] = (void *)0;
+        req->part_errors++;
+        if (--req->parts == 0) done[ndone++] = req;
+    }
+    cid_busy = 0;
+    spin_unlock_irqrestore(&nvme_lock, flags);
+
+    /* Timeouts below count on the timer, so interrupts stay enabled */
+    if (controller_start() < 0) dev->present = 0;
+
+    for (int i = 0; i < ndone; i++)
+        finish_request(done[i], DISK_REQ_ERROR);
+}
+
+/* ── Discovery ───────────────────────────────────────────────────────── */
+/* NVMe: class 0x01 (Mass Storage), subclass 0x08, prog IF 0x02 */
+static uint64_t find_controller(void)
+{
+    for (int bus = 0; bus < 256; bus++) {
+        for (int slot = 0; slot < 32; slot++) {
+            for (int func = 0; func < 8; func++) {
+                uint32_t id = pci_read(bus, slot, func, 0x00);
+                if ((id & 0xFFFF) == 0xFFFF) {
+                    if (func == 0) break;
+                    continue;
+                }
+
+                uint32_t class_reg = pci_read(bus, slot, func, 0x08);
+                if ((class_reg >> 8) == 0x010802) {
+                    uint32_t cmd = pci_read(bus, slot, func, 0x04);
+                    cmd |= (1 << 1) | (1 << 2);  /* Memory Space + Bus Master */
+                    pci_write(bus, slot, func, 0x04, cmd);
+
+                    nvme_irq_line = (uint8_t)pci_read(bus, slot, func, 0x3C);
+
+                    /* BAR0/BAR1 form a 64-bit memory BAR */
+                    uint32_t bar0 = pci_read(bus, slot, func, 0x10);
+                    uint64_t base = bar0 & 0xFFFFFFF0u;
+                    if ((bar0 & 0x6) == 0x4)
+                        base |= (uint64_t)pci_read(bus, slot, func, 0x14) << 32;
+                    return base;
+                }
+
+                if (func == 0) {
+                    uint32_t hdr = pci_read(bus, slot, 0, 0x0C);
+                    if (!((hdr >> 16) & 0x80)) break;  /* Not multi-function */
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int nvme_probe(disk_device_t *dev)
+{
+    uint64_t base = find_controller();
+    if (!base) return 0;
+
+    paging_map_range(base, base, NVME_MMIO_SIZE, PAGE_WRITE | PAGE_CACHE_UC);
+    nvme_base = base;
+    if (controller_start() < 0) return 0;
+
+    /* Transfer limit: MDTS is a power of two in minimum-page units */
+    if (identify(0, NVME_CNS_CONTROLLER) < 0) return 0;
+    uint8_t mdts = identify_buf[77];
+    if (mdts && (NVME_PAGE << mdts) < max_xfer)
+        max_xfer = (uint32_t)(NVME_PAGE << mdts);
+
+    /* First active namespace */
+    if (identify(0, NVME_CNS_NS_LIST) < 0) return 0;
+    nsid = *(uint32_t *)identify_buf;
+    if (!nsid || identify(nsid, NVME_CNS_NAMESPACE) < 0) return 0;
+
+    /* The disk layer works in 512-byte sectors */
+    uint64_t nsze = *(uint64_t *)identify_buf;
+    uint8_t  flbas = identify_buf[26] & 0x0F;
+    uint32_t lbaf = *(uint32_t *)(identify_buf + 128 + 4 * flbas);
+    if (((lbaf >> 16) & 0xFF) != 9) return 0;
+
+    if (nvme_irq_line < 16)
+        irq_register_handler(32 + nvme_irq_line, nvme_irq);
+
+    dev->type          = DISK_TYPE_NVME;
+    dev->mmio_base     = base;
+    dev->io_base       = 0;
+    dev->port_index    = 0;
+    dev->total_sectors = nsze;
+    dev->queue_depth   = NVME_IO_CIDS;
+    dev->present       = 1;
+    return 1;
+}
@@ -0,0 +1,20 @@
+/*
+ * nextOS - nvme.h
+ * NVMe backend for the disk driver
+ */
+#ifndef NEXTOS_NVME_H
+#define NEXTOS_NVME_H
+
+#include "disk.h"
+
+/* Find an NVMe controller, bring up its admin and I/O queues and fill
+ * in dev for namespace 1.  Returns 1 if a usable disk was found.     */
+int  nvme_probe(disk_device_t *dev);
+
+/* Backends for disk_submit / disk_poll / disk_wait's timeout */
+int  nvme_submit(disk_device_t *dev, disk_request_t *req,
+                 const disk_seg_t *segs, uint32_t nsegs);
+int  nvme_poll(disk_device_t *dev);
+void nvme_reset(disk_device_t *dev);
+
+#endif /* NEXTOS_NVME_H */
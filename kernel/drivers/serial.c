@@ -0,0 +1,72 @@
+/*
+ * nextOS - serial.c
+ * 16550 UART on COM1, polled transmit only
+ */
+#include "serial.h"
+#include "../arch/x86_64/idt.h"
+
+#define COM1            0x3F8
+#define UART_DATA       0       /* DLAB=0: THR / RBR; DLAB=1: divisor low  */
+#define UART_IER        1       /* DLAB=0: interrupt enable; DLAB=1: high  */
+#define UART_FCR        2
+#define UART_LCR        3
+#define UART_MCR        4
+#define UART_LSR        5
+#define UART_SCR        7
+
+#define LCR_8N1         0x03
+#define LCR_DLAB        0x80
+#define LSR_THR_EMPTY   0x20
+#define BAUD_DIVISOR    1       /* 115200 / 115200 */
+#define TX_SPIN_MAX     100000  /* A wedged UART must not hang the kernel */
+
+static int serial_present = 0;
+
+int serial_init(void)
+{
+    /* The scratch register reads back what was written on a real UART */
+    outb(COM1 + UART_SCR, 0x5A);
+    if (inb(COM1 + UART_SCR) != 0x5A) return -1;
+
+    outb(COM1 + UART_IER, 0x00);                /* Polled: no interrupts */
+    outb(COM1 + UART_LCR, LCR_DLAB);
+    outb(COM1 + UART_DATA, BAUD_DIVISOR & 0xFF);
+    outb(COM1 + UART_IER, BAUD_DIVISOR >> 8);
+    outb(COM1 + UART_LCR, LCR_8N1);
+    outb(COM1 + UART_FCR, 0xC7);                /* FIFO on, cleared, 14-byte threshold */
+    outb(COM1 + UART_MCR, 0x03);                /* DTR + RTS */
+    serial_present = 1;
+    return 0;
+}
+
+int serial_is_available(void)
+{
+    return serial_present;
+}
+
+void serial_putc(char c)
+{
+    if (!serial_present) return;
+    for (int i = 0; i < TX_SPIN_MAX && !(inb(COM1 + UART_LSR) & LSR_THR_EMPTY); i++)
+        __asm__ volatile("pause");
+    outb(COM1 + UART_DATA, (uint8_t)c);
+}
+
+void serial_write(const char *s)
+{
+    while (*s) {
+        if (*s == '\n') serial_putc('\r');
+        serial_putc(*s++);
+    }
+}
+
+void serial_write_uint(uint64_t v)
+{
+    char buf[21];
+    int n = 0;
+    do {
+        buf[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n > 0) serial_putc(buf[--n]);
+}
@@ -0,0 +1,19 @@
+/*
+ * nextOS - serial.h
+ * COM1 output (115200 8N1), for machine-readable logs such as the
+ * benchmark results
+ */
+#ifndef NEXTOS_SERIAL_H
+#define NEXTOS_SERIAL_H
+
+#include <stdint.h>
+
+/* Returns 0, or -1 if no UART answers at COM1 (output is then dropped) */
+int  serial_init(void);
+int  serial_is_available(void);
+
+void serial_putc(char c);
+void serial_write(const char *s);           /* "\n" goes out as "\r\n" */
+void serial_write_uint(uint64_t v);
+
+#endif /* NEXTOS_SERIAL_H */
@@ -1,19 +1,58 @@
 /*
  * nextOS - timer.c
- * PIT driver — provides system tick at the configured frequency
+ * PIT driver — provides system tick at the configured frequency — and a
+ * TSC clock source calibrated against PIT channel 2
  */
 #include "timer.h"
 #include "../arch/x86_64/idt.h"
+#include "../arch/x86_64/cpu.h"
+
+#define PIT_HZ             1193182ULL
+#define CALIBRATE_COUNT    11932        /* ~10 ms of PIT channel 2 */
+#define CALIBRATE_SPIN_MAX 100000000ULL /* Give up if OUT2 never rises */
 
 static volatile uint64_t tick_count = 0;
 static uint32_t timer_freq = 0;
 
+static uint64_t tsc_hz   = 0;
+static uint64_t tsc_base = 0;
+static uint64_t ns_mult  = 0;   /* Nanoseconds per TSC cycle, 32.32 fixed point */
+
 static void timer_irq(uint64_t irq, uint64_t err)
 {
     (void)irq; (void)err;
     tick_count++;
 }
 
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Count TSC cycles across a one-shot PIT channel 2 countdown (mode 0,
+ * gate via port 0x61, speaker output kept off).                      */
+static uint64_t tsc_calibrate(void)
+{
+    uint8_t gate = inb(0x61);
+    outb(0x61, (gate & ~0x02) | 0x01);
+
+    outb(0x43, 0xB0);                          /* Channel 2, lo/hi, mode 0 */
+    outb(0x42, CALIBRATE_COUNT & 0xFF);
+    outb(0x42, (CALIBRATE_COUNT >> 8) & 0xFF);
+
+    uint64_t t0 = rdtsc();
+    uint64_t spins = 0;
+    while (!(inb(0x61) & 0x20)) {
+        if (++spins > CALIBRATE_SPIN_MAX) { outb(0x61, gate); return 0; }
+    }
+    uint64_t t1 = rdtsc();
+    outb(0x61, gate);
+
+    return (t1 - t0) * PIT_HZ / CALIBRATE_COUNT;
+}
+
 void timer_init(uint32_t freq_hz)
 {
     timer_freq = freq_hz;
@@ -24,6 +63,14 @@ void timer_init(uint32_t freq_hz)
     outb(0x40, (uint8_t)((divisor >> 8) & 0xFF));
 
     irq_register_handler(32, timer_irq);   /* IRQ0 -> vector 32 */
+
+    if (cpu_has(CPU_FEAT_TSC)) {
+        tsc_hz = tsc_calibrate();
+        if (tsc_hz) {
+            ns_mult  = (1000000000ULL << 32) / tsc_hz;
+            tsc_base = rdtsc();
+        }
+    }
 }
 
 uint64_t timer_get_ticks(void)
@@ -38,3 +85,28 @@ void timer_sleep_ms(uint32_t ms)
         __asm__ volatile("hlt");
     }
 }
+
+uint64_t timer_now_ns(void)
+{
+    if (tsc_hz)
+        return (uint64_t)(((unsigned __int128)(rdtsc() - tsc_base) * ns_mult) >> 32);
+    return timer_freq ? tick_count * 1000000000ULL / timer_freq : 0;
+}
+
+uint64_t timer_tsc_hz(void)
+{
+    return tsc_hz;
+}
+
+void timer_sleep_until(uint64_t deadline_ns)
+{
+    uint64_t tick_ns = timer_freq ? 1000000000ULL / timer_freq : NS_PER_MS;
+    for (;;) {
+        uint64_t now = timer_now_ns();
+        if (now >= deadline_ns) return;
+        if (deadline_ns - now > tick_ns || !tsc_hz)
+            __asm__ volatile("hlt");
+        else
+            __asm__ volatile("pause");
+    }
+}
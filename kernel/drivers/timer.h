@@ -1,14 +1,25 @@
 /*
  * nextOS - timer.h
- * PIT (Programmable Interval Timer) driver
+ * PIT (Programmable Interval Timer) driver and TSC clock source
  */
 #ifndef NEXTOS_TIMER_H
 #define NEXTOS_TIMER_H
 
 #include <stdint.h>
 
+#define NS_PER_MS 1000000ULL
+
 void     timer_init(uint32_t freq_hz);
 uint64_t timer_get_ticks(void);
 void     timer_sleep_ms(uint32_t ms);
 
+/* Monotonic nanoseconds since timer_init: the calibrated TSC when
+ * available, PIT ticks otherwise.                                 */
+uint64_t timer_now_ns(void);
+uint64_t timer_tsc_hz(void);           /* 0 when running on PIT ticks */
+
+/* Sleep until timer_now_ns() >= deadline_ns: halts through whole ticks
+ * and spins only the final partial one.                              */
+void     timer_sleep_until(uint64_t deadline_ns);
+
 #endif /* NEXTOS_TIMER_H */
@@ -0,0 +1,266 @@
+/*
+ * nextOS - dcache.c
+ * Directory entry cache for the disk filesystems
+ *
+ * A directory is read into the cache in one sequential pass the first
+ * time it is looked up or listed.  Its entries are then hashed by
+ * (directory, name) for lookups and kept in readdir order for listings,
+ * and a directory read in completely answers misses without touching the
+ * disk.  Names looked up in directories too large to cache in full are
+ * remembered as negative entries.  Whole directories are the unit of
+ * eviction (least recently used first), so a cached listing is never
+ * left with holes.
+ */
+#include "dcache.h"
+
+/* Identity of a directory node: which filesystem, and where */
+typedef struct {
+    int    (*readdir)(vfs_node_t *node, int index, vfs_node_t *child);
+    uint64_t inode;
+    uint64_t fs_data;
+} dkey_t;
+
+typedef struct {
+    vfs_node_t node;                /* node.name is the hashed name   */
+    uint32_t   hash;
+    int16_t    dir;                 /* Owning directory slot, -1 free */
+    int16_t    hash_next;           /* Bucket chain / free list       */
+    int16_t    sib_next;            /* Every entry of the same dir    */
+    uint8_t    negative;
+} dentry_t;
+
+typedef struct {
+    dkey_t   key;
+    int      used;
+    int      complete;              /* children[] is the whole directory */
+    int      count;
+    int16_t  children[DCACHE_DIR_MAX];  /* Positive entries, readdir order */
+    int16_t  first;                 /* Head of the sib_next list      */
+    uint64_t last_use;
+} ddir_t;
+
+static dentry_t       dentries[DCACHE_ENTRIES];
+static ddir_t         dirs[DCACHE_DIRS];
+static int16_t        buckets[DCACHE_BUCKETS];
+static int16_t        free_head;
+static uint64_t       use_clock;
+static dcache_stats_t stats;
+
+/* ── Helpers ──────────────────────────────────────────────────────────── */
+static int dc_strcmp(const char *a, const char *b)
+{
+    while (*a && *a == *b) { a++; b++; }
+    return *(unsigned char *)a - *(unsigned char *)b;
+}
+
+static inline dkey_t key_of(const vfs_node_t *dir)
+{
+    dkey_t k = { dir->readdir, dir->inode, dir->fs_data };
+    return k;
+}
+
+static inline int key_eq(const dkey_t *a, const dkey_t *b)
+{
+    return a->readdir == b->readdir && a->inode == b->inode && a->fs_data == b->fs_data;
+}
+
+static uint32_t name_hash(const dkey_t *k, const char *name)
+{
+    uint32_t h = 2166136261u;
+    uint64_t parts[3] = { (uint64_t)(uintptr_t)k->readdir, k->inode, k->fs_data };
+    const uint8_t *p = (const uint8_t *)parts;
+    for (unsigned i = 0; i < sizeof(parts); i++) { h ^= p[i]; h *= 16777619u; }
+    while (*name) { h ^= (uint8_t)*name++; h *= 16777619u; }
+    return h;
+}
+
+void dcache_reset(void)
+{
+    for (int i = 0; i < DCACHE_BUCKETS; i++) buckets[i] = -1;
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        dentries[i].dir = -1;
+        dentries[i].hash_next = (int16_t)(i + 1 < DCACHE_ENTRIES ? i + 1 : -1);
+    }
+    free_head = 0;
+    for (int i = 0; i < DCACHE_DIRS; i++) dirs[i].used = 0;
+    stats.entries = 0;
+    stats.dirs = 0;
+}
+
+/* ── Directory slots ─────────────────────────────────────────────────── */
+static void dir_evict(int slot)
+{
+    ddir_t *d = &dirs[slot];
+    for (int e = d->first; e >= 0; ) {
+        dentry_t *de = &dentries[e];
+        int16_t *link = &buckets[de->hash % DCACHE_BUCKETS];
+        while (*link != e) link = &dentries[*link].hash_next;
+        *link = de->hash_next;
+
+        int next = de->sib_next;
+        de->dir = -1;
+        de->hash_next = free_head;
+        free_head = (int16_t)e;
+        stats.entries--;
+        e = next;
+    }
+    d->used = 0;
+    stats.dirs--;
+}
+
+static int dir_find(const dkey_t *k)
+{
+    for (int i = 0; i < DCACHE_DIRS; i++)
+        if (dirs[i].used && key_eq(&dirs[i].key, k)) {
+            dirs[i].last_use = ++use_clock;
+            return i;
+        }
+    return -1;
+}
+
+/* Least recently used directory slot other than `keep` */
+static int dir_victim(int keep)
+{
+    int victim = -1;
+    for (int i = 0; i < DCACHE_DIRS; i++) {
+        if (i == keep) continue;
+        if (!dirs[i].used) return i;
+        if (victim < 0 || dirs[i].last_use < dirs[victim].last_use) victim = i;
+    }
+    return victim;
+}
+
+static int dentry_add(int slot, const vfs_node_t *node, const char *name, int negative)
+{
+    if (free_head < 0) {
+        int v = dir_victim(slot);
+        if (v < 0 || !dirs[v].used) return -1;
+        dir_evict(v);
+        stats.evictions++;
+        if (free_head < 0) return -1;
+    }
+
+    int e = free_head;
+    dentry_t *de = &dentries[e];
+    free_head = de->hash_next;
+
+    if (node) de->node = *node;
+    int i = 0;
+    for (; name[i] && i < VFS_MAX_NAME - 1; i++) de->node.name[i] = name[i];
+    de->node.name[i] = 0;
+    de->negative = (uint8_t)negative;
+    de->dir = (int16_t)slot;
+    de->hash = name_hash(&dirs[slot].key, de->node.name);
+    de->hash_next = buckets[de->hash % DCACHE_BUCKETS];
+    buckets[de->hash % DCACHE_BUCKETS] = (int16_t)e;
+    de->sib_next = dirs[slot].first;
+    dirs[slot].first = (int16_t)e;
+    stats.entries++;
+    return e;
+}
+
+static int dentry_find(int slot, const char *name)
+{
+    uint32_t h = name_hash(&dirs[slot].key, name);
+    for (int e = buckets[h % DCACHE_BUCKETS]; e >= 0; e = dentries[e].hash_next)
+        if (dentries[e].dir == slot && dentries[e].hash == h &&
+            dc_strcmp(dentries[e].node.name, name) == 0)
+            return e;
+    return -1;
+}
+
+/* Return the slot caching `dir`, reading the directory in if needed */
+static int dir_get(vfs_node_t *dir)
+{
+    dkey_t k = key_of(dir);
+    int slot = dir_find(&k);
+    if (slot >= 0) return slot;
+
+    slot = dir_victim(-1);
+    if (dirs[slot].used) {
+        dir_evict(slot);
+        stats.evictions++;
+    }
+    ddir_t *d = &dirs[slot];
+    d->key = k;
+    d->used = 1;
+    d->complete = 0;
+    d->count = 0;
+    d->first = -1;
+    d->last_use = ++use_clock;
+    stats.dirs++;
+    stats.dir_fills++;
+
+    /* One sequential pass; the filesystems resume each readdir where
+     * the previous one stopped.                                     */
+    for (;;) {
+        vfs_node_t child;
+        if (dir->readdir(dir, d->count, &child) != 0) {
+            d->complete = 1;
+            break;
+        }
+        if (d->count == DCACHE_DIR_MAX) break;
+        int e = dentry_add(slot, &child, child.name, 0);
+        if (e < 0) break;
+        d->children[d->count++] = (int16_t)e;
+    }
+    return slot;
+}
+
+/* ── Public interface ─────────────────────────────────────────────────── */
+int dcache_lookup(vfs_node_t *dir, const char *name, vfs_node_t *out)
+{
+    if (!dir || !dir->readdir || !name || !out) return -1;
+
+    int slot = dir_get(dir);
+    int e = dentry_find(slot, name);
+    if (e >= 0) {
+        if (dentries[e].negative) {
+            stats.negative_hits++;
+            return -1;
+        }
+        stats.hits++;
+        *out = dentries[e].node;
+        return 0;
+    }
+    if (dirs[slot].complete) {
+        stats.negative_hits++;
+        return -1;
+    }
+
+    /* Only part of the directory fits: scan the rest and remember the
+     * answer either way.                                             */
+    stats.misses++;
+    for (int i = dirs[slot].count; ; i++) {
+        vfs_node_t child;
+        if (dir->readdir(dir, i, &child) != 0) break;
+        if (dc_strcmp(child.name, name) == 0) {
+            dentry_add(slot, &child, child.name, 0);
+            *out = child;
+            return 0;
+        }
+    }
+    dentry_add(slot, (void *)0, name, 1);
+    return -1;
+}
+
+int dcache_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
+{
+    if (!dir || !dir->readdir || !child || index < 0) return -1;
+
+    int slot = dir_get(dir);
+    if (index < dirs[slot].count) {
+        stats.hits++;
+        *child = dentries[dirs[slot].children[index]].node;
+        return 0;
+    }
+    if (dirs[slot].complete) return -1;
+
+    stats.misses++;
+    return dir->readdir(dir, index, child);
+}
+
+void dcache_get_stats(dcache_stats_t *out)
+{
+    *out = stats;
+}
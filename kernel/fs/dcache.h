@@ -0,0 +1,37 @@
+/*
+ * nextOS - dcache.h
+ * Directory entry cache for the disk filesystems
+ */
+#ifndef NEXTOS_DCACHE_H
+#define NEXTOS_DCACHE_H
+
+#include "vfs.h"
+
+#define DCACHE_ENTRIES   512        /* Cached names, positive or negative */
+#define DCACHE_DIRS      16         /* Directories with cached contents   */
+#define DCACHE_DIR_MAX   128        /* Larger directories are partial     */
+#define DCACHE_BUCKETS   256
+
+typedef struct {
+    uint64_t hits;                  /* Lookups / readdirs served from cache */
+    uint64_t negative_hits;         /* Lookups answered "no such name"      */
+    uint64_t misses;                /* Fell through to the filesystem       */
+    uint64_t dir_fills;             /* Directories read in to the cache     */
+    uint64_t evictions;             /* Directories dropped for space        */
+    uint32_t entries;
+    uint32_t dirs;
+} dcache_stats_t;
+
+/* Drop every cached entry.  Called on mount only: the disk filesystems
+ * are read-only, and ramfs namespace changes never reach the dcache. */
+void dcache_reset(void);
+
+/* Find `name` in `dir`.  Returns 0 and fills *out, or -1 if absent.   */
+int  dcache_lookup(vfs_node_t *dir, const char *name, vfs_node_t *out);
+
+/* Same contract as vfs_readdir, served from the cached listing */
+int  dcache_readdir(vfs_node_t *dir, int index, vfs_node_t *child);
+
+void dcache_get_stats(dcache_stats_t *out);
+
+#endif /* NEXTOS_DCACHE_H */
@@ -0,0 +1,164 @@
+/*
+ * nextOS - diskimg.c
+ * Reader for the embedded install image (raw, or LZ4 in chunks)
+ *
+ * Chunks are decoded back to back into one run buffer until a zero
+ * chunk, the end of the image or DISKIMG_RUN_SECTORS, so the installer
+ * writes long runs and never touches the all-zero parts of the image.
+ * The LZ4 decoder checks every length and offset against its buffers;
+ * a corrupt image fails instead of writing garbage.
+ */
+#include "diskimg.h"
+#include "../mem/heap.h"
+
+#define SECTOR 512
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int all_zero(const uint8_t *p, uint32_t len)
+{
+    const uint64_t *w = (const uint64_t *)p;
+    for (uint32_t i = 0; i < len / 8; i++)
+        if (w[i]) return 0;
+    return 1;
+}
+
+/* ── LZ4 block decoder ───────────────────────────────────────────────── */
+/* Decode one block that must fill out[0, out_len) exactly */
+static int lz4_block(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_len)
+{
+    const uint8_t *ip = in, *iend = in + in_len;
+    uint32_t op = 0;
+
+    for (;;) {
+        if (ip >= iend) return -1;
+        uint32_t token = *ip++;
+
+        uint32_t lit = token >> 4;
+        if (lit == 15) {
+            uint32_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (uint32_t)(iend - ip) || lit > out_len - op) return -1;
+        for (uint32_t i = 0; i < lit; i++) out[op + i] = ip[i];
+        ip += lit;
+        op += lit;
+
+        /* The last sequence is literals only */
+        if (ip == iend) return op == out_len ? 0 : -1;
+
+        if (iend - ip < 2) return -1;
+        uint32_t off = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > op) return -1;
+
+        uint32_t len = (token & 15) + 4;
+        if ((token & 15) == 15) {
+            uint32_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if (len > out_len - op) return -1;
+
+        /* Byte by byte: the match may overlap what it produces */
+        const uint8_t *m = out + op - off;
+        for (uint32_t i = 0; i < len; i++) out[op + i] = m[i];
+        op += len;
+    }
+}
+
+/* ── Public interface ─────────────────────────────────────────────────── */
+int diskimg_open(diskimg_t *img, const uint8_t *data, uint64_t size)
+{
+    img->run = (void *)0;
+    img->pos = 0;
+
+    if (size < sizeof(diskimg_header_t) || rd32(data) != DISKIMG_MAGIC) {
+        /* Raw sectors: src stays at the start and runs point into it */
+        img->compressed = 0;
+        img->src = data;
+        img->end = data + size;
+        img->sectors = (uint32_t)(size / SECTOR);
+        img->chunk_sectors = DISKIMG_RAW_CHUNK;
+        return 0;
+    }
+
+    uint32_t sectors = rd32(data + 8), chunk = rd32(data + 12), chunks = rd32(data + 16);
+    if (rd32(data + 4) != DISKIMG_VERSION || chunk == 0 || chunk > DISKIMG_RUN_SECTORS ||
+        chunks != (sectors + chunk - 1) / chunk)
+        return -1;
+
+    img->run = kmalloc((uint64_t)DISKIMG_RUN_SECTORS * SECTOR);
+    if (!img->run) return -1;
+    img->compressed = 1;
+    img->src = data + sizeof(diskimg_header_t);
+    img->end = data + size;
+    img->sectors = sectors;
+    img->chunk_sectors = chunk;
+    return 0;
+}
+
+int diskimg_next(diskimg_t *img, uint64_t *lba, const uint8_t **data)
+{
+    uint32_t start = img->pos, count = 0;
+
+    while (img->pos < img->sectors) {
+        uint32_t n = img->sectors - img->pos;
+        if (n > img->chunk_sectors) n = img->chunk_sectors;
+        if (count + n > DISKIMG_RUN_SECTORS) break;
+
+        if (!img->compressed) {
+            if (all_zero(img->src + (uint64_t)img->pos * SECTOR, n * SECTOR)) {
+                if (count) break;
+                img->pos += n;
+                start = img->pos;
+                continue;
+            }
+        } else {
+            if (img->end - img->src < 4) return -1;
+            uint32_t word = rd32(img->src);
+            if (!word) {
+                if (count) break;      /* Left for the next call */
+                img->src += 4;
+                img->pos += n;
+                start = img->pos;
+                continue;
+            }
+
+            uint32_t len = word & ~DISKIMG_STORED;
+            img->src += 4;
+            if (len > (uint64_t)(img->end - img->src)) return -1;
+            uint8_t *out = img->run + (uint64_t)count * SECTOR;
+            if (word & DISKIMG_STORED) {
+                if (len != n * SECTOR) return -1;
+                for (uint32_t i = 0; i < len; i++) out[i] = img->src[i];
+            } else if (lz4_block(img->src, len, out, n * SECTOR) < 0) {
+                return -1;
+            }
+            img->src += len;
+        }
+        count += n;
+        img->pos += n;
+    }
+
+    *lba = start;
+    *data = img->compressed ? img->run : img->src + (uint64_t)start * SECTOR;
+    return (int)count;
+}
+
+void diskimg_close(diskimg_t *img)
+{
+    if (img->run) kfree(img->run);
+    img->run = (void *)0;
+}
@@ -0,0 +1,57 @@
+/*
+ * nextOS - diskimg.h
+ * Reader for the embedded install image (raw, or LZ4 in chunks)
+ *
+ * tools/lz4img turns the raw disk image into this layout (little-endian):
+ *
+ *   header   magic "NXL4", version, image sectors, chunk sectors, chunks
+ *   chunks   u32 word, then payload:
+ *              0                   all zeros, no payload
+ *              DISKIMG_STORED | n  n bytes stored as they are
+ *              n                   n bytes of LZ4 block data
+ *
+ * Each chunk decodes on its own to chunk_sectors * 512 bytes (the last
+ * one may be shorter), so the image streams through a fixed buffer.
+ * An image without the magic is taken as raw sectors.
+ */
+#ifndef NEXTOS_DISKIMG_H
+#define NEXTOS_DISKIMG_H
+
+#include <stdint.h>
+
+#define DISKIMG_MAGIC          0x344C584E   /* "NXL4" */
+#define DISKIMG_VERSION        1
+#define DISKIMG_STORED         0x80000000u
+#define DISKIMG_RAW_CHUNK      128          /* Zero-skip unit for raw images */
+#define DISKIMG_RUN_SECTORS    2048         /* Longest run handed out (1 MiB) */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sectors;           /* Uncompressed image size */
+    uint32_t chunk_sectors;
+    uint32_t chunks;
+    uint32_t reserved[3];
+} diskimg_header_t;
+
+typedef struct {
+    const uint8_t *src, *end;   /* Input not yet consumed */
+    int      compressed;
+    uint32_t sectors;           /* Whole image                        */
+    uint32_t chunk_sectors;
+    uint32_t pos;               /* Sectors consumed, written or skipped */
+    uint8_t *run;               /* Decode buffer (compressed images)  */
+} diskimg_t;
+
+/* Returns 0, or -1 if the header is bad or no buffer can be had */
+int  diskimg_open(diskimg_t *img, const uint8_t *data, uint64_t size);
+
+/* Next run of sectors that are not all zero: up to DISKIMG_RUN_SECTORS
+ * that belong at *lba, in *data until the next call.  All-zero chunks
+ * are skipped, not returned.  Returns the sector count, 0 at the end,
+ * or -1 if the image is corrupt.                                     */
+int  diskimg_next(diskimg_t *img, uint64_t *lba, const uint8_t **data);
+
+void diskimg_close(diskimg_t *img);
+
+#endif /* NEXTOS_DISKIMG_H */
@@ -1,9 +1,15 @@
 /*
  * nextOS - ext2.c
  * EXT2 read/write filesystem driver
+ *
+ * The block group descriptor table is read once at mount and inodes go
+ * through a small direct-mapped cache, so a lookup costs no disk reads
+ * once its inode has been seen.  ext2_readdir remembers where the last
+ * entry was found, which keeps a sequential walk linear.
  */
 #include "ext2.h"
 #include "../drivers/disk.h"
+#include "../drivers/bcache.h"
 #include "../mem/heap.h"
 
 /* ── EXT2 Superblock ─────────────────────────────────────────────────── */
@@ -85,6 +91,17 @@ typedef struct {
 #define EXT2_MAGIC       0xEF53
 #define EXT2_ROOT_INODE  2
 #define EXT2_FT_DIR      2
+#define EXT2_ICACHE_SIZE 64     /* Direct-mapped by inode number */
+
+/* i_block[] layout */
+#define EXT2_NDIR_BLOCKS 12
+#define EXT2_IND_BLOCK   12
+#define EXT2_DIND_BLOCK  13
+#define EXT2_TIND_BLOCK  14
+
+/* Readahead window for sequential readers */
+#define EXT2_RA_MIN      (16 * 1024)
+#define EXT2_RA_MAX      (128 * 1024)
 
 static ext2_superblock_t sb;
 static disk_device_t    *disk;
@@ -92,50 +109,83 @@ static uint32_t          block_size;
 static uint32_t          inode_size;
 static uint8_t          *block_buf;
 static uint32_t          part_start_lba;  /* Partition offset (sectors) */
+static ext2_bgd_t       *bgdt;            /* Whole descriptor table */
+static uint32_t          group_count;
+static uint8_t          *itable_buf;      /* One block of an inode table */
+
+typedef struct {
+    uint32_t     num;                     /* 0 = empty */
+    ext2_inode_t inode;
+} ext2_icache_entry_t;
+
+static ext2_icache_entry_t icache[EXT2_ICACHE_SIZE];
+
+/* Last indirect table read at each depth of the block map */
+static uint8_t          *ind_buf[3];
+static uint32_t          ind_blk[3];
+
+/* Sequential read detection: one stream, the most recent file */
+static struct {
+    uint32_t ino;
+    uint64_t next;                        /* Offset a sequential read starts at */
+    uint32_t window;                      /* Bytes to read ahead, 0 = none */
+} ra_state;
+
+/* Where the last ext2_readdir result was found (next entry follows it) */
+static struct {
+    uint32_t dir;                         /* 0 = invalid */
+    int      next_index;
+    int      blk;
+    uint32_t off;
+} rd_cursor;
 
 static int read_block(uint32_t block, void *buf)
 {
     uint32_t sectors = block_size / 512;
     uint64_t lba = part_start_lba + (uint64_t)block * sectors;
-    return disk_read(disk, lba, sectors, buf);
+    return bcache_read(disk, lba, sectors, buf);
 }
 
 static int write_block(uint32_t block, const void *buf)
 {
     uint32_t sectors = block_size / 512;
     uint64_t lba = part_start_lba + (uint64_t)block * sectors;
-    return disk_write(disk, lba, sectors, buf);
+    return bcache_write(disk, lba, sectors, buf);
 }
 
 static int read_inode(uint32_t inode_num, ext2_inode_t *out)
 {
+    if (inode_num == 0) return -1;
     uint32_t group = (inode_num - 1) / sb.s_inodes_per_group;
     uint32_t index = (inode_num - 1) % sb.s_inodes_per_group;
-
-    /* Read block group descriptor */
-    uint32_t bgd_block = (block_size == 1024) ? 2 : 1;
-    uint8_t bgd_buf[4096];
-    read_block(bgd_block, bgd_buf);
-
-    ext2_bgd_t *bgd = (ext2_bgd_t *)bgd_buf + group;
-    uint32_t inode_table_block = bgd->bg_inode_table;
-
-    /* Calculate block and offset within that block */
-    uint32_t offset = index * inode_size;
-    uint32_t block_num = inode_table_block + offset / block_size;
-    uint32_t block_off = offset % block_size;
-
-    uint8_t tmp[4096];
-    read_block(block_num, tmp);
-
-    uint8_t *src = tmp + block_off;
-    uint8_t *dst = (uint8_t *)out;
-    for (uint32_t i = 0; i < sizeof(ext2_inode_t) && i < inode_size; i++)
-        dst[i] = src[i];
-
+    if (group >= group_count) return -1;
+
+    ext2_icache_entry_t *ce = &icache[inode_num % EXT2_ICACHE_SIZE];
+    if (ce->num != inode_num) {
+        /* Calculate block and offset within that block */
+        uint32_t offset = index * inode_size;
+        uint32_t block_num = bgdt[group].bg_inode_table + offset / block_size;
+        uint32_t block_off = offset % block_size;
+        if (read_block(block_num, itable_buf) < 0) return -1;
+
+        uint8_t *src = itable_buf + block_off;
+        uint8_t *dst = (uint8_t *)&ce->inode;
+        for (uint32_t i = 0; i < sizeof(ext2_inode_t); i++)
+            dst[i] = i < inode_size ? src[i] : 0;
+        ce->num = inode_num;
+    }
+    *out = ce->inode;
     return 0;
 }
 
+void ext2_cache_invalidate(void)
+{
+    for (int i = 0; i < EXT2_ICACHE_SIZE; i++) icache[i].num = 0;
+    for (int i = 0; i < 3; i++) ind_blk[i] = 0;
+    rd_cursor.dir = 0;
+    ra_state.ino = 0;
+}
+
 /* MBR partition entry (16 bytes each, 4 entries at offset 446) */
 typedef struct {
     uint8_t  status;
@@ -152,7 +202,7 @@ typedef struct {
 static uint32_t find_ext2_partition(void)
 {
     uint8_t mbr[512];
-    if (disk_read(disk, 0, 1, mbr) < 0) return 0;
+    if (bcache_read(disk, 0, 1, mbr) < 0) return 0;
 
     /* Check MBR signature */
     if (mbr[510] != 0x55 || mbr[511] != 0xAA) return 0;
@@ -173,7 +223,7 @@ static int try_ext2_at(uint32_t start_lba)
     /* EXT2 superblock is at byte offset 1024 within the partition
      * For 1024-byte blocks, that's block 1 = sectors 2-3 from partition start */
     uint8_t sb_buf[1024];
-    if (disk_read(disk, start_lba + 2, 2, sb_buf) < 0) return -1;
+    if (bcache_read(disk, start_lba + 2, 2, sb_buf) < 0) return -1;
 
     uint8_t *src = sb_buf;
     uint8_t *dst = (uint8_t *)&sb;
@@ -190,8 +240,32 @@ static int try_ext2_at(uint32_t start_lba)
         inode_size = 128;
     }
 
-    block_buf = kmalloc(block_size);
-    return block_buf ? 0 : -1;
+    if (!sb.s_inodes_per_group) return -1;
+    group_count = (sb.s_inodes_count + sb.s_inodes_per_group - 1) / sb.s_inodes_per_group;
+
+    /* The descriptor table follows the superblock's block */
+    uint32_t bgd_block  = (block_size == 1024) ? 2 : 1;
+    uint32_t bgd_bytes  = group_count * sizeof(ext2_bgd_t);
+    uint32_t bgd_blocks = (bgd_bytes + block_size - 1) / block_size;
+
+    if (bgdt) kfree(bgdt);
+    if (block_buf) kfree(block_buf);
+    if (itable_buf) kfree(itable_buf);
+    bgdt       = kmalloc(bgd_blocks * block_size);
+    block_buf  = kmalloc(block_size);
+    itable_buf = kmalloc(block_size);
+    if (!bgdt || !block_buf || !itable_buf) return -1;
+    for (int i = 0; i < 3; i++) {
+        if (ind_buf[i]) kfree(ind_buf[i]);
+        ind_buf[i] = kmalloc(block_size);
+        if (!ind_buf[i]) return -1;
+    }
+
+    for (uint32_t i = 0; i < bgd_blocks; i++)
+        if (read_block(bgd_block + i, (uint8_t *)bgdt + i * block_size) < 0) return -1;
+
+    ext2_cache_invalidate();
+    return 0;
 }
 
 int ext2_init(void)
@@ -209,64 +283,135 @@ int ext2_init(void)
     return try_ext2_at(0);
 }
 
+/* ── Block mapping ─────────────────────────────────────────────────── */
+/* Entry `idx` of the indirect table in `table`.  The last table read
+ * at each depth is kept, so walking a file's blocks in order reads each
+ * indirect block once.                                                */
+static uint32_t table_entry(int depth, uint32_t table, uint64_t idx)
+{
+    if (!table) return 0;
+    if (ind_blk[depth] != table) {
+        if (read_block(table, ind_buf[depth]) < 0) {
+            ind_blk[depth] = 0;
+            return 0;
+        }
+        ind_blk[depth] = table;
+    }
+    return ((uint32_t *)ind_buf[depth])[idx];
+}
+
+/* Physical block holding logical block `lblk` of a file (0: hole) */
+static uint32_t bmap(const ext2_inode_t *in, uint64_t lblk)
+{
+    uint64_t per = block_size / 4;
+    if (lblk < EXT2_NDIR_BLOCKS) return in->i_block[lblk];
+
+    lblk -= EXT2_NDIR_BLOCKS;
+    if (lblk < per)
+        return table_entry(0, in->i_block[EXT2_IND_BLOCK], lblk);
+
+    lblk -= per;
+    if (lblk < per * per) {
+        uint32_t t = table_entry(0, in->i_block[EXT2_DIND_BLOCK], lblk / per);
+        return table_entry(1, t, lblk % per);
+    }
+
+    lblk -= per * per;
+    if (lblk < per * per * per) {
+        uint32_t t = table_entry(0, in->i_block[EXT2_TIND_BLOCK], lblk / (per * per));
+        t = table_entry(1, t, (lblk / per) % per);
+        return table_entry(2, t, lblk % per);
+    }
+    return 0;
+}
+
+/* Queue the blocks of [pos, pos + len) for the block cache, one request
+ * per physically contiguous run.                                       */
+static void readahead(const ext2_inode_t *in, uint64_t pos, uint64_t len)
+{
+    uint32_t spb = block_size / 512;
+    uint64_t lblk = pos / block_size;
+    uint64_t last = (pos + len - 1) / block_size;
+    while (lblk <= last) {
+        uint32_t pblk = bmap(in, lblk);
+        uint32_t n = 1;
+        if (pblk)
+            while (lblk + n <= last && bmap(in, lblk + n) == pblk + n) n++;
+        if (pblk)
+            bcache_readahead(disk, part_start_lba + (uint64_t)pblk * spb, n * spb);
+        lblk += n;
+    }
+}
+
 int ext2_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buf)
 {
     if (!node || !buf) return -1;
 
     ext2_inode_t inode;
-    read_inode((uint32_t)node->inode, &inode);
+    if (read_inode((uint32_t)node->inode, &inode) < 0) return -1;
 
     uint8_t *out = (uint8_t *)buf;
-    uint64_t bytes_read = 0;
     uint64_t file_size = inode.i_size;
 
     if (offset >= file_size) return 0;
     if (offset + size > file_size) size = file_size - offset;
 
-    /* Direct blocks (0-11) */
-    for (int i = 0; i < 12 && bytes_read < size; i++) {
-        if (inode.i_block[i] == 0) break;
-
-        uint64_t block_start = (uint64_t)i * block_size;
-        uint64_t block_end   = block_start + block_size;
-
-        if (block_end <= offset) continue;
-
-        read_block(inode.i_block[i], block_buf);
-
-        uint64_t start = (offset > block_start) ? offset - block_start : 0;
-        uint64_t end = block_size;
-        if (bytes_read + (end - start) > size)
-            end = start + (size - bytes_read);
+    uint32_t spb = block_size / 512;
+    uint64_t pos = offset, end = offset + size;
+    while (pos < end) {
+        uint64_t lblk = pos / block_size;
+        uint32_t boff = (uint32_t)(pos % block_size);
+        uint32_t pblk = bmap(&inode, lblk);
+        uint8_t *dst = out + (pos - offset);
+
+        /* Partial blocks at either end go through block_buf */
+        if (boff || end - pos < block_size) {
+            uint32_t n = block_size - boff;
+            if (n > end - pos) n = (uint32_t)(end - pos);
+            if (pblk && read_block(pblk, block_buf) < 0) break;
+            for (uint32_t j = 0; j < n; j++)
+                dst[j] = pblk ? block_buf[boff + j] : 0;
+            pos += n;
+            continue;
+        }
 
-        for (uint64_t j = start; j < end; j++)
-            out[bytes_read++] = block_buf[j];
+        /* Whole blocks: one transfer per physically contiguous run (or
+         * hole), straight into the caller's buffer.                   */
+        uint64_t whole = (end - pos) / block_size;
+        uint32_t max_run = DISK_REQ_MAX_SECTORS / spb;
+        uint32_t n = 1;
+        while (n < whole && n < max_run &&
+               bmap(&inode, lblk + n) == (pblk ? pblk + n : 0))
+            n++;
+
+        if (pblk) {
+            if (bcache_read(disk, part_start_lba + (uint64_t)pblk * spb,
+                            n * spb, dst) < 0)
+                break;
+        } else {
+            for (uint64_t j = 0; j < (uint64_t)n * block_size; j++) dst[j] = 0;
+        }
+        pos += (uint64_t)n * block_size;
     }
 
-    /* Indirect block (12) */
-    if (bytes_read < size && inode.i_block[12] != 0) {
-        uint32_t indirect[1024];
-        read_block(inode.i_block[12], indirect);
-        uint32_t ptrs = block_size / 4;
-
-        for (uint32_t i = 0; i < ptrs && bytes_read < size; i++) {
-            if (indirect[i] == 0) break;
-            uint64_t block_start = (uint64_t)(12 + i) * block_size;
-            if (block_start + block_size <= offset) continue;
-
-            read_block(indirect[i], block_buf);
-
-            uint64_t start = (offset > block_start) ? offset - block_start : 0;
-            uint64_t end = block_size;
-            if (bytes_read + (end - start) > size)
-                end = start + (size - bytes_read);
-
-            for (uint64_t j = start; j < end; j++)
-                out[bytes_read++] = block_buf[j];
-        }
+    /* Sequential readers get a window that doubles up to EXT2_RA_MAX */
+    uint32_t ino = (uint32_t)node->inode;
+    if (ino == ra_state.ino && offset == ra_state.next) {
+        ra_state.window *= 2;
+        if (ra_state.window < EXT2_RA_MIN) ra_state.window = EXT2_RA_MIN;
+        if (ra_state.window > EXT2_RA_MAX) ra_state.window = EXT2_RA_MAX;
+    } else {
+        ra_state.window = offset == 0 ? EXT2_RA_MIN : 0;
+    }
+    ra_state.ino  = ino;
+    ra_state.next = pos;
+    if (ra_state.window && pos < file_size) {
+        uint64_t len = ra_state.window;
+        if (len > file_size - pos) len = file_size - pos;
+        readahead(&inode, pos, len);
     }
 
-    return (int)bytes_read;
+    return (int)(pos - offset);
 }
 
 int ext2_write(vfs_node_t *node, uint64_t offset, uint64_t size, const void *buf)
@@ -274,31 +419,27 @@ int ext2_write(vfs_node_t *node, uint64_t offset, uint64_t size, const void *buf
     if (!node || !buf) return -1;
 
     ext2_inode_t inode;
-    read_inode((uint32_t)node->inode, &inode);
+    if (read_inode((uint32_t)node->inode, &inode) < 0) return -1;
 
     const uint8_t *in = (const uint8_t *)buf;
     uint64_t bytes_written = 0;
+    rd_cursor.dir = 0;      /* The blocks may hold directory entries */
 
-    /* Write to direct blocks */
-    for (int i = 0; i < 12 && bytes_written < size; i++) {
-        if (inode.i_block[i] == 0) break;
-
-        uint64_t block_start = (uint64_t)i * block_size;
-        uint64_t block_end   = block_start + block_size;
-
-        if (block_end <= offset) continue;
-
-        read_block(inode.i_block[i], block_buf);
+    /* Overwrite allocated blocks only; a hole ends the write */
+    while (bytes_written < size) {
+        uint64_t pos = offset + bytes_written;
+        uint32_t pblk = bmap(&inode, pos / block_size);
+        if (pblk == 0) break;
 
-        uint64_t start = (offset > block_start) ? offset - block_start : 0;
-        uint64_t end = block_size;
-        if (bytes_written + (end - start) > size)
-            end = start + (size - bytes_written);
+        uint32_t start = (uint32_t)(pos % block_size);
+        uint32_t n = block_size - start;
+        if (n > size - bytes_written) n = (uint32_t)(size - bytes_written);
 
-        for (uint64_t j = start; j < end; j++)
-            block_buf[j] = in[bytes_written++];
+        if (n < block_size && read_block(pblk, block_buf) < 0) break;
+        for (uint32_t j = 0; j < n; j++)
+            block_buf[start + j] = in[bytes_written++];
 
-        write_block(inode.i_block[i], block_buf);
+        write_block(pblk, block_buf);
     }
 
     return (int)bytes_written;
@@ -309,15 +450,23 @@ int ext2_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
     if (!dir || !child) return -1;
 
     ext2_inode_t inode;
-    read_inode((uint32_t)dir->inode, &inode);
-
-    int entry_idx = 0;
+    if (read_inode((uint32_t)dir->inode, &inode) < 0) return -1;
+
+    int entry_idx = 0, start_blk = 0;
+    uint32_t start_off = 0;
+    if (rd_cursor.dir == (uint32_t)dir->inode && rd_cursor.next_index == index) {
+        entry_idx = index;
+        start_blk = rd_cursor.blk;
+        start_off = rd_cursor.off;
+    }
 
-    for (int blk = 0; blk < 12; blk++) {
-        if (inode.i_block[blk] == 0) break;
-        read_block(inode.i_block[blk], block_buf);
+    int nblocks = (int)((inode.i_size + block_size - 1) / block_size);
+    for (int blk = start_blk; blk < nblocks; blk++) {
+        uint32_t pblk = bmap(&inode, (uint64_t)blk);
+        if (pblk == 0) break;
+        if (read_block(pblk, block_buf) < 0) break;
 
-        uint32_t off = 0;
+        uint32_t off = (blk == start_blk) ? start_off : 0;
         while (off < block_size) {
             ext2_dirent_t *de = (ext2_dirent_t *)(block_buf + off);
             if (de->inode == 0 || de->rec_len == 0) break;
@@ -341,6 +490,11 @@ int ext2_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
                 child->write   = ext2_write;
                 child->readdir = (de->file_type == EXT2_FT_DIR) ?
                     ext2_readdir : (void *)0;
+
+                rd_cursor.dir = (uint32_t)dir->inode;
+                rd_cursor.next_index = index + 1;
+                rd_cursor.blk = blk;
+                rd_cursor.off = off + de->rec_len;
                 return 0;
             }
 
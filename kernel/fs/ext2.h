@@ -12,4 +12,7 @@ int ext2_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buf);
 int ext2_write(vfs_node_t *node, uint64_t offset, uint64_t size, const void *buf);
 int ext2_readdir(vfs_node_t *dir, int index, vfs_node_t *child);
 
+/* Forget cached inodes and the readdir position */
+void ext2_cache_invalidate(void);
+
 #endif /* NEXTOS_EXT2_H */
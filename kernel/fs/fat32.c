@@ -1,9 +1,16 @@
 /*
  * nextOS - fat32.c
  * FAT32 read/write driver
+ *
+ * FAT sectors are cached in memory as they are first needed, so following
+ * a chain costs no disk reads after the first pass.  File data goes
+ * through an extent map per recently used file: the chain flattened into
+ * runs of physically contiguous clusters, binary-searched to seek and
+ * read or written one run per disk transfer.
  */
 #include "fat32.h"
 #include "../drivers/disk.h"
+#include "../drivers/bcache.h"
 #include "../mem/heap.h"
 
 /* ── FAT32 BPB (BIOS Parameter Block) ───────────────────────────────── */
@@ -68,6 +75,43 @@ static uint32_t fat_start_lba;
 static uint32_t data_start_lba;
 static uint32_t sectors_per_cluster;
 static uint8_t *cluster_buf;
+static uint32_t total_clusters;
+
+#define FAT32_EOC             0x0FFFFFF8
+#define FAT32_FAT_CACHE_SECS  2048        /* 1 MiB: the whole FAT of ~8 GiB volumes */
+#define FAT32_EXTMAPS         8
+
+/* Lazily filled FAT sectors; slot = sector % fat_slots */
+static uint8_t  *fat_cache;
+static uint32_t *fat_tags;                /* Sector + 1 held by each slot, 0 = empty */
+static uint32_t  fat_slots;
+
+/* Clusters [lcn, lcn + len) of a file are clusters [pcn, pcn + len) */
+typedef struct {
+    uint32_t lcn;
+    uint32_t pcn;
+    uint32_t len;
+} fat32_run_t;
+
+typedef struct {
+    uint32_t     first;                   /* First cluster, 0 = unused */
+    uint32_t     nclusters;
+    uint32_t     nruns;
+    fat32_run_t *runs;
+    uint64_t     last_use;
+} fat32_extmap_t;
+
+static fat32_extmap_t extmaps[FAT32_EXTMAPS];
+static uint64_t       extmap_clock;
+
+/* Where the last fat32_readdir result was found, so a sequential walk
+ * resumes there instead of rescanning the directory from the start.  */
+static struct {
+    uint32_t dir;                       /* 0 = invalid */
+    int      next_index;
+    uint32_t cluster;
+    int      slot;
+} rd_cursor;
 
 static uint32_t cluster_to_lba(uint32_t cluster)
 {
@@ -77,20 +121,114 @@ static uint32_t cluster_to_lba(uint32_t cluster)
 static uint32_t fat32_next_cluster(uint32_t cluster)
 {
     uint32_t fat_offset = cluster * 4;
-    uint32_t fat_sector = fat_start_lba + (fat_offset / bpb.bytes_per_sector);
+    uint32_t sec = fat_offset / bpb.bytes_per_sector;
     uint32_t ent_offset = fat_offset % bpb.bytes_per_sector;
+    if (sec >= bpb.fat_size_32) return 0x0FFFFFFF;
 
     uint8_t sector_buf[512];
-    disk_read(disk, fat_sector, 1, sector_buf);
+    uint8_t *data = sector_buf;
+    if (fat_cache) {
+        uint32_t slot = sec % fat_slots;
+        data = fat_cache + slot * 512;
+        if (fat_tags[slot] != sec + 1) {
+            if (bcache_read(disk, fat_start_lba + sec, 1, data) < 0) {
+                fat_tags[slot] = 0;
+                return 0x0FFFFFFF;
+            }
+            fat_tags[slot] = sec + 1;
+        }
+    } else if (bcache_read(disk, fat_start_lba + sec, 1, sector_buf) < 0) {
+        return 0x0FFFFFFF;
+    }
 
-    uint32_t val = *(uint32_t *)&sector_buf[ent_offset];
+    uint32_t val = *(uint32_t *)&data[ent_offset];
     return val & 0x0FFFFFFF;
 }
 
+/* ── Extent maps ──────────────────────────────────────────────────────── */
+static int add_run(fat32_extmap_t *m, uint32_t *cap, uint32_t lcn, uint32_t pcn)
+{
+    if (m->nruns == *cap) {
+        uint32_t ncap = *cap ? *cap * 2 : 16;
+        fat32_run_t *n = (fat32_run_t *)kmalloc(ncap * sizeof(fat32_run_t));
+        if (!n) return -1;
+        for (uint32_t i = 0; i < m->nruns; i++) n[i] = m->runs[i];
+        if (m->runs) kfree(m->runs);
+        m->runs = n;
+        *cap = ncap;
+    }
+    m->runs[m->nruns].lcn = lcn;
+    m->runs[m->nruns].pcn = pcn;
+    m->runs[m->nruns].len = 1;
+    m->nruns++;
+    return 0;
+}
+
+/* Extent map of the chain starting at `first`, covering at least `want`
+ * clusters when the chain is that long.                             */
+static fat32_extmap_t *extmap_get(uint32_t first, uint32_t want)
+{
+    if (first < 2 || first >= FAT32_EOC || !want) return (void *)0;
+
+    fat32_extmap_t *m = (void *)0;
+    for (int i = 0; i < FAT32_EXTMAPS; i++)
+        if (extmaps[i].first == first) { m = &extmaps[i]; break; }
+    if (m && m->nclusters >= want) {
+        m->last_use = ++extmap_clock;
+        return m;
+    }
+
+    if (!m) {
+        m = &extmaps[0];
+        for (int i = 1; i < FAT32_EXTMAPS; i++)
+            if (extmaps[i].last_use < m->last_use) m = &extmaps[i];
+    }
+    if (m->runs) kfree(m->runs);
+    m->runs = (void *)0;
+    m->nruns = 0;
+    m->first = first;
+    m->last_use = ++extmap_clock;
+
+    /* Walk the chain once; the length bound also stops FAT loops */
+    uint32_t cap = 0, lcn = 0;
+    for (uint32_t c = first; lcn < want && c >= 2 && c < FAT32_EOC; lcn++) {
+        fat32_run_t *last = m->nruns ? &m->runs[m->nruns - 1] : (void *)0;
+        if (last && last->pcn + last->len == c) {
+            last->len++;
+        } else if (add_run(m, &cap, lcn, c) < 0) {
+            break;
+        }
+        c = fat32_next_cluster(c);
+    }
+    m->nclusters = lcn;
+    return m;
+}
+
+/* Run holding logical cluster lcn, or NULL past the end of the chain */
+static const fat32_run_t *find_run(const fat32_extmap_t *m, uint32_t lcn)
+{
+    if (lcn >= m->nclusters) return (void *)0;
+    uint32_t lo = 0, hi = m->nruns;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (m->runs[mid].lcn <= lcn) lo = mid;
+        else                         hi = mid;
+    }
+    return &m->runs[lo];
+}
+
+/* Clusters a node can address: a file's size, a directory's whole chain */
+static uint32_t node_clusters(const vfs_node_t *node)
+{
+    uint32_t cluster_size = sectors_per_cluster * 512;
+    if (node->type == VFS_DIRECTORY) return total_clusters;
+    return (uint32_t)((node->size + cluster_size - 1) / cluster_size);
+}
+
 static int read_cluster(uint32_t cluster, void *buf)
 {
     uint32_t lba = cluster_to_lba(cluster);
-    return disk_read(disk, lba, sectors_per_cluster, buf);
+    return bcache_read(disk, lba, sectors_per_cluster, buf);
 }
 
 /* Convert 8.3 name to normal form */
@@ -122,7 +260,7 @@ int fat32_init(void)
 
     /* Read the boot sector */
     uint8_t sector[512];
-    if (disk_read(disk, 0, 1, sector) < 0) return -1;
+    if (bcache_read(disk, 0, 1, sector) < 0) return -1;
 
     /* Copy BPB */
     uint8_t *src = sector;
@@ -142,80 +280,115 @@ int fat32_init(void)
     fat_start_lba = bpb.reserved_sectors;
     data_start_lba = fat_start_lba + bpb.num_fats * bpb.fat_size_32;
 
+    total_clusters = (bpb.total_sectors_32 - data_start_lba) / sectors_per_cluster;
+    rd_cursor.dir = 0;
+
+    for (int i = 0; i < FAT32_EXTMAPS; i++) {
+        if (extmaps[i].runs) kfree(extmaps[i].runs);
+        extmaps[i].runs = (void *)0;
+        extmaps[i].first = 0;
+        extmaps[i].nruns = extmaps[i].nclusters = 0;
+        extmaps[i].last_use = 0;
+    }
+
+    /* Without room for the FAT cache, chains are followed through bcache */
+    if (fat_cache) kfree(fat_cache);
+    if (fat_tags) kfree(fat_tags);
+    fat_slots = bpb.fat_size_32 < FAT32_FAT_CACHE_SECS ? bpb.fat_size_32 : FAT32_FAT_CACHE_SECS;
+    fat_cache = (uint8_t *)kmalloc_tagged(fat_slots * 512);
+    fat_tags  = (uint32_t *)kmalloc_tagged(fat_slots * sizeof(uint32_t));
+    if (!fat_cache || !fat_tags) {
+        if (fat_cache) kfree(fat_cache);
+        if (fat_tags) kfree(fat_tags);
+        fat_cache = (void *)0;
+        fat_tags = (void *)0;
+    } else {
+        for (uint32_t i = 0; i < fat_slots; i++) fat_tags[i] = 0;
+    }
+
+    if (cluster_buf) kfree(cluster_buf);
     cluster_buf = kmalloc(sectors_per_cluster * 512);
     return cluster_buf ? 0 : -1;
 }
 
-int fat32_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buf)
+/* Move [offset, offset + size) of a file between buf and the disk.
+ * Whole clusters go one contiguous run per transfer, straight to or
+ * from buf; partial clusters at the ends pass through cluster_buf.  */
+static int fat32_rw(vfs_node_t *node, uint64_t offset, uint64_t size,
+                    uint8_t *buf, int write)
 {
-    if (!node || !buf) return -1;
-
-    uint32_t cluster = (uint32_t)node->fs_data;
     uint32_t cluster_size = sectors_per_cluster * 512;
-    uint8_t *out = (uint8_t *)buf;
-    uint64_t bytes_read = 0;
-    uint64_t pos = 0;
-
-    while (cluster < 0x0FFFFFF8 && bytes_read < size) {
-        read_cluster(cluster, cluster_buf);
-
-        if (pos + cluster_size > offset) {
-            uint64_t start = (offset > pos) ? offset - pos : 0;
-            uint64_t end = cluster_size;
-            if (bytes_read + (end - start) > size)
-                end = start + (size - bytes_read);
-
-            for (uint64_t i = start; i < end; i++)
-                out[bytes_read++] = cluster_buf[i];
+    fat32_extmap_t *m = extmap_get((uint32_t)node->fs_data, node_clusters(node));
+    if (!m) return 0;
+
+    uint64_t limit = (uint64_t)m->nclusters * cluster_size;
+    if (node->type == VFS_FILE && node->size < limit) limit = node->size;
+    if (offset >= limit) return 0;
+    if (offset + size > limit) size = limit - offset;
+
+    uint32_t max_run = DISK_REQ_MAX_SECTORS / sectors_per_cluster;
+    uint64_t pos = offset, end = offset + size;
+    while (pos < end) {
+        uint32_t lcn  = (uint32_t)(pos / cluster_size);
+        uint32_t coff = (uint32_t)(pos % cluster_size);
+        const fat32_run_t *r = find_run(m, lcn);
+        if (!r) break;
+        uint32_t pcn = r->pcn + (lcn - r->lcn);
+        uint8_t *p = buf + (pos - offset);
+
+        if (coff || end - pos < cluster_size) {
+            uint32_t n = cluster_size - coff;
+            if (n > end - pos) n = (uint32_t)(end - pos);
+            if (read_cluster(pcn, cluster_buf) < 0) break;
+            if (write) {
+                for (uint32_t i = 0; i < n; i++) cluster_buf[coff + i] = p[i];
+                if (bcache_write(disk, cluster_to_lba(pcn), sectors_per_cluster,
+                                 cluster_buf) < 0)
+                    break;
+            } else {
+                for (uint32_t i = 0; i < n; i++) p[i] = cluster_buf[coff + i];
+            }
+            pos += n;
+            continue;
         }
 
-        pos += cluster_size;
-        cluster = fat32_next_cluster(cluster);
+        uint32_t n = r->lcn + r->len - lcn;
+        if (n > (end - pos) / cluster_size) n = (uint32_t)((end - pos) / cluster_size);
+        if (n > max_run) n = max_run;
+        int rc = write ? bcache_write(disk, cluster_to_lba(pcn), n * sectors_per_cluster, p)
+                       : bcache_read(disk, cluster_to_lba(pcn), n * sectors_per_cluster, p);
+        if (rc < 0) break;
+        pos += (uint64_t)n * cluster_size;
     }
+    return (int)(pos - offset);
+}
 
-    return (int)bytes_read;
+int fat32_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buf)
+{
+    if (!node || !buf) return -1;
+    return fat32_rw(node, offset, size, (uint8_t *)buf, 0);
 }
 
 int fat32_write(vfs_node_t *node, uint64_t offset, uint64_t size, const void *buf)
 {
     if (!node || !buf) return -1;
-
-    uint32_t cluster = (uint32_t)node->fs_data;
-    uint32_t cluster_size = sectors_per_cluster * 512;
-    const uint8_t *in = (const uint8_t *)buf;
-    uint64_t bytes_written = 0;
-    uint64_t pos = 0;
-
-    while (cluster < 0x0FFFFFF8 && bytes_written < size) {
-        read_cluster(cluster, cluster_buf);
-
-        if (pos + cluster_size > offset) {
-            uint64_t start = (offset > pos) ? offset - pos : 0;
-            uint64_t end = cluster_size;
-            if (bytes_written + (end - start) > size)
-                end = start + (size - bytes_written);
-
-            for (uint64_t i = start; i < end; i++)
-                cluster_buf[i] = in[bytes_written++];
-
-            uint32_t lba = cluster_to_lba(cluster);
-            disk_write(disk, lba, sectors_per_cluster, cluster_buf);
-        }
-
-        pos += cluster_size;
-        cluster = fat32_next_cluster(cluster);
-    }
-
-    return (int)bytes_written;
+    rd_cursor.dir = 0;      /* The clusters may hold directory entries */
+    return fat32_rw(node, offset, size, (uint8_t *)buf, 1);
 }
 
 int fat32_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
 {
     if (!dir || !child) return -1;
 
-    uint32_t cluster = (dir->fs_data != 0) ?
+    uint32_t dir_cluster = (dir->fs_data != 0) ?
         (uint32_t)dir->fs_data : bpb.root_cluster;
-    int entry_idx = 0;
+    uint32_t cluster = dir_cluster;
+    int entry_idx = 0, start = 0;
+    if (rd_cursor.dir == dir_cluster && rd_cursor.next_index == index) {
+        cluster = rd_cursor.cluster;
+        start = rd_cursor.slot;
+        entry_idx = index;
+    }
 
     while (cluster < 0x0FFFFFF8) {
         read_cluster(cluster, cluster_buf);
@@ -224,7 +397,7 @@ int fat32_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
         int entries_per_cluster = cluster_size / sizeof(fat32_dirent_t);
 
         fat32_dirent_t *entries = (fat32_dirent_t *)cluster_buf;
-        for (int i = 0; i < entries_per_cluster; i++) {
+        for (int i = start; i < entries_per_cluster; i++) {
             if (entries[i].name[0] == 0x00) return -1;  /* No more entries */
             if ((uint8_t)entries[i].name[0] == 0xE5) continue;  /* Deleted */
             if (entries[i].attr == FAT32_ATTR_LFN) continue;
@@ -242,11 +415,17 @@ int fat32_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
                 child->write   = fat32_write;
                 child->readdir = (entries[i].attr & FAT32_ATTR_DIRECTORY) ?
                     fat32_readdir : (void *)0;
+
+                rd_cursor.dir = dir_cluster;
+                rd_cursor.next_index = index + 1;
+                rd_cursor.cluster = cluster;
+                rd_cursor.slot = i + 1;
                 return 0;
             }
             entry_idx++;
         }
 
+        start = 0;
         cluster = fat32_next_cluster(cluster);
     }
 
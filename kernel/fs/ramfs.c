@@ -4,32 +4,66 @@
  *
  * Provides a writable filesystem layer that overlays on top of the real
  * disk-based ext2 filesystem. User directories and their contents live
- * in kernel heap memory. Paths starting with /Desktop/, /Documents/,
+ * in kernel memory. Paths starting with /Desktop/, /Documents/,
  * /Images/ are handled by ramfs; all other paths fall through to ext2.
  *
- * Persistence: ramfs entries are serialized to raw disk sectors starting
- * at RAMFS_PERSIST_LBA so data survives reboots.
+ * Namespace: entries are hashed by (parent entry, name), so each path
+ * component is found in O(1), and every directory links its children in
+ * creation order for listing.  File data lives in extents of physically
+ * contiguous pages from the PMM, doubling in size up to 128 KiB as a
+ * file grows, so growing never copies what is already written.  All
+ * files together may hold RAMFS_QUOTA_PAGES pages, which keeps a
+ * checkpoint within one log half.
+ *
+ * Persistence: changes are appended as records to a log on raw disk
+ * sectors starting at RAMFS_PERSIST_LBA.  Mutations only mark entries
+ * dirty; a flusher thread waits RAMFS_FLUSH_DELAY_MS so bursts coalesce,
+ * then writes one record per changed entry (metadata, the changed data
+ * range, or a delete) in as few multi-sector writes as possible.  The
+ * log lives in one of two halves; when it fills or is mostly garbage a
+ * checkpoint of the live entries is written to the other half and the
+ * superblock flipped to it.  Loading replays the active half.
  */
 #include "ramfs.h"
 #include "../mem/heap.h"
+#include "../mem/pmm.h"
 #include "../drivers/disk.h"
-
-#define RAMFS_MAX_FILES   128
-#define RAMFS_MAX_DATA    8192
-#define RAMFS_NAME_MAX    VFS_MAX_NAME
+#include "../drivers/bcache.h"
+#include "../drivers/serial.h"
+#include "../sched/kthread.h"
+
+#define RAMFS_MAX_FILES      1024
+#define RAMFS_HASH_BUCKETS   1024
+#define RAMFS_NAME_MAX       VFS_MAX_NAME
+#define RAMFS_MAX_FILE_SIZE  (4u * 1024 * 1024)
+#define RAMFS_EXT_MAX_ORDER  5         /* Largest extent: 32 pages */
+#define RAMFS_ROOT           (-1)      /* Parent of the built-in directories */
+#define RAMFS_NONE           (-2)
 
 /* Disk persistence: ramfs data is stored at sectors starting at this LBA */
 #define RAMFS_PERSIST_LBA    8192  /* 4MB offset, well past ext2 partition */
-#define RAMFS_PERSIST_MAGIC  0x524D4653  /* "RMFS" */
-
-/* On-disk header: magic + count, padded to 512 bytes */
+#define RAMFS_PERSIST_MAGIC  0x524D4653  /* "RMFS": pre-log snapshot format */
+#define RAMFS_LOG_MAGIC      0x474C4D52  /* "RMLG" */
+#define RAMFS_LOG_VERSION    1
+#define RAMFS_REC_MAGIC      0x43455252  /* "RREC" */
+
+/* Superblock sector, then two halves; a checkpoint of everything must
+ * fit in a half, which RAMFS_QUOTA_PAGES guarantees.                */
+#define RAMFS_HALF_SECTORS   16384
+#define RAMFS_HALF_BYTES     (RAMFS_HALF_SECTORS * 512)
+#define RAMFS_STAGE_SECTORS  128   /* Largest single log write (64 KiB) */
+#define RAMFS_REC_DATA_MAX   32768 /* Data bytes per REC_DATA record */
+#define RAMFS_FLUSH_DELAY_MS 250
+#define RAMFS_COMPACT_MIN    (256 * 1024)  /* Log bytes before garbage counts */
+
+/* Pre-log on-disk header: magic + count, padded to 512 bytes */
 typedef struct {
     uint32_t magic;
     uint32_t count;
     uint8_t  reserved[504];
 } __attribute__((packed)) ramfs_disk_header_t;
 
-/* On-disk entry metadata, padded to 512 bytes */
+/* Pre-log on-disk entry metadata, padded to 512 bytes */
 typedef struct {
     char              name[128];
     char              parent[256];
@@ -38,21 +72,108 @@ typedef struct {
     uint8_t           reserved[120];
 } __attribute__((packed)) ramfs_disk_entry_t;
 
-static void ramfs_sync_to_disk(void);
+typedef struct {
+    uint32_t magic;             /* RAMFS_LOG_MAGIC */
+    uint32_t version;
+    uint32_t gen;               /* Generation of the active half */
+    uint32_t active;            /* 0 or 1 */
+    uint8_t  reserved[496];
+} __attribute__((packed)) ramfs_log_super_t;
+
+/* Log records are 4-byte aligned and never straddle the end of a half */
+enum { REC_META = 1, REC_DATA = 2, REC_DELETE = 3 };
+
+typedef struct {
+    uint32_t magic;             /* RAMFS_REC_MAGIC */
+    uint32_t gen;               /* Must match the superblock */
+    uint32_t seq;               /* 0, 1, 2, ... within the half */
+    uint16_t type;
+    uint16_t len;               /* Payload bytes after this header */
+    uint32_t csum;              /* FNV-1a of header (csum = 0) + payload */
+} __attribute__((packed)) ramfs_rec_t;
+
+/* REC_META payload is followed by name_len + parent_len bytes */
+typedef struct {
+    uint32_t ino;
+    uint32_t type;
+    uint16_t name_len;
+    uint16_t parent_len;
+} __attribute__((packed)) ramfs_rec_meta_t;
+
+/* REC_DATA payload is followed by len bytes; REC_DELETE is just ino */
+typedef struct {
+    uint32_t ino;
+    uint32_t offset;
+    uint32_t len;
+    uint32_t size;              /* File size after this write */
+} __attribute__((packed)) ramfs_rec_data_t;
+
+/* Filesystem-wide cap on file pages.  A checkpoint costs at most one
+ * REC_META per entry plus, per held page, its bytes and one REC_DATA
+ * header (data records never span extents, which are whole pages), so
+ * with this many pages it always fits in a half.                     */
+#define RAMFS_META_REC_MAX   (((uint32_t)(sizeof(ramfs_rec_t) + sizeof(ramfs_rec_meta_t) + \
+                                          RAMFS_NAME_MAX + VFS_MAX_PATH) + 3) & ~3u)
+#define RAMFS_DATA_REC_HDR   ((uint32_t)(sizeof(ramfs_rec_t) + sizeof(ramfs_rec_data_t)) + 3)
+#define RAMFS_QUOTA_PAGES    ((RAMFS_HALF_BYTES - 512 - RAMFS_MAX_FILES * RAMFS_META_REC_MAX) / \
+                              (PAGE_SIZE + RAMFS_DATA_REC_HDR))
+
 static void ramfs_load_from_disk(void);
+static void ramfs_mark_dirty(void);
+static void flush_thread(void *arg);
+
+/* 2^order pages from the PMM holding the file from page first_page on */
+typedef struct {
+    uint8_t          *base;
+    uint32_t          first_page;
+    uint32_t          order;
+} ramfs_extent_t;
 
 typedef struct {
     char              name[RAMFS_NAME_MAX];
-    char              parent[VFS_MAX_PATH];  /* Parent directory path */
+    int               parent;       /* Entry index, or RAMFS_ROOT */
+    int               hash_next;    /* Bucket chain; free list when unused */
+    int               first_child, last_child;
+    int               prev_sibling, next_sibling;
     vfs_node_type_t   type;
-    uint8_t          *data;
+    ramfs_extent_t   *ext;          /* Ordered by first_page */
+    uint32_t          next, ext_cap;
+    uint32_t          pages;        /* Pages held by ext[] */
     uint64_t          size;
-    uint64_t          capacity;
     int               used;
+    uint32_t          ino;          /* Stable id in the log (0: built-in) */
+    uint8_t           logged;       /* Has records in the active half */
+    uint8_t           meta_dirty;
+    uint32_t          dirty_lo, dirty_hi;   /* Unlogged data range */
 } ramfs_entry_t;
 
 static ramfs_entry_t entries[RAMFS_MAX_FILES];
 static int           entry_count = 0;
+static int           buckets[RAMFS_HASH_BUCKETS];
+static int           free_head;
+static int           root_first, root_last;     /* Children of RAMFS_ROOT */
+
+/* Position of the last readdir, so listing a directory is one pass */
+static struct {
+    int dir;
+    int index;
+    int entry;
+} rd_cursor = { RAMFS_NONE, 0, -1 };
+
+/* Log state */
+static uint32_t        next_ino = 1;
+static uint32_t        pending_del[RAMFS_MAX_FILES];
+static int             pending_del_count;
+static int             log_dirty;
+static int             force_checkpoint = 1;   /* No valid superblock yet */
+static uint32_t        log_gen, log_active, log_seq;
+static uint32_t        log_tail;               /* Bytes used in active half */
+static uint8_t         tail_sector[512];       /* Partial last log sector */
+static kthread_event_t flush_ev;
+static int             flusher_started;
+static int             flush_failed;           /* Reported once per streak */
+static uint32_t        held_pages;             /* Against RAMFS_QUOTA_PAGES */
+static int             replaying;              /* Old logs may exceed the quota */
 
 /* Built-in directories */
 static const char *builtin_dirs[] = {
@@ -98,44 +219,307 @@ int ramfs_is_ramfs_path(const char *path)
            ramfs_starts_with(path + 1, "Images");
 }
 
+/* ── Namespace ────────────────────────────────────────────────────────── */
+static uint32_t name_hash(int parent, const char *name)
+{
+    uint32_t h = (2166136261u ^ (uint32_t)parent) * 16777619u;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return h % RAMFS_HASH_BUCKETS;
+}
+
+static int find_child(int parent, const char *name)
+{
+    for (int i = buckets[name_hash(parent, name)]; i >= 0; i = entries[i].hash_next)
+        if (entries[i].parent == parent && ramfs_strcmp(entries[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+static inline int *child_head(int dir)
+{
+    return dir == RAMFS_ROOT ? &root_first : &entries[dir].first_child;
+}
+
+static inline int *child_tail(int dir)
+{
+    return dir == RAMFS_ROOT ? &root_last : &entries[dir].last_child;
+}
+
+/* Add an entry (name and parent set) to the hash and its parent's list */
+static void link_entry(int idx)
+{
+    ramfs_entry_t *e = &entries[idx];
+    uint32_t b = name_hash(e->parent, e->name);
+    e->hash_next = buckets[b];
+    buckets[b] = idx;
+
+    int *tail = child_tail(e->parent);
+    e->prev_sibling = *tail;
+    e->next_sibling = -1;
+    if (*tail >= 0) entries[*tail].next_sibling = idx;
+    else            *child_head(e->parent) = idx;
+    *tail = idx;
+    rd_cursor.dir = RAMFS_NONE;
+}
+
+static void unlink_entry(int idx)
+{
+    ramfs_entry_t *e = &entries[idx];
+    int *link = &buckets[name_hash(e->parent, e->name)];
+    while (*link != idx) link = &entries[*link].hash_next;
+    *link = e->hash_next;
+
+    if (e->prev_sibling >= 0) entries[e->prev_sibling].next_sibling = e->next_sibling;
+    else                      *child_head(e->parent) = e->next_sibling;
+    if (e->next_sibling >= 0) entries[e->next_sibling].prev_sibling = e->prev_sibling;
+    else                      *child_tail(e->parent) = e->prev_sibling;
+    rd_cursor.dir = RAMFS_NONE;
+}
+
+/* Take a free entry and reset everything but name, parent and type */
+static int alloc_entry(void)
+{
+    if (free_head < 0) return -1;
+    int idx = free_head;
+    ramfs_entry_t *e = &entries[idx];
+    free_head = e->hash_next;
+
+    e->first_child = e->last_child = -1;
+    e->ext = (void *)0;
+    e->next = e->ext_cap = 0;
+    e->pages = 0;
+    e->size = 0;
+    e->used = 1;
+    e->ino = 0;
+    e->logged = 0;
+    e->meta_dirty = 0;
+    e->dirty_lo = e->dirty_hi = 0;
+    entry_count++;
+    return idx;
+}
+
+static void free_data(ramfs_entry_t *e)
+{
+    for (uint32_t i = 0; i < e->next; i++)
+        pmm_free_pages(e->ext[i].base, e->ext[i].order);
+    if (e->ext) kfree(e->ext);
+    e->ext = (void *)0;
+    e->next = e->ext_cap = 0;
+    held_pages -= e->pages;
+    e->pages = 0;
+    e->size = 0;
+}
+
+/* Drop an entry and everything below it; `log` queues delete records */
+static void remove_entry(int idx, int log)
+{
+    ramfs_entry_t *e = &entries[idx];
+    while (e->first_child >= 0) remove_entry(e->first_child, log);
+
+    if (log && e->logged) {
+        if (pending_del_count < RAMFS_MAX_FILES)
+            pending_del[pending_del_count++] = e->ino;
+        else
+            force_checkpoint = 1;
+    }
+    unlink_entry(idx);
+    free_data(e);
+    e->used = 0;
+    e->hash_next = free_head;
+    free_head = idx;
+    entry_count--;
+}
+
+/* Entry a path names: RAMFS_ROOT for "/", RAMFS_NONE if there is none */
+static int resolve_path(const char *path)
+{
+    char comp[RAMFS_NAME_MAX];
+    int cur = RAMFS_ROOT;
+    for (;;) {
+        while (*path == '/') path++;
+        if (!*path) return cur;
+
+        int n = 0;
+        while (*path && *path != '/') {
+            if (n == RAMFS_NAME_MAX - 1) return RAMFS_NONE;
+            comp[n++] = *path++;
+        }
+        comp[n] = 0;
+        if (cur != RAMFS_ROOT && entries[cur].type != VFS_DIRECTORY) return RAMFS_NONE;
+        cur = find_child(cur, comp);
+        if (cur < 0) return RAMFS_NONE;
+    }
+}
+
+/* "/a/b/" for directory entry b under a, "/" for RAMFS_ROOT.  Returns
+ * the length, or -1 if it does not fit in VFS_MAX_PATH.             */
+static int dir_path(int dir, char *out)
+{
+    int chain[VFS_MAX_PATH / 2];
+    int depth = 0;
+    for (int i = dir; i != RAMFS_ROOT; i = entries[i].parent) {
+        if (depth == VFS_MAX_PATH / 2) return -1;
+        chain[depth++] = i;
+    }
+
+    int n = 0;
+    out[n++] = '/';
+    while (depth--) {
+        for (const char *s = entries[chain[depth]].name; *s; s++) {
+            if (n >= VFS_MAX_PATH - 2) return -1;
+            out[n++] = *s;
+        }
+        out[n++] = '/';
+    }
+    out[n] = 0;
+    return n;
+}
+
+/* Entries in pre-order, parents before children: start from RAMFS_ROOT,
+ * stop at a negative index.                                          */
+static int tree_next(int i)
+{
+    int c = *child_head(i);
+    if (c >= 0) return c;
+    while (i != RAMFS_ROOT) {
+        if (entries[i].next_sibling >= 0) return entries[i].next_sibling;
+        i = entries[i].parent;
+    }
+    return RAMFS_NONE;
+}
+
 /* Initialize ramfs with default directories */
 void ramfs_init(void)
 {
+    /* Re-initialisation (after install) reloads from disk: log first */
+    if (flusher_started) ramfs_sync();
+
     for (int i = 0; i < RAMFS_MAX_FILES; i++) {
+        if (entries[i].used) free_data(&entries[i]);
         entries[i].used = 0;
-        entries[i].data = (void *)0;
-        entries[i].size = 0;
-        entries[i].capacity = 0;
+        entries[i].hash_next = i + 1 < RAMFS_MAX_FILES ? i + 1 : -1;
     }
+    for (int i = 0; i < RAMFS_HASH_BUCKETS; i++) buckets[i] = -1;
+    free_head = 0;
+    root_first = root_last = -1;
+    rd_cursor.dir = RAMFS_NONE;
     entry_count = 0;
+    next_ino = 1;
+    pending_del_count = 0;
+    log_dirty = 0;
+    force_checkpoint = 1;
+    log_gen = log_active = log_seq = log_tail = 0;
 
     /* Create built-in directories */
     for (int i = 0; i < BUILTIN_DIR_COUNT; i++) {
-        ramfs_strcpy(entries[entry_count].name, builtin_dirs[i]);
-        ramfs_strcpy(entries[entry_count].parent, "/");
-        entries[entry_count].type = VFS_DIRECTORY;
-        entries[entry_count].data = (void *)0;
-        entries[entry_count].size = 0;
-        entries[entry_count].capacity = 0;
-        entries[entry_count].used = 1;
-        entry_count++;
+        int idx = alloc_entry();
+        ramfs_strcpy(entries[idx].name, builtin_dirs[i]);
+        entries[idx].parent = RAMFS_ROOT;
+        entries[idx].type = VFS_DIRECTORY;
+        link_entry(idx);
     }
 
-    /* Try to load persisted entries from disk */
+    /* Try to load persisted entries from disk.  What was logged is kept
+     * even past the quota; growth is refused until files are removed. */
+    replaying = 1;
     ramfs_load_from_disk();
+    replaying = 0;
+
+    if (!flusher_started &&
+        kthread_create("ramfs-flush", flush_thread, (void *)0) >= 0)
+        flusher_started = 1;
+
+    /* A converted snapshot is only in memory until the first checkpoint */
+    if (log_dirty) ramfs_mark_dirty();
 }
 
-/* Find entry by parent path and name */
-static int find_entry(const char *parent, const char *name)
+/* ── File data ────────────────────────────────────────────────────────── */
+static ramfs_extent_t *find_extent(ramfs_entry_t *e, uint32_t page)
 {
-    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
-        if (entries[i].used &&
-            ramfs_strcmp(entries[i].parent, parent) == 0 &&
-            ramfs_strcmp(entries[i].name, name) == 0) {
-            return i;
+    uint32_t lo = 0, hi = e->next;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (e->ext[mid].first_page <= page) lo = mid;
+        else                                hi = mid;
+    }
+    return &e->ext[lo];
+}
+
+/* Add zeroed extents until an entry holds at least `needed` bytes */
+static int ensure_capacity(ramfs_entry_t *e, uint64_t needed)
+{
+    if (needed > RAMFS_MAX_FILE_SIZE) return -1;
+
+    while ((uint64_t)e->pages * PAGE_SIZE < needed) {
+        if (e->next == e->ext_cap) {
+            uint32_t cap = e->ext_cap ? e->ext_cap * 2 : 8;
+            ramfs_extent_t *n = (ramfs_extent_t *)kmalloc(cap * sizeof(ramfs_extent_t));
+            if (!n) return -1;
+            for (uint32_t i = 0; i < e->next; i++) n[i] = e->ext[i];
+            if (e->ext) kfree(e->ext);
+            e->ext = n;
+            e->ext_cap = cap;
         }
+
+        /* Each extent doubles the file, so extents start at multiples of
+         * their own size; fall back to smaller ones when memory is short */
+        uint32_t order = 0;
+        while (order < RAMFS_EXT_MAX_ORDER && (2u << order) <= e->pages) order++;
+        if (!replaying) {
+            while (order && held_pages + (1u << order) > RAMFS_QUOTA_PAGES) order--;
+            if (held_pages + (1u << order) > RAMFS_QUOTA_PAGES) return -1;
+        }
+        void *base = pmm_alloc_pages(order);
+        while (!base && order) base = pmm_alloc_pages(--order);
+        if (!base) return -1;
+
+        uint64_t *z = (uint64_t *)base;
+        for (uint32_t i = 0; i < ((uint32_t)PAGE_SIZE << order) / 8; i++) z[i] = 0;
+
+        e->ext[e->next].base = (uint8_t *)base;
+        e->ext[e->next].first_page = e->pages;
+        e->ext[e->next].order = order;
+        e->next++;
+        e->pages += 1u << order;
+        held_pages += 1u << order;
+    }
+    return 0;
+}
+
+/* Longest run of file bytes from pos (< hi) that is contiguous in memory
+ * and fits in one log record; *p points at it.                       */
+static uint32_t data_chunk(ramfs_entry_t *e, uint32_t pos, uint32_t hi,
+                           const uint8_t **p)
+{
+    ramfs_extent_t *x = find_extent(e, pos / PAGE_SIZE);
+    uint32_t xoff = pos - x->first_page * PAGE_SIZE;
+    uint32_t n = (PAGE_SIZE << x->order) - xoff;
+    if (n > hi - pos) n = hi - pos;
+    if (n > RAMFS_REC_DATA_MAX) n = RAMFS_REC_DATA_MAX;
+    *p = x->base + xoff;
+    return n;
+}
+
+/* Copy between buf and file bytes [off, off + n), which must be held */
+static void copy_data(ramfs_entry_t *e, uint64_t off, uint8_t *buf, uint64_t n,
+                      int to_file)
+{
+    while (n) {
+        ramfs_extent_t *x = find_extent(e, (uint32_t)(off / PAGE_SIZE));
+        uint64_t xoff = off - (uint64_t)x->first_page * PAGE_SIZE;
+        uint64_t chunk = ((uint64_t)PAGE_SIZE << x->order) - xoff;
+        if (chunk > n) chunk = n;
+
+        uint8_t *p = x->base + xoff;
+        if (to_file) for (uint64_t i = 0; i < chunk; i++) p[i] = buf[i];
+        else         for (uint64_t i = 0; i < chunk; i++) buf[i] = p[i];
+        off += chunk;
+        buf += chunk;
+        n -= chunk;
     }
-    return -1;
 }
 
 /* Parse a path into parent + name components */
@@ -169,25 +553,39 @@ static void split_path(const char *path, char *parent, char *name)
     name[ni] = 0;
 }
 
+static ramfs_entry_t *file_of(vfs_node_t *node)
+{
+    int idx = (int)node->fs_data;
+    if (idx < 0 || idx >= RAMFS_MAX_FILES || !entries[idx].used) return (void *)0;
+    if (entries[idx].type != VFS_FILE) return (void *)0;
+    return &entries[idx];
+}
+
+static void fill_node(int idx, vfs_node_t *out)
+{
+    ramfs_strcpy(out->name, entries[idx].name);
+    out->type = entries[idx].type;
+    out->size = entries[idx].size;
+    out->inode = 0;
+    out->fs_data = (uint64_t)idx;
+    out->read = ramfs_read;
+    out->write = ramfs_write;
+    out->readdir = (entries[idx].type == VFS_DIRECTORY) ?
+        ramfs_readdir : (void *)0;
+}
+
 int ramfs_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buf)
 {
     if (!node || !buf) return -1;
 
-    int idx = (int)node->fs_data;
-    if (idx < 0 || idx >= RAMFS_MAX_FILES || !entries[idx].used) return -1;
-    if (entries[idx].type != VFS_FILE) return -1;
+    ramfs_entry_t *e = file_of(node);
+    if (!e) return -1;
 
-    uint8_t *out = (uint8_t *)buf;
-    uint64_t file_size = entries[idx].size;
+    uint64_t file_size = e->size;
     if (offset >= file_size) return 0;
     if (offset + size > file_size) size = file_size - offset;
 
-    uint8_t *data = entries[idx].data;
-    if (!data) return 0;
-
-    for (uint64_t i = 0; i < size; i++)
-        out[i] = data[offset + i];
-
+    copy_data(e, offset, (uint8_t *)buf, size, 0);
     return (int)size;
 }
 
@@ -195,132 +593,71 @@ int ramfs_write(vfs_node_t *node, uint64_t offset, uint64_t size, const void *bu
 {
     if (!node || !buf) return -1;
 
-    int idx = (int)node->fs_data;
-    if (idx < 0 || idx >= RAMFS_MAX_FILES || !entries[idx].used) return -1;
-    if (entries[idx].type != VFS_FILE) return -1;
-
-    uint64_t needed = offset + size;
-    if (needed > entries[idx].capacity) {
-        /* Grow buffer */
-        uint64_t new_cap = needed + 1024;
-        if (new_cap > RAMFS_MAX_DATA) new_cap = RAMFS_MAX_DATA;
-        if (needed > new_cap) return -1;  /* Too large */
-
-        uint8_t *new_data = (uint8_t *)kmalloc((uint32_t)new_cap);
-        if (!new_data) return -1;
-
-        /* Copy old data */
-        if (entries[idx].data) {
-            for (uint64_t i = 0; i < entries[idx].size; i++)
-                new_data[i] = entries[idx].data[i];
-            kfree(entries[idx].data);
-        }
-        entries[idx].data = new_data;
-        entries[idx].capacity = new_cap;
-    }
+    ramfs_entry_t *e = file_of(node);
+    if (!e) return -1;
 
-    const uint8_t *in = (const uint8_t *)buf;
-    for (uint64_t i = 0; i < size; i++)
-        entries[idx].data[offset + i] = in[i];
+    if (ensure_capacity(e, offset + size) < 0) return -1;
+    copy_data(e, offset, (uint8_t *)buf, size, 1);
 
-    if (offset + size > entries[idx].size)
-        entries[idx].size = offset + size;
+    if (offset + size > e->size)
+        e->size = offset + size;
 
-    ramfs_sync_to_disk();
+    if (e->dirty_hi == e->dirty_lo) {
+        e->dirty_lo = (uint32_t)offset;
+        e->dirty_hi = (uint32_t)(offset + size);
+    } else {
+        if (offset < e->dirty_lo) e->dirty_lo = (uint32_t)offset;
+        if (offset + size > e->dirty_hi) e->dirty_hi = (uint32_t)(offset + size);
+    }
+    ramfs_mark_dirty();
     return (int)size;
 }
 
 int ramfs_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
 {
-    if (!dir || !child) return -1;
+    if (!dir || !child || index < 0) return -1;
 
-    /* Build the path for this directory */
-    char dir_path[VFS_MAX_PATH];
-    /* The dir->fs_data stores the entry index; for root-level we need parent="/" */
+    /* The dir->fs_data stores the entry index; anything else is the root */
+    int d = RAMFS_ROOT;
     int dir_idx = (int)dir->fs_data;
-
-    /* Build the full path of this directory */
     if (dir_idx >= 0 && dir_idx < RAMFS_MAX_FILES && entries[dir_idx].used) {
-        /* Construct path: parent + name + "/" */
-        int pi = 0;
-        const char *p = entries[dir_idx].parent;
-        while (*p && pi < VFS_MAX_PATH - 1) dir_path[pi++] = *p++;
-        const char *n = entries[dir_idx].name;
-        while (*n && pi < VFS_MAX_PATH - 1) dir_path[pi++] = *n++;
-        if (pi > 0 && dir_path[pi - 1] != '/') dir_path[pi++] = '/';
-        dir_path[pi] = 0;
-    } else {
-        /* Root-level ramfs entries have parent "/" */
-        dir_path[0] = '/';
-        dir_path[1] = 0;
+        if (entries[dir_idx].type != VFS_DIRECTORY) return -1;
+        d = dir_idx;
     }
 
-    /* Enumerate children */
-    int count = 0;
-    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
-        if (!entries[i].used) continue;
-        if (ramfs_strcmp(entries[i].parent, dir_path) != 0) continue;
-        if (count == index) {
-            ramfs_strcpy(child->name, entries[i].name);
-            child->type = entries[i].type;
-            child->size = entries[i].size;
-            child->inode = 0;
-            child->fs_data = (uint64_t)i;
-            child->read = ramfs_read;
-            child->write = ramfs_write;
-            child->readdir = (entries[i].type == VFS_DIRECTORY) ?
-                ramfs_readdir : (void *)0;
-            return 0;
-        }
-        count++;
+    /* Continue from the previous call when listing in order */
+    int i = *child_head(d), n = 0;
+    if (rd_cursor.dir == d && rd_cursor.index <= index) {
+        i = rd_cursor.entry;
+        n = rd_cursor.index;
     }
+    while (i >= 0 && n < index) {
+        i = entries[i].next_sibling;
+        n++;
+    }
+    if (i < 0) return -1;
 
-    return -1;
+    rd_cursor.dir = d;
+    rd_cursor.index = n;
+    rd_cursor.entry = i;
+    fill_node(i, child);
+    return 0;
 }
 
 int ramfs_lookup(const char *path, vfs_node_t *out)
 {
     if (!path || !out) return -1;
 
-    char parent[VFS_MAX_PATH];
-    char name[RAMFS_NAME_MAX];
-    split_path(path, parent, name);
-
-    /* Check for one of the built-in directory roots (e.g., "/Desktop/") */
-    if (name[0] == 0) {
-        /* Path ends with / — might be looking up a directory itself */
-        /* Try stripping trailing slash */
-        char stripped[VFS_MAX_PATH];
-        int len = ramfs_strlen(path);
-        int si = 0;
-        for (int i = 0; i < len; i++) stripped[si++] = path[i];
-        if (si > 1 && stripped[si - 1] == '/') si--;
-        stripped[si] = 0;
-        split_path(stripped, parent, name);
-    }
-
-    if (name[0] == 0) return -1;
-
-    int idx = find_entry(parent, name);
+    int idx = resolve_path(path);
     if (idx < 0) return -1;
 
-    ramfs_strcpy(out->name, entries[idx].name);
-    out->type = entries[idx].type;
-    out->size = entries[idx].size;
-    out->inode = 0;
-    out->fs_data = (uint64_t)idx;
-    out->read = ramfs_read;
-    out->write = ramfs_write;
-    out->readdir = (entries[idx].type == VFS_DIRECTORY) ?
-        ramfs_readdir : (void *)0;
-
+    fill_node(idx, out);
     return 0;
 }
 
 int ramfs_create(const char *path, vfs_node_type_t type)
 {
     if (!path) return -1;
-    if (entry_count >= RAMFS_MAX_FILES) return -1;
 
     char parent[VFS_MAX_PATH];
     char name[RAMFS_NAME_MAX];
@@ -328,26 +665,23 @@ int ramfs_create(const char *path, vfs_node_type_t type)
 
     if (name[0] == 0) return -1;
 
+    int dir = resolve_path(parent);
+    if (dir == RAMFS_NONE) return -1;
+
     /* Check if already exists */
-    if (find_entry(parent, name) >= 0) return -1;
+    if (find_child(dir, name) >= 0) return -1;
 
-    /* Find free slot */
-    int slot = -1;
-    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
-        if (!entries[i].used) { slot = i; break; }
-    }
+    int slot = alloc_entry();
     if (slot < 0) return -1;
 
     ramfs_strcpy(entries[slot].name, name);
-    ramfs_strcpy(entries[slot].parent, parent);
+    entries[slot].parent = dir;
     entries[slot].type = type;
-    entries[slot].data = (void *)0;
-    entries[slot].size = 0;
-    entries[slot].capacity = 0;
-    entries[slot].used = 1;
-    entry_count++;
+    entries[slot].ino = next_ino++;
+    entries[slot].meta_dirty = 1;
+    link_entry(slot);
 
-    ramfs_sync_to_disk();
+    ramfs_mark_dirty();
     return 0;
 }
 
@@ -355,28 +689,16 @@ int ramfs_delete(const char *path)
 {
     if (!path) return -1;
 
-    char parent[VFS_MAX_PATH];
-    char name[RAMFS_NAME_MAX];
-    split_path(path, parent, name);
-
-    int idx = find_entry(parent, name);
+    int idx = resolve_path(path);
     if (idx < 0) return -1;
 
     /* Don't allow deleting built-in directories */
-    if (ramfs_strcmp(parent, "/") == 0) {
-        for (int i = 0; i < BUILTIN_DIR_COUNT; i++) {
-            if (ramfs_strcmp(name, builtin_dirs[i]) == 0) return -1;
-        }
-    }
+    if (entries[idx].ino == 0) return -1;
 
-    if (entries[idx].data) kfree(entries[idx].data);
-    entries[idx].data = (void *)0;
-    entries[idx].size = 0;
-    entries[idx].capacity = 0;
-    entries[idx].used = 0;
-    entry_count--;
+    /* A directory goes with everything in it */
+    remove_entry(idx, 1);
 
-    ramfs_sync_to_disk();
+    ramfs_mark_dirty();
     return 0;
 }
 
@@ -384,18 +706,30 @@ int ramfs_rename(const char *old_path, const char *new_path)
 {
     if (!old_path || !new_path) return -1;
 
-    char old_parent[VFS_MAX_PATH], old_name[RAMFS_NAME_MAX];
     char new_parent[VFS_MAX_PATH], new_name[RAMFS_NAME_MAX];
-    split_path(old_path, old_parent, old_name);
     split_path(new_path, new_parent, new_name);
+    if (new_name[0] == 0) return -1;
 
-    int idx = find_entry(old_parent, old_name);
-    if (idx < 0) return -1;
+    int idx = resolve_path(old_path);
+    if (idx < 0 || entries[idx].ino == 0) return -1;
 
+    int dir = resolve_path(new_parent);
+    if (dir == RAMFS_NONE) return -1;
+    int clash = find_child(dir, new_name);
+    if (clash == idx) return 0;
+    if (clash >= 0) return -1;
+
+    /* A directory cannot move below itself */
+    for (int i = dir; i != RAMFS_ROOT; i = entries[i].parent)
+        if (i == idx) return -1;
+
+    unlink_entry(idx);
     ramfs_strcpy(entries[idx].name, new_name);
-    ramfs_strcpy(entries[idx].parent, new_parent);
+    entries[idx].parent = dir;
+    link_entry(idx);
+    entries[idx].meta_dirty = 1;
 
-    ramfs_sync_to_disk();
+    ramfs_mark_dirty();
     return 0;
 }
 
@@ -403,108 +737,471 @@ int ramfs_rename(const char *old_path, const char *new_path)
 
 /*
  * On-disk layout starting at RAMFS_PERSIST_LBA:
- *   Sector 0: ramfs_disk_header_t (magic, entry count)
- *   For each entry:
- *     1 sector:  ramfs_disk_entry_t (metadata)
- *     N sectors: file data (size / 512 rounded up)
+ *   Sector 0:  ramfs_log_super_t (active half and its generation)
+ *   Half 0:    RAMFS_HALF_SECTORS of log records
+ *   Half 1:    RAMFS_HALF_SECTORS of log records
+ * A half begins with a checkpoint (META + DATA for every user entry) and
+ * continues with incremental records.  Replay stops at the first record
+ * whose magic, generation, sequence number or checksum does not match,
+ * which is also where the next flush appends.
  */
 
-static void ramfs_sync_to_disk(void)
+static uint8_t  stage[RAMFS_STAGE_SECTORS * 512];
+static disk_device_t *stage_disk;
+static uint64_t stage_lba;      /* Disk sector of stage[0]            */
+static uint32_t stage_len;      /* Bytes buffered in stage            */
+static uint32_t stage_pos;      /* Stream offset within the half      */
+static uint32_t stage_gen, stage_seq;
+static int      stage_err;
+
+static inline uint64_t half_lba(uint32_t half)
 {
-    disk_device_t *disk = disk_get_primary();
-    if (!disk) return;
+    return RAMFS_PERSIST_LBA + 1 + (uint64_t)half * RAMFS_HALF_SECTORS;
+}
 
-    uint8_t sector[512];
-    uint64_t lba = RAMFS_PERSIST_LBA;
+static uint32_t fnv1a(uint32_t h, const void *p, uint32_t n)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    for (uint32_t i = 0; i < n; i++) {
+        h ^= b[i];
+        h *= 16777619u;
+    }
+    return h;
+}
 
-    /* Write header */
-    for (int i = 0; i < 512; i++) sector[i] = 0;
-    ramfs_disk_header_t *hdr = (ramfs_disk_header_t *)sector;
-    hdr->magic = RAMFS_PERSIST_MAGIC;
+static inline uint32_t rec_size(uint32_t len)
+{
+    return (uint32_t)(sizeof(ramfs_rec_t) + len + 3) & ~3u;
+}
 
-    /* Count user entries (skip built-in directories) */
-    int user_count = 0;
-    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
-        if (!entries[i].used) continue;
-        /* Skip built-in dirs (parent="/" and name matches builtin) */
-        if (ramfs_strcmp(entries[i].parent, "/") == 0) {
-            int is_builtin = 0;
-            for (int b = 0; b < BUILTIN_DIR_COUNT; b++) {
-                if (ramfs_strcmp(entries[i].name, builtin_dirs[b]) == 0) {
-                    is_builtin = 1;
-                    break;
-                }
-            }
-            if (is_builtin) continue;
+static uint32_t meta_rec_size(const ramfs_entry_t *e)
+{
+    char parent[VFS_MAX_PATH];
+    int plen = dir_path(e->parent, parent);
+    return rec_size(sizeof(ramfs_rec_meta_t) + ramfs_strlen(e->name) +
+                    (plen > 0 ? plen : 0));
+}
+
+/* Bytes of the REC_DATA records for file bytes [lo, hi) */
+static uint32_t data_rec_bytes(ramfs_entry_t *e, uint32_t lo, uint32_t hi)
+{
+    uint32_t n = 0;
+    const uint8_t *p;
+    while (lo < hi) {
+        uint32_t len = data_chunk(e, lo, hi, &p);
+        n += rec_size(sizeof(ramfs_rec_data_t) + len);
+        lo += len;
+    }
+    return n;
+}
+
+/* Built-in directories are recreated at boot and never logged */
+static inline int is_user_entry(const ramfs_entry_t *e)
+{
+    return e->used && e->ino != 0;
+}
+
+static int find_ino(uint32_t ino)
+{
+    for (int i = 0; i < RAMFS_MAX_FILES; i++)
+        if (entries[i].used && entries[i].ino == ino) return i;
+    return -1;
+}
+
+/* ── Log writer ── */
+/* Records stream into `stage`, which goes to disk in whole sectors: when
+ * it fills, and once at the end of a flush.  A flush that continues the
+ * active half starts by rewriting its partially used last sector.     */
+static void stage_begin(disk_device_t *disk, uint32_t half, uint32_t pos,
+                        uint32_t gen, uint32_t seq)
+{
+    stage_disk = disk;
+    stage_lba  = half_lba(half) + pos / 512;
+    stage_len  = pos % 512;
+    stage_pos  = pos;
+    stage_gen  = gen;
+    stage_seq  = seq;
+    stage_err  = 0;
+    for (uint32_t i = 0; i < stage_len; i++) stage[i] = tail_sector[i];
+}
+
+static void stage_put(const void *p, uint32_t n)
+{
+    const uint8_t *src = (const uint8_t *)p;
+    while (n) {
+        uint32_t chunk = (uint32_t)sizeof(stage) - stage_len;
+        if (chunk > n) chunk = n;
+        for (uint32_t i = 0; i < chunk; i++) stage[stage_len + i] = src[i];
+        stage_len += chunk;
+        stage_pos += chunk;
+        src += chunk;
+        n -= chunk;
+
+        if (stage_len == sizeof(stage)) {
+            if (bcache_write(stage_disk, stage_lba, RAMFS_STAGE_SECTORS, stage) < 0)
+                stage_err = 1;
+            stage_lba += RAMFS_STAGE_SECTORS;
+            stage_len = 0;
         }
-        user_count++;
     }
-    hdr->count = (uint32_t)user_count;
-    disk_write(disk, lba, 1, sector);
-    lba++;
+}
 
-    /* Write each user entry */
+static void stage_end(void)
+{
+    uint32_t sectors = (stage_len + 511) / 512;
+    for (uint32_t i = stage_len; i < sectors * 512; i++) stage[i] = 0;
+    if (sectors && bcache_write(stage_disk, stage_lba, sectors, stage) < 0)
+        stage_err = 1;
+
+    /* Zero padding ends replay; the next flush overwrites it */
+    uint32_t part = stage_len % 512;
+    for (uint32_t i = 0; i < part; i++)
+        tail_sector[i] = stage[(sectors - 1) * 512 + i];
+}
+
+static void emit(uint16_t type, const void *a, uint32_t alen,
+                 const void *b, uint32_t blen)
+{
+    static const uint8_t zeros[4] = { 0, 0, 0, 0 };
+    ramfs_rec_t r;
+    r.magic = RAMFS_REC_MAGIC;
+    r.gen   = stage_gen;
+    r.seq   = stage_seq++;
+    r.type  = type;
+    r.len   = (uint16_t)(alen + blen);
+    r.csum  = 0;
+    uint32_t h = fnv1a(2166136261u, &r, sizeof(r));
+    h = fnv1a(h, a, alen);
+    r.csum = fnv1a(h, b, blen);
+
+    stage_put(&r, sizeof(r));
+    stage_put(a, alen);
+    if (blen) stage_put(b, blen);
+    stage_put(zeros, rec_size(alen + blen) - (uint32_t)sizeof(r) - alen - blen);
+}
+
+/* Parents are named by path, so replay needs them logged first */
+static void emit_meta(const ramfs_entry_t *e)
+{
+    char parent[VFS_MAX_PATH];
+    int plen = dir_path(e->parent, parent);
+    if (plen < 0) return;
+
+    uint8_t payload[sizeof(ramfs_rec_meta_t) + RAMFS_NAME_MAX + VFS_MAX_PATH];
+    ramfs_rec_meta_t *m = (ramfs_rec_meta_t *)payload;
+    m->ino        = e->ino;
+    m->type       = (uint32_t)e->type;
+    m->name_len   = (uint16_t)ramfs_strlen(e->name);
+    m->parent_len = (uint16_t)plen;
+
+    uint8_t *p = payload + sizeof(*m);
+    for (int i = 0; i < m->name_len; i++)   *p++ = (uint8_t)e->name[i];
+    for (int i = 0; i < m->parent_len; i++) *p++ = (uint8_t)parent[i];
+    emit(REC_META, payload, (uint32_t)(p - payload), (void *)0, 0);
+}
+
+/* One record per extent piece of at most RAMFS_REC_DATA_MAX bytes */
+static void emit_data(ramfs_entry_t *e, uint32_t lo, uint32_t hi)
+{
+    while (lo < hi) {
+        const uint8_t *p;
+        ramfs_rec_data_t d;
+        d.ino    = e->ino;
+        d.offset = lo;
+        d.len    = data_chunk(e, lo, hi, &p);
+        d.size   = (uint32_t)e->size;
+        emit(REC_DATA, &d, sizeof(d), p, d.len);
+        lo += d.len;
+    }
+}
+
+/* Bytes a checkpoint of the current entries would take */
+static uint32_t checkpoint_bytes(void)
+{
+    uint32_t n = 0;
     for (int i = 0; i < RAMFS_MAX_FILES; i++) {
-        if (!entries[i].used) continue;
-        /* Skip built-in dirs */
-        if (ramfs_strcmp(entries[i].parent, "/") == 0) {
-            int is_builtin = 0;
-            for (int b = 0; b < BUILTIN_DIR_COUNT; b++) {
-                if (ramfs_strcmp(entries[i].name, builtin_dirs[b]) == 0) {
-                    is_builtin = 1;
-                    break;
-                }
-            }
-            if (is_builtin) continue;
-        }
+        if (!is_user_entry(&entries[i])) continue;
+        n += meta_rec_size(&entries[i]);
+        n += data_rec_bytes(&entries[i], 0, (uint32_t)entries[i].size);
+    }
+    return n;
+}
 
-        /* Write metadata sector */
-        for (int j = 0; j < 512; j++) sector[j] = 0;
-        ramfs_disk_entry_t *de = (ramfs_disk_entry_t *)sector;
-        ramfs_strcpy(de->name, entries[i].name);
-        ramfs_strcpy(de->parent, entries[i].parent);
-        de->type = (uint32_t)entries[i].type;
-        de->size = (uint32_t)entries[i].size;
-        disk_write(disk, lba, 1, sector);
-        lba++;
+/* Bytes the pending changes would take as incremental records */
+static uint32_t incremental_bytes(void)
+{
+    uint32_t n = (uint32_t)pending_del_count * rec_size(sizeof(uint32_t));
+    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
+        ramfs_entry_t *e = &entries[i];
+        if (!is_user_entry(e)) continue;
+        if (e->meta_dirty) n += meta_rec_size(e);
+        if (e->dirty_hi > e->dirty_lo) n += data_rec_bytes(e, e->dirty_lo, e->dirty_hi);
+    }
+    return n;
+}
 
-        /* Write data sectors — save size before clearing sector buffer */
-        uint32_t entry_size = (uint32_t)entries[i].size;
-        uint32_t data_sectors = (entry_size + 511) / 512;
-        if (entries[i].data && entry_size > 0) {
-            for (uint32_t s = 0; s < data_sectors; s++) {
-                for (int j = 0; j < 512; j++) sector[j] = 0;
-                uint32_t offset = s * 512;
-                uint32_t chunk = entry_size - offset;
-                if (chunk > 512) chunk = 512;
-                for (uint32_t j = 0; j < chunk; j++)
-                    sector[j] = entries[i].data[offset + j];
-                disk_write(disk, lba + s, 1, sector);
-            }
-        }
-        lba += data_sectors;
+static void mark_all_logged(void)
+{
+    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
+        ramfs_entry_t *e = &entries[i];
+        if (!is_user_entry(e)) continue;
+        e->logged = 1;
+        e->meta_dirty = 0;
+        e->dirty_lo = e->dirty_hi = 0;
     }
+    pending_del_count = 0;
 }
 
-static void ramfs_load_from_disk(void)
+/* Write every live entry to the inactive half, then flip the superblock */
+static int write_checkpoint(disk_device_t *disk)
 {
+    if (checkpoint_bytes() > RAMFS_HALF_BYTES) return -1;
+
+    uint32_t half = log_active ^ 1;
+    stage_begin(disk, half, 0, log_gen + 1, 0);
+    for (int i = tree_next(RAMFS_ROOT); i >= 0; i = tree_next(i)) {
+        ramfs_entry_t *e = &entries[i];
+        if (!is_user_entry(e)) continue;
+        emit_meta(e);
+        emit_data(e, 0, (uint32_t)e->size);
+    }
+    stage_end();
+    if (stage_err) return -1;
+
+    /* The checkpoint must be on disk before the superblock points at it */
+    if (bcache_sync() < 0) return -1;
+
+    uint8_t sector[512];
+    for (int i = 0; i < 512; i++) sector[i] = 0;
+    ramfs_log_super_t *sb = (ramfs_log_super_t *)sector;
+    sb->magic   = RAMFS_LOG_MAGIC;
+    sb->version = RAMFS_LOG_VERSION;
+    sb->gen     = stage_gen;
+    sb->active  = half;
+    if (bcache_write(disk, RAMFS_PERSIST_LBA, 1, sector) < 0) return -1;
+    if (bcache_sync() < 0) return -1;
+
+    log_active = half;
+    log_gen    = stage_gen;
+    log_seq    = stage_seq;
+    log_tail   = stage_pos;
+    force_checkpoint = 0;
+    mark_all_logged();
+    return 0;
+}
+
+/* Append records for what changed since the last flush */
+static int write_incremental(disk_device_t *disk)
+{
+    /* Tree order, and deletes last: an entry moved out of a directory
+     * that is then deleted is relinked before the directory goes.    */
+    stage_begin(disk, log_active, log_tail, log_gen, log_seq);
+    for (int i = tree_next(RAMFS_ROOT); i >= 0; i = tree_next(i)) {
+        ramfs_entry_t *e = &entries[i];
+        if (!is_user_entry(e)) continue;
+        if (e->meta_dirty) emit_meta(e);
+        if (e->dirty_hi > e->dirty_lo) emit_data(e, e->dirty_lo, e->dirty_hi);
+    }
+    for (int i = 0; i < pending_del_count; i++)
+        emit(REC_DELETE, &pending_del[i], sizeof(uint32_t), (void *)0, 0);
+    stage_end();
+    if (stage_err) return -1;
+
+    log_seq  = stage_seq;
+    log_tail = stage_pos;
+    mark_all_logged();
+    return 0;
+}
+
+static int ramfs_flush(void)
+{
+    if (!log_dirty) return 0;
+
     disk_device_t *disk = disk_get_primary();
-    if (!disk) return;
+    if (!disk) return -1;
+
+    /* Checkpoint when the half would overflow, or once most of it is
+     * records that later ones have superseded.                        */
+    uint32_t used = log_tail + incremental_bytes();
+    int rc;
+    if (force_checkpoint || used > RAMFS_HALF_BYTES ||
+        (used > RAMFS_COMPACT_MIN && used > 2 * checkpoint_bytes()))
+        rc = write_checkpoint(disk);
+    else
+        rc = write_incremental(disk);
+
+    if (rc < 0) {
+        /* Records past the tail may be half written: start afresh */
+        force_checkpoint = 1;
+        return -1;
+    }
+    log_dirty = 0;
+    return 0;
+}
+
+static void flush_thread(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        kthread_wait_event(&flush_ev, 0);
+        kthread_sleep_ms(RAMFS_FLUSH_DELAY_MS);    /* Let a burst coalesce */
+
+        /* The changes stay dirty and the next one retries them */
+        if (ramfs_flush() < 0) {
+            if (!flush_failed) serial_write("ramfs: flush to disk failed\n");
+            flush_failed = 1;
+        } else {
+            flush_failed = 0;
+        }
+    }
+}
+
+static void ramfs_mark_dirty(void)
+{
+    log_dirty = 1;
+    if (flusher_started)
+        kthread_signal(&flush_ev);
+    else
+        ramfs_flush();
+}
+
+int ramfs_sync(void)
+{
+    return ramfs_flush();
+}
+
+/* ── Log replay ── */
+static void replay_meta(const uint8_t *p, uint32_t len)
+{
+    const ramfs_rec_meta_t *m = (const ramfs_rec_meta_t *)p;
+    if (len < sizeof(*m) || sizeof(*m) + m->name_len + m->parent_len > len) return;
+    if (!m->name_len || m->name_len >= RAMFS_NAME_MAX ||
+        m->parent_len >= VFS_MAX_PATH || !m->ino) return;
+
+    char parent[VFS_MAX_PATH];
+    const char *s = (const char *)(p + sizeof(*m));
+    for (int i = 0; i < m->parent_len; i++) parent[i] = s[m->name_len + i];
+    parent[m->parent_len] = 0;
+    int dir = resolve_path(parent);
+    if (dir == RAMFS_NONE) return;
+
+    int idx = find_ino(m->ino);
+    if (idx >= 0) {
+        unlink_entry(idx);
+    } else {
+        idx = alloc_entry();
+        if (idx < 0) return;
+        entries[idx].ino = m->ino;
+        entries[idx].logged = 1;
+        if (m->ino >= next_ino) next_ino = m->ino + 1;
+    }
 
+    ramfs_entry_t *e = &entries[idx];
+    for (int i = 0; i < m->name_len; i++) e->name[i] = s[i];
+    e->name[m->name_len] = 0;
+    e->parent = dir;
+    e->type = (vfs_node_type_t)m->type;
+    link_entry(idx);
+}
+
+static void replay_data(const uint8_t *p, uint32_t len)
+{
+    const ramfs_rec_data_t *d = (const ramfs_rec_data_t *)p;
+    if (len < sizeof(*d) || sizeof(*d) + d->len > len) return;
+    if (d->offset > RAMFS_MAX_FILE_SIZE || d->len > RAMFS_MAX_FILE_SIZE - d->offset ||
+        d->size > RAMFS_MAX_FILE_SIZE) return;
+
+    int idx = find_ino(d->ino);
+    if (idx < 0 || entries[idx].type != VFS_FILE) return;
+    ramfs_entry_t *e = &entries[idx];
+    uint32_t end = d->offset + d->len;
+    if (ensure_capacity(e, end > d->size ? end : d->size) < 0) return;
+
+    copy_data(e, d->offset, (uint8_t *)(p + sizeof(*d)), d->len, 1);
+    e->size = d->size;
+}
+
+static void replay_delete(const uint8_t *p, uint32_t len)
+{
+    if (len < sizeof(uint32_t)) return;
+    int idx = find_ino(*(const uint32_t *)p);
+    if (idx < 0) return;
+    remove_entry(idx, 0);
+}
+
+/* Make stage hold half bytes [pos, pos + need) and return them, reading
+ * sectors as needed.  stage[0] is half byte *base, *filled bytes valid. */
+static const uint8_t *replay_window(disk_device_t *disk, uint32_t *base,
+                                    uint32_t *filled, uint32_t pos, uint32_t need)
+{
+    if (pos + need > RAMFS_HALF_BYTES) return (void *)0;
+    if (pos + need <= *base + *filled) return stage + (pos - *base);
+
+    /* Slide so the sector holding pos comes first, then top up */
+    uint32_t shift = (pos & ~511u) - *base;
+    for (uint32_t i = shift; i < *filled; i++) stage[i - shift] = stage[i];
+    *filled -= shift;
+    *base += shift;
+
+    uint32_t room = (uint32_t)sizeof(stage) - *filled;
+    uint32_t left = RAMFS_HALF_BYTES - (*base + *filled);
+    if (room > left) room = left;
+    uint64_t lba = half_lba(log_active);
+    if (room && bcache_read(disk, lba + (*base + *filled) / 512,
+                            room / 512, stage + *filled) < 0)
+        return (void *)0;
+    *filled += room;
+
+    return pos + need <= *base + *filled ? stage + (pos - *base) : (void *)0;
+}
+
+static void replay_log(disk_device_t *disk)
+{
+    uint32_t base = 0, filled = 0, pos = 0, seq = 0;
+    for (;;) {
+        const uint8_t *p = replay_window(disk, &base, &filled, pos, sizeof(ramfs_rec_t));
+        if (!p) break;
+        ramfs_rec_t r = *(const ramfs_rec_t *)p;
+        if (r.magic != RAMFS_REC_MAGIC || r.gen != log_gen || r.seq != seq) break;
+
+        uint32_t size = rec_size(r.len);
+        p = replay_window(disk, &base, &filled, pos, size);
+        if (!p) break;
+
+        uint32_t csum = r.csum;
+        r.csum = 0;
+        uint32_t h = fnv1a(2166136261u, &r, sizeof(r));
+        if (fnv1a(h, p + sizeof(r), r.len) != csum) break;
+
+        const uint8_t *payload = p + sizeof(r);
+        if (r.type == REC_META)        replay_meta(payload, r.len);
+        else if (r.type == REC_DATA)   replay_data(payload, r.len);
+        else if (r.type == REC_DELETE) replay_delete(payload, r.len);
+
+        pos += size;
+        seq++;
+    }
+
+    log_seq  = seq;
+    log_tail = pos;
+    if (pos % 512) {
+        const uint8_t *last = stage + ((pos & ~511u) - base);
+        for (uint32_t i = 0; i < pos % 512; i++) tail_sector[i] = last[i];
+    }
+}
+
+/* Snapshot written by earlier versions: convert it with a checkpoint,
+ * which lands in half 1 and so cannot overwrite what is being read. */
+static void load_snapshot(disk_device_t *disk, uint32_t count)
+{
     uint8_t sector[512];
-    uint64_t lba = RAMFS_PERSIST_LBA;
+    uint64_t lba = RAMFS_PERSIST_LBA + 1;
 
-    /* Read header */
-    if (disk_read(disk, lba, 1, sector) < 0) return;
-    ramfs_disk_header_t *hdr = (ramfs_disk_header_t *)sector;
-    if (hdr->magic != RAMFS_PERSIST_MAGIC) return;
-    uint32_t count = hdr->count;
     if (count > RAMFS_MAX_FILES - BUILTIN_DIR_COUNT) return;
-    lba++;
 
     /* Read each entry */
     for (uint32_t e = 0; e < count; e++) {
-        if (disk_read(disk, lba, 1, sector) < 0) return;
+        if (bcache_read(disk, lba, 1, sector) < 0) return;
         ramfs_disk_entry_t *de = (ramfs_disk_entry_t *)sector;
 
         /* Save metadata before sector buffer is reused for data reads */
@@ -518,49 +1215,61 @@ static void ramfs_load_from_disk(void)
 
         uint32_t data_sectors = (saved_size + 511) / 512;
 
-        /* Find free slot */
-        int slot = -1;
-        for (int i = 0; i < RAMFS_MAX_FILES; i++) {
-            if (!entries[i].used) { slot = i; break; }
-        }
-        if (slot < 0) return;
-
         /* Check for duplicates (shouldn't happen, but be safe) */
-        if (find_entry(saved_parent, saved_name) >= 0) {
+        int dir = resolve_path(saved_parent);
+        if (dir == RAMFS_NONE || find_child(dir, saved_name) >= 0) {
             /* Skip duplicate — advance past data sectors */
             lba += data_sectors;
             continue;
         }
 
+        int slot = alloc_entry();
+        if (slot < 0) return;
         ramfs_strcpy(entries[slot].name, saved_name);
-        ramfs_strcpy(entries[slot].parent, saved_parent);
+        entries[slot].parent = dir;
         entries[slot].type = (vfs_node_type_t)saved_type;
-        entries[slot].size = saved_size;
-        entries[slot].used = 1;
-        entry_count++;
+        entries[slot].ino = next_ino++;
+        entries[slot].meta_dirty = 1;
+        link_entry(slot);
+        log_dirty = 1;
 
         /* Read data */
-        if (saved_size > 0) {
-            entries[slot].data = (uint8_t *)kmalloc(saved_size);
-            entries[slot].capacity = saved_size;
-            if (!entries[slot].data) {
-                entries[slot].size = 0;
-                entries[slot].capacity = 0;
-                lba += data_sectors;
-                continue;
-            }
+        if (saved_size > 0 && saved_type == VFS_FILE &&
+            ensure_capacity(&entries[slot], saved_size) == 0) {
+            entries[slot].size = saved_size;
             for (uint32_t s = 0; s < data_sectors; s++) {
-                if (disk_read(disk, lba + s, 1, sector) < 0) break;
+                if (bcache_read(disk, lba + s, 1, sector) < 0) break;
                 uint32_t offset = s * 512;
                 uint32_t chunk = saved_size - offset;
                 if (chunk > 512) chunk = 512;
-                for (uint32_t j = 0; j < chunk; j++)
-                    entries[slot].data[offset + j] = sector[j];
+                copy_data(&entries[slot], offset, sector, chunk, 1);
             }
-        } else {
-            entries[slot].data = (void *)0;
-            entries[slot].capacity = 0;
         }
         lba += data_sectors;
     }
 }
+
+static void ramfs_load_from_disk(void)
+{
+    disk_device_t *disk = disk_get_primary();
+    if (!disk) return;
+
+    uint8_t sector[512];
+    if (bcache_read(disk, RAMFS_PERSIST_LBA, 1, sector) < 0) return;
+
+    ramfs_disk_header_t *old = (ramfs_disk_header_t *)sector;
+    if (old->magic == RAMFS_PERSIST_MAGIC) {
+        load_snapshot(disk, old->count);
+        return;
+    }
+
+    ramfs_log_super_t *sb = (ramfs_log_super_t *)sector;
+    if (sb->magic != RAMFS_LOG_MAGIC || sb->active > 1 ||
+        sb->version != RAMFS_LOG_VERSION)
+        return;
+
+    log_active = sb->active;
+    log_gen    = sb->gen;
+    replay_log(disk);
+    force_checkpoint = 0;
+}
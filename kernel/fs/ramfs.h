@@ -17,4 +17,9 @@ int  ramfs_readdir(vfs_node_t *dir, int index, vfs_node_t *child);
 int  ramfs_lookup(const char *path, vfs_node_t *out);
 int  ramfs_is_ramfs_path(const char *path);
 
+/* Changes reach the on-disk log RAMFS_FLUSH_DELAY_MS after the first of a
+ * burst; this appends them now (they are then in the block cache, so
+ * follow with bcache_sync to make them durable).  Returns 0 or -1.    */
+int  ramfs_sync(void);
+
 #endif /* NEXTOS_RAMFS_H */
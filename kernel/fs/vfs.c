@@ -6,6 +6,8 @@
 #include "fat32.h"
 #include "ext2.h"
 #include "ramfs.h"
+#include "dcache.h"
+#include "../ui/profiler.h"
 
 static vfs_node_t root_node;
 static int fs_type = 0;  /* 0 = FAT32, 1 = EXT2 */
@@ -26,12 +28,16 @@ static void vfs_strcpy(char *dst, const char *src)
 /* VFS root readdir: enumerates both disk FS entries and ramfs top-level dirs */
 static int vfs_root_readdir(vfs_node_t *dir, int index, vfs_node_t *child);
 
-/* Forward declaration for virtual config file read handler */
+/* Forward declarations for virtual file read handlers */
 static int cfg_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buf);
+static int report_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buf);
+static int report_open(const char *name, vfs_node_t *out);
+static int report_readdir(int index, vfs_node_t *out);
 
 void vfs_init(void)
 {
     disk_fs_ready = 0;
+    dcache_reset();
 
     /* Try FAT32 first, then EXT2 */
     if (fat32_init() == 0) {
@@ -88,6 +94,10 @@ int vfs_open(const char *path, vfs_node_t *out)
         return 0;
     }
 
+    /* Virtual report files: perf.txt, meminfo.txt, netstat.txt, cryptobench.txt */
+    if (path[0] == '/' && report_open(path + 1, out) == 0)
+        return 0;
+
     /* Walk the path components using disk filesystem */
     if (!disk_fs_ready) return -1;
 
@@ -116,17 +126,10 @@ int vfs_open(const char *path, vfs_node_t *out)
         if (*p == '/') p++;
 
         /* Search directory */
-        int found = 0;
-        for (int i = 0; ; i++) {
-            vfs_node_t child;
-            if (vfs_readdir(&current, i, &child) != 0) break;
-            if (vfs_strcmp(child.name, component) == 0) {
-                current = child;
-                found = 1;
-                break;
-            }
-        }
-        if (!found) return -1;
+        if (current.type != VFS_DIRECTORY) return -1;
+        vfs_node_t child;
+        if (dcache_lookup(&current, component, &child) != 0) return -1;
+        current = child;
     }
 
     *out = current;
@@ -148,34 +151,43 @@ int vfs_write(vfs_node_t *node, uint64_t offset, uint64_t size, const void *buf)
 int vfs_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
 {
     if (!dir || dir->type != VFS_DIRECTORY || !dir->readdir) return -1;
+    /* Disk directories are listed from the dentry cache; ramfs is
+     * already in memory and changes under the VFS on every write.  */
+    if (dir->readdir == ext2_readdir || dir->readdir == fat32_readdir)
+        return dcache_readdir(dir, index, child);
     return dir->readdir(dir, index, child);
 }
 
+/* Only ramfs is writable, and the dentry and ext2 inode caches hold
+ * disk state alone, so namespace changes leave both caches valid.  */
 int vfs_create(const char *path, vfs_node_type_t type)
 {
+    int rc = -1;
     if (ramfs_is_ramfs_path(path)) {
-        return ramfs_create(path, type);
+        rc = ramfs_create(path, type);
     }
     /* Disk FS creation not supported */
-    return -1;
+    return rc;
 }
 
 int vfs_delete(const char *path)
 {
+    int rc = -1;
     if (ramfs_is_ramfs_path(path)) {
-        return ramfs_delete(path);
+        rc = ramfs_delete(path);
     }
     /* Disk FS deletion not supported */
-    return -1;
+    return rc;
 }
 
 int vfs_rename(const char *old_path, const char *new_path)
 {
+    int rc = -1;
     if (ramfs_is_ramfs_path(old_path)) {
-        return ramfs_rename(old_path, new_path);
+        rc = ramfs_rename(old_path, new_path);
     }
     /* Disk FS rename not supported */
-    return -1;
+    return rc;
 }
 
 /* ── Root readdir: merges disk FS entries with ramfs top-level dirs ─── */
@@ -205,6 +217,80 @@ static int cfg_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buf)
     return to_copy;
 }
 
+/* Virtual report files, generated on open so size and contents stay
+ * consistent across the reads that follow                          */
+static int perf_generate(char *buf, int cap) { return prof_report(buf, cap, 1); }
+
+static char perf_text[2048];
+static char mem_text[8192];
+static char net_text[2560];
+static char crypto_text[768];
+
+static struct {
+    const char *name;
+    int       (*generate)(char *buf, int cap);
+    char       *text;
+    int         cap;
+    int         len;
+} reports[] = {
+    { "perf.txt",    perf_generate,   perf_text, sizeof(perf_text), 0 },
+    { "meminfo.txt", prof_mem_report, mem_text,  sizeof(mem_text),  0 },
+    { "netstat.txt", prof_net_report, net_text,  sizeof(net_text),  0 },
+    { "cryptobench.txt", prof_crypto_report, crypto_text, sizeof(crypto_text), 0 },
+};
+#define REPORT_COUNT ((int)(sizeof(reports) / sizeof(reports[0])))
+
+static void report_node(int i, vfs_node_t *out)
+{
+    reports[i].len = reports[i].generate(reports[i].text, reports[i].cap);
+    vfs_strcpy(out->name, reports[i].name);
+    out->type = VFS_FILE;
+    out->size = (uint64_t)reports[i].len;
+    out->inode = (uint64_t)i;
+    out->fs_data = 0;
+    out->read = report_read;
+    out->write = (void *)0;
+    out->readdir = (void *)0;
+}
+
+static int report_open(const char *name, vfs_node_t *out)
+{
+    for (int i = 0; i < REPORT_COUNT; i++) {
+        if (vfs_strcmp(name, reports[i].name) == 0) {
+            report_node(i, out);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int report_readdir(int index, vfs_node_t *out)
+{
+    if (index < 0 || index >= REPORT_COUNT) return -1;
+    report_node(index, out);
+    return 0;
+}
+
+static int is_report_name(const char *name)
+{
+    for (int i = 0; i < REPORT_COUNT; i++)
+        if (vfs_strcmp(name, reports[i].name) == 0) return 1;
+    return 0;
+}
+
+static int report_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buf)
+{
+    if (node->inode >= (uint64_t)REPORT_COUNT) return -1;
+    int len = reports[node->inode].len;
+    if ((int)offset >= len) return 0;
+    int avail = len - (int)offset;
+    int to_copy = ((int)size < avail) ? (int)size : avail;
+    const char *src = reports[node->inode].text + offset;
+    char *dst = (char *)buf;
+    for (int i = 0; i < to_copy; i++) dst[i] = src[i];
+    return to_copy;
+}
+
 static int vfs_root_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
 {
     (void)dir;
@@ -247,7 +333,7 @@ static int vfs_root_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
 
     for (int i = 0; ; i++) {
         vfs_node_t disk_child;
-        if (disk_root.readdir(&disk_root, i, &disk_child) != 0) break;
+        if (vfs_readdir(&disk_root, i, &disk_child) != 0) break;
 
         /* Skip . and .. entries */
         if (disk_child.name[0] == '.' &&
@@ -259,8 +345,9 @@ static int vfs_root_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
         /* Skip entries that overlap with ramfs names */
         if (is_ramfs_builtin(disk_child.name)) continue;
 
-        /* Skip nextos.cfg if it somehow exists on disk (we show our virtual one) */
+        /* Skip nextos.cfg and reports if they somehow exist on disk (we show our virtual ones) */
         if (vfs_strcmp(disk_child.name, "nextos.cfg") == 0) continue;
+        if (is_report_name(disk_child.name)) continue;
 
         if (disk_scan == disk_idx) {
             *child = disk_child;
@@ -281,6 +368,5 @@ static int vfs_root_readdir(vfs_node_t *dir, int index, vfs_node_t *child)
         child->readdir = (void *)0;
         return 0;
     }
-
-    return -1;
+    return report_readdir(disk_idx - disk_scan - 1, child);
 }
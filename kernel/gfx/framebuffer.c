@@ -3,8 +3,12 @@
  * Double-buffered framebuffer with drawing primitives and BGA mode switching
  */
 #include "framebuffer.h"
+#include "raster.h"
+#include "text.h"
 #include "../mem/heap.h"
+#include "../mem/paging.h"
 #include "../arch/x86_64/idt.h"
+#include "../arch/x86_64/smp.h"
 
 /* ── Bochs Graphics Adapter (BGA) registers for runtime mode switching ── */
 #define VBE_DISPI_IOPORT_INDEX  0x01CE
@@ -20,14 +24,65 @@
 #define VBE_DISPI_INDEX_VIRT_H  0x07
 #define VBE_DISPI_INDEX_X_OFF   0x08
 #define VBE_DISPI_INDEX_Y_OFF   0x09
+#define VBE_DISPI_INDEX_VIDEO_MEMORY_64K 0x0A
 
 #define VBE_DISPI_DISABLED      0x00
 #define VBE_DISPI_ENABLED       0x01
 #define VBE_DISPI_LFB_ENABLED   0x40
 
+/* VGA input status #1: bit 3 is set while the display is in vertical retrace */
+#define VGA_INPUT_STATUS_1      0x03DA
+#define VGA_STATUS_VRETRACE     0x08
+#define VRETRACE_SPIN_LIMIT     20000
+
 static framebuffer_t fb;
 static int bga_detected = 0;  /* Cached BGA availability (probed once at init) */
 
+/* BGA page flipping: VRAM holds two full pages stacked vertically and the
+ * scanout page is chosen with the Y offset register.  When active, the
+ * backbuffer points straight at the hidden page in VRAM and presenting a
+ * frame is a single register write instead of a copy.                  */
+static int      flip_enabled = 0;
+static uint32_t flip_page    = 0;  /* Page currently being scanned out */
+
+/* Drawing state, one per CPU so tiles can be rasterised in parallel:
+ * the clip rectangle (half-open bounds) that all writes are restricted
+ * to, and the render target (an off-screen surface, or NULL for the
+ * backbuffer).                                                         */
+typedef struct {
+    uint32_t *target;
+    int       tw, th;
+    int       x0, y0, x1, y1;
+    int       saved_x0, saved_y0, saved_x1, saved_y1;
+} draw_ctx_t;
+
+static draw_ctx_t draw_ctx[SMP_MAX_CPUS];
+
+static inline draw_ctx_t *cur_ctx(void)
+{
+    return &draw_ctx[smp_cpu_id()];
+}
+
+static inline uint32_t *ctx_buf(const draw_ctx_t *c)
+{
+    return c->target ? c->target : fb.backbuffer;
+}
+
+static inline int ctx_w(const draw_ctx_t *c)
+{
+    return c->target ? c->tw : (int)fb.width;
+}
+
+static inline int ctx_h(const draw_ctx_t *c)
+{
+    return c->target ? c->th : (int)fb.height;
+}
+
+static inline uint32_t *ctx_row(const draw_ctx_t *c, int row)
+{
+    return ctx_buf(c) + (uint64_t)row * ctx_w(c);
+}
+
 static void bga_write(uint16_t reg, uint16_t val)
 {
     outw(VBE_DISPI_IOPORT_INDEX, reg);
@@ -46,6 +101,90 @@ static void bga_probe(void)
     bga_detected = (id >= 0xB0C0 && id <= 0xB0CF);
 }
 
+/* Map all of VRAM write-combining, so backbuffer copies and drawing into
+ * the flip page are merged into burst writes instead of UC stores.
+ * BGA reports its VRAM size; otherwise only the boot mode is covered. */
+static void map_vram_wc(void)
+{
+    uint64_t size = (uint64_t)fb.pitch * fb.height;
+    if (bga_detected) {
+        uint64_t vram = (uint64_t)bga_read(VBE_DISPI_INDEX_VIDEO_MEMORY_64K) << 16;
+        if (vram > size) size = vram;
+    }
+    uint64_t base = (uint64_t)fb.address & ~(PAGE_SIZE_4K - 1);
+    uint64_t end  = ((uint64_t)fb.address + size + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1);
+    paging_map_range(base, base, end - base, PAGE_WRITE | PAGE_CACHE_WC);
+}
+
+static uint32_t *vram_page(uint32_t page)
+{
+    return (uint32_t *)((uint8_t *)fb.address + (uint64_t)page * fb.height * fb.pitch);
+}
+
+/* Try to extend the current BGA mode to two pages of virtual height.
+ * Only used when the mode is one BGA is actually scanning out with a
+ * packed pitch (the backbuffer is indexed by width), and verified by
+ * reading the registers back: QEMU clamps VIRT_H to what fits in VRAM,
+ * and refuses Y offsets beyond it.                                    */
+static int bga_enable_flip(void)
+{
+    if (!bga_detected || fb.bpp != 32 || fb.pitch != fb.width * 4) return 0;
+    if (fb.height * 2 > 0xFFFF) return 0;
+    if (bga_read(VBE_DISPI_INDEX_XRES) != (uint16_t)fb.width ||
+        bga_read(VBE_DISPI_INDEX_YRES) != (uint16_t)fb.height ||
+        bga_read(VBE_DISPI_INDEX_VIRT_W) != (uint16_t)fb.width)
+        return 0;
+
+    bga_write(VBE_DISPI_INDEX_VIRT_H, (uint16_t)(fb.height * 2));
+    if (bga_read(VBE_DISPI_INDEX_VIRT_H) < (uint16_t)(fb.height * 2))
+        return 0;
+
+    bga_write(VBE_DISPI_INDEX_Y_OFF, (uint16_t)fb.height);
+    int ok = bga_read(VBE_DISPI_INDEX_Y_OFF) == (uint16_t)fb.height;
+    bga_write(VBE_DISPI_INDEX_Y_OFF, 0);
+    return ok;
+}
+
+/* Pick double buffering for the current mode: BGA page flip if the
+ * adapter can hold two pages, otherwise a heap backbuffer copied to
+ * VRAM on swap, otherwise drawing straight to the visible page.      */
+static void fb_setup_buffers(void)
+{
+    flip_enabled = bga_enable_flip();
+    if (flip_enabled) {
+        flip_page = 0;
+        fb.backbuffer = vram_page(1);
+        return;
+    }
+    fb.backbuffer = (uint32_t *)kmalloc(fb.width * fb.height * 4);
+    if (!fb.backbuffer)
+        fb.backbuffer = fb.address; /* fallback: single buffer */
+}
+
+/* Bounded wait for the start of vertical retrace.  The limit keeps a
+ * missing or non-VGA status register from stalling the frame loop.   */
+static void wait_vretrace(void)
+{
+    int n = 0;
+    while ((inb(VGA_INPUT_STATUS_1) & VGA_STATUS_VRETRACE) && n < VRETRACE_SPIN_LIMIT) n++;
+    while (!(inb(VGA_INPUT_STATUS_1) & VGA_STATUS_VRETRACE) && n < VRETRACE_SPIN_LIMIT) n++;
+}
+
+/* Show the page just rendered and retarget drawing at the other one */
+static void fb_flip(void)
+{
+    uint32_t shown = flip_page ^ 1;
+    wait_vretrace();
+    bga_write(VBE_DISPI_INDEX_Y_OFF, (uint16_t)(shown * fb.height));
+    flip_page = shown;
+    fb.backbuffer = vram_page(shown ^ 1);
+}
+
+int fb_page_flipping(void)
+{
+    return flip_enabled;
+}
+
 /* ── Built-in 8x16 bitmap font (ASCII 32-126) ────────────────────────── */
 /* Minimal bitmapped font — each character is 8 pixels wide, 16 rows tall.
  * Stored as 16 bytes per glyph (one byte per row, MSB = leftmost pixel).
@@ -338,6 +477,17 @@ const uint8_t font_8x16[95][16] = {
      0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
 };
 
+static void reset_all_clips(void)
+{
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        draw_ctx[i].target = (void *)0;
+        draw_ctx[i].x0 = 0;
+        draw_ctx[i].y0 = 0;
+        draw_ctx[i].x1 = (int)fb.width;
+        draw_ctx[i].y1 = (int)fb.height;
+    }
+}
+
 void fb_init(uint64_t addr, uint32_t w, uint32_t h, uint32_t pitch, uint32_t bpp)
 {
     fb.address = (uint32_t *)addr;
@@ -348,12 +498,13 @@ void fb_init(uint64_t addr, uint32_t w, uint32_t h, uint32_t pitch, uint32_t bpp
 
     /* Probe BGA once for runtime resolution switching */
     bga_probe();
+    map_vram_wc();
+    raster_init();
+    text_init();
 
-    /* Allocate back buffer */
-    fb.backbuffer = (uint32_t *)kmalloc(w * h * 4);
-    if (!fb.backbuffer) {
-        fb.backbuffer = fb.address; /* fallback: single buffer */
-    }
+    /* Page flip in VRAM if possible, else allocate a back buffer */
+    fb_setup_buffers();
+    reset_all_clips();
 }
 
 int fb_set_resolution(uint32_t w, uint32_t h)
@@ -378,7 +529,7 @@ int fb_set_resolution(uint32_t w, uint32_t h)
     if (actual_w != (uint16_t)w || actual_h != (uint16_t)h) return -1;
 
     /* Free old backbuffer if it was heap-allocated */
-    if (fb.backbuffer && fb.backbuffer != fb.address)
+    if (!flip_enabled && fb.backbuffer && fb.backbuffer != fb.address)
         kfree(fb.backbuffer);
 
     fb.width  = w;
@@ -386,16 +537,16 @@ int fb_set_resolution(uint32_t w, uint32_t h)
     fb.pitch  = w * 4;
     fb.bpp    = 32;
 
-    /* Allocate new backbuffer */
-    fb.backbuffer = (uint32_t *)kmalloc(w * h * 4);
-    if (!fb.backbuffer)
-        fb.backbuffer = fb.address;
+    /* Set up page flipping or a new backbuffer for the new mode */
+    fb_setup_buffers();
+    reset_all_clips();
 
     return 0;
 }
 
 void fb_swap(void)
 {
+    if (flip_enabled) { fb_flip(); return; }
     if (fb.backbuffer == fb.address) return;
 
     /* Copy backbuffer to VRAM using 64-bit transfers */
@@ -412,39 +563,147 @@ void fb_swap(void)
     }
 }
 
-void fb_clear(uint32_t color)
+/* Copy only the given screen rectangles from the backbuffer to VRAM.
+ * Rects are clamped to the screen; overlapping rects are simply copied
+ * twice, which is cheaper than computing their exact union.  With page
+ * flipping the whole hidden page is shown, so the rects are unused.   */
+void fb_swap_rects(const fb_rect_t *rects, int count)
 {
-    uint32_t total = fb.width * fb.height;
-    for (uint32_t i = 0; i < total; i++) {
-        fb.backbuffer[i] = color;
+    if (flip_enabled) { fb_flip(); return; }
+    if (fb.backbuffer == fb.address) return;
+
+    for (int i = 0; i < count; i++) {
+        int x0 = rects[i].x, y0 = rects[i].y;
+        int x1 = x0 + rects[i].w, y1 = y0 + rects[i].h;
+        if (x0 < 0) x0 = 0;
+        if (y0 < 0) y0 = 0;
+        if (x1 > (int)fb.width)  x1 = (int)fb.width;
+        if (y1 > (int)fb.height) y1 = (int)fb.height;
+        if (x0 >= x1 || y0 >= y1) continue;
+
+        for (int y = y0; y < y1; y++) {
+            const uint32_t *src = fb.backbuffer + (uint64_t)y * fb.width + x0;
+            uint32_t *dst = (uint32_t *)((uint8_t *)fb.address +
+                                         (uint64_t)y * fb.pitch) + x0;
+            int n = x1 - x0;
+            int k = 0;
+            /* Align the destination, then move two pixels per store */
+            if (((uint64_t)dst & 7) && n > 0) { dst[0] = src[0]; k = 1; }
+            for (; k + 1 < n; k += 2)
+                *(uint64_t *)(dst + k) = *(const uint64_t *)(src + k);
+            if (k < n) dst[k] = src[k];
+        }
     }
 }
 
+/* ── Off-screen render targets ────────────────────────────────────────── */
+/* Point this CPU's drawing primitives at a caller-owned w*h surface, so
+ * content can be rasterised once and cached.  Not nestable.            */
+void fb_set_target(uint32_t *buf, uint32_t w, uint32_t h)
+{
+    draw_ctx_t *c = cur_ctx();
+    if (c->target) return;
+    c->saved_x0 = c->x0; c->saved_y0 = c->y0;
+    c->saved_x1 = c->x1; c->saved_y1 = c->y1;
+    c->target = buf;
+    c->tw = (int)w;
+    c->th = (int)h;
+    fb_reset_clip();
+}
+
+void fb_reset_target(void)
+{
+    draw_ctx_t *c = cur_ctx();
+    if (!c->target) return;
+    c->target = (void *)0;
+    c->x0 = c->saved_x0; c->y0 = c->saved_y0;
+    c->x1 = c->saved_x1; c->y1 = c->saved_y1;
+}
+
+/* ── Clipping ─────────────────────────────────────────────────────────── */
+void fb_set_clip(int x, int y, int w, int h)
+{
+    draw_ctx_t *c = cur_ctx();
+    int cw = ctx_w(c), ch = ctx_h(c);
+    c->x0 = x < 0 ? 0 : x;
+    c->y0 = y < 0 ? 0 : y;
+    c->x1 = x + w > cw ? cw : x + w;
+    c->y1 = y + h > ch ? ch : y + h;
+    if (c->x1 < c->x0) c->x1 = c->x0;
+    if (c->y1 < c->y0) c->y1 = c->y0;
+}
+
+void fb_reset_clip(void)
+{
+    draw_ctx_t *c = cur_ctx();
+    c->x0 = 0;
+    c->y0 = 0;
+    c->x1 = ctx_w(c);
+    c->y1 = ctx_h(c);
+}
+
+void fb_get_clip(fb_rect_t *out)
+{
+    const draw_ctx_t *c = cur_ctx();
+    out->x = c->x0;
+    out->y = c->y0;
+    out->w = c->x1 - c->x0;
+    out->h = c->y1 - c->y0;
+}
+
+void fb_clear(uint32_t color)
+{
+    const draw_ctx_t *c = cur_ctx();
+    fb_fill_rect(c->x0, c->y0, c->x1 - c->x0, c->y1 - c->y0, color);
+}
+
 void fb_putpixel(int x, int y, uint32_t color)
 {
-    if (x >= 0 && x < (int)fb.width && y >= 0 && y < (int)fb.height) {
-        fb.backbuffer[y * fb.width + x] = color;
+    const draw_ctx_t *c = cur_ctx();
+    if (x >= c->x0 && x < c->x1 && y >= c->y0 && y < c->y1) {
+        ctx_row(c, y)[x] = color;
     }
 }
 
 uint32_t fb_getpixel(int x, int y)
 {
-    if (x >= 0 && x < (int)fb.width && y >= 0 && y < (int)fb.height) {
-        return fb.backbuffer[y * fb.width + x];
+    const draw_ctx_t *c = cur_ctx();
+    if (x >= 0 && x < ctx_w(c) && y >= 0 && y < ctx_h(c)) {
+        return ctx_row(c, y)[x];
     }
     return 0;
 }
 
 
+/* Intersect a rect with the clip; returns 0 if nothing is left */
+static int clip_to(const draw_ctx_t *c, int x, int y, int w, int h,
+                   int *x0, int *y0, int *x1, int *y1)
+{
+    *x0 = x < c->x0 ? c->x0 : x;
+    *y0 = y < c->y0 ? c->y0 : y;
+    *x1 = x + w > c->x1 ? c->x1 : x + w;
+    *y1 = y + h > c->y1 ? c->y1 : y + h;
+    return *x0 < *x1 && *y0 < *y1;
+}
+
 void fb_fill_rect(int x, int y, int w, int h, uint32_t color)
 {
-    for (int row = y; row < y + h; row++) {
-        if (row < 0 || row >= (int)fb.height) continue;
-        for (int col = x; col < x + w; col++) {
-            if (col < 0 || col >= (int)fb.width) continue;
-            fb.backbuffer[row * fb.width + col] = color;
-        }
-    }
+    const draw_ctx_t *c = cur_ctx();
+    int x0, y0, x1, y1;
+    if (!clip_to(c, x, y, w, h, &x0, &y0, &x1, &y1)) return;
+    for (int row = y0; row < y1; row++)
+        raster_ops.fill(ctx_row(c, row) + x0, color, x1 - x0);
+}
+
+/* Blend a constant colour over a rect (dim overlays, gloss, bevels) */
+void fb_blend_rect(int x, int y, int w, int h, uint32_t color, uint8_t alpha)
+{
+    const draw_ctx_t *c = cur_ctx();
+    int x0, y0, x1, y1;
+    if (alpha == 0 || !clip_to(c, x, y, w, h, &x0, &y0, &x1, &y1)) return;
+    for (int row = y0; row < y1; row++)
+        raster_ops.blend_color(ctx_row(c, row) + x0,
+                               color, alpha, x1 - x0);
 }
 
 void fb_draw_rect(int x, int y, int w, int h, uint32_t color)
@@ -477,61 +736,96 @@ void fb_draw_line(int x0, int y0, int x1, int y1, uint32_t color)
     }
 }
 
-void fb_draw_char(int x, int y, char c, uint32_t fg, uint32_t bg)
+/* Text goes through the glyph atlas (text.c), clipped to the current
+ * draw context.  Out-of-range characters render as '?'.              */
+static void draw_text_run(int x, int y, const char *s, int len, uint32_t fg, uint32_t bg)
 {
-    if (c < 32 || c > 126) c = '?';
-    const uint8_t *glyph = font_8x16[c - 32];
-    for (int row = 0; row < 16; row++) {
-        uint8_t bits = glyph[row];
-        uint8_t bits_above = (row > 0)  ? glyph[row - 1] : 0;
-        uint8_t bits_below = (row < 15) ? glyph[row + 1] : 0;
-        for (int col = 0; col < 8; col++) {
-            uint8_t mask = 0x80 >> col;
-            if (bits & mask) {
-                fb_putpixel(x + col, y + row, fg);
-            } else {
-                /* Anti-alias: check if adjacent pixels are filled */
-                int neighbors = 0;
-                if (bits_above & mask) neighbors++;
-                if (bits_below & mask) neighbors++;
-                if (col > 0 && (bits & (mask << 1))) neighbors++;
-                if (col < 7 && (bits & (mask >> 1))) neighbors++;
-                if (neighbors > 0) {
-                    uint32_t base = (bg != 0) ? bg : fb_getpixel(x + col, y + row);
-                    uint8_t alpha = (uint8_t)(neighbors * 40);
-                    fb_putpixel(x + col, y + row, rgba_blend(base, fg, alpha));
-                } else if (bg != 0) {
-                    fb_putpixel(x + col, y + row, bg);
-                }
-            }
-        }
+    const draw_ctx_t *c = cur_ctx();
+    fb_rect_t clip = { c->x0, c->y0, c->x1 - c->x0, c->y1 - c->y0 };
+    char run[64];
+    while (len > 0) {
+        int n = len < (int)sizeof(run) ? len : (int)sizeof(run);
+        for (int i = 0; i < n; i++)
+            run[i] = (s[i] < 32 || s[i] > 126) ? '?' : s[i];
+        text_draw(ctx_buf(c), ctx_w(c), &clip, x, y, run, n, fg, bg, TEXT_AA);
+        x += n * TEXT_GLYPH_W;
+        s += n;
+        len -= n;
     }
 }
 
+void fb_draw_char(int x, int y, char c, uint32_t fg, uint32_t bg)
+{
+    draw_text_run(x, y, &c, 1, fg, bg);
+}
+
 void fb_draw_string(int x, int y, const char *s, uint32_t fg, uint32_t bg)
 {
-    int cx = x;
     while (*s) {
+        int n = 0;
+        while (s[n] && s[n] != '\n') n++;
+        draw_text_run(x, y, s, n, fg, bg);
+        s += n;
         if (*s == '\n') {
-            cx = x;
-            y += 16;
-        } else {
-            fb_draw_char(cx, y, *s, fg, bg);
-            cx += 8;
+            y += TEXT_GLYPH_H;
+            s++;
         }
-        s++;
     }
 }
 
 void fb_blit(int dx, int dy, int w, int h, const uint32_t *src)
 {
-    for (int row = 0; row < h; row++) {
-        for (int col = 0; col < w; col++) {
-            fb_putpixel(dx + col, dy + row, src[row * w + col]);
+    const draw_ctx_t *c = cur_ctx();
+    int x0, y0, x1, y1;
+    if (!clip_to(c, dx, dy, w, h, &x0, &y0, &x1, &y1)) return;
+    for (int row = y0; row < y1; row++)
+        raster_ops.copy(ctx_row(c, row) + x0,
+                        src + (uint64_t)(row - dy) * w + (x0 - dx), x1 - x0);
+}
+
+/* Nearest-neighbour scale of a sw*sh image onto the dw*dh rect at
+ * (dx, dy).  16.16 fixed-point steps replace the per-pixel divides;
+ * clipped pixels are skipped by starting the accumulators part-way.  */
+void fb_blit_scaled(int dx, int dy, int dw, int dh,
+                    const uint32_t *src, int sw, int sh)
+{
+    if (dw <= 0 || dh <= 0 || sw <= 0 || sh <= 0) return;
+    if (dw == sw && dh == sh) { fb_blit(dx, dy, sw, sh, src); return; }
+
+    const draw_ctx_t *c = cur_ctx();
+    int x0, y0, x1, y1;
+    if (!clip_to(c, dx, dy, dw, dh, &x0, &y0, &x1, &y1)) return;
+
+    uint32_t step_x = (uint32_t)(((uint64_t)sw << 16) / (uint32_t)dw);
+    uint32_t step_y = (uint32_t)(((uint64_t)sh << 16) / (uint32_t)dh);
+    uint32_t u0 = (uint32_t)(x0 - dx) * step_x;
+    uint32_t v  = (uint32_t)(y0 - dy) * step_y;
+
+    for (int row = y0; row < y1; row++, v += step_y) {
+        uint32_t sy = v >> 16;
+        if (sy >= (uint32_t)sh) sy = (uint32_t)sh - 1;
+        const uint32_t *s = src + (uint64_t)sy * sw;
+        uint32_t *d = ctx_row(c, row);
+        uint32_t u = u0;
+        for (int col = x0; col < x1; col++, u += step_x) {
+            uint32_t sx = u >> 16;
+            d[col] = s[sx < (uint32_t)sw ? sx : (uint32_t)sw - 1];
         }
     }
 }
 
+/* Blend a w*h source image over the target with constant alpha */
+void fb_blend_blit(int dx, int dy, int w, int h, const uint32_t *src, uint8_t alpha)
+{
+    const draw_ctx_t *c = cur_ctx();
+    int x0, y0, x1, y1;
+    if (alpha == 0 || !clip_to(c, dx, dy, w, h, &x0, &y0, &x1, &y1)) return;
+    for (int row = y0; row < y1; row++)
+        raster_ops.blend_span(ctx_row(c, row) + x0,
+                              src + (uint64_t)(row - dy) * w + (x0 - dx),
+                              alpha, x1 - x0);
+}
+
 framebuffer_t *fb_get(void)
 {
     return &fb;
@@ -16,18 +16,34 @@ typedef struct {
     uint32_t  bpp;          /* Bits per pixel */
 } framebuffer_t;
 
+/* Screen-space rectangle (used for clipping and partial swaps) */
+typedef struct {
+    int x, y;
+    int w, h;
+} fb_rect_t;
+
 void      fb_init(uint64_t addr, uint32_t w, uint32_t h, uint32_t pitch, uint32_t bpp);
 int       fb_set_resolution(uint32_t w, uint32_t h);
 void      fb_swap(void);
+void      fb_swap_rects(const fb_rect_t *rects, int count);
+int       fb_page_flipping(void);   /* Nonzero: backbuffer is a VRAM page one frame behind */
+void      fb_set_clip(int x, int y, int w, int h);
+void      fb_reset_clip(void);
+void      fb_get_clip(fb_rect_t *out);
+void      fb_set_target(uint32_t *buf, uint32_t w, uint32_t h);  /* Draw off-screen */
+void      fb_reset_target(void);
 void      fb_clear(uint32_t color);
 void      fb_putpixel(int x, int y, uint32_t color);
 uint32_t  fb_getpixel(int x, int y);
 void      fb_fill_rect(int x, int y, int w, int h, uint32_t color);
+void      fb_blend_rect(int x, int y, int w, int h, uint32_t color, uint8_t alpha);
 void      fb_draw_rect(int x, int y, int w, int h, uint32_t color);
 void      fb_draw_line(int x0, int y0, int x1, int y1, uint32_t color);
 void      fb_draw_char(int x, int y, char c, uint32_t fg, uint32_t bg);
 void      fb_draw_string(int x, int y, const char *s, uint32_t fg, uint32_t bg);
 void      fb_blit(int dx, int dy, int w, int h, const uint32_t *src);
+void      fb_blit_scaled(int dx, int dy, int dw, int dh, const uint32_t *src, int sw, int sh);
+void      fb_blend_blit(int dx, int dy, int w, int h, const uint32_t *src, uint8_t alpha);
 
 framebuffer_t *fb_get(void);
 
@@ -36,12 +52,16 @@ static inline uint32_t rgb(uint8_t r, uint8_t g, uint8_t b) {
     return (uint32_t)((r << 16) | (g << 8) | b);
 }
 
+/* Exact v / 255 for v <= 65535 without a divide */
+static inline uint32_t div255(uint32_t v) {
+    return (v + 1 + (v >> 8)) >> 8;
+}
+
 static inline uint32_t rgba_blend(uint32_t bg, uint32_t fg, uint8_t alpha) {
-    uint8_t sr = (fg >> 16) & 0xFF, sg = (fg >> 8) & 0xFF, sb = fg & 0xFF;
-    uint8_t dr = (bg >> 16) & 0xFF, dg = (bg >> 8) & 0xFF, db = bg & 0xFF;
-    uint8_t rr = (sr * alpha + dr * (255 - alpha)) / 255;
-    uint8_t rg = (sg * alpha + dg * (255 - alpha)) / 255;
-    uint8_t rb = (sb * alpha + db * (255 - alpha)) / 255;
+    uint32_t ia = 255 - alpha;
+    uint8_t rr = (uint8_t)div255(((fg >> 16) & 0xFF) * alpha + ((bg >> 16) & 0xFF) * ia);
+    uint8_t rg = (uint8_t)div255(((fg >> 8) & 0xFF) * alpha + ((bg >> 8) & 0xFF) * ia);
+    uint8_t rb = (uint8_t)div255((fg & 0xFF) * alpha + (bg & 0xFF) * ia);
     return rgb(rr, rg, rb);
 }
 
@@ -0,0 +1,206 @@
+/*
+ * nextOS - raster.c
+ * SIMD row kernels behind the framebuffer primitives (SSE2 / AVX2)
+ *
+ * Written with GCC vector extensions so no intrinsic headers are needed
+ * in the freestanding build.  SSE2 is baseline on x86_64; the AVX2 set
+ * is compiled with a target attribute and only installed when CPUID and
+ * XCR0 say the YMM state is usable.
+ */
+#include "raster.h"
+#include "framebuffer.h"
+#include "../arch/x86_64/cpu.h"
+
+typedef uint8_t  v16u8   __attribute__((vector_size(16)));
+typedef uint16_t v8u16   __attribute__((vector_size(16)));
+typedef uint32_t v4u32   __attribute__((vector_size(16)));
+typedef uint8_t  v32u8   __attribute__((vector_size(32)));
+typedef uint16_t v16u16  __attribute__((vector_size(32)));
+typedef uint32_t v8u32   __attribute__((vector_size(32)));
+
+/* Unaligned-access variants: rows start at arbitrary pixel offsets */
+typedef uint32_t v4u32u  __attribute__((vector_size(16), aligned(4)));
+typedef uint32_t v8u32u  __attribute__((vector_size(32), aligned(4)));
+
+#define RGB_MASK 0x00FFFFFFu
+
+/* ── Byte <-> word shuffles ───────────────────────────────────────────── */
+/* Interleave with zero to widen bytes to words (punpck{l,h}bw), and pick
+ * the low bytes back out (packuswb).  The 256-bit forms stay within each
+ * 128-bit lane, matching vpunpck and vpackuswb, so no lane crossing.   */
+#define SSE_UNPACK_LO (v16u8){0,16,1,17,2,18,3,19,4,20,5,21,6,22,7,23}
+#define SSE_UNPACK_HI (v16u8){8,24,9,25,10,26,11,27,12,28,13,29,14,30,15,31}
+#define SSE_PACK      (v16u8){0,2,4,6,8,10,12,14,16,18,20,22,24,26,28,30}
+
+#define AVX_UNPACK_LO (v32u8){0,32,1,33,2,34,3,35,4,36,5,37,6,38,7,39, \
+                              16,48,17,49,18,50,19,51,20,52,21,53,22,54,23,55}
+#define AVX_UNPACK_HI (v32u8){8,40,9,41,10,42,11,43,12,44,13,45,14,46,15,47, \
+                              24,56,25,57,26,58,27,59,28,60,29,61,30,62,31,63}
+#define AVX_PACK      (v32u8){0,2,4,6,8,10,12,14,32,34,36,38,40,42,44,46, \
+                              16,18,20,22,24,26,28,30,48,50,52,54,56,58,60,62}
+
+/* ── Scalar tails ─────────────────────────────────────────────────────── */
+static inline void fill_tail(uint32_t *dst, uint32_t color, int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = color;
+}
+
+static inline void copy_tail(uint32_t *dst, const uint32_t *src, int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = src[i];
+}
+
+static inline void blend_color_tail(uint32_t *dst, uint32_t color, uint8_t alpha, int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = rgba_blend(dst[i], color, alpha);
+}
+
+static inline void blend_span_tail(uint32_t *dst, const uint32_t *src, uint8_t alpha, int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = rgba_blend(dst[i], src[i], alpha);
+}
+
+/* ── SSE2: 4 pixels per vector ────────────────────────────────────────── */
+static inline v8u16 div255_x8(v8u16 v)
+{
+    return (v + 1 + (v >> 8)) >> 8;
+}
+
+static void sse2_fill(uint32_t *dst, uint32_t color, int n)
+{
+    v4u32 c = (v4u32){0, 0, 0, 0} + color;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        *(v4u32u *)(dst + i) = c;
+    fill_tail(dst + i, color, n - i);
+}
+
+static void sse2_copy(uint32_t *dst, const uint32_t *src, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        v4u32 a = *(const v4u32u *)(src + i);
+        v4u32 b = *(const v4u32u *)(src + i + 4);
+        *(v4u32u *)(dst + i)     = a;
+        *(v4u32u *)(dst + i + 4) = b;
+    }
+    copy_tail(dst + i, src + i, n - i);
+}
+
+static void sse2_blend_color(uint32_t *dst, uint32_t color, uint8_t alpha, int n)
+{
+    const v16u8 z = {0};
+    v8u16 ia = (v8u16){0} + (uint16_t)(255 - alpha);
+    /* Source term is constant: premultiply it once */
+    v16u8 cs = (v16u8)((v4u32){0, 0, 0, 0} + color);
+    v8u16 term = (v8u16)__builtin_shuffle(cs, z, SSE_UNPACK_LO) * alpha;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        v16u8 d = (v16u8)*(v4u32u *)(dst + i);
+        v8u16 lo = div255_x8(term + (v8u16)__builtin_shuffle(d, z, SSE_UNPACK_LO) * ia);
+        v8u16 hi = div255_x8(term + (v8u16)__builtin_shuffle(d, z, SSE_UNPACK_HI) * ia);
+        v16u8 r = __builtin_shuffle((v16u8)lo, (v16u8)hi, SSE_PACK);
+        *(v4u32u *)(dst + i) = (v4u32)r & RGB_MASK;
+    }
+    blend_color_tail(dst + i, color, alpha, n - i);
+}
+
+static void sse2_blend_span(uint32_t *dst, const uint32_t *src, uint8_t alpha, int n)
+{
+    const v16u8 z = {0};
+    v8u16 a  = (v8u16){0} + alpha;
+    v8u16 ia = (v8u16){0} + (uint16_t)(255 - alpha);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        v16u8 d = (v16u8)*(v4u32u *)(dst + i);
+        v16u8 s = (v16u8)*(const v4u32u *)(src + i);
+        v8u16 lo = div255_x8((v8u16)__builtin_shuffle(s, z, SSE_UNPACK_LO) * a +
+                             (v8u16)__builtin_shuffle(d, z, SSE_UNPACK_LO) * ia);
+        v8u16 hi = div255_x8((v8u16)__builtin_shuffle(s, z, SSE_UNPACK_HI) * a +
+                             (v8u16)__builtin_shuffle(d, z, SSE_UNPACK_HI) * ia);
+        v16u8 r = __builtin_shuffle((v16u8)lo, (v16u8)hi, SSE_PACK);
+        *(v4u32u *)(dst + i) = (v4u32)r & RGB_MASK;
+    }
+    blend_span_tail(dst + i, src + i, alpha, n - i);
+}
+
+/* ── AVX2: 8 pixels per vector ────────────────────────────────────────── */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline v16u16 div255_x16(v16u16 v)
+{
+    return (v + 1 + (v >> 8)) >> 8;
+}
+
+AVX2 static void avx2_fill(uint32_t *dst, uint32_t color, int n)
+{
+    v8u32 c = (v8u32){0, 0, 0, 0, 0, 0, 0, 0} + color;
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        *(v8u32u *)(dst + i) = c;
+    fill_tail(dst + i, color, n - i);
+}
+
+AVX2 static void avx2_copy(uint32_t *dst, const uint32_t *src, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        v8u32 a = *(const v8u32u *)(src + i);
+        v8u32 b = *(const v8u32u *)(src + i + 8);
+        *(v8u32u *)(dst + i)     = a;
+        *(v8u32u *)(dst + i + 8) = b;
+    }
+    copy_tail(dst + i, src + i, n - i);
+}
+
+AVX2 static void avx2_blend_color(uint32_t *dst, uint32_t color, uint8_t alpha, int n)
+{
+    const v32u8 z = {0};
+    v16u16 ia = (v16u16){0} + (uint16_t)(255 - alpha);
+    v32u8 cs = (v32u8)((v8u32){0, 0, 0, 0, 0, 0, 0, 0} + color);
+    v16u16 term = (v16u16)__builtin_shuffle(cs, z, AVX_UNPACK_LO) * alpha;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        v32u8 d = (v32u8)*(v8u32u *)(dst + i);
+        v16u16 lo = div255_x16(term + (v16u16)__builtin_shuffle(d, z, AVX_UNPACK_LO) * ia);
+        v16u16 hi = div255_x16(term + (v16u16)__builtin_shuffle(d, z, AVX_UNPACK_HI) * ia);
+        v32u8 r = __builtin_shuffle((v32u8)lo, (v32u8)hi, AVX_PACK);
+        *(v8u32u *)(dst + i) = (v8u32)r & RGB_MASK;
+    }
+    blend_color_tail(dst + i, color, alpha, n - i);
+}
+
+AVX2 static void avx2_blend_span(uint32_t *dst, const uint32_t *src, uint8_t alpha, int n)
+{
+    const v32u8 z = {0};
+    v16u16 a  = (v16u16){0} + alpha;
+    v16u16 ia = (v16u16){0} + (uint16_t)(255 - alpha);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        v32u8 d = (v32u8)*(v8u32u *)(dst + i);
+        v32u8 s = (v32u8)*(const v8u32u *)(src + i);
+        v16u16 lo = div255_x16((v16u16)__builtin_shuffle(s, z, AVX_UNPACK_LO) * a +
+                               (v16u16)__builtin_shuffle(d, z, AVX_UNPACK_LO) * ia);
+        v16u16 hi = div255_x16((v16u16)__builtin_shuffle(s, z, AVX_UNPACK_HI) * a +
+                               (v16u16)__builtin_shuffle(d, z, AVX_UNPACK_HI) * ia);
+        v32u8 r = __builtin_shuffle((v32u8)lo, (v32u8)hi, AVX_PACK);
+        *(v8u32u *)(dst + i) = (v8u32)r & RGB_MASK;
+    }
+    blend_span_tail(dst + i, src + i, alpha, n - i);
+}
+
+/* ── Dispatch ─────────────────────────────────────────────────────────── */
+raster_ops_t raster_ops = {
+    "sse2", sse2_fill, sse2_copy, sse2_blend_color, sse2_blend_span
+};
+
+void raster_init(void)
+{
+    if (cpu_has(CPU_FEAT_AVX2)) {
+        raster_ops.name        = "avx2";
+        raster_ops.fill        = avx2_fill;
+        raster_ops.copy        = avx2_copy;
+        raster_ops.blend_color = avx2_blend_color;
+        raster_ops.blend_span  = avx2_blend_span;
+    }
+}
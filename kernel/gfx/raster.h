@@ -0,0 +1,26 @@
+/*
+ * nextOS - raster.h
+ * SIMD row kernels behind the framebuffer primitives (SSE2 / AVX2)
+ */
+#ifndef NEXTOS_RASTER_H
+#define NEXTOS_RASTER_H
+
+#include <stdint.h>
+
+/* Row kernels operate on n contiguous pixels and do no clipping: callers
+ * clip once per rectangle and invoke a kernel per row.  Blends follow
+ * rgba_blend(dst, src, alpha) exactly, including the zeroed top byte.  */
+typedef struct {
+    const char *name;
+    void (*fill)(uint32_t *dst, uint32_t color, int n);
+    void (*copy)(uint32_t *dst, const uint32_t *src, int n);
+    void (*blend_color)(uint32_t *dst, uint32_t color, uint8_t alpha, int n);
+    void (*blend_span)(uint32_t *dst, const uint32_t *src, uint8_t alpha, int n);
+} raster_ops_t;
+
+extern raster_ops_t raster_ops;
+
+/* Select the widest kernels the CPU supports (call after cpu_init) */
+void raster_init(void);
+
+#endif /* NEXTOS_RASTER_H */
@@ -0,0 +1,148 @@
+/*
+ * nextOS - text.c
+ * Glyph atlas text engine
+ *
+ * At init every glyph is expanded once into per-pixel coverage levels:
+ * 0 = empty, 1..4 = fringe (number of set 4-neighbours), 5 = set.  A
+ * run of glyphs then resolves the levels to colours once, clips once,
+ * and writes each glyph row only across its non-empty span.
+ */
+#include "text.h"
+
+#define TEXT_GLYPHS   95
+#define LEVEL_SET     5
+#define LEVEL_COUNT   6
+#define FRINGE_ALPHA  40    /* Per neighbour, as the old per-pixel path */
+
+extern const uint8_t font_8x16[TEXT_GLYPHS][16];
+
+typedef struct {
+    uint8_t level[TEXT_GLYPH_H][TEXT_GLYPH_W];
+    uint8_t lo[TEXT_GLYPH_H], hi[TEXT_GLYPH_H];   /* Non-empty span [lo, hi) */
+} glyph_t;
+
+/* [0] anti-aliased, [1] solid */
+static glyph_t atlas[2][TEXT_GLYPHS];
+static int     atlas_ready = 0;
+
+/* ── Atlas ────────────────────────────────────────────────────────────── */
+static void build_glyph(glyph_t *g, const uint8_t *bits, int aa)
+{
+    for (int row = 0; row < TEXT_GLYPH_H; row++) {
+        uint8_t cur   = bits[row];
+        uint8_t above = row > 0  ? bits[row - 1] : 0;
+        uint8_t below = row < 15 ? bits[row + 1] : 0;
+        int lo = TEXT_GLYPH_W, hi = 0;
+        for (int col = 0; col < TEXT_GLYPH_W; col++) {
+            uint8_t mask = 0x80 >> col;
+            int level = 0;
+            if (cur & mask) {
+                level = LEVEL_SET;
+            } else if (aa) {
+                if (above & mask) level++;
+                if (below & mask) level++;
+                if (col > 0 && (cur & (mask << 1))) level++;
+                if (col < 7 && (cur & (mask >> 1))) level++;
+            }
+            g->level[row][col] = (uint8_t)level;
+            if (level) {
+                if (col < lo) lo = col;
+                hi = col + 1;
+            }
+        }
+        g->lo[row] = (uint8_t)(lo < hi ? lo : 0);
+        g->hi[row] = (uint8_t)hi;
+    }
+}
+
+void text_init(void)
+{
+    if (atlas_ready) return;
+    for (int i = 0; i < TEXT_GLYPHS; i++) {
+        build_glyph(&atlas[0][i], font_8x16[i], 1);
+        build_glyph(&atlas[1][i], font_8x16[i], 0);
+    }
+    atlas_ready = 1;
+}
+
+/* ── Drawing ──────────────────────────────────────────────────────────── */
+static void draw_run(uint32_t *buf, int stride, const fb_rect_t *clip,
+                     int x, int y, const char *s, int len,
+                     uint32_t fg, uint32_t bg, int solid)
+{
+    int cx0 = clip->x, cx1 = clip->x + clip->w;
+    int r0 = clip->y - y > 0 ? clip->y - y : 0;
+    int r1 = clip->y + clip->h - y < TEXT_GLYPH_H ? clip->y + clip->h - y : TEXT_GLYPH_H;
+    if (r0 >= r1 || x >= cx1) return;
+
+    /* Glyphs entirely outside the clip are skipped without a look */
+    int first = x < cx0 ? (cx0 - x) / TEXT_GLYPH_W : 0;
+    int last  = (cx1 - x + TEXT_GLYPH_W - 1) / TEXT_GLYPH_W;
+    if (last > len) last = len;
+
+    /* Fringe colours against a known background are the same for every
+     * pixel of the run                                                 */
+    uint32_t lut[LEVEL_COUNT];
+    if (bg) {
+        lut[0] = bg;
+        for (int l = 1; l < LEVEL_SET; l++)
+            lut[l] = rgba_blend(bg, fg, (uint8_t)(l * FRINGE_ALPHA));
+        lut[LEVEL_SET] = fg;
+    }
+
+    for (int i = first; i < last; i++) {
+        int gx = x + i * TEXT_GLYPH_W;
+        int c0 = cx0 - gx > 0 ? cx0 - gx : 0;
+        int c1 = cx1 - gx < TEXT_GLYPH_W ? cx1 - gx : TEXT_GLYPH_W;
+        unsigned char ch = (unsigned char)s[i];
+        const glyph_t *g = ch >= 32 && ch <= 126 ? &atlas[solid][ch - 32] : (void *)0;
+
+        for (int row = r0; row < r1; row++) {
+            uint32_t *dst = buf + (int64_t)(y + row) * stride + gx;
+            if (bg) {
+                if (!g) {
+                    for (int col = c0; col < c1; col++) dst[col] = bg;
+                } else {
+                    const uint8_t *lv = g->level[row];
+                    for (int col = c0; col < c1; col++) dst[col] = lut[lv[col]];
+                }
+                continue;
+            }
+            if (!g) break;
+            int lo = g->lo[row] > c0 ? g->lo[row] : c0;
+            int hi = g->hi[row] < c1 ? g->hi[row] : c1;
+            const uint8_t *lv = g->level[row];
+            for (int col = lo; col < hi; col++) {
+                uint8_t l = lv[col];
+                if (l == LEVEL_SET)
+                    dst[col] = fg;
+                else if (l)
+                    dst[col] = rgba_blend(dst[col], fg, (uint8_t)(l * FRINGE_ALPHA));
+            }
+        }
+    }
+}
+
+void text_draw(uint32_t *buf, int stride, const fb_rect_t *clip,
+               int x, int y, const char *s, int len,
+               uint32_t fg, uint32_t bg, int flags)
+{
+    if (!buf || !s || clip->w <= 0 || clip->h <= 0) return;
+    if (!atlas_ready) text_init();
+    if (len < 0) {
+        len = 0;
+        while (s[len]) len++;
+    }
+    int solid = (flags & TEXT_SOLID) ? 1 : 0;
+    draw_run(buf, stride, clip, x, y, s, len, fg, bg, solid);
+    if (flags & TEXT_BOLD)
+        draw_run(buf, stride, clip, x + 1, y, s, len, fg, 0, solid);
+}
+
+void text_draw_canvas(uint32_t *canvas, int cw, int ch,
+                      int x, int y, const char *s, int len,
+                      uint32_t fg, int flags)
+{
+    fb_rect_t clip = { 0, 0, cw, ch };
+    text_draw(canvas, cw, &clip, x, y, s, len, fg, 0, flags);
+}
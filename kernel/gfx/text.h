@@ -0,0 +1,35 @@
+/*
+ * nextOS - text.h
+ * Glyph atlas text engine for the built-in 8x16 font
+ */
+#ifndef NEXTOS_TEXT_H
+#define NEXTOS_TEXT_H
+
+#include <stdint.h>
+#include "framebuffer.h"
+
+#define TEXT_GLYPH_W  8
+#define TEXT_GLYPH_H  16
+
+/* Style flags */
+#define TEXT_AA     0   /* Bitmap plus a soft fringe next to set pixels */
+#define TEXT_SOLID  1   /* Bitmap only                                  */
+#define TEXT_BOLD   2   /* Second pass one pixel to the right           */
+
+/* Build the coverage atlas from font_8x16 */
+void text_init(void);
+
+/* Draw len glyphs (len < 0: up to the NUL) from (x, y) into a buffer of
+ * the given stride, limited to clip.  bg == 0 leaves the background
+ * untouched; otherwise each cell is filled with bg and the fringe
+ * blends towards it.  Characters outside 32..126 leave blank cells.   */
+void text_draw(uint32_t *buf, int stride, const fb_rect_t *clip,
+               int x, int y, const char *s, int len,
+               uint32_t fg, uint32_t bg, int flags);
+
+/* Transparent text into an app canvas of cw * ch pixels */
+void text_draw_canvas(uint32_t *canvas, int cw, int ch,
+                      int x, int y, const char *s, int len,
+                      uint32_t fg, int flags);
+
+#endif /* NEXTOS_TEXT_H */
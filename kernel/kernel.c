@@ -7,18 +7,28 @@
  */
 #include "arch/x86_64/gdt.h"
 #include "arch/x86_64/idt.h"
+#include "arch/x86_64/cpu.h"
+#include "arch/x86_64/acpi.h"
+#include "arch/x86_64/smp.h"
+#include "sched/kthread.h"
 #include "mem/pmm.h"
 #include "mem/heap.h"
 #include "mem/paging.h"
 #include "drivers/keyboard.h"
 #include "drivers/mouse.h"
 #include "drivers/disk.h"
+#include "drivers/bcache.h"
 #include "drivers/timer.h"
 #include "drivers/net.h"
+#include "drivers/serial.h"
 #include "gfx/framebuffer.h"
 #include "fs/vfs.h"
+#include "fs/ramfs.h"
+#include "fs/diskimg.h"
 #include "net/net_stack.h"
+#include "net/pcap.h"
 #include "ui/compositor.h"
+#include "bench/bench.h"
 #include "../apps/settings/settings.h"
 #include "../apps/explorer/explorer.h"
 #include "../apps/notepad/notepad.h"
@@ -33,6 +43,8 @@
 #define MB2_TAG_BASIC_MEMINFO 4
 #define MB2_TAG_MMAP         6
 #define MB2_TAG_FRAMEBUFFER  8
+#define MB2_TAG_ACPI_OLD     14
+#define MB2_TAG_ACPI_NEW     15
 
 typedef struct {
     uint32_t type;
@@ -61,6 +73,7 @@ typedef struct {
 #define KERNEL_HEAP_START  0x400000    /* 4 MiB */
 #define KERNEL_HEAP_SIZE   0x4000000   /* 64 MiB */
 #define FALLBACK_FB_ADDR   0xFD000000  /* Common QEMU framebuffer address */
+#define FRAME_PERIOD_NS    (1000000000ULL / 120)
 
 /* ── Installer / first boot state ─────────────────────────────────────── */
 static int installer_active = 1;
@@ -69,21 +82,17 @@ static int install_progress = 0;
 static int install_disk_found = 0;
 static uint64_t install_disk_sectors = 0;
 static uint32_t install_sectors_written = 0;
+static int install_failed = 0;
+static int install_thread_id = -1;
 
 /* Embedded bootable disk image (generated at build time, linked in via objcopy).
- * Contains GRUB MBR + core.img + ext2 partition with the kernel ELF.
+ * Contains GRUB MBR + core.img + ext2 partition with the kernel ELF, packed
+ * by tools/lz4img (see fs/diskimg.h; a raw image is accepted as well).
  * Weak symbols so the base-kernel link (pass 1) succeeds without the blob.
  * Symbol names are auto-generated by objcopy from the filename "diskimg.bin". */
 extern const uint8_t _binary_diskimg_bin_start[] __attribute__((weak));
 extern const uint8_t _binary_diskimg_bin_end[]   __attribute__((weak));
 
-/* How many 512-byte sectors the embedded disk image occupies */
-#define DISK_IMG_SECTORS \
-    ((uint32_t)((_binary_diskimg_bin_end - _binary_diskimg_bin_start) / 512))
-
-/* Sectors written per frame during installation (~16 KiB per frame) */
-#define INSTALL_BATCH_SECTORS 32
-
 /* Progress value that signals installation is finished (exceeds 100%) */
 #define INSTALL_DONE 101
 
@@ -96,7 +105,7 @@ extern const uint8_t _binary_diskimg_bin_end[]   __attribute__((weak));
 
 static void write_install_marker(void);
 static int  check_install_marker(void);
-static void install_write_image(void);
+static void install_thread(void *arg);
 
 /* ── Draw a cursor arrow (used on the installer screen) ───────────────── */
 /* Now uses the same bitmap cursor as the desktop compositor */
@@ -269,9 +278,15 @@ static void draw_installer(void)
 
     } else if (installer_step == 3) {
         /* ── Installation complete ────────────────────────────────── */
-        fb_draw_string(px + 30, py + 30, "Installation Complete!", 0x206020, 0x00000000);
-        fb_draw_string(px + 30, py + 60, "nextOS has been installed.", 0x404050, 0x00000000);
-        fb_draw_string(px + 30, py + 80, "You may now boot from disk.", 0x404050, 0x00000000);
+        if (install_failed) {
+            fb_draw_string(px + 30, py + 30, "Installation Failed", 0xA02020, 0x00000000);
+            fb_draw_string(px + 30, py + 60, "The disk image could not be written.", 0x404050, 0x00000000);
+            fb_draw_string(px + 30, py + 80, "Continuing to live desktop.", 0x404050, 0x00000000);
+        } else {
+            fb_draw_string(px + 30, py + 30, "Installation Complete!", 0x206020, 0x00000000);
+            fb_draw_string(px + 30, py + 60, "nextOS has been installed.", 0x404050, 0x00000000);
+            fb_draw_string(px + 30, py + 80, "You may now boot from disk.", 0x404050, 0x00000000);
+        }
         fb_draw_string(px + 30, py + 100, "Click below to start.", 0x404050, 0x00000000);
 
         inst_draw_button(px + (pw - 200) / 2, py + 180, 200, 44,
@@ -324,10 +339,13 @@ static void handle_installer_input(void)
         }
     } else if (installer_step == 2) {
         /* Write the embedded disk image and install marker to the target disk.
-         * Progress is driven by install_write_image(), which writes a batch
-         * of sectors per frame and updates install_progress (0–100).          */
+         * install_thread does the writing and updates install_progress
+         * (0–100) while this loop keeps drawing frames.                */
         if (install_disk_found) {
-            install_write_image();
+            if (install_thread_id < 0) {
+                install_thread_id = kthread_create("installer", install_thread, (void *)0);
+                if (install_thread_id < 0) install_thread((void *)0);  /* Here, then */
+            }
         } else {
             /* No disk — just fake progress */
             install_progress++;
@@ -376,7 +394,8 @@ static void write_install_marker(void)
     marker_sector[6] = (INSTALL_MAGIC_1 >> 16) & 0xFF;
     marker_sector[7] = (INSTALL_MAGIC_1 >> 24) & 0xFF;
 
-    disk_write(disk, INSTALL_MARKER_SECTOR, 1, marker_sector);
+    bcache_write(disk, INSTALL_MARKER_SECTOR, 1, marker_sector);
+    bcache_sync();
 }
 
 static int check_install_marker(void)
@@ -385,7 +404,7 @@ static int check_install_marker(void)
     if (!disk) return 0;
 
     static uint8_t buf[512];
-    if (disk_read(disk, INSTALL_MARKER_SECTOR, 1, buf) < 0)
+    if (bcache_read(disk, INSTALL_MARKER_SECTOR, 1, buf) < 0)
         return 0;
 
     uint32_t m0 = (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
@@ -398,45 +417,49 @@ static int check_install_marker(void)
 
 /* ── Write the embedded disk image to the target disk ─────────────────── */
 /*
- * Called once per frame while installer_step == 2.  Writes a batch of
- * sectors each invocation so the progress bar advances visually.
+ * Runs on its own kernel thread once installer_step reaches 2.  The image
+ * is decoded a run at a time (up to 1 MiB of consecutive non-zero chunks,
+ * all-zero chunks skipped) and each run goes out as one large write, which
+ * bcache passes straight to multi-sector DMA.  The thread yields between
+ * runs so the progress screen keeps rendering.
  */
-
-static void install_write_image(void)
+static void install_thread(void *arg)
 {
+    (void)arg;
     disk_device_t *disk = disk_get_primary();
-    if (!disk) return;
+    diskimg_t img;
 
     /* Guard: if the disk image blob was not linked in (base-kernel pass) */
-    if (!_binary_diskimg_bin_start || !_binary_diskimg_bin_end) {
+    if (!disk || !_binary_diskimg_bin_start || !_binary_diskimg_bin_end) {
         install_progress = INSTALL_DONE;
         return;
     }
-
-    uint32_t total = DISK_IMG_SECTORS;
-    if (total == 0) {
+    if (diskimg_open(&img, _binary_diskimg_bin_start,
+                     (uint64_t)(_binary_diskimg_bin_end - _binary_diskimg_bin_start)) < 0) {
+        install_failed = 1;
         install_progress = INSTALL_DONE;
         return;
     }
 
-    uint32_t batch = INSTALL_BATCH_SECTORS;
-    if (install_sectors_written + batch > total)
-        batch = total - install_sectors_written;
-
-    if (batch > 0) {
-        const uint8_t *src = _binary_diskimg_bin_start +
-                             (uint64_t)install_sectors_written * 512;
-        disk_write(disk, (uint64_t)install_sectors_written, batch, src);
-        install_sectors_written += batch;
+    for (;;) {
+        uint64_t lba;
+        const uint8_t *data;
+        int n = diskimg_next(&img, &lba, &data);
+        if (n < 0 || (n > 0 && bcache_write(disk, lba, (uint32_t)n, data) < 0)) {
+            install_failed = 1;
+            break;
+        }
+        install_sectors_written = img.pos;
+        if (img.sectors)
+            install_progress = (int)((uint64_t)img.pos * 100 / img.sectors);
+        if (n == 0) break;
+        kthread_yield();
     }
+    diskimg_close(&img);
 
-    install_progress = (int)((uint64_t)install_sectors_written * 100 / total);
-
-    if (install_sectors_written >= total) {
-        /* All sectors written — now write the install marker */
-        write_install_marker();
-        install_progress = INSTALL_DONE;
-    }
+    /* All sectors written — now write the install marker */
+    if (!install_failed) write_install_marker();
+    install_progress = INSTALL_DONE;
 }
 
 /* ── System actions (shutdown, restart, about window) ─────────────────── */
@@ -448,6 +471,8 @@ static void install_write_image(void)
 
 static void system_shutdown(void)
 {
+    ramfs_sync();
+    bcache_sync();
     /* QEMU / Bochs ACPI shutdown */
     outw(ACPI_PM1A_CTRL_PORT, ACPI_SLP_TYPa_SLP_EN);
     /* Fallback: Bochs-specific */
@@ -458,6 +483,8 @@ static void system_shutdown(void)
 
 static void system_restart(void)
 {
+    ramfs_sync();
+    bcache_sync();
     /* Pulse the keyboard controller reset line */
     outb(KB_CTRL_PORT, KB_CMD_RESET);
     while (1) __asm__ volatile("cli; hlt");
@@ -591,6 +618,21 @@ static void launch_about(void)
 static uint64_t fb_addr = 0;
 static uint32_t fb_width = 1024, fb_height = 768, fb_pitch = 0, fb_bpp = 32;
 static uint64_t total_memory = 128 * 1024 * 1024; /* default 128 MiB */
+static int      bench_mode = 0;   /* "bench" on the command line */
+
+/* Space-separated flags from the boot loader's command line */
+static void parse_cmdline(const char *s)
+{
+    while (*s) {
+        while (*s == ' ') s++;
+        const char *word = s;
+        while (*s && *s != ' ') s++;
+        int n = (int)(s - word);
+        if (n == 5 && word[0] == 'b' && word[1] == 'e' && word[2] == 'n' &&
+            word[3] == 'c' && word[4] == 'h')
+            bench_mode = 1;
+    }
+}
 
 static void parse_multiboot2(uint64_t mb_info_addr)
 {
@@ -599,6 +641,7 @@ static void parse_multiboot2(uint64_t mb_info_addr)
     uint8_t *ptr = (uint8_t *)mb_info_addr;
     /* Skip total_size (4 bytes) + reserved (4 bytes) */
     ptr += 8;
+    int acpi_seen_new = 0;
 
     while (1) {
         mb2_tag_t *tag = (mb2_tag_t *)ptr;
@@ -613,11 +656,22 @@ static void parse_multiboot2(uint64_t mb_info_addr)
             fb_bpp    = fb_tag->bpp;
         }
 
+        /* NUL-terminated string after the 8-byte tag header */
+        if (tag->type == MB2_TAG_CMDLINE)
+            parse_cmdline((const char *)(ptr + 8));
+
         if (tag->type == MB2_TAG_BASIC_MEMINFO) {
             mb2_tag_meminfo_t *mem = (mb2_tag_meminfo_t *)tag;
             total_memory = ((uint64_t)mem->mem_upper + 1024) * 1024;
         }
 
+        /* RSDP copy follows the 8-byte tag header; prefer the ACPI 2.0 one */
+        if (tag->type == MB2_TAG_ACPI_NEW ||
+            (tag->type == MB2_TAG_ACPI_OLD && !acpi_seen_new)) {
+            acpi_set_rsdp(ptr + 8, tag->size - 8);
+            if (tag->type == MB2_TAG_ACPI_NEW) acpi_seen_new = 1;
+        }
+
         /* Advance to next tag (8-byte aligned) */
         uint32_t advance = (tag->size + 7) & ~7;
         ptr += advance;
@@ -643,6 +697,8 @@ void kernel_main(uint64_t mb_info_addr)
 {
     /* 1. Initialise architecture */
     gdt_init();
+    smp_early_init();  /* Per-CPU block in GS; gdt_init must not run again */
+    cpu_init();   /* CPUID features; enables AVX state before any SIMD use */
     idt_init();
 
     /* 2. Parse Multiboot2 info */
@@ -650,6 +706,7 @@ void kernel_main(uint64_t mb_info_addr)
 
     /* 3. Memory management */
     pmm_init(total_memory);
+    pmm_reserve(KERNEL_HEAP_START, KERNEL_HEAP_SIZE);  /* The heap owns these pages */
     paging_init(total_memory);
     heap_init(KERNEL_HEAP_START, KERNEL_HEAP_SIZE);
 
@@ -662,10 +719,13 @@ void kernel_main(uint64_t mb_info_addr)
     mouse_set_bounds(fb_width, fb_height);
 
     /* 5. Drivers */
+    serial_init();     /* COM1 log output, if there is a UART */
     timer_init(1000);  /* 1 kHz tick */
+    smp_init();        /* Start APs (uses the timer for INIT/SIPI delays) */
     keyboard_init();
     mouse_init();
     disk_init();
+    bcache_init();     /* Block cache + write-back thread over the disk */
     net_init();
 
     /* 6. Filesystem */
@@ -689,7 +749,14 @@ void kernel_main(uint64_t mb_info_addr)
     /* Register app launcher for start menu and desktop icon clicks */
     compositor_set_app_launcher(launch_app_by_index);
 
+    /* Benchmark mode: results on COM1, then power off (see bench/bench.h) */
+    if (bench_mode) {
+        bench_run();
+        system_shutdown();
+    }
+
     /* ── Main loop ─────────────────────────────────────────────────── */
+    uint64_t next_frame = timer_now_ns();
     while (1) {
         /* Process keyboard events */
         key_event_t kev;
@@ -701,6 +768,23 @@ void kernel_main(uint64_t mb_info_addr)
                     continue;
                 }
 
+                /* F12 toggles the frame profiler HUD */
+                if (kev.scancode == KEY_SCANCODE_F12) {
+                    compositor_toggle_hud();
+                    continue;
+                }
+
+                /* F11 starts a packet capture; again saves it as a pcap file */
+                if (kev.scancode == KEY_SCANCODE_F11) {
+                    if (pcap_active()) {
+                        pcap_stop();
+                        pcap_save("/Documents/capture.pcap");
+                    } else {
+                        pcap_start();
+                    }
+                    continue;
+                }
+
                 compositor_handle_key(kev.ascii, kev.scancode, kev.pressed);
 
                 /* Ctrl+1/2/3 to launch apps */
@@ -721,17 +805,22 @@ void kernel_main(uint64_t mb_info_addr)
         } else {
             /* Process input first so positions are up-to-date before rendering */
             compositor_handle_mouse(ms.x, ms.y, ms.buttons, scroll);
-            /* Render all windows, wallpaper, taskbar to backbuffer */
+            /* Re-render only the damaged parts of the scene */
             compositor_render_frame();
             /* Re-read mouse for freshest position, draw cursor into backbuffer,
-             * then swap atomically — cursor is always part of the VRAM copy
-             * so it never flickers (unlike VRAM-direct overlay approach) */
+             * then copy just the dirty rects — cursor is always part of the
+             * VRAM copy so it never flickers (unlike VRAM-direct overlay) */
             ms = mouse_get_state();
-            compositor_draw_cursor(ms.x, ms.y);
-            fb_swap();
+            compositor_present(ms.x, ms.y);
         }
 
-        /* Target ~120 FPS for buttery-smooth experience */
-        timer_sleep_ms(8);
+        /* Pace to 120 FPS against a deadline, sleeping only for what is
+         * left of the frame budget; a late frame starts the next one at
+         * once instead of queueing a burst.  Kernel threads (network
+         * fetches) run while the main loop sleeps.                     */
+        next_frame += FRAME_PERIOD_NS;
+        uint64_t now = timer_now_ns();
+        if (next_frame < now) next_frame = now;
+        kthread_sleep_until(next_frame);
     }
 }
@@ -1,53 +1,490 @@
 /*
  * nextOS - heap.c
- * Simple first-fit heap allocator for the kernel
+ * Kernel heap: size-class slabs in front of a boundary-tag allocator
+ *
+ * Requests up to SLAB_MAX_OBJ bytes are served from per-class slabs:
+ * 16 KiB chunks, aligned to their size, carved into equal objects kept
+ * on an intrusive free list, so alloc and free are a list pop/push.
+ * Larger requests go to the block allocator.  Every block carries its
+ * own size and its physical predecessor's, which makes coalescing on
+ * kfree constant-time; free blocks sit in power-of-two bins so a fit
+ * is found without walking allocated memory.
+ *
+ * Usage counters are kept under the heap lock as allocations come and
+ * go; kmalloc_tagged() additionally records the call site of each live
+ * allocation in a small pointer table so leaks can be attributed.
  */
 #include "heap.h"
+#include "../arch/x86_64/spinlock.h"
 
-typedef struct block_header {
-    size_t               size;
-    int                  free;
-    struct block_header *next;
-} block_header_t;
+/* ── Block allocator ──────────────────────────────────────────────────── */
+typedef struct block {
+    size_t        size;         /* Whole block incl. header; bit 0 = in use */
+    size_t        prev_size;    /* Physical predecessor's size, 0 = first  */
+    struct block *next_free;    /* Free blocks only */
+    struct block *prev_free;
+} block_t;
 
-#define HEADER_SIZE sizeof(block_header_t)
+#define HEADER_SIZE   16
+#define MIN_BLOCK     sizeof(block_t)
+#define BLOCK_USED    1ULL
+#define BIN_COUNT     40
 
-static block_header_t *heap_start = (void *)0;
+static uint8_t  *heap_base = (void *)0;
+static uint8_t  *heap_end  = (void *)0;   /* Address of the end sentinel */
+static block_t  *bins[BIN_COUNT];
+static uint64_t  bin_mask = 0;            /* Bit i set: bins[i] non-empty */
 
+static heap_stats_t stats;
+
+/* Taken with interrupts off: compositor tiles allocate from every CPU */
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+static inline size_t blk_size(const block_t *b)  { return b->size & ~BLOCK_USED; }
+static inline int    blk_used(const block_t *b)  { return (b->size & BLOCK_USED) != 0; }
+static inline block_t *blk_next(block_t *b)      { return (block_t *)((uint8_t *)b + blk_size(b)); }
+static inline block_t *blk_prev(block_t *b)      { return (block_t *)((uint8_t *)b - b->prev_size); }
+static inline void  *blk_payload(block_t *b)     { return (uint8_t *)b + HEADER_SIZE; }
+static inline block_t *payload_blk(void *p)      { return (block_t *)((uint8_t *)p - HEADER_SIZE); }
+
+static int bin_index(size_t size)
+{
+    int i = 63 - __builtin_clzll(size);
+    return i < BIN_COUNT ? i : BIN_COUNT - 1;
+}
+
+static void bin_insert(block_t *b)
+{
+    int i = bin_index(blk_size(b));
+    b->prev_free = (void *)0;
+    b->next_free = bins[i];
+    if (bins[i]) bins[i]->prev_free = b;
+    bins[i] = b;
+    bin_mask |= 1ULL << i;
+    stats.free_blocks++;
+    stats.free_bytes += blk_size(b);
+}
+
+static void bin_remove(block_t *b)
+{
+    int i = bin_index(blk_size(b));
+    if (b->prev_free) b->prev_free->next_free = b->next_free;
+    else              bins[i] = b->next_free;
+    if (b->next_free) b->next_free->prev_free = b->prev_free;
+    if (!bins[i]) bin_mask &= ~(1ULL << i);
+    stats.free_blocks--;
+    stats.free_bytes -= blk_size(b);
+}
+
+/* Set a block's size and keep its successor's back-link in step */
+static void blk_set(block_t *b, size_t size, int used)
+{
+    b->size = size | (used ? BLOCK_USED : 0);
+    blk_next(b)->prev_size = size;
+}
+
+/* Shrink an in-use block to need bytes, returning the tail to the bins */
+static void blk_trim(block_t *b, size_t need)
+{
+    size_t size = blk_size(b);
+    if (size - need < MIN_BLOCK) return;
+    blk_set(b, need, 1);
+    block_t *rest = blk_next(b);
+    rest->prev_size = need;
+    blk_set(rest, size - need, 0);
+    /* An aligned allocation trims twice, so the successor can be the
+     * free tail of the first trim                                      */
+    block_t *after = blk_next(rest);
+    if ((uint8_t *)after < heap_end && !blk_used(after)) {
+        bin_remove(after);
+        blk_set(rest, blk_size(rest) + blk_size(after), 0);
+    }
+    bin_insert(rest);
+}
+
+static size_t block_need(size_t size)
+{
+    size_t need = HEADER_SIZE + ((size + 15) & ~15ULL);
+    return need < MIN_BLOCK ? MIN_BLOCK : need;
+}
+
+static block_t *block_alloc(size_t need)
+{
+    int i = bin_index(need);
+    block_t *b = (void *)0;
+
+    /* First fit within the request's own bin... */
+    for (block_t *c = bins[i]; c; c = c->next_free) {
+        if (blk_size(c) >= need) { b = c; break; }
+    }
+    /* ...else any block of a higher bin is large enough */
+    if (!b) {
+        uint64_t higher = bin_mask & ~((2ULL << i) - 1);
+        if (!higher) return (void *)0;
+        b = bins[__builtin_ctzll(higher)];
+    }
+
+    bin_remove(b);
+    blk_set(b, blk_size(b), 1);
+    blk_trim(b, need);
+    return b;
+}
+
+static void block_free(block_t *b)
+{
+    size_t size = blk_size(b);
+
+    block_t *next = blk_next(b);
+    if ((uint8_t *)next < heap_end && !blk_used(next)) {
+        bin_remove(next);
+        size += blk_size(next);
+    }
+    if (b->prev_size) {
+        block_t *prev = blk_prev(b);
+        if (!blk_used(prev)) {
+            bin_remove(prev);
+            size += blk_size(prev);
+            b = prev;
+        }
+    }
+    blk_set(b, size, 0);
+    bin_insert(b);
+}
+
+/* A block whose payload is aligned to align (a power of two): over-
+ * allocate, then give the unaligned head and the unused tail back.   */
+static block_t *block_alloc_aligned(size_t need, size_t align)
+{
+    block_t *b = block_alloc(need + align + MIN_BLOCK);
+    if (!b) return (void *)0;
+
+    uint64_t p = ((uint64_t)blk_payload(b) + align - 1) & ~(uint64_t)(align - 1);
+    if (p - HEADER_SIZE != (uint64_t)b && p - HEADER_SIZE - (uint64_t)b < MIN_BLOCK)
+        p += align;
+    size_t head = (size_t)(p - HEADER_SIZE - (uint64_t)b);
+    if (head) {
+        /* b's predecessor is in use (free neighbours are always merged),
+         * so the head becomes a free block of its own                 */
+        size_t total = blk_size(b);
+        block_t *a = payload_blk((void *)p);
+        a->prev_size = head;
+        blk_set(a, total - head, 1);
+        blk_set(b, head, 0);
+        bin_insert(b);
+        b = a;
+    }
+    blk_trim(b, need);
+    return b;
+}
+
+/* ── Slab caches ──────────────────────────────────────────────────────── */
+#define SLAB_SIZE       (16 * 1024)
+#define SLAB_MIN_SHIFT  4                   /* 16 B  */
+#define SLAB_MAX_SHIFT  11                  /* 2 KiB */
+#define SLAB_MAX_OBJ    (1u << SLAB_MAX_SHIFT)
+#define SLAB_CLASSES    (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+_Static_assert(SLAB_CLASSES == HEAP_SLAB_CLASSES, "heap.h class count");
+#define SLAB_HEADER     64                  /* Objects start here */
+#define SLAB_MAP_SIZE   16384               /* Chunks covered: 256 MiB of heap */
+
+typedef struct slab {
+    struct slab *next, *prev;   /* Partial list of the cache */
+    void        *free;          /* Free objects, linked through their first word */
+    uint32_t     inuse, total;
+    uint32_t     cls;
+} slab_t;
+
+typedef struct {
+    slab_t *partial;            /* Slabs with at least one free object */
+    slab_t *empty;              /* One fully free slab kept to avoid churn */
+} slab_cache_t;
+
+static slab_cache_t caches[SLAB_CLASSES];
+/* Per 16 KiB chunk of the heap: class + 1 when the chunk is a slab */
+static uint8_t      slab_map[SLAB_MAP_SIZE];
+
+static int size_class(size_t size)
+{
+    if (size <= (1u << SLAB_MIN_SHIFT)) return 0;
+    return (64 - __builtin_clzll(size - 1)) - SLAB_MIN_SHIFT;
+}
+
+static inline size_t class_size(int cls)
+{
+    return (size_t)1 << (cls + SLAB_MIN_SHIFT);
+}
+
+static int chunk_of(const void *p, uint64_t *index)
+{
+    if ((const uint8_t *)p < heap_base || (const uint8_t *)p >= heap_end) return 0;
+    uint64_t i = (uint64_t)((const uint8_t *)p - heap_base) / SLAB_SIZE;
+    if (i >= SLAB_MAP_SIZE) return 0;
+    *index = i;
+    return 1;
+}
+
+static slab_t *slab_of(void *p)
+{
+    uint64_t i;
+    /* Slabs are SLAB_SIZE aligned, and heap_base is too */
+    if (!chunk_of(p, &i) || !slab_map[i]) return (void *)0;
+    return (slab_t *)((uint64_t)p & ~(uint64_t)(SLAB_SIZE - 1));
+}
+
+static void partial_push(slab_cache_t *c, slab_t *s)
+{
+    s->prev = (void *)0;
+    s->next = c->partial;
+    if (c->partial) c->partial->prev = s;
+    c->partial = s;
+}
+
+static void partial_remove(slab_cache_t *c, slab_t *s)
+{
+    if (s->prev) s->prev->next = s->next;
+    else         c->partial = s->next;
+    if (s->next) s->next->prev = s->prev;
+}
+
+static slab_t *slab_new(int cls)
+{
+    block_t *b = block_alloc_aligned(block_need(SLAB_SIZE), SLAB_SIZE);
+    if (!b) return (void *)0;
+    slab_t *s = (slab_t *)blk_payload(b);
+    uint64_t i;
+    if (!chunk_of(s, &i)) {          /* Beyond the chunk map */
+        block_free(b);
+        return (void *)0;
+    }
+    slab_map[i] = (uint8_t)(cls + 1);
+    stats.slab_bytes += SLAB_SIZE;
+
+    size_t osz = class_size(cls);
+    s->cls   = (uint32_t)cls;
+    s->inuse = 0;
+    s->total = (uint32_t)((SLAB_SIZE - SLAB_HEADER) / osz);
+    s->free  = (void *)0;
+    uint8_t *obj = (uint8_t *)s + SLAB_HEADER + (s->total - 1) * osz;
+    for (uint32_t n = 0; n < s->total; n++, obj -= osz) {
+        *(void **)obj = s->free;
+        s->free = obj;
+    }
+    return s;
+}
+
+static void slab_release(slab_t *s)
+{
+    uint64_t i;
+    if (chunk_of(s, &i)) slab_map[i] = 0;
+    stats.slab_bytes -= SLAB_SIZE;
+    block_free(payload_blk(s));
+}
+
+static void *slab_alloc(int cls)
+{
+    slab_cache_t *c = &caches[cls];
+    slab_t *s = c->partial;
+    if (!s) {
+        if (c->empty) {
+            s = c->empty;
+            c->empty = (void *)0;
+        } else if (!(s = slab_new(cls))) {
+            return (void *)0;
+        }
+        partial_push(c, s);
+    }
+    void *obj = s->free;
+    s->free = *(void **)obj;
+    if (++s->inuse == s->total)
+        partial_remove(c, s);
+    return obj;
+}
+
+static void slab_free(slab_t *s, void *obj)
+{
+    slab_cache_t *c = &caches[s->cls];
+    *(void **)obj = s->free;
+    s->free = obj;
+    if (s->inuse-- == s->total)
+        partial_push(c, s);
+    if (s->inuse == 0) {
+        partial_remove(c, s);
+        if (!c->empty) c->empty = s;
+        else           slab_release(s);
+    }
+}
+
+/* ── Statistics ───────────────────────────────────────────────────────── */
+static int hist_bucket(size_t size)
+{
+    int i = (63 - __builtin_clzll(size)) - SLAB_MIN_SHIFT;
+    if (i < 0) i = 0;
+    return i < HEAP_HIST_BUCKETS ? i : HEAP_HIST_BUCKETS - 1;
+}
+
+static void account(size_t usable, int cls, int sign)
+{
+    if (sign > 0) {
+        stats.live_allocs++;
+        stats.total_allocs++;
+        stats.live_bytes += usable;
+        if (stats.live_bytes > stats.peak_bytes) stats.peak_bytes = stats.live_bytes;
+        stats.size_hist[hist_bucket(usable)]++;
+        if (cls >= 0) stats.class_live[cls]++;
+    } else {
+        stats.live_allocs--;
+        stats.total_frees++;
+        stats.live_bytes -= usable;
+        stats.size_hist[hist_bucket(usable)]--;
+        if (cls >= 0) stats.class_live[cls]--;
+    }
+}
+
+/* ── Call-site tracing ────────────────────────────────────────────────── */
+#define TRACE_SLOTS  2048               /* Power of two */
+#define TRACE_TOMB   ((void *)1)
+
+typedef struct {
+    void    *ptr;
+    uint32_t size;
+    uint16_t site;
+} trace_slot_t;
+
+static heap_site_t  sites[HEAP_TRACE_SITES];
+static int          site_count = 0;
+static trace_slot_t trace[TRACE_SLOTS];
+static trace_slot_t trace_scratch[TRACE_SLOTS / 2];
+static uint32_t     trace_live = 0;
+static uint32_t     trace_tombs = 0;
+
+static uint32_t trace_hash(const void *p)
+{
+    uint64_t v = (uint64_t)p >> 4;
+    v *= 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(v >> 40) & (TRACE_SLOTS - 1);
+}
+
+static int site_index(const char *file, int line)
+{
+    for (int i = 0; i < site_count; i++)
+        if (sites[i].line == line && sites[i].file == file) return i;
+    if (site_count >= HEAP_TRACE_SITES) return -1;
+    sites[site_count].file = file;
+    sites[site_count].line = line;
+    return site_count++;
+}
+
+static void trace_add(void *p, size_t size, const char *file, int line)
+{
+    int site = site_index(file, line);
+    if (site < 0 || trace_live >= TRACE_SLOTS / 2) {
+        stats.untraced++;
+        return;
+    }
+    uint32_t h = trace_hash(p);
+    while (trace[h].ptr && trace[h].ptr != TRACE_TOMB)
+        h = (h + 1) & (TRACE_SLOTS - 1);
+    if (trace[h].ptr == TRACE_TOMB) trace_tombs--;
+    trace[h].ptr  = p;
+    trace[h].size = (uint32_t)size;
+    trace[h].site = (uint16_t)site;
+    trace_live++;
+    sites[site].live++;
+    sites[site].bytes += size;
+}
+
+/* Reinsert the live entries into a table without tombstones */
+static void trace_rebuild(void)
+{
+    uint32_t n = 0;
+    for (uint32_t h = 0; h < TRACE_SLOTS; h++) {
+        if (trace[h].ptr && trace[h].ptr != TRACE_TOMB) trace_scratch[n++] = trace[h];
+        trace[h].ptr = (void *)0;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t h = trace_hash(trace_scratch[i].ptr);
+        while (trace[h].ptr) h = (h + 1) & (TRACE_SLOTS - 1);
+        trace[h] = trace_scratch[i];
+    }
+    trace_tombs = 0;
+}
+
+/* Every kfree probes here, tagged or not, so tombstones are swept out
+ * before they leave no empty slot to end an unsuccessful search.    */
+static void trace_remove(void *p)
+{
+    if (!trace_live) return;
+    for (uint32_t h = trace_hash(p), n = 0; trace[h].ptr && n < TRACE_SLOTS;
+         h = (h + 1) & (TRACE_SLOTS - 1), n++) {
+        if (trace[h].ptr != p) continue;
+        heap_site_t *site = &sites[trace[h].site];
+        site->live--;
+        site->bytes -= trace[h].size;
+        trace[h].ptr = TRACE_TOMB;
+        trace_live--;
+        if (++trace_tombs + trace_live > TRACE_SLOTS * 3 / 4) trace_rebuild();
+        return;
+    }
+}
+
+/* ── Public API ───────────────────────────────────────────────────────── */
 void heap_init(uint64_t start, uint64_t size)
 {
-    heap_start = (block_header_t *)start;
-    heap_start->size = size - HEADER_SIZE;
-    heap_start->free = 1;
-    heap_start->next = (void *)0;
+    /* Align the base so slab chunks line up with the chunk map */
+    uint64_t base = (start + SLAB_SIZE - 1) & ~(uint64_t)(SLAB_SIZE - 1);
+    size -= base - start;
+    size &= ~15ULL;
+
+    heap_base = (uint8_t *)base;
+    heap_end  = heap_base + size - HEADER_SIZE;
+    stats.heap_size = size;
+
+    block_t *first = (block_t *)heap_base;
+    block_t *end   = (block_t *)heap_end;
+    first->prev_size = 0;
+    end->size = HEADER_SIZE | BLOCK_USED;       /* Never merged */
+    blk_set(first, size - HEADER_SIZE, 0);
+    bin_insert(first);
+}
+
+/* Called with the heap lock held */
+static void *heap_alloc(size_t size)
+{
+    void *p = (void *)0;
+    if (size <= SLAB_MAX_OBJ) {
+        int cls = size_class(size);
+        p = slab_alloc(cls);
+        if (p) {
+            account(class_size(cls), cls, 1);
+            return p;
+        }
+    }
+    block_t *b = block_alloc(block_need(size));
+    if (!b) {
+        stats.failed_allocs++;
+        return (void *)0;
+    }
+    account(blk_size(b) - HEADER_SIZE, -1, 1);
+    return blk_payload(b);
 }
 
 void *kmalloc(size_t size)
 {
     if (!size) return (void *)0;
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    void *p = heap_alloc(size);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return p; /* NULL: out of memory */
+}
 
-    /* Align to 16 bytes */
-    size = (size + 15) & ~15ULL;
-
-    block_header_t *cur = heap_start;
-    while (cur) {
-        if (cur->free && cur->size >= size) {
-            /* Split if there is enough room for another block */
-            if (cur->size >= size + HEADER_SIZE + 16) {
-                block_header_t *new_blk =
-                    (block_header_t *)((uint8_t *)cur + HEADER_SIZE + size);
-                new_blk->size = cur->size - size - HEADER_SIZE;
-                new_blk->free = 1;
-                new_blk->next = cur->next;
-                cur->next = new_blk;
-                cur->size = size;
-            }
-            cur->free = 0;
-            return (void *)((uint8_t *)cur + HEADER_SIZE);
-        }
-        cur = cur->next;
-    }
-    return (void *)0; /* out of memory */
+void *kmalloc_at(size_t size, const char *file, int line)
+{
+    if (!size) return (void *)0;
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    void *p = heap_alloc(size);
+    if (p) trace_add(p, size, file, line);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return p;
 }
 
 void *kcalloc(size_t count, size_t size)
@@ -64,19 +501,26 @@ void *kcalloc(size_t count, size_t size)
 void kfree(void *ptr)
 {
     if (!ptr) return;
-    block_header_t *blk = (block_header_t *)((uint8_t *)ptr - HEADER_SIZE);
-    blk->free = 1;
-
-    /* Coalesce adjacent free blocks */
-    block_header_t *cur = heap_start;
-    while (cur) {
-        if (cur->free && cur->next && cur->next->free) {
-            cur->size += HEADER_SIZE + cur->next->size;
-            cur->next = cur->next->next;
-            continue; /* re-check current after merge */
-        }
-        cur = cur->next;
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    trace_remove(ptr);
+    slab_t *s = slab_of(ptr);
+    if (s) {
+        account(class_size((int)s->cls), (int)s->cls, -1);
+        slab_free(s, ptr);
+    } else {
+        block_t *b = payload_blk(ptr);
+        account(blk_size(b) - HEADER_SIZE, -1, -1);
+        block_free(b);
     }
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+/* Usable bytes behind an allocation */
+static size_t alloc_size(void *ptr)
+{
+    slab_t *s = slab_of(ptr);
+    if (s) return class_size((int)s->cls);
+    return blk_size(payload_blk(ptr)) - HEADER_SIZE;
 }
 
 void *krealloc(void *ptr, size_t new_size)
@@ -84,15 +528,40 @@ void *krealloc(void *ptr, size_t new_size)
     if (!ptr) return kmalloc(new_size);
     if (!new_size) { kfree(ptr); return (void *)0; }
 
-    block_header_t *blk = (block_header_t *)((uint8_t *)ptr - HEADER_SIZE);
-    if (blk->size >= new_size) return ptr;
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    size_t old_size = alloc_size(ptr);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    if (old_size >= new_size) return ptr;
 
     void *new_ptr = kmalloc(new_size);
     if (new_ptr) {
         uint8_t *src = (uint8_t *)ptr;
         uint8_t *dst = (uint8_t *)new_ptr;
-        for (size_t i = 0; i < blk->size; i++) dst[i] = src[i];
+        for (size_t i = 0; i < old_size; i++) dst[i] = src[i];
         kfree(ptr);
     }
     return new_ptr;
 }
+
+void heap_get_stats(heap_stats_t *out)
+{
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    *out = stats;
+    /* Only the highest non-empty bin can hold the largest block */
+    out->largest_free = 0;
+    if (bin_mask) {
+        for (block_t *b = bins[63 - __builtin_clzll(bin_mask)]; b; b = b->next_free)
+            if (blk_size(b) > out->largest_free) out->largest_free = blk_size(b);
+    }
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+int heap_get_sites(heap_site_t *out, int max)
+{
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    int n = 0;
+    for (int i = 0; i < site_count && n < max; i++)
+        if (sites[i].live) out[n++] = sites[i];
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return n;
+}
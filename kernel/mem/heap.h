@@ -1,6 +1,6 @@
 /*
  * nextOS - heap.h
- * Kernel heap allocator (first-fit free list)
+ * Kernel heap allocator (slab caches + boundary-tag blocks)
  */
 #ifndef NEXTOS_HEAP_H
 #define NEXTOS_HEAP_H
@@ -8,10 +8,44 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#define HEAP_SLAB_CLASSES  8     /* 16 B .. 2 KiB        */
+#define HEAP_HIST_BUCKETS  24    /* 16 B .. 128 MiB, x2  */
+#define HEAP_TRACE_SITES   64
+
+/* Byte counts are usable sizes (size class or block payload), which is
+ * what the heap actually gives up for each allocation.                */
+typedef struct {
+    uint64_t heap_size;
+    uint64_t live_bytes, peak_bytes;
+    uint64_t live_allocs;
+    uint64_t total_allocs, total_frees, failed_allocs;
+    uint64_t slab_bytes;                        /* Held by slabs, incl. free objects */
+    uint64_t free_bytes, free_blocks;           /* Block allocator free space     */
+    uint64_t largest_free;                      /* Biggest single free block      */
+    uint64_t class_live[HEAP_SLAB_CLASSES];     /* Live objects per slab class    */
+    uint64_t size_hist[HEAP_HIST_BUCKETS];      /* Live allocations by log2 size  */
+    uint64_t untraced;                          /* Tagged calls the table dropped */
+} heap_stats_t;
+
+/* Live allocations made through kmalloc_tagged from one call site */
+typedef struct {
+    const char *file;
+    int         line;
+    uint32_t    live;
+    uint64_t    bytes;
+} heap_site_t;
+
 void  heap_init(uint64_t start, uint64_t size);
 void *kmalloc(size_t size);
 void *kcalloc(size_t count, size_t size);
 void  kfree(void *ptr);
 void *krealloc(void *ptr, size_t new_size);
 
+/* kmalloc that attributes the allocation to its call site until freed */
+void *kmalloc_at(size_t size, const char *file, int line);
+#define kmalloc_tagged(size) kmalloc_at((size), __FILE__, __LINE__)
+
+void  heap_get_stats(heap_stats_t *out);
+int   heap_get_sites(heap_site_t *out, int max);   /* Sites with live allocations */
+
 #endif /* NEXTOS_HEAP_H */
@@ -1,16 +1,20 @@
 /*
  * nextOS - paging.c
  * 4-level paging for x86_64 (identity-mapped kernel space)
+ *
+ * boot.S identity-maps the first 4 GiB with 2 MiB pages.  Mappings made
+ * here may use any of the three page sizes; a smaller mapping inside a
+ * large page splits it into a table of the next size down that keeps the
+ * original translation, so neighbouring addresses are unaffected.
  */
 #include "paging.h"
 #include "pmm.h"
+#include "../arch/x86_64/cpu.h"
 
-#define PAGE_PRESENT  0x01
-#define PAGE_WRITE    0x02
-#define PAGE_HUGE     0x80
-
-/* The boot.S already set up identity mapping for the first 1 GiB.
- * Here we extend it as needed and provide an API for further mappings. */
+#define PAGE_HUGE       0x80ULL         /* PS bit in a PDPT/PD entry   */
+#define PAGE_PAT_LARGE  0x1000ULL       /* PAT bit in a PDPT/PD entry  */
+#define ADDR_MASK       0x000FFFFFFFFFF000ULL
+#define TABLE_FLAGS     (PAGE_PRESENT | PAGE_WRITE)
 
 static uint64_t *kernel_pml4;
 
@@ -20,45 +24,144 @@ static void memzero_page(void *page)
     for (int i = 0; i < 512; i++) p[i] = 0;
 }
 
+static inline uint64_t *entry_table(uint64_t e)
+{
+    return (uint64_t *)(e & ADDR_MASK);
+}
+
+/* 4 KiB PTE flags -> large-page entry flags, and back */
+static inline uint64_t large_flags(uint64_t flags)
+{
+    return (flags & ~PAGE_PAT) | PAGE_HUGE | ((flags & PAGE_PAT) ? PAGE_PAT_LARGE : 0);
+}
+
+static inline uint64_t small_flags(uint64_t large)
+{
+    uint64_t f = large & 0xFFFULL & ~PAGE_HUGE;
+    return f | ((large & PAGE_PAT_LARGE) ? PAGE_PAT : 0);
+}
+
+/* Return the table an entry points to, allocating it if absent or
+ * splitting a large page of `size` bytes into 512 smaller ones.      */
+static uint64_t *next_table(uint64_t *entry, uint64_t size)
+{
+    uint64_t e = *entry;
+    if ((e & PAGE_PRESENT) && !(e & PAGE_HUGE))
+        return entry_table(e);
+
+    uint64_t *table = (uint64_t *)pmm_alloc_page();
+    if (!table) return (void *)0;
+    memzero_page(table);
+
+    if (e & PAGE_PRESENT) {
+        uint64_t base = e & ADDR_MASK & ~PAGE_PAT_LARGE;
+        uint64_t step = size / 512;
+        if (step == PAGE_SIZE_4K) {
+            uint64_t f = small_flags(e);
+            for (int i = 0; i < 512; i++) table[i] = (base + i * step) | f;
+        } else {
+            /* 1 GiB -> 2 MiB keeps the large-page encoding */
+            uint64_t f = e & (0xFFFULL | PAGE_PAT_LARGE);
+            for (int i = 0; i < 512; i++) table[i] = (base + i * step) | f;
+        }
+    }
+    *entry = (uint64_t)table | TABLE_FLAGS;
+    return table;
+}
+
+/* Release the page tables below an entry just replaced by a large page
+ * (after the TLB flush, so no cached walk can still reach them).  Tables
+ * that came from boot.S are not PMM pages; pmm_free_page ignores them. */
+static void drop_table(uint64_t e, int levels)
+{
+    if (!(e & PAGE_PRESENT) || (e & PAGE_HUGE)) return;
+    uint64_t *table = entry_table(e);
+    if (levels > 1)
+        for (int i = 0; i < 512; i++) drop_table(table[i], levels - 1);
+    pmm_free_page(table);
+}
+
+static void flush_tlb(void)
+{
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
 void paging_init(uint64_t mem_size)
 {
-    (void)mem_size;
     /* Read CR3 to get the PML4 the bootloader set up */
     uint64_t cr3;
     __asm__ volatile("movq %%cr3, %0" : "=r"(cr3));
     kernel_pml4 = (uint64_t *)(cr3 & ~0xFFFULL);
+
+    /* Whole gigabytes of RAM are cheaper to cover with 1 GiB pages */
+    uint64_t ram_gib = mem_size & ~(PAGE_SIZE_1G - 1);
+    if (ram_gib > 4 * PAGE_SIZE_1G) ram_gib = 4 * PAGE_SIZE_1G;
+    if (ram_gib && cpu_has(CPU_FEAT_PAGE1G))
+        paging_map_range(0, 0, ram_gib, PAGE_WRITE | PAGE_CACHE_WB);
 }
 
-void paging_map(uint64_t virt, uint64_t phys, uint64_t flags)
+int paging_map_range(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags)
 {
-    uint64_t pml4_idx = (virt >> 39) & 0x1FF;
-    uint64_t pdpt_idx = (virt >> 30) & 0x1FF;
-    uint64_t pd_idx   = (virt >> 21) & 0x1FF;
-    uint64_t pt_idx   = (virt >> 12) & 0x1FF;
-
-    /* Walk / allocate page table levels */
-    if (!(kernel_pml4[pml4_idx] & PAGE_PRESENT)) {
-        void *page = pmm_alloc_page();
-        memzero_page(page);
-        kernel_pml4[pml4_idx] = (uint64_t)page | PAGE_PRESENT | PAGE_WRITE;
-    }
-    uint64_t *pdpt = (uint64_t *)(kernel_pml4[pml4_idx] & ~0xFFFULL);
+    int huge_1g = cpu_has(CPU_FEAT_PAGE1G);
+    uint64_t end = virt + size;
+    int rc = 0;
 
-    if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-        void *page = pmm_alloc_page();
-        memzero_page(page);
-        pdpt[pdpt_idx] = (uint64_t)page | PAGE_PRESENT | PAGE_WRITE;
-    }
-    uint64_t *pd = (uint64_t *)(pdpt[pdpt_idx] & ~0xFFFULL);
+    flags = (flags & 0xFFFULL) | PAGE_PRESENT;
+    while (virt < end) {
+        uint64_t left = end - virt;
+        uint64_t *pdpt = next_table(&kernel_pml4[(virt >> 39) & 0x1FF], 0);
+        if (!pdpt) { rc = -1; break; }
+        uint64_t *pdpte = &pdpt[(virt >> 30) & 0x1FF];
 
-    if (!(pd[pd_idx] & PAGE_PRESENT)) {
-        void *page = pmm_alloc_page();
-        memzero_page(page);
-        pd[pd_idx] = (uint64_t)page | PAGE_PRESENT | PAGE_WRITE;
+        if (huge_1g && left >= PAGE_SIZE_1G && !((virt | phys) & (PAGE_SIZE_1G - 1))) {
+            uint64_t old = *pdpte;
+            *pdpte = phys | large_flags(flags);
+            if ((old & PAGE_PRESENT) && !(old & PAGE_HUGE)) {
+                flush_tlb();
+                drop_table(old, 2);
+            }
+            virt += PAGE_SIZE_1G; phys += PAGE_SIZE_1G;
+            continue;
+        }
+
+        uint64_t *pd = next_table(pdpte, PAGE_SIZE_1G);
+        if (!pd) { rc = -1; break; }
+        uint64_t *pde = &pd[(virt >> 21) & 0x1FF];
+
+        if (left >= PAGE_SIZE_2M && !((virt | phys) & (PAGE_SIZE_2M - 1))) {
+            uint64_t old = *pde;
+            *pde = phys | large_flags(flags);
+            if ((old & PAGE_PRESENT) && !(old & PAGE_HUGE)) {
+                flush_tlb();
+                drop_table(old, 1);
+            }
+            virt += PAGE_SIZE_2M; phys += PAGE_SIZE_2M;
+            continue;
+        }
+
+        uint64_t *pt = next_table(pde, PAGE_SIZE_2M);
+        if (!pt) { rc = -1; break; }
+        pt[(virt >> 12) & 0x1FF] = phys | flags;
+        virt += PAGE_SIZE_4K; phys += PAGE_SIZE_4K;
     }
-    uint64_t *pt = (uint64_t *)(pd[pd_idx] & ~0xFFFULL);
 
-    pt[pt_idx] = phys | flags | PAGE_PRESENT;
+    /* Replaced tables may linger in the paging-structure caches, which
+     * invlpg only clears for one address: reload CR3 instead.         */
+    flush_tlb();
+    return rc;
+}
+
+void paging_map(uint64_t virt, uint64_t phys, uint64_t flags)
+{
+    uint64_t *pdpt = next_table(&kernel_pml4[(virt >> 39) & 0x1FF], 0);
+    if (!pdpt) return;
+    uint64_t *pd = next_table(&pdpt[(virt >> 30) & 0x1FF], PAGE_SIZE_1G);
+    if (!pd) return;
+    uint64_t *pt = next_table(&pd[(virt >> 21) & 0x1FF], PAGE_SIZE_2M);
+    if (!pt) return;
+
+    pt[(virt >> 12) & 0x1FF] = phys | flags | PAGE_PRESENT;
 
     /* Invalidate TLB for this page */
     __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
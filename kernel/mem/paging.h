@@ -7,7 +7,31 @@
 
 #include <stdint.h>
 
+#define PAGE_SIZE_4K    0x1000ULL
+#define PAGE_SIZE_2M    0x200000ULL
+#define PAGE_SIZE_1G    0x40000000ULL
+
+/* Entry flags, always given in 4 KiB PTE form; paging_map_range moves
+ * the PAT bit to its large-page position itself.                      */
+#define PAGE_PRESENT    0x01ULL
+#define PAGE_WRITE      0x02ULL
+#define PAGE_PWT        0x08ULL
+#define PAGE_PCD        0x10ULL
+#define PAGE_PAT        0x80ULL
+
+/* Memory types selected through the PAT layout cpu_init programs:
+ * entries 0-3 keep their power-on values, entry 4 is write-combining. */
+#define PAGE_CACHE_WB   0ULL
+#define PAGE_CACHE_UC   (PAGE_PCD | PAGE_PWT)
+#define PAGE_CACHE_WC   PAGE_PAT
+
 void paging_init(uint64_t mem_size);
 void paging_map(uint64_t virt, uint64_t phys, uint64_t flags);
 
+/* Map [virt, virt+size) to phys using the largest page size each step's
+ * alignment allows (1 GiB where supported, then 2 MiB, then 4 KiB),
+ * splitting or replacing existing entries.  Only the calling CPU's TLB
+ * is flushed.  Returns 0, or -1 if a page table could not be allocated. */
+int  paging_map_range(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+
 #endif /* NEXTOS_PAGING_H */
@@ -1,56 +1,204 @@
 /*
  * nextOS - pmm.c
- * Physical Memory Manager — simple bitmap allocator
+ * Physical Memory Manager — binary buddy allocator
+ *
+ * Free memory is kept as naturally aligned blocks of 2^order pages on one
+ * list per order, linked through the free pages themselves (all RAM is
+ * identity-mapped).  A byte per page records whether it heads a free or
+ * allocated block and of which order, so a block's buddy is found by
+ * flipping one bit of its page index.  Allocation splits the smallest
+ * large-enough block, freeing merges with free buddies: both are
+ * bounded by the number of orders.
  */
 #include "pmm.h"
+#include "../arch/x86_64/spinlock.h"
 
-static uint64_t *bitmap;
-static uint64_t  total_pages;
-static uint64_t  bitmap_size;  /* in uint64_t words */
+typedef struct free_block {
+    struct free_block *next, *prev;
+} free_block_t;
+
+#define META_FREE   0x80    /* Page heads a free block      */
+#define META_HEAD   0x40    /* Page heads an allocated block */
+
+static uint8_t      *page_meta;     /* One byte per page */
+static uint64_t      total_pages;
+static free_block_t *free_lists[PMM_MAX_ORDER + 1];
+static pmm_stats_t   stats;
+static spinlock_t    pmm_lock = SPINLOCK_INIT;
 
 /* Kernel end symbol from linker */
 extern char _end[];
 
+static inline free_block_t *page_ptr(uint64_t idx)
+{
+    return (free_block_t *)(idx * PAGE_SIZE);
+}
+
+static inline uint64_t page_idx(const void *p)
+{
+    return (uint64_t)p / PAGE_SIZE;
+}
+
+static void list_push(unsigned order, uint64_t idx)
+{
+    free_block_t *b = page_ptr(idx);
+    b->prev = (void *)0;
+    b->next = free_lists[order];
+    if (b->next) b->next->prev = b;
+    free_lists[order] = b;
+    page_meta[idx] = META_FREE | (uint8_t)order;
+    stats.free_blocks[order]++;
+}
+
+static void list_remove(unsigned order, uint64_t idx)
+{
+    free_block_t *b = page_ptr(idx);
+    if (b->prev) b->prev->next = b->next;
+    else         free_lists[order] = b->next;
+    if (b->next) b->next->prev = b->prev;
+    page_meta[idx] = 0;
+    stats.free_blocks[order]--;
+}
+
+/* Return a block to the free lists, merging with free buddies */
+static void free_block(uint64_t idx, unsigned order)
+{
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = idx ^ (1ULL << order);
+        if (buddy + (1ULL << order) > total_pages ||
+            page_meta[buddy] != (META_FREE | order))
+            break;
+        list_remove(order, buddy);
+        idx &= ~(1ULL << order);
+        order++;
+    }
+    list_push(order, idx);
+}
+
+/* Hand [first, last) to the allocator as the largest aligned blocks */
+static void free_range(uint64_t first, uint64_t last)
+{
+    while (first < last) {
+        unsigned order = PMM_MAX_ORDER;
+        while (order && ((first & ((1ULL << order) - 1)) ||
+                         first + (1ULL << order) > last))
+            order--;
+        free_block(first, order);
+        first += 1ULL << order;
+    }
+}
+
 void pmm_init(uint64_t mem_size)
 {
     total_pages = mem_size / PAGE_SIZE;
-    bitmap_size = (total_pages + 63) / 64;
 
-    /* Place bitmap right after the kernel image */
-    bitmap = (uint64_t *)((((uint64_t)_end) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    /* Page metadata lives right after the kernel image */
+    page_meta = (uint8_t *)((((uint64_t)_end) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    for (uint64_t i = 0; i < total_pages; i++)
+        page_meta[i] = 0;
 
-    /* Mark everything as used initially */
-    for (uint64_t i = 0; i < bitmap_size; i++) {
-        bitmap[i] = 0xFFFFFFFFFFFFFFFF;
-    }
+    uint64_t meta_end = (uint64_t)page_meta + total_pages;
+    meta_end = (meta_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint64_t first_free = meta_end / PAGE_SIZE;
 
-    /* Free usable pages above the kernel + bitmap area */
-    uint64_t bitmap_end = (uint64_t)bitmap + bitmap_size * sizeof(uint64_t);
-    bitmap_end = (bitmap_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-    uint64_t first_free = bitmap_end / PAGE_SIZE;
+    stats.total_pages = total_pages;
+    stats.used_pages  = first_free < total_pages ? first_free : total_pages;
+    stats.peak_used   = stats.used_pages;
 
-    for (uint64_t i = first_free; i < total_pages; i++) {
-        bitmap[i / 64] &= ~(1ULL << (i % 64));
-    }
+    if (first_free < total_pages)
+        free_range(first_free, total_pages);
 }
 
-void *pmm_alloc_page(void)
+/* Take one page out of whatever free block contains it */
+static void reserve_page(uint64_t idx)
 {
-    for (uint64_t i = 0; i < bitmap_size; i++) {
-        if (bitmap[i] != 0xFFFFFFFFFFFFFFFF) {
-            for (int bit = 0; bit < 64; bit++) {
-                if (!(bitmap[i] & (1ULL << bit))) {
-                    bitmap[i] |= (1ULL << bit);
-                    return (void *)((i * 64 + bit) * PAGE_SIZE);
-                }
+    for (unsigned order = 0; order <= PMM_MAX_ORDER; order++) {
+        uint64_t head = idx & ~((1ULL << order) - 1);
+        if (page_meta[head] != (META_FREE | order)) continue;
+
+        /* Split down to idx, returning the halves that do not hold it */
+        list_remove(order, head);
+        while (order > 0) {
+            order--;
+            uint64_t half = head + (1ULL << order);
+            if (idx >= half) {
+                list_push(order, head);
+                head = half;
+            } else {
+                list_push(order, half);
             }
         }
+        stats.used_pages++;
+        return;
+    }
+}
+
+void pmm_reserve(uint64_t base, uint64_t size)
+{
+    uint64_t first = base / PAGE_SIZE;
+    uint64_t last  = (base + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (last > total_pages) last = total_pages;
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    for (uint64_t i = first; i < last; i++)
+        reserve_page(i);
+    if (stats.used_pages > stats.peak_used)
+        stats.peak_used = stats.used_pages;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+void *pmm_alloc_pages(unsigned order)
+{
+    if (order > PMM_MAX_ORDER) return (void *)0;
+
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    unsigned o = order;
+    while (o <= PMM_MAX_ORDER && !free_lists[o]) o++;
+    if (o > PMM_MAX_ORDER) {
+        stats.failed_allocs++;
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return (void *)0; /* out of memory */
+    }
+
+    uint64_t idx = page_idx(free_lists[o]);
+    list_remove(o, idx);
+    while (o > order) {
+        o--;
+        list_push(o, idx + (1ULL << o));
     }
-    return (void *)0; /* out of memory */
+    page_meta[idx] = META_HEAD | (uint8_t)order;
+
+    stats.used_pages += 1ULL << order;
+    if (stats.used_pages > stats.peak_used)
+        stats.peak_used = stats.used_pages;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return page_ptr(idx);
+}
+
+void pmm_free_pages(void *base, unsigned order)
+{
+    uint64_t idx = page_idx(base);
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    /* Only the head of a live block of that order may be freed */
+    if (idx < total_pages && page_meta[idx] == (META_HEAD | order)) {
+        stats.used_pages -= 1ULL << order;
+        free_block(idx, order);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+void *pmm_alloc_page(void)
+{
+    return pmm_alloc_pages(0);
 }
 
 void pmm_free_page(void *page)
 {
-    uint64_t idx = (uint64_t)page / PAGE_SIZE;
-    bitmap[idx / 64] &= ~(1ULL << (idx % 64));
+    pmm_free_pages(page, 0);
+}
+
+void pmm_get_stats(pmm_stats_t *out)
+{
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
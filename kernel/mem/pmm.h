@@ -1,6 +1,6 @@
 /*
  * nextOS - pmm.h
- * Physical Memory Manager (bitmap-based)
+ * Physical Memory Manager (buddy allocator)
  */
 #ifndef NEXTOS_PMM_H
 #define NEXTOS_PMM_H
@@ -8,10 +8,27 @@
 #include <stdint.h>
 #include <stddef.h>
 
-#define PAGE_SIZE 4096
+#define PAGE_SIZE      4096
+#define PMM_MAX_ORDER  10       /* Largest block: 2^10 pages = 4 MiB */
+
+typedef struct {
+    uint64_t total_pages;
+    uint64_t used_pages;
+    uint64_t peak_used;
+    uint64_t failed_allocs;
+    uint64_t free_blocks[PMM_MAX_ORDER + 1];    /* Per order: fragmentation */
+} pmm_stats_t;
 
 void  pmm_init(uint64_t mem_size);
+/* Withhold a physical range (e.g. the kernel heap) from the allocator */
+void  pmm_reserve(uint64_t base, uint64_t size);
+
+/* 2^order physically contiguous pages, aligned to their own size */
+void *pmm_alloc_pages(unsigned order);
+void  pmm_free_pages(void *base, unsigned order);
+
 void *pmm_alloc_page(void);
 void  pmm_free_page(void *page);
+void  pmm_get_stats(pmm_stats_t *out);
 
 #endif /* NEXTOS_PMM_H */
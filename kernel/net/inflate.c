@@ -0,0 +1,408 @@
+/*
+ * nextOS - inflate.c
+ * Streaming DEFLATE decoder (RFC 1951, with RFC 1950 / 1952 framing)
+ *
+ * Input may arrive split anywhere.  Decoding advances in atomic steps
+ * (a header, a block header with its code tables, one literal or one
+ * length/distance pair, a run of stored bytes); a step that runs out of
+ * input is rolled back to its start and retried when more arrives, so
+ * no decoder state ever has to be kept in the middle of a symbol.
+ * A gzip stream ends with the CRC-32 and length of its output, which
+ * are checked; a mismatch is reported as corruption.
+ */
+#include "inflate.h"
+#include "../mem/heap.h"
+
+#define WIN_SIZE   32768
+#define OUT_SIZE   4096
+#define MAX_BITS   15
+#define MAX_LCODES 286
+#define MAX_DCODES 30
+
+enum { ST_FORMAT, ST_GZIP, ST_ZLIB, ST_BLOCK, ST_STORED, ST_CODES, ST_TRAILER, ST_DONE };
+enum { STEP_OK, STEP_MORE, STEP_BAD };
+
+typedef struct {
+    uint16_t count[MAX_BITS + 1];
+    uint16_t symbol[288];
+} huff_t;
+
+struct inflate_state {
+    int            state;
+    int            gzip;          /* Trailer follows the last block */
+    uint32_t       crc;           /* CRC-32 of the output so far, inverted */
+    int            last_block;
+    uint32_t       stored_left;
+
+    /* Unconsumed input and the bit reader over it */
+    uint8_t       *in;
+    int            in_len, in_pos, in_cap;
+    uint32_t       bitbuf;
+    int            bitcnt;
+    int            underflow;
+
+    huff_t         lit, dist;
+
+    uint8_t        win[WIN_SIZE];
+    uint32_t       total_out;
+    uint8_t        out[OUT_SIZE];
+    int            out_len;
+    inflate_out_fn out_fn;
+    void          *out_ctx;
+};
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/* ── Bits and bytes ──────────────────────────────────────────────────── */
+static uint32_t bits(inflate_t *z, int n)
+{
+    while (z->bitcnt < n) {
+        if (z->in_pos >= z->in_len) {
+            z->underflow = 1;
+            return 0;
+        }
+        z->bitbuf |= (uint32_t)z->in[z->in_pos++] << z->bitcnt;
+        z->bitcnt += 8;
+    }
+    uint32_t v = z->bitbuf & ((1u << n) - 1);
+    z->bitbuf >>= n;
+    z->bitcnt -= n;
+    return v;
+}
+
+static uint32_t crc_table[256];
+
+static void crc_init(void)
+{
+    if (crc_table[1]) return;
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static void flush_out(inflate_t *z)
+{
+    if (!z->out_len) return;
+    if (z->gzip) {
+        uint32_t c = z->crc;
+        for (int i = 0; i < z->out_len; i++) c = crc_table[(c ^ z->out[i]) & 0xFF] ^ (c >> 8);
+        z->crc = c;
+    }
+    z->out_fn(z->out_ctx, z->out, z->out_len);
+    z->out_len = 0;
+}
+
+static void put_byte(inflate_t *z, uint8_t b)
+{
+    z->win[z->total_out++ & (WIN_SIZE - 1)] = b;
+    z->out[z->out_len++] = b;
+    if (z->out_len == OUT_SIZE) flush_out(z);
+}
+
+/* ── Huffman codes ────────────────────────────────────────────────────── */
+/* Canonical code from per-symbol lengths; -1 if over-subscribed */
+static int huff_build(huff_t *h, const uint8_t *lengths, int n)
+{
+    uint16_t offs[MAX_BITS + 1];
+    for (int len = 0; len <= MAX_BITS; len++) h->count[len] = 0;
+    for (int s = 0; s < n; s++) h->count[lengths[s]]++;
+    if (h->count[0] == n) return 0;
+
+    int left = 1;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) return -1;
+    }
+    offs[1] = 0;
+    for (int len = 1; len < MAX_BITS; len++) offs[len + 1] = (uint16_t)(offs[len] + h->count[len]);
+    for (int s = 0; s < n; s++)
+        if (lengths[s]) h->symbol[offs[lengths[s]]++] = (uint16_t)s;
+    return 0;
+}
+
+static int huff_decode(inflate_t *z, const huff_t *h)
+{
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        code |= (int)bits(z, 1);
+        if (z->underflow) return -1;
+        int count = h->count[len];
+        if (code - count < first) return h->symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -2;
+}
+
+static void fixed_tables(inflate_t *z)
+{
+    uint8_t lengths[288];
+    int s = 0;
+    for (; s < 144; s++) lengths[s] = 8;
+    for (; s < 256; s++) lengths[s] = 9;
+    for (; s < 280; s++) lengths[s] = 7;
+    for (; s < 288; s++) lengths[s] = 8;
+    huff_build(&z->lit, lengths, 288);
+    for (s = 0; s < MAX_DCODES; s++) lengths[s] = 5;
+    huff_build(&z->dist, lengths, MAX_DCODES);
+}
+
+static int dynamic_tables(inflate_t *z)
+{
+    static const uint8_t order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    uint8_t lengths[MAX_LCODES + MAX_DCODES];
+
+    int nlen = (int)bits(z, 5) + 257;
+    int ndist = (int)bits(z, 5) + 1;
+    int ncode = (int)bits(z, 4) + 4;
+    if (z->underflow) return STEP_MORE;
+    if (nlen > MAX_LCODES || ndist > MAX_DCODES) return STEP_BAD;
+
+    int i = 0;
+    for (; i < ncode; i++) lengths[order[i]] = (uint8_t)bits(z, 3);
+    for (; i < 19; i++) lengths[order[i]] = 0;
+    if (z->underflow) return STEP_MORE;
+    if (huff_build(&z->lit, lengths, 19) < 0) return STEP_BAD;
+
+    for (i = 0; i < nlen + ndist; ) {
+        int sym = huff_decode(z, &z->lit);
+        if (sym == -1) return STEP_MORE;
+        if (sym < 0) return STEP_BAD;
+        if (sym < 16) { lengths[i++] = (uint8_t)sym; continue; }
+
+        uint8_t len = 0;
+        int rep;
+        if (sym == 16) {
+            if (i == 0) return STEP_BAD;
+            len = lengths[i - 1];
+            rep = 3 + (int)bits(z, 2);
+        } else if (sym == 17) {
+            rep = 3 + (int)bits(z, 3);
+        } else {
+            rep = 11 + (int)bits(z, 7);
+        }
+        if (z->underflow) return STEP_MORE;
+        if (i + rep > nlen + ndist) return STEP_BAD;
+        while (rep--) lengths[i++] = len;
+    }
+    if (lengths[256] == 0) return STEP_BAD;
+    if (huff_build(&z->lit, lengths, nlen) < 0) return STEP_BAD;
+    if (huff_build(&z->dist, lengths + nlen, ndist) < 0) return STEP_BAD;
+    return STEP_OK;
+}
+
+/* ── Steps ────────────────────────────────────────────────────────────── */
+static int step_gzip_header(inflate_t *z)
+{
+    if (bits(z, 8) != 0x1F || z->underflow) return z->underflow ? STEP_MORE : STEP_BAD;
+    if (bits(z, 8) != 0x8B || z->underflow) return z->underflow ? STEP_MORE : STEP_BAD;
+    if (bits(z, 8) != 8 || z->underflow) return z->underflow ? STEP_MORE : STEP_BAD;
+    uint32_t flags = bits(z, 8);
+    for (int i = 0; i < 6; i++) bits(z, 8);          /* MTIME, XFL, OS */
+    if (flags & 4) {                                      /* FEXTRA */
+        uint32_t xlen = bits(z, 16);
+        while (xlen-- && !z->underflow) bits(z, 8);
+    }
+    if (flags & 8)  while (bits(z, 8) && !z->underflow) ;   /* FNAME */
+    if (flags & 16) while (bits(z, 8) && !z->underflow) ;   /* FCOMMENT */
+    if (flags & 2)  bits(z, 16);                             /* FHCRC */
+    if (z->underflow) return STEP_MORE;
+    z->state = ST_BLOCK;
+    return STEP_OK;
+}
+
+/* CRC32 and ISIZE, little-endian, from the next byte boundary */
+static int step_gzip_trailer(inflate_t *z)
+{
+    flush_out(z);
+    bits(z, z->bitcnt & 7);
+    uint32_t crc = bits(z, 16);
+    crc |= bits(z, 16) << 16;
+    uint32_t isize = bits(z, 16);
+    isize |= bits(z, 16) << 16;
+    if (z->underflow) return STEP_MORE;
+    if (crc != ~z->crc || isize != z->total_out) return STEP_BAD;
+    z->state = ST_DONE;
+    return STEP_OK;
+}
+
+static int step_zlib_header(inflate_t *z)
+{
+    uint32_t cmf = bits(z, 8), flg = bits(z, 8);
+    if (z->underflow) return STEP_MORE;
+    if ((cmf & 0x0F) != 8 || ((cmf << 8) | flg) % 31 || (flg & 0x20)) return STEP_BAD;
+    z->state = ST_BLOCK;
+    return STEP_OK;
+}
+
+/* HTTP "deflate" is meant to be zlib, but raw streams are common */
+static int step_sniff(inflate_t *z)
+{
+    if (z->in_len - z->in_pos < 2) return STEP_MORE;
+    uint32_t cmf = z->in[z->in_pos], flg = z->in[z->in_pos + 1];
+    int zlib = (cmf & 0x0F) == 8 && ((cmf << 8) | flg) % 31 == 0;
+    z->state = zlib ? ST_ZLIB : ST_BLOCK;
+    return STEP_OK;
+}
+
+static int step_block(inflate_t *z)
+{
+    z->last_block = (int)bits(z, 1);
+    uint32_t type = bits(z, 2);
+    if (z->underflow) return STEP_MORE;
+
+    if (type == 0) {
+        bits(z, z->bitcnt & 7);                            /* To a byte boundary */
+        uint32_t len = bits(z, 16), nlen = bits(z, 16);
+        if (z->underflow) return STEP_MORE;
+        if ((len ^ 0xFFFF) != nlen) return STEP_BAD;
+        z->stored_left = len;
+        z->state = ST_STORED;
+        return STEP_OK;
+    }
+    if (type == 1) {
+        fixed_tables(z);
+    } else if (type == 2) {
+        int r = dynamic_tables(z);
+        if (r != STEP_OK) return r;
+    } else {
+        return STEP_BAD;
+    }
+    z->state = ST_CODES;
+    return STEP_OK;
+}
+
+static void end_block(inflate_t *z)
+{
+    z->state = !z->last_block ? ST_BLOCK : z->gzip ? ST_TRAILER : ST_DONE;
+}
+
+static int step_stored(inflate_t *z)
+{
+    if (z->stored_left == 0) { end_block(z); return STEP_OK; }
+    /* The header read left the bit reader byte aligned and empty */
+    int avail = z->in_len - z->in_pos;
+    if (avail == 0) return STEP_MORE;
+    uint32_t n = z->stored_left < (uint32_t)avail ? z->stored_left : (uint32_t)avail;
+    for (uint32_t i = 0; i < n; i++) put_byte(z, z->in[z->in_pos++]);
+    z->stored_left -= n;
+    return STEP_OK;
+}
+
+static int step_codes(inflate_t *z)
+{
+    int sym = huff_decode(z, &z->lit);
+    if (sym == -1) return STEP_MORE;
+    if (sym < 0) return STEP_BAD;
+    if (sym < 256) { put_byte(z, (uint8_t)sym); return STEP_OK; }
+    if (sym == 256) { end_block(z); return STEP_OK; }
+
+    sym -= 257;
+    if (sym >= 29) return STEP_BAD;
+    uint32_t len = len_base[sym] + bits(z, len_extra[sym]);
+    int dsym = huff_decode(z, &z->dist);
+    if (dsym == -1 || z->underflow) return STEP_MORE;
+    if (dsym < 0 || dsym >= 30) return STEP_BAD;
+    uint32_t dist = dist_base[dsym] + bits(z, dist_extra[dsym]);
+    if (z->underflow) return STEP_MORE;
+    if (dist > z->total_out || dist > WIN_SIZE) return STEP_BAD;
+
+    while (len--) put_byte(z, z->win[(z->total_out - dist) & (WIN_SIZE - 1)]);
+    return STEP_OK;
+}
+
+/* ── Public interface ─────────────────────────────────────────────────── */
+inflate_t *inflate_create(int format, inflate_out_fn out, void *ctx)
+{
+    inflate_t *z = (inflate_t *)kmalloc(sizeof(inflate_t));
+    if (!z) return (void *)0;
+    z->state = format == INFLATE_GZIP ? ST_GZIP :
+               format == INFLATE_ZLIB ? ST_ZLIB :
+               format == INFLATE_DEFLATE ? ST_FORMAT : ST_BLOCK;
+    z->gzip = format == INFLATE_GZIP;
+    z->crc = 0xFFFFFFFFu;
+    if (z->gzip) crc_init();
+    z->last_block = 0;
+    z->stored_left = 0;
+    z->in = (void *)0;
+    z->in_len = z->in_pos = z->in_cap = 0;
+    z->bitbuf = 0;
+    z->bitcnt = 0;
+    z->underflow = 0;
+    z->total_out = 0;
+    z->out_len = 0;
+    z->out_fn = out;
+    z->out_ctx = ctx;
+    return z;
+}
+
+void inflate_destroy(inflate_t *z)
+{
+    if (!z) return;
+    kfree(z->in);
+    kfree(z);
+}
+
+int inflate_feed(inflate_t *z, const uint8_t *data, int len)
+{
+    if (z->state == ST_DONE) return 1;
+
+    /* Keep only the unconsumed tail, then append */
+    int keep = z->in_len - z->in_pos;
+    for (int i = 0; i < keep; i++) z->in[i] = z->in[z->in_pos + i];
+    z->in_len = keep;
+    z->in_pos = 0;
+    if (keep + len > z->in_cap) {
+        int cap = z->in_cap ? z->in_cap : 4096;
+        while (cap < keep + len) cap *= 2;
+        uint8_t *n = (uint8_t *)krealloc(z->in, (size_t)cap);
+        if (!n) return -1;
+        z->in = n;
+        z->in_cap = cap;
+    }
+    for (int i = 0; i < len; i++) z->in[z->in_len + i] = data[i];
+    z->in_len += len;
+
+    int r = STEP_OK;
+    while (z->state != ST_DONE) {
+        int pos = z->in_pos, cnt = z->bitcnt;
+        uint32_t buf = z->bitbuf;
+        z->underflow = 0;
+        switch (z->state) {
+        case ST_FORMAT: r = step_sniff(z);        break;
+        case ST_GZIP:   r = step_gzip_header(z);  break;
+        case ST_ZLIB:   r = step_zlib_header(z);  break;
+        case ST_BLOCK:  r = step_block(z);        break;
+        case ST_STORED: r = step_stored(z);       break;
+        case ST_TRAILER: r = step_gzip_trailer(z); break;
+        default:        r = step_codes(z);        break;
+        }
+        if (r == STEP_MORE) {
+            z->in_pos = pos;
+            z->bitcnt = cnt;
+            z->bitbuf = buf;
+            break;
+        }
+        if (r == STEP_BAD) break;
+    }
+    flush_out(z);
+    if (r == STEP_BAD) return -1;
+    return z->state == ST_DONE ? 1 : 0;
+}
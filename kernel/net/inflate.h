@@ -0,0 +1,29 @@
+/*
+ * nextOS - inflate.h
+ * Streaming DEFLATE decoder (raw, zlib and gzip framing)
+ */
+#ifndef NEXTOS_INFLATE_H
+#define NEXTOS_INFLATE_H
+
+#include <stdint.h>
+
+#define INFLATE_RAW     0
+#define INFLATE_ZLIB    1
+#define INFLATE_GZIP    2
+#define INFLATE_DEFLATE 3      /* HTTP "deflate": zlib, or raw if no zlib header */
+
+typedef struct inflate_state inflate_t;
+
+/* Receives decompressed bytes in order */
+typedef void (*inflate_out_fn)(void *ctx, const uint8_t *data, int len);
+
+inflate_t *inflate_create(int format, inflate_out_fn out, void *ctx);
+void       inflate_destroy(inflate_t *z);
+
+/* Feed the next compressed bytes, in any split.  Everything that can be
+ * decoded is passed to `out` before returning.  Returns 0 while more is
+ * expected, 1 once the stream has ended, -1 if it is corrupt (for gzip,
+ * also when the trailer's CRC-32 or length does not match).          */
+int        inflate_feed(inflate_t *z, const uint8_t *data, int len);
+
+#endif /* NEXTOS_INFLATE_H */
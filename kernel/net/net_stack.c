@@ -4,12 +4,15 @@
  *
  * Implements: Ethernet framing, ARP, IPv4, UDP, TCP (basic),
  *             DNS resolution, and HTTP/1.1 GET requests.
- * Uses polling-based approach (no async/interrupt-driven networking).
+ * Blocking calls sleep on the NIC's receive interrupt between polls.
  */
 #include "net_stack.h"
+#include "inflate.h"
+#include "pcap.h"
 #include "../drivers/net.h"
 #include "../drivers/timer.h"
 #include "../mem/heap.h"
+#include "../sched/kthread.h"
 
 /* ── String/Memory Helpers (freestanding) ────────────────────────────── */
 static void mem_copy(void *dst, const void *src, int n)
@@ -25,6 +28,19 @@ static void mem_zero(void *dst, int n)
     for (int i = 0; i < n; i++) d[i] = 0;
 }
 
+static int mem_eq(const void *a, const void *b, int n)
+{
+    const uint8_t *x = (const uint8_t *)a, *y = (const uint8_t *)b;
+    for (int i = 0; i < n; i++) if (x[i] != y[i]) return 0;
+    return 1;
+}
+
+static int str_eq_ns(const char *a, const char *b)
+{
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
+}
+
 /* ── Byte Order ──────────────────────────────────────────────────────── */
 static inline uint16_t htons(uint16_t v) { return (v >> 8) | (v << 8); }
 static inline uint16_t ntohs(uint16_t v) { return htons(v); }
@@ -52,92 +68,281 @@ typedef struct {
 
 static arp_entry_t arp_cache[ARP_CACHE_SIZE];
 
-/* ── TX/RX packet buffer ─────────────────────────────────────────────── */
-static uint8_t pkt_buf[2048];
-static uint8_t rx_pkt[2048];
+static net_stack_stats_t stats;
+
+/* ── Packet buffers and TX batching ──────────────────────────────────── */
+/* Outgoing frames are built in place in a netbuf, headers in front of
+ * the payload.  Inside a batch (packet processing, a burst of TCP
+ * segments) they are only queued, and the driver's doorbell is rung
+ * once when the outermost batch ends.                                */
+#define NET_HDR_ETH  ((int)sizeof(eth_header_t))
+#define NET_HDR_IP   (NET_HDR_ETH + 20)
+
+static int tx_batch = 0;
+
+static void tx_batch_begin(void) { tx_batch++; }
+
+static void tx_batch_end(void)
+{
+    if (--tx_batch == 0) net_flush();
+}
+
+/* ── Blocking waits and progress ─────────────────────────────────────── */
+/* Every wait loop polls through here.  Anything still queued goes out
+ * first, since the wait may be for its answer; then, with nothing
+ * received, the thread sleeps until a frame arrives or the next TCP
+ * timer is due, so other kernel threads run and an idle CPU halts.
+ * NET_WAIT_MAX_MS bounds the sleep for the callers' own deadlines.  */
+#define NET_WAIT_MAX_MS 10
+
+static uint32_t tcp_next_timer_ms(void);
+static int      loop_count;
+
+static void net_wait_poll(void)
+{
+    net_flush();
+    /* Looped-back frames are already waiting: nothing to sleep for */
+    if (!loop_count) net_wait(tcp_next_timer_ms());
+    net_stack_process();
+}
+
+static net_progress_fn progress_hook = (void *)0;
+static int             progress_stage = NET_PROGRESS_IDLE;
+static int             progress_bytes = 0;
+
+void net_set_progress_hook(net_progress_fn fn)
+{
+    progress_hook = fn;
+}
+
+static void progress_set(int stage)
+{
+    progress_stage = stage;
+    progress_bytes = 0;
+    if (progress_hook) progress_hook(stage, 0);
+}
+
+static net_body_fn body_hook = (void *)0;
+
+void net_set_body_hook(net_body_fn fn)
+{
+    body_hook = fn;
+}
+
+static void body_deliver(const char *data, int len)
+{
+    if (body_hook && len > 0) body_hook(data, len);
+}
 
-/* ── TCP State (single connection at a time) ─────────────────────────── */
+/* Payload bytes only count once the response is being received */
+static void progress_add(int bytes)
+{
+    if (progress_stage != NET_PROGRESS_RECEIVING || bytes <= 0) return;
+    progress_bytes += bytes;
+    if (progress_hook) progress_hook(progress_stage, progress_bytes);
+}
+
+/* ── TCP sockets ─────────────────────────────────────────────────────── */
+/*
+ * Each connection has a control block in the socket table, found by its
+ * (remote address, remote port, local port) 4-tuple.  A handle is the
+ * table index; it stays valid after the peer closes, so buffered data can
+ * still be read, until tcp_close() frees the slot.
+ *
+ * Closing: a FIN from the peer is ACKed and moves the socket to
+ * CLOSE_WAIT, where it may still send.  tcp_close() then queues our FIN
+ * behind any unsent data (FIN_WAIT, or LAST_ACK after the peer's FIN);
+ * it takes a sequence number and is resent by the RTO like data, and
+ * the socket closes once it is acknowledged.
+ */
 typedef enum {
     TCP_CLOSED = 0,
     TCP_SYN_SENT,
     TCP_ESTABLISHED,
     TCP_FIN_WAIT,
+    TCP_LISTEN,
+    TCP_SYN_RCVD,
+    TCP_CLOSE_WAIT,
+    TCP_LAST_ACK,
 } tcp_state_t;
 
-static tcp_state_t tcp_state = TCP_CLOSED;
-static uint32_t tcp_remote_ip;
-static uint16_t tcp_local_port;
-static uint16_t tcp_remote_port;
-static uint32_t tcp_local_seq;
-static uint32_t tcp_local_ack;
-static uint32_t tcp_remote_seq;
-static uint16_t tcp_next_port = 49152;
-
-/* TCP receive buffer */
-#define TCP_RX_BUF_SIZE 65536
-static uint8_t tcp_rx_buf[TCP_RX_BUF_SIZE];
-static int tcp_rx_head = 0;
-static int tcp_rx_tail = 0;
-
-/* ── IP checksum ─────────────────────────────────────────────────────── */
-/* Computes the Internet checksum (RFC 1071) over on-wire (network byte order)
- * data.  The sum is byte-order independent because the folding arithmetic
- * produces the same result regardless of host endianness.  The odd-byte case
- * adds the last byte in the low position, which matches RFC 1071 behaviour. */
-static uint16_t ip_checksum(const void *data, int len)
+#define TCP_RX_BUF_SIZE (256 * 1024)
+#define TCP_RCV_WSCALE  3           /* Lets the whole ring be advertised */
+#define TCP_MSS         1460
+#define TCP_OOO_MAX     4           /* Held ranges beyond a hole */
+#define TCP_DELACK_MS   100
+#define TCP_TX_BUF_SIZE (64 * 1024)
+#define TCP_RTO_INIT    1000        /* RFC 6298, before any RTT sample */
+#define TCP_RTO_MIN     200
+#define TCP_RTO_MAX     60000
+
+typedef struct {
+    uint32_t start, end;
+} tcp_range_t;
+
+typedef struct {
+    int         used;
+    tcp_state_t state;
+    uint32_t    remote_ip;
+    uint16_t    local_port;
+    uint16_t    remote_port;
+    uint32_t    local_seq;      /* Next sequence number to send (snd_nxt) */
+    uint32_t    local_ack;
+    uint32_t    remote_seq;
+    int         parent;         /* Listener, until tcp_accept(); else -1 */
+    uint8_t    *rx_buf;         /* TCP_RX_BUF_SIZE ring */
+    int         rx_head;
+    int         rx_tail;
+
+    /* Receive side: local_ack is the next sequence number expected.
+     * Out-of-order data is written into the ring at its offset from
+     * local_ack and recorded in ooo[] until the hole before it fills. */
+    uint8_t     rcv_wscale;     /* Shift applied to windows we advertise */
+    uint8_t     sack_ok;        /* Peer accepts SACK blocks              */
+    tcp_range_t ooo[TCP_OOO_MAX];
+    int         ooo_count;
+    int         fin_pending;    /* FIN seen at fin_seq, not yet reached  */
+    uint32_t    fin_seq;
+    int         fin_rcvd;       /* The peer's FIN was reached and ACKed  */
+    int         ack_pending;    /* Segments received and not ACKed yet   */
+    uint64_t    ack_due;
+    uint32_t    adv_edge;       /* Right edge of the last window sent    */
+
+    /* Send side: bytes from snd_una on wait in tx_buf (starting at
+     * tx_tail) until they are acknowledged.                          */
+    uint8_t    *tx_buf;         /* TCP_TX_BUF_SIZE ring */
+    int         tx_tail;
+    uint32_t    tx_len;         /* Queued bytes, sent or not           */
+    uint32_t    snd_una;        /* Oldest unacknowledged               */
+    uint32_t    snd_max;        /* Highest sequence number sent        */
+    uint32_t    snd_wnd;        /* Peer's window, in bytes             */
+    uint8_t     snd_wscale;
+    uint16_t    snd_mss;
+    int         snd_fin;        /* Our FIN has been sent at snd_fin_seq */
+    uint32_t    snd_fin_seq;
+
+    /* RFC 6298 timer and NewReno congestion control (RFC 5681/6582) */
+    uint32_t    cwnd, ssthresh;
+    int         dupacks;
+    int         in_recovery;
+    uint32_t    recover;        /* snd_max when recovery began         */
+    int         srtt8, rttvar4; /* Smoothed RTT x8, variance x4, in ms */
+    uint32_t    rto;
+    uint64_t    rto_due;        /* 0 while nothing is outstanding      */
+    int         rtt_timing;     /* One segment timed at a time (Karn)  */
+    uint32_t    rtt_seq;
+    uint64_t    rtt_start;
+} tcp_sock_t;
+
+static tcp_sock_t tcp_socks[TCP_MAX_SOCKETS];
+static uint16_t   tcp_next_port = 49152;
+
+static tcp_sock_t *tcp_sock(int s)
+{
+    if (s < 0 || s >= TCP_MAX_SOCKETS || !tcp_socks[s].used) return (void *)0;
+    return &tcp_socks[s];
+}
+
+static inline int rx_free(const tcp_sock_t *k)
+{
+    return TCP_RX_BUF_SIZE - 1 - (k->rx_head - k->rx_tail + TCP_RX_BUF_SIZE) % TCP_RX_BUF_SIZE;
+}
+
+static inline int seq_lt(uint32_t a, uint32_t b)  { return (int32_t)(a - b) < 0; }
+static inline int seq_leq(uint32_t a, uint32_t b) { return (int32_t)(a - b) <= 0; }
+
+/* ── Internet checksum ───────────────────────────────────────────────── */
+/* One's complement sums (RFC 1071) over on-wire data, 32 bits at a time
+ * into a 64-bit accumulator.  Since 2^16 = 1 modulo 0xFFFF, folding the
+ * wide sum gives the same result as adding 16-bit words, in either byte
+ * order.  Partial sums of pieces that start at even offsets just add. */
+typedef uint64_t __attribute__((may_alias, aligned(1))) csum_word_t;
+
+static uint64_t csum_partial(const void *data, int len, uint64_t sum)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (; len >= 32; p += 32, len -= 32) {
+        uint64_t a = ((const csum_word_t *)p)[0], b = ((const csum_word_t *)p)[1];
+        uint64_t c = ((const csum_word_t *)p)[2], d = ((const csum_word_t *)p)[3];
+        sum += (a & 0xFFFFFFFFu) + (a >> 32) + (b & 0xFFFFFFFFu) + (b >> 32) +
+               (c & 0xFFFFFFFFu) + (c >> 32) + (d & 0xFFFFFFFFu) + (d >> 32);
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t a = *(const csum_word_t *)p;
+        sum += (a & 0xFFFFFFFFu) + (a >> 32);
+    }
+    for (; len >= 2; p += 2, len -= 2)
+        sum += (uint64_t)p[0] | ((uint64_t)p[1] << 8);
+    if (len)
+        sum += p[0];            /* Odd byte, padded with a zero */
+    return sum;
+}
+
+/* Copy a payload into place and sum it in the same pass */
+static uint64_t csum_copy(void *dst, const void *src, int len, uint64_t sum)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    for (; len >= 8; d += 8, s += 8, len -= 8) {
+        uint64_t a = *(const csum_word_t *)s;
+        *(csum_word_t *)d = a;
+        sum += (a & 0xFFFFFFFFu) + (a >> 32);
+    }
+    for (int i = 0; i < len; i++) d[i] = s[i];
+    return csum_partial(s, len, sum);
+}
+
+static uint16_t csum_fold(uint64_t sum)
 {
-    const uint16_t *p = (const uint16_t *)data;
-    uint32_t sum = 0;
-    for (int i = 0; i < len / 2; i++)
-        sum += p[i];
-    if (len & 1)
-        sum += ((const uint8_t *)data)[len - 1];
-    while (sum >> 16)
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    return (uint16_t)(~sum);
-}
-
-/* ── TCP pseudo-header checksum ──────────────────────────────────────── */
-/* IPs (our_ip, dst_ip) are stored in network byte order throughout the stack,
- * so the pseudo-header words are already in the correct on-wire order. */
-static uint16_t tcp_checksum(uint32_t src_ip, uint32_t dst_ip,
-                             const void *tcp_data, int tcp_len)
-{
-    uint32_t sum = 0;
-    /* Pseudo-header */
-    sum += (src_ip >> 16) & 0xFFFF;
-    sum += src_ip & 0xFFFF;
-    sum += (dst_ip >> 16) & 0xFFFF;
-    sum += dst_ip & 0xFFFF;
-    sum += htons(IP_PROTO_TCP);
-    sum += htons((uint16_t)tcp_len);
-    /* TCP segment */
-    const uint16_t *p = (const uint16_t *)tcp_data;
-    for (int i = 0; i < tcp_len / 2; i++)
-        sum += p[i];
-    if (tcp_len & 1)
-        sum += ((const uint8_t *)tcp_data)[tcp_len - 1];
     while (sum >> 16)
         sum = (sum & 0xFFFF) + (sum >> 16);
-    return (uint16_t)(~sum);
+    return (uint16_t)sum;
+}
+
+static uint16_t ip_checksum(const void *data, int len)
+{
+    return (uint16_t)~csum_fold(csum_partial(data, len, 0));
+}
+
+/* TCP/UDP pseudo-header.  IPs are kept in network byte order throughout
+ * the stack, so their words are already in on-wire order.           */
+static uint64_t pseudo_sum(uint32_t src_ip, uint32_t dst_ip, uint8_t protocol, int len)
+{
+    return (uint64_t)(src_ip & 0xFFFF) + (src_ip >> 16) +
+           (dst_ip & 0xFFFF) + (dst_ip >> 16) +
+           htons(protocol) + htons((uint16_t)len);
 }
 
 /* ── Build & Send Ethernet Frame ─────────────────────────────────────── */
-static void send_eth(const uint8_t dst[6], uint16_t ethertype,
-                     const void *payload, int payload_len)
+/* Send a frame whose payload is already at nb->data + NET_HDR_ETH.
+ * Consumes the caller's reference.                                  */
+static void send_eth_buf(const uint8_t dst[6], uint16_t ethertype,
+                         netbuf_t *nb, int payload_len)
 {
-    eth_header_t *eth = (eth_header_t *)pkt_buf;
+    eth_header_t *eth = (eth_header_t *)nb->data;
     mem_copy(eth->dst, dst, 6);
     mem_copy(eth->src, our_mac, 6);
     eth->ethertype = htons(ethertype);
-    mem_copy(pkt_buf + sizeof(eth_header_t), payload, payload_len);
-    int total = (int)sizeof(eth_header_t) + payload_len;
+    int total = NET_HDR_ETH + payload_len;
     if (total < 60) {
         int pad_start = total;
         total = 60;  /* Minimum Ethernet frame size */
-        mem_zero(pkt_buf + pad_start, total - pad_start);
+        mem_zero(nb->data + pad_start, total - pad_start);
     }
-    net_send(pkt_buf, total);
+    nb->len = (uint16_t)total;
+    pcap_record(nb->data, total);
+    net_send_buf(nb);
+    netbuf_put(nb);
+    if (!tx_batch) net_flush();
+}
+
+static void send_eth(const uint8_t dst[6], uint16_t ethertype,
+                     const void *payload, int payload_len)
+{
+    netbuf_t *nb = netbuf_alloc();
+    if (!nb) return;
+    mem_copy(nb->data + NET_HDR_ETH, payload, payload_len);
+    send_eth_buf(dst, ethertype, nb, payload_len);
 }
 
 /* ── ARP ─────────────────────────────────────────────────────────────── */
@@ -226,30 +431,60 @@ static int resolve_mac(uint32_t ip, uint8_t mac_out[6])
         return 1;
 
     /* Send ARP request and wait */
+    stats.arp_misses++;
     for (int retry = 0; retry < 3; retry++) {
         arp_send_request(target);
         uint64_t start = timer_get_ticks();
         while (timer_get_ticks() - start < 500) {
-            net_stack_process();
+            net_wait_poll();
             if (arp_cache_lookup(target, mac_out))
                 return 1;
         }
     }
+    stats.arp_failures++;
     return 0;
 }
 
+/* ── Loopback ────────────────────────────────────────────────────────── */
+/* Packets for 127/8 never reach the NIC: they are queued here, checksums
+ * taken as good, and handed to ipv4_handle by the next
+ * net_stack_process().  The queue holds every netbuf there is, so it
+ * cannot overflow.                                                    */
+static netbuf_t *loop_queue[NETBUF_COUNT];
+static int       loop_head;
+static int       loop_count;
+
+/* IPs are in network byte order: the first octet is the low byte */
+static inline int ip_is_loopback(uint32_t ip) { return (ip & 0xFF) == 127; }
+
+static void loop_send(netbuf_t *nb, int payload_len)
+{
+    eth_header_t *eth = (eth_header_t *)nb->data;
+    mem_zero(eth->dst, 6);
+    mem_zero(eth->src, 6);
+    eth->ethertype = htons(ETH_TYPE_IPV4);
+    nb->len = (uint16_t)(NET_HDR_ETH + payload_len);
+    nb->flags = NETBUF_RX_CSUM_OK | NETBUF_RX_LOOPBACK;
+    pcap_record(nb->data, nb->len);
+    loop_queue[(loop_head + loop_count++) % NETBUF_COUNT] = nb;
+    stats.loopback_packets++;
+}
+
 /* ── Send IPv4 packet ────────────────────────────────────────────────── */
 static uint16_t ip_id_counter = 1;
 
-static void send_ipv4(uint32_t dst_ip, uint8_t protocol,
-                      const void *payload, int payload_len)
+/* Send an IPv4 packet whose payload is already at nb->data + NET_HDR_IP.
+ * Consumes the caller's reference.                                     */
+static void send_ipv4_buf(uint32_t dst_ip, uint8_t protocol, netbuf_t *nb, int payload_len)
 {
+    int loop = ip_is_loopback(dst_ip);
     uint8_t dst_mac[6];
-    if (!resolve_mac(dst_ip, dst_mac))
+    if (!loop && !resolve_mac(dst_ip, dst_mac)) {
+        netbuf_put(nb);
         return;
+    }
 
-    uint8_t ip_pkt[1500];
-    ipv4_header_t *ip = (ipv4_header_t *)ip_pkt;
+    ipv4_header_t *ip = (ipv4_header_t *)(nb->data + NET_HDR_ETH);
     ip->ver_ihl = 0x45;  /* IPv4, 5 words header */
     ip->tos = 0;
     ip->total_len = htons((uint16_t)(20 + payload_len));
@@ -259,12 +494,25 @@ static void send_ipv4(uint32_t dst_ip, uint8_t protocol,
     ip->protocol = protocol;
     ip->checksum = 0;
     /* IPs are stored in network byte order throughout the stack */
-    ip->src_ip = our_ip;
+    ip->src_ip = loop ? dst_ip : our_ip;
     ip->dst_ip = dst_ip;
-    ip->checksum = ip_checksum(ip, 20);
+    if (loop) {
+        loop_send(nb, 20 + payload_len);
+        return;
+    }
+    if (!(nb->flags & NETBUF_TX_CSUM_TCP))
+        ip->checksum = ip_checksum(ip, 20);
 
-    mem_copy(ip_pkt + 20, payload, payload_len);
-    send_eth(dst_mac, ETH_TYPE_IPV4, ip_pkt, 20 + payload_len);
+    send_eth_buf(dst_mac, ETH_TYPE_IPV4, nb, 20 + payload_len);
+}
+
+static void send_ipv4(uint32_t dst_ip, uint8_t protocol,
+                      const void *payload, int payload_len)
+{
+    netbuf_t *nb = netbuf_alloc();
+    if (!nb) return;
+    mem_copy(nb->data + NET_HDR_IP, payload, payload_len);
+    send_ipv4_buf(dst_ip, protocol, nb, payload_len);
 }
 
 /* ── UDP send ────────────────────────────────────────────────────────── */
@@ -283,36 +531,451 @@ static void send_udp(uint32_t dst_ip, uint16_t src_port, uint16_t dst_port,
 
 /* ── TCP send ────────────────────────────────────────────────────────── */
 static void send_tcp(uint32_t dst_ip, uint16_t src_port, uint16_t dst_port,
-                     uint32_t seq, uint32_t ack, uint8_t flags,
-                     const void *data, int data_len)
+                     uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window,
+                     const uint8_t *opts, int opt_len, const void *data, int data_len)
 {
-    uint8_t tcp_pkt[1460 + 20];
+    netbuf_t *nb = netbuf_alloc();
+    if (!nb) return;   /* As if lost on the wire; TCP recovers */
+
+    uint8_t *tcp_pkt = nb->data + NET_HDR_IP;
     tcp_header_t *tcp = (tcp_header_t *)tcp_pkt;
+    int hdr_len = 20 + opt_len;
     tcp->src_port = htons(src_port);
     tcp->dst_port = htons(dst_port);
     tcp->seq_num = htonl(seq);
     tcp->ack_num = htonl(ack);
-    tcp->data_offset = (5 << 4);  /* 20 bytes header, no options */
+    tcp->data_offset = (uint8_t)((hdr_len / 4) << 4);
     tcp->flags = flags;
-    tcp->window = htons(8192);
+    tcp->window = htons(window);
     tcp->checksum = 0;
     tcp->urgent = 0;
 
-    if (data_len > 0)
-        mem_copy(tcp_pkt + 20, data, data_len);
+    if (opt_len > 0)
+        mem_copy(tcp_pkt + 20, opts, opt_len);
+
+    /* With offload the NIC sums the segment from the pseudo-header seed;
+     * otherwise the payload is summed as it is copied in.            */
+    int tcp_total = hdr_len + data_len;
+    uint64_t sum = pseudo_sum(our_ip, dst_ip, IP_PROTO_TCP, tcp_total);
+    if (net_offloads() & NET_OFFLOAD_TX_CSUM) {
+        mem_copy(tcp_pkt + hdr_len, data, data_len);
+        tcp->checksum = csum_fold(sum);
+        nb->flags |= NETBUF_TX_CSUM_TCP;
+    } else {
+        sum = csum_partial(tcp_pkt, hdr_len, sum);
+        sum = csum_copy(tcp_pkt + hdr_len, data, data_len, sum);
+        tcp->checksum = (uint16_t)~csum_fold(sum);
+    }
+
+    stats.tcp_segs_out++;
+    send_ipv4_buf(dst_ip, IP_PROTO_TCP, nb, tcp_total);
+}
+
+/* Send a segment on a socket.  It carries the window we can take now
+ * and, past a hole, SACK blocks for the data held beyond it; a SYN
+ * carries our MSS, window scale and SACK-permitted options instead.  */
+static void tcp_output_at(tcp_sock_t *k, uint32_t seq, uint8_t flags,
+                          const void *data, int data_len)
+{
+    uint8_t opts[40];
+    int n = 0;
+    if (flags & TCP_SYN) {
+        /* A SYN-ACK offers only what the peer's SYN did */
+        int answer = (flags & TCP_ACK) != 0;
+        opts[n++] = 2; opts[n++] = 4;                   /* MSS */
+        opts[n++] = TCP_MSS >> 8; opts[n++] = TCP_MSS & 0xFF;
+        if (!answer || k->rcv_wscale) {
+            opts[n++] = 1;                              /* Window scale */
+            opts[n++] = 3; opts[n++] = 3; opts[n++] = TCP_RCV_WSCALE;
+        }
+        if (!answer || k->sack_ok) {
+            opts[n++] = 1; opts[n++] = 1;               /* SACK permitted */
+            opts[n++] = 4; opts[n++] = 2;
+        }
+    } else if (k->sack_ok && k->ooo_count > 0) {
+        int blocks = k->ooo_count < 3 ? k->ooo_count : 3;
+        opts[n++] = 1; opts[n++] = 1;
+        opts[n++] = 5; opts[n++] = (uint8_t)(2 + 8 * blocks);
+        for (int b = 0; b < blocks; b++) {
+            uint32_t edge[2] = { k->ooo[b].start, k->ooo[b].end };
+            for (int e = 0; e < 2; e++) {
+                opts[n++] = (uint8_t)(edge[e] >> 24); opts[n++] = (uint8_t)(edge[e] >> 16);
+                opts[n++] = (uint8_t)(edge[e] >> 8);  opts[n++] = (uint8_t)edge[e];
+            }
+        }
+    }
+
+    /* Windows in a SYN are never scaled */
+    int shift = (flags & TCP_SYN) ? 0 : k->rcv_wscale;
+    uint32_t wnd = (uint32_t)rx_free(k) >> shift;
+    if (wnd > 0xFFFF) wnd = 0xFFFF;
+    k->adv_edge = k->local_ack + (wnd << shift);
+    if (flags & TCP_ACK) k->ack_pending = 0;
+
+    send_tcp(k->remote_ip, k->local_port, k->remote_port, seq, k->local_ack,
+             flags, (uint16_t)wnd, opts, n, data, data_len);
+}
+
+static void tcp_output(tcp_sock_t *k, uint8_t flags, const void *data, int data_len)
+{
+    tcp_output_at(k, k->local_seq, flags, data, data_len);
+}
+
+/* ── TCP send queue ──────────────────────────────────────────────────── */
+/*
+ * tcp_send() only queues.  tcp_push() sends whatever the smaller of the
+ * peer's window and cwnd allows, tcp_ack() frees acknowledged bytes and
+ * runs congestion control, and an RTO (from tcp_timers) goes back to
+ * snd_una and resends with cwnd reset to one segment.
+ */
+static void tcp_send_range(tcp_sock_t *k, uint32_t seq, int len)
+{
+    uint8_t seg[TCP_MSS];
+    if (seq_lt(seq, k->snd_max)) stats.tcp_retransmits++;
+    int pos = (int)((k->tx_tail + (seq - k->snd_una)) % TCP_TX_BUF_SIZE);
+    for (int i = 0; i < len; i++) {
+        seg[i] = k->tx_buf[pos];
+        if (++pos == TCP_TX_BUF_SIZE) pos = 0;
+    }
+    tcp_output_at(k, seq, TCP_ACK | TCP_PSH, seg, len);
+}
+
+static void tcp_push(tcp_sock_t *k)
+{
+    uint64_t now = timer_get_ticks();
+    uint32_t wnd = k->snd_wnd < k->cwnd ? k->snd_wnd : k->cwnd;
+    tx_batch_begin();
+    for (;;) {
+        uint32_t flight = k->local_seq - k->snd_una;
+        if (flight >= k->tx_len) break;         /* All sent (and our FIN) */
+        uint32_t unsent = k->tx_len - flight;
+        if (flight >= wnd) {
+            /* Zero window: the RTO timer doubles as the persist timer */
+            if (!k->rto_due) k->rto_due = now + k->rto;
+            break;
+        }
+        uint32_t n = wnd - flight;
+        if (n > unsent) n = unsent;
+        if (n > k->snd_mss) n = k->snd_mss;
+
+        tcp_send_range(k, k->local_seq, (int)n);
+        if (!k->rtt_timing && k->local_seq == k->snd_max) {
+            k->rtt_timing = 1;
+            k->rtt_seq = k->local_seq + n;
+            k->rtt_start = now;
+        }
+        k->local_seq += n;
+        if (seq_lt(k->snd_max, k->local_seq)) k->snd_max = k->local_seq;
+        if (!k->rto_due) k->rto_due = now + k->rto;
+    }
+
+    /* Our FIN follows the last byte once that has gone out */
+    if ((k->state == TCP_FIN_WAIT || k->state == TCP_LAST_ACK) &&
+        k->local_seq == k->snd_una + k->tx_len) {
+        if (seq_lt(k->local_seq, k->snd_max)) stats.tcp_retransmits++;
+        tcp_output(k, TCP_FIN | TCP_ACK, 0, 0);
+        k->snd_fin = 1;
+        k->snd_fin_seq = k->local_seq++;
+        if (seq_lt(k->snd_max, k->local_seq)) k->snd_max = k->local_seq;
+        if (!k->rto_due) k->rto_due = now + k->rto;
+    }
+    tx_batch_end();
+}
+
+/* Resend the oldest unacknowledged segment: data, or else our FIN */
+static void tcp_resend_head(tcp_sock_t *k)
+{
+    uint32_t n = k->snd_max - k->snd_una;
+    if (n > k->tx_len) n = k->tx_len;
+    if (n > 0) {
+        tcp_send_range(k, k->snd_una, (int)(n < k->snd_mss ? n : k->snd_mss));
+    } else if (k->snd_fin) {
+        stats.tcp_retransmits++;
+        tcp_output_at(k, k->snd_una, TCP_FIN | TCP_ACK, 0, 0);
+    }
+}
+
+static void tcp_rtt_sample(tcp_sock_t *k, int r)
+{
+    if (k->srtt8 == 0) {
+        k->srtt8 = r * 8;
+        k->rttvar4 = r * 2;
+    } else {
+        int delta = r - k->srtt8 / 8;
+        k->srtt8 += delta;
+        if (delta < 0) delta = -delta;
+        k->rttvar4 += delta - k->rttvar4 / 4;
+    }
+    uint32_t rto = (uint32_t)(k->srtt8 / 8 + (k->rttvar4 > 1 ? k->rttvar4 : 1));
+    k->rto = rto < TCP_RTO_MIN ? TCP_RTO_MIN : rto > TCP_RTO_MAX ? TCP_RTO_MAX : rto;
+}
+
+/* Half the data in flight, but at least two segments */
+static uint32_t tcp_half_flight(const tcp_sock_t *k)
+{
+    uint32_t half = (k->snd_max - k->snd_una) / 2;
+    return half > 2u * k->snd_mss ? half : 2u * k->snd_mss;
+}
+
+/* Process the ACK field and window of an incoming segment */
+static void tcp_ack(tcp_sock_t *k, uint32_t ack, uint16_t window, int pure)
+{
+    uint32_t wnd = (uint32_t)window << k->snd_wscale;
+    if (seq_lt(k->snd_max, ack)) return;         /* ACKs data never sent */
+
+    if (seq_lt(k->snd_una, ack)) {
+        uint32_t acked = ack - k->snd_una;
+        uint32_t freed = acked < k->tx_len ? acked : k->tx_len;
+        k->tx_tail = (int)((k->tx_tail + freed) % TCP_TX_BUF_SIZE);
+        k->tx_len -= freed;
+        k->snd_una = ack;
+        if (seq_lt(k->local_seq, ack)) k->local_seq = ack;
+
+        if (k->rtt_timing && seq_leq(k->rtt_seq, ack)) {
+            k->rtt_timing = 0;
+            tcp_rtt_sample(k, (int)(timer_get_ticks() - k->rtt_start));
+        }
 
-    int tcp_total = 20 + data_len;
-    tcp->checksum = tcp_checksum(our_ip, dst_ip, tcp_pkt, tcp_total);
+        if (k->in_recovery) {
+            if (seq_leq(k->recover, ack)) {
+                k->in_recovery = 0;                 /* Full ACK */
+                k->cwnd = k->ssthresh;
+            } else {
+                /* Partial ACK: the next hole is lost too */
+                tcp_resend_head(k);
+                k->cwnd = k->cwnd > acked ? k->cwnd - acked + k->snd_mss : k->snd_mss;
+            }
+        } else if (k->cwnd < k->ssthresh) {
+            k->cwnd += acked < k->snd_mss ? acked : k->snd_mss;
+        } else {
+            uint32_t inc = (uint32_t)k->snd_mss * k->snd_mss / k->cwnd;
+            k->cwnd += inc ? inc : 1;
+        }
+        k->dupacks = 0;
+        k->rto_due = k->snd_una == k->snd_max ? 0 : timer_get_ticks() + k->rto;
+    } else if (pure && ack == k->snd_una && wnd == k->snd_wnd && wnd > 0 &&
+               k->snd_una != k->snd_max) {
+        if (++k->dupacks == 3 && !k->in_recovery) {
+            /* Fast retransmit, then fast recovery */
+            stats.tcp_fast_retransmits++;
+            k->ssthresh = tcp_half_flight(k);
+            tcp_resend_head(k);
+            k->cwnd = k->ssthresh + 3u * k->snd_mss;
+            k->in_recovery = 1;
+            k->recover = k->snd_max;
+            k->rtt_timing = 0;
+        } else if (k->in_recovery) {
+            k->cwnd += k->snd_mss;
+        }
+    }
+    k->snd_wnd = wnd;
+    tcp_push(k);
+}
 
-    send_ipv4(dst_ip, IP_PROTO_TCP, tcp_pkt, tcp_total);
+/* Retransmission timeout: back off and resend from snd_una */
+static void tcp_rto_fire(tcp_sock_t *k)
+{
+    uint64_t now = timer_get_ticks();
+    stats.tcp_timeouts++;
+    k->rto = k->rto * 2 > TCP_RTO_MAX ? TCP_RTO_MAX : k->rto * 2;
+    k->rto_due = now + k->rto;
+    k->rtt_timing = 0;
+    k->dupacks = 0;
+    k->in_recovery = 0;
+
+    if (k->state == TCP_SYN_SENT || k->state == TCP_SYN_RCVD) {
+        uint8_t flags = k->state == TCP_SYN_SENT ? TCP_SYN : TCP_SYN | TCP_ACK;
+        tcp_output_at(k, k->snd_una, flags, 0, 0);
+        return;
+    }
+    if (k->tx_len > 0 && k->snd_wnd == 0) {
+        /* Window probe: the first byte past the closed window */
+        tcp_send_range(k, k->snd_una, 1);
+        k->local_seq = k->snd_una + 1;
+        if (seq_lt(k->snd_max, k->local_seq)) k->snd_max = k->local_seq;
+    } else if (k->snd_una != k->snd_max) {
+        k->ssthresh = tcp_half_flight(k);
+        k->cwnd = k->snd_mss;
+        k->local_seq = k->snd_una;
+        tcp_push(k);
+    } else {
+        k->rto_due = 0;
+    }
 }
 
 /* ── Handle incoming TCP ─────────────────────────────────────────────── */
+static tcp_sock_t *tcp_demux(uint32_t remote_ip, uint16_t remote_port, uint16_t local_port)
+{
+    for (int i = 0; i < TCP_MAX_SOCKETS; i++) {
+        tcp_sock_t *k = &tcp_socks[i];
+        if (k->used && k->state != TCP_CLOSED && k->local_port == local_port &&
+            k->remote_port == remote_port && k->remote_ip == remote_ip)
+            return k;
+    }
+    return (void *)0;
+}
+
+/* MSS, window scale and SACK-permitted from the options of a SYN or SYN-ACK */
+static void tcp_syn_options(tcp_sock_t *k, const uint8_t *opt, int len)
+{
+    int wscale = -1;
+    k->sack_ok = 0;
+    for (int i = 0; i < len; ) {
+        if (opt[i] == 0) break;
+        if (opt[i] == 1) { i++; continue; }
+        if (i + 1 >= len || opt[i + 1] < 2 || i + opt[i + 1] > len) break;
+        if (opt[i] == 2 && opt[i + 1] == 4) k->snd_mss = (uint16_t)((opt[i + 2] << 8) | opt[i + 3]);
+        if (opt[i] == 3 && opt[i + 1] == 3) wscale = opt[i + 2];
+        if (opt[i] == 4) k->sack_ok = 1;
+        i += opt[i + 1];
+    }
+    /* Scaling is used only if both sides offer it */
+    k->rcv_wscale = wscale >= 0 ? TCP_RCV_WSCALE : 0;
+    k->snd_wscale = (uint8_t)(wscale < 0 ? 0 : wscale > 14 ? 14 : wscale);
+    if (k->snd_mss == 0 || k->snd_mss > TCP_MSS) k->snd_mss = TCP_MSS;
+}
+
+/* Record [start, end) as held beyond the hole, merging with neighbours */
+static void tcp_ooo_add(tcp_sock_t *k, uint32_t start, uint32_t end)
+{
+    int i = 0;
+    while (i < k->ooo_count && seq_lt(k->ooo[i].end, start)) i++;
+    if (i < k->ooo_count && seq_leq(k->ooo[i].start, end)) {
+        tcp_range_t *r = &k->ooo[i];
+        if (seq_lt(start, r->start)) r->start = start;
+        if (seq_lt(r->end, end)) r->end = end;
+        while (i + 1 < k->ooo_count && seq_leq(k->ooo[i + 1].start, r->end)) {
+            if (seq_lt(r->end, k->ooo[i + 1].end)) r->end = k->ooo[i + 1].end;
+            for (int m = i + 1; m + 1 < k->ooo_count; m++) k->ooo[m] = k->ooo[m + 1];
+            k->ooo_count--;
+        }
+        return;
+    }
+    if (k->ooo_count == TCP_OOO_MAX) {
+        stats.tcp_ooo_full++;                   /* The peer will send it again */
+        return;
+    }
+    for (int m = k->ooo_count; m > i; m--) k->ooo[m] = k->ooo[m - 1];
+    k->ooo[i].start = start;
+    k->ooo[i].end = end;
+    k->ooo_count++;
+}
+
+/* Take in a data segment.  Returns 1 if it must be ACKed at once: it
+ * was out of order, a duplicate, or it filled a hole.              */
+static int tcp_receive_segment(tcp_sock_t *k, uint32_t seq, const uint8_t *p, int len, int fin)
+{
+    if (fin) {
+        k->fin_pending = 1;
+        k->fin_seq = seq + (uint32_t)len;
+    }
+
+    /* Trim what we already have and what does not fit the window */
+    int32_t off = (int32_t)(seq - k->local_ack);
+    if (off < 0) {
+        uint32_t behind = k->local_ack - seq;  /* -off would overflow at INT32_MIN */
+        if (behind >= (uint32_t)len) {
+            if (len > 0) stats.tcp_dup++;
+            return len > 0;
+        }
+        p += behind;
+        len -= (int)behind;
+        off = 0;
+    }
+    int room = rx_free(k);
+    if (len > 0 && off >= room) {             /* Also keeps off + len from overflowing */
+        stats.tcp_rx_full++;
+        return 1;
+    }
+    if (off + len > room) {
+        stats.tcp_rx_full++;
+        len = room - off;
+        if (len <= 0) return 1;
+    }
+    if (len <= 0) return 0;
+
+    int pos = (k->rx_head + off) % TCP_RX_BUF_SIZE;
+    for (int i = 0; i < len; i++) {
+        k->rx_buf[pos] = p[i];
+        if (++pos == TCP_RX_BUF_SIZE) pos = 0;
+    }
+
+    if (off > 0) {
+        stats.tcp_ooo++;
+        tcp_ooo_add(k, k->local_ack + (uint32_t)off, k->local_ack + (uint32_t)(off + len));
+        return 1;
+    }
+
+    /* In order: advance, then through any held ranges it now reaches */
+    uint32_t end = k->local_ack + (uint32_t)len;
+    int filled = 0;
+    while (k->ooo_count > 0 && seq_leq(k->ooo[0].start, end)) {
+        if (seq_lt(end, k->ooo[0].end)) end = k->ooo[0].end;
+        for (int m = 0; m + 1 < k->ooo_count; m++) k->ooo[m] = k->ooo[m + 1];
+        k->ooo_count--;
+        filled = 1;
+    }
+    k->rx_head = (int)((k->rx_head + (end - k->local_ack)) % TCP_RX_BUF_SIZE);
+    k->local_ack = end;
+    return filled;
+}
+
+/* Our SYN was acknowledged at ack: the connection is open */
+static void tcp_syn_acked(tcp_sock_t *k, uint32_t ack)
+{
+    k->local_seq = ack;
+    k->snd_una = k->snd_max = ack;
+    if (k->rtt_timing) tcp_rtt_sample(k, (int)(timer_get_ticks() - k->rtt_start));
+    k->rtt_timing = 0;
+    k->rto_due = 0;
+    k->cwnd = 4u * k->snd_mss;          /* RFC 3390 initial window */
+    k->ssthresh = 0xFFFFFFFF;
+    k->state = TCP_ESTABLISHED;
+}
+
+static int  tcp_alloc(void);
+static void tcp_free(tcp_sock_t *k);
+
+static tcp_sock_t *tcp_listener(uint16_t port)
+{
+    for (int i = 0; i < TCP_MAX_SOCKETS; i++)
+        if (tcp_socks[i].used && tcp_socks[i].state == TCP_LISTEN &&
+            tcp_socks[i].local_port == port)
+            return &tcp_socks[i];
+    return (void *)0;
+}
+
+/* A SYN for listener l: answer it from a new socket in SYN_RCVD */
+static void tcp_passive_open(tcp_sock_t *l, uint32_t src_ip, uint16_t src_port,
+                             uint32_t seq, uint16_t window, const uint8_t *opt, int opt_len)
+{
+    int s = tcp_alloc();
+    if (s < 0) return;      /* As with a full backlog: the SYN is sent again */
+    tcp_sock_t *k = &tcp_socks[s];
+    k->parent = (int)(l - tcp_socks);
+    k->remote_ip = src_ip;
+    k->remote_port = src_port;
+    k->local_port = l->local_port;
+    tcp_syn_options(k, opt, opt_len);
+    k->remote_seq = seq + 1;
+    k->local_ack = k->remote_seq;
+    k->snd_wnd = window;                /* Never scaled in a SYN */
+
+    /* SYN-ACK, resent from tcp_timers until the handshake's ACK */
+    k->state = TCP_SYN_RCVD;
+    tcp_output(k, TCP_SYN | TCP_ACK, 0, 0);
+    k->local_seq++;
+    k->rtt_timing = 1;
+    k->rtt_start = timer_get_ticks();
+    k->rto_due = k->rtt_start + k->rto;
+}
+
 static void tcp_handle(uint32_t src_ip, const uint8_t *data, int len)
 {
     if (len < 20) return;
     const tcp_header_t *tcp = (const tcp_header_t *)data;
 
+    uint16_t src_port = ntohs(tcp->src_port);
     uint16_t dst_port = ntohs(tcp->dst_port);
     uint32_t seq = ntohl(tcp->seq_num);
     uint32_t ack = ntohl(tcp->ack_num);
@@ -320,54 +983,117 @@ static void tcp_handle(uint32_t src_ip, const uint8_t *data, int len)
     if (hdr_len < 20 || hdr_len > len)
         return;
     int payload_len = len - hdr_len;
-
-    if (dst_port != tcp_local_port || src_ip != tcp_remote_ip)
+    stats.tcp_segs_in++;
+
+    /* No such connection: reset the sender, as for a closed port */
+    tcp_sock_t *k = tcp_demux(src_ip, src_port, dst_port);
+    if (!k) {
+        tcp_sock_t *l = tcp_listener(dst_port);
+        if (l && (tcp->flags & (TCP_SYN | TCP_ACK | TCP_RST)) == TCP_SYN) {
+            tcp_passive_open(l, src_ip, src_port, seq, ntohs(tcp->window),
+                             data + 20, hdr_len - 20);
+            return;
+        }
+        stats.rx_no_socket++;
+        if (tcp->flags & TCP_RST) return;
+        if (tcp->flags & TCP_ACK)
+            send_tcp(src_ip, dst_port, src_port, ack, 0, TCP_RST, 0, 0, 0, 0, 0);
+        else
+            send_tcp(src_ip, dst_port, src_port, 0,
+                     seq + (uint32_t)payload_len + ((tcp->flags & (TCP_SYN | TCP_FIN)) ? 1 : 0),
+                     TCP_RST | TCP_ACK, 0, 0, 0, 0, 0);
         return;
+    }
 
-    if (tcp_state == TCP_SYN_SENT) {
-        if ((tcp->flags & (TCP_SYN | TCP_ACK)) == (TCP_SYN | TCP_ACK)) {
-            tcp_remote_seq = seq + 1;
-            tcp_local_seq = ack;
-            tcp_local_ack = tcp_remote_seq;
-            /* Send ACK */
-            send_tcp(tcp_remote_ip, tcp_local_port, tcp_remote_port,
-                     tcp_local_seq, tcp_local_ack, TCP_ACK, 0, 0);
-            tcp_state = TCP_ESTABLISHED;
+    if (k->state == TCP_SYN_RCVD) {
+        if (tcp->flags & TCP_RST) {
+            tcp_free(k);
+            return;
         }
-    } else if (tcp_state == TCP_ESTABLISHED) {
-        if (payload_len > 0 && seq == tcp_local_ack) {
-            /* Store received data */
-            const uint8_t *payload = data + hdr_len;
-            for (int i = 0; i < payload_len; i++) {
-                int next = (tcp_rx_head + 1) % TCP_RX_BUF_SIZE;
-                if (next == tcp_rx_tail) break;  /* Buffer full */
-                tcp_rx_buf[tcp_rx_head] = payload[i];
-                tcp_rx_head = next;
-            }
-            tcp_local_ack = seq + (uint32_t)payload_len;
-            send_tcp(tcp_remote_ip, tcp_local_port, tcp_remote_port,
-                     tcp_local_seq, tcp_local_ack, TCP_ACK, 0, 0);
+        if (tcp->flags & TCP_SYN) {
+            /* Our SYN-ACK was lost: the peer sent its SYN again */
+            tcp_output_at(k, k->snd_una, TCP_SYN | TCP_ACK, 0, 0);
+            return;
         }
-        if (tcp->flags & TCP_FIN) {
-            tcp_local_ack = seq + 1;
-            if (payload_len > 0)
-                tcp_local_ack = seq + (uint32_t)payload_len + 1;
-            send_tcp(tcp_remote_ip, tcp_local_port, tcp_remote_port,
-                     tcp_local_seq, tcp_local_ack, TCP_ACK | TCP_FIN, 0, 0);
-            tcp_state = TCP_CLOSED;
+        if (!(tcp->flags & TCP_ACK) || ack != k->local_seq) return;
+        tcp_syn_acked(k, ack);
+        /* The ACK may carry data already: on to the established state */
+    }
+
+    if (k->state == TCP_SYN_SENT) {
+        if ((tcp->flags & (TCP_SYN | TCP_ACK)) == (TCP_SYN | TCP_ACK)) {
+            tcp_syn_options(k, data + 20, hdr_len - 20);
+            k->remote_seq = seq + 1;
+            k->snd_wnd = ntohs(tcp->window);    /* Never scaled in a SYN */
+            k->local_ack = k->remote_seq;
+            tcp_syn_acked(k, ack);
+            /* Send ACK */
+            tcp_output(k, TCP_ACK, 0, 0);
+        } else if (tcp->flags & TCP_RST) {
+            k->state = TCP_CLOSED;
         }
+    } else if (k->state != TCP_LISTEN) {
+        /* ESTABLISHED, CLOSE_WAIT, FIN_WAIT or LAST_ACK */
         if (tcp->flags & TCP_RST) {
-            tcp_state = TCP_CLOSED;
+            k->state = TCP_CLOSED;
+            return;
         }
-    } else if (tcp_state == TCP_FIN_WAIT) {
-        if (tcp->flags & (TCP_ACK | TCP_FIN)) {
-            if (tcp->flags & TCP_FIN) {
-                tcp_local_ack = seq + 1;
-                send_tcp(tcp_remote_ip, tcp_local_port, tcp_remote_port,
-                         tcp_local_seq, tcp_local_ack, TCP_ACK, 0, 0);
+        int fin = (tcp->flags & TCP_FIN) != 0;
+        if (tcp->flags & TCP_ACK)
+            tcp_ack(k, ack, ntohs(tcp->window), payload_len == 0 && !fin);
+        if (payload_len > 0 || fin) {
+            int now = tcp_receive_segment(k, seq, data + hdr_len, payload_len,
+                                          fin && !k->fin_rcvd);
+            if (k->fin_pending && k->fin_seq == k->local_ack) {
+                /* The peer is done sending: ACK its FIN at once */
+                k->fin_pending = 0;
+                k->fin_rcvd = 1;
+                k->local_ack++;
+                if (k->state == TCP_ESTABLISHED) k->state = TCP_CLOSE_WAIT;
+                now = 1;
+            } else if (fin && k->fin_rcvd) {
+                now = 1;                        /* Our ACK of it was lost */
             }
-            tcp_state = TCP_CLOSED;
+            /* Otherwise ACK every second segment, or after TCP_DELACK_MS */
+            if (now || ++k->ack_pending >= 2)
+                tcp_output(k, TCP_ACK, 0, 0);
+            else if (k->ack_pending == 1)
+                k->ack_due = timer_get_ticks() + TCP_DELACK_MS;
         }
+        /* Our FIN is acknowledged: nothing more will be sent either way */
+        if ((k->state == TCP_FIN_WAIT || k->state == TCP_LAST_ACK) &&
+            k->snd_fin && seq_lt(k->snd_fin_seq, k->snd_una))
+            k->state = TCP_CLOSED;
+    }
+}
+
+/* Milliseconds until the earliest delayed ACK or retransmission, at
+ * least 1 and at most NET_WAIT_MAX_MS                             */
+static uint32_t tcp_next_timer_ms(void)
+{
+    uint64_t now = timer_get_ticks();
+    uint64_t wait = NET_WAIT_MAX_MS;
+    for (int i = 0; i < TCP_MAX_SOCKETS; i++) {
+        const tcp_sock_t *k = &tcp_socks[i];
+        if (!k->used || k->state == TCP_CLOSED) continue;
+        if (k->rto_due && k->rto_due < now + wait)
+            wait = k->rto_due > now ? k->rto_due - now : 0;
+        if (k->ack_pending && k->ack_due < now + wait)
+            wait = k->ack_due > now ? k->ack_due - now : 0;
+    }
+    return wait ? (uint32_t)wait : 1;
+}
+
+/* Delayed ACKs and retransmissions that have come due */
+static void tcp_timers(void)
+{
+    uint64_t now = timer_get_ticks();
+    for (int i = 0; i < TCP_MAX_SOCKETS; i++) {
+        tcp_sock_t *k = &tcp_socks[i];
+        if (!k->used || k->state == TCP_CLOSED) continue;
+        if (k->rto_due && now >= k->rto_due) tcp_rto_fire(k);
+        if (k->state != TCP_CLOSED && k->ack_pending && now >= k->ack_due)
+            tcp_output(k, TCP_ACK, 0, 0);
     }
 }
 
@@ -402,25 +1128,50 @@ static void udp_handle(uint32_t src_ip, const uint8_t *data, int len)
                 dns_response_len = (int)sizeof(dns_response);
             mem_copy(dns_response, payload, dns_response_len);
             dns_response_ready = 1;
+            return;
         }
     }
+    stats.rx_no_port++;
 }
 
 /* ── Handle incoming IPv4 ────────────────────────────────────────────── */
-static void ipv4_handle(const uint8_t *data, int len)
+/* csum is the frame's NETBUF_RX_CSUM_* flags: what the NIC checked
+ * need not be summed again.                                       */
+static void ipv4_handle(const uint8_t *data, int len, uint16_t csum)
 {
     if (len < 20) return;
+    if (csum & NETBUF_RX_CSUM_BAD) {
+        stats.rx_bad_csum++;
+        return;
+    }
     const ipv4_header_t *ip = (const ipv4_header_t *)data;
     int hdr_len = (ip->ver_ihl & 0x0F) * 4;
     if (hdr_len < 20 || hdr_len > len) return;
     int total = ntohs(ip->total_len);
+    if (total < hdr_len) return;
     if (total > len) total = len;
     int payload_len = total - hdr_len;
     const uint8_t *payload = data + hdr_len;
 
+    if (!(csum & NETBUF_RX_CSUM_OK)) {
+        int bad = ip_checksum(ip, hdr_len) != 0;
+        if (!bad && (ip->protocol == IP_PROTO_TCP ||
+                     (ip->protocol == IP_PROTO_UDP && payload_len >= 8 &&
+                      ((const udp_header_t *)payload)->checksum != 0))) {
+            uint64_t sum = pseudo_sum(ip->src_ip, ip->dst_ip, ip->protocol, payload_len);
+            bad = csum_fold(csum_partial(payload, payload_len, sum)) != 0xFFFF;
+        }
+        if (bad) {
+            stats.rx_bad_csum++;
+            return;
+        }
+    }
+
     if (ip->protocol == IP_PROTO_UDP) {
         udp_handle(ip->src_ip, payload, payload_len);
-    } else if (ip->protocol == IP_PROTO_TCP) {
+    } else if (ip->protocol == IP_PROTO_TCP &&
+               (ip->dst_ip == our_ip ||
+                ((csum & NETBUF_RX_LOOPBACK) && ip_is_loopback(ip->dst_ip)))) {
         tcp_handle(ip->src_ip, payload, payload_len);
     }
 }
@@ -430,21 +1181,36 @@ void net_stack_process(void)
 {
     if (!net_is_available()) return;
 
-    int len = net_receive(rx_pkt, sizeof(rx_pkt));
-    while (len > 0) {
-        if (len >= (int)sizeof(eth_header_t)) {
-            eth_header_t *eth = (eth_header_t *)rx_pkt;
+    /* Frames are parsed where the NIC left them; replies are batched */
+    tx_batch_begin();
+    netbuf_t *nb;
+    while ((nb = net_receive_buf()) != (void *)0) {
+        int len = nb->len;
+        pcap_record(nb->data, len);
+        if (len >= NET_HDR_ETH) {
+            eth_header_t *eth = (eth_header_t *)nb->data;
             uint16_t type = ntohs(eth->ethertype);
-            int payload_off = (int)sizeof(eth_header_t);
-            int payload_len = len - payload_off;
+            int payload_len = len - NET_HDR_ETH;
 
             if (type == ETH_TYPE_ARP)
-                arp_handle(rx_pkt + payload_off, payload_len);
+                arp_handle(nb->data + NET_HDR_ETH, payload_len);
             else if (type == ETH_TYPE_IPV4)
-                ipv4_handle(rx_pkt + payload_off, payload_len);
+                ipv4_handle(nb->data + NET_HDR_ETH, payload_len, nb->flags);
         }
-        len = net_receive(rx_pkt, sizeof(rx_pkt));
+        netbuf_put(nb);
     }
+
+    /* Loopback: only what was queued before this pass, so the answers
+     * it provokes wait for the next one                             */
+    for (int n = loop_count; n > 0; n--) {
+        nb = loop_queue[loop_head];
+        loop_head = (loop_head + 1) % NETBUF_COUNT;
+        loop_count--;
+        ipv4_handle(nb->data + NET_HDR_ETH, nb->len - NET_HDR_ETH, nb->flags);
+        netbuf_put(nb);
+    }
+    tcp_timers();
+    tx_batch_end();
 }
 
 /* ── DNS Resolution ──────────────────────────────────────────────────── */
@@ -473,13 +1239,10 @@ static int is_ip_address(const char *s)
     return dots == 3;
 }
 
-uint32_t dns_resolve(const char *hostname)
+/* Ask the DNS server for an A record; *ttl gets its lifetime in seconds */
+static uint32_t dns_query(const char *hostname, uint32_t *ttl)
 {
-    if (!net_is_available()) return 0;
-
-    /* Check if it's already an IP address */
-    if (is_ip_address(hostname))
-        return parse_ip_string(hostname);
+    progress_set(NET_PROGRESS_RESOLVING);
 
     /* Build DNS query */
     uint8_t query[256];
@@ -518,7 +1281,7 @@ uint32_t dns_resolve(const char *hostname)
     /* Wait for response */
     uint64_t start = timer_get_ticks();
     while (!dns_response_ready && timer_get_ticks() - start < 3000) {
-        net_stack_process();
+        net_wait_poll();
     }
 
     if (!dns_response_ready) return 0;
@@ -555,6 +1318,8 @@ skip_q_done:
         uint16_t rtype = (uint16_t)((resp[rpos] << 8) | resp[rpos + 1]);
         rpos += 2;  /* TYPE */
         rpos += 2;  /* CLASS */
+        *ttl = ((uint32_t)resp[rpos] << 24) | ((uint32_t)resp[rpos + 1] << 16) |
+               ((uint32_t)resp[rpos + 2] << 8) | resp[rpos + 3];
         rpos += 4;  /* TTL */
         uint16_t rdlength = (uint16_t)((resp[rpos] << 8) | resp[rpos + 1]);
         rpos += 2;
@@ -571,73 +1336,283 @@ skip_q_done:
     return 0;
 }
 
+/* ── DNS Cache ───────────────────────────────────────────────────────── */
+/* Answers are kept for their TTL (capped at a day), least recently used
+ * first out, so repeat requests to a host skip the lookup.            */
+#define DNS_CACHE_SIZE  16
+#define DNS_NAME_MAX    128
+#define DNS_TTL_MAX     86400
+
+typedef struct {
+    char     name[DNS_NAME_MAX];
+    uint32_t ip;                /* 0: slot unused */
+    uint64_t expires;           /* timer ms */
+    uint64_t last_use;
+} dns_cache_entry_t;
+
+static dns_cache_entry_t dns_cache[DNS_CACHE_SIZE];
+static uint64_t          dns_cache_clock;
+
+uint32_t dns_resolve(const char *hostname)
+{
+    if (!net_is_available()) return 0;
+
+    /* Check if it's already an IP address */
+    if (is_ip_address(hostname))
+        return parse_ip_string(hostname);
+
+    uint64_t now = timer_get_ticks();
+    dns_cache_entry_t *victim = &dns_cache[0];
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dns_cache_entry_t *e = &dns_cache[i];
+        if (e->ip && str_eq_ns(e->name, hostname)) {
+            if (now < e->expires) {
+                e->last_use = ++dns_cache_clock;
+                stats.dns_cache_hits++;
+                return e->ip;
+            }
+            e->ip = 0;
+        }
+        if (victim->ip && (!e->ip || e->last_use < victim->last_use)) victim = e;
+    }
+
+    uint32_t ttl = 0;
+    stats.dns_queries++;
+    uint32_t ip = dns_query(hostname, &ttl);
+    uint32_t ms = (uint32_t)(timer_get_ticks() - now);
+    if (ip) {
+        stats.dns_total_ms += ms;
+        stats.dns_last_ms = ms;
+        if (ms > stats.dns_max_ms) stats.dns_max_ms = ms;
+    } else {
+        stats.dns_failures++;
+    }
+    int n = 0;
+    while (hostname[n] && n < DNS_NAME_MAX) n++;
+    if (ip && ttl && n < DNS_NAME_MAX) {
+        if (ttl > DNS_TTL_MAX) ttl = DNS_TTL_MAX;
+        for (int i = 0; i <= n; i++) victim->name[i] = hostname[i];
+        victim->ip = ip;
+        victim->expires = timer_get_ticks() + (uint64_t)ttl * 1000;
+        victim->last_use = ++dns_cache_clock;
+    }
+    return ip;
+}
+
+/* ── Statistics ──────────────────────────────────────────────────────── */
+void net_stack_get_stats(net_stack_stats_t *out)
+{
+    *out = stats;
+}
+
 /* ── TCP Connection ──────────────────────────────────────────────────── */
+/* Next ephemeral port not used by an open socket */
+static uint16_t tcp_alloc_port(void)
+{
+    for (;;) {
+        uint16_t port = tcp_next_port++;
+        if (tcp_next_port == 0) tcp_next_port = 49152;
+        int busy = 0;
+        for (int i = 0; i < TCP_MAX_SOCKETS; i++)
+            if (tcp_socks[i].used && tcp_socks[i].local_port == port) busy = 1;
+        if (!busy) return port;
+    }
+}
+
+/* A free socket with its buffers and no connection yet; -1 if none */
+static int tcp_alloc(void)
+{
+    int s = 0;
+    while (s < TCP_MAX_SOCKETS && tcp_socks[s].used) s++;
+    if (s == TCP_MAX_SOCKETS) return -1;
+    tcp_sock_t *k = &tcp_socks[s];
+    k->rx_buf = (uint8_t *)kmalloc(TCP_RX_BUF_SIZE);
+    k->tx_buf = (uint8_t *)kmalloc(TCP_TX_BUF_SIZE);
+    if (!k->rx_buf || !k->tx_buf) {
+        kfree(k->rx_buf);
+        kfree(k->tx_buf);
+        k->rx_buf = k->tx_buf = (void *)0;
+        return -1;
+    }
+
+    k->used = 1;
+    k->parent = -1;
+    k->local_seq = (uint32_t)(timer_get_ticks() & 0xFFFFFFFF);
+    k->local_ack = 0;
+    k->rx_head = 0;
+    k->rx_tail = 0;
+    k->rcv_wscale = 0;
+    k->sack_ok = 0;
+    k->ooo_count = 0;
+    k->fin_pending = 0;
+    k->fin_rcvd = 0;
+    k->ack_pending = 0;
+    k->tx_tail = 0;
+    k->tx_len = 0;
+    k->snd_una = k->snd_max = k->local_seq;
+    k->snd_wnd = 0;
+    k->snd_wscale = 0;
+    k->snd_mss = 0;
+    k->snd_fin = 0;
+    k->dupacks = 0;
+    k->in_recovery = 0;
+    k->srtt8 = 0;
+    k->rttvar4 = 0;
+    k->rto = TCP_RTO_INIT;
+    return s;
+}
+
+static void tcp_free(tcp_sock_t *k)
+{
+    k->state = TCP_CLOSED;
+    kfree(k->rx_buf);
+    kfree(k->tx_buf);
+    k->rx_buf = (void *)0;
+    k->tx_buf = (void *)0;
+    k->used = 0;
+}
+
 int tcp_connect(uint32_t dst_ip, uint16_t dst_port)
 {
     if (!net_is_available()) return -1;
-    if (tcp_state != TCP_CLOSED) return -1;
-
-    tcp_remote_ip = dst_ip;
-    tcp_remote_port = dst_port;
-    tcp_local_port = tcp_next_port++;
-    tcp_local_seq = (uint32_t)(timer_get_ticks() & 0xFFFFFFFF);
-    tcp_local_ack = 0;
-    tcp_rx_head = 0;
-    tcp_rx_tail = 0;
-
-    /* Send SYN */
-    tcp_state = TCP_SYN_SENT;
-    send_tcp(dst_ip, tcp_local_port, dst_port,
-             tcp_local_seq, 0, TCP_SYN, 0, 0);
-    tcp_local_seq++;  /* SYN consumes one sequence number */
+
+    int s = tcp_alloc();
+    if (s < 0) return -1;
+    tcp_sock_t *k = &tcp_socks[s];
+
+    progress_set(NET_PROGRESS_CONNECTING);
+    k->remote_ip = dst_ip;
+    k->remote_port = dst_port;
+    k->local_port = tcp_alloc_port();
+
+    /* Send SYN; it is resent from tcp_timers until answered */
+    k->state = TCP_SYN_SENT;
+    tcp_output(k, TCP_SYN, 0, 0);
+    k->local_seq++;  /* SYN consumes one sequence number */
+    k->rtt_timing = 1;
+    k->rtt_start = timer_get_ticks();
+    k->rto_due = k->rtt_start + k->rto;
 
     /* Wait for SYN-ACK */
     uint64_t start = timer_get_ticks();
-    while (tcp_state == TCP_SYN_SENT && timer_get_ticks() - start < 5000) {
-        net_stack_process();
+    while (k->state == TCP_SYN_SENT && timer_get_ticks() - start < 5000) {
+        net_wait_poll();
     }
 
-    return (tcp_state == TCP_ESTABLISHED) ? 0 : -1;
+    if (k->state != TCP_ESTABLISHED) {
+        tcp_close(s);
+        return -1;
+    }
+    return s;
 }
 
-int tcp_send_data(const void *data, int len)
+int tcp_listen(uint16_t port)
 {
-    if (tcp_state != TCP_ESTABLISHED) return -1;
+    if (!net_is_available() || tcp_listener(port)) return -1;
+
+    int s = 0;
+    while (s < TCP_MAX_SOCKETS && tcp_socks[s].used) s++;
+    if (s == TCP_MAX_SOCKETS) return -1;
+    tcp_sock_t *k = &tcp_socks[s];
+    mem_zero(k, sizeof(*k));
+    k->used = 1;
+    k->parent = -1;
+    k->local_port = port;
+    k->state = TCP_LISTEN;
+    return s;
+}
 
-    const uint8_t *p = (const uint8_t *)data;
-    int sent = 0;
-    while (sent < len) {
-        int chunk = len - sent;
-        if (chunk > 1400) chunk = 1400;  /* MSS */
-        send_tcp(tcp_remote_ip, tcp_local_port, tcp_remote_port,
-                 tcp_local_seq, tcp_local_ack,
-                 TCP_ACK | TCP_PSH, p + sent, chunk);
-        tcp_local_seq += (uint32_t)chunk;
-        sent += chunk;
+/* Wait up to timeout_ms for a connection that has completed its handshake */
+int tcp_accept(int listener, int timeout_ms)
+{
+    tcp_sock_t *l = tcp_sock(listener);
+    if (!l || l->state != TCP_LISTEN) return -1;
 
-        /* Brief delay to avoid overwhelming */
-        uint64_t t = timer_get_ticks();
-        while (timer_get_ticks() - t < 10)
-            net_stack_process();
+    uint64_t start = timer_get_ticks();
+    for (;;) {
+        for (int i = 0; i < TCP_MAX_SOCKETS; i++) {
+            tcp_sock_t *k = &tcp_socks[i];
+            if (k->used && k->parent == listener && k->state != TCP_SYN_RCVD) {
+                k->parent = -1;
+                return i;
+            }
+        }
+        if (timer_get_ticks() - start >= (uint64_t)timeout_ms) return -1;
+        net_wait_poll();
+    }
+}
+
+/* Our direction is open until tcp_close(), whether or not the peer's is */
+static int tcp_can_send(const tcp_sock_t *k)
+{
+    return k->state == TCP_ESTABLISHED || k->state == TCP_CLOSE_WAIT;
+}
+
+/* Queue data for sending.  Blocks only while the send queue is full,
+ * and returns once all of it is queued (-1 if the connection drops). */
+int tcp_send(int s, const void *data, int len)
+{
+    tcp_sock_t *k = tcp_sock(s);
+    if (!k || !tcp_can_send(k)) return -1;
+
+    const uint8_t *p = (const uint8_t *)data;
+    int queued = 0;
+    uint64_t last = timer_get_ticks();
+    while (queued < len) {
+        uint32_t room = TCP_TX_BUF_SIZE - k->tx_len;
+        if (room == 0) {
+            /* Wait for ACKs, giving up if none come for 30 s */
+            if (timer_get_ticks() - last > 30000) return -1;
+            net_wait_poll();
+            if (!tcp_can_send(k)) return -1;
+            continue;
+        }
+        uint32_t n = (uint32_t)(len - queued) < room ? (uint32_t)(len - queued) : room;
+        int pos = (int)((k->tx_tail + k->tx_len) % TCP_TX_BUF_SIZE);
+        for (uint32_t i = 0; i < n; i++) {
+            k->tx_buf[pos] = p[queued + i];
+            if (++pos == TCP_TX_BUF_SIZE) pos = 0;
+        }
+        k->tx_len += n;
+        queued += (int)n;
+        last = timer_get_ticks();
+        tcp_push(k);
     }
-    return sent;
+    return queued;
 }
 
-int tcp_receive_data(void *buf, int buf_size, int timeout_ms)
+/* After the application has read: send the ACK still owed, or tell the
+ * peer about a window that had nearly closed and has now reopened.   */
+static void tcp_read_done(tcp_sock_t *k)
 {
+    if (k->state != TCP_ESTABLISHED) return;
+    int32_t had = (int32_t)(k->adv_edge - k->local_ack);
+    int32_t gain = (int32_t)(k->local_ack + (uint32_t)rx_free(k) - k->adv_edge);
+    if (k->ack_pending || (had < TCP_RX_BUF_SIZE / 2 && gain >= TCP_MSS))
+        tcp_output(k, TCP_ACK, 0, 0);
+}
+
+int tcp_recv(int s, void *buf, int buf_size, int timeout_ms)
+{
+    tcp_sock_t *k = tcp_sock(s);
+    if (!k) return -1;
+
     uint8_t *dst = (uint8_t *)buf;
     int received = 0;
     uint64_t start = timer_get_ticks();
 
     while (received < buf_size) {
-        net_stack_process();
+        net_wait_poll();
 
-        while (tcp_rx_tail != tcp_rx_head && received < buf_size) {
-            dst[received++] = tcp_rx_buf[tcp_rx_tail];
-            tcp_rx_tail = (tcp_rx_tail + 1) % TCP_RX_BUF_SIZE;
+        int before = received;
+        while (k->rx_tail != k->rx_head && received < buf_size) {
+            dst[received++] = k->rx_buf[k->rx_tail];
+            k->rx_tail = (k->rx_tail + 1) % TCP_RX_BUF_SIZE;
         }
+        progress_add(received - before);
+        if (received > before) tcp_read_done(k);
 
-        if (received > 0 && tcp_rx_tail == tcp_rx_head) {
+        if (received > 0 && received < buf_size && k->rx_tail == k->rx_head) {
             /* Got some data and buffer empty, wait for more but respect timeout */
             uint64_t elapsed = timer_get_ticks() - start;
             if (elapsed >= (uint64_t)timeout_ms) break;
@@ -645,13 +1620,13 @@ int tcp_receive_data(void *buf, int buf_size, int timeout_ms)
             uint64_t inter_wait = (remaining_ms < 500) ? remaining_ms : 500;
             uint64_t wait_start = timer_get_ticks();
             while (timer_get_ticks() - wait_start < inter_wait) {
-                net_stack_process();
-                if (tcp_rx_tail != tcp_rx_head) break;
+                net_wait_poll();
+                if (k->rx_tail != k->rx_head) break;
             }
-            if (tcp_rx_tail == tcp_rx_head) break;
+            if (k->rx_tail == k->rx_head) break;
         }
 
-        if (tcp_state == TCP_CLOSED && tcp_rx_tail == tcp_rx_head)
+        if ((k->state == TCP_CLOSED || k->fin_rcvd) && k->rx_tail == k->rx_head)
             break;
 
         if (timer_get_ticks() - start > (uint64_t)timeout_ms)
@@ -660,109 +1635,579 @@ int tcp_receive_data(void *buf, int buf_size, int timeout_ms)
     return received;
 }
 
-void tcp_close(void)
+/* Wait up to timeout_ms for data, then take only what has arrived */
+static int tcp_receive_some(int s, void *buf, int buf_size, int timeout_ms)
 {
-    if (tcp_state == TCP_ESTABLISHED) {
-        send_tcp(tcp_remote_ip, tcp_local_port, tcp_remote_port,
-                 tcp_local_seq, tcp_local_ack, TCP_FIN | TCP_ACK, 0, 0);
-        tcp_local_seq++;
-        tcp_state = TCP_FIN_WAIT;
+    tcp_sock_t *k = tcp_sock(s);
+    if (!k) return 0;
+    uint8_t *dst = (uint8_t *)buf;
+    uint64_t start = timer_get_ticks();
 
-        uint64_t start = timer_get_ticks();
-        while (tcp_state != TCP_CLOSED && timer_get_ticks() - start < 2000)
-            net_stack_process();
+    net_wait_poll();
+    while (k->rx_tail == k->rx_head) {
+        if (k->state == TCP_CLOSED || k->fin_rcvd) return 0;
+        if (timer_get_ticks() - start >= (uint64_t)timeout_ms) return 0;
+        net_wait_poll();
+    }
+
+    int received = 0;
+    while (k->rx_tail != k->rx_head && received < buf_size) {
+        dst[received++] = k->rx_buf[k->rx_tail];
+        k->rx_tail = (k->rx_tail + 1) % TCP_RX_BUF_SIZE;
     }
-    tcp_state = TCP_CLOSED;
+    progress_add(received);
+    tcp_read_done(k);
+    return received;
 }
 
-int tcp_is_connected(void)
+/* Throw away whatever has been received and not read yet */
+static void tcp_discard(int s)
 {
-    return tcp_state == TCP_ESTABLISHED;
+    tcp_sock_t *k = tcp_sock(s);
+    if (k) k->rx_tail = k->rx_head;
+}
+
+void tcp_close(int s)
+{
+    tcp_sock_t *k = tcp_sock(s);
+    if (!k) return;
+    if (k->state == TCP_LISTEN) {
+        for (int i = 0; i < TCP_MAX_SOCKETS; i++) {
+            tcp_sock_t *c = &tcp_socks[i];
+            if (!c->used || c->parent != s) continue;
+            if (c->state != TCP_CLOSED) tcp_output(c, TCP_RST | TCP_ACK, 0, 0);
+            tcp_free(c);
+        }
+    }
+    /* Let queued data drain first; our FIN goes out right behind it */
+    uint64_t start = timer_get_ticks();
+    while (tcp_can_send(k) && k->tx_len > 0 && timer_get_ticks() - start < 5000)
+        net_wait_poll();
+    if (tcp_can_send(k)) {
+        k->state = k->state == TCP_CLOSE_WAIT ? TCP_LAST_ACK : TCP_FIN_WAIT;
+        tcp_push(k);
+
+        start = timer_get_ticks();
+        while (k->state != TCP_CLOSED && timer_get_ticks() - start < 2000)
+            net_wait_poll();
+    }
+    tcp_free(k);
+}
+
+int tcp_is_connected(int s)
+{
+    tcp_sock_t *k = tcp_sock(s);
+    return k && k->state == TCP_ESTABLISHED;
 }
 
 /* ── HTTP GET ────────────────────────────────────────────────────────── */
 static int str_len_ns(const char *s) { int n = 0; while (s[n]) n++; return n; }
 
-int http_get(const char *host, uint16_t port, const char *path,
-             char *response_buf, int buf_size)
+static const char *request_headers = (void *)0;
+static http_response_info_t last_response;
+
+void net_set_request_headers(const char *headers)
 {
-    if (!net_is_available()) return -1;
+    request_headers = headers;
+}
 
-    /* Resolve hostname */
-    uint32_t ip = dns_resolve(host);
-    if (!ip) return -1;
+const http_response_info_t *net_last_response(void)
+{
+    return &last_response;
+}
 
-    /* Connect */
-    if (tcp_connect(ip, port) != 0)
-        return -1;
+/* "GET path HTTP/1.1", Host, the fixed headers, then any set with
+ * net_set_request_headers().  Returns the length, or -1 if too long. */
+static int build_get_request(char *out, int size, const char *host,
+                             const char *path, const char *fixed)
+{
+    const char *parts[] = { "GET ", path, " HTTP/1.1\r\nHost: ", host, "\r\n",
+                            fixed, request_headers ? request_headers : "", "\r\n" };
+    int len = 0;
+    for (unsigned p = 0; p < sizeof(parts) / sizeof(parts[0]); p++)
+        for (const char *c = parts[p]; *c; c++) {
+            if (len >= size - 1) return -1;
+            out[len++] = *c;
+        }
+    out[len] = 0;
+    return len;
+}
 
-    /* Build HTTP request */
-    char request[512];
-    int rpos = 0;
-    int max_rpos = (int)(sizeof(request) - 1);
-    const char *get = "GET ";
-    for (int i = 0; get[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = get[i];
+static char lower_ns(char c) { return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c; }
+
+/* Does the header line at s (length n) start with `name:`? */
+static int header_is(const char *s, int n, const char *name)
+{
+    int i = 0;
+    for (; name[i]; i++)
+        if (i >= n || lower_ns(s[i]) != name[i]) return 0;
+    return i < n && s[i] == ':';
+}
+
+/* Copy a header's value (after "name:" and blanks) into out */
+static void header_value(const char *s, int n, int name_len, char *out, int size)
+{
+    int i = name_len + 1, o = 0;
+    while (i < n && (s[i] == ' ' || s[i] == '\t')) i++;
+    while (i < n && o < size - 1) out[o++] = s[i++];
+    out[o] = 0;
+}
+
+/* Seconds since 1970 for an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT"),
+ * or -1 if it does not parse                                           */
+static int64_t http_date(const char *s)
+{
+    static const char months[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+    while (*s && (*s < '0' || *s > '9')) s++;
+    int day = 0, year = 0, hh = 0, mm = 0, ss = 0, mon = -1;
+    while (*s >= '0' && *s <= '9') day = day * 10 + (*s++ - '0');
+    while (*s == ' ' || *s == '-') s++;
+    for (int m = 0; m < 12 && s[0] && s[1] && s[2]; m++)
+        if (lower_ns(s[0]) == months[m * 3] && lower_ns(s[1]) == months[m * 3 + 1] &&
+            lower_ns(s[2]) == months[m * 3 + 2]) { mon = m; break; }
+    if (mon < 0) return -1;
+    s += 3;
+    while (*s == ' ' || *s == '-') s++;
+    while (*s >= '0' && *s <= '9') year = year * 10 + (*s++ - '0');
+    while (*s == ' ') s++;
+    while (*s >= '0' && *s <= '9') hh = hh * 10 + (*s++ - '0');
+    if (*s == ':') s++;
+    while (*s >= '0' && *s <= '9') mm = mm * 10 + (*s++ - '0');
+    if (*s == ':') s++;
+    while (*s >= '0' && *s <= '9') ss = ss * 10 + (*s++ - '0');
+    if (year < 100) year += 1900 + (year < 70 ? 100 : 0);
+    if (day < 1 || day > 31 || year < 1970) return -1;
+
+    /* Days from civil date (proleptic Gregorian, March-based year) */
+    int y = year - (mon < 2);
+    int era = y / 400, yoe = y - era * 400;
+    int mp = (mon + 9) % 12;
+    int doy = (153 * mp + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+    return days * 86400 + hh * 3600 + mm * 60 + ss;
+}
+
+/* Case-insensitive match of a Cache-Control directive name */
+static int directive_is(const char *d, const char *name)
+{
+    int i = 0;
+    for (; name[i]; i++)
+        if (lower_ns(d[i]) != name[i]) return 0;
+    return d[i] == 0 || d[i] == ',' || d[i] == '=' || d[i] == ' ';
+}
+
+/* Fill last_response from the status line and headers in buf[0, len) */
+static void parse_response_headers(const char *buf, int len)
+{
+    http_response_info_t *r = &last_response;
+    char expires[48] = { 0 }, date[48] = { 0 }, cc[128] = { 0 };
+    int has_expires = 0;
+
+    char conn[32] = { 0 }, te[32] = { 0 }, ce[32] = { 0 };
+
+    r->status = 0;
+    r->fresh_secs = -1;
+    r->no_store = 0;
+    r->etag[0] = 0;
+    r->last_modified[0] = 0;
+    r->content_length = -1;
+    r->chunked = 0;
+    r->keep_alive = 0;
+    r->content_encoding = HTTP_ENCODING_IDENTITY;
+    r->corrupt = 0;
+
+    /* "HTTP/1.1 200 OK"; 1.1 connections stay open unless told otherwise */
+    int i = 0;
+    int http11 = len >= 8 && buf[5] == '1' && buf[6] == '.' && buf[7] == '1';
+    while (i < len && buf[i] != ' ' && buf[i] != '\r') i++;
+    while (i < len && buf[i] == ' ') i++;
+    while (i < len && buf[i] >= '0' && buf[i] <= '9') r->status = r->status * 10 + (buf[i++] - '0');
+
+    while (i < len) {
+        while (i < len && buf[i] != '\n') i++;
+        int line = ++i, end = line;
+        while (end < len && buf[end] != '\r' && buf[end] != '\n') end++;
+        int n = end - line;
+        if (n == 0) break;
+        const char *h = buf + line;
+        if (header_is(h, n, "etag"))               header_value(h, n, 4, r->etag, sizeof(r->etag));
+        else if (header_is(h, n, "last-modified")) header_value(h, n, 13, r->last_modified, sizeof(r->last_modified));
+        else if (header_is(h, n, "expires"))     { header_value(h, n, 7, expires, sizeof(expires)); has_expires = 1; }
+        else if (header_is(h, n, "date"))          header_value(h, n, 4, date, sizeof(date));
+        else if (header_is(h, n, "cache-control")) header_value(h, n, 13, cc, sizeof(cc));
+        else if (header_is(h, n, "connection"))    header_value(h, n, 10, conn, sizeof(conn));
+        else if (header_is(h, n, "transfer-encoding")) header_value(h, n, 17, te, sizeof(te));
+        else if (header_is(h, n, "content-encoding"))  header_value(h, n, 16, ce, sizeof(ce));
+        else if (header_is(h, n, "content-length")) {
+            char v[16];
+            header_value(h, n, 14, v, sizeof(v));
+            r->content_length = 0;
+            for (int d = 0; v[d] >= '0' && v[d] <= '9'; d++) r->content_length = r->content_length * 10 + (v[d] - '0');
+        }
+        i = end;
     }
-    for (int i = 0; path[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = path[i];
+
+    if (directive_is(te, "chunked")) {
+        r->chunked = 1;
+        r->content_length = -1;
     }
-    const char *ver = " HTTP/1.1\r\nHost: ";
-    for (int i = 0; ver[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = ver[i];
+    r->keep_alive = directive_is(conn, "close") ? 0 : (http11 || directive_is(conn, "keep-alive"));
+    if (directive_is(ce, "gzip") || directive_is(ce, "x-gzip"))
+        r->content_encoding = HTTP_ENCODING_GZIP;
+    else if (directive_is(ce, "deflate"))
+        r->content_encoding = HTTP_ENCODING_DEFLATE;
+
+    /* Cache-Control directives outrank Expires */
+    int max_age = -1, no_cache = 0;
+    for (int c = 0; cc[c]; ) {
+        while (cc[c] == ' ' || cc[c] == ',') c++;
+        const char *d = cc + c;
+        if (directive_is(d, "no-store")) r->no_store = 1;
+        else if (directive_is(d, "no-cache") || directive_is(d, "must-revalidate")) no_cache = 1;
+        else if (directive_is(d, "max-age") && d[7] == '=') {
+            max_age = 0;
+            for (const char *v = d + 8; *v >= '0' && *v <= '9'; v++) max_age = max_age * 10 + (*v - '0');
+        }
+        while (cc[c] && cc[c] != ',') c++;
     }
-    for (int i = 0; host[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = host[i];
+
+    if (no_cache) {
+        r->fresh_secs = 0;
+    } else if (max_age >= 0) {
+        r->fresh_secs = max_age;
+    } else if (has_expires) {
+        /* Judged against the server's own clock, so ours need not be set */
+        int64_t e = http_date(expires), d = http_date(date);
+        r->fresh_secs = (e >= 0 && d >= 0 && e > d) ? (int)(e - d) : 0;
     }
-    const char *hdr = "\r\nConnection: close\r\nUser-Agent: nextOS/3.0.0\r\n\r\n";
-    for (int i = 0; hdr[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = hdr[i];
+}
+
+/* ── Response bodies ─────────────────────────────────────────────────── */
+/*
+ * Received bytes are collected until the header block ends; after that
+ * the body goes through the chunked decoder and then the inflater as it
+ * arrives, and what comes out is appended to the caller's rope and handed
+ * to the body hook.  It never has to be buffered in its wire form.
+ */
+#define RESP_HDR_MAX 8192
+
+enum { CHUNK_SIZE, CHUNK_EXT, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER, CHUNK_DONE };
+
+static struct {
+    rope_t    *out;
+    char       hdr[RESP_HDR_MAX];
+    int        hdr_len;
+    int        framed;          /* Header block seen and parsed  */
+    int        stop;            /* Out of room, or undecodable   */
+    int        full;            /* Stopped by the rope's limit   */
+    int        z_rc;            /* Last inflate_feed() result    */
+    uint32_t   raw;             /* Body bytes as sent            */
+    int        chunk_state;
+    uint32_t   chunk_left;
+    int        line_len;
+    inflate_t *z;
+} resp;
+
+static char resp_rx[4096];
+
+static void resp_output(void *ctx, const uint8_t *data, int len)
+{
+    (void)ctx;
+    if (resp.stop) return;
+    int stored = (int)rope_append(resp.out, data, (uint32_t)len);
+    if (stored < len) resp.stop = resp.full = 1;
+    body_deliver((const char *)data, stored);
+}
+
+static void resp_decode(const char *data, int len)
+{
+    if (!resp.z) {
+        resp_output((void *)0, (const uint8_t *)data, len);
+    } else if ((resp.z_rc = inflate_feed(resp.z, (const uint8_t *)data, len)) < 0) {
+        resp.stop = 1;
     }
-    request[rpos] = 0;
+}
 
-    /* Send request */
-    tcp_send_data(request, rpos);
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-    /* Receive response */
-    int total = tcp_receive_data(response_buf, buf_size - 1, 10000);
-    response_buf[total] = 0;
+/* Transfer-Encoding: chunked, one state per part of the framing */
+static void resp_dechunk(const char *p, int n)
+{
+    while (n > 0 && resp.chunk_state != CHUNK_DONE && !resp.stop) {
+        char c = *p;
+        switch (resp.chunk_state) {
+        case CHUNK_SIZE: {
+            int d = hex_digit(c);
+            if (d >= 0) {
+                if (resp.chunk_left >> 27) { resp.stop = 1; break; }
+                resp.chunk_left = resp.chunk_left * 16 + (uint32_t)d;
+                break;
+            }
+            resp.chunk_state = CHUNK_EXT;
+        }
+        /* fall through */
+        case CHUNK_EXT:
+            if (c == '\n') {
+                resp.chunk_state = resp.chunk_left ? CHUNK_DATA : CHUNK_TRAILER;
+                resp.line_len = 0;
+            }
+            break;
+        case CHUNK_DATA: {
+            int take = (uint32_t)n < resp.chunk_left ? n : (int)resp.chunk_left;
+            resp_decode(p, take);
+            resp.chunk_left -= (uint32_t)take;
+            if (resp.chunk_left == 0) resp.chunk_state = CHUNK_DATA_END;
+            p += take;
+            n -= take;
+            continue;
+        }
+        case CHUNK_DATA_END:
+            if (c == '\n') resp.chunk_state = CHUNK_SIZE;
+            break;
+        case CHUNK_TRAILER:
+            if (c == '\n') {
+                if (resp.line_len == 0) resp.chunk_state = CHUNK_DONE;
+                resp.line_len = 0;
+            } else if (c != '\r') {
+                resp.line_len++;
+            }
+            break;
+        }
+        p++;
+        n--;
+    }
+}
 
-    tcp_close();
+static void resp_body(const char *data, int len)
+{
+    if (len <= 0) return;
+    resp.raw += (uint32_t)len;
+    if (last_response.chunked) resp_dechunk(data, len);
+    else resp_decode(data, len);
+}
+
+static void resp_begin(rope_t *out)
+{
+    resp.out = out;
+    resp.hdr_len = 0;
+    resp.framed = 0;
+    resp.stop = 0;
+    resp.full = 0;
+    resp.z_rc = 0;
+    resp.raw = 0;
+    resp.chunk_state = CHUNK_SIZE;
+    resp.chunk_left = 0;
+    resp.z = (void *)0;
+}
+
+/* Take the next received bytes of the response */
+static void resp_input(const char *data, int len)
+{
+    if (resp.framed) { resp_body(data, len); return; }
+
+    int take = RESP_HDR_MAX - resp.hdr_len;
+    if (take > len) take = len;
+    int scanned = resp.hdr_len > 3 ? resp.hdr_len - 3 : 0;
+    mem_copy(resp.hdr + resp.hdr_len, data, take);
+    resp.hdr_len += take;
 
     /* Find end of HTTP headers (blank line \r\n\r\n) */
-    int body_start = -1;
-    for (int i = 0; i < total - 3; i++) {
-        if (response_buf[i] == '\r' && response_buf[i+1] == '\n' &&
-            response_buf[i+2] == '\r' && response_buf[i+3] == '\n') {
-            body_start = i + 4;
-            break;
+    for (int i = scanned; i < resp.hdr_len - 3; i++) {
+        if (resp.hdr[i] == '\r' && resp.hdr[i+1] == '\n' &&
+            resp.hdr[i+2] == '\r' && resp.hdr[i+3] == '\n') {
+            parse_response_headers(resp.hdr, i + 4);
+            resp.framed = 1;
+            int enc = last_response.content_encoding;
+            if (enc != HTTP_ENCODING_IDENTITY) {
+                resp.z = inflate_create(enc == HTTP_ENCODING_GZIP ? INFLATE_GZIP : INFLATE_DEFLATE,
+                                        resp_output, (void *)0);
+                if (!resp.z) resp.stop = 1;
+            }
+            resp_body(resp.hdr + i + 4, resp.hdr_len - (i + 4));
+            resp_body(data + take, len - take);
+            return;
         }
     }
+    if (resp.hdr_len == RESP_HDR_MAX) resp.stop = 1;
+}
+
+/* Done receiving: returns the body length.  Without a header block the
+ * raw bytes are returned as the body.                                */
+static int resp_end(int *framed)
+{
+    if (!resp.framed) rope_append(resp.out, resp.hdr, (uint32_t)resp.hdr_len);
+    /* A stream cut off by our own size limit is kept, as for identity;
+     * no body at all (a 304, say) is not a stream that stopped short. */
+    if (resp.z && (resp.z_rc < 0 || (resp.z_rc == 0 && !resp.full && resp.raw > 0)))
+        last_response.corrupt = 1;
+    inflate_destroy(resp.z);
+    resp.z = (void *)0;
+    *framed = resp.framed;
+    return (int)resp.out->len;
+}
+
+/* Has the whole body of last_response arrived?  A response framed only
+ * by the server closing the connection is never complete early.      */
+static int body_complete(void)
+{
+    const http_response_info_t *r = &last_response;
+    if (r->status == 204 || r->status == 304) return 1;
+    if (r->chunked) return resp.chunk_state == CHUNK_DONE;
+    if (r->content_length >= 0) return resp.raw >= (uint32_t)r->content_length;
+    return 0;
+}
+
+/* A built-in page in place of a response body */
+static int error_page(rope_t *body, const char *html)
+{
+    int len = 0;
+    while (html[len]) len++;
+    rope_append(body, html, (uint32_t)len);
+    return body->len ? (int)body->len : -1;
+}
+
+/* The decoded body is damaged or short: show that instead of it */
+static int corrupt_page(rope_t *body)
+{
+    rope_free(body);
+    return error_page(body,
+        "<html><body bgcolor=\"#FFF0F0\">"
+        "<h1>Damaged Response</h1>"
+        "<p>The compressed page did not arrive intact.</p>"
+        "<p>Reload to try again.</p>"
+        "</body></html>");
+}
+
+/* ── Connection reuse ────────────────────────────────────────────────── */
+/*
+ * The HTTP and TLS layers talk on one connection at a time, http_sock,
+ * and the pool holds the last one: a response that was framed and not
+ * marked "Connection: close" leaves its socket (and TLS session) open
+ * for the next request to the same host, port and scheme.  Anything
+ * else closes it first.
+ */
+static int      http_sock = -1;
+static char     pool_host[128];
+static uint16_t pool_port;
+static int      pool_tls;
+static int      pool_sock = -1;
+
+/* 1 if the kept connection serves host:port (now http_sock), else closed and 0 */
+static int conn_reuse(const char *host, uint16_t port, int tls)
+{
+    net_stack_process();
+    int ok = tcp_is_connected(pool_sock) && pool_port == port &&
+             pool_tls == tls && str_eq_ns(pool_host, host);
+    if (ok) {
+        http_sock = pool_sock;
+        pool_sock = -1;
+        tcp_discard(http_sock);   /* Drop anything left from the last response */
+        return 1;
+    }
+    tcp_close(pool_sock);
+    pool_sock = -1;
+    return 0;
+}
+
+static void conn_close(void)
+{
+    tcp_close(http_sock);
+    http_sock = -1;
+}
+
+static void conn_release(const char *host, uint16_t port, int tls, int keep)
+{
+    if (keep && tcp_is_connected(http_sock) && str_len_ns(host) < (int)sizeof(pool_host)) {
+        for (int i = 0; ; i++) { pool_host[i] = host[i]; if (!host[i]) break; }
+        pool_port = port;
+        pool_tls = tls;
+        pool_sock = http_sock;
+        http_sock = -1;
+    } else {
+        conn_close();
+    }
+}
+
+/* Receive one response on the open connection into body; *framed is
+ * set once the headers are in.  Returns the body length.            */
+static int http_receive(rope_t *body, int *framed)
+{
+    progress_set(NET_PROGRESS_RECEIVING);
+    resp_begin(body);
+    int got = 0;
+    uint64_t start = timer_get_ticks();
+    while (!resp.stop) {
+        uint64_t elapsed = timer_get_ticks() - start;
+        if (elapsed >= 10000) break;
+        /* Once data has started, a 500 ms lull ends the response */
+        int wait = (int)(10000 - elapsed);
+        if (got && wait > 500) wait = 500;
+        int n = tcp_receive_some(http_sock, resp_rx, (int)sizeof(resp_rx), wait);
+        if (n <= 0) break;
+        got = 1;
+        resp_input(resp_rx, n);
+        if (resp.framed && body_complete()) break;
+    }
+    return resp_end(framed);
+}
+
+int http_get(const char *host, uint16_t port, const char *path, rope_t *body)
+{
+    if (!net_is_available()) return -1;
+    parse_response_headers("", 0);
 
-    if (body_start < 0) return total;  /* No headers found, return raw */
+    /* Build HTTP request */
+    char request[1024];
+    int rpos = build_get_request(request, (int)sizeof(request), host, path,
+                                 "Connection: keep-alive\r\nUser-Agent: nextOS/3.0.0\r\n"
+                                 "Accept-Encoding: gzip, deflate\r\n");
+    if (rpos < 0) return -1;
+
+    int reused = conn_reuse(host, port, 0), framed, total;
+    for (;;) {
+        if (!reused) {
+            uint32_t ip = dns_resolve(host);
+            if (!ip) return -1;
+            http_sock = tcp_connect(ip, port);
+            if (http_sock < 0) return -1;
+        }
+        tcp_send(http_sock, request, rpos);
+        total = http_receive(body, &framed);
+        if (framed || !reused) break;
+        /* The kept connection had gone stale: retry on a new one */
+        conn_close();
+        rope_free(body);
+        reused = 0;
+    }
 
-    /* Move body to start of buffer */
-    int body_len = total - body_start;
-    for (int i = 0; i < body_len; i++)
-        response_buf[i] = response_buf[body_start + i];
-    response_buf[body_len] = 0;
+    conn_release(host, port, 0, framed && last_response.keep_alive &&
+                 !resp.stop && !last_response.corrupt && body_complete());
+    if (last_response.corrupt) return corrupt_page(body);
 
-    return body_len;
+    /* No headers found: the raw response is returned */
+    return total;
 }
 
 /* ── TLS 1.2 Client ──────────────────────────────────────────────────── */
 /*
  * Full TLS 1.2 implementation for HTTPS support.
- * Uses TLS_RSA_WITH_AES_128_CBC_SHA256 (0x003C) cipher suite.
+ * Offers TLS_RSA_WITH_AES_128_GCM_SHA256 (0x009C) first, then the CBC
+ * suites with HMAC-SHA-256 (0x003C) and HMAC-SHA-1 (0x002F).
  *
  * Implements complete handshake:
  *   ClientHello -> ServerHello,Certificate,ServerHelloDone ->
  *   ClientKeyExchange,ChangeCipherSpec,Finished ->
+ *   [NewSessionTicket],ChangeCipherSpec,Finished
+ * and, for a host in the session cache, the abbreviated one:
+ *   ClientHello(session ID / ticket) ->
+ *   ServerHello,[NewSessionTicket],ChangeCipherSpec,Finished ->
  *   ChangeCipherSpec,Finished
  * Then encrypted application data for HTTP request/response.
  */
@@ -777,6 +2222,7 @@ int http_get(const char *host, uint16_t port, const char *path,
 /* Handshake types */
 #define TLS_CLIENT_HELLO    1
 #define TLS_SERVER_HELLO    2
+#define TLS_NEW_TICKET      4
 #define TLS_CERTIFICATE    11
 #define TLS_SERVER_DONE    14
 #define TLS_CLIENT_KEY_EX  16
@@ -796,12 +2242,29 @@ static uint8_t tls_client_write_iv[16];
 static uint8_t tls_server_write_iv[16];
 static uint8_t tls_client_write_mac_key[32];
 static uint8_t tls_server_write_mac_key[32];
+
+/* MAC keys folded into HMAC midstates once per session */
+typedef union {
+    hmac_sha256_ctx_t sha256;
+    hmac_sha1_ctx_t   sha1;
+} tls_mac_key_t;
+
+static tls_mac_key_t tls_client_mac;
+static tls_mac_key_t tls_server_mac;
 static uint64_t tls_client_seq;
 static uint64_t tls_server_seq;
 
+/* Write keys expanded once per session (the AES context is also the
+ * one the CBC suites use)                                          */
+static aes128_gcm_ctx_t tls_client_cipher;
+static aes128_gcm_ctx_t tls_server_cipher;
+
 /* Negotiated cipher suite info */
 static uint16_t tls_cipher_suite;   /* Selected cipher suite ID */
 static int tls_mac_len;             /* MAC length: 20 for SHA-1, 32 for SHA-256 */
+static int tls_aead;                /* AES-GCM: no MAC, nonce = salt(4) + explicit(8) */
+
+#define TLS_GCM_EXPLICIT 8
 
 /* Handshake message accumulator for Finished verification */
 #define TLS_HS_BUF_SIZE 8192
@@ -821,14 +2284,126 @@ static void tls_hs_accumulate(const uint8_t *data, int len)
 static uint8_t tls_cert_buf[TLS_CERT_BUF_SIZE];
 static int tls_cert_len;
 
-/* Large receive buffer for TLS records */
-#define TLS_RECV_BUF_SIZE 8192
+/* Receive buffer for one TLS record, up to the largest ciphertext
+ * allowed (2^14 + 2048); records are decrypted in place.          */
+#define TLS_RECV_BUF_SIZE 18432
 static uint8_t tls_recv_buf[TLS_RECV_BUF_SIZE];
 
+/* ── TLS session cache ───────────────────────────────────────────────── */
+/* The master secret of each host's last session, with the session ID
+ * and/or RFC 5077 ticket the server issued for it, so the next
+ * connection can resume: no certificate, no RSA, one round trip less.
+ * Least recently used first out; a failed handshake drops the entry. */
+#define TLS_SESSION_CACHE   8
+#define TLS_TICKET_MAX      1024
+#define TLS_SESSION_MAX_MS  (2 * 3600 * 1000)   /* Unless the ticket hints less */
+
+typedef struct {
+    char     host[DNS_NAME_MAX];
+    uint16_t port;
+    uint16_t cipher_suite;          /* 0: slot unused */
+    uint8_t  master_secret[48];
+    uint8_t  session_id[32];
+    int      sid_len;
+    uint8_t  ticket[TLS_TICKET_MAX];
+    int      ticket_len;
+    uint64_t expires;               /* timer ms */
+    uint64_t last_use;
+} tls_session_t;
+
+static tls_session_t tls_sessions[TLS_SESSION_CACHE];
+static uint64_t      tls_session_clock;
+
+/* This handshake: what was offered, and what the server handed out */
+static tls_session_t *tls_offer;
+static uint8_t  tls_offer_sid[32];
+static int      tls_offer_sid_len;
+static uint8_t  tls_session_id[32];
+static int      tls_sid_len;
+static uint8_t  tls_ticket[TLS_TICKET_MAX];
+static int      tls_ticket_len;
+static uint32_t tls_ticket_hint;    /* Lifetime hint, seconds; 0 none */
+
+static tls_session_t *tls_session_find(const char *host, uint16_t port)
+{
+    uint64_t now = timer_get_ticks();
+    for (int i = 0; i < TLS_SESSION_CACHE; i++) {
+        tls_session_t *e = &tls_sessions[i];
+        if (!e->cipher_suite || e->port != port || !str_eq_ns(e->host, host)) continue;
+        if (now >= e->expires) { e->cipher_suite = 0; return (void *)0; }
+        e->last_use = ++tls_session_clock;
+        return e;
+    }
+    return (void *)0;
+}
+
+static void tls_session_drop(const char *host, uint16_t port)
+{
+    tls_session_t *e = tls_session_find(host, port);
+    if (e) e->cipher_suite = 0;
+}
+
+static void tls_session_ticket(tls_session_t *e)
+{
+    uint64_t life = TLS_SESSION_MAX_MS;
+    if (tls_ticket_hint && (uint64_t)tls_ticket_hint * 1000 < life)
+        life = (uint64_t)tls_ticket_hint * 1000;
+    mem_copy(e->ticket, tls_ticket, tls_ticket_len);
+    e->ticket_len = tls_ticket_len;
+    e->expires = timer_get_ticks() + life;
+}
+
+/* Remember the session just established, if the server made it
+ * resumable.  A resumed one only picks up a renewed ticket.       */
+static void tls_session_store(const char *host, uint16_t port, int resumed)
+{
+    if (resumed) {
+        if (tls_ticket_len) tls_session_ticket(tls_offer);
+        return;
+    }
+
+    int n = str_len_ns(host);
+    if (n >= DNS_NAME_MAX || (!tls_sid_len && !tls_ticket_len)) {
+        tls_session_drop(host, port);
+        return;
+    }
+    tls_session_t *e = tls_session_find(host, port);
+    if (!e) {
+        e = &tls_sessions[0];
+        for (int i = 0; i < TLS_SESSION_CACHE; i++) {
+            tls_session_t *c = &tls_sessions[i];
+            if (!c->cipher_suite) { e = c; break; }
+            if (c->last_use < e->last_use) e = c;
+        }
+    }
+    mem_copy(e->host, host, n + 1);
+    e->port = port;
+    e->cipher_suite = tls_cipher_suite;
+    mem_copy(e->master_secret, tls_master_secret, 48);
+    mem_copy(e->session_id, tls_session_id, tls_sid_len);
+    e->sid_len = tls_sid_len;
+    e->ticket_len = 0;
+    e->expires = timer_get_ticks() + TLS_SESSION_MAX_MS;
+    if (tls_ticket_len) tls_session_ticket(e);
+    e->last_use = ++tls_session_clock;
+}
+
+/* NewSessionTicket body: lifetime_hint(4) + ticket length(2) + ticket */
+static void tls_take_ticket(const uint8_t *body, int len)
+{
+    if (len < 6) return;
+    int tlen = (body[4] << 8) | body[5];
+    if (tlen == 0 || tlen > TLS_TICKET_MAX || 6 + tlen > len) return;
+    tls_ticket_hint = ((uint32_t)body[0] << 24) | ((uint32_t)body[1] << 16) |
+                      ((uint32_t)body[2] << 8) | body[3];
+    mem_copy(tls_ticket, body + 6, tlen);
+    tls_ticket_len = tlen;
+}
+
 /* Build and send TLS ClientHello */
 static int tls_send_client_hello(const char *host)
 {
-    uint8_t msg[512];
+    uint8_t msg[512 + TLS_TICKET_MAX];
     int pos = 0;
     int host_len = str_len_ns(host);
 
@@ -862,11 +2437,23 @@ static int tls_send_client_hello(const char *host)
     mem_copy(msg + pos, tls_client_random, 32);
     pos += 32;
 
-    /* Session ID length = 0 */
-    msg[pos++] = 0;
+    /* Session ID: the cached one, or with only a ticket to offer a
+     * random one, which the server echoes when it accepts the ticket */
+    tls_offer_sid_len = 0;
+    if (tls_offer && tls_offer->sid_len) {
+        tls_offer_sid_len = tls_offer->sid_len;
+        mem_copy(tls_offer_sid, tls_offer->session_id, tls_offer_sid_len);
+    } else if (tls_offer) {
+        tls_offer_sid_len = 32;
+        tls_random_bytes(tls_offer_sid, 32);
+    }
+    msg[pos++] = (uint8_t)tls_offer_sid_len;
+    mem_copy(msg + pos, tls_offer_sid, tls_offer_sid_len);
+    pos += tls_offer_sid_len;
 
-    /* Cipher suites - offer AES_128_CBC_SHA256 primarily */
-    msg[pos++] = 0; msg[pos++] = 4;  /* 2 cipher suites = 4 bytes */
+    /* Cipher suites - offer AES_128_GCM_SHA256 primarily */
+    msg[pos++] = 0; msg[pos++] = 6;  /* 3 cipher suites = 6 bytes */
+    msg[pos++] = 0x00; msg[pos++] = 0x9C;  /* TLS_RSA_WITH_AES_128_GCM_SHA256 */
     msg[pos++] = 0x00; msg[pos++] = 0x3C;  /* TLS_RSA_WITH_AES_128_CBC_SHA256 */
     msg[pos++] = 0x00; msg[pos++] = 0x2F;  /* TLS_RSA_WITH_AES_128_CBC_SHA */
 
@@ -895,6 +2482,14 @@ static int tls_send_client_hello(const char *host)
     msg[sni_len_pos] = (uint8_t)(sni_data_len >> 8);
     msg[sni_len_pos + 1] = (uint8_t)(sni_data_len & 0xFF);
 
+    /* SessionTicket extension: the cached ticket, or empty to ask for one */
+    int tlen = tls_offer ? tls_offer->ticket_len : 0;
+    msg[pos++] = 0x00; msg[pos++] = 0x23;  /* session_ticket */
+    msg[pos++] = (uint8_t)(tlen >> 8);
+    msg[pos++] = (uint8_t)(tlen & 0xFF);
+    if (tlen) mem_copy(msg + pos, tls_offer->ticket, tlen);
+    pos += tlen;
+
     /* Signature algorithms extension (required for TLS 1.2) */
     msg[pos++] = 0x00; msg[pos++] = 0x0d;  /* signature_algorithms */
     msg[pos++] = 0x00; msg[pos++] = 0x08;  /* extension length */
@@ -934,16 +2529,19 @@ static int tls_send_client_hello(const char *host)
     tls_hs_len = 0;
     tls_cipher_suite = 0x003C;  /* Default: AES_128_CBC_SHA256 */
     tls_mac_len = 32;
+    tls_sid_len = 0;
+    tls_ticket_len = 0;
+    tls_ticket_hint = 0;
     tls_hs_accumulate(msg + hs_start, rec_payload_len);
 
-    return tcp_send_data(msg, pos);
+    return tcp_send(http_sock, msg, pos);
 }
 
 /* Read a full TLS record from TCP. Returns record body length or -1 */
 static int tls_read_record(uint8_t *out_type, uint8_t *buf, int buf_size)
 {
     uint8_t hdr[5];
-    int got = tcp_receive_data(hdr, 5, 8000);
+    int got = tcp_recv(http_sock, hdr, 5, 8000);
     if (got < 5) return -1;
 
     *out_type = hdr[0];
@@ -955,7 +2553,7 @@ static int tls_read_record(uint8_t *out_type, uint8_t *buf, int buf_size)
     int total = 0;
     int remaining = rec_len;
     while (remaining > 0) {
-        int chunk = tcp_receive_data(buf + total, remaining, 5000);
+        int chunk = tcp_recv(http_sock, buf + total, remaining, 5000);
         if (chunk <= 0) break;
         total += chunk;
         remaining -= chunk;
@@ -964,13 +2562,15 @@ static int tls_read_record(uint8_t *out_type, uint8_t *buf, int buf_size)
     return total;
 }
 
-/* Process server handshake: ServerHello, Certificate, ServerHelloDone */
+/* Process server handshake: ServerHello, Certificate, ServerHelloDone.
+ * Returns 1 instead once ServerHello echoes the offered session ID:
+ * the server is resuming and goes on to ChangeCipherSpec.           */
 static int tls_process_server_handshake(rsa_pubkey_t *server_key)
 {
-    int got_hello = 0, got_cert = 0, got_done = 0;
+    int got_hello = 0, got_cert = 0, got_done = 0, resumed = 0;
     tls_cert_len = 0;
 
-    while (!got_done) {
+    while (!got_done && !resumed) {
         uint8_t rec_type;
         int rec_len = tls_read_record(&rec_type, tls_recv_buf, TLS_RECV_BUF_SIZE);
         if (rec_len < 0) return -1;
@@ -996,17 +2596,24 @@ static int tls_process_server_handshake(rsa_pubkey_t *server_key)
                     if (hs_len >= 34) {
                         mem_copy(tls_server_random, tls_recv_buf + hpos + 6, 32);
                     }
-                    /* Extract selected cipher suite */
+                    /* Extract session ID and selected cipher suite */
                     if (hs_len >= 37) {
                         int body = hpos + 4;
                         int sid_len = tls_recv_buf[body + 34];
                         int cs_off = body + 35 + sid_len;
-                        if (cs_off + 2 <= hpos + 4 + hs_len) {
+                        if (cs_off + 2 <= hpos + 4 + hs_len && sid_len <= 32) {
                             tls_cipher_suite = ((uint16_t)tls_recv_buf[cs_off] << 8) |
                                                 tls_recv_buf[cs_off + 1];
+                            mem_copy(tls_session_id, tls_recv_buf + body + 35, sid_len);
+                            tls_sid_len = sid_len;
                         }
                     }
+                    resumed = tls_offer && tls_sid_len && tls_sid_len == tls_offer_sid_len &&
+                              mem_eq(tls_session_id, tls_offer_sid, tls_sid_len) &&
+                              tls_cipher_suite == tls_offer->cipher_suite;
                     got_hello = 1;
+                } else if (hs_type == TLS_NEW_TICKET) {
+                    tls_take_ticket(tls_recv_buf + hpos + 4, hs_len);
                 } else if (hs_type == TLS_CERTIFICATE) {
                     /* Extract first certificate */
                     if (hs_len > 6) {
@@ -1036,6 +2643,7 @@ static int tls_process_server_handshake(rsa_pubkey_t *server_key)
         }
     }
 
+    if (resumed) return 1;
     if (!got_hello || !got_cert) return -1;
     if (tls_cert_len == 0) return -1;
 
@@ -1052,24 +2660,31 @@ static int tls_process_server_handshake(rsa_pubkey_t *server_key)
     return 0;
 }
 
-/* Derive master secret and key material */
+/* Derive master secret and key material.  A resumed session passes
+ * no pre-master secret and keeps the cached master secret.        */
 static void tls_derive_keys(const uint8_t *pre_master_secret)
 {
     /* Determine MAC length from negotiated cipher suite:
      * 0x002F = AES_128_CBC_SHA    -> HMAC-SHA-1   (20 bytes)
-     * 0x003C = AES_128_CBC_SHA256 -> HMAC-SHA-256 (32 bytes) */
-    if (tls_cipher_suite == 0x003C)
+     * 0x003C = AES_128_CBC_SHA256 -> HMAC-SHA-256 (32 bytes)
+     * 0x009C = AES_128_GCM_SHA256 -> none, the AEAD tag authenticates */
+    tls_aead = tls_cipher_suite == 0x009C;
+    if (tls_aead)
+        tls_mac_len = 0;
+    else if (tls_cipher_suite == 0x003C)
         tls_mac_len = 32;
     else
         tls_mac_len = 20;
 
     /* master_secret = PRF(pre_master_secret, "master secret",
      *                     ClientHello.random + ServerHello.random) */
-    uint8_t seed[64];
-    mem_copy(seed, tls_client_random, 32);
-    mem_copy(seed + 32, tls_server_random, 32);
-    tls_prf_sha256(pre_master_secret, 48, "master secret", seed, 64,
-                   tls_master_secret, 48);
+    if (pre_master_secret) {
+        uint8_t seed[64];
+        mem_copy(seed, tls_client_random, 32);
+        mem_copy(seed + 32, tls_server_random, 32);
+        tls_prf_sha256(pre_master_secret, 48, "master secret", seed, 64,
+                       tls_master_secret, 48);
+    }
 
     /* key_block = PRF(master_secret, "key expansion",
      *                 server_random + client_random) */
@@ -1078,8 +2693,10 @@ static void tls_derive_keys(const uint8_t *pre_master_secret)
     mem_copy(ks_seed + 32, tls_client_random, 32);
 
     /* Key material: 2*(mac_key + enc_key(16) + IV(16))
-     * SHA-256: 2*(32+16+16) = 128,  SHA-1: 2*(20+16+16) = 104 */
-    int kb_len = 2 * (tls_mac_len + 16 + 16);
+     * SHA-256: 2*(32+16+16) = 128,  SHA-1: 2*(20+16+16) = 104
+     * GCM has no MAC keys and a 4-byte implicit IV (salt): 2*(16+4) = 40 */
+    int iv_len = tls_aead ? 4 : 16;
+    int kb_len = 2 * (tls_mac_len + 16 + iv_len);
     uint8_t key_block[128];
     tls_prf_sha256(tls_master_secret, 48, "key expansion", ks_seed, 64,
                    key_block, kb_len);
@@ -1089,9 +2706,18 @@ static void tls_derive_keys(const uint8_t *pre_master_secret)
     mem_copy(tls_server_write_mac_key, key_block + off, tls_mac_len); off += tls_mac_len;
     mem_copy(tls_client_write_key, key_block + off, 16); off += 16;
     mem_copy(tls_server_write_key, key_block + off, 16); off += 16;
-    mem_copy(tls_client_write_iv, key_block + off, 16); off += 16;
-    mem_copy(tls_server_write_iv, key_block + off, 16);
+    mem_copy(tls_client_write_iv, key_block + off, iv_len); off += iv_len;
+    mem_copy(tls_server_write_iv, key_block + off, iv_len);
 
+    aes128_gcm_init(&tls_client_cipher, tls_client_write_key);
+    aes128_gcm_init(&tls_server_cipher, tls_server_write_key);
+    if (tls_mac_len == 20) {
+        hmac_sha1_init(&tls_client_mac.sha1, tls_client_write_mac_key, 20);
+        hmac_sha1_init(&tls_server_mac.sha1, tls_server_write_mac_key, 20);
+    } else if (tls_mac_len == 32) {
+        hmac_sha256_init(&tls_client_mac.sha256, tls_client_write_mac_key, 32);
+        hmac_sha256_init(&tls_server_mac.sha256, tls_server_write_mac_key, 32);
+    }
     tls_client_seq = 0;
     tls_server_seq = 0;
 }
@@ -1144,7 +2770,7 @@ static int tls_send_client_key_exchange(const rsa_pubkey_t *server_key)
     /* Accumulate handshake message */
     tls_hs_accumulate(msg + hs_start, msg_len);
 
-    int ret = tcp_send_data(msg, pos);
+    int ret = tcp_send(http_sock, msg, pos);
     kfree(msg);
     return ret;
 }
@@ -1159,11 +2785,12 @@ static int tls_send_change_cipher_spec(void)
     msg[3] = 0;
     msg[4] = 1;  /* Length = 1 */
     msg[5] = 1;  /* ChangeCipherSpec message */
-    return tcp_send_data(msg, 6);
+    return tcp_send(http_sock, msg, 6);
 }
 
-/* Compute MAC for a TLS record (HMAC-SHA-256 or HMAC-SHA-1) */
-static void tls_compute_mac(const uint8_t *mac_key,
+/* Compute MAC for a TLS record (HMAC-SHA-256 or HMAC-SHA-1) from the
+ * connection's keyed midstates                                      */
+static void tls_compute_mac(const tls_mac_key_t *key,
                             uint64_t seq_num, uint8_t rec_type,
                             const uint8_t *data, int data_len,
                             uint8_t *mac_out)
@@ -1179,137 +2806,121 @@ static void tls_compute_mac(const uint8_t *mac_key,
     header[hi++] = (uint8_t)(data_len >> 8);
     header[hi++] = (uint8_t)(data_len & 0xFF);
 
-    uint8_t k_pad[64];
-
     if (tls_mac_len == 20) {
-        /* HMAC-SHA-1 */
         sha1_ctx_t ctx;
-        mem_zero(k_pad, 64);
-        mem_copy(k_pad, mac_key, tls_mac_len);
-        for (int i = 0; i < 64; i++) k_pad[i] ^= 0x36;
-        sha1_init(&ctx);
-        sha1_update(&ctx, k_pad, 64);
+        hmac_sha1_start(&key->sha1, &ctx);
         sha1_update(&ctx, header, 13);
         sha1_update(&ctx, data, data_len);
-        uint8_t inner[20];
-        sha1_final(&ctx, inner);
-        mem_zero(k_pad, 64);
-        mem_copy(k_pad, mac_key, tls_mac_len);
-        for (int i = 0; i < 64; i++) k_pad[i] ^= 0x5c;
-        sha1_init(&ctx);
-        sha1_update(&ctx, k_pad, 64);
-        sha1_update(&ctx, inner, 20);
-        sha1_final(&ctx, mac_out);
+        hmac_sha1_finish(&key->sha1, &ctx, mac_out);
     } else {
-        /* HMAC-SHA-256 */
         sha256_ctx_t ctx;
-        mem_zero(k_pad, 64);
-        mem_copy(k_pad, mac_key, tls_mac_len);
-        for (int i = 0; i < 64; i++) k_pad[i] ^= 0x36;
-        sha256_init(&ctx);
-        sha256_update(&ctx, k_pad, 64);
+        hmac_sha256_start(&key->sha256, &ctx);
         sha256_update(&ctx, header, 13);
         sha256_update(&ctx, data, data_len);
-        uint8_t inner[32];
-        sha256_final(&ctx, inner);
-        mem_zero(k_pad, 64);
-        mem_copy(k_pad, mac_key, tls_mac_len);
-        for (int i = 0; i < 64; i++) k_pad[i] ^= 0x5c;
-        sha256_init(&ctx);
-        sha256_update(&ctx, k_pad, 64);
-        sha256_update(&ctx, inner, 32);
-        sha256_final(&ctx, mac_out);
+        hmac_sha256_finish(&key->sha256, &ctx, mac_out);
     }
 }
 
+/* AEAD additional data: seq_num(8) + type(1) + version(2) + length(2) */
+static void tls_aead_ad(uint8_t ad[13], uint64_t seq_num, uint8_t rec_type, int len)
+{
+    for (int i = 0; i < 8; i++)
+        ad[i] = (uint8_t)(seq_num >> (56 - 8 * i));
+    ad[8] = rec_type;
+    ad[9] = TLS_VER_MAJOR;
+    ad[10] = TLS_VER_MINOR;
+    ad[11] = (uint8_t)(len >> 8);
+    ad[12] = (uint8_t)(len & 0xFF);
+}
+
 /* Send encrypted TLS record */
 static int tls_send_encrypted(uint8_t rec_type, const uint8_t *data, int data_len)
 {
-    /* Build plaintext: data + MAC + padding */
-    uint8_t mac[32];
-    tls_compute_mac(tls_client_write_mac_key, tls_client_seq,
-                    rec_type, data, data_len, mac);
-
-    int plain_len = data_len + tls_mac_len;  /* data + MAC */
-    /* TLS padding for AES-CBC */
-    int pad = 16 - (plain_len % 16);
-    int total_plain = plain_len + pad;
-
-    /* Generate random IV (16 bytes) */
-    uint8_t iv[16];
-    tls_random_bytes(iv, 16);
-
-    /* Plaintext buffer: data + mac + padding */
-    uint8_t *pt = (uint8_t *)kmalloc(total_plain);
-    if (!pt) return -1;
-    mem_copy(pt, data, data_len);
-    mem_copy(pt + data_len, mac, tls_mac_len);
-    for (int i = 0; i < pad; i++)
-        pt[plain_len + i] = (uint8_t)(pad - 1);  /* TLS padding value = pad_len - 1 */
-
-    /* Encrypt with AES-128-CBC (no PKCS#7 since we added TLS padding) */
-    uint8_t *ct = (uint8_t *)kmalloc(total_plain);
-    if (!ct) { kfree(pt); return -1; }
-
-    /* Manual CBC encrypt (TLS padding is different from PKCS#7) */
-    aes128_ctx_t aes_ctx;
-    aes128_init(&aes_ctx, tls_client_write_key);
-    uint8_t prev[16];
-    mem_copy(prev, iv, 16);
-    for (int i = 0; i < total_plain; i += 16) {
-        uint8_t block[16];
-        mem_copy(block, pt + i, 16);
-        for (int j = 0; j < 16; j++) block[j] ^= prev[j];
-        aes128_encrypt_block(&aes_ctx, block, ct + i);
-        mem_copy(prev, ct + i, 16);
-    }
-
-    /* TLS record: record header(5) + IV(16) + ciphertext */
-    int rec_payload = 16 + total_plain;
+    /* GCM:  header(5) + explicit nonce(8) + ciphertext + tag(16)
+     * CBC:  header(5) + IV(16) + E(data + MAC + padding)          */
+    int rec_payload;
+    if (tls_aead) {
+        rec_payload = TLS_GCM_EXPLICIT + data_len + GCM_TAG_SIZE;
+    } else {
+        int plain_len = data_len + tls_mac_len;
+        rec_payload = 16 + plain_len + (16 - plain_len % 16);
+    }
     uint8_t *rec = (uint8_t *)kmalloc(5 + rec_payload);
-    if (!rec) { kfree(pt); kfree(ct); return -1; }
+    if (!rec) return -1;
 
     rec[0] = rec_type;
     rec[1] = TLS_VER_MAJOR;
     rec[2] = TLS_VER_MINOR;
     rec[3] = (uint8_t)(rec_payload >> 8);
     rec[4] = (uint8_t)(rec_payload & 0xFF);
-    mem_copy(rec + 5, iv, 16);
-    mem_copy(rec + 5 + 16, ct, total_plain);
 
-    int ret = tcp_send_data(rec, 5 + rec_payload);
+    if (tls_aead) {
+        /* The explicit nonce is the sequence number: unique per key */
+        uint8_t nonce[GCM_NONCE_SIZE], ad[13];
+        tls_aead_ad(ad, tls_client_seq, rec_type, data_len);
+        mem_copy(nonce, tls_client_write_iv, 4);
+        mem_copy(nonce + 4, ad, TLS_GCM_EXPLICIT);
+        mem_copy(rec + 5, ad, TLS_GCM_EXPLICIT);
+        uint8_t *ct = rec + 5 + TLS_GCM_EXPLICIT;
+        aes128_gcm_seal(&tls_client_cipher, nonce, ad, 13, data, ct, data_len,
+                        ct + data_len);
+    } else {
+        /* Random IV, then data + MAC + TLS padding encrypted in place */
+        uint8_t *iv = rec + 5, *pt = rec + 5 + 16;
+        int total_plain = rec_payload - 16;
+        int plain_len = data_len + tls_mac_len;
+        tls_random_bytes(iv, 16);
+        mem_copy(pt, data, data_len);
+        tls_compute_mac(&tls_client_mac, tls_client_seq,
+                        rec_type, data, data_len, pt + data_len);
+        for (int i = plain_len; i < total_plain; i++)
+            pt[i] = (uint8_t)(total_plain - plain_len - 1);  /* pad_len - 1 */
+
+        uint8_t chain[16];
+        mem_copy(chain, iv, 16);
+        aes128_cbc_encrypt_blocks(&tls_client_cipher.aes, chain, pt, pt, total_plain);
+    }
+
+    int ret = tcp_send(http_sock, rec, 5 + rec_payload);
 
     tls_client_seq++;
-    kfree(pt);
-    kfree(ct);
     kfree(rec);
     return ret;
 }
 
-/* Decrypt a TLS record */
-static int tls_decrypt_record(const uint8_t *data, int data_len,
-                              uint8_t rec_type, uint8_t *out, int max_out)
+/* Decrypt a TLS record in place.  Returns the content length with
+ * *plain pointing at it inside data, or -1.                      */
+static int tls_decrypt_record(uint8_t *data, int data_len,
+                              uint8_t rec_type, uint8_t **plain)
 {
+    if (tls_aead) {
+        int ct_len = data_len - TLS_GCM_EXPLICIT - GCM_TAG_SIZE;
+        if (ct_len < 0) return -1;
+
+        uint8_t nonce[GCM_NONCE_SIZE], ad[13];
+        mem_copy(nonce, tls_server_write_iv, 4);
+        mem_copy(nonce + 4, data, TLS_GCM_EXPLICIT);
+        tls_aead_ad(ad, tls_server_seq, rec_type, ct_len);
+        uint8_t *ct = data + TLS_GCM_EXPLICIT;
+        if (aes128_gcm_open(&tls_server_cipher, nonce, ad, 13, ct, ct, ct_len,
+                            ct + ct_len) != 0)
+            return -1;
+
+        tls_server_seq++;
+        *plain = ct;
+        return ct_len;
+    }
+
     if (data_len < 32) return -1;  /* Need at least IV(16) + one block(16) */
 
-    const uint8_t *iv = data;
-    const uint8_t *ct = data + 16;
+    uint8_t *out = data + 16;
     int ct_len = data_len - 16;
-
     if (ct_len % 16 != 0) return -1;
-    if (ct_len > max_out) return -1;
 
     /* Decrypt AES-128-CBC */
-    aes128_ctx_t aes_ctx;
-    aes128_init(&aes_ctx, tls_server_write_key);
-    const uint8_t *prev = iv;
-    for (int i = 0; i < ct_len; i += 16) {
-        uint8_t block[16];
-        aes128_decrypt_block(&aes_ctx, ct + i, block);
-        for (int j = 0; j < 16; j++) block[j] ^= prev[j];
-        mem_copy(out + i, block, 16);
-        prev = ct + i;
-    }
+    uint8_t chain[16];
+    mem_copy(chain, data, 16);
+    aes128_cbc_decrypt_blocks(&tls_server_cipher.aes, chain, out, out, ct_len);
 
     /* Remove TLS padding */
     int pad_val = out[ct_len - 1];
@@ -1323,7 +2934,7 @@ static int tls_decrypt_record(const uint8_t *data, int data_len,
 
     /* Verify MAC: compute expected MAC over decrypted content */
     uint8_t expected_mac[32];
-    tls_compute_mac(tls_server_write_mac_key, tls_server_seq,
+    tls_compute_mac(&tls_server_mac, tls_server_seq,
                     rec_type, out, content_len, expected_mac);
     const uint8_t *received_mac = out + content_len;
     int mac_ok = 1;
@@ -1333,6 +2944,7 @@ static int tls_decrypt_record(const uint8_t *data, int data_len,
     if (!mac_ok) return -1;
 
     tls_server_seq++;
+    *plain = out;
     return content_len;
 }
 
@@ -1376,10 +2988,21 @@ static int tls_receive_server_finished(void)
 
         if (rec_type == TLS_CHANGE_CIPHER) {
             got_ccs = 1;
+        } else if (rec_type == TLS_HANDSHAKE && !got_ccs) {
+            /* NewSessionTicket, sent before ChangeCipherSpec */
+            tls_hs_accumulate(tls_recv_buf, rec_len);
+            for (int hpos = 0; hpos + 4 <= rec_len; ) {
+                int hs_len = ((int)tls_recv_buf[hpos+1] << 16) |
+                             ((int)tls_recv_buf[hpos+2] << 8) | tls_recv_buf[hpos+3];
+                if (hpos + 4 + hs_len > rec_len) break;
+                if (tls_recv_buf[hpos] == TLS_NEW_TICKET)
+                    tls_take_ticket(tls_recv_buf + hpos + 4, hs_len);
+                hpos += 4 + hs_len;
+            }
         } else if (rec_type == TLS_HANDSHAKE && got_ccs) {
             /* Encrypted handshake - decrypt it */
-            uint8_t pt[256];
-            int pt_len = tls_decrypt_record(tls_recv_buf, rec_len, TLS_HANDSHAKE, pt, sizeof(pt));
+            uint8_t *pt;
+            int pt_len = tls_decrypt_record(tls_recv_buf, rec_len, TLS_HANDSHAKE, &pt);
             if (pt_len < 4) return -1;
 
             uint8_t hs_type = pt[0];
@@ -1408,189 +3031,174 @@ static int tls_receive_server_finished(void)
             }
             if (!ok) return -1;
 
+            /* An abbreviated handshake hashes it into the client Finished */
+            tls_hs_accumulate(pt, 16);
             got_finished = 1;
         }
     }
     return 0;
 }
 
-int https_get(const char *host, uint16_t port, const char *path,
-              char *response_buf, int buf_size)
+/* Connect and run the TLS handshake, abbreviated when the session
+ * cache has this host.  Returns 0 when the session is up, -1 on
+ * failure, or the length of an error page left in response_buf.  */
+static int tls_open(const char *host, uint16_t port, rope_t *body)
 {
-    if (!net_is_available()) return -1;
-
     /* Resolve hostname */
     uint32_t ip = dns_resolve(host);
     if (!ip) return -1;
 
     /* Connect TCP to HTTPS port */
-    if (tcp_connect(ip, port) != 0)
+    http_sock = tcp_connect(ip, port);
+    if (http_sock < 0)
         return -1;
 
     /* Step 1: Send ClientHello */
+    progress_set(NET_PROGRESS_HANDSHAKE);
+    tls_offer = tls_session_find(host, port);
     if (tls_send_client_hello(host) < 0) {
-        tcp_close();
+        conn_close();
         return -1;
     }
 
     /* Step 2: Receive ServerHello, Certificate, ServerHelloDone */
     rsa_pubkey_t server_key;
-    if (tls_process_server_handshake(&server_key) != 0) {
-        tcp_close();
+    int resumed = tls_process_server_handshake(&server_key);
+    if (resumed < 0) {
+        conn_close();
+        tls_session_drop(host, port);
         /* Return error page */
-        int len = 0;
-        const char *err =
+        return error_page(body,
             "<html><body bgcolor=\"#FFFFF0\">"
             "<h1>HTTPS Handshake Failed</h1>"
             "<p>Could not complete the TLS handshake with the server.</p>"
             "<p>The server may require cipher suites or TLS extensions "
             "that nextOS does not support.</p>"
             "<p>Try using <b>http://</b> instead if available.</p>"
-            "</body></html>";
-        for (int i = 0; err[i] && len < buf_size - 1; i++)
-            response_buf[len++] = err[i];
-        response_buf[len] = 0;
-        return len;
+            "</body></html>");
+    }
+
+    if (resumed) {
+        /* Abbreviated: keys from the cached master secret, the server
+         * finishes first.  Should it go wrong, forget the session and
+         * start over with a full handshake.                          */
+        mem_copy(tls_master_secret, tls_offer->master_secret, 48);
+        tls_derive_keys((void *)0);
+        if (tls_receive_server_finished() != 0 ||
+            tls_send_change_cipher_spec() < 0 ||
+            tls_send_finished() < 0) {
+            conn_close();
+            tls_session_drop(host, port);
+            return tls_open(host, port, body);
+        }
+        stats.tls_resumed++;
+        tls_session_store(host, port, 1);
+        return 0;
     }
 
     /* Step 3: Send ClientKeyExchange (RSA encrypted pre-master secret) */
     if (tls_send_client_key_exchange(&server_key) < 0) {
-        tcp_close();
+        conn_close();
         return -1;
     }
 
     /* Step 4: Send ChangeCipherSpec */
     if (tls_send_change_cipher_spec() < 0) {
-        tcp_close();
+        conn_close();
         return -1;
     }
 
     /* Step 5: Send Finished */
     if (tls_send_finished() < 0) {
-        tcp_close();
+        conn_close();
         return -1;
     }
 
-    /* Step 6: Receive server's ChangeCipherSpec + Finished */
+    /* Step 6: Receive server's [NewSessionTicket,] ChangeCipherSpec + Finished */
     if (tls_receive_server_finished() != 0) {
-        tcp_close();
-        int len = 0;
-        const char *err =
+        conn_close();
+        tls_session_drop(host, port);
+        return error_page(body,
             "<html><body bgcolor=\"#FFFFF0\">"
             "<h1>HTTPS Encryption Failed</h1>"
             "<p>TLS handshake was completed but the server's Finished "
             "message could not be verified.</p>"
             "<p>Try using <b>http://</b> instead if available.</p>"
-            "</body></html>";
-        for (int i = 0; err[i] && len < buf_size - 1; i++)
-            response_buf[len++] = err[i];
-        response_buf[len] = 0;
-        return len;
-    }
-
-    /* Step 7: Send HTTP request over TLS */
-    char request[512];
-    int rpos = 0;
-    int max_rpos = (int)(sizeof(request) - 1);
-    const char *get = "GET ";
-    for (int i = 0; get[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = get[i];
-    }
-    for (int i = 0; path[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = path[i];
-    }
-    const char *ver = " HTTP/1.1\r\nHost: ";
-    for (int i = 0; ver[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = ver[i];
-    }
-    for (int i = 0; host[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = host[i];
-    }
-    const char *hdr = "\r\nConnection: close\r\nUser-Agent: nextOS/3.0.0\r\nAccept: text/html,*/*\r\n\r\n";
-    for (int i = 0; hdr[i]; i++) {
-        if (rpos >= max_rpos) { tcp_close(); return -1; }
-        request[rpos++] = hdr[i];
-    }
-    request[rpos] = 0;
-
-    if (tls_send_encrypted(TLS_APPLICATION, (uint8_t *)request, rpos) < 0) {
-        tcp_close();
-        return -1;
+            "</body></html>");
     }
 
-    /* Step 8: Receive encrypted HTTP response */
-    int total_body = 0;
-    int header_done = 0;
-    int body_start_off = 0;
+    stats.tls_full_handshakes++;
+    tls_session_store(host, port, 0);
+    return 0;
+}
 
-    for (int attempt = 0; attempt < 20 && total_body < buf_size - 1; attempt++) {
+/* Receive one decrypted response into body, like http_receive() */
+static int https_receive(rope_t *body, int *framed)
+{
+    progress_set(NET_PROGRESS_RECEIVING);
+    resp_begin(body);
+
+    /* Records other than application data are bounded; data is not */
+    for (int other = 0; other < 20 && !resp.stop; ) {
         uint8_t rec_type;
         int rec_len = tls_read_record(&rec_type, tls_recv_buf, TLS_RECV_BUF_SIZE);
         if (rec_len <= 0) break;
 
         if (rec_type == TLS_ALERT) break;
+        if (rec_type != TLS_APPLICATION) { other++; continue; }
 
-        if (rec_type == TLS_APPLICATION) {
-            uint8_t pt[TLS_RECV_BUF_SIZE];
-            int pt_len = tls_decrypt_record(tls_recv_buf, rec_len, TLS_APPLICATION, pt, sizeof(pt));
-            if (pt_len <= 0) break;
-
-            if (!header_done) {
-                /* Find end of HTTP headers */
-                int temp_start = total_body;
-                int copy_len = pt_len;
-                if (temp_start + copy_len >= buf_size) copy_len = buf_size - temp_start - 1;
-                mem_copy(response_buf + temp_start, pt, copy_len);
-                total_body += copy_len;
-                response_buf[total_body] = 0;
-
-                /* Search for \r\n\r\n in accumulated data */
-                for (int i = 0; i < total_body - 3; i++) {
-                    if (response_buf[i] == '\r' && response_buf[i+1] == '\n' &&
-                        response_buf[i+2] == '\r' && response_buf[i+3] == '\n') {
-                        body_start_off = i + 4;
-                        header_done = 1;
-                        /* Move body to start */
-                        int body_len = total_body - body_start_off;
-                        for (int j = 0; j < body_len; j++)
-                            response_buf[j] = response_buf[body_start_off + j];
-                        total_body = body_len;
-                        response_buf[total_body] = 0;
-                        break;
-                    }
-                }
-            } else {
-                /* Append decrypted data */
-                int copy_len = pt_len;
-                if (total_body + copy_len >= buf_size) copy_len = buf_size - total_body - 1;
-                if (copy_len > 0) {
-                    mem_copy(response_buf + total_body, pt, copy_len);
-                    total_body += copy_len;
-                }
-            }
+        uint8_t *pt;
+        int pt_len = tls_decrypt_record(tls_recv_buf, rec_len, TLS_APPLICATION, &pt);
+        if (pt_len <= 0) break;
+
+        resp_input((const char *)pt, pt_len);
+        if (resp.framed && body_complete()) break;
+    }
+    return resp_end(framed);
+}
+
+int https_get(const char *host, uint16_t port, const char *path, rope_t *body)
+{
+    if (!net_is_available()) return -1;
+    parse_response_headers("", 0);
+
+    /* Build the HTTP request */
+    char request[1024];
+    int rpos = build_get_request(request, (int)sizeof(request), host, path,
+                                 "Connection: keep-alive\r\nUser-Agent: nextOS/3.0.0\r\n"
+                                 "Accept: text/html,*/*\r\nAccept-Encoding: gzip, deflate\r\n");
+    if (rpos < 0) return -1;
+
+    /* A kept connection skips DNS, TCP setup and the handshake */
+    int reused = conn_reuse(host, port, 1), framed = 0, total_body = 0;
+    for (;;) {
+        if (!reused) {
+            int rc = tls_open(host, port, body);
+            if (rc != 0) return rc;
         }
+        int sent = tls_send_encrypted(TLS_APPLICATION, (uint8_t *)request, rpos) >= 0;
+        if (sent) total_body = https_receive(body, &framed);
+        if (framed || !reused) {
+            if (!sent) { conn_close(); return -1; }
+            break;
+        }
+        /* The kept connection had gone stale: retry on a new one */
+        conn_close();
+        rope_free(body);
+        reused = 0;
     }
 
-    response_buf[total_body] = 0;
-    tcp_close();
+    conn_release(host, port, 1, framed && last_response.keep_alive &&
+                 !resp.stop && !last_response.corrupt && body_complete());
+    if (last_response.corrupt) return corrupt_page(body);
 
     /* If we got no body at all, return error */
-    if (total_body == 0) {
-        const char *err =
+    if (total_body == 0 && last_response.status != 304)
+        return error_page(body,
             "<html><body bgcolor=\"#FFFFF0\">"
             "<h1>Empty HTTPS Response</h1>"
             "<p>The server did not return any content.</p>"
-            "</body></html>";
-        int len = 0;
-        for (int i = 0; err[i] && len < buf_size - 1; i++)
-            response_buf[len++] = err[i];
-        response_buf[len] = 0;
-        return len;
-    }
+            "</body></html>");
 
     return total_body;
 }
@@ -1599,9 +3207,9 @@ int https_get(const char *host, uint16_t port, const char *path,
 void net_stack_init(void)
 {
     mem_zero(arp_cache, sizeof(arp_cache));
-    tcp_state = TCP_CLOSED;
-    tcp_rx_head = 0;
-    tcp_rx_tail = 0;
+    mem_zero(tcp_socks, sizeof(tcp_socks));
+    http_sock = -1;
+    pool_sock = -1;
 
     /* Set defaults for QEMU user networking (SLIRP) */
     our_ip     = parse_ip_string("10.0.2.15");
@@ -6,6 +6,7 @@
 #define NEXTOS_NET_STACK_H
 
 #include <stdint.h>
+#include "rope.h"
 
 /* ── Ethernet ────────────────────────────────────────────────────────── */
 #define ETH_TYPE_ARP  0x0806
@@ -85,8 +86,6 @@ typedef struct {
 } __attribute__((packed)) dns_header_t;
 
 /* ── Network stack configuration ─────────────────────────────────────── */
-#define NET_MAX_HTTP_RESPONSE 32768
-
 void     net_stack_init(void);
 
 /* Configuration */
@@ -96,22 +95,95 @@ uint32_t net_stack_get_ip(void);
 /* DNS resolution */
 uint32_t dns_resolve(const char *hostname);
 
-/* HTTP GET - returns response body length, or -1 on error */
-int      http_get(const char *host, uint16_t port, const char *path,
-                  char *response_buf, int buf_size);
+/* HTTP GET - appends the decoded body (de-chunked and decompressed) to
+ * an initialised rope, up to its limit.  Returns the body length, or -1
+ * on error.                                                          */
+int      http_get(const char *host, uint16_t port, const char *path, rope_t *body);
+
+/* HTTPS GET - same contract as http_get */
+int      https_get(const char *host, uint16_t port, const char *path, rope_t *body);
+
+/* Extra request lines ("Name: value\r\n"...) sent by the next calls
+ * above, or 0 for none.  The string must outlive the call.          */
+void     net_set_request_headers(const char *headers);
 
-/* HTTPS GET - returns response body length, or -1 on error */
-int      https_get(const char *host, uint16_t port, const char *path,
-                   char *response_buf, int buf_size);
+/* Status and caching headers of the last response (status 0 if none) */
+typedef struct {
+    int  status;
+    int  fresh_secs;           /* Freshness lifetime; -1 unknown, 0 revalidate */
+    int  no_store;
+    char etag[64];
+    char last_modified[48];
+    int  content_length;       /* -1 if not sent */
+    int  chunked;
+    int  keep_alive;           /* Server left the connection open */
+    int  content_encoding;     /* HTTP_ENCODING_*, already undone in the body */
+    int  corrupt;              /* Encoded body failed to decode or ended early */
+} http_response_info_t;
+
+#define HTTP_ENCODING_IDENTITY 0
+#define HTTP_ENCODING_GZIP     1
+#define HTTP_ENCODING_DEFLATE  2
+
+const http_response_info_t *net_last_response(void);
+
+/* Progress of the blocking calls above, reported from inside them.
+ * bytes is the response payload received so far (RECEIVING only).  */
+#define NET_PROGRESS_IDLE       0
+#define NET_PROGRESS_RESOLVING  1
+#define NET_PROGRESS_CONNECTING 2
+#define NET_PROGRESS_HANDSHAKE  3
+#define NET_PROGRESS_RECEIVING  4
+
+typedef void (*net_progress_fn)(int stage, int bytes);
+void     net_set_progress_hook(net_progress_fn fn);
+
+/* Response body for the same calls, handed over in order as it arrives
+ * (headers stripped, decoded).  The whole body still ends up in the rope. */
+typedef void (*net_body_fn)(const char *data, int len);
+void     net_set_body_hook(net_body_fn fn);
 
 /* Process incoming packets */
 void     net_stack_process(void);
 
-/* TCP connection (simple blocking) */
+/* Protocol counters since boot (the driver's are in net_stats_t) */
+typedef struct {
+    uint64_t rx_bad_csum;          /* Dropped: IP, TCP or UDP checksum    */
+    uint64_t rx_no_socket;         /* TCP for no socket, answered by RST  */
+    uint64_t rx_no_port;           /* UDP nobody was waiting for          */
+    uint64_t loopback_packets;     /* Sent to 127/8, delivered in memory  */
+    uint64_t tcp_segs_in, tcp_segs_out;
+    uint64_t tcp_ooo;              /* Segments held beyond a hole         */
+    uint64_t tcp_ooo_full;         /* ... dropped, no range slot left     */
+    uint64_t tcp_dup;              /* Segments entirely received before   */
+    uint64_t tcp_rx_full;          /* Segments cut short: receive ring full */
+    uint64_t tcp_retransmits;      /* Segments sent again, by any cause   */
+    uint64_t tcp_fast_retransmits;
+    uint64_t tcp_timeouts;         /* Retransmission timeouts fired       */
+    uint64_t arp_misses;           /* Sends that had to ask ARP first     */
+    uint64_t arp_failures;         /* ... with no answer: dropped         */
+    uint64_t dns_queries, dns_cache_hits, dns_failures;
+    uint64_t dns_total_ms;         /* Latency of the answered queries     */
+    uint32_t dns_last_ms, dns_max_ms;
+    uint64_t tls_full_handshakes;  /* Certificate and RSA key exchange    */
+    uint64_t tls_resumed;          /* Abbreviated, from the session cache */
+} net_stack_stats_t;
+
+void     net_stack_get_stats(net_stack_stats_t *out);
+
+/* TCP sockets (blocking).  tcp_connect returns a handle, or -1; the
+ * handle is valid until tcp_close, even after the peer has closed.
+ * tcp_listen takes connections on a local port; each one tcp_accept
+ * returns is a handle of its own.  Closing the listener resets the
+ * connections not accepted yet.  127/8 is looped back in memory.   */
+#define TCP_MAX_SOCKETS 8
+
 int      tcp_connect(uint32_t dst_ip, uint16_t dst_port);
-int      tcp_send_data(const void *data, int len);
-int      tcp_receive_data(void *buf, int buf_size, int timeout_ms);
-void     tcp_close(void);
-int      tcp_is_connected(void);
+int      tcp_listen(uint16_t port);
+int      tcp_accept(int listener, int timeout_ms);
+int      tcp_send(int sock, const void *data, int len);
+int      tcp_recv(int sock, void *buf, int buf_size, int timeout_ms);
+void     tcp_close(int sock);
+int      tcp_is_connected(int sock);
 
 #endif /* NEXTOS_NET_STACK_H */
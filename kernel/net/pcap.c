@@ -0,0 +1,140 @@
+/*
+ * nextOS - pcap.c
+ * Bounded in-kernel packet capture
+ *
+ * Records are kept in a byte ring already in libpcap record format (a
+ * 16-byte header, then the frame), so the ring read from its oldest
+ * byte is the body of the file and saving is at most two writes.  A
+ * record that does not fit pushes out the oldest ones.  Timestamps are
+ * time since boot.
+ */
+#include "pcap.h"
+#include "../drivers/timer.h"
+#include "../fs/vfs.h"
+#include "../mem/heap.h"
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_rec_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t  thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_file_t;
+
+#define PCAP_MAGIC        0xA1B2C3D4u
+#define PCAP_LINK_ETHERNET 1
+
+static uint8_t     *ring = (void *)0;
+static uint32_t     ring_tail;     /* Oldest record */
+static uint32_t     ring_used;
+static pcap_stats_t stats;
+
+/* ── Ring ─────────────────────────────────────────────────────────────── */
+static void ring_put(uint32_t pos, const void *src, uint32_t n)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    for (uint32_t i = 0; i < n; i++)
+        ring[(pos + i) % PCAP_RING_SIZE] = s[i];
+}
+
+static void ring_get(uint32_t pos, void *dst, uint32_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    for (uint32_t i = 0; i < n; i++)
+        d[i] = ring[(pos + i) % PCAP_RING_SIZE];
+}
+
+static void ring_drop_oldest(void)
+{
+    pcap_rec_t rec;
+    ring_get(ring_tail, &rec, sizeof(rec));
+    uint32_t n = (uint32_t)sizeof(rec) + rec.incl_len;
+    ring_tail = (ring_tail + n) % PCAP_RING_SIZE;
+    ring_used -= n;
+    stats.held--;
+    stats.overwritten++;
+}
+
+/* ── Public interface ─────────────────────────────────────────────────── */
+int pcap_start(void)
+{
+    if (!ring) {
+        ring = (uint8_t *)kmalloc_tagged(PCAP_RING_SIZE);
+        if (!ring) return -1;
+    }
+    ring_tail = 0;
+    ring_used = 0;
+    stats.frames = 0;
+    stats.overwritten = 0;
+    stats.held = 0;
+    stats.active = 1;
+    return 0;
+}
+
+void pcap_stop(void)
+{
+    stats.active = 0;
+}
+
+int pcap_active(void)
+{
+    return stats.active;
+}
+
+void pcap_record(const uint8_t *frame, int len)
+{
+    if (!stats.active || len <= 0) return;
+
+    pcap_rec_t rec;
+    uint64_t us = timer_now_ns() / 1000;
+    rec.ts_sec = (uint32_t)(us / 1000000);
+    rec.ts_usec = (uint32_t)(us % 1000000);
+    rec.orig_len = (uint32_t)len;
+    rec.incl_len = len > PCAP_SNAPLEN ? PCAP_SNAPLEN : (uint32_t)len;
+
+    uint32_t n = (uint32_t)sizeof(rec) + rec.incl_len;
+    while (PCAP_RING_SIZE - ring_used < n) ring_drop_oldest();
+
+    uint32_t head = (ring_tail + ring_used) % PCAP_RING_SIZE;
+    ring_put(head, &rec, sizeof(rec));
+    ring_put((head + sizeof(rec)) % PCAP_RING_SIZE, frame, rec.incl_len);
+    ring_used += n;
+    stats.held++;
+    stats.frames++;
+}
+
+int pcap_save(const char *path)
+{
+    if (!ring) return -1;
+
+    vfs_node_t node;
+    vfs_delete(path);
+    if (vfs_create(path, VFS_FILE) != 0 || vfs_open(path, &node) != 0) return -1;
+
+    pcap_file_t hdr = { PCAP_MAGIC, 2, 4, 0, 0, PCAP_SNAPLEN, PCAP_LINK_ETHERNET };
+    if (vfs_write(&node, 0, sizeof(hdr), &hdr) != (int)sizeof(hdr)) return -1;
+
+    uint64_t off = sizeof(hdr);
+    uint32_t first = PCAP_RING_SIZE - ring_tail;
+    if (first > ring_used) first = ring_used;
+    if (vfs_write(&node, off, first, ring + ring_tail) != (int)first) return -1;
+    if (ring_used > first &&
+        vfs_write(&node, off + first, ring_used - first, ring) != (int)(ring_used - first))
+        return -1;
+    return (int)stats.held;
+}
+
+void pcap_get_stats(pcap_stats_t *out)
+{
+    *out = stats;
+    out->bytes = ring_used;
+}
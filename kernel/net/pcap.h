@@ -0,0 +1,36 @@
+/*
+ * nextOS - pcap.h
+ * Bounded in-kernel packet capture, saved as libpcap files
+ */
+#ifndef NEXTOS_PCAP_H
+#define NEXTOS_PCAP_H
+
+#include <stdint.h>
+
+#define PCAP_RING_SIZE  (1024 * 1024)  /* Oldest records give way when full */
+#define PCAP_SNAPLEN    1518
+
+typedef struct {
+    uint64_t frames;           /* Recorded since pcap_start */
+    uint64_t overwritten;      /* Dropped from the ring for newer ones */
+    uint32_t held;             /* Records in the ring now */
+    uint32_t bytes;            /* Ring bytes in use, including headers */
+    int      active;
+} pcap_stats_t;
+
+/* Start capturing into an empty ring (allocated on first use); stopping
+ * keeps what was captured for pcap_save.                             */
+int  pcap_start(void);
+void pcap_stop(void);
+int  pcap_active(void);
+
+/* Copy an Ethernet frame, sent or received, into the ring if capturing */
+void pcap_record(const uint8_t *frame, int len);
+
+/* Write the ring to path (replacing it) as a pcap file.  Returns the
+ * number of records written, or -1.                                 */
+int  pcap_save(const char *path);
+
+void pcap_get_stats(pcap_stats_t *out);
+
+#endif /* NEXTOS_PCAP_H */
@@ -0,0 +1,70 @@
+/*
+ * nextOS - rope.c
+ * Growable byte buffer made of a list of heap chunks
+ *
+ * Responses are received into a rope so their size is bounded only by
+ * the caller's limit, and growing one never copies what it holds.
+ */
+#include "rope.h"
+#include "../mem/heap.h"
+
+void rope_init(rope_t *r, uint32_t limit)
+{
+    r->head = r->tail = (void *)0;
+    r->len = 0;
+    r->limit = limit;
+}
+
+void rope_free(rope_t *r)
+{
+    rope_chunk_t *c = r->head;
+    while (c) {
+        rope_chunk_t *next = c->next;
+        kfree(c);
+        c = next;
+    }
+    r->head = r->tail = (void *)0;
+    r->len = 0;
+}
+
+uint32_t rope_append(rope_t *r, const void *data, uint32_t len)
+{
+    const char *src = (const char *)data;
+    if (len > r->limit - r->len) len = r->limit - r->len;
+
+    uint32_t done = 0;
+    while (done < len) {
+        rope_chunk_t *c = r->tail;
+        if (!c || c->len == ROPE_CHUNK_SIZE) {
+            c = (rope_chunk_t *)kmalloc(sizeof(rope_chunk_t));
+            if (!c) break;
+            c->next = (void *)0;
+            c->len = 0;
+            if (r->tail) r->tail->next = c;
+            else         r->head = c;
+            r->tail = c;
+        }
+        uint32_t n = ROPE_CHUNK_SIZE - c->len;
+        if (n > len - done) n = len - done;
+        for (uint32_t i = 0; i < n; i++) c->data[c->len + i] = src[done + i];
+        c->len += n;
+        done += n;
+    }
+    r->len += done;
+    return done;
+}
+
+uint32_t rope_copy(const rope_t *r, uint32_t off, void *dst, uint32_t len)
+{
+    char *out = (char *)dst;
+    uint32_t done = 0;
+    for (const rope_chunk_t *c = r->head; c && done < len; c = c->next) {
+        if (off >= c->len) { off -= c->len; continue; }
+        uint32_t n = c->len - off;
+        if (n > len - done) n = len - done;
+        for (uint32_t i = 0; i < n; i++) out[done + i] = c->data[off + i];
+        done += n;
+        off = 0;
+    }
+    return done;
+}
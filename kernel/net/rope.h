@@ -0,0 +1,34 @@
+/*
+ * nextOS - rope.h
+ * Growable byte buffer made of a list of heap chunks
+ */
+#ifndef NEXTOS_ROPE_H
+#define NEXTOS_ROPE_H
+
+#include <stdint.h>
+
+#define ROPE_CHUNK_SIZE 16384
+
+typedef struct rope_chunk {
+    struct rope_chunk *next;
+    uint32_t           len;
+    char               data[ROPE_CHUNK_SIZE];
+} rope_chunk_t;
+
+/* Appending never moves what is already stored */
+typedef struct {
+    rope_chunk_t *head, *tail;
+    uint32_t      len;
+    uint32_t      limit;       /* Appends past this many bytes are dropped */
+} rope_t;
+
+void     rope_init(rope_t *r, uint32_t limit);
+void     rope_free(rope_t *r);
+
+/* Returns the bytes stored, short of len at the limit or out of memory */
+uint32_t rope_append(rope_t *r, const void *data, uint32_t len);
+
+/* Copy up to len bytes from offset off; returns the bytes copied */
+uint32_t rope_copy(const rope_t *r, uint32_t off, void *dst, uint32_t len);
+
+#endif /* NEXTOS_ROPE_H */
@@ -2,13 +2,19 @@
  * nextOS - tls_crypto.c
  * Cryptographic primitives for TLS 1.2
  *
- * SHA-256, SHA-1, HMAC-SHA-256, HMAC-SHA-1, AES-128-CBC, RSA PKCS#1 v1.5, TLS PRF
+ * SHA-256, SHA-1, HMAC-SHA-256, HMAC-SHA-1, AES-128-CBC, AES-128-GCM,
+ * RSA PKCS#1 v1.5, TLS PRF
  *
  * Note: This is a minimal but correct implementation for use in a
- * freestanding kernel environment. Not optimized for speed.
+ * freestanding kernel environment.  RSA uses 64-bit limbs and Montgomery
+ * multiplication.  AES, GHASH and SHA switch to AES-NI, PCLMULQDQ and
+ * SHA-NI when CPUID reports them, through GCC target attributes and builtins (no
+ * intrinsic headers), like the AVX2 row kernels in raster.c.
+ * tls_crypto_bench() times the handshake and record primitives.
  */
 #include "tls_crypto.h"
 #include "../drivers/timer.h"
+#include "../arch/x86_64/cpu.h"
 
 /* ── Memory helpers ──────────────────────────────────────────────────── */
 static void mc(void *d, const void *s, int n) {
@@ -22,6 +28,22 @@ static void mz(void *d, int n) {
 }
 static int sl(const char *s) { int n = 0; while (s[n]) n++; return n; }
 
+/* ── Vector types for the CPU extension paths ────────────────────────── */
+typedef long long v2di  __attribute__((vector_size(16)));
+typedef long long v2diu __attribute__((vector_size(16), aligned(1)));
+typedef int       v4si  __attribute__((vector_size(16)));
+typedef int       v4siu __attribute__((vector_size(16), aligned(1)));
+typedef char      v16qi __attribute__((vector_size(16)));
+
+#define AESNI  __attribute__((target("aes")))
+#define PCLMUL __attribute__((target("pclmul")))
+#define SHANI  __attribute__((target("sha,ssse3,sse4.1")))
+
+#define NI_LD(p)     (*(const v2diu *)(const void *)(p))
+#define NI_ST(p, v)  (*(v2diu *)(void *)(p) = (v))
+#define NI_LD32(p)   (*(const v4siu *)(const void *)(p))
+#define NI_ST32(p, v) (*(v4siu *)(void *)(p) = (v))
+
 /* ── SHA-256 ─────────────────────────────────────────────────────────── */
 static const uint32_t sha256_k[64] = {
     0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
@@ -42,7 +64,7 @@ static const uint32_t sha256_k[64] = {
 #define SIG0(x) (RR(x,7)^RR(x,18)^((x)>>3))
 #define SIG1(x) (RR(x,17)^RR(x,19)^((x)>>10))
 
-static void sha256_transform(sha256_ctx_t *ctx, const uint8_t data[64])
+static void sha256_transform(uint32_t state[8], const uint8_t data[64])
 {
     uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
     int i;
@@ -51,15 +73,57 @@ static void sha256_transform(sha256_ctx_t *ctx, const uint8_t data[64])
                ((uint32_t)data[i*4+2]<<8)|data[i*4+3];
     for (i = 16; i < 64; i++)
         w[i] = SIG1(w[i-2]) + w[i-7] + SIG0(w[i-15]) + w[i-16];
-    a=ctx->state[0]; b=ctx->state[1]; c=ctx->state[2]; d=ctx->state[3];
-    e=ctx->state[4]; f=ctx->state[5]; g=ctx->state[6]; h=ctx->state[7];
+    a=state[0]; b=state[1]; c=state[2]; d=state[3];
+    e=state[4]; f=state[5]; g=state[6]; h=state[7];
     for (i = 0; i < 64; i++) {
         t1 = h + EP1(e) + CH(e,f,g) + sha256_k[i] + w[i];
         t2 = EP0(a) + MAJ(a,b,c);
         h=g; g=f; f=e; e=d+t1; d=c; c=b; b=a; a=t1+t2;
     }
-    ctx->state[0]+=a; ctx->state[1]+=b; ctx->state[2]+=c; ctx->state[3]+=d;
-    ctx->state[4]+=e; ctx->state[5]+=f; ctx->state[6]+=g; ctx->state[7]+=h;
+    state[0]+=a; state[1]+=b; state[2]+=c; state[3]+=d;
+    state[4]+=e; state[5]+=f; state[6]+=g; state[7]+=h;
+}
+
+/* SHA-NI keeps the state as ABEF / CDGH and runs two rounds per
+ * sha256rnds2; sha256msg1/msg2 extend the schedule four words at a
+ * time.  The shuffles are pshufd, palignr and pblendw.             */
+#define BSWAP32_MASK (v16qi){3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12}
+
+SHANI static void sha256_ni(uint32_t state[8], const uint8_t *p, int blocks)
+{
+    v4si t  = __builtin_shuffle(NI_LD32(state), (v4si){1, 0, 3, 2});
+    v4si s1 = __builtin_shuffle(NI_LD32(state + 4), (v4si){3, 2, 1, 0});
+    v4si s0 = __builtin_shuffle(s1, t, (v4si){2, 3, 4, 5});     /* ABEF */
+    s1 = __builtin_shuffle(s1, t, (v4si){0, 1, 6, 7});          /* CDGH */
+
+    for (; blocks > 0; blocks--, p += 64) {
+        v4si abef = s0, cdgh = s1, w[16];
+        for (int i = 0; i < 16; i++) {
+            if (i < 4)
+                w[i] = (v4si)__builtin_shuffle((v16qi)NI_LD32(p + 16*i), BSWAP32_MASK);
+            else
+                w[i] = __builtin_ia32_sha256msg2(
+                           __builtin_ia32_sha256msg1(w[i-4], w[i-3]) +
+                           __builtin_shuffle(w[i-2], w[i-1], (v4si){1, 2, 3, 4}),
+                           w[i-1]);
+            v4si m = w[i] + NI_LD32(sha256_k + 4*i);
+            s1 = __builtin_ia32_sha256rnds2(s1, s0, m);
+            s0 = __builtin_ia32_sha256rnds2(s0, s1, __builtin_shuffle(m, (v4si){2, 3, 0, 0}));
+        }
+        s0 += abef;
+        s1 += cdgh;
+    }
+
+    t  = __builtin_shuffle(s0, (v4si){3, 2, 1, 0});
+    s1 = __builtin_shuffle(s1, (v4si){1, 0, 3, 2});
+    NI_ST32(state, __builtin_shuffle(t, s1, (v4si){0, 1, 6, 7}));
+    NI_ST32(state + 4, __builtin_shuffle(t, s1, (v4si){2, 3, 4, 5}));
+}
+
+static void sha256_blocks(uint32_t state[8], const uint8_t *p, int blocks)
+{
+    if (cpu_has(CPU_FEAT_SHA)) { sha256_ni(state, p, blocks); return; }
+    for (; blocks > 0; blocks--, p += 64) sha256_transform(state, p);
 }
 
 void sha256_init(sha256_ctx_t *ctx)
@@ -74,12 +138,19 @@ void sha256_init(sha256_ctx_t *ctx)
 
 void sha256_update(sha256_ctx_t *ctx, const uint8_t *data, int len)
 {
-    for (int i = 0; i < len; i++) {
-        ctx->buf[ctx->count % 64] = data[i];
-        ctx->count++;
-        if ((ctx->count % 64) == 0)
-            sha256_transform(ctx, ctx->buf);
+    int used = (int)(ctx->count % 64);
+    ctx->count += (uint64_t)len;
+    if (used) {
+        int take = 64 - used < len ? 64 - used : len;
+        mc(ctx->buf + used, data, take);
+        data += take;
+        len -= take;
+        if (used + take < 64) return;
+        sha256_blocks(ctx->state, ctx->buf, 1);
     }
+    /* Whole blocks straight from the caller's buffer */
+    sha256_blocks(ctx->state, data, len / 64);
+    mc(ctx->buf, data + (len & ~63), len % 64);
 }
 
 void sha256_final(sha256_ctx_t *ctx, uint8_t digest[32])
@@ -89,13 +160,13 @@ void sha256_final(sha256_ctx_t *ctx, uint8_t digest[32])
     ctx->buf[idx++] = 0x80;
     if (idx > 56) {
         while (idx < 64) ctx->buf[idx++] = 0;
-        sha256_transform(ctx, ctx->buf);
+        sha256_blocks(ctx->state, ctx->buf, 1);
         idx = 0;
     }
     while (idx < 56) ctx->buf[idx++] = 0;
     for (int i = 7; i >= 0; i--)
         ctx->buf[56 + (7-i)] = (uint8_t)(bits >> (i*8));
-    sha256_transform(ctx, ctx->buf);
+    sha256_blocks(ctx->state, ctx->buf, 1);
     for (int i = 0; i < 8; i++) {
         digest[i*4]   = (ctx->state[i]>>24)&0xff;
         digest[i*4+1] = (ctx->state[i]>>16)&0xff;
@@ -115,7 +186,7 @@ void sha256(const uint8_t *data, int len, uint8_t digest[32])
 /* ── SHA-1 ───────────────────────────────────────────────────────────── */
 #define SHA1_RL(x,n) (((x)<<(n))|((x)>>(32-(n))))
 
-static void sha1_transform(sha1_ctx_t *ctx, const uint8_t data[64])
+static void sha1_transform(uint32_t state[5], const uint8_t data[64])
 {
     uint32_t w[80], a, b, c, d, e, temp;
     int i;
@@ -125,8 +196,8 @@ static void sha1_transform(sha1_ctx_t *ctx, const uint8_t data[64])
     for (i = 16; i < 80; i++)
         w[i] = SHA1_RL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
 
-    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2];
-    d = ctx->state[3]; e = ctx->state[4];
+    a = state[0]; b = state[1]; c = state[2];
+    d = state[3]; e = state[4];
 
     for (i = 0; i < 80; i++) {
         uint32_t f, k;
@@ -138,8 +209,50 @@ static void sha1_transform(sha1_ctx_t *ctx, const uint8_t data[64])
         e = d; d = c; c = SHA1_RL(b, 30); b = a; a = temp;
     }
 
-    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c;
-    ctx->state[3] += d; ctx->state[4] += e;
+    state[0] += a; state[1] += b; state[2] += c;
+    state[3] += d; state[4] += e;
+}
+
+/* SHA-NI: sha1rnds4 does four rounds (the immediate picks f and K),
+ * sha1nexte derives the next E, sha1msg1/msg2 extend the schedule. */
+#define BSWAP128_MASK (v16qi){15,14,13,12, 11,10,9,8, 7,6,5,4, 3,2,1,0}
+
+#define SHA1_GROUPS(f, from)                                                \
+    for (int g = (from); g < 5 * ((f) + 1); g++) {                          \
+        if (g >= 4)                                                         \
+            w[g % 4] = __builtin_ia32_sha1msg2(                             \
+                __builtin_ia32_sha1msg1(w[g % 4], w[(g + 1) % 4]) ^         \
+                w[(g + 2) % 4], w[(g + 3) % 4]);                            \
+        v4si e_in = g ? __builtin_ia32_sha1nexte(prev, w[g % 4]) : e0 + w[0]; \
+        prev = abcd;                                                        \
+        abcd = __builtin_ia32_sha1rnds4(abcd, e_in, (f));                   \
+    }
+
+SHANI static void sha1_ni(uint32_t state[5], const uint8_t *p, int blocks)
+{
+    v4si abcd = __builtin_shuffle(NI_LD32(state), (v4si){3, 2, 1, 0});
+    v4si e0 = { 0, 0, 0, (int)state[4] };
+
+    for (; blocks > 0; blocks--, p += 64) {
+        v4si abcd_save = abcd, e_save = e0, prev = abcd, w[4];
+        for (int i = 0; i < 4; i++)
+            w[i] = (v4si)__builtin_shuffle((v16qi)NI_LD32(p + 16*i), BSWAP128_MASK);
+        SHA1_GROUPS(0, 0)
+        SHA1_GROUPS(1, 5)
+        SHA1_GROUPS(2, 10)
+        SHA1_GROUPS(3, 15)
+        e0 = __builtin_ia32_sha1nexte(prev, e_save);
+        abcd += abcd_save;
+    }
+
+    NI_ST32(state, __builtin_shuffle(abcd, (v4si){3, 2, 1, 0}));
+    state[4] = (uint32_t)e0[3];
+}
+
+static void sha1_blocks(uint32_t state[5], const uint8_t *p, int blocks)
+{
+    if (cpu_has(CPU_FEAT_SHA)) { sha1_ni(state, p, blocks); return; }
+    for (; blocks > 0; blocks--, p += 64) sha1_transform(state, p);
 }
 
 void sha1_init(sha1_ctx_t *ctx)
@@ -153,12 +266,18 @@ void sha1_init(sha1_ctx_t *ctx)
 
 void sha1_update(sha1_ctx_t *ctx, const uint8_t *data, int len)
 {
-    for (int i = 0; i < len; i++) {
-        ctx->buf[ctx->count % SHA1_BLOCK_SIZE] = data[i];
-        ctx->count++;
-        if (ctx->count % SHA1_BLOCK_SIZE == 0)
-            sha1_transform(ctx, ctx->buf);
+    int used = (int)(ctx->count % SHA1_BLOCK_SIZE);
+    ctx->count += (uint64_t)len;
+    if (used) {
+        int take = SHA1_BLOCK_SIZE - used < len ? SHA1_BLOCK_SIZE - used : len;
+        mc(ctx->buf + used, data, take);
+        data += take;
+        len -= take;
+        if (used + take < SHA1_BLOCK_SIZE) return;
+        sha1_blocks(ctx->state, ctx->buf, 1);
     }
+    sha1_blocks(ctx->state, data, len / SHA1_BLOCK_SIZE);
+    mc(ctx->buf, data + (len & ~63), len % SHA1_BLOCK_SIZE);
 }
 
 void sha1_final(sha1_ctx_t *ctx, uint8_t digest[SHA1_DIGEST_SIZE])
@@ -190,12 +309,9 @@ void sha1(const uint8_t *data, int len, uint8_t digest[SHA1_DIGEST_SIZE])
 }
 
 /* ── HMAC-SHA-256 ────────────────────────────────────────────────────── */
-void hmac_sha256(const uint8_t *key, int key_len,
-                 const uint8_t *data, int data_len,
-                 uint8_t out[32])
+void hmac_sha256_init(hmac_sha256_ctx_t *ctx, const uint8_t *key, int key_len)
 {
     uint8_t k_pad[64], tk[32];
-    sha256_ctx_t ctx;
 
     /* If key > 64 bytes, hash it first */
     if (key_len > 64) {
@@ -208,32 +324,54 @@ void hmac_sha256(const uint8_t *key, int key_len,
     mz(k_pad, 64);
     mc(k_pad, key, key_len);
     for (int i = 0; i < 64; i++) k_pad[i] ^= 0x36;
-
-    sha256_init(&ctx);
-    sha256_update(&ctx, k_pad, 64);
-    sha256_update(&ctx, data, data_len);
-    uint8_t inner[32];
-    sha256_final(&ctx, inner);
+    sha256_init(&ctx->inner);
+    sha256_update(&ctx->inner, k_pad, 64);
 
     /* opad */
+    for (int i = 0; i < 64; i++) k_pad[i] ^= 0x36 ^ 0x5c;
+    sha256_init(&ctx->outer);
+    sha256_update(&ctx->outer, k_pad, 64);
+
     mz(k_pad, 64);
-    mc(k_pad, key, key_len);
-    for (int i = 0; i < 64; i++) k_pad[i] ^= 0x5c;
+    mz(tk, 32);
+}
 
-    sha256_init(&ctx);
-    sha256_update(&ctx, k_pad, 64);
-    sha256_update(&ctx, inner, 32);
-    sha256_final(&ctx, out);
+void hmac_sha256_start(const hmac_sha256_ctx_t *ctx, sha256_ctx_t *msg)
+{
+    *msg = ctx->inner;
+}
 
-    mz(k_pad, 64);
+void hmac_sha256_finish(const hmac_sha256_ctx_t *ctx, sha256_ctx_t *msg,
+                        uint8_t out[SHA256_DIGEST_SIZE])
+{
+    uint8_t inner[32];
+    sha256_final(msg, inner);
+    *msg = ctx->outer;
+    sha256_update(msg, inner, 32);
+    sha256_final(msg, out);
     mz(inner, 32);
-    mz(tk, 32);
+}
+
+void hmac_sha256_mac(const hmac_sha256_ctx_t *ctx, const uint8_t *data, int data_len,
+                     uint8_t out[SHA256_DIGEST_SIZE])
+{
+    sha256_ctx_t msg;
+    hmac_sha256_start(ctx, &msg);
+    sha256_update(&msg, data, data_len);
+    hmac_sha256_finish(ctx, &msg, out);
+}
+
+void hmac_sha256(const uint8_t *key, int key_len,
+                 const uint8_t *data, int data_len,
+                 uint8_t out[32])
+{
+    hmac_sha256_ctx_t ctx;
+    hmac_sha256_init(&ctx, key, key_len);
+    hmac_sha256_mac(&ctx, data, data_len, out);
 }
 
 /* ── HMAC-SHA-1 ──────────────────────────────────────────────────────── */
-void hmac_sha1(const uint8_t *key, int key_len,
-               const uint8_t *data, int data_len,
-               uint8_t out[SHA1_DIGEST_SIZE])
+void hmac_sha1_init(hmac_sha1_ctx_t *ctx, const uint8_t *key, int key_len)
 {
     uint8_t k[SHA1_BLOCK_SIZE];
     mz(k, SHA1_BLOCK_SIZE);
@@ -249,28 +387,48 @@ void hmac_sha1(const uint8_t *key, int key_len,
         ipad[i] = k[i] ^ 0x36;
         opad[i] = k[i] ^ 0x5c;
     }
-
-    sha1_ctx_t ctx;
-    sha1_init(&ctx);
-    sha1_update(&ctx, ipad, SHA1_BLOCK_SIZE);
-    sha1_update(&ctx, data, data_len);
-    uint8_t inner[SHA1_DIGEST_SIZE];
-    sha1_final(&ctx, inner);
-
-    sha1_init(&ctx);
-    sha1_update(&ctx, opad, SHA1_BLOCK_SIZE);
-    sha1_update(&ctx, inner, SHA1_DIGEST_SIZE);
-    sha1_final(&ctx, out);
+    sha1_init(&ctx->inner);
+    sha1_update(&ctx->inner, ipad, SHA1_BLOCK_SIZE);
+    sha1_init(&ctx->outer);
+    sha1_update(&ctx->outer, opad, SHA1_BLOCK_SIZE);
 
     mz(k, SHA1_BLOCK_SIZE);
     mz(ipad, SHA1_BLOCK_SIZE);
     mz(opad, SHA1_BLOCK_SIZE);
+}
+
+void hmac_sha1_start(const hmac_sha1_ctx_t *ctx, sha1_ctx_t *msg)
+{
+    *msg = ctx->inner;
+}
+
+void hmac_sha1_finish(const hmac_sha1_ctx_t *ctx, sha1_ctx_t *msg,
+                      uint8_t out[SHA1_DIGEST_SIZE])
+{
+    uint8_t inner[SHA1_DIGEST_SIZE];
+    sha1_final(msg, inner);
+    *msg = ctx->outer;
+    sha1_update(msg, inner, SHA1_DIGEST_SIZE);
+    sha1_final(msg, out);
     mz(inner, SHA1_DIGEST_SIZE);
 }
 
+void hmac_sha1(const uint8_t *key, int key_len,
+               const uint8_t *data, int data_len,
+               uint8_t out[SHA1_DIGEST_SIZE])
+{
+    hmac_sha1_ctx_t ctx;
+    sha1_ctx_t msg;
+    hmac_sha1_init(&ctx, key, key_len);
+    hmac_sha1_start(&ctx, &msg);
+    sha1_update(&msg, data, data_len);
+    hmac_sha1_finish(&ctx, &msg, out);
+}
+
 /* ── TLS PRF (SHA-256) ───────────────────────────────────────────────── */
 /* P_hash(secret, seed) = HMAC(secret, A(1) + seed) + HMAC(secret, A(2) + seed) + ...
- * A(0) = seed, A(i) = HMAC(secret, A(i-1)) */
+ * A(0) = seed, A(i) = HMAC(secret, A(i-1))
+ * The secret is keyed into HMAC midstates once for the whole output. */
 void tls_prf_sha256(const uint8_t *secret, int secret_len,
                     const char *label,
                     const uint8_t *seed, int seed_len,
@@ -287,18 +445,22 @@ void tls_prf_sha256(const uint8_t *secret, int secret_len,
         ls_len += seed_len;
     }
 
+    hmac_sha256_ctx_t key;
+    hmac_sha256_init(&key, secret, secret_len);
+
     uint8_t a[32];  /* A(i) */
     /* A(1) = HMAC(secret, label + seed) */
-    hmac_sha256(secret, secret_len, ls, ls_len, a);
+    hmac_sha256_mac(&key, ls, ls_len, a);
 
     int done = 0;
     while (done < output_len) {
         /* HMAC(secret, A(i) + label + seed) */
-        uint8_t input[32 + 128];
-        mc(input, a, 32);
-        mc(input + 32, ls, ls_len);
+        sha256_ctx_t msg;
         uint8_t p[32];
-        hmac_sha256(secret, secret_len, input, 32 + ls_len, p);
+        hmac_sha256_start(&key, &msg);
+        sha256_update(&msg, a, 32);
+        sha256_update(&msg, ls, ls_len);
+        hmac_sha256_finish(&key, &msg, p);
 
         int take = output_len - done;
         if (take > 32) take = 32;
@@ -306,10 +468,9 @@ void tls_prf_sha256(const uint8_t *secret, int secret_len,
         done += take;
 
         /* A(i+1) = HMAC(secret, A(i)) */
-        uint8_t a_next[32];
-        hmac_sha256(secret, secret_len, a, 32, a_next);
-        mc(a, a_next, 32);
+        hmac_sha256_mac(&key, a, 32, a);
     }
+    mz(&key, sizeof(key));
 }
 
 /* ── AES-128 ─────────────────────────────────────────────────────────── */
@@ -369,6 +530,94 @@ static uint32_t aes_rot_word(uint32_t w)
     return (w << 8) | (w >> 24);
 }
 
+/* ── AES-NI ──────────────────────────────────────────────────────────── */
+/* The encryption schedule is rk[] byte by byte; the Equivalent Inverse
+ * Cipher takes it in reverse with InvMixColumns on the inner keys.   */
+AESNI static void ni_expand(aes128_ctx_t *ctx)
+{
+    for (int i = 0; i < 44; i++)
+        for (int b = 0; b < 4; b++)
+            ctx->ek[4*i + b] = (uint8_t)(ctx->rk[i] >> (24 - 8*b));
+    NI_ST(ctx->dk, NI_LD(ctx->ek + 160));
+    for (int r = 1; r < 10; r++)
+        NI_ST(ctx->dk + 16*r, __builtin_ia32_aesimc128(NI_LD(ctx->ek + 160 - 16*r)));
+    NI_ST(ctx->dk + 160, NI_LD(ctx->ek));
+}
+
+AESNI static inline v2di ni_enc(const uint8_t *k, v2di b)
+{
+    b ^= NI_LD(k);
+    for (int r = 1; r < 10; r++) b = __builtin_ia32_aesenc128(b, NI_LD(k + 16*r));
+    return __builtin_ia32_aesenclast128(b, NI_LD(k + 160));
+}
+
+AESNI static inline v2di ni_dec(const uint8_t *k, v2di b)
+{
+    b ^= NI_LD(k);
+    for (int r = 1; r < 10; r++) b = __builtin_ia32_aesdec128(b, NI_LD(k + 16*r));
+    return __builtin_ia32_aesdeclast128(b, NI_LD(k + 160));
+}
+
+/* Four independent blocks per round key hide the aesenc/aesdec latency */
+#define NI_ROUNDS4(op, last, k, b)                                        \
+    do {                                                                  \
+        v2di rk_ = NI_LD(k);                                              \
+        b[0] ^= rk_; b[1] ^= rk_; b[2] ^= rk_; b[3] ^= rk_;               \
+        for (int r_ = 1; r_ < 10; r_++) {                                 \
+            rk_ = NI_LD((k) + 16*r_);                                     \
+            b[0] = op(b[0], rk_); b[1] = op(b[1], rk_);                   \
+            b[2] = op(b[2], rk_); b[3] = op(b[3], rk_);                   \
+        }                                                                 \
+        rk_ = NI_LD((k) + 160);                                           \
+        b[0] = last(b[0], rk_); b[1] = last(b[1], rk_);                   \
+        b[2] = last(b[2], rk_); b[3] = last(b[3], rk_);                   \
+    } while (0)
+
+AESNI static void ni_encrypt_block(const aes128_ctx_t *ctx, const uint8_t *in, uint8_t *out)
+{
+    NI_ST(out, ni_enc(ctx->ek, NI_LD(in)));
+}
+
+AESNI static void ni_decrypt_block(const aes128_ctx_t *ctx, const uint8_t *in, uint8_t *out)
+{
+    NI_ST(out, ni_dec(ctx->dk, NI_LD(in)));
+}
+
+AESNI static void ni_cbc_encrypt(const aes128_ctx_t *ctx, uint8_t iv[16],
+                                 const uint8_t *in, uint8_t *out, int len)
+{
+    v2di c = NI_LD(iv);
+    for (int i = 0; i < len; i += 16) {
+        c = ni_enc(ctx->ek, c ^ NI_LD(in + i));
+        NI_ST(out + i, c);
+    }
+    NI_ST(iv, c);
+}
+
+AESNI static void ni_cbc_decrypt(const aes128_ctx_t *ctx, uint8_t iv[16],
+                                 const uint8_t *in, uint8_t *out, int len)
+{
+    v2di prev = NI_LD(iv);
+    int i = 0;
+    for (; i + 64 <= len; i += 64) {
+        v2di c[4], b[4];
+        for (int j = 0; j < 4; j++) b[j] = c[j] = NI_LD(in + i + 16*j);
+        NI_ROUNDS4(__builtin_ia32_aesdec128, __builtin_ia32_aesdeclast128, ctx->dk, b);
+        NI_ST(out + i,      b[0] ^ prev);
+        NI_ST(out + i + 16, b[1] ^ c[0]);
+        NI_ST(out + i + 32, b[2] ^ c[1]);
+        NI_ST(out + i + 48, b[3] ^ c[2]);
+        prev = c[3];
+    }
+    for (; i < len; i += 16) {
+        v2di c = NI_LD(in + i);
+        NI_ST(out + i, ni_dec(ctx->dk, c) ^ prev);
+        prev = c;
+    }
+    NI_ST(iv, prev);
+}
+
+/* ── AES-128 block functions ─────────────────────────────────────────── */
 void aes128_init(aes128_ctx_t *ctx, const uint8_t key[16])
 {
     for (int i = 0; i < 4; i++)
@@ -380,10 +629,14 @@ void aes128_init(aes128_ctx_t *ctx, const uint8_t key[16])
             t = aes_sub_word(aes_rot_word(t)) ^ aes_rcon[i/4-1];
         ctx->rk[i] = ctx->rk[i-4] ^ t;
     }
+    ctx->ni = cpu_has(CPU_FEAT_AESNI);
+    if (ctx->ni) ni_expand(ctx);
 }
 
 void aes128_encrypt_block(const aes128_ctx_t *ctx, const uint8_t in[16], uint8_t out[16])
 {
+    if (ctx->ni) { ni_encrypt_block(ctx, in, out); return; }
+
     uint8_t s[16];
     mc(s, in, 16);
 
@@ -426,6 +679,8 @@ void aes128_encrypt_block(const aes128_ctx_t *ctx, const uint8_t in[16], uint8_t
 
 void aes128_decrypt_block(const aes128_ctx_t *ctx, const uint8_t in[16], uint8_t out[16])
 {
+    if (ctx->ni) { ni_decrypt_block(ctx, in, out); return; }
+
     uint8_t s[16];
     mc(s, in, 16);
 
@@ -469,6 +724,32 @@ void aes128_decrypt_block(const aes128_ctx_t *ctx, const uint8_t in[16], uint8_t
     mc(out, s, 16);
 }
 
+/* ── AES-128-CBC ─────────────────────────────────────────────────────── */
+void aes128_cbc_encrypt_blocks(const aes128_ctx_t *ctx, uint8_t iv[16],
+                               const uint8_t *in, uint8_t *out, int len)
+{
+    if (ctx->ni) { ni_cbc_encrypt(ctx, iv, in, out, len); return; }
+    for (int i = 0; i < len; i += 16) {
+        uint8_t block[16];
+        for (int j = 0; j < 16; j++) block[j] = in[i+j] ^ iv[j];
+        aes128_encrypt_block(ctx, block, out + i);
+        mc(iv, out + i, 16);
+    }
+}
+
+void aes128_cbc_decrypt_blocks(const aes128_ctx_t *ctx, uint8_t iv[16],
+                               const uint8_t *in, uint8_t *out, int len)
+{
+    if (ctx->ni) { ni_cbc_decrypt(ctx, iv, in, out, len); return; }
+    for (int i = 0; i < len; i += 16) {
+        uint8_t c[16], block[16];
+        mc(c, in + i, 16);
+        aes128_decrypt_block(ctx, c, block);
+        for (int j = 0; j < 16; j++) out[i+j] = block[j] ^ iv[j];
+        mc(iv, c, 16);
+    }
+}
+
 /* AES-128-CBC encrypt */
 int aes128_cbc_encrypt(const uint8_t *key, const uint8_t *iv,
                        const uint8_t *plaintext, int plain_len,
@@ -482,20 +763,15 @@ int aes128_cbc_encrypt(const uint8_t *key, const uint8_t *iv,
     int total = plain_len + pad;
     if (total > max_out) return -1;
 
-    uint8_t prev[16];
-    mc(prev, iv, 16);
+    uint8_t chain[16];
+    mc(chain, iv, 16);
+    int whole = plain_len - plain_len % 16;
+    aes128_cbc_encrypt_blocks(&ctx, chain, plaintext, ciphertext, whole);
 
-    for (int i = 0; i < total; i += 16) {
-        uint8_t block[16];
-        for (int j = 0; j < 16; j++) {
-            if (i + j < plain_len) block[j] = plaintext[i+j];
-            else block[j] = (uint8_t)pad;
-        }
-        /* XOR with previous ciphertext (or IV) */
-        for (int j = 0; j < 16; j++) block[j] ^= prev[j];
-        aes128_encrypt_block(&ctx, block, ciphertext + i);
-        mc(prev, ciphertext + i, 16);
-    }
+    uint8_t block[16];
+    for (int j = 0; j < 16; j++)
+        block[j] = whole + j < plain_len ? plaintext[whole + j] : (uint8_t)pad;
+    aes128_cbc_encrypt_blocks(&ctx, chain, block, ciphertext + whole, 16);
     return total;
 }
 
@@ -510,14 +786,9 @@ int aes128_cbc_decrypt(const uint8_t *key, const uint8_t *iv,
     aes128_ctx_t ctx;
     aes128_init(&ctx, key);
 
-    const uint8_t *prev = iv;
-    for (int i = 0; i < cipher_len; i += 16) {
-        uint8_t block[16];
-        aes128_decrypt_block(&ctx, ciphertext + i, block);
-        for (int j = 0; j < 16; j++) block[j] ^= prev[j];
-        mc(plaintext + i, block, 16);
-        prev = ciphertext + i;
-    }
+    uint8_t chain[16];
+    mc(chain, iv, 16);
+    aes128_cbc_decrypt_blocks(&ctx, chain, ciphertext, plaintext, cipher_len);
 
     /* Remove PKCS#7 padding */
     int pad = plaintext[cipher_len - 1];
@@ -529,6 +800,277 @@ int aes128_cbc_decrypt(const uint8_t *key, const uint8_t *iv,
     return cipher_len - pad;
 }
 
+/* ── AES-128-GCM ─────────────────────────────────────────────────────── */
+/* Blocks are handled as big-endian (hi, lo) halves, which is GCM's
+ * bit-reflected order: bit 127 of the pair is the coefficient of x^0. */
+static inline uint64_t ld_be64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+static inline void st_be64(uint8_t *p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--) { p[i] = (uint8_t)v; v >>= 8; }
+}
+
+/* Software GHASH: Shoup's 4-bit tables, hh/hl[i] = i * H */
+static const uint16_t ghash_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static void ghash_table(aes128_gcm_ctx_t *ctx, uint64_t vh, uint64_t vl)
+{
+    ctx->hh[0] = ctx->hl[0] = 0;
+    ctx->hh[8] = vh;
+    ctx->hl[8] = vl;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t t = (vl & 1) * 0xe1000000u;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ (t << 32);
+        ctx->hh[i] = vh;
+        ctx->hl[i] = vl;
+    }
+    for (int i = 2; i <= 8; i *= 2)
+        for (int j = 1; j < i; j++) {
+            ctx->hh[i + j] = ctx->hh[i] ^ ctx->hh[j];
+            ctx->hl[i + j] = ctx->hl[i] ^ ctx->hl[j];
+        }
+}
+
+static void ghash_mul_soft(const aes128_gcm_ctx_t *ctx, uint64_t *yh, uint64_t *yl)
+{
+    uint8_t x[16];
+    st_be64(x, *yh);
+    st_be64(x + 8, *yl);
+
+    uint64_t zh = ctx->hh[x[15] & 0xf], zl = ctx->hl[x[15] & 0xf];
+    for (int i = 15; i >= 0; i--) {
+        int lo = x[i] & 0xf, hi = x[i] >> 4;
+        if (i != 15) {
+            int rem = (int)(zl & 0xf);
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ ((uint64_t)ghash_last4[rem] << 48);
+            zh ^= ctx->hh[lo];
+            zl ^= ctx->hl[lo];
+        }
+        int rem = (int)(zl & 0xf);
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ ((uint64_t)ghash_last4[rem] << 48);
+        zh ^= ctx->hh[hi];
+        zl ^= ctx->hl[hi];
+    }
+    *yh = zh;
+    *yl = zl;
+}
+
+/* PCLMULQDQ GHASH.  A 128x128 carry-less product is kept unreduced as
+ * three 128-bit terms (lo, middle, hi), so several products can be
+ * summed and reduced once: Y = (Y^X1)H^4 + X2 H^3 + X3 H^2 + X4 H.   */
+typedef struct { v2di lo, mid, hi; } clmul_acc_t;
+
+PCLMUL static inline void clmul_add(clmul_acc_t *acc, uint64_t ah, uint64_t al,
+                                    uint64_t bh, uint64_t bl)
+{
+    v2di a = { (long long)al, (long long)ah };
+    v2di b = { (long long)bl, (long long)bh };
+    acc->lo  ^= __builtin_ia32_pclmulqdq128(a, b, 0x00);
+    acc->mid ^= __builtin_ia32_pclmulqdq128(a, b, 0x01) ^
+                __builtin_ia32_pclmulqdq128(a, b, 0x10);
+    acc->hi  ^= __builtin_ia32_pclmulqdq128(a, b, 0x11);
+}
+
+/* Shift the reflected 255-bit product into place and reduce it modulo
+ * x^128 + x^7 + x^2 + x + 1 (Gueron and Kounavis' shift-xor method). */
+static inline void clmul_reduce(const clmul_acc_t *acc, uint64_t *yh, uint64_t *yl)
+{
+    uint64_t x0 = (uint64_t)acc->lo[0];
+    uint64_t x1 = (uint64_t)acc->lo[1] ^ (uint64_t)acc->mid[0];
+    uint64_t x2 = (uint64_t)acc->hi[0] ^ (uint64_t)acc->mid[1];
+    uint64_t x3 = (uint64_t)acc->hi[1];
+
+    x3 = (x3 << 1) | (x2 >> 63);
+    x2 = (x2 << 1) | (x1 >> 63);
+    x1 = (x1 << 1) | (x0 >> 63);
+    x0 <<= 1;
+
+    uint64_t d  = x1 ^ (x0 << 63) ^ (x0 << 62) ^ (x0 << 57);
+    uint64_t h1 = d  ^ (d >> 1) ^ (d >> 2) ^ (d >> 7);
+    uint64_t h0 = x0 ^ ((x0 >> 1) | (d << 63)) ^ ((x0 >> 2) | (d << 62)) ^
+                  ((x0 >> 7) | (d << 57));
+    *yh = x3 ^ h1;
+    *yl = x2 ^ h0;
+}
+
+PCLMUL static void clmul_mul(uint64_t ah, uint64_t al, uint64_t bh, uint64_t bl,
+                             uint64_t *yh, uint64_t *yl)
+{
+    clmul_acc_t acc = { {0, 0}, {0, 0}, {0, 0} };
+    clmul_add(&acc, ah, al, bh, bl);
+    clmul_reduce(&acc, yh, yl);
+}
+
+PCLMUL static void ghash_clmul(const aes128_gcm_ctx_t *ctx, uint64_t *yh, uint64_t *yl,
+                               const uint8_t *p, int blocks)
+{
+    const uint64_t *hp = ctx->hpow;
+    uint64_t h = *yh, l = *yl;
+    for (; blocks >= 4; blocks -= 4, p += 64) {
+        clmul_acc_t acc = { {0, 0}, {0, 0}, {0, 0} };
+        clmul_add(&acc, h ^ ld_be64(p), l ^ ld_be64(p + 8), hp[6], hp[7]);
+        clmul_add(&acc, ld_be64(p + 16), ld_be64(p + 24), hp[4], hp[5]);
+        clmul_add(&acc, ld_be64(p + 32), ld_be64(p + 40), hp[2], hp[3]);
+        clmul_add(&acc, ld_be64(p + 48), ld_be64(p + 56), hp[0], hp[1]);
+        clmul_reduce(&acc, &h, &l);
+    }
+    for (; blocks > 0; blocks--, p += 16)
+        clmul_mul(h ^ ld_be64(p), l ^ ld_be64(p + 8), hp[0], hp[1], &h, &l);
+    *yh = h;
+    *yl = l;
+}
+
+/* Absorb len bytes into Y, zero-padding a final partial block */
+static void ghash_update(const aes128_gcm_ctx_t *ctx, uint64_t *yh, uint64_t *yl,
+                         const uint8_t *p, int len)
+{
+    int whole = len / 16;
+    if (ctx->clmul) {
+        ghash_clmul(ctx, yh, yl, p, whole);
+    } else {
+        for (int i = 0; i < whole; i++) {
+            *yh ^= ld_be64(p + 16*i);
+            *yl ^= ld_be64(p + 16*i + 8);
+            ghash_mul_soft(ctx, yh, yl);
+        }
+    }
+    if (len % 16) {
+        uint8_t last[16];
+        mz(last, 16);
+        mc(last, p + 16*whole, len % 16);
+        if (ctx->clmul) {
+            ghash_clmul(ctx, yh, yl, last, 1);
+        } else {
+            *yh ^= ld_be64(last);
+            *yl ^= ld_be64(last + 8);
+            ghash_mul_soft(ctx, yh, yl);
+        }
+    }
+}
+
+static inline void ctr_inc(uint8_t ctr[16])
+{
+    for (int i = 15; i >= 12 && ++ctr[i] == 0; i--) ;
+}
+
+AESNI static void ni_ctr(const aes128_ctx_t *ctx, uint8_t ctr[16],
+                         const uint8_t *in, uint8_t *out, int len)
+{
+    int i = 0;
+    for (; i + 64 <= len; i += 64) {
+        v2di b[4];
+        for (int j = 0; j < 4; j++) { b[j] = NI_LD(ctr); ctr_inc(ctr); }
+        NI_ROUNDS4(__builtin_ia32_aesenc128, __builtin_ia32_aesenclast128, ctx->ek, b);
+        for (int j = 0; j < 4; j++)
+            NI_ST(out + i + 16*j, b[j] ^ NI_LD(in + i + 16*j));
+    }
+    for (; i < len; i += 16) {
+        uint8_t ks[16];
+        NI_ST(ks, ni_enc(ctx->ek, NI_LD(ctr)));
+        ctr_inc(ctr);
+        for (int j = 0; j < 16 && i + j < len; j++) out[i+j] = in[i+j] ^ ks[j];
+    }
+}
+
+/* CTR keystream over len bytes; only the last call may be partial */
+static void gcm_ctr(const aes128_ctx_t *ctx, uint8_t ctr[16],
+                    const uint8_t *in, uint8_t *out, int len)
+{
+    if (ctx->ni) { ni_ctr(ctx, ctr, in, out, len); return; }
+    for (int i = 0; i < len; i += 16) {
+        uint8_t ks[16];
+        aes128_encrypt_block(ctx, ctr, ks);
+        ctr_inc(ctr);
+        for (int j = 0; j < 16 && i + j < len; j++) out[i+j] = in[i+j] ^ ks[j];
+    }
+}
+
+void aes128_gcm_init(aes128_gcm_ctx_t *ctx, const uint8_t key[AES_KEY_SIZE])
+{
+    aes128_init(&ctx->aes, key);
+    uint8_t zero[16], hk[16];
+    mz(zero, 16);
+    aes128_encrypt_block(&ctx->aes, zero, hk);
+    uint64_t hh = ld_be64(hk), hl = ld_be64(hk + 8);
+
+    ghash_table(ctx, hh, hl);
+    ctx->clmul = cpu_has(CPU_FEAT_PCLMUL);
+    if (ctx->clmul) {
+        ctx->hpow[0] = hh;
+        ctx->hpow[1] = hl;
+        for (int i = 2; i < 8; i += 2)
+            clmul_mul(ctx->hpow[i-2], ctx->hpow[i-1], hh, hl, &ctx->hpow[i], &ctx->hpow[i+1]);
+    }
+}
+
+/* Ciphertext is hashed a chunk at a time, next to the CTR pass over the
+ * same bytes, so both run while the chunk is still in L1.           */
+#define GCM_CHUNK 1024
+
+static void gcm_crypt(const aes128_gcm_ctx_t *ctx, const uint8_t nonce[GCM_NONCE_SIZE],
+                      const uint8_t *aad, int aad_len,
+                      const uint8_t *in, uint8_t *out, int len,
+                      int decrypt, uint8_t tag[GCM_TAG_SIZE])
+{
+    uint8_t j0[16], ctr[16];
+    mc(j0, nonce, 12);
+    j0[12] = j0[13] = j0[14] = 0;
+    j0[15] = 1;
+    mc(ctr, j0, 16);
+    ctr_inc(ctr);
+
+    uint64_t yh = 0, yl = 0;
+    ghash_update(ctx, &yh, &yl, aad, aad_len);
+    for (int off = 0; off < len; off += GCM_CHUNK) {
+        int n = len - off < GCM_CHUNK ? len - off : GCM_CHUNK;
+        if (decrypt) ghash_update(ctx, &yh, &yl, in + off, n);
+        gcm_ctr(&ctx->aes, ctr, in + off, out + off, n);
+        if (!decrypt) ghash_update(ctx, &yh, &yl, out + off, n);
+    }
+
+    uint8_t lens[16];
+    st_be64(lens, (uint64_t)aad_len * 8);
+    st_be64(lens + 8, (uint64_t)len * 8);
+    ghash_update(ctx, &yh, &yl, lens, 16);
+
+    aes128_encrypt_block(&ctx->aes, j0, tag);
+    uint8_t y[16];
+    st_be64(y, yh);
+    st_be64(y + 8, yl);
+    for (int i = 0; i < 16; i++) tag[i] ^= y[i];
+}
+
+void aes128_gcm_seal(const aes128_gcm_ctx_t *ctx, const uint8_t nonce[GCM_NONCE_SIZE],
+                     const uint8_t *aad, int aad_len,
+                     const uint8_t *in, uint8_t *out, int len,
+                     uint8_t tag[GCM_TAG_SIZE])
+{
+    gcm_crypt(ctx, nonce, aad, aad_len, in, out, len, 0, tag);
+}
+
+int aes128_gcm_open(const aes128_gcm_ctx_t *ctx, const uint8_t nonce[GCM_NONCE_SIZE],
+                    const uint8_t *aad, int aad_len,
+                    const uint8_t *in, uint8_t *out, int len,
+                    const uint8_t tag[GCM_TAG_SIZE])
+{
+    uint8_t expect[GCM_TAG_SIZE];
+    gcm_crypt(ctx, nonce, aad, aad_len, in, out, len, 1, expect);
+    uint8_t diff = 0;
+    for (int i = 0; i < GCM_TAG_SIZE; i++) diff |= expect[i] ^ tag[i];
+    return diff ? -1 : 0;
+}
+
 /* ── RSA Public Key from X.509 DER ───────────────────────────────────── */
 /* Parse ASN.1 DER length */
 static int asn1_len(const uint8_t *p, int max, int *hlen)
@@ -609,154 +1151,175 @@ int rsa_extract_pubkey(const uint8_t *cert, int cert_len, rsa_pubkey_t *key)
 }
 
 /* ── RSA Modular Exponentiation (big number) ─────────────────────────── */
-/* Simple big-number modular exponentiation using byte arrays.
- * result = base^exp mod mod, all as big-endian byte arrays. */
+/*
+ * Numbers are little-endian arrays of 64-bit limbs, as many as the
+ * modulus has.  Products are reduced with Montgomery multiplication
+ * (CIOS: each limb of b is multiplied in and one limb reduced away in
+ * the same pass), so an exponentiation is a conversion into the
+ * Montgomery domain, one multiply per exponent bit and a conversion out.
+ * Only public-key operations are done, so nothing here is constant-time.
+ */
+#define BN_LIMBS (RSA_MAX_MOD_BYTES / 8)
 
-/* Big-number multiply-and-mod for RSA (schoolbook, slow but correct) */
-/* Working with arrays of uint32_t for slightly better performance */
-#define BN_WORDS ((RSA_MAX_MOD_BYTES/4)+2)
+typedef unsigned __int128 u128;
 
 typedef struct {
-    uint32_t d[BN_WORDS];
-    int n;  /* number of significant words */
-} bignum_t;
-
-static void bn_zero(bignum_t *a) { mz(a, sizeof(*a)); }
-
-static void bn_from_bytes(bignum_t *a, const uint8_t *data, int len)
+    uint64_t n[BN_LIMBS];
+    int      len;              /* Limbs */
+    uint64_t n0inv;            /* -n^-1 mod 2^64 */
+    uint64_t one[BN_LIMBS];    /* R mod n, with R = 2^(64 len) */
+    uint64_t rr[BN_LIMBS];     /* R^2 mod n */
+} mont_t;
+
+static void bn_from_bytes(uint64_t *a, int limbs, const uint8_t *data, int len)
 {
-    bn_zero(a);
-    int words = (len + 3) / 4;
-    if (words > BN_WORDS) words = BN_WORDS;
-    a->n = words;
-    for (int i = 0; i < len && i < BN_WORDS * 4; i++) {
-        int wi = (len - 1 - i) / 4;
-        int bi = (len - 1 - i) % 4;
-        a->d[wi] |= (uint32_t)data[i] << (bi * 8);
-    }
-    /* Normalize */
-    while (a->n > 0 && a->d[a->n - 1] == 0) a->n--;
+    for (int i = 0; i < limbs; i++) a[i] = 0;
+    for (int i = 0; i < len && i < limbs * 8; i++)
+        a[i / 8] |= (uint64_t)data[len - 1 - i] << (8 * (i % 8));
 }
 
-static void bn_to_bytes(const bignum_t *a, uint8_t *out, int len)
+static void bn_to_bytes(const uint64_t *a, int limbs, uint8_t *out, int len)
 {
-    mz(out, len);
-    for (int i = 0; i < len; i++) {
-        int wi = i / 4;
-        int bi = i % 4;
-        if (wi < BN_WORDS)
-            out[len - 1 - i] = (a->d[wi] >> (bi * 8)) & 0xff;
-    }
+    for (int i = 0; i < len; i++)
+        out[len - 1 - i] = i < limbs * 8 ? (uint8_t)(a[i / 8] >> (8 * (i % 8))) : 0;
 }
 
 /* Compare: returns -1, 0, or 1 */
-static int bn_cmp(const bignum_t *a, const bignum_t *b)
+static int bn_cmp(const uint64_t *a, const uint64_t *b, int limbs)
 {
-    int n = a->n > b->n ? a->n : b->n;
-    for (int i = n - 1; i >= 0; i--) {
-        uint32_t av = (i < a->n) ? a->d[i] : 0;
-        uint32_t bv = (i < b->n) ? b->d[i] : 0;
-        if (av > bv) return 1;
-        if (av < bv) return -1;
+    for (int i = limbs - 1; i >= 0; i--) {
+        if (a[i] > b[i]) return 1;
+        if (a[i] < b[i]) return -1;
     }
     return 0;
 }
 
-/* a = a - b (assumes a >= b) */
-static void bn_sub(bignum_t *a, const bignum_t *b)
+/* a -= b; returns the borrow out */
+static uint64_t bn_sub(uint64_t *a, const uint64_t *b, int limbs)
 {
-    int borrow = 0;
-    int n = a->n > b->n ? a->n : b->n;
-    for (int i = 0; i < n; i++) {
-        uint64_t av = (i < a->n) ? a->d[i] : 0;
-        uint64_t bv = (i < b->n) ? b->d[i] : 0;
-        bv += borrow;
-        if (av >= bv) {
-            a->d[i] = (uint32_t)(av - bv);
-            borrow = 0;
-        } else {
-            a->d[i] = (uint32_t)((0x100000000ULL + av) - bv);
-            borrow = 1;
-        }
+    uint64_t borrow = 0;
+    for (int i = 0; i < limbs; i++) {
+        u128 d = (u128)a[i] - b[i] - borrow;
+        a[i] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
     }
-    if (n > a->n) a->n = n;
-    while (a->n > 0 && a->d[a->n - 1] == 0) a->n--;
+    return borrow;
 }
 
-/* a = a + b */
-static void bn_add(bignum_t *a, const bignum_t *b)
+/* a = 2a mod n, for a < n */
+static void bn_dbl_mod(uint64_t *a, const mont_t *m)
 {
     uint64_t carry = 0;
-    int n = a->n > b->n ? a->n : b->n;
-    for (int i = 0; i <= n; i++) {
-        uint64_t sum = carry;
-        if (i < a->n) sum += a->d[i];
-        if (i < b->n) sum += b->d[i];
-        a->d[i] = (uint32_t)sum;
-        carry = sum >> 32;
+    for (int i = 0; i < m->len; i++) {
+        uint64_t nc = a[i] >> 63;
+        a[i] = (a[i] << 1) | carry;
+        carry = nc;
     }
-    a->n = n + 1;
-    while (a->n > 0 && a->d[a->n - 1] == 0) a->n--;
+    if (carry || bn_cmp(a, m->n, m->len) >= 0) bn_sub(a, m->n, m->len);
 }
 
-/* Shift left by 1 bit */
-static void bn_shl1(bignum_t *a)
+/* r = a * b / R mod n, for a, b < n.  r may alias a or b. */
+static void mont_mul(const mont_t *m, uint64_t *r, const uint64_t *a, const uint64_t *b)
 {
-    uint32_t carry = 0;
-    for (int i = 0; i < a->n; i++) {
-        uint32_t nc = a->d[i] >> 31;
-        a->d[i] = (a->d[i] << 1) | carry;
-        carry = nc;
-    }
-    if (carry && a->n < BN_WORDS) {
-        a->d[a->n] = carry;
-        a->n++;
+    uint64_t t[BN_LIMBS + 2];
+    int s = m->len;
+    for (int i = 0; i < s + 2; i++) t[i] = 0;
+
+    for (int i = 0; i < s; i++) {
+        uint64_t bi = b[i], carry = 0;
+        for (int j = 0; j < s; j++) {
+            u128 p = (u128)a[j] * bi + t[j] + carry;
+            t[j] = (uint64_t)p;
+            carry = (uint64_t)(p >> 64);
+        }
+        u128 p = (u128)t[s] + carry;
+        t[s] = (uint64_t)p;
+        t[s + 1] = (uint64_t)(p >> 64);
+
+        /* Add q n, which zeroes the low limb, and shift down a limb */
+        uint64_t q = t[0] * m->n0inv;
+        p = (u128)q * m->n[0] + t[0];
+        carry = (uint64_t)(p >> 64);
+        for (int j = 1; j < s; j++) {
+            p = (u128)q * m->n[j] + t[j] + carry;
+            t[j - 1] = (uint64_t)p;
+            carry = (uint64_t)(p >> 64);
+        }
+        p = (u128)t[s] + carry;
+        t[s - 1] = (uint64_t)p;
+        t[s] = t[s + 1] + (uint64_t)(p >> 64);
     }
+
+    /* t < 2n */
+    if (t[s] || bn_cmp(t, m->n, s) >= 0) bn_sub(t, m->n, s);
+    for (int i = 0; i < s; i++) r[i] = t[i];
 }
 
-/* c = a * b mod m (using Montgomery-like reduction, but simpler) */
-static void bn_mulmod(bignum_t *c, const bignum_t *a, const bignum_t *b, const bignum_t *m)
+/* r = x^e in the Montgomery domain (x and r are Montgomery forms) */
+static void mont_pow(const mont_t *m, uint64_t *r, const uint64_t *x, uint32_t e)
 {
-    /* Simple: accumulate a * each bit of b, reduce mod m */
-    bignum_t acc, temp;
-    bn_zero(&acc);
-    mc(&temp, a, sizeof(bignum_t));
-
-    /* Reduce temp mod m first */
-    while (bn_cmp(&temp, m) >= 0) bn_sub(&temp, m);
-
-    for (int i = 0; i < b->n * 32; i++) {
-        int wi = i / 32;
-        int bi = i % 32;
-        if (b->d[wi] & (1u << bi)) {
-            bn_add(&acc, &temp);
-            if (bn_cmp(&acc, m) >= 0) bn_sub(&acc, m);
-        }
-        bn_shl1(&temp);
-        if (bn_cmp(&temp, m) >= 0) bn_sub(&temp, m);
+    uint64_t acc[BN_LIMBS];
+    int bit = 31;
+    while (bit >= 0 && !(e & (1u << bit))) bit--;
+    for (int i = 0; i < m->len; i++) acc[i] = bit >= 0 ? x[i] : m->one[i];
+    while (--bit >= 0) {
+        mont_mul(m, acc, acc, acc);
+        if (e & (1u << bit)) mont_mul(m, acc, acc, x);
     }
-    mc(c, &acc, sizeof(bignum_t));
+    for (int i = 0; i < m->len; i++) r[i] = acc[i];
 }
 
-/* c = base^exp mod mod */
-static void bn_modexp(bignum_t *result, const bignum_t *base,
-                      uint32_t exp, const bignum_t *mod)
+/* Set up for an odd modulus of len big-endian bytes; -1 if unusable */
+static int mont_init(mont_t *m, const uint8_t *mod, int len)
 {
-    bignum_t r, b;
-    bn_zero(&r);
-    r.d[0] = 1; r.n = 1;
-    mc(&b, base, sizeof(bignum_t));
-    /* Reduce base mod m */
-    while (bn_cmp(&b, mod) >= 0) bn_sub(&b, mod);
+    while (len > 0 && mod[0] == 0) { mod++; len--; }
+    if (len <= 0 || len > RSA_MAX_MOD_BYTES || !(mod[len - 1] & 1)) return -1;
+    m->len = (len + 7) / 8;
+    bn_from_bytes(m->n, m->len, mod, len);
+
+    /* Newton's iteration doubles the correct low bits: 3, 6, ... 96 */
+    uint64_t x = m->n[0];
+    for (int i = 0; i < 5; i++) x *= 2 - m->n[0] * x;
+    m->n0inv = (uint64_t)0 - x;
+
+    /* R mod n: the top bit of n, doubled up to bit 64 len */
+    int top = 63;
+    while (!(m->n[m->len - 1] >> top)) top--;
+    for (int i = 0; i < m->len; i++) m->one[i] = 0;
+    m->one[m->len - 1] = 1ULL << top;
+    if (bn_cmp(m->one, m->n, m->len) == 0) return -1;   /* n = 1 */
+    for (int i = top; i < 64; i++) bn_dbl_mod(m->one, m);
+
+    /* R^2 = (R 2^64)^len / R^(len-1): R 2^64 is the Montgomery form of
+     * 2^64, so len - 1 more doublings' worth comes from a short power. */
+    uint64_t g[BN_LIMBS];
+    for (int i = 0; i < m->len; i++) g[i] = m->one[i];
+    for (int i = 0; i < 64; i++) bn_dbl_mod(g, m);
+    mont_pow(m, m->rr, g, (uint32_t)m->len);
+    return 0;
+}
 
-    while (exp > 0) {
-        if (exp & 1) {
-            bn_mulmod(&r, &r, &b, mod);
-        }
-        bn_mulmod(&b, &b, &b, mod);
-        exp >>= 1;
-    }
-    mc(result, &r, sizeof(bignum_t));
+/* out = base^exp mod n, all big-endian of the modulus' byte length k */
+static int rsa_modexp(const uint8_t *base, const uint8_t *mod, int k,
+                      uint32_t exp, uint8_t *out)
+{
+    mont_t m;
+    if (mont_init(&m, mod, k) < 0) return -1;
+
+    uint64_t x[BN_LIMBS], one[BN_LIMBS];
+    int limbs = (k + 7) / 8;
+    bn_from_bytes(x, limbs, base, k);
+    for (int i = m.len; i < limbs; i++)
+        if (x[i]) return -1;
+    if (bn_cmp(x, m.n, m.len) >= 0) return -1;
+
+    mont_mul(&m, x, x, m.rr);           /* Into the Montgomery domain */
+    mont_pow(&m, x, x, exp);
+    for (int i = 0; i < m.len; i++) one[i] = 0;
+    one[0] = 1;
+    mont_mul(&m, x, x, one);            /* And out */
+    bn_to_bytes(x, m.len, out, k);
+    return 0;
 }
 
 /* RSA PKCS#1 v1.5 encrypt: output = (0x00 || 0x02 || PS || 0x00 || data)^e mod n */
@@ -784,12 +1347,7 @@ int rsa_pkcs1_encrypt(const rsa_pubkey_t *key,
     mc(em + 3 + ps_len, data, data_len);
 
     /* RSA: result = em^e mod n */
-    bignum_t base_bn, mod_bn, result_bn;
-    bn_from_bytes(&base_bn, em, k);
-    bn_from_bytes(&mod_bn, key->modulus, k);
-    bn_modexp(&result_bn, &base_bn, key->exponent, &mod_bn);
-    bn_to_bytes(&result_bn, output, k);
-
+    if (rsa_modexp(em, key->modulus, k, key->exponent, output) < 0) return -1;
     return k;
 }
 
@@ -893,3 +1451,69 @@ void tls_random_bytes(uint8_t *buf, int len)
     if (buf == 0 || len <= 0) return;
     prng_generate(buf, len);
 }
+
+/* ── Microbenchmark ──────────────────────────────────────────────────── */
+static uint64_t bench_rsa(int bytes, int rounds)
+{
+    static rsa_pubkey_t key;
+    uint8_t data[48], out[RSA_MAX_MOD_BYTES];
+    tls_random_bytes(key.modulus, bytes);
+    key.modulus[0] |= 0x80;
+    key.modulus[bytes - 1] |= 1;
+    key.mod_len = bytes;
+    key.exponent = 65537;
+    tls_random_bytes(data, sizeof(data));
+
+    uint64_t t = timer_now_ns();
+    for (int i = 0; i < rounds; i++)
+        rsa_pkcs1_encrypt(&key, data, sizeof(data), out, sizeof(out));
+    return (timer_now_ns() - t) / (uint64_t)rounds;
+}
+
+void tls_crypto_bench(tls_bench_t *out)
+{
+    out->rsa2048_ns = bench_rsa(256, 4);
+    out->rsa4096_ns = bench_rsa(512, 2);
+
+    uint8_t secret[48], seed[64], block[128];
+    tls_random_bytes(secret, sizeof(secret));
+    tls_random_bytes(seed, sizeof(seed));
+    uint64_t t = timer_now_ns();
+    for (int i = 0; i < 16; i++) {
+        tls_prf_sha256(secret, 48, "master secret", seed, 64, block, 48);
+        tls_prf_sha256(block, 48, "key expansion", seed, 64, block + 48, 72);
+        tls_prf_sha256(block, 48, "client finished", seed, 32, block + 48, 12);
+        tls_prf_sha256(block, 48, "server finished", seed, 32, block + 48, 12);
+    }
+    out->prf_ns = (timer_now_ns() - t) / 16;
+
+    static uint8_t buf[16384];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    t = timer_now_ns();
+    for (int i = 0; i < 8; i++) sha256(buf, sizeof(buf), digest);
+    out->sha256_16k_ns = (timer_now_ns() - t) / 8;
+
+    out->handshake_ns = out->rsa2048_ns + out->prf_ns;
+
+    /* Record layer: what opening one full-size record costs each way */
+    static aes128_gcm_ctx_t gcm;
+    uint8_t key[16], iv[16], mac[SHA256_DIGEST_SIZE], tag[GCM_TAG_SIZE];
+    tls_random_bytes(key, sizeof(key));
+    tls_random_bytes(iv, sizeof(iv));
+    aes128_gcm_init(&gcm, key);
+    t = timer_now_ns();
+    for (int i = 0; i < 8; i++) {
+        aes128_cbc_decrypt_blocks(&gcm.aes, iv, buf, buf, sizeof(buf));
+        hmac_sha256(key, sizeof(key), buf, sizeof(buf), mac);
+    }
+    out->cbc_16k_ns = (timer_now_ns() - t) / 8;
+
+    t = timer_now_ns();
+    for (int i = 0; i < 8; i++)
+        aes128_gcm_open(&gcm, iv, seed, 13, buf, buf, sizeof(buf), tag);
+    out->gcm_16k_ns = (timer_now_ns() - t) / 8;
+
+    out->aesni = gcm.aes.ni;
+    out->pclmul = gcm.clmul;
+    out->shani = cpu_has(CPU_FEAT_SHA);
+}
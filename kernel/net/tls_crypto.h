@@ -2,8 +2,9 @@
  * nextOS - tls_crypto.h
  * Cryptographic primitives for TLS 1.2
  *
- * Implements: SHA-256, SHA-1, HMAC-SHA-256, HMAC-SHA-1, AES-128-CBC,
- *             RSA PKCS#1 v1.5, TLS PRF (pseudo-random function)
+ * Implements: SHA-256, SHA-1 (SHA-NI when present), HMAC-SHA-256,
+ *             HMAC-SHA-1, AES-128-CBC, AES-128-GCM, RSA PKCS#1 v1.5,
+ *             TLS PRF (pseudo-random function)
  */
 #ifndef NEXTOS_TLS_CRYPTO_H
 #define NEXTOS_TLS_CRYPTO_H
@@ -50,6 +51,25 @@ void hmac_sha1(const uint8_t *key, int key_len,
                const uint8_t *data, int data_len,
                uint8_t out[SHA1_DIGEST_SIZE]);
 
+/* Keyed HMAC contexts: the hash states after the ipad and opad blocks,
+ * computed once per key.  A message is then start, any number of
+ * updates on the returned hash context, and finish; it costs its own
+ * blocks plus the outer one instead of two more for the pads.       */
+typedef struct { sha256_ctx_t inner, outer; } hmac_sha256_ctx_t;
+typedef struct { sha1_ctx_t inner, outer; }   hmac_sha1_ctx_t;
+
+void hmac_sha256_init(hmac_sha256_ctx_t *ctx, const uint8_t *key, int key_len);
+void hmac_sha256_start(const hmac_sha256_ctx_t *ctx, sha256_ctx_t *msg);
+void hmac_sha256_finish(const hmac_sha256_ctx_t *ctx, sha256_ctx_t *msg,
+                        uint8_t out[SHA256_DIGEST_SIZE]);
+void hmac_sha256_mac(const hmac_sha256_ctx_t *ctx, const uint8_t *data, int data_len,
+                     uint8_t out[SHA256_DIGEST_SIZE]);
+
+void hmac_sha1_init(hmac_sha1_ctx_t *ctx, const uint8_t *key, int key_len);
+void hmac_sha1_start(const hmac_sha1_ctx_t *ctx, sha1_ctx_t *msg);
+void hmac_sha1_finish(const hmac_sha1_ctx_t *ctx, sha1_ctx_t *msg,
+                      uint8_t out[SHA1_DIGEST_SIZE]);
+
 /* TLS PRF (SHA-256 based) */
 void tls_prf_sha256(const uint8_t *secret, int secret_len,
                     const char *label,
@@ -62,12 +82,24 @@ void tls_prf_sha256(const uint8_t *secret, int secret_len,
 
 typedef struct {
     uint32_t rk[44];  /* Round keys for AES-128 (11 rounds * 4 words) */
+    uint8_t  ek[176]; /* AES-NI schedules: rk in byte order, and the    */
+    uint8_t  dk[176]; /*   inverse cipher's (reversed, InvMixColumns)    */
+    int      ni;      /* Set when CPUID reports AES-NI                  */
 } aes128_ctx_t;
 
 void aes128_init(aes128_ctx_t *ctx, const uint8_t key[AES_KEY_SIZE]);
 void aes128_encrypt_block(const aes128_ctx_t *ctx, const uint8_t in[16], uint8_t out[16]);
 void aes128_decrypt_block(const aes128_ctx_t *ctx, const uint8_t in[16], uint8_t out[16]);
 
+/* CBC over whole blocks with an expanded key (len a multiple of 16, in
+ * may equal out).  iv is advanced to the last ciphertext block, so
+ * consecutive calls continue one chain.  Decryption runs four blocks
+ * at a time with AES-NI.                                            */
+void aes128_cbc_encrypt_blocks(const aes128_ctx_t *ctx, uint8_t iv[16],
+                               const uint8_t *in, uint8_t *out, int len);
+void aes128_cbc_decrypt_blocks(const aes128_ctx_t *ctx, uint8_t iv[16],
+                               const uint8_t *in, uint8_t *out, int len);
+
 /* AES-128-CBC */
 int aes128_cbc_encrypt(const uint8_t *key, const uint8_t *iv,
                        const uint8_t *plaintext, int plain_len,
@@ -76,6 +108,31 @@ int aes128_cbc_decrypt(const uint8_t *key, const uint8_t *iv,
                        const uint8_t *ciphertext, int cipher_len,
                        uint8_t *plaintext, int max_out);
 
+/* AES-128-GCM (96-bit nonce, 128-bit tag).  GHASH uses PCLMULQDQ when
+ * present, 4-bit tables otherwise; with AES-NI as well, four counter
+ * blocks and four GHASH multiplies are in flight per step.  in may
+ * equal out.  open returns 0 when the tag matches, -1 otherwise, and
+ * the output must then be discarded.                                */
+#define GCM_NONCE_SIZE 12
+#define GCM_TAG_SIZE   16
+
+typedef struct {
+    aes128_ctx_t aes;
+    uint64_t     hh[16], hl[16];  /* Multiples of H, software GHASH */
+    uint64_t     hpow[8];         /* H^1..H^4 (hi, lo), PCLMULQDQ   */
+    int          clmul;
+} aes128_gcm_ctx_t;
+
+void aes128_gcm_init(aes128_gcm_ctx_t *ctx, const uint8_t key[AES_KEY_SIZE]);
+void aes128_gcm_seal(const aes128_gcm_ctx_t *ctx, const uint8_t nonce[GCM_NONCE_SIZE],
+                     const uint8_t *aad, int aad_len,
+                     const uint8_t *in, uint8_t *out, int len,
+                     uint8_t tag[GCM_TAG_SIZE]);
+int  aes128_gcm_open(const aes128_gcm_ctx_t *ctx, const uint8_t nonce[GCM_NONCE_SIZE],
+                     const uint8_t *aad, int aad_len,
+                     const uint8_t *in, uint8_t *out, int len,
+                     const uint8_t tag[GCM_TAG_SIZE]);
+
 /* RSA public key operations */
 #define RSA_MAX_MOD_BYTES 512  /* Support up to 4096-bit keys */
 
@@ -97,4 +154,20 @@ int rsa_pkcs1_encrypt(const rsa_pubkey_t *key,
 uint32_t tls_random(void);
 void tls_random_bytes(uint8_t *buf, int len);
 
+/* TLS crypto microbenchmark: mean nanoseconds per operation, on random
+ * odd moduli and keys.  handshake_ns is what one RSA-2048 full
+ * handshake spends in crypto: the key exchange plus the four PRFs.  */
+typedef struct {
+    uint64_t rsa2048_ns;       /* Public-key encrypt, e = 65537 */
+    uint64_t rsa4096_ns;
+    uint64_t prf_ns;           /* Master secret, key block and both Finished */
+    uint64_t sha256_16k_ns;    /* SHA-256 over 16 KiB */
+    uint64_t handshake_ns;
+    uint64_t cbc_16k_ns;       /* Open a 16 KiB record: CBC decrypt + HMAC-SHA-256 */
+    uint64_t gcm_16k_ns;       /* ... AES-128-GCM */
+    int      aesni, pclmul, shani;  /* Which paths the above ran on */
+} tls_bench_t;
+
+void tls_crypto_bench(tls_bench_t *out);
+
 #endif /* NEXTOS_TLS_CRYPTO_H */
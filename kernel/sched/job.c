@@ -0,0 +1,278 @@
+/*
+ * nextOS - job.c
+ * Work-stealing job scheduler
+ *
+ * Each CPU owns a deque.  The owner pushes and pops at the tail (LIFO,
+ * cache-warm), thieves take from the head (FIFO, oldest and usually the
+ * largest work).  Deques and the job pool are fixed size; when either is
+ * exhausted the job simply runs inline, so submission never fails.
+ */
+#include "job.h"
+#include "../arch/x86_64/smp.h"
+
+#define JOB_POOL_SIZE   256     /* Job records per CPU  */
+#define JOB_DEQUE_SIZE  256     /* Power of two         */
+
+typedef struct job {
+    job_fn_t           fn;
+    void              *arg;
+    job_counter_t     *counter;
+    struct job        *next_waiter;
+    volatile uint32_t  in_use;
+} job_t;
+
+typedef struct {
+    spinlock_t lock;
+    uint32_t   head;            /* Free-running; size = tail - head */
+    uint32_t   tail;
+    job_t     *slots[JOB_DEQUE_SIZE];
+} job_deque_t;
+
+static job_t       job_pool[SMP_MAX_CPUS][JOB_POOL_SIZE];
+static uint32_t    pool_cursor[SMP_MAX_CPUS];
+static job_deque_t deques[SMP_MAX_CPUS];
+static int         idle_workers = 0;
+
+/* ── Job records ──────────────────────────────────────────────────────── */
+/* Records are claimed with a CAS, so any CPU (or an interrupt handler on
+ * the owner) may allocate; the calling CPU's pool is simply tried first. */
+static job_t *job_alloc(void)
+{
+    int self = smp_cpu_id();
+    int ncpu = smp_cpu_count();
+    for (int k = 0; k < ncpu; k++) {
+        int cpu = (self + k) % ncpu;
+        for (int n = 0; n < JOB_POOL_SIZE; n++) {
+            uint32_t i = __atomic_fetch_add(&pool_cursor[cpu], 1, __ATOMIC_RELAXED) % JOB_POOL_SIZE;
+            uint32_t expected = 0;
+            if (__atomic_compare_exchange_n(&job_pool[cpu][i].in_use, &expected, 1, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return &job_pool[cpu][i];
+        }
+    }
+    return (void *)0;
+}
+
+static void job_release(job_t *j)
+{
+    __atomic_store_n(&j->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/* ── Counters ─────────────────────────────────────────────────────────── */
+static void job_enqueue(job_t *j);
+
+static void counter_add(job_counter_t *c)
+{
+    if (c) __atomic_fetch_add(&c->value, 1, __ATOMIC_RELAXED);
+}
+
+/* The decrement and the waiter drain share c->lock with job_done(), so
+ * a waiter cannot see zero (and drop a stack counter) while we still
+ * hold a reference.  Nothing touches c after the unlock.             */
+static void counter_sub(job_counter_t *c)
+{
+    if (!c) return;
+
+    uint64_t flags = spin_lock_irqsave(&c->lock);
+    job_t *list = (void *)0;
+    if (__atomic_sub_fetch(&c->value, 1, __ATOMIC_ACQ_REL) == 0) {
+        list = c->waiters;
+        c->waiters = (void *)0;
+    }
+    spin_unlock_irqrestore(&c->lock, flags);
+
+    while (list) {
+        job_t *next = list->next_waiter;
+        job_enqueue(list);
+        list = next;
+    }
+}
+
+static void job_execute(job_t *j)
+{
+    job_fn_t fn = j->fn;
+    void *arg = j->arg;
+    job_counter_t *counter = j->counter;
+    job_release(j);
+    fn(arg);
+    counter_sub(counter);
+}
+
+/* ── Deques ───────────────────────────────────────────────────────────── */
+static int deque_push(job_deque_t *d, job_t *j)
+{
+    uint64_t flags = spin_lock_irqsave(&d->lock);
+    int ok = d->tail - d->head < JOB_DEQUE_SIZE;
+    if (ok) {
+        d->slots[d->tail & (JOB_DEQUE_SIZE - 1)] = j;
+        __atomic_store_n(&d->tail, d->tail + 1, __ATOMIC_RELEASE);
+    }
+    spin_unlock_irqrestore(&d->lock, flags);
+    return ok;
+}
+
+static job_t *deque_pop(job_deque_t *d)
+{
+    if (__atomic_load_n(&d->tail, __ATOMIC_ACQUIRE) == __atomic_load_n(&d->head, __ATOMIC_ACQUIRE))
+        return (void *)0;
+    job_t *j = (void *)0;
+    uint64_t flags = spin_lock_irqsave(&d->lock);
+    if (d->tail != d->head) {
+        __atomic_store_n(&d->tail, d->tail - 1, __ATOMIC_RELAXED);
+        j = d->slots[d->tail & (JOB_DEQUE_SIZE - 1)];
+    }
+    spin_unlock_irqrestore(&d->lock, flags);
+    return j;
+}
+
+static job_t *deque_steal(job_deque_t *d)
+{
+    if (__atomic_load_n(&d->tail, __ATOMIC_ACQUIRE) == __atomic_load_n(&d->head, __ATOMIC_ACQUIRE))
+        return (void *)0;
+    job_t *j = (void *)0;
+    uint64_t flags = spin_lock_irqsave(&d->lock);
+    if (d->tail != d->head) {
+        j = d->slots[d->head & (JOB_DEQUE_SIZE - 1)];
+        __atomic_store_n(&d->head, d->head + 1, __ATOMIC_RELAXED);
+    }
+    spin_unlock_irqrestore(&d->lock, flags);
+    return j;
+}
+
+static int has_work(void)
+{
+    int ncpu = smp_cpu_count();
+    for (int i = 0; i < ncpu; i++)
+        if (__atomic_load_n(&deques[i].tail, __ATOMIC_SEQ_CST) !=
+            __atomic_load_n(&deques[i].head, __ATOMIC_SEQ_CST))
+            return 1;
+    return 0;
+}
+
+/* Run one job: own deque first, then steal round-robin */
+static int run_one(void)
+{
+    int self = smp_cpu_id();
+    int ncpu = smp_cpu_count();
+    job_t *j = deque_pop(&deques[self]);
+    for (int k = 1; !j && k < ncpu; k++)
+        j = deque_steal(&deques[(self + k) % ncpu]);
+    if (!j) return 0;
+    job_execute(j);
+    return 1;
+}
+
+static void job_enqueue(job_t *j)
+{
+    if (smp_cpu_count() <= 1 || !deque_push(&deques[smp_cpu_id()], j)) {
+        job_execute(j);
+        return;
+    }
+    /* Pairs with the idle check in job_worker_loop */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&idle_workers, __ATOMIC_SEQ_CST))
+        smp_wake_others();
+}
+
+/* ── Public API ───────────────────────────────────────────────────────── */
+void job_submit(job_fn_t fn, void *arg, job_counter_t *counter)
+{
+    job_submit_after((void *)0, fn, arg, counter);
+}
+
+void job_submit_after(job_counter_t *dep, job_fn_t fn, void *arg, job_counter_t *counter)
+{
+    counter_add(counter);
+
+    job_t *j = job_alloc();
+    if (!j) {
+        /* Out of records: honour the dependency by waiting for it here */
+        if (dep) job_wait(dep);
+        fn(arg);
+        counter_sub(counter);
+        return;
+    }
+    j->fn      = fn;
+    j->arg     = arg;
+    j->counter = counter;
+    j->next_waiter = (void *)0;
+
+    if (dep) {
+        uint64_t flags = spin_lock_irqsave(&dep->lock);
+        if (__atomic_load_n(&dep->value, __ATOMIC_ACQUIRE) != 0) {
+            j->next_waiter = dep->waiters;
+            dep->waiters = j;
+            spin_unlock_irqrestore(&dep->lock, flags);
+            return;
+        }
+        spin_unlock_irqrestore(&dep->lock, flags);
+    }
+    job_enqueue(j);
+}
+
+int job_done(job_counter_t *counter)
+{
+    uint64_t flags = spin_lock_irqsave(&counter->lock);
+    int done = counter->value == 0;
+    spin_unlock_irqrestore(&counter->lock, flags);
+    return done;
+}
+
+void job_wait(job_counter_t *counter)
+{
+    while (!job_done(counter)) {
+        if (!run_one())
+            cpu_relax();
+    }
+}
+
+typedef struct {
+    job_range_fn_t fn;
+    void          *arg;
+    int            count;
+    int            next;
+} job_range_t;
+
+static void range_worker(void *p)
+{
+    job_range_t *r = (job_range_t *)p;
+    for (;;) {
+        int i = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED);
+        if (i >= r->count) break;
+        r->fn(i, r->arg);
+    }
+}
+
+void job_parallel_for(int count, job_range_fn_t fn, void *arg)
+{
+    if (count <= 0) return;
+
+    /* One helper per other CPU; all of them claim indices from a shared
+     * cursor, so uneven items balance out without per-item jobs.       */
+    job_range_t r = { fn, arg, count, 0 };
+    job_counter_t done = JOB_COUNTER_INIT;
+    int helpers = smp_cpu_count() - 1;
+    if (helpers > count - 1) helpers = count - 1;
+    for (int i = 0; i < helpers; i++)
+        job_submit(range_worker, &r, &done);
+
+    range_worker(&r);
+    job_wait(&done);
+}
+
+void job_worker_loop(void)
+{
+    for (;;) {
+        if (run_one()) continue;
+
+        /* sti;hlt is atomic with respect to interrupts, so a wake-up IPI
+         * sent after the check still breaks the hlt.                    */
+        __atomic_fetch_add(&idle_workers, 1, __ATOMIC_SEQ_CST);
+        __asm__ volatile("cli");
+        if (!has_work())
+            __asm__ volatile("sti; hlt");
+        else
+            __asm__ volatile("sti");
+        __atomic_fetch_sub(&idle_workers, 1, __ATOMIC_SEQ_CST);
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * nextOS - job.h
+ * Work-stealing job scheduler
+ *
+ * Jobs are short, non-blocking functions queued on per-CPU deques.  Idle
+ * CPUs steal from the others; a CPU waiting on a counter runs jobs while
+ * it waits.  With a single CPU online every job runs inline at submit.
+ */
+#ifndef NEXTOS_JOB_H
+#define NEXTOS_JOB_H
+
+#include <stdint.h>
+#include "../arch/x86_64/spinlock.h"
+
+typedef void (*job_fn_t)(void *arg);
+typedef void (*job_range_fn_t)(int index, void *arg);
+
+struct job;
+
+/* Counts outstanding jobs; jobs submitted "after" a counter are held
+ * until it drops to zero.                                           */
+typedef struct {
+    volatile int32_t value;
+    spinlock_t       lock;
+    struct job      *waiters;
+} job_counter_t;
+
+#define JOB_COUNTER_INIT { 0, SPINLOCK_INIT, (void *)0 }
+
+/* Queue fn(arg).  counter (optional) is raised now and lowered when the
+ * job has finished.                                                    */
+void job_submit(job_fn_t fn, void *arg, job_counter_t *counter);
+
+/* As job_submit, but fn only becomes runnable once dep reaches zero */
+void job_submit_after(job_counter_t *dep, job_fn_t fn, void *arg, job_counter_t *counter);
+
+/* Run queued jobs until counter reaches zero.  Completion is observed
+ * under the counter's lock, so once this returns no other CPU still
+ * touches the counter and it may live on the caller's stack.        */
+void job_wait(job_counter_t *counter);
+
+int job_done(job_counter_t *counter);
+
+/* fn(0..count-1, arg) across all CPUs; returns when every call is done */
+void job_parallel_for(int count, job_range_fn_t fn, void *arg);
+
+/* Idle loop of an application processor (called from smp.c, no return) */
+void job_worker_loop(void);
+
+#endif /* NEXTOS_JOB_H */
@@ -0,0 +1,204 @@
+/*
+ * nextOS - kthread.c
+ * Cooperative kernel threads
+ *
+ * A fixed table of threads scheduled round-robin on the BSP.  Sleeping
+ * and waiting threads are simply skipped until their wake time passes or
+ * their event is signalled; when nothing is runnable the CPU halts until
+ * the next timer tick, or spins out the last partial tick before the
+ * nearest deadline so sleeps end on time rather than on a tick edge.
+ */
+#include "kthread.h"
+#include "../drivers/timer.h"
+#include "../mem/heap.h"
+#include "../arch/x86_64/smp.h"
+#include "../arch/x86_64/spinlock.h"
+
+#define KT_READY    0
+#define KT_SLEEPING 1
+#define KT_WAITING  2
+#define KT_DEAD     3
+
+typedef struct {
+    int              used;
+    int              state;
+    uint64_t         rsp;
+    uint8_t         *stack;
+    uint64_t         wake_at;   /* timer_now_ns deadline; 0 = none while waiting */
+    kthread_event_t *event;
+    char             name[16];
+} kthread_t;
+
+extern void kthread_switch(uint64_t *save_rsp, uint64_t load_rsp);
+extern void kthread_start(void);
+
+/* Slot 0 is the main loop, running on the boot stack */
+static kthread_t threads[KTHREAD_MAX] = { { 1, KT_READY, 0, (void *)0, 0, (void *)0, "main" } };
+static int       current = 0;
+
+/* Code shared with jobs may end up here on an AP, which has no thread
+ * table of its own: there the calls degrade to plain spinning.      */
+static int on_bsp(void)
+{
+    return smp_cpu_id() == 0;
+}
+
+static int runnable(const kthread_t *t, uint64_t now)
+{
+    if (!t->used) return 0;
+    switch (t->state) {
+    case KT_READY:    return 1;
+    case KT_SLEEPING: return now >= t->wake_at;
+    case KT_WAITING:  return t->event->signaled || (t->wake_at && now >= t->wake_at);
+    default:          return 0;
+    }
+}
+
+/* Free the stacks of exited threads; never the one we are running on */
+static void reap(void)
+{
+    for (int i = 1; i < KTHREAD_MAX; i++) {
+        if (threads[i].used && threads[i].state == KT_DEAD && i != current) {
+            kfree(threads[i].stack);
+            threads[i].stack = (void *)0;
+            threads[i].used = 0;
+        }
+    }
+}
+
+/* Earliest pending wake-up, or 0 when every blocked thread waits forever */
+static uint64_t next_deadline(void)
+{
+    uint64_t best = 0;
+    for (int i = 0; i < KTHREAD_MAX; i++) {
+        const kthread_t *t = &threads[i];
+        if (!t->used || (t->state != KT_SLEEPING && t->state != KT_WAITING) || !t->wake_at)
+            continue;
+        if (!best || t->wake_at < best) best = t->wake_at;
+    }
+    return best;
+}
+
+static void schedule(void)
+{
+    for (;;) {
+        uint64_t now = timer_now_ns();
+        /* Others first, the current thread last */
+        for (int k = 1; k <= KTHREAD_MAX; k++) {
+            int next = (current + k) % KTHREAD_MAX;
+            if (!runnable(&threads[next], now)) continue;
+            if (next != current) {
+                int prev = current;
+                current = next;
+                kthread_switch(&threads[prev].rsp, threads[next].rsp);
+                reap();
+            }
+            return;
+        }
+        uint64_t deadline = next_deadline();
+        if (deadline && deadline - now <= NS_PER_MS)
+            cpu_relax();
+        else
+            __asm__ volatile("hlt");
+    }
+}
+
+int kthread_create(const char *name, kthread_fn_t fn, void *arg)
+{
+    int id = -1;
+    for (int i = 1; i < KTHREAD_MAX; i++) {
+        if (!threads[i].used) { id = i; break; }
+    }
+    if (id < 0) return -1;
+
+    uint8_t *stack = (uint8_t *)kmalloc(KTHREAD_STACK_SIZE);
+    if (!stack) return -1;
+
+    /* Initial frame popped by kthread_switch: r15, r14, r13, r12, rbx,
+     * rbp, return address.  Returning into kthread_start leaves rsp at
+     * the 16-byte aligned top, so its call sees the ABI alignment.    */
+    uint64_t *sp = (uint64_t *)(((uint64_t)stack + KTHREAD_STACK_SIZE) & ~15ULL);
+    *--sp = (uint64_t)kthread_start;
+    *--sp = 0;                  /* rbp */
+    *--sp = 0;                  /* rbx */
+    *--sp = (uint64_t)fn;       /* r12 */
+    *--sp = (uint64_t)arg;      /* r13 */
+    *--sp = 0;                  /* r14 */
+    *--sp = 0;                  /* r15 */
+
+    kthread_t *t = &threads[id];
+    t->state   = KT_READY;
+    t->rsp     = (uint64_t)sp;
+    t->stack   = stack;
+    t->wake_at = 0;
+    t->event   = (void *)0;
+    int n = 0;
+    for (; name && name[n] && n < (int)sizeof(t->name) - 1; n++) t->name[n] = name[n];
+    t->name[n] = 0;
+    t->used = 1;
+    return id;
+}
+
+void kthread_exit(void)
+{
+    if (current == 0 || !on_bsp()) return;   /* The main loop never exits */
+    threads[current].state = KT_DEAD;
+    schedule();
+}
+
+int kthread_current(void)
+{
+    return current;
+}
+
+void kthread_yield(void)
+{
+    if (on_bsp()) schedule();
+}
+
+void kthread_sleep_until(uint64_t deadline_ns)
+{
+    if (!on_bsp()) {
+        while (timer_now_ns() < deadline_ns) cpu_relax();
+        return;
+    }
+    if (timer_now_ns() >= deadline_ns) {
+        schedule();
+        return;
+    }
+    kthread_t *t = &threads[current];
+    t->wake_at = deadline_ns;
+    t->state = KT_SLEEPING;
+    schedule();
+    t->state = KT_READY;
+}
+
+void kthread_sleep_ms(uint32_t ms)
+{
+    kthread_sleep_until(timer_now_ns() + ms * NS_PER_MS);
+}
+
+int kthread_wait_event(kthread_event_t *ev, uint32_t timeout_ms)
+{
+    if (!on_bsp()) {
+        uint64_t end = timer_now_ns() + timeout_ms * NS_PER_MS;
+        while (!ev->signaled && (!timeout_ms || timer_now_ns() < end)) cpu_relax();
+    }
+    kthread_t *t = &threads[current];
+    if (on_bsp() && !ev->signaled) {
+        t->event   = ev;
+        t->wake_at = timeout_ms ? timer_now_ns() + timeout_ms * NS_PER_MS : 0;
+        t->state   = KT_WAITING;
+        schedule();
+        t->state   = KT_READY;
+        t->event   = (void *)0;
+    }
+    if (!ev->signaled) return 0;
+    ev->signaled = 0;
+    return 1;
+}
+
+void kthread_signal(kthread_event_t *ev)
+{
+    ev->signaled = 1;
+}
@@ -0,0 +1,40 @@
+/*
+ * nextOS - kthread.h
+ * Cooperative kernel threads
+ *
+ * Threads run on the BSP only and switch exclusively at kthread_yield,
+ * the sleep calls and kthread_wait_event, so between those calls a
+ * thread may touch UI and driver state exactly like the main loop does.
+ * The main loop itself is thread 0.
+ */
+#ifndef NEXTOS_KTHREAD_H
+#define NEXTOS_KTHREAD_H
+
+#include <stdint.h>
+
+#define KTHREAD_MAX         8
+#define KTHREAD_STACK_SIZE  (64 * 1024)
+
+typedef void (*kthread_fn_t)(void *arg);
+
+/* Auto-reset event: one kthread_wait_event call consumes a signal */
+typedef struct {
+    volatile int signaled;
+} kthread_event_t;
+
+/* Returns the new thread's id, or -1 if no slot or stack is available */
+int  kthread_create(const char *name, kthread_fn_t fn, void *arg);
+void kthread_exit(void);
+int  kthread_current(void);
+
+/* Let other runnable threads run; returns at once if there are none */
+void kthread_yield(void);
+void kthread_sleep_ms(uint32_t ms);
+void kthread_sleep_until(uint64_t deadline_ns);   /* timer_now_ns() clock */
+
+/* Block until ev is signalled (returns 1) or timeout_ms passes (returns
+ * 0).  A timeout of 0 waits forever.                                  */
+int  kthread_wait_event(kthread_event_t *ev, uint32_t timeout_ms);
+void kthread_signal(kthread_event_t *ev);
+
+#endif /* NEXTOS_KTHREAD_H */
@@ -12,6 +12,9 @@
 #include "../drivers/timer.h"
 #include "../drivers/mouse.h"
 #include "../arch/x86_64/idt.h"
+#include "../arch/x86_64/smp.h"
+#include "../sched/job.h"
+#include "profiler.h"
 
 /* ── Internal state ───────────────────────────────────────────────────── */
 static window_t windows[MAX_WINDOWS];
@@ -39,8 +42,46 @@ static uint8_t  cached_hour = 0;
 static uint8_t  cached_min  = 0;
 static uint64_t clock_last_read = 0;   /* Tick of last CMOS read */
 
+/* timer_now_ns snapshot taken once per frame so every damage pass of the
+ * same frame sees identical animation progress.                        */
+static uint64_t frame_now = 0;
+
+/* ── Damage tracking ──────────────────────────────────────────────────── */
+/* Each frame collects the screen rectangles whose contents changed; only
+ * those are re-rendered and copied to VRAM.  Screen elements remember the
+ * rect and a state signature from the previous frame, and damage both the
+ * old and the new rect whenever either changes.                          */
+#define MAX_DAMAGE_RECTS 16
+
+typedef struct {
+    fb_rect_t rect;
+    uint32_t  sig;
+    int       valid;     /* Element was on screen last frame */
+} damage_track_t;
+
+static fb_rect_t      damage_rects[MAX_DAMAGE_RECTS];
+static int            damage_count = 0;
+/* With BGA page flipping the back page is one frame old, so last frame's
+ * damage is re-rendered along with this frame's to bring it up to date. */
+static fb_rect_t      flip_prev_rects[MAX_DAMAGE_RECTS];
+static int            flip_prev_count = 0;
+static int            damage_full  = 1;   /* First frame repaints everything */
+static damage_track_t win_track[MAX_WINDOWS];
+static damage_track_t taskbar_track;
+static damage_track_t menu_track;
+static damage_track_t hud_track;
+
+/* Cursor bookkeeping: where the arrow was last composited into the
+ * backbuffer, and whether it is still there (not painted over).     */
+#define CURSOR_W 18   /* 16px bitmap + 2px shadow offset */
+#define CURSOR_H 22
+static int cursor_on_screen = 0;
+static int cursor_drawn_x = 0, cursor_drawn_y = 0;
+
 /* Forward declarations */
 static void resize_canvas(window_t *w, int new_w, int new_h);
+static uint32_t sig_mix(uint32_t h, uint32_t v);
+static uint32_t sig_str(uint32_t h, const char *s);
 
 /* ── Theme colour palettes ────────────────────────────────────────────── */
 typedef struct {
@@ -161,12 +202,20 @@ static void draw_gradient_rect(int x, int y, int w, int h,
 static int      start_menu_anim = 0;
 static uint64_t start_menu_anim_start = 0;
 
+/* Time since an animation started; an animation started after this
+ * frame's snapshot has not begun yet rather than wrapped around.     */
+static uint64_t anim_elapsed(uint64_t start)
+{
+    return frame_now > start ? frame_now - start : 0;
+}
+
 /* Ease-out cubic: 1 - (1-t)^3, returns 0..1000 */
-static int ease_out_cubic(uint64_t elapsed_ms, int duration_ms)
+static int ease_out_cubic(uint64_t elapsed_ns, int duration_ms)
 {
-    if (duration_ms <= 0 || elapsed_ms >= (uint64_t)duration_ms) return 1000;
-    if (elapsed_ms == 0) return 0;
-    int t = (int)(elapsed_ms * 1000 / (uint64_t)duration_ms);
+    uint64_t duration_ns = (uint64_t)duration_ms * NS_PER_MS;
+    if (duration_ms <= 0 || elapsed_ns >= duration_ns) return 1000;
+    if (elapsed_ns == 0) return 0;
+    int t = (int)(elapsed_ns * 1000 / duration_ns);
     int inv = 1000 - t;
     int64_t inv3 = (int64_t)inv * inv * inv;
     return (int)(1000 - inv3 / 1000000);
@@ -273,19 +322,11 @@ static void draw_bevel(int x, int y, int w, int h, int raised)
     uint32_t dark  = raised ? 0x404040 : 0xFFFFFF;
 
     /* Top & left highlight */
-    for (int i = x; i < x + w; i++) {
-        fb_putpixel(i, y, rgba_blend(fb_getpixel(i, y), light, 100));
-    }
-    for (int i = y; i < y + h; i++) {
-        fb_putpixel(x, i, rgba_blend(fb_getpixel(x, i), light, 100));
-    }
+    fb_blend_rect(x, y, w, 1, light, 100);
+    fb_blend_rect(x, y, 1, h, light, 100);
     /* Bottom & right shadow */
-    for (int i = x; i < x + w; i++) {
-        fb_putpixel(i, y + h - 1, rgba_blend(fb_getpixel(i, y + h - 1), dark, 100));
-    }
-    for (int i = y; i < y + h; i++) {
-        fb_putpixel(x + w - 1, i, rgba_blend(fb_getpixel(x + w - 1, i), dark, 100));
-    }
+    fb_blend_rect(x, y + h - 1, w, 1, dark, 100);
+    fb_blend_rect(x + w - 1, y, 1, h, dark, 100);
 }
 
 /* ── Glossy highlight (top 40% bright, bottom 60% darker) ─────────── */
@@ -294,10 +335,7 @@ static void draw_gloss(int x, int y, int w, int h)
     int gloss_h = h * 2 / 5;
     for (int row = 0; row < gloss_h; row++) {
         uint8_t alpha = 60 - (uint8_t)(row * 60 / gloss_h);
-        for (int col = 0; col < w; col++) {
-            uint32_t px = fb_getpixel(x + col, y + row);
-            fb_putpixel(x + col, y + row, rgba_blend(px, 0xFFFFFF, alpha));
-        }
+        fb_blend_rect(x, y + row, w, 1, 0xFFFFFF, alpha);
     }
 }
 
@@ -326,17 +364,20 @@ static void draw_titlebar_circle(int cx, int cy, int r, uint32_t color)
     }
 }
 
-static void draw_window(window_t *win)
+/* Compute where a window is drawn this frame, with any running animation
+ * applied.  Returns 0 if the window contributes no pixels at all.        */
+static int window_geometry(window_t *win, int *ox, int *oy, int *ow, int *oh,
+                           uint8_t *alpha)
 {
+    if (!win->active) return 0;
     if (win->minimized && win->anim_type != ANIM_UNMINIMIZE &&
-        win->anim_type != ANIM_MINIMIZE) return;
+        win->anim_type != ANIM_MINIMIZE) return 0;
 
-    const theme_colors_t *tc = &themes[current_theme];
     int x = win->x, y = win->y, w = win->width, h = win->height;
     uint8_t anim_alpha = 255;
 
     if (win->anim_type != ANIM_NONE) {
-        uint64_t elapsed = timer_get_ticks() - win->anim_start;
+        uint64_t elapsed = anim_elapsed(win->anim_start);
         int duration = get_anim_duration(win->anim_type);
         int p = ease_out_cubic(elapsed, duration);
         switch (win->anim_type) {
@@ -347,7 +388,7 @@ static void draw_window(window_t *win)
         case ANIM_CLOSE:
             y = win->y + 10 * p / 1000;
             anim_alpha = (uint8_t)(255 - p * 255 / 1000);
-            if ((int)elapsed >= duration) return;
+            if ((int)elapsed >= duration) return 0;
             break;
         case ANIM_MINIMIZE:
             x = anim_lerp(win->anim_from_x, win->anim_to_x, p);
@@ -357,7 +398,7 @@ static void draw_window(window_t *win)
             if (w < 4) w = 4;
             if (h < 4) h = 4;
             anim_alpha = (uint8_t)(255 - p * 255 / 1000);
-            if ((int)elapsed >= duration) return;
+            if ((int)elapsed >= duration) return 0;
             break;
         case ANIM_UNMINIMIZE:
             x = anim_lerp(win->anim_from_x, win->anim_to_x, p);
@@ -387,29 +428,38 @@ static void draw_window(window_t *win)
         }
     }
 
-    int total_h = h + TITLEBAR_H;
-    framebuffer_t *fb = fb_get();
-    int fw = (int)fb->width, fh = (int)fb->height;
+    *ox = x; *oy = y; *ow = w; *oh = h;
+    *alpha = anim_alpha;
+    return 1;
+}
 
-    /* Save background behind the window region for proper alpha blending */
-    int save_x0 = x - 1, save_y0 = y - 1;
-    int save_w = w + 10, save_h = total_h + 10;
-    if (save_x0 < 0) save_x0 = 0;
-    if (save_y0 < 0) save_y0 = 0;
-    if (save_x0 + save_w > fw) save_w = fw - save_x0;
-    if (save_y0 + save_h > fh) save_h = fh - save_y0;
+/* Screen area touched by a window drawn at (x, y, w, h): the rounded
+ * outline extends 1px left/up, the drop shadow 4px right/down.        */
+static fb_rect_t window_bounds(int x, int y, int w, int h)
+{
+    fb_rect_t r = { x - 1, y - 1, w + 10, h + TITLEBAR_H + 10 };
+    return r;
+}
 
-    uint32_t *bg_save = (void *)0;
-    if (anim_alpha < 255 && save_w > 0 && save_h > 0) {
-        bg_save = (uint32_t *)kmalloc(save_w * save_h * 4);
-        if (bg_save) {
-            for (int r = 0; r < save_h; r++) {
-                for (int c = 0; c < save_w; c++) {
-                    bg_save[r * save_w + c] = fb_getpixel(save_x0 + c, save_y0 + r);
-                }
-            }
-        }
-    }
+/* Intersect [start, start + len) with the clip span and return the
+ * result as offsets relative to start.  Returns 0 if empty.          */
+static int clip_span(int start, int len, int clip_start, int clip_len,
+                     int *lo, int *hi)
+{
+    int a = clip_start - start, b = clip_start + clip_len - start;
+    if (a < 0) a = 0;
+    if (b > len) b = len;
+    *lo = a;
+    *hi = b;
+    return a < b;
+}
+
+/* Window frame: shadow, titlebar, buttons, client fill and outline, for a
+ * window whose top-left corner is (x, y).                                */
+static void draw_decorations(window_t *win, int x, int y, int w, int h, int dimmed)
+{
+    const theme_colors_t *tc = &themes[current_theme];
+    int total_h = h + TITLEBAR_H;
 
     /* Drop shadow */
     draw_shadow(x, y, w, total_h, tc->shadow);
@@ -455,64 +505,271 @@ static void draw_window(window_t *win)
     draw_rounded_rect_outline(x - 1, y - 1, w + 2, total_h + 2,
                               WIN_CORNER_R, tc->border);
 
-    /* Blit client canvas onto the window's client area */
-    if (win->canvas) {
-        int cw = win->width - BORDER_W * 2;
-        int ch = win->height - BORDER_W * 2;
-        int draw_cw = w - BORDER_W * 2;
-        int draw_ch = h - BORDER_W * 2;
-        if (draw_cw > 0 && draw_ch > 0 && cw > 0 && ch > 0) {
-            for (int row = 0; row < draw_ch; row++) {
-                int src_row = row * ch / draw_ch;
-                if (src_row >= ch) src_row = ch - 1;
-                for (int col = 0; col < draw_cw; col++) {
-                    int src_col = col * cw / draw_cw;
-                    if (src_col >= cw) src_col = cw - 1;
-                    fb_putpixel(x + BORDER_W + col, cy + BORDER_W + row,
-                                win->canvas[src_row * cw + src_col]);
+    /* Unfocused windows are dimmed as a whole */
+    if (dimmed)
+        fb_blend_rect(x, y, w, total_h, 0x000000, 60);
+}
+
+/* ── Decoration cache ─────────────────────────────────────────────────── */
+/* Each window's frame is rasterised once into an off-screen surface and
+ * composited as per-row runs: opaque spans are copied, the few pixels
+ * that depend on the desktop behind them (rounded corners, gloss and dim
+ * over the background) are blended, and the canvas area is a hole.  The
+ * frame is rendered over black and over white: pixels that agree are
+ * opaque, and the difference gives the coverage of the rest.           */
+typedef struct {
+    uint16_t x, n;
+    uint16_t blend;      /* Pixels carry their alpha in the top byte */
+} deco_run_t;
+
+typedef struct {
+    uint32_t   *pixels;      /* sw * sh, origin at window (x - 1, y - 1) */
+    deco_run_t *runs;
+    uint32_t   *row_runs;    /* sh + 1 offsets into runs */
+    int         sw, sh;
+    uint32_t    key;
+    int         valid;
+} deco_cache_t;
+
+static deco_cache_t deco_cache[MAX_WINDOWS];
+
+static void deco_free(deco_cache_t *dc)
+{
+    if (dc->pixels)   kfree(dc->pixels);
+    if (dc->runs)     kfree(dc->runs);
+    if (dc->row_runs) kfree(dc->row_runs);
+    dc->pixels   = (void *)0;
+    dc->runs     = (void *)0;
+    dc->row_runs = (void *)0;
+    dc->valid    = 0;
+}
+
+static uint32_t deco_key(window_t *win, int w, int h, int dimmed)
+{
+    uint32_t k = 2166136261u;
+    k = sig_mix(k, (uint32_t)w);
+    k = sig_mix(k, (uint32_t)h);
+    k = sig_mix(k, (uint32_t)current_theme);
+    k = sig_mix(k, (uint32_t)dimmed);
+    k = sig_mix(k, win->canvas != (void *)0);
+    return sig_str(k, win->title);
+}
+
+/* Pixel kinds while building; stored in the scratch surface */
+#define DECO_CLEAR  0
+#define DECO_OPAQUE 1
+#define DECO_BLEND  2
+
+static int deco_build(deco_cache_t *dc, window_t *win, int w, int h, int dimmed)
+{
+    int sw = w + 10, sh = h + TITLEBAR_H + 10;
+    int npx = sw * sh;
+    uint32_t *over_black = (uint32_t *)kmalloc_tagged(npx * 4);
+    uint32_t *over_white = (uint32_t *)kmalloc_tagged(npx * 4);
+    dc->row_runs = (uint32_t *)kmalloc_tagged((sh + 1) * 4);
+    if (!over_black || !over_white || !dc->row_runs) {
+        if (over_black) kfree(over_black);
+        if (over_white) kfree(over_white);
+        deco_free(dc);
+        return 0;
+    }
+
+    fb_set_target(over_black, sw, sh);
+    fb_clear(0x000000);
+    draw_decorations(win, 1, 1, w, h, dimmed);
+    fb_reset_target();
+    fb_set_target(over_white, sw, sh);
+    fb_clear(0xFFFFFF);
+    draw_decorations(win, 1, 1, w, h, dimmed);
+    fb_reset_target();
+
+    /* Canvas area (surface coords) is overdrawn every frame: skip it */
+    int hx0 = 1 + BORDER_W, hy0 = 1 + TITLEBAR_H + BORDER_W;
+    int hx1 = win->canvas ? hx0 + w - BORDER_W * 2 : hx0;
+    int hy1 = hy0 + h - BORDER_W * 2;
+
+    /* Classify: the final pixel goes to over_black, its kind to over_white */
+    int nruns = 0;
+    for (int row = 0; row < sh; row++) {
+        int prev = DECO_CLEAR;
+        for (int col = 0; col < sw; col++) {
+            int i = row * sw + col;
+            uint32_t b = over_black[i], wv = over_white[i];
+            int kind;
+            if (col >= hx0 && col < hx1 && row >= hy0 && row < hy1) {
+                kind = DECO_CLEAR;
+            } else if (b == wv) {
+                kind = DECO_OPAQUE;
+            } else {
+                int diff = ((int)((wv >> 16) & 0xFF) - (int)((b >> 16) & 0xFF) +
+                            (int)((wv >> 8) & 0xFF)  - (int)((b >> 8) & 0xFF) +
+                            (int)(wv & 0xFF)         - (int)(b & 0xFF)) / 3;
+                int a = 255 - diff;
+                if (a <= 0) {
+                    kind = DECO_CLEAR;
+                } else {
+                    uint32_t c = 0;
+                    for (int sh8 = 0; sh8 < 24; sh8 += 8) {
+                        uint32_t v = ((b >> sh8) & 0xFF) * 255 / (uint32_t)a;
+                        c |= (v > 255 ? 255 : v) << sh8;
+                    }
+                    over_black[i] = ((uint32_t)a << 24) | c;
+                    kind = DECO_BLEND;
                 }
             }
+            if (kind != DECO_CLEAR && kind != prev) nruns++;
+            over_white[i] = (uint32_t)kind;
+            prev = kind;
         }
     }
 
-    /* Unfocused window dimming overlay (entire window) */
-    if (!win->focused && win->anim_type != ANIM_CLOSE) {
-        for (int row = 0; row < total_h; row++) {
-            for (int col = 0; col < w; col++) {
-                int px = x + col, py = y + row;
-                uint32_t orig = fb_getpixel(px, py);
-                fb_putpixel(px, py, rgba_blend(orig, 0x000000, 60));
+    dc->runs = (deco_run_t *)kmalloc_tagged((nruns ? nruns : 1) * sizeof(deco_run_t));
+    if (!dc->runs) {
+        kfree(over_black);
+        kfree(over_white);
+        deco_free(dc);
+        return 0;
+    }
+
+    int k = 0;
+    for (int row = 0; row < sh; row++) {
+        dc->row_runs[row] = (uint32_t)k;
+        const uint32_t *kinds = over_white + row * sw;
+        int col = 0;
+        while (col < sw) {
+            int kind = (int)kinds[col];
+            int start = col;
+            while (col < sw && (int)kinds[col] == kind) col++;
+            if (kind == DECO_CLEAR) continue;
+            dc->runs[k].x = (uint16_t)start;
+            dc->runs[k].n = (uint16_t)(col - start);
+            dc->runs[k].blend = kind == DECO_BLEND;
+            k++;
+        }
+    }
+    dc->row_runs[sh] = (uint32_t)k;
+
+    kfree(over_white);
+    dc->pixels = over_black;
+    dc->sw = sw;
+    dc->sh = sh;
+    dc->valid = 1;
+    return 1;
+}
+
+/* Composite a cached frame with its surface origin at (sx, sy) */
+static void deco_draw(const deco_cache_t *dc, int sx, int sy)
+{
+    fb_rect_t clip;
+    fb_get_clip(&clip);
+    int r0, r1;
+    if (!clip_span(sy, dc->sh, clip.y, clip.h, &r0, &r1)) return;
+
+    for (int row = r0; row < r1; row++) {
+        const uint32_t *src = dc->pixels + row * dc->sw;
+        int py = sy + row;
+        for (uint32_t k = dc->row_runs[row]; k < dc->row_runs[row + 1]; k++) {
+            const deco_run_t *run = &dc->runs[k];
+            if (!run->blend) {
+                fb_blit(sx + run->x, py, run->n, 1, src + run->x);
+                continue;
+            }
+            for (int i = 0; i < run->n; i++) {
+                int px = sx + run->x + i;
+                uint32_t v = src[run->x + i];
+                fb_putpixel(px, py, rgba_blend(fb_getpixel(px, py), v & 0xFFFFFF,
+                                               (uint8_t)(v >> 24)));
             }
         }
     }
+}
 
-    /* Animation alpha blend — blend drawn window with saved background */
-    if (anim_alpha < 255 && bg_save) {
-        uint8_t inv = 255 - anim_alpha;
-        for (int r = 0; r < save_h; r++) {
-            for (int c = 0; c < save_w; c++) {
-                int px = save_x0 + c, py = save_y0 + r;
-                uint32_t bg_px = bg_save[r * save_w + c];
-                uint32_t win_px = fb_getpixel(px, py);
-                fb_putpixel(px, py, rgba_blend(win_px, bg_px, inv));
+/* Set while tiles render on several CPUs: caches are then read-only */
+static volatile int render_parallel = 0;
+
+/* Return the window's up-to-date frame cache, building it if needed */
+static deco_cache_t *deco_prepare(window_t *win, int w, int h, int dimmed)
+{
+    deco_cache_t *dc = &deco_cache[win - windows];
+    uint32_t key = deco_key(win, w, h, dimmed);
+    if (!dc->valid || dc->key != key) {
+        if (render_parallel) return (void *)0;
+        deco_free(dc);
+        if (deco_build(dc, win, w, h, dimmed))
+            dc->key = key;
+    }
+    return dc->valid ? dc : (void *)0;
+}
+
+static void draw_window(window_t *win)
+{
+    int x, y, w, h;
+    uint8_t anim_alpha;
+    if (!window_geometry(win, &x, &y, &w, &h, &anim_alpha)) return;
+
+    int total_h = h + TITLEBAR_H;
+    fb_rect_t clip;
+    fb_get_clip(&clip);
+
+    /* Save background behind the window region for proper alpha blending.
+     * Only the part inside the clip rect can change, so only that is kept. */
+    int save_x0 = x - 1, save_y0 = y - 1;
+    int save_w = w + 10, save_h = total_h + 10;
+    if (save_x0 < clip.x) { save_w -= clip.x - save_x0; save_x0 = clip.x; }
+    if (save_y0 < clip.y) { save_h -= clip.y - save_y0; save_y0 = clip.y; }
+    if (save_x0 + save_w > clip.x + clip.w) save_w = clip.x + clip.w - save_x0;
+    if (save_y0 + save_h > clip.y + clip.h) save_h = clip.y + clip.h - save_y0;
+
+    uint32_t *bg_save = (void *)0;
+    if (anim_alpha < 255 && save_w > 0 && save_h > 0) {
+        bg_save = (uint32_t *)kmalloc(save_w * save_h * 4);
+        if (bg_save) {
+            for (int r = 0; r < save_h; r++) {
+                for (int c = 0; c < save_w; c++) {
+                    bg_save[r * save_w + c] = fb_getpixel(save_x0 + c, save_y0 + r);
+                }
             }
         }
+    }
+
+    /* Frame: cached surface when drawn at its real size, else direct */
+    int dimmed = !win->focused && win->anim_type != ANIM_CLOSE;
+    int cached = 0;
+    if (w == win->width && h == win->height) {
+        deco_cache_t *dc = deco_prepare(win, w, h, dimmed);
+        if (dc) {
+            deco_draw(dc, x - 1, y - 1);
+            cached = 1;
+        }
+    }
+    if (!cached)
+        draw_decorations(win, x, y, w, h, dimmed);
+
+    /* Blit client canvas onto the window's client area */
+    int cy = y + TITLEBAR_H;
+    if (win->canvas) {
+        /* 1:1 unless an animation is scaling the window */
+        fb_blit_scaled(x + BORDER_W, cy + BORDER_W, w - BORDER_W * 2, h - BORDER_W * 2,
+                       win->canvas, win->width - BORDER_W * 2, win->height - BORDER_W * 2);
+    }
+
+    /* Unfocused dimming: the frame has it baked in, the canvas does not */
+    if (dimmed && win->canvas)
+        fb_blend_rect(x + BORDER_W, cy + BORDER_W, w - BORDER_W * 2, h - BORDER_W * 2,
+                      0x000000, 60);
+
+    /* Animation alpha blend — blend drawn window with saved background */
+    if (anim_alpha < 255 && bg_save) {
+        fb_blend_blit(save_x0, save_y0, save_w, save_h, bg_save, 255 - anim_alpha);
         kfree(bg_save);
     } else if (anim_alpha < 255) {
         /* Fallback if allocation failed — blend toward black */
-        for (int row = -1; row < total_h + 5; row++) {
-            for (int col = -1; col < w + 5; col++) {
-                int px = x + col, py = y + row;
-                if (px < 0 || py < 0 || px >= fw || py >= fh) continue;
-                uint32_t cur = fb_getpixel(px, py);
-                fb_putpixel(px, py, rgba_blend(cur, 0x000000, 255 - anim_alpha));
-            }
-        }
+        fb_blend_rect(x - 1, y - 1, w + 6, total_h + 6, 0x000000, 255 - anim_alpha);
     }
 }
 
 /* ── Desktop wallpaper (gradient + subtle texture) ────────────────────── */
-void desktop_draw_wallpaper(void)
+static void wallpaper_prepare(void)
 {
     const theme_colors_t *tc = &themes[current_theme];
     framebuffer_t *f = fb_get();
@@ -526,7 +783,7 @@ void desktop_draw_wallpaper(void)
             wallpaper_w = 0;
             wallpaper_h = 0;
         }
-        wallpaper_cache = (uint32_t *)kmalloc(f->width * f->height * 4);
+        wallpaper_cache = (uint32_t *)kmalloc_tagged(f->width * f->height * 4);
         if (wallpaper_cache) {
             wallpaper_w = f->width;
             wallpaper_h = f->height;
@@ -549,6 +806,15 @@ void desktop_draw_wallpaper(void)
         wallpaper_theme = current_theme;
         wallpaper_dirty = 0;
     }
+}
+
+void desktop_draw_wallpaper(void)
+{
+    const theme_colors_t *tc = &themes[current_theme];
+    framebuffer_t *f = fb_get();
+
+    if (!render_parallel)
+        wallpaper_prepare();
 
     /* Fast blit cached wallpaper */
     if (wallpaper_cache) {
@@ -780,15 +1046,6 @@ static uint64_t last_icon_click_tick = 0;
 static int    last_icon_click_idx = -1;
 #define DBLCLICK_MS 500
 
-static void draw_desktop_icons(void)
-{
-    for (int i = 0; i < DESKTOP_ICON_COUNT; i++) {
-        int x = ICON_START_X;
-        int y = ICON_START_Y + i * (ICON_H + ICON_LABEL_GAP);
-        draw_desktop_icon(x, y, &desktop_icons[i], i == selected_icon);
-    }
-}
-
 /* ── Taskbar ──────────────────────────────────────────────────────────── */
 #define TASKBAR_H 40
 
@@ -802,52 +1059,70 @@ static const char *start_menu_labels[START_MENU_ITEMS] = {
     "About nextOS", "Restart", "Shutdown"
 };
 
-static void draw_start_menu(void)
+/* Height of the start menu panel (items + padding + About separator) */
+#define START_MENU_SEP_H 6
+#define START_MENU_H (START_MENU_ITEMS * START_MENU_ITEM_H + 8 + START_MENU_SEP_H)
+
+/* Compute the start menu's animated position and opacity for this frame.
+ * Returns 0 if the menu is not on screen.                                */
+static int start_menu_geometry(int *omy, uint8_t *oalpha)
 {
-    if (!start_menu_open) return;
+    if (!start_menu_open) return 0;
     framebuffer_t *f = fb_get();
-    const theme_colors_t *tc = &themes[current_theme];
-
-    /* Extra space for separator between item 2 and item 3 */
-    int separator_h = 6;
-    int mh = START_MENU_ITEMS * START_MENU_ITEM_H + 8 + separator_h;
-    int mx = 4;
-    int my_base = (int)f->height - TASKBAR_H - mh;
+    int my_base = (int)f->height - TASKBAR_H - START_MENU_H;
 
     /* Animation offset and alpha */
     int y_offset = 0;
     uint8_t sm_alpha = 255;
 
     if (start_menu_anim == 1) {
-        uint64_t elapsed = timer_get_ticks() - start_menu_anim_start;
+        uint64_t elapsed = anim_elapsed(start_menu_anim_start);
         int p = ease_out_cubic(elapsed, START_MENU_ANIM_MS);
         y_offset = 20 - 20 * p / 1000;
         sm_alpha = (uint8_t)(p * 255 / 1000);
-        if ((int)elapsed >= START_MENU_ANIM_MS)
-            start_menu_anim = 0;
     } else if (start_menu_anim == 2) {
-        uint64_t elapsed = timer_get_ticks() - start_menu_anim_start;
+        uint64_t elapsed = anim_elapsed(start_menu_anim_start);
         int p = ease_out_cubic(elapsed, START_MENU_ANIM_MS);
         y_offset = 20 * p / 1000;
         sm_alpha = (uint8_t)(255 - p * 255 / 1000);
-        if ((int)elapsed >= START_MENU_ANIM_MS) {
-            start_menu_open = 0;
-            start_menu_anim = 0;
-            return;
-        }
     }
 
-    int my = my_base + y_offset;
+    *omy = my_base + y_offset;
+    *oalpha = sm_alpha;
+    return 1;
+}
 
-    /* Save background behind menu for proper alpha blending */
-    framebuffer_t *fb_ptr = fb_get();
-    int fw = (int)fb_ptr->width, fh = (int)fb_ptr->height;
+/* Retire a finished open/close animation (once per frame, before drawing) */
+static void start_menu_finish_anim(void)
+{
+    if (start_menu_anim == 0) return;
+    if (anim_elapsed(start_menu_anim_start) < START_MENU_ANIM_MS * NS_PER_MS) return;
+    if (start_menu_anim == 2)
+        start_menu_open = 0;
+    start_menu_anim = 0;
+}
+
+static void draw_start_menu(void)
+{
+    const theme_colors_t *tc = &themes[current_theme];
+    int my;
+    uint8_t sm_alpha;
+    if (!start_menu_geometry(&my, &sm_alpha)) return;
+
+    int separator_h = START_MENU_SEP_H;
+    int mh = START_MENU_H;
+    int mx = 4;
+
+    /* Save background behind menu for proper alpha blending; as with
+     * windows, only the part inside the clip rect is needed.          */
+    fb_rect_t clip;
+    fb_get_clip(&clip);
     int sm_save_x0 = mx - 1, sm_save_y0 = my;
     int sm_save_w = START_MENU_W + 6, sm_save_h = mh + 5;
-    if (sm_save_x0 < 0) sm_save_x0 = 0;
-    if (sm_save_y0 < 0) sm_save_y0 = 0;
-    if (sm_save_x0 + sm_save_w > fw) sm_save_w = fw - sm_save_x0;
-    if (sm_save_y0 + sm_save_h > fh) sm_save_h = fh - sm_save_y0;
+    if (sm_save_x0 < clip.x) { sm_save_w -= clip.x - sm_save_x0; sm_save_x0 = clip.x; }
+    if (sm_save_y0 < clip.y) { sm_save_h -= clip.y - sm_save_y0; sm_save_y0 = clip.y; }
+    if (sm_save_x0 + sm_save_w > clip.x + clip.w) sm_save_w = clip.x + clip.w - sm_save_x0;
+    if (sm_save_y0 + sm_save_h > clip.y + clip.h) sm_save_h = clip.y + clip.h - sm_save_y0;
 
     uint32_t *sm_bg_save = (void *)0;
     if (sm_alpha < 255 && sm_save_w > 0 && sm_save_h > 0) {
@@ -894,25 +1169,48 @@ static void draw_start_menu(void)
 
     /* Fade overlay for animation — blend with saved background */
     if (sm_alpha < 255 && sm_bg_save) {
-        uint8_t inv = 255 - sm_alpha;
-        for (int r = 0; r < sm_save_h; r++) {
-            for (int c = 0; c < sm_save_w; c++) {
-                int px = sm_save_x0 + c, py = sm_save_y0 + r;
-                uint32_t bg_px = sm_bg_save[r * sm_save_w + c];
-                uint32_t win_px = fb_getpixel(px, py);
-                fb_putpixel(px, py, rgba_blend(win_px, bg_px, inv));
-            }
-        }
+        fb_blend_blit(sm_save_x0, sm_save_y0, sm_save_w, sm_save_h, sm_bg_save, 255 - sm_alpha);
         kfree(sm_bg_save);
     } else if (sm_alpha < 255) {
         /* Fallback */
-        for (int row = 0; row < mh + 5; row++) {
-            for (int col = -1; col < START_MENU_W + 5; col++) {
-                int px = mx + col, py = my + row;
-                if (px < 0 || py < 0 || px >= fw || py >= fh) continue;
-                uint32_t cur = fb_getpixel(px, py);
-                fb_putpixel(px, py, rgba_blend(cur, 0x000000, 255 - sm_alpha));
+        fb_blend_rect(mx - 1, my, START_MENU_W + 6, mh + 5, 0x000000, 255 - sm_alpha);
+    }
+}
+
+/* ── Taskbar clock (CMOS RTC) ─────────────────────────────────────────── */
+static void clock_update(void)
+{
+    /* Re-read CMOS only once per second (1000 ticks at 1kHz) */
+    uint64_t now = timer_get_ticks();
+    if (now - clock_last_read >= 1000) {
+        clock_last_read = now;
+        /* Wait for RTC update-in-progress (UIP) to clear */
+        outb(0x70, 0x0A);
+        if (!(inb(0x71) & 0x80)) {
+            outb(0x70, 0x0B); uint8_t regb = inb(0x71);
+            outb(0x70, 0x04); uint8_t hour = inb(0x71);
+            outb(0x70, 0x02); uint8_t min  = inb(0x71);
+            int is_pm = 0;
+            /* Handle 12-hour mode: strip PM bit before BCD conversion */
+            if (!(regb & 0x02)) {
+                is_pm = (hour & 0x80) ? 1 : 0;
+                hour &= 0x7F;
+            }
+            if (!(regb & 0x04)) {
+                hour = (hour >> 4) * 10 + (hour & 0x0F);
+                min  = (min >> 4) * 10 + (min & 0x0F);
+            }
+            /* Convert 12-hour to 24-hour */
+            if (!(regb & 0x02)) {
+                if (hour == 12) hour = 0;
+                if (is_pm) hour += 12;
             }
+            /* Apply UTC offset */
+            int h = (int)hour + clock_utc_offset;
+            if (h < 0) h += 24;
+            if (h >= 24) h -= 24;
+            cached_hour = (uint8_t)h;
+            cached_min  = (min <= 59) ? min : 0;
         }
     }
 }
@@ -965,40 +1263,6 @@ void desktop_draw_taskbar(void)
 
     /* Clock on the right side of the taskbar (CMOS RTC) */
     {
-        /* Re-read CMOS only once per second (1000 ticks at 1kHz) */
-        uint64_t now = timer_get_ticks();
-        if (now - clock_last_read >= 1000) {
-            clock_last_read = now;
-            /* Wait for RTC update-in-progress (UIP) to clear */
-            outb(0x70, 0x0A);
-            if (!(inb(0x71) & 0x80)) {
-                outb(0x70, 0x0B); uint8_t regb = inb(0x71);
-                outb(0x70, 0x04); uint8_t hour = inb(0x71);
-                outb(0x70, 0x02); uint8_t min  = inb(0x71);
-                int is_pm = 0;
-                /* Handle 12-hour mode: strip PM bit before BCD conversion */
-                if (!(regb & 0x02)) {
-                    is_pm = (hour & 0x80) ? 1 : 0;
-                    hour &= 0x7F;
-                }
-                if (!(regb & 0x04)) {
-                    hour = (hour >> 4) * 10 + (hour & 0x0F);
-                    min  = (min >> 4) * 10 + (min & 0x0F);
-                }
-                /* Convert 12-hour to 24-hour */
-                if (!(regb & 0x02)) {
-                    if (hour == 12) hour = 0;
-                    if (is_pm) hour += 12;
-                }
-                /* Apply UTC offset */
-                int h = (int)hour + clock_utc_offset;
-                if (h < 0) h += 24;
-                if (h >= 24) h -= 24;
-                cached_hour = (uint8_t)h;
-                cached_min  = (min <= 59) ? min : 0;
-            }
-        }
-
         char time_str[6];
         time_str[0] = '0' + cached_hour / 10;
         time_str[1] = '0' + cached_hour % 10;
@@ -1149,7 +1413,13 @@ window_t *compositor_create_window(const char *title, int x, int y, int w, int h
             windows[i].orig_h = h;
             windows[i].close_hover = 0;
             windows[i].anim_type = ANIM_OPEN;
-            windows[i].anim_start = timer_get_ticks();
+            windows[i].anim_start = timer_now_ns();
+            windows[i].canvas_valid = 0;
+            windows[i].canvas_dirty.x = 0;
+            windows[i].canvas_dirty.y = 0;
+            windows[i].canvas_dirty.w = w - BORDER_W * 2;
+            windows[i].canvas_dirty.h = h - BORDER_W * 2;
+            windows[i].repaint_at = 0;
             windows[i].on_paint = (void *)0;
             windows[i].on_key   = (void *)0;
             windows[i].on_mouse = (void *)0;
@@ -1158,7 +1428,7 @@ window_t *compositor_create_window(const char *title, int x, int y, int w, int h
 
             int cw = w - BORDER_W * 2;
             int ch = h - BORDER_W * 2;
-            windows[i].canvas = (uint32_t *)kmalloc(cw * ch * 4);
+            windows[i].canvas = (uint32_t *)kmalloc_tagged(cw * ch * 4);
             if (windows[i].canvas) {
                 for (int p = 0; p < cw * ch; p++)
                     windows[i].canvas[p] = 0xF0F0F0;
@@ -1187,11 +1457,486 @@ void compositor_destroy_window(window_t *win)
     win->on_close = (void *)0;
     win->focused  = 0;
     win->anim_type  = ANIM_CLOSE;
-    win->anim_start = timer_get_ticks();
+    win->anim_start = timer_now_ns();
+}
+
+/* ── Damage helpers ───────────────────────────────────────────────────── */
+static int rect_contains(const fb_rect_t *outer, const fb_rect_t *inner)
+{
+    return inner->x >= outer->x && inner->y >= outer->y &&
+           inner->x + inner->w <= outer->x + outer->w &&
+           inner->y + inner->h <= outer->y + outer->h;
+}
+
+static int rect_intersects(const fb_rect_t *a, const fb_rect_t *b)
+{
+    return a->x < b->x + b->w && b->x < a->x + a->w &&
+           a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+static fb_rect_t rect_union(const fb_rect_t *a, const fb_rect_t *b)
+{
+    int x0 = a->x < b->x ? a->x : b->x;
+    int y0 = a->y < b->y ? a->y : b->y;
+    int x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    int y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+    fb_rect_t r = { x0, y0, x1 - x0, y1 - y0 };
+    return r;
+}
+
+static uint64_t rect_area(const fb_rect_t *r)
+{
+    return (uint64_t)r->w * (uint64_t)r->h;
+}
+
+static uint32_t sig_mix(uint32_t h, uint32_t v)
+{
+    /* FNV-1a over the four bytes of v */
+    for (int i = 0; i < 4; i++) {
+        h ^= (v >> (i * 8)) & 0xFF;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t sig_str(uint32_t h, const char *s)
+{
+    while (*s) h = sig_mix(h, (uint8_t)*s++);
+    return h;
+}
+
+void compositor_damage(int x, int y, int w, int h)
+{
+    if (damage_full) return;
+
+    framebuffer_t *f = fb_get();
+    fb_rect_t r = { x, y, w, h };
+    if (r.x < 0) { r.w += r.x; r.x = 0; }
+    if (r.y < 0) { r.h += r.y; r.y = 0; }
+    if (r.x + r.w > (int)f->width)  r.w = (int)f->width - r.x;
+    if (r.y + r.h > (int)f->height) r.h = (int)f->height - r.y;
+    if (r.w <= 0 || r.h <= 0) return;
+
+    for (int i = 0; i < damage_count; i++)
+        if (rect_contains(&damage_rects[i], &r)) return;
+    for (int i = damage_count - 1; i >= 0; i--)
+        if (rect_contains(&r, &damage_rects[i]))
+            damage_rects[i] = damage_rects[--damage_count];
+
+    if (damage_count < MAX_DAMAGE_RECTS) {
+        damage_rects[damage_count++] = r;
+        return;
+    }
+
+    /* List full: fold into the rect whose bounding box grows the least */
+    int best = 0;
+    uint64_t best_growth = (uint64_t)-1;
+    for (int i = 0; i < damage_count; i++) {
+        fb_rect_t u = rect_union(&damage_rects[i], &r);
+        uint64_t growth = rect_area(&u) - rect_area(&damage_rects[i]);
+        if (growth < best_growth) { best_growth = growth; best = i; }
+    }
+    damage_rects[best] = rect_union(&damage_rects[best], &r);
+}
+
+void compositor_damage_all(void)
+{
+    damage_full = 1;
+}
+
+static void damage_rect(const fb_rect_t *r)
+{
+    compositor_damage(r->x, r->y, r->w, r->h);
+}
+
+/* ── Canvas invalidation ──────────────────────────────────────────────── */
+void compositor_invalidate_window(window_t *win, const fb_rect_t *rect)
+{
+    if (!win || !win->active) return;
+    fb_rect_t r = { 0, 0, win->width - BORDER_W * 2, win->height - BORDER_W * 2 };
+    if (rect) {
+        int x1 = rect->x + rect->w, y1 = rect->y + rect->h;
+        if (rect->x > r.x) r.x = rect->x;
+        if (rect->y > r.y) r.y = rect->y;
+        if (x1 < r.w) r.w = x1;
+        if (y1 < r.h) r.h = y1;
+        r.w -= r.x;
+        r.h -= r.y;
+        if (r.w <= 0 || r.h <= 0) return;
+    }
+    if (win->canvas_valid) {
+        win->canvas_dirty = r;
+        win->canvas_valid = 0;
+    } else {
+        win->canvas_dirty = rect_union(&win->canvas_dirty, &r);
+    }
+}
+
+void compositor_schedule_repaint(window_t *win, uint32_t ms)
+{
+    if (!win || !win->active) return;
+    uint64_t at = timer_now_ns() + ms * NS_PER_MS;
+    if (!win->repaint_at || at < win->repaint_at)
+        win->repaint_at = at;
+}
+
+/* Run on_paint for a window whose canvas was invalidated and damage the
+ * part of the screen showing the repainted canvas area.                */
+static void repaint_window(window_t *win)
+{
+    if (win->repaint_at && frame_now >= win->repaint_at) {
+        win->repaint_at = 0;
+        compositor_invalidate_window(win, (void *)0);
+    }
+    if (win->canvas_valid) return;
+
+    /* Mark valid first so invalidations made by on_paint itself stick */
+    fb_rect_t dirty = win->canvas_dirty;
+    win->canvas_valid = 1;
+    win->on_paint(win);
+
+    int x, y, w, h;
+    uint8_t alpha;
+    if (!window_geometry(win, &x, &y, &w, &h, &alpha)) return;
+    int sx = x + BORDER_W, sy = y + TITLEBAR_H + BORDER_W;
+    if (w == win->width && h == win->height)
+        compositor_damage(sx + dirty.x, sy + dirty.y, dirty.w, dirty.h);
+    else    /* Scaled during an animation: the whole client area moves */
+        compositor_damage(sx, sy, w - BORDER_W * 2, h - BORDER_W * 2);
+}
+
+/* Compare an element against last frame and damage what changed */
+static void damage_track_update(damage_track_t *t, int visible,
+                                fb_rect_t rect, uint32_t sig)
+{
+    int changed = !t->valid || !visible || t->sig != sig ||
+                  t->rect.x != rect.x || t->rect.y != rect.y ||
+                  t->rect.w != rect.w || t->rect.h != rect.h;
+    if (changed) {
+        if (t->valid) damage_rect(&t->rect);
+        if (visible)  damage_rect(&rect);
+    }
+    t->valid = visible;
+    t->rect  = rect;
+    t->sig   = sig;
+}
+
+static fb_rect_t icon_bounds(int i)
+{
+    int x = ICON_START_X;
+    int y = ICON_START_Y + i * (ICON_H + ICON_LABEL_GAP);
+    /* Selection box extends 4px out; shadow/label reach below the icon */
+    fb_rect_t r = { x - 4, y - 4, ICON_W + 8, ICON_H + 25 };
+    return r;
+}
+
+static fb_rect_t start_menu_bounds(int my)
+{
+    fb_rect_t r = { 3, my, START_MENU_W + 6, START_MENU_H + 5 };
+    return r;
+}
+
+static fb_rect_t cursor_bounds(int x, int y)
+{
+    fb_rect_t r = { x, y, CURSOR_W, CURSOR_H };
+    return r;
+}
+
+/* ── Performance HUD ──────────────────────────────────────────────────── */
+/* Profiler summary in the top-right corner; the text is refreshed a few
+ * times a second so the overlay does not dominate what it measures.    */
+#define HUD_REFRESH_MS 250
+#define HUD_PAD        6
+
+static int      hud_visible = 0;
+static char     hud_text[1024];
+static uint64_t hud_refresh_at = 0;
+
+void compositor_toggle_hud(void)
+{
+    hud_visible = !hud_visible;
+    hud_refresh_at = 0;
+}
+
+static fb_rect_t hud_bounds(void)
+{
+    int lines = 0, cols = 0, col = 0;
+    for (const char *p = hud_text; *p; p++) {
+        if (*p == '\n') { lines++; col = 0; continue; }
+        if (++col > cols) cols = col;
+    }
+    int w = cols * 8 + HUD_PAD * 2;
+    int h = lines * 16 + HUD_PAD * 2;
+    fb_rect_t r = { (int)fb_get()->width - w - 8, 8, w, h };
+    return r;
+}
+
+static void draw_hud(void)
+{
+    fb_rect_t r = hud_track.rect;
+    fb_blend_rect(r.x, r.y, r.w, r.h, 0x101010, 200);
+    fb_draw_rect(r.x, r.y, r.w, r.h, 0x606060);
+
+    char line[128];
+    int y = r.y + HUD_PAD;
+    const char *p = hud_text;
+    while (*p) {
+        int n = 0;
+        while (*p && *p != '\n') {
+            if (n < (int)sizeof(line) - 1) line[n++] = *p;
+            p++;
+        }
+        line[n] = 0;
+        if (*p) p++;
+        fb_draw_string(r.x + HUD_PAD, y, line, 0x80FF80, 0x00000000);
+        y += 16;
+    }
+}
+
+/* Collect this frame's damage from every screen element */
+static void compute_damage(void)
+{
+    framebuffer_t *f = fb_get();
+
+    /* Wallpaper rebuild (theme or resolution change) repaints everything */
+    if (wallpaper_dirty || wallpaper_theme != current_theme ||
+        wallpaper_w != f->width || wallpaper_h != f->height)
+        damage_full = 1;
+
+    /* Windows: geometry, focus, animation and title changes */
+    for (int i = 0; i < MAX_WINDOWS; i++) {
+        window_t *win = &windows[i];
+        int x = 0, y = 0, w = 0, h = 0;
+        uint8_t alpha = 255;
+        int visible = window_geometry(win, &x, &y, &w, &h, &alpha);
+        uint32_t sig = 2166136261u;
+        if (visible) {
+            sig = sig_mix(sig, (uint32_t)win->focused);
+            sig = sig_mix(sig, (uint32_t)win->anim_type);
+            sig = sig_mix(sig, alpha);
+            sig = sig_mix(sig, (uint32_t)current_theme);
+            sig = sig_str(sig, win->title);
+        }
+        damage_track_update(&win_track[i], visible, window_bounds(x, y, w, h), sig);
+    }
+
+    /* Desktop icons: only the selection highlight changes */
+    static int prev_selected_icon = -1;
+    if (selected_icon != prev_selected_icon) {
+        if (prev_selected_icon >= 0) {
+            fb_rect_t r = icon_bounds(prev_selected_icon);
+            damage_rect(&r);
+        }
+        if (selected_icon >= 0) {
+            fb_rect_t r = icon_bounds(selected_icon);
+            damage_rect(&r);
+        }
+        prev_selected_icon = selected_icon;
+    }
+
+    /* Taskbar: clock, window buttons and theme */
+    {
+        uint32_t sig = 2166136261u;
+        sig = sig_mix(sig, (uint32_t)current_theme);
+        sig = sig_mix(sig, ((uint32_t)cached_hour << 8) | cached_min);
+        for (int i = 0; i < MAX_WINDOWS; i++) {
+            if (!windows[i].active) continue;
+            sig = sig_mix(sig, (uint32_t)i | ((uint32_t)windows[i].focused << 8));
+            sig = sig_str(sig, windows[i].title);
+        }
+        fb_rect_t r = { 0, (int)f->height - TASKBAR_H, (int)f->width, TASKBAR_H };
+        damage_track_update(&taskbar_track, 1, r, sig);
+    }
+
+    /* Start menu: open/close and animation progress */
+    {
+        int my = 0;
+        uint8_t alpha = 255;
+        int visible = start_menu_geometry(&my, &alpha);
+        uint32_t sig = sig_mix(sig_mix(2166136261u, alpha), (uint32_t)current_theme);
+        damage_track_update(&menu_track, visible, start_menu_bounds(my), sig);
+    }
+
+    /* Performance HUD: only its text changes */
+    damage_track_update(&hud_track, hud_visible, hud_bounds(),
+                        sig_str(2166136261u, hud_text));
+}
+
+/* Render every layer of the scene, restricted to one screen rectangle */
+static void render_region(const fb_rect_t *r)
+{
+    fb_set_clip(r->x, r->y, r->w, r->h);
+
+    /* Draw desktop */
+    uint64_t t = prof_now();
+    desktop_draw_wallpaper();
+    prof_stage(PROF_WALLPAPER, t);
+
+    /* Draw desktop icons */
+    t = prof_now();
+    for (int i = 0; i < DESKTOP_ICON_COUNT; i++) {
+        fb_rect_t ib = icon_bounds(i);
+        if (!rect_intersects(&ib, r)) continue;
+        draw_desktop_icon(ICON_START_X, ICON_START_Y + i * (ICON_H + ICON_LABEL_GAP),
+                          &desktop_icons[i], i == selected_icon);
+    }
+    prof_stage(PROF_ICONS, t);
+
+    /* Draw windows (back to front), focused window on top */
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < MAX_WINDOWS; i++) {
+            if (!windows[i].active || windows[i].focused != pass) continue;
+            if (!win_track[i].valid || !rect_intersects(&win_track[i].rect, r))
+                continue;
+            t = prof_now();
+            draw_window(&windows[i]);
+            prof_window(i, 0, t);
+        }
+    }
+
+    /* Taskbar on top of everything */
+    if (rect_intersects(&taskbar_track.rect, r)) {
+        t = prof_now();
+        desktop_draw_taskbar();
+        prof_stage(PROF_TASKBAR, t);
+    }
+
+    /* Start menu above taskbar */
+    if (menu_track.valid && rect_intersects(&menu_track.rect, r)) {
+        t = prof_now();
+        draw_start_menu();
+        prof_stage(PROF_START_MENU, t);
+    }
+
+    /* Profiler HUD above everything but the cursor */
+    if (hud_track.valid && rect_intersects(&hud_track.rect, r)) {
+        t = prof_now();
+        draw_hud();
+        prof_stage(PROF_HUD, t);
+    }
+
+    fb_reset_clip();
+}
+
+/* ── Tile-parallel rendering ──────────────────────────────────────────
+ * Large damage is cut into disjoint tiles rendered on all CPUs.  Tiles
+ * must not overlap: blends read back what is under them, so two CPUs
+ * painting the same pixel would race.  Caches that are built lazily
+ * while drawing (wallpaper, window frames) are prepared up front.     */
+#define PAR_MIN_AREA   (64 * 1024)   /* Below this, dispatch costs more */
+#define PAR_TILE_W     256
+#define PAR_TILE_H     64
+#define PAR_MAX_RECTS  128
+#define PAR_MAX_TILES  512
+
+static fb_rect_t par_rects[PAR_MAX_RECTS];
+static int       par_rect_count;
+static fb_rect_t par_pieces[2][PAR_MAX_RECTS];
+static fb_rect_t par_tiles[PAR_MAX_TILES];
+static int       par_tile_count;
+
+/* a minus b as up to four bands (top, bottom, left, right) */
+static int rect_subtract(const fb_rect_t *a, const fb_rect_t *b, fb_rect_t out[4])
+{
+    if (!rect_intersects(a, b)) { out[0] = *a; return 1; }
+    int n = 0;
+    int ax1 = a->x + a->w, ay1 = a->y + a->h;
+    int bx1 = b->x + b->w, by1 = b->y + b->h;
+    int y0 = a->y > b->y ? a->y : b->y;
+    int y1 = ay1 < by1 ? ay1 : by1;
+    if (b->y > a->y) { fb_rect_t r = { a->x, a->y, a->w, b->y - a->y }; out[n++] = r; }
+    if (by1 < ay1)   { fb_rect_t r = { a->x, by1, a->w, ay1 - by1 };    out[n++] = r; }
+    if (b->x > a->x) { fb_rect_t r = { a->x, y0, b->x - a->x, y1 - y0 }; out[n++] = r; }
+    if (bx1 < ax1)   { fb_rect_t r = { bx1, y0, ax1 - bx1, y1 - y0 };    out[n++] = r; }
+    return n;
+}
+
+/* Add the part of r not yet covered by par_rects; 0 if out of room */
+static int disjoint_add(const fb_rect_t *r)
+{
+    int cur = 0, n = 1;
+    par_pieces[0][0] = *r;
+    for (int i = 0; i < par_rect_count && n > 0; i++) {
+        int m = 0;
+        for (int p = 0; p < n; p++) {
+            fb_rect_t out[4];
+            int k = rect_subtract(&par_pieces[cur][p], &par_rects[i], out);
+            if (m + k > PAR_MAX_RECTS) return 0;
+            for (int j = 0; j < k; j++) par_pieces[cur ^ 1][m++] = out[j];
+        }
+        cur ^= 1;
+        n = m;
+    }
+    if (par_rect_count + n > PAR_MAX_RECTS) return 0;
+    for (int p = 0; p < n; p++) par_rects[par_rect_count++] = par_pieces[cur][p];
+    return 1;
+}
+
+static int build_tiles(const fb_rect_t *rects, int count)
+{
+    par_rect_count = 0;
+    par_tile_count = 0;
+    for (int i = 0; i < count; i++)
+        if (!disjoint_add(&rects[i])) return 0;
+
+    for (int i = 0; i < par_rect_count; i++) {
+        const fb_rect_t *r = &par_rects[i];
+        for (int ty = r->y; ty < r->y + r->h; ty += PAR_TILE_H) {
+            for (int tx = r->x; tx < r->x + r->w; tx += PAR_TILE_W) {
+                if (par_tile_count >= PAR_MAX_TILES) return 0;
+                fb_rect_t *t = &par_tiles[par_tile_count++];
+                t->x = tx;
+                t->y = ty;
+                t->w = r->x + r->w - tx < PAR_TILE_W ? r->x + r->w - tx : PAR_TILE_W;
+                t->h = r->y + r->h - ty < PAR_TILE_H ? r->y + r->h - ty : PAR_TILE_H;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Build every cache render_region could otherwise create mid-draw */
+static void prepare_scene(void)
+{
+    wallpaper_prepare();
+    for (int i = 0; i < MAX_WINDOWS; i++) {
+        window_t *win = &windows[i];
+        int x, y, w, h;
+        uint8_t alpha;
+        if (!win->active || !window_geometry(win, &x, &y, &w, &h, &alpha)) continue;
+        if (w == win->width && h == win->height)
+            deco_prepare(win, w, h, !win->focused && win->anim_type != ANIM_CLOSE);
+    }
+}
+
+static void render_tile_job(int index, void *arg)
+{
+    (void)arg;
+    render_region(&par_tiles[index]);
+}
+
+static void render_regions(const fb_rect_t *rects, int count)
+{
+    uint64_t area = 0;
+    for (int i = 0; i < count; i++)
+        area += rect_area(&rects[i]);
+
+    if (smp_cpu_count() > 1 && area >= PAR_MIN_AREA && build_tiles(rects, count)) {
+        prepare_scene();
+        render_parallel = 1;
+        job_parallel_for(par_tile_count, render_tile_job, (void *)0);
+        render_parallel = 0;
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        render_region(&rects[i]);
 }
 
 void compositor_render_frame(void)
 {
+    prof_frame_begin();
+
     /* Smooth scroll: release pixels gradually from accumulator */
     if (smooth_scroll_accum > 0) {
         int step = smooth_scroll_accum * 3 / 10;
@@ -1209,12 +1954,14 @@ void compositor_render_frame(void)
         smooth_scroll_output = 0;
     }
 
+    frame_now = timer_now_ns();
+
     /* Finalize completed animations */
     for (int i = 0; i < MAX_WINDOWS; i++) {
         if (!windows[i].active || windows[i].anim_type == ANIM_NONE) continue;
-        uint64_t elapsed = timer_get_ticks() - windows[i].anim_start;
+        uint64_t elapsed = anim_elapsed(windows[i].anim_start);
         int duration = get_anim_duration(windows[i].anim_type);
-        if ((int)elapsed < duration) continue;
+        if (elapsed < (uint64_t)duration * NS_PER_MS) continue;
         switch (windows[i].anim_type) {
         case ANIM_OPEN:
             windows[i].anim_type = ANIM_NONE;
@@ -1222,6 +1969,7 @@ void compositor_render_frame(void)
         case ANIM_CLOSE:
             if (windows[i].canvas) kfree(windows[i].canvas);
             windows[i].canvas = (void *)0;
+            deco_free(&deco_cache[i]);
             windows[i].active = 0;
             window_count--;
             break;
@@ -1240,32 +1988,110 @@ void compositor_render_frame(void)
         }
     }
 
-    /* Draw desktop */
-    desktop_draw_wallpaper();
+    start_menu_finish_anim();
+    clock_update();
+
+    /* Let apps redraw invalidated canvases (back to front, as before) */
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < MAX_WINDOWS; i++) {
+            if (windows[i].active && windows[i].focused == pass &&
+                windows[i].on_paint) {
+                uint64_t t = prof_now();
+                repaint_window(&windows[i]);
+                prof_window(i, 1, t);
+            }
+        }
+    }
 
-    /* Draw desktop icons */
-    draw_desktop_icons();
+    if (hud_visible && frame_now >= hud_refresh_at) {
+        prof_report(hud_text, sizeof(hud_text), 0);
+        hud_refresh_at = frame_now + HUD_REFRESH_MS * NS_PER_MS;
+    }
 
-    /* Draw windows (back to front) */
-    for (int i = 0; i < MAX_WINDOWS; i++) {
-        if (windows[i].active && !windows[i].focused) {
-            if (windows[i].on_paint) windows[i].on_paint(&windows[i]);
-            draw_window(&windows[i]);
-        }
+    compute_damage();
+
+    framebuffer_t *f = fb_get();
+    fb_rect_t screen = { 0, 0, (int)f->width, (int)f->height };
+
+    if (!fb_page_flipping())
+        flip_prev_count = 0;
+
+    /* Collapse to one full-screen pass when most of the screen is dirty */
+    uint64_t dirty_area = 0;
+    for (int i = 0; i < damage_count; i++)
+        dirty_area += rect_area(&damage_rects[i]);
+    for (int i = 0; i < flip_prev_count; i++)
+        dirty_area += rect_area(&flip_prev_rects[i]);
+    if (damage_full || dirty_area >= rect_area(&screen) * 3 / 4) {
+        damage_rects[0] = screen;
+        damage_count = 1;
+        damage_full = 0;
+        flip_prev_count = 0;
     }
-    /* Focused window on top */
-    for (int i = 0; i < MAX_WINDOWS; i++) {
-        if (windows[i].active && windows[i].focused) {
-            if (windows[i].on_paint) windows[i].on_paint(&windows[i]);
-            draw_window(&windows[i]);
+
+    /* Repainting under the cursor erases it: take its whole rect along
+     * so it can be redrawn cleanly on present.                         */
+    if (cursor_on_screen) {
+        fb_rect_t cr = cursor_bounds(cursor_drawn_x, cursor_drawn_y);
+        int hit = 0;
+        for (int i = 0; i < damage_count && !hit; i++)
+            hit = rect_intersects(&damage_rects[i], &cr);
+        for (int i = 0; i < flip_prev_count && !hit; i++)
+            hit = rect_intersects(&flip_prev_rects[i], &cr);
+        if (hit) {
+            damage_rect(&cr);
+            cursor_on_screen = 0;
         }
     }
 
-    /* Taskbar on top of everything */
-    desktop_draw_taskbar();
+    /* This frame's damage, plus catching the stale back page up where
+     * that was not just redrawn anyway                                */
+    fb_rect_t regions[MAX_DAMAGE_RECTS * 2];
+    int nregions = 0;
+    for (int i = 0; i < damage_count; i++)
+        regions[nregions++] = damage_rects[i];
+    for (int i = 0; i < flip_prev_count; i++) {
+        int covered = 0;
+        for (int j = 0; j < damage_count && !covered; j++)
+            covered = rect_contains(&damage_rects[j], &flip_prev_rects[i]);
+        if (!covered)
+            regions[nregions++] = flip_prev_rects[i];
+    }
+    render_regions(regions, nregions);
+}
 
-    /* Start menu above taskbar */
-    draw_start_menu();
+void compositor_present(int cursor_x, int cursor_y)
+{
+    /* Cursor moved since it was composited: restore the scene under it */
+    if (cursor_on_screen &&
+        (cursor_x != cursor_drawn_x || cursor_y != cursor_drawn_y)) {
+        fb_rect_t old = cursor_bounds(cursor_drawn_x, cursor_drawn_y);
+        render_region(&old);
+        damage_rect(&old);
+        cursor_on_screen = 0;
+    }
+
+    if (!cursor_on_screen) {
+        uint64_t t = prof_now();
+        compositor_draw_cursor(cursor_x, cursor_y);
+        prof_stage(PROF_CURSOR, t);
+        fb_rect_t cr = cursor_bounds(cursor_x, cursor_y);
+        damage_rect(&cr);
+        cursor_drawn_x = cursor_x;
+        cursor_drawn_y = cursor_y;
+        cursor_on_screen = 1;
+    }
+
+    uint64_t t = prof_now();
+    fb_swap_rects(damage_rects, damage_count);
+    prof_stage(PROF_SWAP, t);
+    if (fb_page_flipping()) {
+        for (int i = 0; i < damage_count; i++)
+            flip_prev_rects[i] = damage_rects[i];
+        flip_prev_count = damage_count;
+    }
+    prof_frame_end(damage_count > 0);
+    damage_count = 0;
 }
 
 /* ── Helper: find a window under (mx, my) — focused first ─────────────── */
@@ -1308,7 +2134,7 @@ static void resize_canvas(window_t *w, int new_w, int new_h)
 {
     int cw = new_w - BORDER_W * 2;
     int ch = new_h - BORDER_W * 2;
-    uint32_t *new_canvas = (uint32_t *)kmalloc(cw * ch * 4);
+    uint32_t *new_canvas = (uint32_t *)kmalloc_tagged(cw * ch * 4);
     if (new_canvas) {
         for (int p = 0; p < cw * ch; p++)
             new_canvas[p] = 0xF0F0F0;
@@ -1316,10 +2142,15 @@ static void resize_canvas(window_t *w, int new_w, int new_h)
         w->canvas = new_canvas;
         w->width = new_w;
         w->height = new_h;
+        compositor_invalidate_window(w, (void *)0);
     }
     /* If alloc failed, keep old canvas AND old dimensions */
 }
 
+/* Last pointer state forwarded to the focused window's on_mouse */
+static window_t *fwd_win = (void *)0;
+static int       fwd_x = 0, fwd_y = 0, fwd_buttons = 0;
+
 void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
 {
     current_scroll = scroll;
@@ -1355,11 +2186,11 @@ void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
             if (start_menu_anim != 1 && start_menu_anim != 2) {
                 if (start_menu_open) {
                     start_menu_anim = 2;
-                    start_menu_anim_start = timer_get_ticks();
+                    start_menu_anim_start = timer_now_ns();
                 } else {
                     start_menu_open = 1;
                     start_menu_anim = 1;
-                    start_menu_anim_start = timer_get_ticks();
+                    start_menu_anim_start = timer_now_ns();
                 }
             }
             return;
@@ -1373,7 +2204,7 @@ void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
                 if (mx >= bx && mx < bx + 120) {
                     if (windows[i].minimized) {
                         windows[i].anim_type = ANIM_UNMINIMIZE;
-                        windows[i].anim_start = timer_get_ticks();
+                        windows[i].anim_start = timer_now_ns();
                         windows[i].anim_from_x = bx;
                         windows[i].anim_from_y = (int)f->height - TASKBAR_H;
                         windows[i].anim_from_w = 120;
@@ -1394,8 +2225,8 @@ void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
 
         /* Start menu item hit test */
         if (start_menu_open && start_menu_anim != 2) {
-            int separator_h = 6;
-            int mh = START_MENU_ITEMS * START_MENU_ITEM_H + 8 + separator_h;
+            int separator_h = START_MENU_SEP_H;
+            int mh = START_MENU_H;
             int menu_x = 4;
             int menu_y = (int)f->height - TASKBAR_H - mh;
             if (mx >= menu_x && mx < menu_x + START_MENU_W &&
@@ -1411,14 +2242,14 @@ void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
                 }
                 if (item >= 0 && item < START_MENU_ITEMS) {
                     start_menu_anim = 2;
-                    start_menu_anim_start = timer_get_ticks();
+                    start_menu_anim_start = timer_now_ns();
                     if (start_menu_callback)
                         start_menu_callback(item);
                 }
                 return;
             }
             start_menu_anim = 2;
-            start_menu_anim_start = timer_get_ticks();
+            start_menu_anim_start = timer_now_ns();
         }
 
         /* Window hit-test: use z-order-aware helper (before desktop icons
@@ -1446,7 +2277,7 @@ void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
                     resize_canvas(w, w->orig_w, w->orig_h);
                     w->maximized = 0;
                     w->anim_type = ANIM_RESTORE;
-                    w->anim_start = timer_get_ticks();
+                    w->anim_start = timer_now_ns();
                     w->anim_from_x = from_x;
                     w->anim_from_y = from_y;
                     w->anim_from_w = from_w;
@@ -1464,7 +2295,7 @@ void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
                     int new_w = (int)f->width;
                     int new_h = (int)f->height - TASKBAR_H - TITLEBAR_H;
                     w->anim_type = ANIM_MAXIMIZE;
-                    w->anim_start = timer_get_ticks();
+                    w->anim_start = timer_now_ns();
                     w->anim_from_x = w->x;
                     w->anim_from_y = w->y;
                     w->anim_from_w = w->width;
@@ -1489,7 +2320,7 @@ void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
             if ((mx - min_cx) * (mx - min_cx) + (my - btn_y_center) * (my - btn_y_center) <= 49) {
                 w->focused = 0;
                 w->anim_type = ANIM_MINIMIZE;
-                w->anim_start = timer_get_ticks();
+                w->anim_start = timer_now_ns();
                 w->anim_from_x = w->x;
                 w->anim_from_y = w->y;
                 w->anim_from_w = w->width;
@@ -1524,6 +2355,7 @@ void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
                     int lx = mx - w->x - BORDER_W;
                     int ly = my - w->y - TITLEBAR_H - BORDER_W;
                     w->on_mouse(w, lx, ly, buttons);
+                    compositor_invalidate_window(w, (void *)0);
                 }
                 return;
             }
@@ -1567,16 +2399,27 @@ void compositor_handle_mouse(int mx, int my, int buttons, int scroll)
             int lx = mx - w->x - BORDER_W;
             int ly = my - w->y - TITLEBAR_H - BORDER_W;
             w->on_mouse(w, lx, ly, buttons);
+            compositor_invalidate_window(w, (void *)0);
             return;
         }
     }
 
-    /* Forward mouse move to focused window */
+    /* Forward mouse move to focused window.  This runs every frame (apps
+     * poll scroll state from it), but only real movement, button or
+     * scroll activity invalidates the canvas.                          */
     for (int i = 0; i < MAX_WINDOWS; i++) {
         if (windows[i].active && windows[i].focused && windows[i].on_mouse) {
             int lx = mx - windows[i].x - BORDER_W;
             int ly = my - windows[i].y - TITLEBAR_H - BORDER_W;
             windows[i].on_mouse(&windows[i], lx, ly, buttons);
+            if (&windows[i] != fwd_win || lx != fwd_x || ly != fwd_y ||
+                buttons != fwd_buttons || scroll != 0 ||
+                smooth_scroll_accum != 0 || smooth_scroll_output != 0)
+                compositor_invalidate_window(&windows[i], (void *)0);
+            fwd_win = &windows[i];
+            fwd_x = lx;
+            fwd_y = ly;
+            fwd_buttons = buttons;
         }
     }
 }
@@ -1592,6 +2435,7 @@ void compositor_handle_key(char ascii, int scancode, int pressed)
     for (int i = 0; i < MAX_WINDOWS; i++) {
         if (windows[i].active && windows[i].focused && windows[i].on_key) {
             windows[i].on_key(&windows[i], ascii, scancode, pressed);
+            compositor_invalidate_window(&windows[i], (void *)0);
             return;
         }
     }
@@ -1602,11 +2446,11 @@ void compositor_toggle_start_menu(void)
     if (start_menu_anim == 1 || start_menu_anim == 2) return;
     if (start_menu_open) {
         start_menu_anim = 2;
-        start_menu_anim_start = timer_get_ticks();
+        start_menu_anim_start = timer_now_ns();
     } else {
         start_menu_open = 1;
         start_menu_anim = 1;
-        start_menu_anim_start = timer_get_ticks();
+        start_menu_anim_start = timer_now_ns();
     }
 }
 
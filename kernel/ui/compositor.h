@@ -6,6 +6,7 @@
 #define NEXTOS_COMPOSITOR_H
 
 #include <stdint.h>
+#include "../gfx/framebuffer.h"
 
 /* ── Theme definitions ────────────────────────────────────────────────── */
 typedef enum {
@@ -46,13 +47,18 @@ struct window_s {
 
     /* Animation state */
     int      anim_type;
-    uint64_t anim_start;
+    uint64_t anim_start;         /* timer_now_ns() */
     int      anim_from_x, anim_from_y;
     int      anim_to_x, anim_to_y;
     int      anim_from_w, anim_from_h;
     int      anim_to_w, anim_to_h;
 
-    /* Callback: called each frame so the app can draw into canvas */
+    /* Repaint bookkeeping: on_paint only runs while the canvas is invalid */
+    int       canvas_valid;
+    fb_rect_t canvas_dirty;      /* Invalidated area, canvas coordinates */
+    uint64_t  repaint_at;        /* timer_now_ns of a scheduled invalidation, 0 = none */
+
+    /* Callback: called after the canvas was invalidated so the app can redraw it */
     void (*on_paint)(window_t *self);
     void (*on_key)(window_t *self, char ascii, int scancode, int pressed);
     void (*on_mouse)(window_t *self, int mx, int my, int buttons);
@@ -68,6 +74,8 @@ void      compositor_set_utc_offset(int hours);
 int       compositor_get_utc_offset(void);
 window_t *compositor_create_window(const char *title, int x, int y, int w, int h);
 void      compositor_destroy_window(window_t *win);
+void      compositor_invalidate_window(window_t *win, const fb_rect_t *rect);
+void      compositor_schedule_repaint(window_t *win, uint32_t ms);
 void      compositor_render_frame(void);
 void      compositor_handle_mouse(int mx, int my, int buttons, int scroll);
 int       compositor_get_scroll(void);
@@ -75,7 +83,11 @@ int       compositor_get_smooth_scroll(void);
 void      compositor_handle_key(char ascii, int scancode, int pressed);
 void      compositor_set_app_launcher(void (*callback)(int item));
 void      compositor_toggle_start_menu(void);
+void      compositor_toggle_hud(void);       /* Frame profiler overlay */
 void      compositor_draw_cursor(int x, int y);
+void      compositor_present(int cursor_x, int cursor_y);
+void      compositor_damage(int x, int y, int w, int h);
+void      compositor_damage_all(void);
 
 /* Desktop */
 void      desktop_draw_wallpaper(void);
@@ -0,0 +1,382 @@
+/*
+ * nextOS - profiler.c
+ * Per-stage frame-time profiler
+ *
+ * Each frame accumulates the time spent per compositor stage into the
+ * current record; finished frames go into a ring of the last
+ * PROF_HISTORY.  Stage times are summed over tiles, so with parallel
+ * rendering they are CPU time and may add up to more than the frame.
+ * Reports also summarise heap and page allocator usage, and the
+ * network driver, stack and capture counters.
+ */
+#include "profiler.h"
+#include "../mem/heap.h"
+#include "../mem/pmm.h"
+#include "../drivers/bcache.h"
+#include "../fs/dcache.h"
+#include "../drivers/net.h"
+#include "../net/net_stack.h"
+#include "../net/pcap.h"
+#include "../net/tls_crypto.h"
+
+typedef struct {
+    uint64_t total;
+    uint64_t stage[PROF_STAGE_COUNT];
+} prof_frame_t;
+
+static const char *stage_names[PROF_STAGE_COUNT] = {
+    "wallpaper", "icons", "on_paint", "windows", "taskbar",
+    "start menu", "hud", "cursor", "swap"
+};
+
+static prof_frame_t ring[PROF_HISTORY];
+static int          ring_head  = 0;
+static int          ring_count = 0;
+
+static prof_frame_t cur;
+static uint64_t     cur_start;
+static uint64_t     win_paint[PROF_MAX_WINDOWS], win_draw[PROF_MAX_WINDOWS];
+static uint64_t     last_paint[PROF_MAX_WINDOWS], last_draw[PROF_MAX_WINDOWS];
+
+/* ── Recording ────────────────────────────────────────────────────────── */
+void prof_frame_begin(void)
+{
+    for (int i = 0; i < PROF_STAGE_COUNT; i++) cur.stage[i] = 0;
+    for (int i = 0; i < PROF_MAX_WINDOWS; i++) win_paint[i] = win_draw[i] = 0;
+    cur_start = prof_now();
+}
+
+void prof_stage(prof_stage_t stage, uint64_t start)
+{
+    __atomic_fetch_add(&cur.stage[stage], prof_now() - start, __ATOMIC_RELAXED);
+}
+
+void prof_window(int index, int paint, uint64_t start)
+{
+    if (index < 0 || index >= PROF_MAX_WINDOWS) return;
+    uint64_t dt = prof_now() - start;
+    __atomic_fetch_add(paint ? &win_paint[index] : &win_draw[index], dt, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&cur.stage[paint ? PROF_PAINT : PROF_WINDOWS], dt, __ATOMIC_RELAXED);
+}
+
+void prof_frame_end(int drew)
+{
+    if (!drew) return;
+    cur.total = prof_now() - cur_start;
+    ring[ring_head] = cur;
+    ring_head = (ring_head + 1) % PROF_HISTORY;
+    if (ring_count < PROF_HISTORY) ring_count++;
+    for (int i = 0; i < PROF_MAX_WINDOWS; i++) {
+        last_paint[i] = win_paint[i];
+        last_draw[i]  = win_draw[i];
+    }
+}
+
+/* ── Report ───────────────────────────────────────────────────────────── */
+typedef struct {
+    char *buf;
+    int   cap, len;
+} out_t;
+
+static void put(out_t *o, const char *s)
+{
+    while (*s && o->len < o->cap - 1) o->buf[o->len++] = *s++;
+    o->buf[o->len] = 0;
+}
+
+static void put_uint(out_t *o, uint64_t v, int width)
+{
+    char tmp[24];
+    int n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    while (n < width) tmp[n++] = ' ';
+    char s[24];
+    for (int i = 0; i < n; i++) s[i] = tmp[n - 1 - i];
+    s[n] = 0;
+    put(o, s);
+}
+
+/* Milliseconds with three decimals, right-aligned */
+static void put_ms(out_t *o, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    put_uint(o, us / 1000, 3);
+    put(o, ".");
+    uint64_t frac = us % 1000;
+    char s[4] = { (char)('0' + frac / 100), (char)('0' + frac / 10 % 10),
+                  (char)('0' + frac % 10), 0 };
+    put(o, s);
+    put(o, " ms");
+}
+
+static void put_kib(out_t *o, uint64_t bytes, int width)
+{
+    put_uint(o, (bytes + 1023) / 1024, width);
+    put(o, " KiB");
+}
+
+static void put_pad(out_t *o, const char *s, int width)
+{
+    int n = 0;
+    while (s[n]) n++;
+    put(o, s);
+    for (; n < width; n++) put(o, " ");
+}
+
+int prof_report(char *buf, int cap, int detail)
+{
+    out_t o = { buf, cap, 0 };
+    if (cap <= 0) return 0;
+    buf[0] = 0;
+
+    /* Sorted frame totals for the percentiles */
+    uint64_t sorted[PROF_HISTORY];
+    uint64_t sum[PROF_STAGE_COUNT] = { 0 }, peak[PROF_STAGE_COUNT] = { 0 };
+    int n = ring_count;
+    for (int i = 0; i < n; i++) {
+        const prof_frame_t *f = &ring[i];
+        uint64_t v = f->total;
+        int j = i;
+        while (j > 0 && sorted[j - 1] > v) { sorted[j] = sorted[j - 1]; j--; }
+        sorted[j] = v;
+        for (int s = 0; s < PROF_STAGE_COUNT; s++) {
+            sum[s] += f->stage[s];
+            if (f->stage[s] > peak[s]) peak[s] = f->stage[s];
+        }
+    }
+
+    heap_stats_t hs;
+    pmm_stats_t ps;
+    heap_get_stats(&hs);
+    pmm_get_stats(&ps);
+    put(&o, "heap  ");  put_kib(&o, hs.live_bytes, 0);
+    put(&o, " peak ");  put_kib(&o, hs.peak_bytes, 0);   put(&o, "\n");
+    put(&o, "free  ");  put_kib(&o, hs.free_bytes, 0);
+    put(&o, " in ");    put_uint(&o, hs.free_blocks, 0);
+    put(&o, " max ");   put_kib(&o, hs.largest_free, 0); put(&o, "\n");
+    put(&o, "pages ");  put_uint(&o, ps.used_pages, 0);
+    put(&o, "/");       put_uint(&o, ps.total_pages, 0); put(&o, "\n");
+
+    put(&o, "frames ");
+    put_uint(&o, (uint64_t)n, 0);
+    put(&o, "\n");
+    if (n == 0) return o.len;
+
+    put(&o, "p50   "); put_ms(&o, sorted[n / 2]);            put(&o, "\n");
+    put(&o, "p99   "); put_ms(&o, sorted[(n * 99) / 100]);   put(&o, "\n");
+    put(&o, "max   "); put_ms(&o, sorted[n - 1]);            put(&o, "\n");
+    put(&o, "stage         avg        max\n");
+    for (int s = 0; s < PROF_STAGE_COUNT; s++) {
+        put_pad(&o, stage_names[s], 11);
+        put_ms(&o, sum[s] / (uint64_t)n);
+        put(&o, " ");
+        put_ms(&o, peak[s]);
+        put(&o, "\n");
+    }
+
+    if (detail) {
+        put(&o, "last frame  on_paint   draw_window\n");
+        for (int i = 0; i < PROF_MAX_WINDOWS; i++) {
+            if (!last_paint[i] && !last_draw[i]) continue;
+            put(&o, "window ");
+            put_uint(&o, (uint64_t)i, 2);
+            put(&o, " ");
+            put_ms(&o, last_paint[i]);
+            put(&o, " ");
+            put_ms(&o, last_draw[i]);
+            put(&o, "\n");
+        }
+    }
+    return o.len;
+}
+
+int prof_mem_report(char *buf, int cap)
+{
+    out_t o = { buf, cap, 0 };
+    if (cap <= 0) return 0;
+    buf[0] = 0;
+
+    heap_stats_t hs;
+    pmm_stats_t ps;
+    heap_get_stats(&hs);
+    pmm_get_stats(&ps);
+
+    put(&o, "[heap]\n");
+    put(&o, "size         "); put_kib(&o, hs.heap_size, 0);    put(&o, "\n");
+    put(&o, "live         "); put_kib(&o, hs.live_bytes, 0);
+    put(&o, " in ");          put_uint(&o, hs.live_allocs, 0); put(&o, " allocations\n");
+    put(&o, "peak         "); put_kib(&o, hs.peak_bytes, 0);   put(&o, "\n");
+    put(&o, "slabs        "); put_kib(&o, hs.slab_bytes, 0);   put(&o, "\n");
+    put(&o, "free         "); put_kib(&o, hs.free_bytes, 0);
+    put(&o, " in ");          put_uint(&o, hs.free_blocks, 0); put(&o, " blocks\n");
+    put(&o, "largest free "); put_kib(&o, hs.largest_free, 0); put(&o, "\n");
+    put(&o, "allocs       "); put_uint(&o, hs.total_allocs, 0);
+    put(&o, " frees ");       put_uint(&o, hs.total_frees, 0);
+    put(&o, " failed ");      put_uint(&o, hs.failed_allocs, 0); put(&o, "\n");
+
+    put(&o, "\n[slab classes]\n");
+    for (int i = 0; i < HEAP_SLAB_CLASSES; i++) {
+        put_uint(&o, 16ULL << i, 5);
+        put(&o, " B  ");
+        put_uint(&o, hs.class_live[i], 8);
+        put(&o, " live\n");
+    }
+
+    put(&o, "\n[live allocations by size]\n");
+    for (int i = 0; i < HEAP_HIST_BUCKETS; i++) {
+        if (!hs.size_hist[i]) continue;
+        put(&o, ">= ");
+        put_kib(&o, 16ULL << i, 6);
+        put(&o, "  ");
+        put_uint(&o, hs.size_hist[i], 8);
+        put(&o, "\n");
+    }
+
+    heap_site_t sites[HEAP_TRACE_SITES];
+    int nsites = heap_get_sites(sites, HEAP_TRACE_SITES);
+    put(&o, "\n[tagged call sites]\n");
+    for (int i = 0; i < nsites; i++) {
+        put(&o, sites[i].file);
+        put(&o, ":");
+        put_uint(&o, (uint64_t)sites[i].line, 0);
+        put(&o, "  ");
+        put_uint(&o, sites[i].live, 0);
+        put(&o, " live, ");
+        put_kib(&o, sites[i].bytes, 0);
+        put(&o, "\n");
+    }
+    if (hs.untraced) {
+        put(&o, "untraced     ");
+        put_uint(&o, hs.untraced, 0);
+        put(&o, "\n");
+    }
+
+    put(&o, "\n[pages]\n");
+    put(&o, "total        "); put_uint(&o, ps.total_pages, 0); put(&o, "\n");
+    put(&o, "used         "); put_uint(&o, ps.used_pages, 0);  put(&o, "\n");
+    put(&o, "peak         "); put_uint(&o, ps.peak_used, 0);   put(&o, "\n");
+    put(&o, "failed       "); put_uint(&o, ps.failed_allocs, 0); put(&o, "\n");
+    put(&o, "free blocks by order\n");
+    for (int i = 0; i <= PMM_MAX_ORDER; i++) {
+        put_kib(&o, (uint64_t)PAGE_SIZE << i, 6);
+        put(&o, "  ");
+        put_uint(&o, ps.free_blocks[i], 8);
+        put(&o, "\n");
+    }
+
+    bcache_stats_t bs;
+    bcache_get_stats(&bs);
+    put(&o, "\n[block cache]\n");
+    put(&o, "cached       "); put_uint(&o, bs.cached_blocks, 0);
+    put(&o, " blocks, ");     put_uint(&o, bs.dirty_blocks, 0); put(&o, " dirty\n");
+    put(&o, "hits         "); put_uint(&o, bs.hits, 0);
+    put(&o, " misses ");      put_uint(&o, bs.misses, 0);
+    put(&o, " bypassed ");    put_uint(&o, bs.bypassed, 0);
+    put(&o, " readahead ");   put_uint(&o, bs.readahead, 0);    put(&o, "\n");
+    put(&o, "evictions    "); put_uint(&o, bs.evictions, 0);
+    put(&o, " writebacks ");  put_uint(&o, bs.writebacks, 0);
+    put(&o, " errors ");      put_uint(&o, bs.write_errors, 0);
+    put(&o, " kept dirty ");  put_uint(&o, bs.evict_failures, 0); put(&o, "\n");
+
+    dcache_stats_t ds;
+    dcache_get_stats(&ds);
+    put(&o, "\n[dentry cache]\n");
+    put(&o, "cached       "); put_uint(&o, ds.entries, 0);
+    put(&o, " names in ");    put_uint(&o, ds.dirs, 0);     put(&o, " dirs\n");
+    put(&o, "hits         "); put_uint(&o, ds.hits, 0);
+    put(&o, " negative ");    put_uint(&o, ds.negative_hits, 0);
+    put(&o, " misses ");      put_uint(&o, ds.misses, 0);   put(&o, "\n");
+    put(&o, "dir fills    "); put_uint(&o, ds.dir_fills, 0);
+    put(&o, " evictions ");   put_uint(&o, ds.evictions, 0); put(&o, "\n");
+    return o.len;
+}
+
+int prof_net_report(char *buf, int cap)
+{
+    out_t o = { buf, cap, 0 };
+    if (cap <= 0) return 0;
+    buf[0] = 0;
+
+    net_stats_t ns;
+    net_get_stats(&ns);
+    put(&o, "[driver]\n");
+    put(&o, "rx           "); put_uint(&o, ns.rx_frames, 0);
+    put(&o, " frames, ");     put_kib(&o, ns.rx_bytes, 0);      put(&o, "\n");
+    put(&o, "tx           "); put_uint(&o, ns.tx_frames, 0);
+    put(&o, " frames, ");     put_kib(&o, ns.tx_bytes, 0);      put(&o, "\n");
+    put(&o, "rx dropped   "); put_uint(&o, ns.rx_missed, 0);
+    put(&o, " ring full, ");  put_uint(&o, ns.rx_no_buf, 0);    put(&o, " no buffer\n");
+    put(&o, "tx ring full "); put_uint(&o, ns.tx_ring_full, 0); put(&o, "\n");
+    put(&o, "csum offload "); put_uint(&o, ns.rx_csum_hw, 0);
+    put(&o, " rx, ");         put_uint(&o, ns.tx_csum_hw, 0);   put(&o, " tx\n");
+    put(&o, "interrupts   "); put_uint(&o, ns.interrupts, 0);   put(&o, "\n");
+    put(&o, "free buffers "); put_uint(&o, ns.netbufs_free, 0); put(&o, "\n");
+
+    net_stack_stats_t ss;
+    net_stack_get_stats(&ss);
+    put(&o, "\n[ip]\n");
+    put(&o, "bad checksum "); put_uint(&o, ss.rx_bad_csum, 0);  put(&o, "\n");
+    put(&o, "arp misses   "); put_uint(&o, ss.arp_misses, 0);
+    put(&o, " failed ");      put_uint(&o, ss.arp_failures, 0); put(&o, "\n");
+    put(&o, "udp no port  "); put_uint(&o, ss.rx_no_port, 0);   put(&o, "\n");
+    put(&o, "loopback     "); put_uint(&o, ss.loopback_packets, 0); put(&o, "\n");
+
+    put(&o, "\n[tcp]\n");
+    put(&o, "segments     "); put_uint(&o, ss.tcp_segs_in, 0);
+    put(&o, " in, ");         put_uint(&o, ss.tcp_segs_out, 0); put(&o, " out\n");
+    put(&o, "no socket    "); put_uint(&o, ss.rx_no_socket, 0); put(&o, "\n");
+    put(&o, "out of order "); put_uint(&o, ss.tcp_ooo, 0);
+    put(&o, " dropped ");     put_uint(&o, ss.tcp_ooo_full, 0); put(&o, "\n");
+    put(&o, "duplicate    "); put_uint(&o, ss.tcp_dup, 0);      put(&o, "\n");
+    put(&o, "rx ring full "); put_uint(&o, ss.tcp_rx_full, 0);  put(&o, "\n");
+    put(&o, "retransmits  "); put_uint(&o, ss.tcp_retransmits, 0);
+    put(&o, " fast ");        put_uint(&o, ss.tcp_fast_retransmits, 0);
+    put(&o, " timeouts ");    put_uint(&o, ss.tcp_timeouts, 0); put(&o, "\n");
+
+    uint64_t answered = ss.dns_queries - ss.dns_failures;
+    put(&o, "\n[dns]\n");
+    put(&o, "queries      "); put_uint(&o, ss.dns_queries, 0);
+    put(&o, " failed ");      put_uint(&o, ss.dns_failures, 0);
+    put(&o, " cached ");      put_uint(&o, ss.dns_cache_hits, 0); put(&o, "\n");
+    put(&o, "latency      ");
+    put_uint(&o, answered ? ss.dns_total_ms / answered : 0, 0);
+    put(&o, " ms avg, ");     put_uint(&o, ss.dns_last_ms, 0);
+    put(&o, " last, ");       put_uint(&o, ss.dns_max_ms, 0);   put(&o, " max\n");
+
+    put(&o, "\n[tls]\n");
+    put(&o, "handshakes   "); put_uint(&o, ss.tls_full_handshakes, 0);
+    put(&o, " full, ");       put_uint(&o, ss.tls_resumed, 0);  put(&o, " resumed\n");
+
+    pcap_stats_t ps;
+    pcap_get_stats(&ps);
+    put(&o, "\n[capture]\n");
+    put(&o, ps.active ? "recording    " : "stopped      ");
+    put_uint(&o, ps.held, 0);
+    put(&o, " frames held, "); put_kib(&o, ps.bytes, 0);        put(&o, "\n");
+    put(&o, "captured     "); put_uint(&o, ps.frames, 0);
+    put(&o, " overwritten "); put_uint(&o, ps.overwritten, 0);  put(&o, "\n");
+    return o.len;
+}
+
+int prof_crypto_report(char *buf, int cap)
+{
+    out_t o = { buf, cap, 0 };
+    if (cap <= 0) return 0;
+    buf[0] = 0;
+
+    tls_bench_t b;
+    tls_crypto_bench(&b);
+    put(&o, "[tls handshake crypto]\n");
+    put(&o, "rsa-2048 encrypt  "); put_ms(&o, b.rsa2048_ns);    put(&o, "\n");
+    put(&o, "rsa-4096 encrypt  "); put_ms(&o, b.rsa4096_ns);    put(&o, "\n");
+    put(&o, "prf x4            "); put_ms(&o, b.prf_ns);        put(&o, "\n");
+    put(&o, "sha-256 16 KiB    "); put_ms(&o, b.sha256_16k_ns); put(&o, "\n");
+    put(&o, "full handshake    "); put_ms(&o, b.handshake_ns);  put(&o, "\n");
+    put(&o, "\n[tls record, 16 KiB]\n");
+    put(&o, "aes-cbc + hmac    "); put_ms(&o, b.cbc_16k_ns);    put(&o, "\n");
+    put(&o, "aes-gcm           "); put_ms(&o, b.gcm_16k_ns);    put(&o, "\n");
+    put(&o, "aes-ni  "); put(&o, b.aesni ? "yes" : "no");
+    put(&o, "  pclmulqdq  "); put(&o, b.pclmul ? "yes" : "no");
+    put(&o, "  sha-ni  "); put(&o, b.shani ? "yes" : "no");   put(&o, "\n");
+    return o.len;
+}
@@ -0,0 +1,53 @@
+/*
+ * nextOS - profiler.h
+ * Per-stage frame-time profiler for the compositor, plus memory and network reports
+ */
+#ifndef NEXTOS_PROFILER_H
+#define NEXTOS_PROFILER_H
+
+#include <stdint.h>
+#include "../drivers/timer.h"
+
+typedef enum {
+    PROF_WALLPAPER = 0,
+    PROF_ICONS,
+    PROF_PAINT,        /* Apps' on_paint callbacks */
+    PROF_WINDOWS,      /* draw_window              */
+    PROF_TASKBAR,
+    PROF_START_MENU,
+    PROF_HUD,
+    PROF_CURSOR,
+    PROF_SWAP,         /* fb_swap_rects            */
+    PROF_STAGE_COUNT
+} prof_stage_t;
+
+#define PROF_HISTORY      128   /* Frames kept in the ring */
+#define PROF_MAX_WINDOWS  16    /* Matches MAX_WINDOWS     */
+
+/* Timestamps are timer_now_ns() values.  Stage and window times may be
+ * recorded from any CPU while tiles render in parallel.               */
+static inline uint64_t prof_now(void)
+{
+    return timer_now_ns();
+}
+
+void prof_frame_begin(void);
+void prof_stage(prof_stage_t stage, uint64_t start);
+void prof_window(int index, int paint, uint64_t start);
+/* Frames that drew nothing are dropped so idle loops do not mask cost */
+void prof_frame_end(int drew);
+
+/* Plain-text report; detail adds per-window times of the last frame.
+ * Returns the length written (always NUL-terminated).               */
+int  prof_report(char *buf, int cap, int detail);
+
+/* Heap and page allocator usage, histograms and tagged call sites */
+int  prof_mem_report(char *buf, int cap);
+
+/* NIC, protocol and packet capture counters */
+int  prof_net_report(char *buf, int cap);
+
+/* Runs tls_crypto_bench() and reports it (takes a few milliseconds) */
+int  prof_crypto_report(char *buf, int cap);
+
+#endif /* NEXTOS_PROFILER_H */
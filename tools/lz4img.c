@@ -0,0 +1,182 @@
+/*
+ * nextOS - lz4img.c
+ * Host tool: pack a raw disk image into the chunked LZ4 install format
+ * read by kernel/fs/diskimg.c.
+ *
+ *   lz4img <raw.img> <packed.img>
+ *
+ * Every 64 KiB chunk becomes one independent LZ4 block (greedy matcher,
+ * one hash probe per position), is stored as it is when that does not
+ * make it smaller, or is dropped entirely when it is all zeros.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGIC          0x344C584E   /* "NXL4" */
+#define VERSION        1
+#define STORED         0x80000000u
+#define CHUNK_SECTORS  128
+#define CHUNK_BYTES    (CHUNK_SECTORS * 512)
+
+#define MIN_MATCH      4
+#define MF_LIMIT       12   /* No match starts in the last 12 bytes   */
+#define LAST_LITERALS  5    /* ... or ends in the last 5              */
+#define HASH_BITS      16
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t hash4(const uint8_t *p)
+{
+    return (get32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, uint32_t len)
+{
+    while (len >= 255) { *op++ = 255; len -= 255; }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *lit, uint32_t lit_len,
+                             uint32_t offset, uint32_t match_len)
+{
+    uint32_t ml = match_len ? match_len - MIN_MATCH : 0;
+    *op++ = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+    if (lit_len >= 15) op = put_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (!match_len) return op;
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    if (ml >= 15) op = put_length(op, ml - 15);
+    return op;
+}
+
+/* Compress in[0, len) as one LZ4 block; out needs len + len / 255 + 16 */
+static uint32_t lz4_compress(const uint8_t *in, uint32_t len, uint8_t *out)
+{
+    static int32_t table[1 << HASH_BITS];
+    for (uint32_t i = 0; i < (1u << HASH_BITS); i++) table[i] = -1;
+
+    uint8_t *op = out;
+    uint32_t anchor = 0, ip = 0;
+    uint32_t match_end_limit = len > LAST_LITERALS ? len - LAST_LITERALS : 0;
+
+    while (len >= MF_LIMIT && ip + MF_LIMIT <= len) {
+        uint32_t h = hash4(in + ip);
+        int32_t cand = table[h];
+        table[h] = (int32_t)ip;
+
+        if (cand < 0 || ip - (uint32_t)cand > 65535 ||
+            get32(in + cand) != get32(in + ip)) {
+            ip++;
+            continue;
+        }
+
+        uint32_t m = MIN_MATCH;
+        while (ip + m < match_end_limit && in[cand + m] == in[ip + m]) m++;
+
+        op = put_sequence(op, in + anchor, ip - anchor, ip - (uint32_t)cand, m);
+        for (uint32_t k = ip + 1; k < ip + m && k + 4 <= len; k += 2)
+            table[hash4(in + k)] = (int32_t)k;
+        ip += m;
+        anchor = ip;
+    }
+    op = put_sequence(op, in + anchor, len - anchor, 0, 0);
+    return (uint32_t)(op - out);
+}
+
+static int all_zero(const uint8_t *p, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+        if (p[i]) return 0;
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <raw.img> <packed.img>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) { perror(argv[1]); return 1; }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0 || size % 512) {
+        fprintf(stderr, "%s: size is not a whole number of sectors\n", argv[1]);
+        return 1;
+    }
+    uint8_t *raw = malloc((size_t)size + 1);
+    if (!raw || fread(raw, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    FILE *o = fopen(argv[2], "wb");
+    if (!o) { perror(argv[2]); return 1; }
+
+    uint32_t sectors = (uint32_t)(size / 512);
+    uint32_t chunks = (sectors + CHUNK_SECTORS - 1) / CHUNK_SECTORS;
+    uint8_t hdr[32] = { 0 };
+    put32(hdr + 0, MAGIC);
+    put32(hdr + 4, VERSION);
+    put32(hdr + 8, sectors);
+    put32(hdr + 12, CHUNK_SECTORS);
+    put32(hdr + 16, chunks);
+    fwrite(hdr, 1, sizeof(hdr), o);
+
+    static uint8_t packed[CHUNK_BYTES + CHUNK_BYTES / 255 + 16];
+    uint32_t zero = 0, stored = 0;
+    long total = sizeof(hdr);
+    for (uint32_t c = 0; c < chunks; c++) {
+        const uint8_t *in = raw + (size_t)c * CHUNK_BYTES;
+        uint32_t len = (uint32_t)(size - (long)c * CHUNK_BYTES);
+        if (len > CHUNK_BYTES) len = CHUNK_BYTES;
+
+        uint8_t word[4];
+        if (all_zero(in, len)) {
+            put32(word, 0);
+            fwrite(word, 1, 4, o);
+            zero++;
+            total += 4;
+            continue;
+        }
+        uint32_t n = lz4_compress(in, len, packed);
+        if (n >= len) {
+            put32(word, STORED | len);
+            fwrite(word, 1, 4, o);
+            fwrite(in, 1, len, o);
+            stored++;
+            total += 4 + len;
+        } else {
+            put32(word, n);
+            fwrite(word, 1, 4, o);
+            fwrite(packed, 1, n, o);
+            total += 4 + n;
+        }
+    }
+    if (fclose(o) != 0) { perror(argv[2]); return 1; }
+
+    printf("Packed %s: %ld -> %ld bytes (%u chunks, %u zero, %u stored)\n",
+           argv[2], size, total, chunks, zero, stored);
+    free(raw);
+    return 0;
+}
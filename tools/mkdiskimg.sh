@@ -4,15 +4,18 @@
 # Creates a bootable disk image containing GRUB + the nextOS kernel.
 # This image is embedded into the ISO kernel so the installer can
 # write it to a target disk, making the disk independently bootable.
+# Given the lz4img packer, the output is packed with it (chunked LZ4,
+# see kernel/fs/diskimg.h); without it the raw image is written.
 # ─────────────────────────────────────────────────────────────────────────────
 set -e
 
 KERNEL_ELF="$1"          # Path to the (first-pass) kernel ELF
 OUTPUT_IMG="$2"           # Output disk image path
 GRUB_CFG="$3"             # Path to grub.cfg
+PACKER="$4"               # Optional: tools/lz4img
 
 if [ -z "$KERNEL_ELF" ] || [ -z "$OUTPUT_IMG" ] || [ -z "$GRUB_CFG" ]; then
-    echo "Usage: $0 <kernel.elf> <output.img> <grub.cfg>" >&2
+    echo "Usage: $0 <kernel.elf> <output.img> <grub.cfg> [lz4img]" >&2
     exit 1
 fi
 
@@ -80,9 +83,13 @@ sudo grub-bios-setup \
 
 sudo losetup -d "${LOOP}"
 
-# ── Step 6: Copy result ─────────────────────────────────────────────────
-cp "${DISK_IMG}" "${OUTPUT_IMG}"
-
-IMG_SIZE=$(wc -c < "${OUTPUT_IMG}")
+# ── Step 6: Pack or copy result ─────────────────────────────────────────
+IMG_SIZE=$(wc -c < "${DISK_IMG}")
 IMG_SECTORS=$((IMG_SIZE / 512))
-echo "Disk image created: ${OUTPUT_IMG} (${IMG_SIZE} bytes, ${IMG_SECTORS} sectors)"
+if [ -n "$PACKER" ]; then
+    "$PACKER" "${DISK_IMG}" "${OUTPUT_IMG}"
+else
+    cp "${DISK_IMG}" "${OUTPUT_IMG}"
+fi
+
+echo "Disk image created: ${OUTPUT_IMG} (${IMG_SECTORS} sectors, $(wc -c < "${OUTPUT_IMG}") bytes embedded)"